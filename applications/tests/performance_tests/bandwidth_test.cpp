@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -30,19 +31,21 @@ struct exp_result {
     uint num_messages;
     uint delivery_mode;
     double bw;
+    // whether the senders took turns with DERECHO/rdmc_send_token
+    bool send_token;
 
     void print(std::ofstream &fout) {
         fout << num_nodes << " " << num_senders_selector << " "
              << max_msg_size << " " << window_size << " "
              << num_messages << " " << delivery_mode << " "
-             << bw << endl;
+             << bw << " " << send_token << endl;
     }
 };
 
 int main(int argc, char *argv[]) {
     if(argc < 5) {
         cout << "Insufficient number of command line arguments" << endl;
-        cout << "Enter num_nodes, num_senders_selector (0 - all senders, 1 - half senders, 2 - one sender), num_messages, delivery_mode (0 - ordered mode, 1 - unordered mode)" << endl;
+        cout << "Enter num_nodes, num_senders_selector (0 - all senders, 1 - half senders, 2 - one sender), num_messages, delivery_mode (0 - ordered mode, 1 - unordered mode, 2 - per-sender FIFO mode, 3 - leader-sequenced mode), [msg_size (default - max_payload_size)]" << endl;
         cout << "Thank you" << endl;
         return -1;
     }
@@ -53,6 +56,9 @@ int main(int argc, char *argv[]) {
     const uint num_senders_selector = std::stoi(argv[2]);
     const uint num_messages = std::stoi(argv[3]);
     const uint delivery_mode = std::stoi(argv[4]);
+    // read before Conf::initialize, since getopt may permute argv
+    const long long unsigned int requested_msg_size
+            = (argc >= 6 && argv[5][0] != '-') ? std::stoull(argv[5]) : 0;
 
     Conf::initialize(argc, argv);
 
@@ -84,8 +90,12 @@ int main(int argc, char *argv[]) {
     };
 
     Mode mode = Mode::ORDERED;
-    if(delivery_mode) {
+    if(delivery_mode == 1) {
         mode = Mode::UNORDERED;
+    } else if(delivery_mode == 2) {
+        mode = Mode::FIFO;
+    } else if(delivery_mode == 3) {
+        mode = Mode::SEQUENCED;
     }
 
     auto membership_function = [num_senders_selector, mode, num_nodes](const View &curr_view, int &next_unassigned_rank) {
@@ -136,7 +146,12 @@ int main(int argc, char *argv[]) {
     cout << endl;
 
     long long unsigned int max_msg_size = getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE);
-    
+    // an explicit message size lets small-message runs exercise SST multicast
+    // without changing max_payload_size
+    if(requested_msg_size) {
+        max_msg_size = std::min(max_msg_size, requested_msg_size);
+    }
+
     auto send_all = [&]() {
         RawSubgroup &group_as_subgroup = managed_group.get_subgroup<RawObject>();
         for(uint i = 0; i < num_messages; ++i) {
@@ -181,7 +196,7 @@ int main(int argc, char *argv[]) {
     if(node_rank == 0) {
         log_results(exp_result{num_nodes, num_senders_selector, max_msg_size,
                                getConfUInt32(CONF_DERECHO_WINDOW_SIZE), num_messages,
-                               delivery_mode, avg_bw},
+                               delivery_mode, avg_bw, getConfBoolean(CONF_DERECHO_RDMC_SEND_TOKEN)},
                     "data_derecho_bw");
     }
 
@@ -0,0 +1,93 @@
+#ifndef BENCHMARK_RESULTS_H
+#define BENCHMARK_RESULTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * The outcome of one run of a benchmark scenario, written as a single line of
+ * JSON so that the runs of a release can be appended to one file and compared
+ * with those of another release by any JSON tool.
+ */
+class BenchmarkResult {
+    std::string scenario;
+    /** The settings the run used, already rendered as JSON values */
+    std::vector<std::pair<std::string, std::string>> parameters;
+    std::vector<std::pair<std::string, double>> measurements;
+
+    static std::string quote(const std::string& s) {
+        std::string quoted = "\"";
+        for(char c : s) {
+            if(c == '"' || c == '\\') {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+public:
+    BenchmarkResult(const std::string& scenario) : scenario(scenario) {}
+
+    void add_parameter(const std::string& name, const std::string& value) {
+        parameters.emplace_back(name, quote(value));
+    }
+    void add_parameter(const std::string& name, uint64_t value) {
+        parameters.emplace_back(name, std::to_string(value));
+    }
+    void add_measurement(const std::string& name, double value) {
+        measurements.emplace_back(name, value);
+    }
+
+    std::string to_json() const {
+        std::ostringstream json;
+        json.precision(12);
+        json << "{\"scenario\": " << quote(scenario) << ", \"parameters\": {";
+        for(std::size_t i = 0; i < parameters.size(); ++i) {
+            json << (i ? ", " : "") << quote(parameters[i].first) << ": " << parameters[i].second;
+        }
+        json << "}, \"measurements\": {";
+        for(std::size_t i = 0; i < measurements.size(); ++i) {
+            json << (i ? ", " : "") << quote(measurements[i].first) << ": " << measurements[i].second;
+        }
+        json << "}}";
+        return json.str();
+    }
+
+    /** Appends the result to a file, as one line. */
+    void append_to(const std::string& filename) const {
+        std::ofstream fout(filename, std::ofstream::app);
+        fout << to_json() << std::endl;
+    }
+};
+
+/**
+ * Adds the usual percentiles of some latencies to a result, as
+ * <name>_p50_us and so on.
+ * @param latencies_ns The latencies in nanoseconds, which this sorts
+ */
+inline void add_percentiles(BenchmarkResult& result, const std::string& name, std::vector<uint64_t>& latencies_ns) {
+    if(latencies_ns.empty()) {
+        return;
+    }
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile = [&latencies_ns](double fraction) {
+        return latencies_ns[std::min(latencies_ns.size() - 1, static_cast<std::size_t>(fraction * latencies_ns.size()))] / 1000.0;
+    };
+    double total_ns = 0;
+    for(uint64_t latency : latencies_ns) {
+        total_ns += latency;
+    }
+    result.add_measurement(name + "_mean_us", total_ns / latencies_ns.size() / 1000.0);
+    result.add_measurement(name + "_p50_us", percentile(0.5));
+    result.add_measurement(name + "_p90_us", percentile(0.9));
+    result.add_measurement(name + "_p99_us", percentile(0.99));
+    result.add_measurement(name + "_p999_us", percentile(0.999));
+    result.add_measurement(name + "_max_us", latencies_ns.back() / 1000.0);
+}
+#endif
@@ -0,0 +1,725 @@
+/**
+ * @file derecho_benchmark.cpp
+ *
+ * One driver for the benchmarks that track Derecho's performance between
+ * releases. Every node of the group runs it with the same arguments; the
+ * node with rank 0 appends one JSON line per run to the output file.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aggregate_bandwidth.h"
+#include "benchmark_results.h"
+#include "bytes_object.h"
+#include "conf/conf.hpp"
+#include "conf/fault_injection.hpp"
+#include "derecho/derecho.h"
+#include "derecho/latency_stats.h"
+#include "derecho/metrics.h"
+#include <mutils-serialization/SerializationSupport.hpp>
+#include <persistent/Persistent.hpp>
+
+using std::cout;
+using std::endl;
+using namespace derecho;
+
+/** The replicated state of the p2p_query and state_transfer scenarios. */
+class BenchObject : public mutils::ByteRepresentable {
+    std::vector<char> state;
+
+public:
+    uint64_t echo(const uint64_t& value) {
+        return value;
+    }
+
+    BenchObject(const std::vector<char>& state = {}) : state(state) {}
+
+    DEFAULT_SERIALIZATION_SUPPORT(BenchObject, state);
+    REGISTER_RPC_FUNCTIONS(BenchObject, echo);
+};
+
+/** The replicated state of the persistence scenario. */
+class PersistentBenchObject : public mutils::ByteRepresentable, public PersistsFields {
+public:
+    Persistent<Bytes> log;
+
+    void append(const Bytes& bytes) {
+        *log = bytes;
+    }
+
+    PersistentBenchObject(Persistent<Bytes>& log) : log(std::move(log)) {}
+    PersistentBenchObject(PersistentRegistry* pr) : log(nullptr, pr) {}
+
+    DEFAULT_SERIALIZATION_SUPPORT(PersistentBenchObject, log);
+    REGISTER_RPC_FUNCTIONS(PersistentBenchObject, append);
+};
+
+using BenchGroup = Group<BenchObject, PersistentBenchObject>;
+
+/** The name=value arguments of a run, with the defaults of the ones left out. */
+struct BenchmarkOptions {
+    std::string scenario;
+    uint32_t num_nodes;
+    /** all, half or one */
+    std::string senders = "all";
+    /** Bytes per message; 0 means max_payload_size */
+    uint64_t size = 0;
+    /** Messages per sender, or queries */
+    uint64_t count = 10000;
+    /** Bytes of replicated state a joining node receives */
+    uint64_t state_size = 100 * 1024 * 1024;
+    /** The first offered load of the open-loop scenarios, in queries per second */
+    uint64_t rate = 1000;
+    /** How much the offered load grows each step */
+    uint64_t rate_step = 1000;
+    /** The most steps to run before giving up on finding the knee */
+    uint64_t steps = 20;
+    /** Seconds per step, or of sending after the fault */
+    uint64_t duration = 5;
+    /** The fault of the fault_injection scenario: drop_puts, delay_puts,
+     * stall_persistence or freeze_sender */
+    std::string fault = "drop_puts";
+    /** Seconds of sending before the fault is injected */
+    uint64_t fault_after = 2;
+    /** How long a delay, stall or freeze lasts, in milliseconds */
+    uint64_t fault_ms = 1000;
+    /** The delay of each SST write in delay_puts, in microseconds */
+    uint64_t delay_us = 100;
+    std::string output = "derecho_benchmark.json";
+};
+
+void print_usage(const char* program) {
+    cout << "usage: " << program << " <scenario> <num_nodes> [name=value ...] [Derecho options]" << endl
+         << "scenarios:" << endl
+         << "  ordered_send    senders=all|half|one size=<bytes> count=<messages per sender>" << endl
+         << "  p2p_query       count=<queries>; rank 0 queries rank 1" << endl
+         << "  persistence     senders=all|half|one size=<bytes> count=<messages per sender>;" << endl
+         << "                  needs DERECHO/latency_stats = true" << endl
+         << "  view_change     the last node leaves; the others time the view change" << endl
+         << "  state_transfer  state_size=<bytes>; start the last node after the others" << endl
+         << "  open_loop_p2p, open_loop_ordered" << endl
+         << "                  rate=<queries/s> rate_step=<queries/s> steps=<n> duration=<s>;" << endl
+         << "                  rank 0 sends p2p_query to rank 1, or ordered_query to the" << endl
+         << "                  shard, at a Poisson rate that grows each step until it saturates" << endl
+         << "  fault_injection fault=drop_puts|delay_puts|stall_persistence|freeze_sender" << endl
+         << "                  fault_after=<s> fault_ms=<ms> delay_us=<us> duration=<s> size=<bytes>;" << endl
+         << "                  every node sends until duration seconds after the fault hits the" << endl
+         << "                  last node, and rank 0 reports the throughput dip and the time to" << endl
+         << "                  the new view; drop_puts makes the others drop their SST writes to" << endl
+         << "                  the last node, so it is reported as failed after DERECHO/timeout_ms" << endl
+         << "every scenario takes output=<file> (default derecho_benchmark.json)" << endl;
+}
+
+/** Parses the arguments before Conf::initialize, since getopt may permute argv. */
+bool parse_options(int argc, char* argv[], BenchmarkOptions& options) {
+    if(argc < 3) {
+        return false;
+    }
+    options.scenario = argv[1];
+    options.num_nodes = std::stoul(argv[2]);
+    for(int i = 3; i < argc && argv[i][0] != '-'; ++i) {
+        const std::string arg = argv[i];
+        const std::size_t equals = arg.find('=');
+        if(equals == std::string::npos) {
+            return false;
+        }
+        const std::string name = arg.substr(0, equals);
+        const std::string value = arg.substr(equals + 1);
+        if(name == "senders") {
+            options.senders = value;
+        } else if(name == "size") {
+            options.size = std::stoull(value);
+        } else if(name == "count") {
+            options.count = std::stoull(value);
+        } else if(name == "state_size") {
+            options.state_size = std::stoull(value);
+        } else if(name == "rate") {
+            options.rate = std::stoull(value);
+        } else if(name == "rate_step") {
+            options.rate_step = std::stoull(value);
+        } else if(name == "steps") {
+            options.steps = std::stoull(value);
+        } else if(name == "duration") {
+            options.duration = std::stoull(value);
+        } else if(name == "fault") {
+            options.fault = value;
+        } else if(name == "fault_after") {
+            options.fault_after = std::stoull(value);
+        } else if(name == "fault_ms") {
+            options.fault_ms = std::stoull(value);
+        } else if(name == "delay_us") {
+            options.delay_us = std::stoull(value);
+        } else if(name == "output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+    }
+    return options.num_nodes >= 2 && options.rate > 0 && options.duration > 0 && options.fault_after > 0
+           && (options.senders == "all" || options.senders == "half" || options.senders == "one")
+           && (options.fault == "drop_puts" || options.fault == "delay_puts"
+               || options.fault == "stall_persistence" || options.fault == "freeze_sender");
+}
+
+/** Marks the senders of a shard of all the members, as selected by the senders option. */
+std::vector<int> select_senders(const std::string& senders, std::size_t num_members) {
+    std::vector<int> is_sender(num_members, 1);
+    if(senders == "half") {
+        for(std::size_t i = 0; i <= (num_members - 1) / 2; ++i) {
+            is_sender[i] = 0;
+        }
+    } else if(senders == "one") {
+        for(std::size_t i = 0; i < num_members - 1; ++i) {
+            is_sender[i] = 0;
+        }
+    }
+    return is_sender;
+}
+
+uint32_t count_senders(const std::vector<int>& is_sender) {
+    return std::count(is_sender.begin(), is_sender.end(), 1);
+}
+
+/**
+ * Places one subgroup of the given type on the first num_nodes members of
+ * the view, or none if the scenario doesn't use the type.
+ */
+shard_view_generator_t one_shard_of(uint32_t num_nodes, bool used, Mode mode = Mode::ORDERED,
+                                    std::vector<int> is_sender = {}) {
+    return [=](const View& curr_view, int& next_unassigned_rank) {
+        if(!used) {
+            return subgroup_shard_layout_t{};
+        }
+        if(curr_view.num_members < static_cast<int32_t>(num_nodes)) {
+            throw subgroup_provisioning_exception();
+        }
+        subgroup_shard_layout_t subgroup_vector(1);
+        std::vector<node_id_t> members(curr_view.members.begin(), curr_view.members.begin() + num_nodes);
+        subgroup_vector[0].emplace_back(curr_view.make_subview(members, mode, is_sender));
+        next_unassigned_rank = std::max(next_unassigned_rank, static_cast<int>(num_nodes));
+        return subgroup_vector;
+    };
+}
+
+/** Returns this node's rank in the group. */
+uint32_t my_rank(BenchGroup& group) {
+    const std::vector<node_id_t> members = group.get_members();
+    const node_id_t my_id = getConfUInt32(CONF_DERECHO_LOCAL_ID);
+    return std::distance(members.begin(), std::find(members.begin(), members.end(), my_id));
+}
+
+void add_common_parameters(BenchmarkResult& result, const BenchmarkOptions& options) {
+    result.add_parameter("num_nodes", options.num_nodes);
+    result.add_parameter("window_size", getConfUInt64(CONF_DERECHO_WINDOW_SIZE));
+    result.add_parameter("max_payload_size", getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE));
+    result.add_parameter("rdma_provider", getConfString(CONF_RDMA_PROVIDER));
+}
+
+void add_latency_stats(BenchmarkResult& result, const LatencyStats& stats) {
+    const char* stage_names[] = {"received", "stable", "delivered", "persisted"};
+    for(std::size_t stage = 0; stage < num_latency_stages; ++stage) {
+        if(stats[stage].count > 0) {
+            result.add_measurement(std::string(stage_names[stage]) + "_p50_us", stats[stage].p50 / 1000.0);
+            result.add_measurement(std::string(stage_names[stage]) + "_p99_us", stats[stage].p99 / 1000.0);
+        }
+    }
+}
+
+void add_histogram(BenchmarkResult& result, const std::string& name, const LatencyHistogram& histogram) {
+    const LatencySummary summary = histogram.summarize();
+    result.add_measurement(name + "_mean_us", summary.mean / 1000.0);
+    result.add_measurement(name + "_p50_us", summary.p50 / 1000.0);
+    result.add_measurement(name + "_p99_us", summary.p99 / 1000.0);
+    result.add_measurement(name + "_p999_us", summary.p999 / 1000.0);
+    result.add_measurement(name + "_max_us", summary.max / 1000.0);
+}
+
+/** Ordered multicasts of a raw subgroup: bandwidth across the group. */
+void run_ordered_send(const BenchmarkOptions& options) {
+    const std::vector<int> is_sender = select_senders(options.senders, options.num_nodes);
+    const uint64_t total_messages = options.count * count_senders(is_sender);
+    std::atomic<bool> done(false);
+    uint64_t num_delivered = 0;
+    auto stability_callback = [&](uint32_t subgroup, int sender_id, long long int index, char* buf, long long int msg_size) {
+        // null message filter
+        if(msg_size == 0) {
+            return;
+        }
+        if(++num_delivered == total_messages) {
+            done = true;
+        }
+    };
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(RawObject)), one_shard_of(options.num_nodes, true, Mode::ORDERED, is_sender)},
+                                {std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes, false)},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, false)}},
+                               {std::type_index(typeid(RawObject)), std::type_index(typeid(BenchObject)),
+                                std::type_index(typeid(PersistentBenchObject))}};
+    BenchGroup group(CallbackSet{stability_callback}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    const uint32_t rank = my_rank(group);
+    uint64_t msg_size = getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE);
+    if(options.size) {
+        msg_size = std::min(msg_size, options.size);
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+    if(is_sender[rank]) {
+        RawSubgroup& raw_subgroup = group.get_subgroup<RawObject>();
+        for(uint64_t i = 0; i < options.count; ++i) {
+            while(!raw_subgroup.get_sendbuffer_ptr(msg_size)) {
+            }
+            raw_subgroup.send();
+        }
+    }
+    while(!done) {
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const double bandwidth = msg_size * total_messages / seconds;
+    const double avg_bandwidth = aggregate_bandwidth(group.get_members(), getConfUInt32(CONF_DERECHO_LOCAL_ID), bandwidth);
+    if(rank == 0) {
+        BenchmarkResult result("ordered_send");
+        add_common_parameters(result, options);
+        result.add_parameter("senders", options.senders);
+        result.add_parameter("message_size", msg_size);
+        result.add_parameter("messages_per_sender", options.count);
+        result.add_measurement("bandwidth_bytes_per_second", avg_bandwidth);
+        result.add_measurement("messages_per_second", total_messages / seconds);
+        add_latency_stats(result, group.get_latency_stats<RawObject>());
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** Round trips of p2p_query from rank 0 to rank 1. */
+void run_p2p_query(const BenchmarkOptions& options) {
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes, true)},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, false)}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    BenchGroup group(CallbackSet{}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    if(my_rank(group) == 0) {
+        Replicated<BenchObject>& handle = group.get_subgroup<BenchObject>();
+        const node_id_t target = group.get_members()[1];
+        std::vector<uint64_t> latencies_ns;
+        latencies_ns.reserve(options.count);
+        const auto start_time = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < options.count; ++i) {
+            const auto send_time = std::chrono::steady_clock::now();
+            handle.p2p_query<RPC_NAME(echo)>(target, i).get().get(target);
+            latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           std::chrono::steady_clock::now() - send_time)
+                                           .count());
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        BenchmarkResult result("p2p_query");
+        add_common_parameters(result, options);
+        result.add_parameter("queries", options.count);
+        result.add_measurement("queries_per_second", options.count / seconds);
+        add_percentiles(result, "latency", latencies_ns);
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** Ordered sends to a persistent object: the time from each send until
+ * the shard has persisted it, taken from the latency stats. */
+void run_persistence(const BenchmarkOptions& options) {
+    if(!getConfBoolean(CONF_DERECHO_LATENCY_STATS)) {
+        std::cerr << "The persistence scenario needs DERECHO/latency_stats = true" << endl;
+        return;
+    }
+    const std::vector<int> is_sender = select_senders(options.senders, options.num_nodes);
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes, false)},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, true, Mode::ORDERED, is_sender)}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    BenchGroup group(CallbackSet{}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    const uint32_t rank = my_rank(group);
+    // leave room for the RPC header in the payload
+    const uint64_t bytes_size = std::min<uint64_t>(options.size ? options.size : 1024,
+                                                   getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE) - 128);
+    const std::vector<char> payload(bytes_size, 'b');
+    const Bytes bytes(payload.data(), payload.size());
+    Replicated<PersistentBenchObject>& handle = group.get_subgroup<PersistentBenchObject>();
+
+    const auto start_time = std::chrono::steady_clock::now();
+    if(is_sender[rank]) {
+        for(uint64_t i = 0; i < options.count; ++i) {
+            handle.ordered_send<RPC_NAME(append)>(bytes);
+        }
+    }
+    const uint64_t total_messages = options.count * count_senders(is_sender);
+    // wait until this node has seen every message persisted
+    while(group.get_latency_stats<PersistentBenchObject>()[static_cast<int>(LatencyStage::PERSISTED)].count < total_messages) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    if(rank == 0) {
+        BenchmarkResult result("persistence");
+        add_common_parameters(result, options);
+        result.add_parameter("senders", options.senders);
+        result.add_parameter("message_size", bytes_size);
+        result.add_parameter("messages_per_sender", options.count);
+        result.add_measurement("persisted_messages_per_second", total_messages / seconds);
+        add_latency_stats(result, group.get_latency_stats<PersistentBenchObject>());
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** The last node leaves, and the others time the view change that removes it. */
+void run_view_change(const BenchmarkOptions& options) {
+    // one subgroup over whoever is left, so the smaller view stays adequate
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes - 1, true)},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, false)}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    BenchGroup group(CallbackSet{}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    while(group.get_members().size() < options.num_nodes) {
+    }
+    const uint32_t rank = my_rank(group);
+    // recorded by the ViewManager for every view change it installs
+    MetricCounter& view_change_time_us = MetricsRegistry::get().counter(
+            "derecho_view_change_microseconds_total", "Time from wedging each view to installing the next one");
+    const uint64_t time_before_us = view_change_time_us.value();
+    group.barrier_sync();
+    if(rank == options.num_nodes - 1) {
+        group.leave();
+        return;
+    }
+    const auto leave_time = std::chrono::steady_clock::now();
+    while(group.get_members().size() == options.num_nodes) {
+    }
+    const double seconds_to_new_view = std::chrono::duration<double>(std::chrono::steady_clock::now() - leave_time).count();
+    if(rank == 0) {
+        BenchmarkResult result("view_change");
+        add_common_parameters(result, options);
+        result.add_measurement("view_change_us", view_change_time_us.value() - time_before_us);
+        result.add_measurement("time_to_new_view_us", seconds_to_new_view * 1e6);
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** The last node joins a subgroup with state_size bytes of state; its
+ * Group constructor covers both the join and the state transfer. */
+void run_state_transfer(const BenchmarkOptions& options) {
+    // the subgroup starts with the other nodes, and takes the last one when it joins
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), [num_nodes = options.num_nodes](const View& curr_view, int& next_unassigned_rank) {
+                                     return one_shard_of(std::min<uint32_t>(curr_view.num_members, num_nodes), true)(curr_view, next_unassigned_rank);
+                                 }},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, false)}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    const uint64_t state_size = options.state_size;
+    const auto start_time = std::chrono::steady_clock::now();
+    BenchGroup group(CallbackSet{}, subgroup_info, {},
+                     [state_size](PersistentRegistry*) { return std::make_unique<BenchObject>(std::vector<char>(state_size)); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    while(group.get_members().size() < options.num_nodes) {
+    }
+    const uint32_t rank = my_rank(group);
+    if(rank == options.num_nodes - 1) {
+        BenchmarkResult result("state_transfer");
+        add_common_parameters(result, options);
+        result.add_parameter("state_size", state_size);
+        result.add_measurement("join_us", seconds * 1e6);
+        result.add_measurement("bandwidth_bytes_per_second", state_size / seconds);
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** What one step of an open-loop run has seen; shared with the reply callbacks. */
+struct OpenLoopStep {
+    LatencyHistogram latencies;
+    std::atomic<uint64_t> completed{0};
+    std::atomic<int64_t> last_completion_ns{0};
+};
+
+/**
+ * Queries from rank 0 at a fixed offered rate with Poisson arrivals, stepping
+ * the rate up until the group can't keep up. Unlike the closed-loop
+ * p2p_query scenario, each query is sent at a time drawn in advance and its
+ * latency is measured from that time, so when the sender falls behind the
+ * backlog counts against the latency instead of hiding it.
+ */
+void run_open_loop(const BenchmarkOptions& options, bool ordered) {
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes, true)},
+                                {std::type_index(typeid(PersistentBenchObject)), one_shard_of(options.num_nodes, false)}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    BenchGroup group(CallbackSet{}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    if(my_rank(group) == 0) {
+        using clock = std::chrono::steady_clock;
+        Replicated<BenchObject>& handle = group.get_subgroup<BenchObject>();
+        const node_id_t target = group.get_members()[1];
+        std::mt19937_64 random_engine(getConfUInt32(CONF_DERECHO_LOCAL_ID));
+        // Queries whose replies never came in time, kept until the group
+        // leaves in case they still arrive
+        std::vector<rpc::QueryResults<uint64_t>> abandoned;
+        uint64_t rate = options.rate;
+        for(uint64_t step_num = 0; step_num < options.steps; ++step_num, rate += options.rate_step) {
+            auto step = std::make_shared<OpenLoopStep>();
+            std::vector<rpc::QueryResults<uint64_t>> in_flight;
+            std::exponential_distribution<double> interarrival(static_cast<double>(rate));
+            const auto start_time = clock::now();
+            const auto end_time = start_time + std::chrono::seconds(options.duration);
+            auto send_time = start_time;
+            uint64_t sent = 0;
+            while(true) {
+                send_time += std::chrono::duration_cast<clock::duration>(
+                        std::chrono::duration<double>(interarrival(random_engine)));
+                if(send_time >= end_time) {
+                    break;
+                }
+                std::this_thread::sleep_until(send_time);
+                auto results = ordered ? handle.ordered_query<RPC_NAME(echo)>(sent)
+                                       : handle.p2p_query<RPC_NAME(echo)>(target, sent);
+                auto record_reply = [step, send_time]() {
+                    const auto now = clock::now();
+                    step->latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - send_time).count());
+                    step->last_completion_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+                    step->completed++;
+                };
+                if(!results.notifier->set_waiter(record_reply)) {
+                    record_reply();
+                }
+                in_flight.emplace_back(std::move(results));
+                ++sent;
+            }
+            // Whatever is still queued once the offered load stops is part
+            // of this step's latency, so wait for it before moving on
+            const auto drain_deadline = clock::now() + std::chrono::seconds(10 + options.duration);
+            while(step->completed < sent && clock::now() < drain_deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            const uint64_t completed = step->completed;
+            const double seconds = (step->last_completion_ns
+                                    - std::chrono::duration_cast<std::chrono::nanoseconds>(start_time.time_since_epoch()).count())
+                                   / 1e9;
+            const double achieved_rate = completed > 0 ? completed / seconds : 0;
+            // Saturated once the group falls measurably behind the offered load
+            const bool saturated = completed < sent || achieved_rate < 0.95 * sent / options.duration;
+
+            BenchmarkResult result(ordered ? "open_loop_ordered" : "open_loop_p2p");
+            add_common_parameters(result, options);
+            result.add_parameter("offered_rate", rate);
+            result.add_parameter("duration_seconds", options.duration);
+            result.add_measurement("queries_sent", sent);
+            result.add_measurement("queries_completed", completed);
+            result.add_measurement("achieved_queries_per_second", achieved_rate);
+            result.add_measurement("saturated", saturated ? 1 : 0);
+            add_histogram(result, "latency", step->latencies);
+            result.append_to(options.output);
+            cout << "offered " << rate << " queries/s, achieved " << achieved_rate
+                 << ", p99 " << step->latencies.summarize().p99 / 1000.0 << " us" << endl;
+
+            if(completed < sent) {
+                std::move(in_flight.begin(), in_flight.end(), std::back_inserter(abandoned));
+            }
+            if(saturated) {
+                cout << "Saturated at " << rate << " queries/s" << endl;
+                break;
+            }
+        }
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+void run_open_loop_p2p(const BenchmarkOptions& options) {
+    run_open_loop(options, false);
+}
+
+void run_open_loop_ordered(const BenchmarkOptions& options) {
+    run_open_loop(options, true);
+}
+
+/**
+ * Every node sends ordered appends to a persistent subgroup while a fault is
+ * injected into the last node, or into the others' writes to it, and rank 0
+ * samples how many messages it delivers every 100 ms. The throughput before
+ * the fault is the baseline; the dip is how far it falls after the fault,
+ * and for how long. drop_puts should end in a view without the last node.
+ */
+void run_fault_injection(const BenchmarkOptions& options) {
+    using clock = std::chrono::steady_clock;
+    // the subgroup shrinks with the view, so dropping the last node leaves it adequate
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(BenchObject)), one_shard_of(options.num_nodes, false)},
+                                {std::type_index(typeid(PersistentBenchObject)), [num_nodes = options.num_nodes](const View& curr_view, int& next_unassigned_rank) {
+                                     return one_shard_of(std::min<uint32_t>(curr_view.num_members, num_nodes), true)(curr_view, next_unassigned_rank);
+                                 }}},
+                               {std::type_index(typeid(BenchObject)), std::type_index(typeid(PersistentBenchObject))}};
+    std::atomic<uint64_t> num_delivered(0);
+    std::atomic<int64_t> last_persisted_ns(0);
+    auto stability_callback = [&](uint32_t, int, long long int, char*, long long int) {
+        num_delivered++;
+    };
+    auto persistence_callback = [&](subgroup_id_t, persistent::version_t) {
+        last_persisted_ns = clock::now().time_since_epoch().count();
+    };
+    BenchGroup group(CallbackSet{stability_callback, persistence_callback}, subgroup_info, {},
+                     [](PersistentRegistry*) { return std::make_unique<BenchObject>(); },
+                     [](PersistentRegistry* pr) { return std::make_unique<PersistentBenchObject>(pr); });
+    while(group.get_members().size() < options.num_nodes) {
+    }
+    const uint32_t rank = my_rank(group);
+    const node_id_t faulty_node = group.get_members()[options.num_nodes - 1];
+    const bool is_faulty_node = rank == options.num_nodes - 1;
+    const uint64_t bytes_size = std::min<uint64_t>(options.size ? options.size : 1024,
+                                                   getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE) - 128);
+    const std::vector<char> payload(bytes_size, 'b');
+    const Bytes bytes(payload.data(), payload.size());
+    group.barrier_sync();
+
+    const auto start_time = clock::now();
+    const auto fault_time = start_time + std::chrono::seconds(options.fault_after);
+    const auto end_time = fault_time + std::chrono::seconds(options.duration);
+    std::atomic<bool> sending(true);
+    std::thread fault_thread([&]() {
+        std::this_thread::sleep_until(fault_time);
+        FaultInjector& fault_injector = FaultInjector::get();
+        if(options.fault == "drop_puts" && !is_faulty_node) {
+            fault_injector.drop_puts_to(faulty_node);
+        } else if(options.fault == "delay_puts" && !is_faulty_node) {
+            fault_injector.delay_puts_to(faulty_node, options.delay_us);
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.fault_ms));
+            fault_injector.delay_puts_to(faulty_node, 0);
+        } else if(options.fault == "stall_persistence" && is_faulty_node) {
+            fault_injector.stall_persistence(options.fault_ms);
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.fault_ms));
+            fault_injector.stall_persistence(0);
+        } else if(options.fault == "freeze_sender" && is_faulty_node) {
+            fault_injector.freeze_sender(options.fault_ms);
+        }
+    });
+    // rank 0 samples its deliveries, and times the view change if there is one
+    std::vector<uint64_t> delivered_per_sample;
+    std::optional<clock::duration> time_to_new_view;
+    int64_t max_persistence_gap_ns = 0;
+    std::thread sampler_thread;
+    if(rank == 0) {
+        sampler_thread = std::thread([&]() {
+            uint64_t last_delivered = 0;
+            auto sample_time = start_time;
+            while(sending) {
+                sample_time += std::chrono::milliseconds(100);
+                std::this_thread::sleep_until(sample_time);
+                const uint64_t delivered = num_delivered;
+                delivered_per_sample.push_back(delivered - last_delivered);
+                last_delivered = delivered;
+                if(sample_time > fault_time) {
+                    max_persistence_gap_ns = std::max(max_persistence_gap_ns,
+                                                      sample_time.time_since_epoch().count() - last_persisted_ns);
+                }
+                if(!time_to_new_view && group.get_members().size() < options.num_nodes) {
+                    time_to_new_view = clock::now() - fault_time;
+                }
+            }
+        });
+    }
+    // a node the others drop stops sending, since it is about to be removed
+    if(!(is_faulty_node && options.fault == "drop_puts")) {
+        Replicated<PersistentBenchObject>& handle = group.get_subgroup<PersistentBenchObject>();
+        while(clock::now() < end_time) {
+            handle.ordered_send<RPC_NAME(append)>(bytes);
+        }
+    } else {
+        std::this_thread::sleep_until(end_time);
+    }
+    sending = false;
+    fault_thread.join();
+    if(sampler_thread.joinable()) {
+        sampler_thread.join();
+    }
+    if(rank == 0) {
+        const std::size_t fault_sample = options.fault_after * 10;
+        double baseline = 0;
+        // skip the first second, while the senders get going
+        for(std::size_t i = std::min<std::size_t>(10, fault_sample / 2); i < fault_sample; ++i) {
+            baseline += delivered_per_sample[i];
+        }
+        baseline /= (fault_sample - std::min<std::size_t>(10, fault_sample / 2)) / 10.0;
+        double min_after_fault = baseline;
+        // how long after the fault the throughput stayed under 90% of the baseline
+        std::size_t last_slow_sample = fault_sample;
+        for(std::size_t i = fault_sample; i < delivered_per_sample.size(); ++i) {
+            min_after_fault = std::min(min_after_fault, delivered_per_sample[i] * 10.0);
+            if(delivered_per_sample[i] * 10.0 < 0.9 * baseline) {
+                last_slow_sample = i + 1;
+            }
+        }
+        BenchmarkResult result("fault_injection");
+        add_common_parameters(result, options);
+        result.add_parameter("fault", options.fault);
+        result.add_parameter("fault_after_seconds", options.fault_after);
+        result.add_parameter("fault_ms", options.fault_ms);
+        result.add_parameter("delay_us", options.delay_us);
+        result.add_parameter("timeout_ms", getConfUInt64(CONF_DERECHO_TIMEOUT_MS));
+        result.add_parameter("message_size", bytes_size);
+        result.add_measurement("baseline_messages_per_second", baseline);
+        result.add_measurement("min_messages_per_second", min_after_fault);
+        result.add_measurement("dip_ms", (last_slow_sample - fault_sample) * 100.0);
+        result.add_measurement("max_persistence_gap_ms", max_persistence_gap_ns / 1e6);
+        if(time_to_new_view) {
+            result.add_measurement("time_to_new_view_us",
+                                   std::chrono::duration_cast<std::chrono::microseconds>(*time_to_new_view).count());
+        }
+        result.append_to(options.output);
+    }
+    if(is_faulty_node && options.fault == "drop_puts") {
+        // removed from the group by now, so there is no one to leave
+        return;
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    if(!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    pthread_setname_np(pthread_self(), "benchmark");
+    Conf::initialize(argc, argv);
+
+    const std::map<std::string, void (*)(const BenchmarkOptions&)> scenarios = {
+            {"ordered_send", run_ordered_send},
+            {"p2p_query", run_p2p_query},
+            {"persistence", run_persistence},
+            {"view_change", run_view_change},
+            {"state_transfer", run_state_transfer},
+            {"open_loop_p2p", run_open_loop_p2p},
+            {"open_loop_ordered", run_open_loop_ordered},
+            {"fault_injection", run_fault_injection}};
+    auto scenario = scenarios.find(options.scenario);
+    if(scenario == scenarios.end()) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    scenario->second(options);
+    return 0;
+}
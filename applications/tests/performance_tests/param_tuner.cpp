@@ -0,0 +1,543 @@
+/**
+ * @file param_tuner.cpp
+ *
+ * Recommends the DerechoParams of a workload by measuring candidates on the
+ * cluster itself. Every node of the group runs it with the same arguments,
+ * and each writes the recommended settings to the same configuration file,
+ * commented with the throughput and latency measured with them; the node
+ * with rank 0 also appends one JSON line per trial to the trials file.
+ *
+ * The settings are tuned one at a time, each trial keeping the best values
+ * found so far for the others: max_smc_payload_size, window_size, and then
+ * block_size and rdmc_send_algorithm if some messages are too large for SMC,
+ * for each shard size, and at the end tx_depth and rx_depth with the largest
+ * shard. max_payload_size is the largest message size. A candidate that
+ * needs more registered memory than the budget is skipped, which is what
+ * max_registered_memory makes the group do.
+ *
+ * Each trial is a new group in a new process, since Conf is fixed once it is
+ * read: the tuner runs itself as "param_tuner trial ..." with the trial's
+ * settings on the command line. The nodes run the same trials in the same
+ * order, and a node that starts a trial before the leader waits for it in
+ * the join, as usual.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark_results.h"
+#include "conf/conf.hpp"
+#include "derecho/derecho.h"
+#include "derecho/latency_stats.h"
+
+using std::cout;
+using std::endl;
+using namespace derecho;
+
+/** The exit code of a trial whose settings need more registered memory than the budget */
+constexpr int trial_did_not_fit = 3;
+/** The user SST fields a trial's rank 0 publishes its measurements in, the
+ * last of which it sets once the others are written */
+constexpr uint32_t num_result_fields = 5;
+
+/** The name=value arguments, with the defaults of the ones left out. */
+struct TunerOptions {
+    uint32_t num_nodes;
+    /** The sizes argument, which is passed on to the trials */
+    std::string sizes_arg = "10240";
+    /** Message sizes in bytes, each with the fraction of the messages of that size */
+    std::vector<std::pair<uint64_t, double>> sizes = {{10240, 1.0}};
+    /** The shard sizes to tune for; just the number of nodes if empty */
+    std::vector<uint32_t> shard_sizes;
+    /** The registered memory budget of each node in bytes, 0 for none */
+    uint64_t memory = 0;
+    /** Messages per sender per trial */
+    uint64_t count = 10000;
+    /** all, half or one */
+    std::string senders = "all";
+    /** throughput, or latency (the p99 of delivery) */
+    std::string objective = "throughput";
+    std::vector<uint64_t> window_sizes = {8, 16, 32, 64};
+    std::vector<uint64_t> block_sizes = {262144, 1048576, 4194304};
+    std::vector<std::string> algorithms = {"binomial_send", "chain_send", "sequential_send", "tree_send"};
+    std::vector<uint64_t> depths = {256, 1024};
+    std::string output = "tuned.cfg";
+    std::string trials = "param_tuner.json";
+    /** The shard size of a trial */
+    uint32_t shard_size = 0;
+    /** The file a trial writes its measurements to */
+    std::string result = "param_tuner.result";
+    /** The Derecho options (--SECTION/name=value), which are passed on to the trials */
+    std::vector<std::string> derecho_args;
+};
+
+/** The settings of one trial. */
+struct Candidate {
+    uint64_t max_payload_size;
+    uint64_t max_smc_payload_size;
+    uint64_t window_size;
+    uint64_t block_size;
+    std::string rdmc_send_algorithm;
+    /** Both tx_depth and rx_depth */
+    uint64_t depth;
+};
+
+struct Measurement {
+    bool fits = false;
+    double bytes_per_second = 0;
+    double messages_per_second = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+};
+
+void print_usage(const char* program) {
+    cout << "usage: " << program << " <num_nodes> [name=value ...] [Derecho options]" << endl
+         << "  sizes=<bytes>[:<fraction>],...    the message sizes of the workload (default 10240)" << endl
+         << "  shard_sizes=<n>,...              the shard sizes to tune for (default num_nodes)" << endl
+         << "  memory=<bytes>                   the registered memory budget of a node (default none)" << endl
+         << "  count=<messages>                 messages per sender per trial (default 10000)" << endl
+         << "  senders=all|half|one             the senders of each shard (default all)" << endl
+         << "  objective=throughput|latency     what to optimize; latency is the p99 of delivery" << endl
+         << "  window_sizes=, block_sizes=, algorithms=, depths=" << endl
+         << "                                   the values to try, separated by commas" << endl
+         << "  output=<file>                    the recommended configuration (default tuned.cfg)" << endl
+         << "  trials=<file>                    a JSON line per trial (default param_tuner.json)" << endl;
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<uint64_t> split_numbers(const std::string& list) {
+    std::vector<uint64_t> numbers;
+    for(const std::string& item : split(list)) {
+        numbers.push_back(std::stoull(item));
+    }
+    return numbers;
+}
+
+/** Parses the arguments after the number of nodes, before Conf::initialize,
+ * since getopt may permute argv. */
+bool parse_options(int argc, char* argv[], int first, TunerOptions& options) {
+    if(argc <= first) {
+        return false;
+    }
+    options.num_nodes = std::stoul(argv[first]);
+    int i = first + 1;
+    for(; i < argc && argv[i][0] != '-'; ++i) {
+        const std::string arg = argv[i];
+        const std::size_t equals = arg.find('=');
+        if(equals == std::string::npos) {
+            return false;
+        }
+        const std::string name = arg.substr(0, equals);
+        const std::string value = arg.substr(equals + 1);
+        if(name == "sizes") {
+            options.sizes_arg = value;
+            options.sizes.clear();
+            for(const std::string& item : split(value)) {
+                const std::size_t colon = item.find(':');
+                options.sizes.emplace_back(std::stoull(item.substr(0, colon)),
+                                           colon == std::string::npos ? 1.0 : std::stod(item.substr(colon + 1)));
+            }
+        } else if(name == "shard_sizes") {
+            for(uint64_t shard_size : split_numbers(value)) {
+                options.shard_sizes.push_back(shard_size);
+            }
+        } else if(name == "memory") {
+            options.memory = std::stoull(value);
+        } else if(name == "count") {
+            options.count = std::stoull(value);
+        } else if(name == "senders") {
+            options.senders = value;
+        } else if(name == "objective") {
+            options.objective = value;
+        } else if(name == "window_sizes") {
+            options.window_sizes = split_numbers(value);
+        } else if(name == "block_sizes") {
+            options.block_sizes = split_numbers(value);
+        } else if(name == "algorithms") {
+            options.algorithms = split(value);
+        } else if(name == "depths") {
+            options.depths = split_numbers(value);
+        } else if(name == "output") {
+            options.output = value;
+        } else if(name == "trials") {
+            options.trials = value;
+        } else if(name == "shard_size") {
+            options.shard_size = std::stoul(value);
+        } else if(name == "result") {
+            options.result = value;
+        } else {
+            return false;
+        }
+    }
+    options.derecho_args.assign(argv + i, argv + argc);
+    if(options.shard_sizes.empty()) {
+        options.shard_sizes.push_back(options.num_nodes);
+    }
+    std::sort(options.shard_sizes.begin(), options.shard_sizes.end());
+    return options.num_nodes >= 2 && !options.sizes.empty() && options.count > 0
+           && options.shard_sizes.front() >= 1 && options.shard_sizes.back() <= options.num_nodes
+           && !options.window_sizes.empty() && !options.block_sizes.empty()
+           && !options.algorithms.empty() && !options.depths.empty()
+           && (options.senders == "all" || options.senders == "half" || options.senders == "one")
+           && (options.objective == "throughput" || options.objective == "latency");
+}
+
+/** Marks the senders of a shard of all the members, as selected by the senders option. */
+std::vector<int> select_senders(const std::string& senders, std::size_t num_members) {
+    std::vector<int> is_sender(num_members, 1);
+    if(senders == "half") {
+        for(std::size_t i = 0; i <= (num_members - 1) / 2; ++i) {
+            is_sender[i] = 0;
+        }
+    } else if(senders == "one") {
+        for(std::size_t i = 0; i < num_members - 1; ++i) {
+            is_sender[i] = 0;
+        }
+    }
+    return is_sender;
+}
+
+/**
+ * Runs one trial, in the process the tuner started for it: every sender of a
+ * shard of the first shard_size members sends count messages with sizes drawn
+ * from the workload, and rank 0 times their delivery and shares what it
+ * measured with the nodes outside the shard, in its user SST fields.
+ * @return 0, or trial_did_not_fit
+ */
+int run_trial(const TunerOptions& options) {
+    const std::vector<int> is_sender = select_senders(options.senders, options.shard_size);
+    const uint64_t total_messages = options.count * std::count(is_sender.begin(), is_sender.end(), 1);
+    std::atomic<bool> done(false);
+    uint64_t num_delivered = 0;
+    uint64_t bytes_delivered = 0;
+    auto stability_callback = [&](uint32_t subgroup, int sender_id, long long int index, char* buf, long long int msg_size) {
+        // null message filter
+        if(msg_size == 0) {
+            return;
+        }
+        bytes_delivered += msg_size;
+        if(++num_delivered == total_messages) {
+            done = true;
+        }
+    };
+    const uint32_t shard_size = options.shard_size;
+    auto shard_of_first_members = [shard_size, is_sender](const View& curr_view, int& next_unassigned_rank) {
+        if(curr_view.num_members < static_cast<int32_t>(shard_size)) {
+            throw subgroup_provisioning_exception();
+        }
+        subgroup_shard_layout_t subgroup_vector(1);
+        std::vector<node_id_t> members(curr_view.members.begin(), curr_view.members.begin() + shard_size);
+        subgroup_vector[0].emplace_back(curr_view.make_subview(members, Mode::ORDERED, is_sender));
+        next_unassigned_rank = std::max(next_unassigned_rank, static_cast<int>(shard_size));
+        return subgroup_vector;
+    };
+    std::map<std::type_index, shard_view_generator_t> subgroup_map = {{std::type_index(typeid(RawObject)), shard_of_first_members}};
+    SubgroupInfo subgroup_info(subgroup_map);
+    std::unique_ptr<Group<>> group;
+    try {
+        group = std::make_unique<Group<>>(CallbackSet{stability_callback}, subgroup_info);
+    } catch(const derecho_exception& e) {
+        std::cerr << e.what() << endl;
+        return trial_did_not_fit;
+    }
+    while(group->get_members().size() < options.num_nodes) {
+    }
+    const std::vector<node_id_t> members = group->get_members();
+    const uint32_t rank = std::distance(members.begin(),
+                                        std::find(members.begin(), members.end(), getConfUInt32(CONF_DERECHO_LOCAL_ID)));
+
+    const auto start_time = std::chrono::steady_clock::now();
+    if(rank < shard_size && is_sender[rank]) {
+        std::vector<double> weights;
+        for(const auto& size : options.sizes) {
+            weights.push_back(size.second);
+        }
+        std::mt19937 generator(rank);
+        std::discrete_distribution<std::size_t> pick_size(weights.begin(), weights.end());
+        RawSubgroup& raw_subgroup = group->get_subgroup<RawObject>();
+        for(uint64_t i = 0; i < options.count; ++i) {
+            const uint64_t msg_size = options.sizes[pick_size(generator)].first;
+            while(!raw_subgroup.get_sendbuffer_ptr(msg_size)) {
+            }
+            raw_subgroup.send();
+        }
+    }
+    if(rank == 0) {
+        while(!done) {
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        const LatencySummary& delivered = group->get_latency_stats<RawObject>()[static_cast<int>(LatencyStage::DELIVERED)];
+        const double values[num_result_fields - 1] = {bytes_delivered / seconds, num_delivered / seconds,
+                                                      delivered.p50 / 1000.0, delivered.p99 / 1000.0};
+        for(uint32_t field = 0; field < num_result_fields - 1; ++field) {
+            uint64_t bits;
+            memcpy(&bits, &values[field], sizeof(bits));
+            group->set_user_sst_field(field, bits);
+        }
+        group->set_user_sst_field(num_result_fields - 1, 1);
+
+        BenchmarkResult result("param_tuner_trial");
+        result.add_parameter("num_nodes", options.num_nodes);
+        result.add_parameter("shard_size", shard_size);
+        result.add_parameter("senders", options.senders);
+        result.add_parameter("sizes", options.sizes_arg);
+        result.add_parameter("messages_per_sender", options.count);
+        result.add_parameter("max_payload_size", getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE));
+        result.add_parameter("max_smc_payload_size", getConfUInt64(CONF_DERECHO_MAX_SMC_PAYLOAD_SIZE));
+        result.add_parameter("window_size", getConfUInt64(CONF_DERECHO_WINDOW_SIZE));
+        result.add_parameter("block_size", getConfUInt64(CONF_DERECHO_BLOCK_SIZE));
+        result.add_parameter("rdmc_send_algorithm", getConfString(CONF_DERECHO_RDMC_SEND_ALGORITHM));
+        result.add_parameter("tx_depth", getConfUInt64(CONF_RDMA_TX_DEPTH));
+        result.add_parameter("rx_depth", getConfUInt64(CONF_RDMA_RX_DEPTH));
+        result.add_parameter("rdma_provider", getConfString(CONF_RDMA_PROVIDER));
+        result.add_measurement("bytes_per_second", values[0]);
+        result.add_measurement("messages_per_second", values[1]);
+        result.add_measurement("delivered_p50_us", values[2]);
+        result.add_measurement("delivered_p99_us", values[3]);
+        result.append_to(options.trials);
+    } else if(rank < shard_size) {
+        while(!done) {
+        }
+    }
+    group->barrier_sync();
+    while(group->get_user_sst_field(members[0], num_result_fields - 1) == 0) {
+    }
+    std::ofstream result_file(options.result);
+    result_file.precision(12);
+    for(uint32_t field = 0; field < num_result_fields - 1; ++field) {
+        const uint64_t bits = group->get_user_sst_field(members[0], field);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        result_file << value << " ";
+    }
+    result_file << endl;
+    result_file.close();
+    group->barrier_sync();
+    group->leave();
+    return 0;
+}
+
+/** Runs a trial in a new process, as every other node does, and reads what it measured. */
+Measurement measure(const TunerOptions& options, uint32_t shard_size, const Candidate& candidate) {
+    std::vector<std::string> args = {"param_tuner", "trial", std::to_string(options.num_nodes),
+                                     "shard_size=" + std::to_string(shard_size),
+                                     "sizes=" + options.sizes_arg,
+                                     "count=" + std::to_string(options.count),
+                                     "senders=" + options.senders,
+                                     "trials=" + options.trials,
+                                     "result=" + options.result};
+    args.insert(args.end(), options.derecho_args.begin(), options.derecho_args.end());
+    // later options win, so the trial's settings override the passed-on ones
+    const std::vector<std::string> settings = {
+            std::string("--") + CONF_DERECHO_MAX_PAYLOAD_SIZE + "=" + std::to_string(candidate.max_payload_size),
+            std::string("--") + CONF_DERECHO_MAX_SMC_PAYLOAD_SIZE + "=" + std::to_string(candidate.max_smc_payload_size),
+            std::string("--") + CONF_DERECHO_WINDOW_SIZE + "=" + std::to_string(candidate.window_size),
+            std::string("--") + CONF_DERECHO_BLOCK_SIZE + "=" + std::to_string(candidate.block_size),
+            std::string("--") + CONF_DERECHO_RDMC_SEND_ALGORITHM + "=" + candidate.rdmc_send_algorithm,
+            std::string("--") + CONF_RDMA_TX_DEPTH + "=" + std::to_string(candidate.depth),
+            std::string("--") + CONF_RDMA_RX_DEPTH + "=" + std::to_string(candidate.depth),
+            std::string("--") + CONF_DERECHO_MAX_REGISTERED_MEMORY + "=" + std::to_string(options.memory),
+            std::string("--") + CONF_DERECHO_LATENCY_STATS + "=true",
+            std::string("--") + CONF_DERECHO_USER_SST_FIELDS + "=" + std::to_string(num_result_fields)};
+    args.insert(args.end(), settings.begin(), settings.end());
+    std::vector<char*> argv;
+    for(std::string& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    std::remove(options.result.c_str());
+    // give the previous trial's processes time to release their ports
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const pid_t pid = fork();
+    if(pid == 0) {
+        execv("/proc/self/exe", argv.data());
+        std::cerr << "Failed to start a trial: " << strerror(errno) << endl;
+        _exit(1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    Measurement measurement;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != trial_did_not_fit) {
+            std::cerr << "A trial failed; counting its settings as unusable" << endl;
+        }
+        return measurement;
+    }
+    std::ifstream result_file(options.result);
+    measurement.fits = static_cast<bool>(result_file >> measurement.bytes_per_second >> measurement.messages_per_second
+                                         >> measurement.p50_us >> measurement.p99_us);
+    return measurement;
+}
+
+bool better(const TunerOptions& options, const Measurement& a, const Measurement& b) {
+    if(!a.fits) {
+        return false;
+    }
+    if(!b.fits) {
+        return true;
+    }
+    return options.objective == "latency" ? a.p99_us < b.p99_us : a.bytes_per_second > b.bytes_per_second;
+}
+
+void print_trial(uint32_t shard_size, const Candidate& c, const Measurement& m) {
+    cout << "shard " << shard_size << ": smc " << c.max_smc_payload_size << ", window " << c.window_size
+         << ", block " << c.block_size << ", " << c.rdmc_send_algorithm << ", depth " << c.depth << ": ";
+    if(m.fits) {
+        cout << m.bytes_per_second << " bytes/s, " << m.messages_per_second << " messages/s, p50 "
+             << m.p50_us << " us, p99 " << m.p99_us << " us" << endl;
+    } else {
+        cout << "over the memory budget" << endl;
+    }
+}
+
+/** Tries each value of one setting with the best values of the others, and keeps the best. */
+template <typename T>
+void tune(const TunerOptions& options, uint32_t shard_size, const std::vector<T>& values, T Candidate::*setting,
+          Candidate& best, Measurement& best_measurement) {
+    const Candidate start = best;
+    for(const T& value : values) {
+        if(value == start.*setting) {
+            continue;
+        }
+        Candidate candidate = start;
+        candidate.*setting = value;
+        const Measurement measurement = measure(options, shard_size, candidate);
+        print_trial(shard_size, candidate, measurement);
+        if(better(options, measurement, best_measurement)) {
+            best = candidate;
+            best_measurement = measurement;
+        }
+    }
+}
+
+void write_settings(std::ofstream& out, const Candidate& c) {
+    out << "max_payload_size = " << c.max_payload_size << endl
+        << "max_smc_payload_size = " << c.max_smc_payload_size << endl
+        << "block_size = " << c.block_size << endl
+        << "window_size = " << c.window_size << endl
+        << "rdmc_send_algorithm = " << c.rdmc_send_algorithm << endl;
+}
+
+void write_measurement(std::ofstream& out, uint32_t shard_size, const Measurement& m) {
+    out << "# shard of " << shard_size << ": " << m.bytes_per_second << " bytes/s, " << m.messages_per_second
+        << " messages/s, delivery latency p50 " << m.p50_us << " us, p99 " << m.p99_us << " us" << endl;
+}
+
+int run_tuner(const TunerOptions& options) {
+    uint64_t max_size = 0;
+    std::vector<uint64_t> smc_sizes;
+    for(const auto& size : options.sizes) {
+        max_size = std::max(max_size, size.first);
+        smc_sizes.push_back(size.first);
+    }
+    std::sort(smc_sizes.begin(), smc_sizes.end());
+    smc_sizes.erase(std::unique(smc_sizes.begin(), smc_sizes.end()), smc_sizes.end());
+    Candidate baseline{max_size,
+                       std::min(max_size, getConfUInt64(CONF_DERECHO_MAX_SMC_PAYLOAD_SIZE)),
+                       getConfUInt64(CONF_DERECHO_WINDOW_SIZE),
+                       getConfUInt64(CONF_DERECHO_BLOCK_SIZE),
+                       getConfString(CONF_DERECHO_RDMC_SEND_ALGORITHM),
+                       getConfUInt64(CONF_RDMA_TX_DEPTH)};
+    std::vector<uint64_t> block_sizes;
+    std::copy_if(options.block_sizes.begin(), options.block_sizes.end(), std::back_inserter(block_sizes),
+                 [max_size](uint64_t block_size) { return block_size <= max_size; });
+    if(block_sizes.empty()) {
+        block_sizes.push_back(max_size);
+    }
+
+    std::vector<Candidate> best(options.shard_sizes.size());
+    std::vector<Measurement> best_measurement(options.shard_sizes.size());
+    for(std::size_t s = 0; s < options.shard_sizes.size(); ++s) {
+        const uint32_t shard_size = options.shard_sizes[s];
+        best[s] = baseline;
+        best_measurement[s] = measure(options, shard_size, baseline);
+        print_trial(shard_size, baseline, best_measurement[s]);
+        tune(options, shard_size, smc_sizes, &Candidate::max_smc_payload_size, best[s], best_measurement[s]);
+        tune(options, shard_size, options.window_sizes, &Candidate::window_size, best[s], best_measurement[s]);
+        // block_size and the algorithm only matter to messages sent with RDMC
+        if(max_size > best[s].max_smc_payload_size) {
+            tune(options, shard_size, block_sizes, &Candidate::block_size, best[s], best_measurement[s]);
+            tune(options, shard_size, options.algorithms, &Candidate::rdmc_send_algorithm, best[s], best_measurement[s]);
+        }
+    }
+    // the queue depths are settings of the whole process, so they are tuned
+    // once, for the largest shard
+    const std::size_t largest = options.shard_sizes.size() - 1;
+    tune(options, options.shard_sizes[largest], options.depths, &Candidate::depth, best[largest], best_measurement[largest]);
+    if(!best_measurement[largest].fits) {
+        std::cerr << "No settings that were tried fit in the memory budget" << endl;
+        return -1;
+    }
+
+    std::ofstream out(options.output);
+    out << "# Recommended by param_tuner for " << options.num_nodes << " nodes, message sizes " << options.sizes_arg
+        << ", " << options.senders << " senders";
+    if(options.memory) {
+        out << ", and a budget of " << options.memory << " bytes of registered memory";
+    }
+    out << ", optimizing " << options.objective << "." << endl
+        << "# Merge these into the configuration file; subgroups with smaller shards" << endl
+        << "# can name the profiles at the end." << endl;
+    write_measurement(out, options.shard_sizes[largest], best_measurement[largest]);
+    out << "[DERECHO]" << endl;
+    write_settings(out, best[largest]);
+    if(options.memory) {
+        out << "max_registered_memory = " << options.memory << endl;
+    }
+    out << endl
+        << "[RDMA]" << endl
+        << "tx_depth = " << best[largest].depth << endl
+        << "rx_depth = " << best[largest].depth << endl;
+    for(std::size_t s = 0; s < largest; ++s) {
+        out << endl;
+        if(!best_measurement[s].fits) {
+            out << "# No settings that were tried fit a shard of " << options.shard_sizes[s] << endl;
+            continue;
+        }
+        write_measurement(out, options.shard_sizes[s], best_measurement[s]);
+        out << "[SUBGROUP/shard_" << options.shard_sizes[s] << "]" << endl;
+        write_settings(out, best[s]);
+    }
+    cout << "Wrote the recommended settings to " << options.output << endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const bool is_trial = argc > 1 && std::string(argv[1]) == "trial";
+    TunerOptions options;
+    if(!parse_options(argc, argv, is_trial ? 2 : 1, options)
+       || (is_trial && (options.shard_size < 1 || options.shard_size > options.num_nodes))) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    pthread_setname_np(pthread_self(), is_trial ? "tuner_trial" : "param_tuner");
+    Conf::initialize(argc, argv);
+    return is_trial ? run_trial(options) : run_tuner(options);
+}
@@ -0,0 +1,275 @@
+/**
+ * @file scalability_benchmark.cpp
+ *
+ * The benchmarks that track how Derecho scales between releases: throughput
+ * and latency against the number of members, the number of subgroups each
+ * node belongs to and the shard size, and the time of a view change against
+ * the size of the group. Every node of the group runs it with the same
+ * arguments; the node with rank 0 appends one JSON line per run to the output
+ * file, in the schema of performance_tests/benchmark_results.h, so a sweep is
+ * a loop over one parameter in the cluster's run script.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <typeindex>
+#include <vector>
+
+#include "aggregate_bandwidth.h"
+#include "benchmark_results.h"
+#include "conf/conf.hpp"
+#include "derecho/derecho.h"
+#include "derecho/metrics.h"
+
+using std::cout;
+using std::endl;
+using namespace derecho;
+
+/** The name=value arguments of a run, with the defaults of the ones left out. */
+struct ScalabilityOptions {
+    std::string scenario;
+    uint32_t num_nodes;
+    /** Bytes per message; 0 means max_payload_size */
+    uint64_t size = 0;
+    /** Messages each node sends in each of its subgroups */
+    uint64_t count = 10000;
+    /** Raw subgroups, each spanning every node */
+    uint32_t subgroups = 1;
+    /** Members per shard; 0 means one shard of every node */
+    uint32_t shard_size = 0;
+    std::string output = "scalability_benchmark.json";
+};
+
+void print_usage(const char* program) {
+    cout << "usage: " << program << " <scenario> <num_nodes> [name=value ...] [Derecho options]" << endl
+         << "scenarios:" << endl
+         << "  members      size=<bytes> count=<messages per sender>; one subgroup of every" << endl
+         << "               node, in which every node sends" << endl
+         << "  subgroups    subgroups=<n> size=<bytes> count=<messages per sender per subgroup>;" << endl
+         << "               n subgroups of every node, in all of which every node sends" << endl
+         << "  shards       shard_size=<members> size=<bytes> count=<messages per sender>;" << endl
+         << "               one subgroup cut into shards of shard_size nodes, which must divide" << endl
+         << "               num_nodes, and every node sends in its shard" << endl
+         << "  view_change  the last node leaves; the others time the view change" << endl
+         << "every scenario takes output=<file> (default scalability_benchmark.json)" << endl
+         << "latencies are from each send until its sender delivers it, so they need no" << endl
+         << "synchronized clocks" << endl;
+}
+
+/** Parses the arguments before Conf::initialize, since getopt may permute argv. */
+bool parse_options(int argc, char* argv[], ScalabilityOptions& options) {
+    if(argc < 3) {
+        return false;
+    }
+    options.scenario = argv[1];
+    options.num_nodes = std::stoul(argv[2]);
+    for(int i = 3; i < argc && argv[i][0] != '-'; ++i) {
+        const std::string arg = argv[i];
+        const std::size_t equals = arg.find('=');
+        if(equals == std::string::npos) {
+            return false;
+        }
+        const std::string name = arg.substr(0, equals);
+        const std::string value = arg.substr(equals + 1);
+        if(name == "size") {
+            options.size = std::stoull(value);
+        } else if(name == "count") {
+            options.count = std::stoull(value);
+        } else if(name == "subgroups") {
+            options.subgroups = std::stoul(value);
+        } else if(name == "shard_size") {
+            options.shard_size = std::stoul(value);
+        } else if(name == "output") {
+            options.output = value;
+        } else {
+            return false;
+        }
+    }
+    if(options.shard_size == 0) {
+        options.shard_size = options.num_nodes;
+    }
+    return options.num_nodes >= 2 && options.count > 0 && options.subgroups > 0
+           && options.shard_size > 0 && options.num_nodes % options.shard_size == 0;
+}
+
+/**
+ * Places num_subgroups raw subgroups on the first num_nodes members of the
+ * view, each cut into shards of shard_size consecutive members.
+ */
+shard_view_generator_t raw_layout(uint32_t num_nodes, uint32_t num_subgroups, uint32_t shard_size) {
+    return [=](const View& curr_view, int& next_unassigned_rank) {
+        if(curr_view.num_members < static_cast<int32_t>(num_nodes)) {
+            throw subgroup_provisioning_exception();
+        }
+        subgroup_shard_layout_t subgroup_vector(num_subgroups);
+        for(uint32_t subgroup = 0; subgroup < num_subgroups; ++subgroup) {
+            for(uint32_t first = 0; first < num_nodes; first += shard_size) {
+                std::vector<node_id_t> members(curr_view.members.begin() + first,
+                                               curr_view.members.begin() + first + shard_size);
+                subgroup_vector[subgroup].emplace_back(curr_view.make_subview(members));
+            }
+        }
+        next_unassigned_rank = std::max(next_unassigned_rank, static_cast<int>(num_nodes));
+        return subgroup_vector;
+    };
+}
+
+/** Returns this node's rank in the group. */
+uint32_t my_rank(Group<>& group) {
+    const std::vector<node_id_t> members = group.get_members();
+    const node_id_t my_id = getConfUInt32(CONF_DERECHO_LOCAL_ID);
+    return std::distance(members.begin(), std::find(members.begin(), members.end(), my_id));
+}
+
+void add_common_parameters(BenchmarkResult& result, const ScalabilityOptions& options) {
+    result.add_parameter("num_nodes", options.num_nodes);
+    result.add_parameter("num_subgroups", options.subgroups);
+    result.add_parameter("shard_size", options.shard_size);
+    result.add_parameter("window_size", getConfUInt64(CONF_DERECHO_WINDOW_SIZE));
+    result.add_parameter("max_payload_size", getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE));
+    result.add_parameter("rdma_provider", getConfString(CONF_RDMA_PROVIDER));
+}
+
+/**
+ * Every node sends count messages in each of the raw subgroups it belongs
+ * to, in turn, and waits until it has delivered everything sent in them.
+ * The members, subgroups and shards scenarios are this load on different
+ * layouts. Each message carries its send time, so the sender times its own
+ * messages to their delivery.
+ */
+void run_raw_load(const ScalabilityOptions& options) {
+    using clock = std::chrono::steady_clock;
+    const uint64_t expected_deliveries = options.count * options.subgroups * options.shard_size;
+    const node_id_t my_id = getConfUInt32(CONF_DERECHO_LOCAL_ID);
+    std::atomic<bool> done(false);
+    uint64_t num_delivered = 0;
+    // only the delivery thread touches these until done is set
+    std::vector<uint64_t> latencies_ns;
+    latencies_ns.reserve(options.count * options.subgroups);
+    auto stability_callback = [&](uint32_t subgroup, int sender_id, long long int index, char* buf, long long int msg_size) {
+        // null message filter
+        if(msg_size == 0) {
+            return;
+        }
+        if(static_cast<node_id_t>(sender_id) == my_id) {
+            int64_t send_time_ns;
+            memcpy(&send_time_ns, buf, sizeof(send_time_ns));
+            latencies_ns.push_back(clock::now().time_since_epoch().count() - send_time_ns);
+        }
+        if(++num_delivered == expected_deliveries) {
+            done = true;
+        }
+    };
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(RawObject)),
+                                 raw_layout(options.num_nodes, options.subgroups, options.shard_size)}}};
+    Group<> group(CallbackSet{stability_callback}, subgroup_info);
+    while(group.get_members().size() < options.num_nodes) {
+    }
+    const uint32_t rank = my_rank(group);
+    uint64_t msg_size = getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE);
+    if(options.size) {
+        msg_size = std::min(msg_size, options.size);
+    }
+    // room for the send time
+    msg_size = std::max<uint64_t>(msg_size, sizeof(int64_t));
+    std::vector<RawSubgroup*> subgroups;
+    for(uint32_t subgroup = 0; subgroup < options.subgroups; ++subgroup) {
+        subgroups.push_back(&group.get_subgroup<RawObject>(subgroup));
+    }
+    group.barrier_sync();
+
+    const auto start_time = clock::now();
+    for(uint64_t i = 0; i < options.count; ++i) {
+        for(RawSubgroup* subgroup : subgroups) {
+            char* buf = subgroup->get_sendbuffer_ptr(msg_size);
+            while(!buf) {
+                buf = subgroup->get_sendbuffer_ptr(msg_size);
+            }
+            const int64_t send_time_ns = clock::now().time_since_epoch().count();
+            memcpy(buf, &send_time_ns, sizeof(send_time_ns));
+            subgroup->send();
+        }
+    }
+    while(!done) {
+    }
+    const double seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+    // each node's delivery bandwidth, averaged over the nodes
+    const double bandwidth = msg_size * expected_deliveries / seconds;
+    const double avg_bandwidth = aggregate_bandwidth(group.get_members(), my_id, bandwidth);
+    if(rank == 0) {
+        BenchmarkResult result(options.scenario);
+        add_common_parameters(result, options);
+        result.add_parameter("message_size", msg_size);
+        result.add_parameter("messages_per_sender", options.count);
+        result.add_measurement("bandwidth_bytes_per_second", avg_bandwidth);
+        result.add_measurement("messages_per_second", avg_bandwidth / msg_size);
+        // every node sends, so the group as a whole delivers num_nodes / shard_size
+        // times what one shard does
+        result.add_measurement("group_messages_per_second",
+                               avg_bandwidth / msg_size * options.num_nodes / options.shard_size);
+        add_percentiles(result, "delivery_latency", latencies_ns);
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+/** The last node leaves, and the others time the view change that removes it. */
+void run_view_change(const ScalabilityOptions& options) {
+    // one subgroup over whoever is left, so the smaller view stays adequate
+    SubgroupInfo subgroup_info{{{std::type_index(typeid(RawObject)), raw_layout(options.num_nodes - 1, 1, options.num_nodes - 1)}}};
+    Group<> group(CallbackSet{}, subgroup_info);
+    while(group.get_members().size() < options.num_nodes) {
+    }
+    const uint32_t rank = my_rank(group);
+    // recorded by the ViewManager for every view change it installs
+    MetricCounter& view_change_time_us = MetricsRegistry::get().counter(
+            "derecho_view_change_microseconds_total", "Time from wedging each view to installing the next one");
+    const uint64_t time_before_us = view_change_time_us.value();
+    group.barrier_sync();
+    if(rank == options.num_nodes - 1) {
+        group.leave();
+        return;
+    }
+    const auto leave_time = std::chrono::steady_clock::now();
+    while(group.get_members().size() == options.num_nodes) {
+    }
+    const double seconds_to_new_view = std::chrono::duration<double>(std::chrono::steady_clock::now() - leave_time).count();
+    if(rank == 0) {
+        BenchmarkResult result("view_change");
+        add_common_parameters(result, options);
+        result.add_measurement("view_change_us", view_change_time_us.value() - time_before_us);
+        result.add_measurement("time_to_new_view_us", seconds_to_new_view * 1e6);
+        result.append_to(options.output);
+    }
+    group.barrier_sync();
+    group.leave();
+}
+
+int main(int argc, char* argv[]) {
+    ScalabilityOptions options;
+    if(!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    pthread_setname_np(pthread_self(), "scalability");
+    Conf::initialize(argc, argv);
+
+    const std::map<std::string, void (*)(const ScalabilityOptions&)> scenarios = {
+            {"members", run_raw_load},
+            {"subgroups", run_raw_load},
+            {"shards", run_raw_load},
+            {"view_change", run_view_change}};
+    auto scenario = scenarios.find(options.scenario);
+    if(scenario == scenarios.end()) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    scenario->second(options);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Runs scalability_benchmark once for each value of one parameter, so a whole
+# sweep lands in one results file. Every node runs it with the same arguments,
+# each from its own working directory with its own derecho.cfg; the runs line
+# up because each one waits for all num_nodes nodes to join.
+#
+# usage: scalability_sweep.sh <scenario> <num_nodes> <parameter> "<values>" [name=value ...]
+#   e.g. scalability_sweep.sh subgroups 16 subgroups "1 2 4 8 16" size=1024 count=5000
+#        scalability_sweep.sh shards 32 shard_size "2 4 8 16 32"
+# A sweep over the number of members has to start a different set of nodes
+# for each run, so it is a loop over num_nodes in the cluster's own launcher.
+
+if [ $# -lt 4 ]; then
+    echo "usage: $0 <scenario> <num_nodes> <parameter> \"<values>\" [name=value ...]"
+    exit 1
+fi
+scenario=$1
+num_nodes=$2
+parameter=$3
+values=$4
+shift 4
+benchmark=$(dirname "$0")/scalability_benchmark
+
+for value in $values; do
+    "$benchmark" "$scenario" "$num_nodes" "$parameter=$value" "$@" || exit $?
+    # let the previous group's ports close before the next one starts
+    sleep 5
+done
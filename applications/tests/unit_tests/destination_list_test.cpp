@@ -0,0 +1,86 @@
+/**
+ * @file destination_list_test.cpp
+ *
+ * Checks that the destination list of an ordered send picks out the same
+ * members after a view change. A message that is still undelivered when the
+ * view changes is sent again in the next view with the header it was written
+ * with, so the list is written against the sender's shard in one view and
+ * read by the members of the shard in the next one, where they may have
+ * other ranks. Exits with 0 if every check passes.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "derecho/rpc_manager.h"
+
+using derecho::node_id_t;
+using derecho::rpc::RPCManager;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/** Reads a written list back the way rpc_message_handler does, for each
+ * member of a shard, and returns the members it picks out */
+std::vector<node_id_t> destinations_among(const std::vector<char>& list, std::size_t num_dest_nodes,
+                                          const std::vector<node_id_t>& shard_members) {
+    std::vector<node_id_t> destinations;
+    for(const node_id_t member : shard_members) {
+        if(num_dest_nodes == 0 || RPCManager::destination_list_contains(list.data(), num_dest_nodes, member)) {
+            destinations.push_back(member);
+        }
+    }
+    return destinations;
+}
+
+}  // namespace
+
+int main() {
+    // The sender's shard when the message is written, and the shard in the
+    // next view, where node 5 has left, node 11 has joined, and the others
+    // have other ranks
+    const std::vector<node_id_t> old_shard = {2, 5, 7, 9};
+    const std::vector<node_id_t> new_shard = {7, 9, 11, 2};
+
+    // A targeted send to nodes 9 and 2, listed out of order, and to node 5,
+    // which leaves before the message is delivered
+    const std::vector<node_id_t> dest_nodes = {9, 2, 5};
+    std::vector<char> list(RPCManager::destination_list_size(dest_nodes.size()));
+    check(list.size() % sizeof(uint64_t) == 0, "the list is a whole number of words");
+    check(RPCManager::write_destination_list(dest_nodes, list.data()) == list.size(),
+          "write_destination_list writes destination_list_size bytes");
+
+    check(destinations_among(list, dest_nodes.size(), old_shard) == std::vector<node_id_t>({2, 5, 9}),
+          "the list picks out the destinations in the view it was written in");
+    // Shard ranks 0 and 3 were the destinations in the old view; they are
+    // nodes 7 and 2 in the new one
+    check(destinations_among(list, dest_nodes.size(), new_shard) == std::vector<node_id_t>({9, 2}),
+          "the list picks out the same destinations after the view change");
+
+    // No destinations means the whole shard, in any view
+    check(RPCManager::destination_list_size(0) == 0, "an empty list takes no space");
+    check(destinations_among({}, 0, new_shard) == new_shard, "an empty list means the whole shard");
+
+    // A single destination still takes a whole word, and the padding does
+    // not match node 0
+    const std::vector<node_id_t> only_node_7 = {7};
+    std::vector<char> short_list(RPCManager::destination_list_size(only_node_7.size()));
+    RPCManager::write_destination_list(only_node_7, short_list.data());
+    check(short_list.size() == sizeof(uint64_t), "a one-node list is padded to a word");
+    check(destinations_among(short_list, only_node_7.size(), {0, 7, 9}) == only_node_7,
+          "the padding is not read as a destination");
+
+    if(failures == 0) {
+        std::cout << "All destination list checks passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
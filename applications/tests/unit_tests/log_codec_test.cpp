@@ -0,0 +1,153 @@
+/**
+ * @file log_codec_test.cpp
+ *
+ * Checks that the LZ4 codec of persistent/LogCodec.cpp gives back what it was
+ * given, for the inputs where a hand-written LZ4 encoder or decoder is most
+ * likely to slip: empty and incompressible data, matches long enough to need
+ * several length bytes, matches that overlap the bytes they produce, literal
+ * runs at the boundaries of their length encoding, and matches at the
+ * largest offset. Also checks that the decoder rejects data that doesn't
+ * decompress to the size it is told. Exits with 0 if every check passes.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "persistent/LogCodec.hpp"
+
+using persistent::compressData;
+using persistent::decompressData;
+using persistent::LOG_CODEC_LZ4;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/** The most an input of this size can take compressed: all literals */
+std::size_t worst_case_size(std::size_t size) {
+    return size + size / 255 + 16;
+}
+
+std::vector<uint8_t> random_bytes(std::size_t size, std::mt19937& rng) {
+    std::vector<uint8_t> bytes(size);
+    for(uint8_t& b : bytes) {
+        b = static_cast<uint8_t>(rng());
+    }
+    return bytes;
+}
+
+/** Whether decompressData accepts the data as raw_size bytes */
+bool decompresses(const std::vector<uint8_t>& compressed, std::size_t raw_size) {
+    std::vector<uint8_t> raw(raw_size);
+    try {
+        decompressData(LOG_CODEC_LZ4, compressed.data(), compressed.size(), raw.data(), raw.size());
+    } catch(unsigned long long) {
+        // PERSIST_EXP_CODEC
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Compresses data, with room for it to come out all literals, checks that it
+ * decompresses to the same bytes, and returns the compressed data
+ */
+std::vector<uint8_t> round_trip(const std::vector<uint8_t>& data, const std::string& what) {
+    std::vector<uint8_t> compressed(worst_case_size(data.size()));
+    const uint64_t compressed_size = compressData(LOG_CODEC_LZ4, data.data(), data.size(),
+                                                  compressed.data(), compressed.size());
+    check(compressed_size > 0, what + ": compresses");
+    compressed.resize(compressed_size);
+    std::vector<uint8_t> raw(data.size());
+    try {
+        decompressData(LOG_CODEC_LZ4, compressed.data(), compressed.size(), raw.data(), raw.size());
+        check(raw == data, what + ": decompresses to the same bytes");
+    } catch(unsigned long long) {
+        check(false, what + ": decompresses");
+    }
+    return compressed;
+}
+
+}  // namespace
+
+int main() {
+    std::mt19937 rng(20261015);
+
+    // Nothing in, one token out
+    round_trip({}, "empty input");
+
+    // Random data doesn't compress: it doesn't fit in its own size, and with
+    // room for it, it comes out as literals
+    const std::vector<uint8_t> noise = random_bytes(100000, rng);
+    std::vector<uint8_t> too_small(noise.size());
+    check(compressData(LOG_CODEC_LZ4, noise.data(), noise.size(), too_small.data(), too_small.size()) == 0,
+          "incompressible input doesn't fit in its own size");
+    round_trip(noise, "incompressible input");
+
+    // A block repeated many times gives matches much longer than the 15 + 255
+    // a single length byte covers
+    std::vector<uint8_t> repeated;
+    const std::vector<uint8_t> block = random_bytes(1000, rng);
+    for(int i = 0; i < 200; ++i) {
+        repeated.insert(repeated.end(), block.begin(), block.end());
+    }
+    check(round_trip(repeated, "long matches").size() < repeated.size() / 50,
+          "long matches compress");
+
+    // A run of one byte, and of a short pattern, is a match at offset 1 or 3
+    // that copies bytes it has just written
+    round_trip(std::vector<uint8_t>(70000, 'a'), "overlapping copies at offset 1");
+    std::vector<uint8_t> pattern;
+    for(int i = 0; i < 5000; ++i) {
+        pattern.push_back('x');
+        pattern.push_back('y');
+        pattern.push_back('z');
+    }
+    round_trip(pattern, "overlapping copies at offset 3");
+
+    // Literal runs either side of the lengths that take another length byte:
+    // 15 in the token, then 255 more per byte. Each run is the whole input,
+    // and then the literals in front of a match.
+    for(const std::size_t run : {0, 1, 14, 15, 16, 269, 270, 271, 524, 525, 526, 65536}) {
+        const std::vector<uint8_t> literals = random_bytes(run, rng);
+        round_trip(literals, "a literal run of " + std::to_string(run));
+        std::vector<uint8_t> then_match = literals;
+        then_match.insert(then_match.end(), 64, 'm');
+        round_trip(then_match, "a literal run of " + std::to_string(run) + " before a match");
+    }
+
+    // A block repeated as far back as an offset reaches, and one byte
+    // farther, with zeros in between, which take a single match
+    for(const std::size_t distance : {65535, 65536}) {
+        const std::vector<uint8_t> far_block = random_bytes(1000, rng);
+        std::vector<uint8_t> far_match = far_block;
+        far_match.resize(distance);
+        far_match.insert(far_match.end(), far_block.begin(), far_block.end());
+        const std::size_t compressed_size = round_trip(far_match, "a match at offset " + std::to_string(distance)).size();
+        if(distance == 65535) {
+            check(compressed_size < far_block.size() + 500, "a match at the largest offset is used");
+        }
+    }
+
+    // The decoder holds the data to the size it is told
+    const std::vector<uint8_t> compressed = round_trip(repeated, "long matches");
+    check(!decompresses(compressed, repeated.size() - 1), "data longer than raw_size is rejected");
+    check(!decompresses(compressed, repeated.size() + 1), "data shorter than raw_size is rejected");
+    check(!decompresses(std::vector<uint8_t>(compressed.begin(), compressed.end() - 1), repeated.size()),
+          "truncated data is rejected");
+
+    if(failures == 0) {
+        std::cout << "All LZ4 codec checks passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
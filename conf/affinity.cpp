@@ -0,0 +1,112 @@
+#include "affinity.hpp"
+#include "conf.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * Parses DERECHO/thread_cpus, a comma-separated list of <name>:<cores>
+ * entries where <cores> is a core or a range of them, like "rpc_thread:3" or
+ * "sender_thread:4-5". Malformed entries are reported and skipped.
+ */
+static std::map<std::string, std::vector<int>> parse_thread_cpus(const std::string& list) {
+    std::map<std::string, std::vector<int>> thread_cpus;
+    std::istringstream entries(list);
+    std::string entry;
+    while(std::getline(entries, entry, ',')) {
+        const std::size_t colon = entry.find(':');
+        try {
+            if(colon == std::string::npos) {
+                throw std::invalid_argument(entry);
+            }
+            const std::string cores = entry.substr(colon + 1);
+            const std::size_t dash = cores.find('-');
+            const int first = std::stoi(cores.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(cores.substr(dash + 1));
+            std::vector<int>& cpus = thread_cpus[entry.substr(0, colon)];
+            for(int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch(const std::logic_error&) {
+            std::cerr << "Ignoring malformed " << CONF_DERECHO_THREAD_CPUS << " entry \"" << entry << "\"" << std::endl;
+        }
+    }
+    return thread_cpus;
+}
+
+/** The cores to pin a thread with the given name to, or nullptr if none */
+static const std::vector<int>* find_thread_cpus(const std::string& name) {
+    static const std::map<std::string, std::vector<int>> thread_cpus
+            = parse_thread_cpus(getConfString(CONF_DERECHO_THREAD_CPUS));
+    auto cpus = thread_cpus.find(name);
+    if(cpus == thread_cpus.end()) {
+        // sender_thread_2 and the like fall back to the entry for their kind
+        const std::size_t suffix = name.find_last_not_of("0123456789");
+        if(suffix != std::string::npos && suffix + 1 < name.size() && name[suffix] == '_') {
+            cpus = thread_cpus.find(name.substr(0, suffix));
+        }
+    }
+    return cpus == thread_cpus.end() ? nullptr : &cpus->second;
+}
+
+bool name_and_pin_thread(const std::string& name) {
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    const std::vector<int>* cpus = find_thread_cpus(name);
+    if(!cpus) {
+        return true;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for(int cpu : *cpus) {
+        CPU_SET(cpu, &cpuset);
+    }
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        std::cerr << "Failed to pin thread " << name << " to the cores in " << CONF_DERECHO_THREAD_CPUS << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/** Reads the NUMA node of a device from sysfs, or returns -1 */
+static int read_numa_node(const std::string& path) {
+    std::ifstream numa_node_file(path);
+    int numa_node = -1;
+    if(!(numa_node_file >> numa_node)) {
+        return -1;
+    }
+    return numa_node;
+}
+
+int get_nic_numa_node() {
+    static const int numa_node = []() {
+        const std::string& setting = getConfString(CONF_DERECHO_NUMA_NODE);
+        if(setting.empty()) {
+            return -1;
+        }
+        if(setting != "auto") {
+            try {
+                return std::stoi(setting);
+            } catch(const std::logic_error&) {
+                std::cerr << "Ignoring malformed " << CONF_DERECHO_NUMA_NODE << " \"" << setting << "\"" << std::endl;
+                return -1;
+            }
+        }
+        // The domain is an RDMA device for the verbs provider and a network
+        // interface for the socket ones
+        const std::string& domain = getConfString(CONF_RDMA_DOMAIN);
+        int node = read_numa_node("/sys/class/infiniband/" + domain + "/device/numa_node");
+        if(node < 0) {
+            node = read_numa_node("/sys/class/net/" + domain + "/device/numa_node");
+        }
+        return node;
+    }();
+    return numa_node;
+}
+
+}  // namespace derecho
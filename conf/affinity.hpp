@@ -0,0 +1,27 @@
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <string>
+
+namespace derecho {
+
+/**
+ * Names the calling thread, and pins it to the CPU cores that
+ * DERECHO/thread_cpus lists for that name, if any. A thread named with a
+ * numeric suffix, such as "sender_thread_2", also matches the entry for the
+ * name without it. Names longer than the 15 characters the OS keeps are cut
+ * short for the OS, but are matched in full.
+ * @param name The name of the thread, e.g. "rpc_thread"
+ * @return false if the thread should have been pinned but could not be
+ */
+bool name_and_pin_thread(const std::string& name);
+
+/**
+ * The NUMA node that memory registered with the NIC should be allocated on,
+ * from DERECHO/numa_node: the given node, the NIC's own node if it is
+ * "auto", or -1 (any node) if it is empty or the NIC's node is unknown.
+ */
+int get_nic_numa_node();
+
+}  // namespace derecho
+#endif  // AFFINITY_HPP
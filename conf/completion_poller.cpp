@@ -0,0 +1,85 @@
+#include "completion_poller.hpp"
+#include "affinity.hpp"
+#include "conf.hpp"
+#include <algorithm>
+#include <iostream>
+#include <poll.h>
+
+namespace derecho {
+
+CompletionPoller::CompletionPoller()
+        : busy_poll_time(std::chrono::microseconds(getConfUInt64(CONF_DERECHO_POLLER_BUSY_POLL_US))),
+          idle_sleep_time(std::max<uint64_t>(1, getConfUInt64(CONF_DERECHO_POLLER_IDLE_SLEEP_US))) {}
+
+CompletionPoller::~CompletionPoller() {
+    shutdown = true;
+    if(polling_thread.joinable()) {
+        polling_thread.join();
+    }
+}
+
+bool CompletionPoller::enabled() {
+    return getConfBoolean(CONF_DERECHO_UNIFIED_POLLER);
+}
+
+CompletionPoller& CompletionPoller::get() {
+    static CompletionPoller poller;
+    return poller;
+}
+
+uint64_t CompletionPoller::add_source(const std::string& name, poll_function_t poll, int wait_fd) {
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    const uint64_t id = next_source_id++;
+    sources.push_back(source{id, name, std::move(poll), wait_fd});
+    if(!polling_thread.joinable()) {
+        polling_thread = std::thread(&CompletionPoller::poll_loop, this);
+    }
+    return id;
+}
+
+void CompletionPoller::remove_source(uint64_t id) {
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    sources.erase(std::remove_if(sources.begin(), sources.end(),
+                                 [id](const source& s) { return s.id == id; }),
+                  sources.end());
+}
+
+void CompletionPoller::poll_loop() {
+    name_and_pin_thread("completion_poll");
+    auto last_completion = std::chrono::steady_clock::now();
+    std::vector<pollfd> wait_fds;
+    while(!shutdown) {
+        bool found_completions = false;
+        bool can_wait = true;
+        wait_fds.clear();
+        {
+            std::lock_guard<std::mutex> lock(sources_mutex);
+            for(source& s : sources) {
+                try {
+                    found_completions = s.poll() || found_completions;
+                } catch(const std::exception& e) {
+                    std::cerr << "Polling the completion queue of " << s.name << " failed: " << e.what() << std::endl;
+                }
+                can_wait = can_wait && s.wait_fd >= 0;
+                wait_fds.push_back(pollfd{s.wait_fd, POLLIN, 0});
+            }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if(found_completions) {
+            last_completion = now;
+            continue;
+        }
+        if(now - last_completion < busy_poll_time) {
+            continue;
+        }
+        // The sources may gain completions while the poller waits, so it
+        // comes back to read them at least every 50 ms, like the threads it replaces
+        if(can_wait && !wait_fds.empty()) {
+            poll(wait_fds.data(), wait_fds.size(), 50);
+        } else {
+            std::this_thread::sleep_for(idle_sleep_time);
+        }
+    }
+}
+
+}  // namespace derecho
@@ -0,0 +1,75 @@
+#ifndef COMPLETION_POLLER_HPP
+#define COMPLETION_POLLER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * A single thread that reads the completion queues of RDMC (one per rail)
+ * and of the SST, in place of a polling thread for each, if
+ * DERECHO/unified_poller is set. Each subsystem registers a function that
+ * reads its queue once without blocking and dispatches what it finds to its
+ * own handlers; the poller calls them in turn.
+ *
+ * After DERECHO/poller_busy_poll_us without a completion, the poller stops
+ * spinning: if every source has a wait file descriptor it waits for one of
+ * them to become readable, and otherwise it sleeps for
+ * DERECHO/poller_idle_sleep_us between rounds, until a completion turns up.
+ */
+class CompletionPoller {
+public:
+    /** Reads a completion queue once without blocking, and handles what it
+     * read; returns whether it found any completions */
+    using poll_function_t = std::function<bool()>;
+
+private:
+    struct source {
+        uint64_t id;
+        std::string name;
+        poll_function_t poll;
+        int wait_fd;
+    };
+    /** Held by the polling thread while it calls the sources */
+    std::mutex sources_mutex;
+    std::vector<source> sources;
+    uint64_t next_source_id = 0;
+    std::atomic<bool> shutdown{false};
+    const std::chrono::nanoseconds busy_poll_time;
+    const std::chrono::microseconds idle_sleep_time;
+    std::thread polling_thread;
+
+    CompletionPoller();
+    void poll_loop();
+
+public:
+    ~CompletionPoller();
+    /** Whether RDMC and the SST should register with the poller instead of
+     * starting polling threads of their own */
+    static bool enabled();
+    /** The process's poller; its thread starts with the first source */
+    static CompletionPoller& get();
+
+    /**
+     * Starts polling a completion queue.
+     * @param name Names the source in error messages
+     * @param poll Reads the queue; called on the polling thread only
+     * @param wait_fd A file descriptor that becomes readable when the queue
+     * has completions, or -1 if it has none
+     * @return The source's ID, for remove_source()
+     */
+    uint64_t add_source(const std::string& name, poll_function_t poll, int wait_fd = -1);
+    /** Stops polling a source. Once it returns, the source's function is
+     * not running and will not be called again. */
+    void remove_source(uint64_t id);
+};
+
+}  // namespace derecho
+#endif  // COMPLETION_POLLER_HPP
@@ -39,6 +39,18 @@ inline auto dbgConsole() {
 #define dbg_flush()
 #endif  //NDEBUG
 
+// EFA only has reliable datagram endpoints, and each operation costs more
+// than on verbs, so more of them are kept in flight and blocks are larger.
+const std::map<const std::string, std::map<const std::string, std::string>> Conf::provider_defaults = {
+      {"efa", {
+          {CONF_RDMA_RDM_ENDPOINT, "true"},
+          {CONF_RDMA_TX_DEPTH, "1024"},
+          {CONF_RDMA_RX_DEPTH, "1024"},
+          {CONF_DERECHO_WINDOW_SIZE, "64"},
+          {CONF_DERECHO_BLOCK_SIZE, "4194304"},
+          {CONF_DERECHO_MAX_OUTSTANDING_RDMC_SENDS, "4"}}}
+};
+
 #define MAKE_LONG_OPT_ENTRY(x) \
     {x, required_argument, 0, 0 }
 struct option Conf::long_options[] = {
@@ -56,15 +68,94 @@ struct option Conf::long_options[] = {
       MAKE_LONG_OPT_ENTRY(CONF_DERECHO_BLOCK_SIZE),
       MAKE_LONG_OPT_ENTRY(CONF_DERECHO_WINDOW_SIZE),
       MAKE_LONG_OPT_ENTRY(CONF_DERECHO_TIMEOUT_MS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_FAILURE_PHI_THRESHOLD),
       MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_SEND_ALGORITHM),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_PREDICATE_THREADS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_PREDICATE_CPUS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_SPIN_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_YIELD_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_SLEEP_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_CACHE_LINE_LAYOUT),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_NOTIFICATIONS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MAX_PINNED_SST_MESSAGES),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MAX_OUTSTANDING_RDMC_SENDS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_PERSISTENCE_WINDOW),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_ADAPTIVE_WINDOW),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_NUM_SENDER_THREADS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_DELIVERY_EXECUTOR),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_UNIFIED_POLLER),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_POLLER_BUSY_POLL_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_POLLER_IDLE_SLEEP_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RPC_AGGREGATION_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RPC_AGGREGATION_DELAY_US),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MESSAGE_BUFFER_SLAB_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MAX_REGISTERED_MEMORY),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MAX_INLINE_PAYLOAD_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SKIP_NULL_MESSAGES),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_AGGREGATED_STABILITY),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_AGGREGATION_FANOUT),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_HUGEPAGE_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_HUGETLBFS_PATH),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_RACK_MAP),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_ADAPTIVE_THRESHOLDS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_BLOCK_OVERHEAD),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_BLOCK_CREDITS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_COMPRESSION),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_RDMC_SEND_TOKEN),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_P2P_WORKER_THREADS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_P2P_SLOT_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_LINEARIZABLE_P2P_QUERIES),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_TARGETED_SEND_THRESHOLD),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_COMPACT_RPC_HEADERS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_BACKGROUND_STATE_TRANSFER),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_OBJECT_CONSTRUCTION_THREADS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SHARED_MEMORY_SST),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_JOIN_BATCH_WINDOW_MS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_LATENCY_STATS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_LATENCY_STATS_DUMP_INTERVAL_MS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_METRICS_PORT),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_CDC_PORT),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_CDC_RING_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_PROFILE_PREDICATES),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_SST_PROFILE_DUMP_INTERVAL_MS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_USER_SST_FIELDS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_THREAD_CPUS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_NUMA_NODE),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_FAULT_INJECTION),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_EXTERNAL_PORT),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_MAX_EXTERNAL_CLIENTS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_NODE_RACKS),
+      MAKE_LONG_OPT_ENTRY(CONF_DERECHO_NODE_CAPACITIES),
       // [RDMA]
       MAKE_LONG_OPT_ENTRY(CONF_RDMA_PROVIDER),
       MAKE_LONG_OPT_ENTRY(CONF_RDMA_DOMAIN),
       MAKE_LONG_OPT_ENTRY(CONF_RDMA_TX_DEPTH),
       MAKE_LONG_OPT_ENTRY(CONF_RDMA_RX_DEPTH),
+      MAKE_LONG_OPT_ENTRY(CONF_RDMA_IMPLICIT_ODP),
+      MAKE_LONG_OPT_ENTRY(CONF_RDMA_EXTRA_DOMAINS),
+      MAKE_LONG_OPT_ENTRY(CONF_RDMA_RDM_ENDPOINT),
+      MAKE_LONG_OPT_ENTRY(CONF_RDMA_SIGNAL_INTERVAL),
+      MAKE_LONG_OPT_ENTRY(CONF_RDMA_MR_CACHE_SIZE),
       // [PERS]
       MAKE_LONG_OPT_ENTRY(CONF_PERS_FILE_PATH),
       MAKE_LONG_OPT_ENTRY(CONF_PERS_RAMDISK_PATH),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_DELTA_CHECKPOINT_INTERVAL),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_GROUP_COMMIT_DELAY_US),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_GROUP_COMMIT_MAX_REQUESTS),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_MEMORY_DURABLE_REPLICAS),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_DIRECT_READ_CACHE_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_PMEM_PATH),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_MAX_LOG_ENTRY),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_MAX_DATA_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_MEM_LOG_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_CODEC_CACHE_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_HLC_TSC_CLOCK),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_VERSION_CACHE_SIZE),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_RETENTION_MAX_VERSIONS),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_RETENTION_MAX_AGE_MS),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_RETENTION_MAX_BYTES),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_PARALLEL_PERSIST),
+      MAKE_LONG_OPT_ENTRY(CONF_PERS_PREALLOC_SIZE),
       {0,0,0,0}
 };
 
@@ -148,4 +239,12 @@ const float getConfFloat(const std::string & key){
 const double getConfDouble(const std::string& key) {
     return Conf::get()->getDouble(key);
 }
+
+const bool getConfBoolean(const std::string& key) {
+    return Conf::get()->getBoolean(key);
+}
+
+const bool hasConfKey(const std::string& key) {
+    return Conf::get()->hasKey(key);
+}
 }
@@ -7,6 +7,7 @@
 #include <inttypes.h>
 #include <map>
 #include <memory>
+#include <set>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -19,6 +20,8 @@ class Conf {
 private:
   // Configuration Table:
   // config name --> default value
+// The sections of subgroup profiles, e.g. [SUBGROUP/small]; see DerechoParams::for_profile
+#define CONF_SUBGROUP_PREFIX "SUBGROUP/"
 #define CONF_DERECHO_LEADER_IP "DERECHO/leader_ip"
 #define CONF_DERECHO_LEADER_GMS_PORT "DERECHO/leader_gms_port"
 #define CONF_DERECHO_LOCAL_ID "DERECHO/local_id"
@@ -32,13 +35,92 @@ private:
 #define CONF_DERECHO_BLOCK_SIZE "DERECHO/block_size"
 #define CONF_DERECHO_WINDOW_SIZE "DERECHO/window_size"
 #define CONF_DERECHO_TIMEOUT_MS "DERECHO/timeout_ms"
+#define CONF_DERECHO_FAILURE_PHI_THRESHOLD "DERECHO/failure_phi_threshold"
 #define CONF_DERECHO_RDMC_SEND_ALGORITHM "DERECHO/rdmc_send_algorithm"
+#define CONF_DERECHO_SST_PREDICATE_THREADS "DERECHO/sst_predicate_threads"
+#define CONF_DERECHO_SST_PREDICATE_CPUS "DERECHO/sst_predicate_cpus"
+#define CONF_DERECHO_SST_SPIN_US "DERECHO/sst_spin_us"
+#define CONF_DERECHO_SST_YIELD_US "DERECHO/sst_yield_us"
+#define CONF_DERECHO_SST_SLEEP_US "DERECHO/sst_sleep_us"
+#define CONF_DERECHO_SST_CACHE_LINE_LAYOUT "DERECHO/sst_cache_line_layout"
+#define CONF_DERECHO_SST_NOTIFICATIONS "DERECHO/sst_notifications"
+#define CONF_DERECHO_MAX_PINNED_SST_MESSAGES "DERECHO/max_pinned_sst_messages"
+#define CONF_DERECHO_MAX_OUTSTANDING_RDMC_SENDS "DERECHO/max_outstanding_rdmc_sends"
+#define CONF_DERECHO_PERSISTENCE_WINDOW "DERECHO/persistence_window"
+#define CONF_DERECHO_ADAPTIVE_WINDOW "DERECHO/adaptive_window"
+#define CONF_DERECHO_NUM_SENDER_THREADS "DERECHO/num_sender_threads"
+#define CONF_DERECHO_DELIVERY_EXECUTOR "DERECHO/delivery_executor"
+#define CONF_DERECHO_UNIFIED_POLLER "DERECHO/unified_poller"
+#define CONF_DERECHO_POLLER_BUSY_POLL_US "DERECHO/poller_busy_poll_us"
+#define CONF_DERECHO_POLLER_IDLE_SLEEP_US "DERECHO/poller_idle_sleep_us"
+#define CONF_DERECHO_RPC_AGGREGATION_SIZE "DERECHO/rpc_aggregation_size"
+#define CONF_DERECHO_RPC_AGGREGATION_DELAY_US "DERECHO/rpc_aggregation_delay_us"
+#define CONF_DERECHO_MESSAGE_BUFFER_SLAB_SIZE "DERECHO/message_buffer_slab_size"
+#define CONF_DERECHO_MAX_REGISTERED_MEMORY "DERECHO/max_registered_memory"
+#define CONF_DERECHO_MAX_INLINE_PAYLOAD_SIZE "DERECHO/max_inline_payload_size"
+#define CONF_DERECHO_SKIP_NULL_MESSAGES "DERECHO/skip_null_messages"
+#define CONF_DERECHO_AGGREGATED_STABILITY "DERECHO/aggregated_stability"
+#define CONF_DERECHO_AGGREGATION_FANOUT "DERECHO/aggregation_fanout"
+#define CONF_DERECHO_HUGEPAGE_SIZE "DERECHO/hugepage_size"
+#define CONF_DERECHO_RDMC_RACK_MAP "DERECHO/rdmc_rack_map"
+#define CONF_DERECHO_RDMC_ADAPTIVE_THRESHOLDS "DERECHO/rdmc_adaptive_thresholds"
+#define CONF_DERECHO_RDMC_BLOCK_OVERHEAD "DERECHO/rdmc_block_overhead"
+#define CONF_DERECHO_RDMC_BLOCK_CREDITS "DERECHO/rdmc_block_credits"
+#define CONF_DERECHO_RDMC_COMPRESSION "DERECHO/rdmc_compression"
+#define CONF_DERECHO_RDMC_SEND_TOKEN "DERECHO/rdmc_send_token"
+#define CONF_DERECHO_HUGETLBFS_PATH "DERECHO/hugetlbfs_path"
+#define CONF_DERECHO_P2P_WORKER_THREADS "DERECHO/p2p_worker_threads"
+#define CONF_DERECHO_P2P_SLOT_SIZE "DERECHO/p2p_slot_size"
+#define CONF_DERECHO_LINEARIZABLE_P2P_QUERIES "DERECHO/linearizable_p2p_queries"
+#define CONF_DERECHO_TARGETED_SEND_THRESHOLD "DERECHO/targeted_send_threshold"
+#define CONF_DERECHO_COMPACT_RPC_HEADERS "DERECHO/compact_rpc_headers"
+#define CONF_DERECHO_BACKGROUND_STATE_TRANSFER "DERECHO/background_state_transfer"
+#define CONF_DERECHO_OBJECT_CONSTRUCTION_THREADS "DERECHO/object_construction_threads"
+#define CONF_DERECHO_SHARED_MEMORY_SST "DERECHO/shared_memory_sst"
+#define CONF_DERECHO_JOIN_BATCH_WINDOW_MS "DERECHO/join_batch_window_ms"
+#define CONF_DERECHO_LATENCY_STATS "DERECHO/latency_stats"
+#define CONF_DERECHO_LATENCY_STATS_DUMP_INTERVAL_MS "DERECHO/latency_stats_dump_interval_ms"
+#define CONF_DERECHO_METRICS_PORT "DERECHO/metrics_port"
+#define CONF_DERECHO_CDC_PORT "DERECHO/cdc_port"
+#define CONF_DERECHO_CDC_RING_SIZE "DERECHO/cdc_ring_size"
+#define CONF_DERECHO_SST_PROFILE_PREDICATES "DERECHO/sst_profile_predicates"
+#define CONF_DERECHO_SST_PROFILE_DUMP_INTERVAL_MS "DERECHO/sst_profile_dump_interval_ms"
+#define CONF_DERECHO_USER_SST_FIELDS "DERECHO/user_sst_fields"
+#define CONF_DERECHO_THREAD_CPUS "DERECHO/thread_cpus"
+#define CONF_DERECHO_NUMA_NODE "DERECHO/numa_node"
+#define CONF_DERECHO_FAULT_INJECTION "DERECHO/fault_injection"
+#define CONF_DERECHO_EXTERNAL_PORT "DERECHO/external_port"
+#define CONF_DERECHO_MAX_EXTERNAL_CLIENTS "DERECHO/max_external_clients"
+#define CONF_DERECHO_NODE_RACKS "DERECHO/node_racks"
+#define CONF_DERECHO_NODE_CAPACITIES "DERECHO/node_capacities"
 #define CONF_RDMA_PROVIDER "RDMA/provider"
 #define CONF_RDMA_DOMAIN "RDMA/domain"
 #define CONF_RDMA_TX_DEPTH "RDMA/tx_depth"
 #define CONF_RDMA_RX_DEPTH "RDMA/rx_depth"
+#define CONF_RDMA_IMPLICIT_ODP "RDMA/implicit_odp"
+#define CONF_RDMA_EXTRA_DOMAINS "RDMA/extra_domains"
+#define CONF_RDMA_RDM_ENDPOINT "RDMA/rdm_endpoint"
+#define CONF_RDMA_SIGNAL_INTERVAL "RDMA/signal_interval"
+#define CONF_RDMA_MR_CACHE_SIZE "RDMA/mr_cache_size"
 #define CONF_PERS_FILE_PATH "PERS/file_path"
 #define CONF_PERS_RAMDISK_PATH "PERS/ramdisk_path"
+#define CONF_PERS_DELTA_CHECKPOINT_INTERVAL "PERS/delta_checkpoint_interval"
+#define CONF_PERS_GROUP_COMMIT_DELAY_US "PERS/group_commit_delay_us"
+#define CONF_PERS_GROUP_COMMIT_MAX_REQUESTS "PERS/group_commit_max_requests"
+#define CONF_PERS_MEMORY_DURABLE_REPLICAS "PERS/memory_durable_replicas"
+#define CONF_PERS_DIRECT_READ_CACHE_SIZE "PERS/direct_read_cache_size"
+#define CONF_PERS_PMEM_PATH "PERS/pmem_path"
+#define CONF_PERS_MAX_LOG_ENTRY "PERS/max_log_entry"
+#define CONF_PERS_MAX_DATA_SIZE "PERS/max_data_size"
+#define CONF_PERS_MEM_LOG_SIZE "PERS/mem_log_size"
+#define CONF_PERS_CODEC_CACHE_SIZE "PERS/codec_cache_size"
+#define CONF_PERS_HLC_TSC_CLOCK "PERS/hlc_tsc_clock"
+#define CONF_PERS_VERSION_CACHE_SIZE "PERS/version_cache_size"
+#define CONF_PERS_RETENTION_MAX_VERSIONS "PERS/retention_max_versions"
+#define CONF_PERS_RETENTION_MAX_AGE_MS "PERS/retention_max_age_ms"
+#define CONF_PERS_RETENTION_MAX_BYTES "PERS/retention_max_bytes"
+#define CONF_PERS_PARALLEL_PERSIST "PERS/parallel_persist"
+#define CONF_PERS_PREALLOC_SIZE "PERS/prealloc_size"
 
   std::map<const std::string, std::string> config = {
       // [DERECHO]
@@ -55,15 +137,100 @@ private:
       {CONF_DERECHO_BLOCK_SIZE, "1048576"},
       {CONF_DERECHO_WINDOW_SIZE, "16"},
       {CONF_DERECHO_TIMEOUT_MS, "1"},
+      {CONF_DERECHO_FAILURE_PHI_THRESHOLD, "0"},
       {CONF_DERECHO_RDMC_SEND_ALGORITHM, "binomial_send"},
+      {CONF_DERECHO_SST_PREDICATE_THREADS, "1"},
+      {CONF_DERECHO_SST_PREDICATE_CPUS, ""},
+      {CONF_DERECHO_SST_SPIN_US, "1000"},
+      {CONF_DERECHO_SST_YIELD_US, "0"},
+      {CONF_DERECHO_SST_SLEEP_US, "1000"},
+      {CONF_DERECHO_SST_CACHE_LINE_LAYOUT, "false"},
+      {CONF_DERECHO_SST_NOTIFICATIONS, "false"},
+      {CONF_DERECHO_MAX_PINNED_SST_MESSAGES, "0"},
+      {CONF_DERECHO_MAX_OUTSTANDING_RDMC_SENDS, "1"},
+      {CONF_DERECHO_PERSISTENCE_WINDOW, "0"},
+      {CONF_DERECHO_ADAPTIVE_WINDOW, "false"},
+      {CONF_DERECHO_NUM_SENDER_THREADS, "1"},
+      {CONF_DERECHO_DELIVERY_EXECUTOR, "false"},
+      {CONF_DERECHO_UNIFIED_POLLER, "false"},
+      {CONF_DERECHO_POLLER_BUSY_POLL_US, "50000"},
+      {CONF_DERECHO_POLLER_IDLE_SLEEP_US, "50"},
+      {CONF_DERECHO_RPC_AGGREGATION_SIZE, "0"},
+      {CONF_DERECHO_RPC_AGGREGATION_DELAY_US, "50"},
+      {CONF_DERECHO_MESSAGE_BUFFER_SLAB_SIZE, "4194304"},
+      {CONF_DERECHO_MAX_REGISTERED_MEMORY, "0"},
+      {CONF_DERECHO_MAX_INLINE_PAYLOAD_SIZE, "0"},
+      {CONF_DERECHO_SKIP_NULL_MESSAGES, "true"},
+      {CONF_DERECHO_AGGREGATED_STABILITY, "false"},
+      {CONF_DERECHO_AGGREGATION_FANOUT, "16"},
+      {CONF_DERECHO_HUGEPAGE_SIZE, "0"},
+      {CONF_DERECHO_HUGETLBFS_PATH, ""},
+      {CONF_DERECHO_RDMC_RACK_MAP, ""},
+      {CONF_DERECHO_RDMC_ADAPTIVE_THRESHOLDS, "3:0:sequential_send,8:16:chain_send"},
+      {CONF_DERECHO_RDMC_BLOCK_OVERHEAD, "65536"},
+      {CONF_DERECHO_RDMC_BLOCK_CREDITS, "4"},
+      {CONF_DERECHO_RDMC_COMPRESSION, "false"},
+      {CONF_DERECHO_RDMC_SEND_TOKEN, "false"},
+      {CONF_DERECHO_P2P_WORKER_THREADS, "0"},
+      {CONF_DERECHO_P2P_SLOT_SIZE, "0"},
+      {CONF_DERECHO_LINEARIZABLE_P2P_QUERIES, "false"},
+      {CONF_DERECHO_TARGETED_SEND_THRESHOLD, "0"},
+      {CONF_DERECHO_COMPACT_RPC_HEADERS, "false"},
+      {CONF_DERECHO_BACKGROUND_STATE_TRANSFER, "false"},
+      {CONF_DERECHO_OBJECT_CONSTRUCTION_THREADS, "1"},
+      {CONF_DERECHO_SHARED_MEMORY_SST, "false"},
+      {CONF_DERECHO_JOIN_BATCH_WINDOW_MS, "0"},
+      {CONF_DERECHO_LATENCY_STATS, "false"},
+      {CONF_DERECHO_LATENCY_STATS_DUMP_INTERVAL_MS, "0"},
+      {CONF_DERECHO_METRICS_PORT, "0"},
+      {CONF_DERECHO_CDC_PORT, "0"},
+      {CONF_DERECHO_CDC_RING_SIZE, "16777216"},
+      {CONF_DERECHO_SST_PROFILE_PREDICATES, "false"},
+      {CONF_DERECHO_SST_PROFILE_DUMP_INTERVAL_MS, "0"},
+      {CONF_DERECHO_USER_SST_FIELDS, "0"},
+      {CONF_DERECHO_THREAD_CPUS, ""},
+      {CONF_DERECHO_NUMA_NODE, ""},
+      {CONF_DERECHO_FAULT_INJECTION, ""},
+      {CONF_DERECHO_EXTERNAL_PORT, "0"},
+      {CONF_DERECHO_MAX_EXTERNAL_CLIENTS, "4096"},
+      {CONF_DERECHO_NODE_RACKS, ""},
+      {CONF_DERECHO_NODE_CAPACITIES, ""},
       // [RDMA]
       {CONF_RDMA_PROVIDER, "sockets"},
       {CONF_RDMA_DOMAIN, "eth0"},
       {CONF_RDMA_TX_DEPTH, "256"},
       {CONF_RDMA_RX_DEPTH, "256"},
+      {CONF_RDMA_IMPLICIT_ODP, "false"},
+      {CONF_RDMA_EXTRA_DOMAINS, ""},
+      {CONF_RDMA_RDM_ENDPOINT, "false"},
+      {CONF_RDMA_SIGNAL_INTERVAL, "-1"},
+      {CONF_RDMA_MR_CACHE_SIZE, "67108864"},
       // [PERS]
       {CONF_PERS_FILE_PATH, ".plog"},
-      {CONF_PERS_RAMDISK_PATH, "/dev/shm/volatile_t"}};
+      {CONF_PERS_RAMDISK_PATH, "/dev/shm/volatile_t"},
+      {CONF_PERS_DELTA_CHECKPOINT_INTERVAL, "1024"},
+      {CONF_PERS_GROUP_COMMIT_DELAY_US, "0"},
+      {CONF_PERS_GROUP_COMMIT_MAX_REQUESTS, "256"},
+      {CONF_PERS_MEMORY_DURABLE_REPLICAS, "0"},
+      {CONF_PERS_DIRECT_READ_CACHE_SIZE, "67108864"},
+      {CONF_PERS_PMEM_PATH, ""},
+      {CONF_PERS_MAX_LOG_ENTRY, "1048576"},
+      {CONF_PERS_MAX_DATA_SIZE, "549755813888"},
+      {CONF_PERS_MEM_LOG_SIZE, "67108864"},
+      {CONF_PERS_CODEC_CACHE_SIZE, "16777216"},
+      {CONF_PERS_HLC_TSC_CLOCK, "false"},
+      {CONF_PERS_VERSION_CACHE_SIZE, "16"},
+      {CONF_PERS_RETENTION_MAX_VERSIONS, "0"},
+      {CONF_PERS_RETENTION_MAX_AGE_MS, "0"},
+      {CONF_PERS_RETENTION_MAX_BYTES, "0"},
+      {CONF_PERS_PARALLEL_PERSIST, "false"},
+      {CONF_PERS_PREALLOC_SIZE, "0"}};
+
+  // Provider defaults:
+  // RDMA/provider --> (config name --> default value)
+  // They replace the defaults above for the entries that neither the
+  // configuration file nor the command line sets.
+  static const std::map<const std::string, std::map<const std::string, std::string>> provider_defaults;
 
 public:
   // the option for parsing command line with getopt(not GetPot!!!)
@@ -74,11 +241,21 @@ public:
    *  Conf can read configure from multiple sources
    *  - the command line argument has the highest priority, then,
    *  - the configuration files
+   *  - the defaults of the RDMA provider
    *  - the default values.
    **/
   Conf(int argc, char *argv[], GetPot *getpotcfg = nullptr) noexcept {
+    std::set<std::string> explicit_keys;
     // 1 - load configuration from configuration file
     if (getpotcfg != nullptr) {
+      for (const std::string &name : getpotcfg->get_variable_names()) {
+        explicit_keys.insert(name);
+        // The sections of subgroup profiles have no defaults, so their
+        // entries are only known from the file
+        if (name.compare(0, sizeof(CONF_SUBGROUP_PREFIX) - 1, CONF_SUBGROUP_PREFIX) == 0) {
+          this->config[name] = (*getpotcfg)(name.c_str(), "");
+        }
+      }
       for (std::map<const std::string, std::string>::iterator it =
                this->config.begin();
            it != this->config.end(); it++) {
@@ -98,6 +275,7 @@ public:
       switch (c) {
       case 0:
         this->config[long_options[option_index].name] = optarg;
+        explicit_keys.insert(long_options[option_index].name);
         break;
 
       case '?':
@@ -107,8 +285,20 @@ public:
         std::cerr << "ignore unknown commandline code:" << c << std::endl;
       }
     }
+    // 3 - apply the defaults of the provider to the entries left unset
+    auto provider = provider_defaults.find(this->config[CONF_RDMA_PROVIDER]);
+    if (provider != provider_defaults.end()) {
+      for (const auto &entry : provider->second) {
+        if (explicit_keys.count(entry.first) == 0) {
+          this->config[entry.first] = entry.second;
+        }
+      }
+    }
   }
   /** get configuration **/
+  bool hasKey(const std::string &key) const {
+    return this->config.find(key) != this->config.end();
+  }
   const std::string &getString(const std::string &key) const {
     return this->config.at(key);
   }
@@ -136,6 +326,10 @@ public:
   const double getDouble(const std::string &key) const {
     return (const float)std::stod(this->config.at(key));
   }
+  const bool getBoolean(const std::string &key) const {
+    const std::string &value = this->config.at(key);
+    return value == "true" || value == "yes" || value == "1";
+  }
   // Initialize the singleton from the command line and the configuration file.
   // The command line has higher priority than the configuration file
   // The process we find the configuration file:
@@ -165,5 +359,8 @@ const int64_t getConfInt64(const std::string &key);
 const uint64_t getConfUInt64(const std::string &key);
 const float getConfFloat(const std::string &key);
 const double getConfDouble(const std::string &key);
+const bool getConfBoolean(const std::string &key);
+/** Whether the configuration has the key, e.g. a setting of a subgroup profile */
+const bool hasConfKey(const std::string &key);
 } // namespace derecho
 #endif // CONF_HPP
@@ -0,0 +1,149 @@
+#include "fault_injection.hpp"
+#include "conf.hpp"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace derecho {
+
+static int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+FaultInjector::FaultInjector() {
+    parse_config(getConfString(CONF_DERECHO_FAULT_INJECTION));
+}
+
+FaultInjector& FaultInjector::get() {
+    static FaultInjector injector;
+    return injector;
+}
+
+/** Applies the entries of DERECHO/fault_injection; malformed ones are reported and skipped. */
+void FaultInjector::parse_config(const std::string& faults) {
+    std::istringstream entries(faults);
+    std::string entry;
+    while(std::getline(entries, entry, ',')) {
+        std::vector<std::string> fields;
+        std::istringstream entry_stream(entry);
+        std::string field;
+        while(std::getline(entry_stream, field, ':')) {
+            fields.push_back(field);
+        }
+        try {
+            if(fields.size() == 3 && fields[0] == "delay_puts") {
+                delay_puts_to(std::stoul(fields[1]), std::stoull(fields[2]));
+            } else if(fields.size() == 2 && fields[0] == "drop_puts") {
+                drop_puts_to(std::stoul(fields[1]));
+            } else if(fields.size() == 2 && fields[0] == "stall_persistence") {
+                stall_persistence(std::stoull(fields[1]));
+            } else if(fields.size() == 2 && fields[0] == "freeze_sender") {
+                freeze_sender(std::stoull(fields[1]));
+            } else if(fields.size() == 2 && fields[0] == "start") {
+                start_time_ns = steady_now_ns() + std::stoll(fields[1]) * 1000000;
+            } else {
+                throw std::invalid_argument(entry);
+            }
+        } catch(const std::logic_error&) {
+            std::cerr << "Ignoring malformed " << CONF_DERECHO_FAULT_INJECTION << " entry \"" << entry << "\"" << std::endl;
+        }
+    }
+}
+
+bool FaultInjector::started() const {
+    return steady_now_ns() >= start_time_ns.load(std::memory_order_relaxed);
+}
+
+void FaultInjector::delay_puts_to(uint32_t node_id, uint64_t delay_us) {
+    std::lock_guard<std::mutex> lock(put_faults_mutex);
+    if(delay_us) {
+        put_delays_us[node_id] = delay_us;
+        active = true;
+    } else {
+        put_delays_us.erase(node_id);
+    }
+}
+
+void FaultInjector::drop_puts_to(uint32_t node_id, bool drop) {
+    std::lock_guard<std::mutex> lock(put_faults_mutex);
+    if(drop) {
+        dropped_put_nodes.insert(node_id);
+        active = true;
+    } else {
+        dropped_put_nodes.erase(node_id);
+    }
+}
+
+void FaultInjector::stall_persistence(uint64_t stall_ms) {
+    persistence_stall_ms = stall_ms;
+    if(stall_ms) {
+        active = true;
+    }
+}
+
+void FaultInjector::freeze_sender(uint64_t freeze_ms) {
+    pending_sender_freeze_ms = freeze_ms;
+    if(freeze_ms) {
+        active = true;
+    }
+}
+
+void FaultInjector::clear() {
+    std::lock_guard<std::mutex> lock(put_faults_mutex);
+    active = false;
+    put_delays_us.clear();
+    dropped_put_nodes.clear();
+    persistence_stall_ms = 0;
+    pending_sender_freeze_ms = 0;
+    sender_frozen_until_ns = 0;
+}
+
+bool FaultInjector::before_put(uint32_t node_id) {
+    if(!started()) {
+        return true;
+    }
+    uint64_t delay_us = 0;
+    {
+        std::lock_guard<std::mutex> lock(put_faults_mutex);
+        if(dropped_put_nodes.count(node_id)) {
+            return false;
+        }
+        auto delay = put_delays_us.find(node_id);
+        if(delay != put_delays_us.end()) {
+            delay_us = delay->second;
+        }
+    }
+    if(delay_us) {
+        std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+    return true;
+}
+
+void FaultInjector::before_persist() {
+    const uint64_t stall_ms = persistence_stall_ms;
+    if(stall_ms && started()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(stall_ms));
+    }
+}
+
+void FaultInjector::before_send() {
+    if(!started()) {
+        return;
+    }
+    // The first sender thread to get here starts the freeze for all of them
+    const uint64_t freeze_ms = pending_sender_freeze_ms.exchange(0);
+    if(freeze_ms) {
+        sender_frozen_until_ns = steady_now_ns() + static_cast<int64_t>(freeze_ms) * 1000000;
+    }
+    const int64_t frozen_until_ns = sender_frozen_until_ns;
+    const int64_t now_ns = steady_now_ns();
+    if(frozen_until_ns > now_ns) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(frozen_until_ns - now_ns));
+    }
+}
+
+}  // namespace derecho
@@ -0,0 +1,80 @@
+#ifndef FAULT_INJECTION_HPP
+#define FAULT_INJECTION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace derecho {
+
+/**
+ * Faults injected into this process, for measuring what slow or failing
+ * members cost the rest of the group. This is meant for tests: nothing is
+ * injected unless DERECHO/fault_injection is set or a test calls one of the
+ * setters, and until then each hook costs one atomic load.
+ *
+ * DERECHO/fault_injection is a comma-separated list of these entries:
+ *   delay_puts:<node>:<us>   SST writes to the node are held back that long
+ *   drop_puts:<node>         SST writes to the node are never posted, so the
+ *                            writes that wait for completions time out and
+ *                            report it as failed
+ *   stall_persistence:<ms>   each persistence flush is held back that long
+ *   freeze_sender:<ms>       the sender threads stop for that long, once
+ *   start:<ms>               none of the above starts until that long after
+ *                            the injector is first used
+ */
+class FaultInjector {
+    /** Whether any fault has been set; checked before anything else */
+    std::atomic<bool> active{false};
+    /** When the faults take effect, in nanoseconds of the steady clock */
+    std::atomic<int64_t> start_time_ns{0};
+
+    std::mutex put_faults_mutex;
+    std::map<uint32_t, uint64_t> put_delays_us;
+    std::set<uint32_t> dropped_put_nodes;
+
+    std::atomic<uint64_t> persistence_stall_ms{0};
+    /** A freeze that has been requested but not yet started */
+    std::atomic<uint64_t> pending_sender_freeze_ms{0};
+    std::atomic<int64_t> sender_frozen_until_ns{0};
+
+    FaultInjector();
+    void parse_config(const std::string& faults);
+    bool started() const;
+
+public:
+    /** The process's injector, configured from DERECHO/fault_injection */
+    static FaultInjector& get();
+
+    /** Holds back SST writes to a node by delay_us; 0 stops doing so. */
+    void delay_puts_to(uint32_t node_id, uint64_t delay_us);
+    /** Drops SST writes to a node, or stops dropping them. */
+    void drop_puts_to(uint32_t node_id, bool drop = true);
+    /** Holds back every persistence flush by stall_ms; 0 stops doing so. */
+    void stall_persistence(uint64_t stall_ms);
+    /** Stops the sender threads for freeze_ms, starting with their next message. */
+    void freeze_sender(uint64_t freeze_ms);
+    /** Removes every fault. */
+    void clear();
+
+    bool enabled() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Called before posting an SST write to a node: sleeps for the node's
+     * delay, if it has one.
+     * @return false if the write should be dropped
+     */
+    bool before_put(uint32_t node_id);
+    /** Called by a persistence thread before it flushes. */
+    void before_persist();
+    /** Called by a sender thread before it sends a message. */
+    void before_send();
+};
+
+}  // namespace derecho
+#endif  // FAULT_INJECTION_HPP
@@ -0,0 +1,124 @@
+/**
+ * @file byte_view.h
+ *
+ * A parameter type for RPC functions that take large byte arrays, which
+ * lets the handler read the argument where it was delivered instead of
+ * copying it out of the message buffer first.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutils-serialization/SerializationSupport.hpp>
+#include <mutils-serialization/context_ptr.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "deserialization_arena.h"
+
+namespace derecho {
+class ByteView;
+}
+
+namespace mutils {
+/** A ByteView deserialized into a DeserializationArena belongs to the arena */
+template <>
+struct ContextDeleter<derecho::ByteView> {
+    bool in_arena = false;
+    void operator()(derecho::ByteView* view) const;
+};
+}  // namespace mutils
+
+namespace derecho {
+
+/**
+ * A read-only view of bytes owned by someone else, like a std::string_view,
+ * that can be an argument of an RPC function. On the sending side it points
+ * at the caller's data, which is serialized straight into the send buffer.
+ * On the receiving side it points into the delivered message, so the
+ * handler gets the argument without a copy. It is only valid until the
+ * handler returns, since the message buffer is then reused, so a handler
+ * must copy whatever it keeps, and a ByteView must not be part of an
+ * object's replicated or persistent state.
+ *
+ * It is serialized as a size_t length followed by the bytes, the same way
+ * as the Bytes objects of the tests, so a handler can take a ByteView where
+ * callers send Bytes.
+ */
+class ByteView : public mutils::ByteRepresentable {
+    const char* bytes;
+    std::size_t length;
+
+public:
+    ByteView() : bytes(nullptr), length(0) {}
+    ByteView(const char* bytes, std::size_t length) : bytes(bytes), length(length) {}
+    ByteView(std::string_view view) : bytes(view.data()), length(view.size()) {}
+    ByteView(const std::string& string) : bytes(string.data()), length(string.size()) {}
+    ByteView(const std::vector<char>& vector) : bytes(vector.data()), length(vector.size()) {}
+
+    const char* data() const {
+        return bytes;
+    }
+    std::size_t size() const {
+        return length;
+    }
+    bool empty() const {
+        return length == 0;
+    }
+    std::string_view as_string_view() const {
+        return std::string_view(bytes, length);
+    }
+    /** Copies the bytes, for a handler that needs them after it returns. */
+    std::string to_string() const {
+        return std::string(bytes, length);
+    }
+
+    std::size_t to_bytes(char* v) const {
+        ((std::size_t*)(v))[0] = length;
+        if(length > 0) {
+            memcpy(v + sizeof(length), bytes, length);
+        }
+        return length + sizeof(length);
+    }
+
+    std::size_t bytes_size() const {
+        return length + sizeof(length);
+    }
+
+    void post_object(const std::function<void(char const* const, std::size_t)>& f) const {
+        f((const char*)&length, sizeof(length));
+        f(bytes, length);
+    }
+
+    void ensure_registered(mutils::DeserializationManager&) {}
+
+    /** Points into the buffer, like from_bytes_noalloc; the buffer must outlive the view. */
+    static std::unique_ptr<ByteView> from_bytes(mutils::DeserializationManager*, const char* const v) {
+        return std::make_unique<ByteView>(v + sizeof(std::size_t), ((std::size_t*)(v))[0]);
+    }
+
+    /** Constructs the view in the DeserializationArena of dsm, if it has one */
+    static mutils::context_ptr<ByteView> from_bytes_noalloc(mutils::DeserializationManager* dsm, const char* const v) {
+        if(DeserializationArena* arena = DeserializationArena::get(dsm)) {
+            return mutils::context_ptr<ByteView>{
+                    arena->create<ByteView>(v + sizeof(std::size_t), ((std::size_t*)(v))[0]),
+                    mutils::ContextDeleter<ByteView>{true}};
+        }
+        return mutils::context_ptr<ByteView>{new ByteView(v + sizeof(std::size_t), ((std::size_t*)(v))[0])};
+    }
+
+    static mutils::context_ptr<const ByteView> from_bytes_noalloc_const(mutils::DeserializationManager*, const char* const v) {
+        return mutils::context_ptr<const ByteView>{new ByteView(v + sizeof(std::size_t), ((std::size_t*)(v))[0])};
+    }
+};
+
+}  // namespace derecho
+
+inline void mutils::ContextDeleter<derecho::ByteView>::operator()(derecho::ByteView* view) const {
+    if(!in_arena) {
+        delete view;
+    }
+}
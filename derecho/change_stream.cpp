@@ -0,0 +1,246 @@
+/**
+ * @file change_stream.cpp
+ */
+
+#include "change_stream.h"
+#include "conf/affinity.hpp"
+#include "conf/conf.hpp"
+
+#include "tcp/tcp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <optional>
+
+namespace derecho {
+
+ChangeRing::ChangeRing(std::size_t capacity) : buffer(capacity) {}
+
+void ChangeRing::copy_in(uint64_t position, const void* bytes, std::size_t size) {
+    const std::size_t offset = position % buffer.size();
+    const std::size_t first_part = std::min(size, buffer.size() - offset);
+    memcpy(buffer.data() + offset, bytes, first_part);
+    memcpy(buffer.data(), static_cast<const char*>(bytes) + first_part, size - first_part);
+}
+
+void ChangeRing::copy_out(uint64_t position, void* bytes, std::size_t size) const {
+    const std::size_t offset = position % buffer.size();
+    const std::size_t first_part = std::min(size, buffer.size() - offset);
+    memcpy(bytes, buffer.data() + offset, first_part);
+    memcpy(static_cast<char*>(bytes) + first_part, buffer.data(), size - first_part);
+}
+
+bool ChangeRing::overwritten(uint64_t position) const {
+    // pairs with the fence in append(), between moving reclaimed_end and
+    // writing over what it reclaimed
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return position < reclaimed_end.load(std::memory_order_relaxed);
+}
+
+void ChangeRing::append(const ChangeRecordHeader& record_header, const char* payload, std::size_t payload_size) {
+    ChangeRecordHeader header = record_header;
+    header.record_size = sizeof(header) + payload_size;
+    if(header.record_size > buffer.size() / 2) {
+        overwritten_version.store(header.version, std::memory_order_release);
+        return;
+    }
+    const uint64_t write_position = published_end.load(std::memory_order_relaxed);
+    uint64_t reclaim_position = reclaimed_end.load(std::memory_order_relaxed);
+    if(write_position + header.record_size - reclaim_position > buffer.size()) {
+        ChangeRecordHeader oldest;
+        while(write_position + header.record_size - reclaim_position > buffer.size()) {
+            copy_out(reclaim_position, &oldest, sizeof(oldest));
+            reclaim_position += oldest.record_size;
+        }
+        overwritten_version.store(oldest.version, std::memory_order_relaxed);
+        reclaimed_end.store(reclaim_position, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    copy_in(write_position, &header, sizeof(header));
+    copy_in(write_position + sizeof(header), payload, payload_size);
+    published_end.store(write_position + header.record_size, std::memory_order_release);
+}
+
+bool ChangeRing::find(persistent::version_t version, uint64_t& position) const {
+    while(true) {
+        // The overwritten records all have versions up to overwritten_version
+        if(version < get_overwritten_version()) {
+            return false;
+        }
+        const uint64_t end = published_end.load(std::memory_order_acquire);
+        uint64_t candidate = reclaimed_end.load(std::memory_order_acquire);
+        bool lost_place = false;
+        while(candidate < end) {
+            ChangeRecordHeader header;
+            copy_out(candidate, &header, sizeof(header));
+            if(overwritten(candidate)) {
+                lost_place = true;
+                break;
+            }
+            if(header.version > version) {
+                break;
+            }
+            candidate += header.record_size;
+        }
+        if(!lost_place) {
+            position = candidate;
+            return true;
+        }
+    }
+}
+
+bool ChangeRing::read(uint64_t& position, std::vector<char>& out, std::size_t max_bytes) const {
+    const uint64_t end = published_end.load(std::memory_order_acquire);
+    const std::size_t start_size = out.size();
+    uint64_t next = position;
+    while(next < end) {
+        ChangeRecordHeader header;
+        copy_out(next, &header, sizeof(header));
+        if(overwritten(next)) {
+            out.resize(start_size);
+            return false;
+        }
+        if(out.size() > start_size && out.size() - start_size + header.record_size > max_bytes) {
+            break;
+        }
+        const std::size_t record_start = out.size();
+        out.resize(record_start + header.record_size);
+        copy_out(next, out.data() + record_start, header.record_size);
+        if(overwritten(next)) {
+            out.resize(start_size);
+            return false;
+        }
+        next += header.record_size;
+    }
+    if(overwritten(position)) {
+        return false;
+    }
+    position = next;
+    return true;
+}
+
+ChangeStream::ChangeStream() : ring_size(getConfUInt64(CONF_DERECHO_CDC_RING_SIZE)) {}
+
+bool ChangeStream::enabled() {
+    return getConfUInt16(CONF_DERECHO_CDC_PORT) != 0;
+}
+
+ChangeStream& ChangeStream::get() {
+    static ChangeStream stream;
+    return stream;
+}
+
+ChangeRing* ChangeStream::ring(subgroup_id_t subgroup_id) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    std::unique_ptr<ChangeRing>& ring = rings[subgroup_id];
+    if(!ring) {
+        ring = std::make_unique<ChangeRing>(ring_size);
+    }
+    return ring.get();
+}
+
+ChangeRing* ChangeStream::find_ring(subgroup_id_t subgroup_id) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    auto ring_it = rings.find(subgroup_id);
+    return ring_it == rings.end() ? nullptr : ring_it->second.get();
+}
+
+ChangeStreamServer::ChangeStreamServer(uint16_t port) : thread_shutdown(false) {
+    if(port != 0) {
+        server_thread = std::thread(&ChangeStreamServer::serve, this, port);
+    }
+}
+
+ChangeStreamServer::~ChangeStreamServer() {
+    thread_shutdown = true;
+    if(server_thread.joinable()) {
+        server_thread.join();
+    }
+    for(std::thread& subscriber_thread : subscriber_threads) {
+        subscriber_thread.join();
+    }
+}
+
+void ChangeStreamServer::serve(uint16_t port) {
+    name_and_pin_thread("cdc_server");
+    tcp::connection_listener listener(port);
+    // the timeout only bounds how long the destructor waits for this thread
+    constexpr int accept_timeout_ms = 200;
+    while(!thread_shutdown) {
+        std::optional<tcp::socket> subscriber = listener.try_accept(accept_timeout_ms);
+        if(subscriber) {
+            subscriber_threads.emplace_back(&ChangeStreamServer::stream_to, this, std::move(*subscriber));
+        }
+    }
+}
+
+void ChangeStreamServer::stream_to(tcp::socket subscriber) {
+    using namespace std::chrono;
+    name_and_pin_thread("cdc_stream");
+    constexpr std::size_t max_batch_bytes = 1 << 20;
+    constexpr auto idle_sleep = milliseconds(1);
+    constexpr auto keepalive_interval = seconds(1);
+    {
+        tcp::socket_poller poller;
+        poller.add(subscriber, 0);
+        while(poller.wait(200).empty()) {
+            if(thread_shutdown) {
+                return;
+            }
+        }
+        poller.remove(subscriber);
+    }
+    subgroup_id_t subgroup_id;
+    persistent::version_t cursor;
+    if(!subscriber.read(subgroup_id) || !subscriber.read(cursor)) {
+        return;
+    }
+    // The ring is created when this member first delivers in the subgroup
+    ChangeRing* ring;
+    while(!(ring = ChangeStream::get().find_ring(subgroup_id))) {
+        if(thread_shutdown) {
+            return;
+        }
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    if(cursor == -1) {
+        cursor = ring->get_overwritten_version();
+    }
+    persistent::version_t lost_through = -1;
+    uint64_t position;
+    while(!ring->find(cursor, position)) {
+        lost_through = cursor = ring->get_overwritten_version();
+    }
+    std::vector<char> batch;
+    auto last_write = steady_clock::now();
+    while(!thread_shutdown) {
+        batch.clear();
+        if(!ring->read(position, batch, max_batch_bytes)) {
+            // The subscriber fell a whole ring behind
+            persistent::version_t lost = ring->get_overwritten_version();
+            while(!ring->find(lost, position)) {
+                lost = ring->get_overwritten_version();
+            }
+            lost_through = lost;
+            continue;
+        }
+        const auto now = steady_clock::now();
+        if(batch.empty() && lost_through == -1 && now - last_write < keepalive_interval) {
+            std::this_thread::sleep_for(idle_sleep);
+            continue;
+        }
+        const ChangeBatchHeader batch_header{batch.size(), lost_through};
+        std::vector<std::pair<const char*, size_t>> buffers{{reinterpret_cast<const char*>(&batch_header), sizeof(batch_header)}};
+        if(!batch.empty()) {
+            buffers.emplace_back(batch.data(), batch.size());
+        }
+        if(!subscriber.writev(buffers)) {
+            return;
+        }
+        lost_through = -1;
+        last_write = now;
+    }
+}
+
+}  // namespace derecho
@@ -0,0 +1,170 @@
+/**
+ * @file change_stream.h
+ *
+ * A change-data-capture tap on the messages a member delivers in its ordered
+ * and sequenced subgroups, which processes outside the group can follow over
+ * TCP without joining it or reading the persistent logs.
+ */
+
+#pragma once
+
+#include "derecho_internal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tcp {
+class socket;
+}
+
+namespace derecho {
+
+/**
+ * The fixed part of a delivered message's record, in a ChangeRing and on the
+ * wire; the message's payload follows it. The payload of an RPC message (an
+ * ordered_send) is the RPC message as the multicast carried it, starting
+ * with its header, which names the function.
+ */
+struct ChangeRecordHeader {
+    /** The size of the record, this header included */
+    uint64_t record_size;
+    /** The version the message created */
+    persistent::version_t version;
+    /** The sender's timestamp of the message, in microseconds, which is also
+     * the HLC of its version */
+    uint64_t hlc_us;
+    node_id_t sender_id;
+    subgroup_id_t subgroup_id;
+};
+
+/**
+ * A bounded ring of the records of one subgroup's delivered messages, in the
+ * order they were delivered. The thread that delivers the subgroup's messages
+ * appends to it, overwriting the oldest records once it is full, and any
+ * number of readers copy records out of it without taking a lock.
+ *
+ * A position in the ring is an offset in the stream of all the bytes ever
+ * appended to it. Before the writer overwrites a record it moves
+ * reclaimed_end past it, so a reader that finds reclaimed_end still at or
+ * before the position it started copying from once the copy is done has a
+ * copy that the writer did not touch.
+ */
+class ChangeRing {
+    std::vector<char> buffer;
+    /** Records before reclaimed_end may be overwritten, and records before
+     * published_end are complete */
+    std::atomic<uint64_t> reclaimed_end{0};
+    std::atomic<uint64_t> published_end{0};
+    /** The latest version among the records that have been overwritten */
+    std::atomic<persistent::version_t> overwritten_version{-1};
+
+    void copy_in(uint64_t position, const void* bytes, std::size_t size);
+    void copy_out(uint64_t position, void* bytes, std::size_t size) const;
+    /** Whether the bytes copied from position on may have been overwritten */
+    bool overwritten(uint64_t position) const;
+
+public:
+    /** @param capacity The number of bytes of records the ring holds */
+    explicit ChangeRing(std::size_t capacity);
+
+    /**
+     * Adds a delivered message's record. Only one thread may append at a
+     * time. A record larger than half the ring is counted as overwritten
+     * right away instead of emptying the ring.
+     */
+    void append(const ChangeRecordHeader& record_header, const char* payload, std::size_t payload_size);
+
+    /**
+     * Finds where to resume reading after a version.
+     * @param version The latest version the reader already has, or -1 for
+     * the oldest record still in the ring
+     * @param position Set to the position of the first record after version
+     * @return false if records after version have already been overwritten
+     */
+    bool find(persistent::version_t version, uint64_t& position) const;
+
+    /**
+     * Copies complete records from position on to the end of out, until
+     * max_bytes would be exceeded (but always at least one record), and
+     * advances position past them.
+     * @return false if the records at position have been overwritten, in
+     * which case nothing is copied
+     */
+    bool read(uint64_t& position, std::vector<char>& out, std::size_t max_bytes) const;
+
+    /** The latest version that has been overwritten, or -1 if none has */
+    persistent::version_t get_overwritten_version() const {
+        return overwritten_version.load(std::memory_order_acquire);
+    }
+};
+
+/**
+ * The process's change rings, one for each ordered or sequenced subgroup this
+ * member has delivered messages in, if DERECHO/cdc_port is set. They outlive
+ * views, so a subscriber keeps its place in a subgroup's stream across view
+ * changes.
+ */
+class ChangeStream {
+    std::mutex rings_mutex;
+    std::map<subgroup_id_t, std::unique_ptr<ChangeRing>> rings;
+    const std::size_t ring_size;
+
+    ChangeStream();
+
+public:
+    /** Whether delivered messages should be recorded */
+    static bool enabled();
+    /** The process's change stream */
+    static ChangeStream& get();
+
+    /** Gets the ring of a subgroup, creating it if this is its first use */
+    ChangeRing* ring(subgroup_id_t subgroup_id);
+    /** Gets the ring of a subgroup, or nullptr if it has none yet */
+    ChangeRing* find_ring(subgroup_id_t subgroup_id);
+};
+
+/**
+ * The header of each batch of records the ChangeStreamServer sends; size
+ * bytes of records follow it.
+ */
+struct ChangeBatchHeader {
+    uint64_t size;
+    /** If not -1, records up to this version were overwritten before the
+     * subscriber could read them, and it must catch up on them from the
+     * subgroup's persisted state (as of this version or later) before it
+     * applies the records in this batch */
+    persistent::version_t lost_through;
+};
+
+/**
+ * Streams the records of ChangeStream::get() to subscribers on a TCP port. A
+ * subscriber connects and sends the subgroup ID (a subgroup_id_t) and the
+ * latest version it already has (a persistent::version_t, -1 for the oldest
+ * one still recorded), which makes its cursor resumable across connections.
+ * The server then sends it batches of records, each after a
+ * ChangeBatchHeader, as they are delivered, one thread per subscriber. An
+ * idle subscriber gets an empty batch every second, which is how the server
+ * notices that it has gone.
+ */
+class ChangeStreamServer {
+    std::atomic<bool> thread_shutdown;
+    std::thread server_thread;
+    /** Only touched by server_thread, and joined once it has been */
+    std::list<std::thread> subscriber_threads;
+
+    void serve(uint16_t port);
+    void stream_to(tcp::socket subscriber);
+
+public:
+    /** Starts serving on a port, unless it is 0. */
+    ChangeStreamServer(uint16_t port);
+    ~ChangeStreamServer();
+};
+
+}  // namespace derecho
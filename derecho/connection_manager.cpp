@@ -10,6 +10,7 @@ bool tcp_connections::add_connection(const node_id_t other_id,
     if(other_id < my_id) {
         try {
             sockets[other_id] = socket(other_ip_and_port.first, other_ip_and_port.second);
+            socket_mutexes[other_id];
         } catch(exception) {
             std::cerr << "WARNING: failed to connect to node " << other_id << " at "
                       << other_ip_and_port.first << ":" << other_ip_and_port.second << std::endl;
@@ -44,6 +45,7 @@ bool tcp_connections::add_connection(const node_id_t other_id,
                     return false;
                 } else {
                     sockets[remote_id] = std::move(s);
+                    socket_mutexes[remote_id];
                     //If the connection we got wasn't the intended node, keep
                     //looping and try again; there must be multiple nodes connecting
                     //simultaneously
@@ -84,21 +86,21 @@ tcp_connections::tcp_connections(node_id_t my_id,
 }
 
 void tcp_connections::destroy() {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     sockets.clear();
     conn_listener.reset();
 }
 
 bool tcp_connections::write(node_id_t node_id, char const* buffer,
                             size_t size) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     const auto it = sockets.find(node_id);
     assert(it != sockets.end());
     return it->second.write(buffer, size);
 }
 
 bool tcp_connections::write_all(char const* buffer, size_t size) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     bool success = true;
     for(auto& p : sockets) {
         if(p.first == my_id) {
@@ -111,14 +113,21 @@ bool tcp_connections::write_all(char const* buffer, size_t size) {
 
 bool tcp_connections::read(node_id_t node_id, char* buffer,
                            size_t size) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     const auto it = sockets.find(node_id);
     assert(it != sockets.end());
     return it->second.read(buffer, size);
 }
 
 bool tcp_connections::add_node(node_id_t new_id, const std::pair<ip_addr_t, uint16_t>& new_ip_addr_and_port) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    {
+        //Check without excluding the users of other sockets first, since one
+        //could be in a long state transfer
+        std::shared_lock<std::shared_timed_mutex> sockets_lock(sockets_mutex);
+        if(sockets.count(new_id) > 0)
+            return true;
+    }
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     assert(new_id != my_id);
     //If there's already a connection to this ID, just return "success"
     if(sockets.count(new_id) > 0)
@@ -127,12 +136,13 @@ bool tcp_connections::add_node(node_id_t new_id, const std::pair<ip_addr_t, uint
 }
 
 bool tcp_connections::delete_node(node_id_t remove_id) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
+    socket_mutexes.erase(remove_id);
     return (sockets.erase(remove_id) > 0);
 }
 
 int32_t tcp_connections::probe_all() {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
+    std::lock_guard<std::shared_timed_mutex> lock(sockets_mutex);
     for(auto& p : sockets) {
         bool new_data_available = p.second.probe();
         if(new_data_available == true) {
@@ -142,7 +152,9 @@ int32_t tcp_connections::probe_all() {
     return -1;
 }
 
-derecho::LockedReference<std::unique_lock<std::mutex>, socket> tcp_connections::get_socket(node_id_t node_id) {
-    return derecho::LockedReference<std::unique_lock<std::mutex>, socket>(sockets.at(node_id), sockets_mutex);
+locked_socket tcp_connections::get_socket(node_id_t node_id) {
+    std::shared_lock<std::shared_timed_mutex> sockets_lock(sockets_mutex);
+    std::unique_lock<std::mutex> lock(socket_mutexes.at(node_id));
+    return locked_socket(sockets.at(node_id), socket_lock{std::move(sockets_lock), std::move(lock)});
 }
 }  // namespace tcp
@@ -3,18 +3,33 @@
 #include <cassert>
 #include <map>
 #include <mutex>
+#include <shared_mutex>
 
 #include "derecho/derecho_type_definitions.h"
 #include "locked_reference.h"
 #include "tcp/tcp.h"
 
 namespace tcp {
+/**
+ * The locks held by a socket reference from tcp_connections::get_socket: the
+ * set of sockets, shared, so that it can't change, and the socket itself.
+ */
+struct socket_lock {
+    std::shared_lock<std::shared_timed_mutex> sockets_lock;
+    std::unique_lock<std::mutex> lock;
+};
+
+using locked_socket = derecho::LockedReference<socket_lock, socket>;
+
 class tcp_connections {
-    std::mutex sockets_mutex;
+    /** Held exclusively by every method but get_socket, which holds it shared */
+    std::shared_timed_mutex sockets_mutex;
 
     node_id_t my_id;
     std::unique_ptr<connection_listener> conn_listener;
     std::map<node_id_t, socket> sockets;
+    /** Locked by get_socket, so that different sockets can be used at once */
+    std::map<node_id_t, std::mutex> socket_mutexes;
     bool add_connection(const node_id_t other_id,
                         const std::pair<ip_addr_t, uint16_t>& other_ip_and_port);
     void establish_node_connections(
@@ -81,11 +96,17 @@ public:
      * was not.
      */
     bool delete_node(node_id_t remove_id);
+    /**
+     * Sends a POD object to a node and receives one from it. Only the socket
+     * to that node is locked, like with get_socket, so that the exchanges
+     * with different nodes can go on in parallel.
+     */
     template <class T>
     bool exchange(node_id_t node_id, T local, T& remote) {
-        std::lock_guard<std::mutex> lock(sockets_mutex);
+        std::shared_lock<std::shared_timed_mutex> sockets_lock(sockets_mutex);
         const auto it = sockets.find(node_id);
         assert(it != sockets.end());
+        std::lock_guard<std::mutex> lock(socket_mutexes.at(node_id));
         return it->second.exchange(local, remote);
     }
     /**
@@ -101,12 +122,13 @@ public:
     /**
      * Gets a locked reference to the TCP socket connected to a particular node.
      * While the caller holds the locked reference to the socket, no other
-     * tcp_connections methods can be called. This makes it safe to use this
-     * method to access sockets directly, even though they are usually managed
-     * by the other tcp_connections methods.
+     * tcp_connections methods can be called, except get_socket for other
+     * sockets, so several threads can each use a socket of their own. This
+     * makes it safe to use this method to access sockets directly, even though
+     * they are usually managed by the other tcp_connections methods.
      * @param node_id The ID of the desired node
      * @return A LockedReference to the TCP socket connected to that node.
      */
-    derecho::LockedReference<std::unique_lock<std::mutex>, socket> get_socket(node_id_t node_id);
+    locked_socket get_socket(node_id_t node_id);
 };
 }  // namespace tcp
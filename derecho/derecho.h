@@ -1,10 +1,14 @@
 #pragma once
 
+#include "byte_view.h"
 #include "derecho_exception.h"
 #include "derecho_internal.h"
 #include "derecho_type_definitions.h"
+#include "external_client.h"
 #include "group.h"
 #include "register_rpc_functions.h"
+#include "replicated_kv_store.h"
+#include "rpc_awaitable.h"
 #include "subgroup_functions.h"
 #include "subgroup_info.h"
 #include <mutils-serialization/SerializationSupport.hpp>
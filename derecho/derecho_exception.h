@@ -36,4 +36,12 @@ struct empty_reference_exception : public derecho_exception {
 struct invalid_subgroup_exception : public derecho_exception {
     invalid_subgroup_exception(const std::string& message) : derecho_exception(message) {}
 };
+
+/**
+ * Exception that means a message is larger than the group is configured to
+ * carry, so it was not sent.
+ */
+struct message_too_large_exception : public derecho_exception {
+    message_too_large_exception(const std::string& message) : derecho_exception(message) {}
+};
 }  // namespace derecho
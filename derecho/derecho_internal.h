@@ -10,6 +10,7 @@
 #include <map>
 #include <string>
 #include <sys/types.h>
+#include <vector>
 
 #include "derecho/derecho_type_definitions.h"
 #include "persistent/HLC.hpp"
@@ -33,8 +34,22 @@ using message_id_t = int32_t;
 /** Alias for the type of std::function that is used for message delivery event callbacks. */
 using message_callback_t = std::function<void(subgroup_id_t, node_id_t, message_id_t, char*, long long int)>;
 using persistence_callback_t = std::function<void(subgroup_id_t, persistent::version_t)>;
+/** Alias for the type of callback that is told a subgroup has persisted
+ * every version from the second argument up to the third, inclusive. */
+using persistence_range_callback_t = std::function<void(subgroup_id_t, persistent::version_t, persistent::version_t)>;
 using rpc_handler_t = std::function<void(subgroup_id_t, node_id_t, char*, uint32_t)>;
 
+/** One raw message in a batch handed to a message_batch_callback_t. The
+ * payload pointer is only valid until the callback returns. */
+struct DeliveredMessage {
+    node_id_t sender_id;
+    message_id_t index;
+    char* payload;
+    long long int size;
+};
+/** Alias for the type of std::function that is used to deliver a run of messages, in delivery order, with one call. */
+using message_batch_callback_t = std::function<void(subgroup_id_t, const std::vector<DeliveredMessage>&)>;
+
 /** The type of factory function the user must provide to the Group constructor,
  * to construct each Replicated Object that is assigned to a subgroup */
 template <typename T>
@@ -0,0 +1,66 @@
+/**
+ * @file derecho_log.h
+ *
+ * Logging macros for the hot paths of the multicast, view management and RPC
+ * code, which run on the SST predicate thread and the delivery threads. Each
+ * of these subsystems has a minimum log level fixed at compile time: a call
+ * below it compiles to nothing, so neither the level check nor its arguments
+ * cost anything on those threads. A call at or above it checks the logger's
+ * level at run time, as whenlog(logger->...) does, and then only queues the
+ * message for the logger's background thread.
+ *
+ * The minimum levels are DERECHO_MULTICAST_LOG_LEVEL, DERECHO_VIEW_LOG_LEVEL
+ * and DERECHO_RPC_LOG_LEVEL, each one of the DERECHO_LOG_LEVEL_* values; they
+ * default to DERECHO_LOG_LEVEL_TRACE, and a build sets them with -D. Under
+ * NOLOG every call compiles to nothing, as with whenlog.
+ *
+ * The macros use the logger member of the class they are called in:
+ * multicast_log(TRACE, "Subgroup {}, delivered {}", subgroup_num, count);
+ */
+
+#pragma once
+
+#ifndef NOLOG
+#include <spdlog/spdlog.h>
+#endif
+
+/* The levels of spdlog::level::level_enum, as numbers the preprocessor and
+ * if constexpr can compare */
+#define DERECHO_LOG_LEVEL_TRACE 0
+#define DERECHO_LOG_LEVEL_DEBUG 1
+#define DERECHO_LOG_LEVEL_INFO 2
+#define DERECHO_LOG_LEVEL_WARN 3
+#define DERECHO_LOG_LEVEL_ERROR 4
+#define DERECHO_LOG_LEVEL_CRITICAL 5
+#define DERECHO_LOG_LEVEL_OFF 6
+
+#ifndef DERECHO_MULTICAST_LOG_LEVEL
+#define DERECHO_MULTICAST_LOG_LEVEL DERECHO_LOG_LEVEL_TRACE
+#endif
+#ifndef DERECHO_VIEW_LOG_LEVEL
+#define DERECHO_VIEW_LOG_LEVEL DERECHO_LOG_LEVEL_TRACE
+#endif
+#ifndef DERECHO_RPC_LOG_LEVEL
+#define DERECHO_RPC_LOG_LEVEL DERECHO_LOG_LEVEL_TRACE
+#endif
+
+#ifdef NOLOG
+#define DERECHO_LOG(min_level, lvl, ...)
+#else
+#define DERECHO_LOG(min_level, lvl, ...)                                                        \
+    do {                                                                                        \
+        if constexpr(DERECHO_LOG_LEVEL_##lvl >= (min_level)) {                                  \
+            constexpr auto derecho_log_level = spdlog::level::level_enum(DERECHO_LOG_LEVEL_##lvl);\
+            if(logger->should_log(derecho_log_level)) {                                         \
+                logger->log(derecho_log_level, __VA_ARGS__);                                    \
+            }                                                                                   \
+        }                                                                                       \
+    } while(0)
+#endif
+
+/** Logs at a level (TRACE, DEBUG, INFO, WARN, ERROR or CRITICAL) from MulticastGroup */
+#define multicast_log(level, ...) DERECHO_LOG(DERECHO_MULTICAST_LOG_LEVEL, level, __VA_ARGS__)
+/** Logs at a level from ViewManager */
+#define view_log(level, ...) DERECHO_LOG(DERECHO_VIEW_LOG_LEVEL, level, __VA_ARGS__)
+/** Logs at a level from RPCManager */
+#define rpc_log(level, ...) DERECHO_LOG(DERECHO_RPC_LOG_LEVEL, level, __VA_ARGS__)
@@ -2,7 +2,21 @@
 
 namespace derecho {
 enum class Mode {
+    /** Totally ordered: every member delivers every stable message in the
+     * same round-robin order over the senders, and versions persistent state */
     ORDERED,
-    UNORDERED
+    /** Raw: messages are handed to the stability callback as soon as they
+     * are received locally, with no ordering or stability guarantee */
+    UNORDERED,
+    /** Per-sender FIFO: each sender's messages are delivered in the order it
+     * sent them once every member has received them, independently of the
+     * other senders, so a slow sender doesn't hold up the rest. Since members
+     * can interleave the senders differently, persistent state isn't versioned. */
+    FIFO,
+    /** Totally ordered by a sequencer, the shard member with shard rank 0,
+     * which orders messages as it receives them instead of waiting for every
+     * sender's turn, so delivery latency doesn't grow with the number of
+     * senders. Versions persistent state like ORDERED. */
+    SEQUENCED
 };
 }
@@ -42,6 +42,9 @@ void DerechoSST::init_local_row_from_previous(const DerechoSST& old_sst, const i
     num_acked[local_row] = old_sst.num_acked[row];
     num_installed[local_row] = old_sst.num_installed[row] + num_changes_installed;
     wedged[local_row] = false;
+    for(size_t i = 0; i < user_fields.size() && i < old_sst.user_fields.size(); ++i) {
+        user_fields[local_row][i] = old_sst.user_fields[row][i];
+    }
 }
 
 void DerechoSST::init_local_change_proposals(const int other_row) {
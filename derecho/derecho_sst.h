@@ -47,6 +47,15 @@ public:
      * persisted to disk at this node, if persistence is enabled. This is
      * updated by the PersistenceManager. */
     SSTFieldVector<persistent::version_t> persisted_num;
+    /** With aggregated stability, the minimum of the stable_num of the
+     * members of the aggregation group this node leads, if it leads one.
+     * Only sent to the shard member with shard rank 0. */
+    SSTFieldVector<message_id_t> group_stable_num;
+    /** With aggregated stability, the minimum of the stable_num of every
+     * member of the shard, as computed by the shard member with shard rank 0
+     * from the group_stable_num of the group leaders. Only written by that
+     * member; the others read it instead of every row. */
+    SSTFieldVector<message_id_t> shard_stable_num;
 
     // Group management service members, related only to handling view changes
     /** View ID associated with this SST. VIDs monotonically increase as views change. */
@@ -90,31 +99,93 @@ public:
      */
     SSTFieldVector<int32_t> num_received;
     /** Set after calling rdmc::wedged(), reports that this member is wedged.
-     * Must be after num_received!*/
+     * Must be after num_received in both row layouts!*/
     SSTField<bool> wedged;
     /** Array of how many messages to accept from each sender in the current view change */
     SSTFieldVector<int> global_min;
     /** Array indicating whether each shard leader (indexed by subgroup number)
      * has published a global_min for the current view change*/
     SSTFieldVector<bool> global_min_ready;
-    /** for SST multicast */
+    /** for SST multicast: each subgroup's window of message slots, which
+     * start at its SubgroupSettings::slots_offset. The windows of subgroups
+     * that have no sender in common overlap, since each row only holds the
+     * messages of the member it belongs to. */
     SSTFieldVector<char> slots;
     SSTFieldVector<int32_t> num_received_sst;
+    /** For each SST multicast sender, the highest num_received_sst up to which
+     * this node has delivered and released every message, so that the sender
+     * can reuse the slots. Only maintained when slot pinning is enabled. */
+    SSTFieldVector<int32_t> num_released_sst;
+    /** For each sender (indexed like num_received), the index of the sender's
+     * next message, once it has announced that it skips every index between
+     * its last message and this one instead of sending null messages for
+     * them. -1 until the sender first skips. Only written by the sender. */
+    SSTFieldVector<int32_t> null_skip_index;
+    /** For each sender (indexed like num_received), the index of its last
+     * message that this node has delivered. Only maintained in FIFO and
+     * SEQUENCED subgroups, which don't deliver in round-robin order. */
+    SSTFieldVector<int32_t> delivered_index;
+    /** In a SEQUENCED subgroup, the sequence number of the last message the
+     * sequencer (the shard member with shard rank 0) has placed in the
+     * delivery order. Only written by the sequencer. */
+    SSTFieldVector<message_id_t> sequenced_num;
+    /** The delivery order of each SEQUENCED subgroup, as a ring of the
+     * shard sender ranks of its messages; each subgroup's ring starts at its
+     * SubgroupSettings::sequence_order_offset. Only written by the
+     * sequencer, and empty if there are no SEQUENCED subgroups. */
+    SSTFieldVector<uint16_t> sequence_order;
+    /** In a subgroup with rdmc_send_token, the turn of the token that lets
+     * one shard sender at a time start RDMC sends: the largest entry among
+     * the shard's senders, held by the sender whose sender rank is the turn
+     * modulo the number of senders. Only written by the holder, to pass the
+     * token on. */
+    SSTFieldVector<uint64_t> send_token;
+    /** In a subgroup with rdmc_send_token, whether this sender has an RDMC
+     * send ready and is waiting for the token */
+    SSTFieldVector<bool> send_token_wanted;
 
     /** to check for failures - used by the thread running check_failures_loop in derecho_group **/
     SSTFieldVector<uint64_t> local_stability_frontier;
+    /** Incremented by the failure checking thread on each of its ticks, so
+     * that the other members can tell how regularly this one reports in.
+     * Follows local_stability_frontier, which is written with it. */
+    SSTField<uint64_t> heartbeat;
+    /** For barrier_sync's dissemination barrier: entry r is the number of the
+     * latest barrier in which this member has signalled round r, and is
+     * written only to the member 2^r rows after this one. */
+    SSTFieldVector<uint64_t> barrier_rounds;
+    /** The values the application publishes with Group::set_user_sst_field;
+     * only written by the application's threads */
+    SSTFieldVector<uint64_t> user_fields;
+    /** The number of rounds of a dissemination barrier among num_members,
+     * ceil(log2(num_members)), but at least 1 */
+    static std::size_t num_barrier_rounds(std::size_t num_members) {
+        std::size_t rounds = 1;
+        while((std::size_t{1} << rounds) < num_members) {
+            rounds++;
+        }
+        return rounds;
+    }
     /**
      * Constructs an SST, and initializes the GMS fields to "safe" initial values
      * (0, false, etc.). Initializing the MulticastGroup fields is left to MulticastGroup.
      * @param parameters The SST parameters, which will be forwarded to the
      * standard SST constructor.
+     * @param slots_size The number of bytes of slots, which hold the windows
+     * of every subgroup.
+     * @param sequence_order_size The number of entries of sequence_order,
+     * which is 0 unless the View has SEQUENCED subgroups.
+     * @param num_user_fields The number of entries of user_fields.
      */
-    DerechoSST(const sst::SSTParams& parameters, uint32_t num_subgroups, uint32_t num_received_size, uint32_t window_size, uint64_t sst_max_msg_size)
+    DerechoSST(const sst::SSTParams& parameters, uint32_t num_subgroups, uint32_t num_received_size,
+               uint64_t slots_size, uint32_t sequence_order_size = 0, uint32_t num_user_fields = 0)
             : sst::SST<DerechoSST>(this, parameters),
               seq_num(num_subgroups),
               stable_num(num_subgroups),
               delivered_num(num_subgroups),
               persisted_num(num_subgroups),
+              group_stable_num(num_subgroups),
+              shard_stable_num(num_subgroups),
               suspected(parameters.members.size()),
               changes(100 + parameters.members.size()),
               joiner_ips(100 + parameters.members.size()),
@@ -125,15 +196,51 @@ public:
               num_received(num_received_size),
               global_min(num_received_size),
               global_min_ready(num_subgroups),
-              slots((sst_max_msg_size)*window_size * num_subgroups),
+              slots(slots_size),
               num_received_sst(num_received_size),
-              local_stability_frontier(num_subgroups) {
-        SSTInit(seq_num, stable_num, delivered_num,
-                persisted_num, vid, suspected, changes, joiner_ips,
-                joiner_gms_ports, joiner_rpc_ports, joiner_sst_ports, joiner_rdmc_ports,
-                num_changes, num_committed, num_acked, num_installed,
-                num_received, wedged, global_min, global_min_ready,
-                slots, num_received_sst, local_stability_frontier);
+              num_released_sst(num_received_size),
+              null_skip_index(num_received_size),
+              delivered_index(num_received_size),
+              sequenced_num(num_subgroups),
+              sequence_order(sequence_order_size),
+              send_token(num_subgroups),
+              send_token_wanted(num_subgroups),
+              local_stability_frontier(num_subgroups),
+              barrier_rounds(num_barrier_rounds(parameters.members.size())),
+              user_fields(num_user_fields) {
+        // The senders write their slots themselves, and they make up most of
+        // the row, so the whole-row puts leave them out
+        slots.exclude_from_row_puts();
+        if(parameters.cache_line_layout) {
+            // Keep the counters updated on every message together at the start
+            // of the row, and start a new cache line wherever a different
+            // thread takes over writing (persisted_num is written by the
+            // PersistenceManager, local_stability_frontier by the failure
+            // checking thread), at the start of the rarely written GMS fields,
+            // and at the start of the remotely written message slots.
+            persisted_num.align_to_cache_line();
+            local_stability_frontier.align_to_cache_line();
+            vid.align_to_cache_line();
+            user_fields.align_to_cache_line();
+            slots.align_to_cache_line();
+            SSTInit(seq_num, stable_num, delivered_num, group_stable_num, shard_stable_num, num_received, num_received_sst,
+                    num_released_sst, null_skip_index, delivered_index, sequenced_num, sequence_order,
+                    send_token, send_token_wanted, persisted_num, local_stability_frontier, heartbeat,
+                    vid, suspected, changes, joiner_ips,
+                    joiner_gms_ports, joiner_rpc_ports, joiner_sst_ports, joiner_rdmc_ports,
+                    num_changes, num_committed, num_acked, num_installed, barrier_rounds,
+                    wedged, global_min, global_min_ready, user_fields, slots);
+        } else {
+            SSTInit(seq_num, stable_num, delivered_num,
+                    persisted_num, group_stable_num, shard_stable_num, vid, suspected, changes, joiner_ips,
+                    joiner_gms_ports, joiner_rpc_ports, joiner_sst_ports, joiner_rdmc_ports,
+                    num_changes, num_committed, num_acked, num_installed,
+                    num_received, wedged, global_min, global_min_ready,
+                    slots, num_received_sst, num_released_sst, null_skip_index, delivered_index,
+                    sequenced_num, sequence_order, send_token, send_token_wanted,
+                    local_stability_frontier, heartbeat,
+                    barrier_rounds, user_fields);
+        }
         //Once superclass constructor has finished, table entries can be initialized
         for(unsigned int row = 0; row < get_num_rows(); ++row) {
             vid[row] = 0;
@@ -159,6 +266,13 @@ public:
             num_installed[row] = 0;
             num_acked[row] = 0;
             wedged[row] = false;
+            heartbeat[row] = 0;
+            for(size_t i = 0; i < barrier_rounds.size(); ++i) {
+                barrier_rounds[row][i] = 0;
+            }
+            for(size_t i = 0; i < user_fields.size(); ++i) {
+                user_fields[row][i] = 0;
+            }
             // start off local_stability_frontier with the current time
             struct timespec start_time;
             clock_gettime(CLOCK_REALTIME, &start_time);
@@ -173,8 +287,8 @@ public:
      * Initializes the local row of this SST based on the specified row of the
      * previous View's SST. Copies num_changes, num_committed, and num_acked,
      * adds num_changes_installed to the previous value of num_installed, copies
-     * (num_changes - num_changes_installed) elements of changes, and initializes
-     * the other SST fields to 0/false.
+     * (num_changes - num_changes_installed) elements of changes, copies
+     * user_fields, and initializes the other SST fields to 0/false.
      * @param old_sst The SST instance to copy data from
      * @param row The target row in that SST instance (from which data will be copied)
      * @param num_changes_installed The number of changes that were applied
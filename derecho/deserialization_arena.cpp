@@ -0,0 +1,56 @@
+/**
+ * @file deserialization_arena.cpp
+ */
+
+#include "deserialization_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace derecho {
+
+DeserializationArena::DeserializationArena(std::size_t block_size) {
+    blocks.push_back(block{std::make_unique<char[]>(block_size), block_size});
+}
+
+DeserializationArena::~DeserializationArena() {
+    reset();
+}
+
+void* DeserializationArena::allocate(std::size_t size, std::size_t alignment) {
+    while(true) {
+        block& current = blocks[current_block];
+        const uintptr_t start = reinterpret_cast<uintptr_t>(current.memory.get());
+        const std::size_t offset = ((start + used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - start;
+        if(offset + size <= current.size) {
+            used = offset + size;
+            return current.memory.get() + offset;
+        }
+        current_block++;
+        used = 0;
+        if(current_block == blocks.size()) {
+            // Big enough for the allocation at any alignment
+            const std::size_t new_size = std::max(blocks[0].size, size + alignment);
+            blocks.push_back(block{std::make_unique<char[]>(new_size), new_size});
+        }
+    }
+}
+
+void DeserializationArena::reset() {
+    for(auto object = destructors.rbegin(); object != destructors.rend(); ++object) {
+        object->second(object->first);
+    }
+    destructors.clear();
+    if(blocks.size() > 1) {
+        std::size_t total_size = 0;
+        for(const block& b : blocks) {
+            total_size += b.size;
+        }
+        blocks.clear();
+        blocks.push_back(block{std::make_unique<char[]>(total_size), total_size});
+    }
+    current_block = 0;
+    used = 0;
+}
+
+}  // namespace derecho
@@ -0,0 +1,86 @@
+/**
+ * @file deserialization_arena.h
+ *
+ * An arena that objects deserialized for the duration of an RPC handler can
+ * be allocated in, so that delivering a message doesn't call malloc and
+ * free for each of its arguments.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <mutils-serialization/SerializationSupport.hpp>
+
+namespace derecho {
+
+/**
+ * A bump allocator that the RPC manager registers with the
+ * DeserializationManager it deserializes the arguments of RPC calls with.
+ * A type whose from_bytes_noalloc() finds an arena there (see get()) can
+ * construct the object in it instead of on the heap, with a ContextDeleter
+ * that leaves it alone; the arena destroys all of its objects at once when
+ * the handler has returned. Objects in the arena must not outlive the
+ * handler, so a type that does this has to copy anything it points to in
+ * the message buffer when the object is copied or moved.
+ *
+ * Each thread that delivers RPC messages has its own arena, so it isn't
+ * thread-safe. It keeps its memory when it is reset, and after a reset in
+ * which it needed more than one block, it replaces them with one block of
+ * their total size, so it soon stops allocating at all.
+ */
+class DeserializationArena : public mutils::RemoteDeserializationContext {
+    struct block {
+        std::unique_ptr<char[]> memory;
+        std::size_t size;
+    };
+    std::vector<block> blocks;
+    /** The block allocations come from, and the bytes used in it */
+    std::size_t current_block = 0;
+    std::size_t used = 0;
+    /** The objects to destroy on reset, in the order they were created */
+    std::vector<std::pair<void*, void (*)(void*)>> destructors;
+
+public:
+    explicit DeserializationArena(std::size_t block_size = 64 * 1024);
+    DeserializationArena(const DeserializationArena&) = delete;
+    DeserializationArena& operator=(const DeserializationArena&) = delete;
+    ~DeserializationArena();
+
+    /** Allocates size bytes aligned to alignment, which must be a power of 2 */
+    void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+
+    /** Makes reset() destroy the object at object, which is in the arena */
+    template <typename T>
+    void destroy_on_reset(T* object) {
+        if constexpr(!std::is_trivially_destructible<T>::value) {
+            destructors.emplace_back(object, [](void* p) { static_cast<T*>(p)->~T(); });
+        }
+    }
+
+    /** Constructs a T in the arena, which reset() will destroy */
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        destroy_on_reset(object);
+        return object;
+    }
+
+    /** Destroys every object in the arena and frees all of its memory for reuse */
+    void reset();
+
+    /** The arena registered with dsm, or null if there is none */
+    static DeserializationArena* get(mutils::DeserializationManager* dsm) {
+        if(dsm == nullptr || !dsm->registered<DeserializationArena>()) {
+            return nullptr;
+        }
+        return &dsm->mgr<DeserializationArena>();
+    }
+};
+
+}  // namespace derecho
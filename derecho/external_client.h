@@ -0,0 +1,425 @@
+/**
+ * @file external_client.h
+ *
+ * @date Oct 15, 2026
+ */
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+#include <tcp/tcp.h>
+
+#include "derecho_exception.h"
+#include "derecho_internal.h"
+#include "remote_invocable.h"
+#include "rpc_manager.h"
+#include "rpc_utils.h"
+#include "view.h"
+
+#include "conf/conf.hpp"
+#include "mutils-serialization/SerializationSupport.hpp"
+
+namespace derecho {
+
+class ExternalClient;
+
+/** Lets ExternalClient keep the callers of subgroups of different types together */
+class ExternalClientCallerBase {
+public:
+    virtual ~ExternalClientCallerBase() {}
+};
+
+/**
+ * The equivalent of ExternalCaller<T> for a process that is not a member of
+ * the group: it makes P2P calls to the members of a subgroup of type T over
+ * the TCP connections of an ExternalClient.
+ */
+template <typename T>
+class ExternalClientCaller : public ExternalClientCallerBase {
+    ExternalClient& client;
+    /** The internally-generated subgroup ID of the subgroup that this ExternalClientCaller will contact. */
+    const subgroup_id_t subgroup_id;
+    std::unique_ptr<rpc::RemoteInvokerFor<T>> wrapped_this;
+
+    template <rpc::FunctionTag tag, typename... Args>
+    auto p2p_send_or_query(bool is_query, node_id_t dest_node, Args&&... args);
+
+public:
+    ExternalClientCaller(ExternalClient& client, subgroup_id_t subgroup_id, node_id_t my_id, rpc::ReceiverTable& receivers)
+            : client(client),
+              subgroup_id(subgroup_id),
+              wrapped_this(mutils::callFunc([&](const auto&... unpacked_functions) {
+                  return rpc::build_remote_invoker_for_class<T, decltype(rpc::bind_to_instance(std::declval<std::unique_ptr<T>*>(),
+                                                                                               unpacked_functions))...>(
+                          my_id, subgroup_id, receivers);
+              },
+              T::register_functions())) {}
+
+    /**
+     * Sends a peer-to-peer message to a single member of the subgroup,
+     * invoking the RPC function identified by the FunctionTag template
+     * parameter, but does not wait for a response. This should only be used
+     * for RPC functions whose return type is void.
+     * @param dest_node The ID of the member that the message should be sent to
+     * @param args The arguments to the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    void p2p_send(node_id_t dest_node, Args&&... args) {
+        p2p_send_or_query<tag>(false, dest_node, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Sends a peer-to-peer query to a single member of the subgroup, invoking
+     * the RPC function identified by the FunctionTag template parameter. The
+     * caller must keep the returned QueryResults object in scope in order to
+     * receive the reply. If the connection to the member is lost, the reply
+     * fails with node_removed_from_group_exception.
+     * @param dest_node The ID of the member that the query should be sent to
+     * @param args The arguments to the RPC function being invoked
+     * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
+     * of the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto p2p_query(node_id_t dest_node, Args&&... args) {
+        return p2p_send_or_query<tag>(true, dest_node, std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * A connection to a Derecho group for a process that is not a member of it.
+ * It learns the group's current View from a member, and sends P2P messages
+ * to the members it calls over TCP connections to their external_port,
+ * opened when they are first used. Unlike a Group, it adds no SST rows or
+ * P2P buffers to the members, so thousands of them can use the same group.
+ * A single thread receives the replies from all of its connections.
+ */
+class ExternalClient {
+    template <typename T>
+    friend class ExternalClientCaller;
+
+    /** The ID this client puts in the headers of its messages; it should
+     * differ from those of the members. */
+    const node_id_t my_id;
+    /** The port that the members serve external clients on */
+    const uint16_t external_port;
+    /** The handlers of the replies to this client's queries */
+    rpc::ReceiverTable receivers;
+    mutils::DeserializationManager dsm{{}};
+
+    /** The View most recently received from a member; guarded by view_mutex */
+    std::unique_ptr<View> view;
+    mutable std::mutex view_mutex;
+    /** Where to ask for a View when none of the members in the last one answers */
+    const std::vector<ip_addr_t> contact_ips;
+
+    struct MemberConnection {
+        tcp::socket socket;
+        /** Held while a message is written to the socket */
+        std::mutex send_mutex;
+    };
+    /** The open connections, by member ID. Locked exclusively to add or
+     * remove one, and shared while sending on or receiving from one. */
+    std::map<node_id_t, std::unique_ptr<MemberConnection>> connections;
+    std::shared_timed_mutex connections_mutex;
+    /** Watches the connections for replies; tagged by member ID */
+    tcp::socket_poller poller;
+
+    /** The PendingResultsSlabs that queries have been sent for, whose replies
+     * fail when the connections to their members are lost. */
+    std::list<std::reference_wrapper<rpc::OutstandingRepliesBase>> outstanding_replies_list;
+    std::mutex outstanding_replies_mutex;
+
+    std::map<std::pair<std::type_index, uint32_t>, std::unique_ptr<ExternalClientCallerBase>> callers;
+    /** Guards callers, and receivers, which a new caller adds its handlers to */
+    std::mutex callers_mutex;
+
+    std::atomic<bool> thread_shutdown{false};
+    std::thread receive_thread;
+
+    /** Asks a member for its View over a new connection, and keeps it */
+    bool fetch_view_from(const ip_addr_t& member_ip) {
+        using namespace rpc::remote_invocation_utilities;
+        try {
+            tcp::socket bootstrap_socket(member_ip, external_port);
+            std::vector<char> request(header_space());
+            populate_header(request.data(), 0, rpc::Opcode{typeid(rpc::RPCManager), 0, rpc::RPCManager::EXTERNAL_VIEW_REQUEST, false}, my_id);
+            std::vector<char> reply(header_space());
+            if(!bootstrap_socket.write(request.data(), request.size())
+               || !bootstrap_socket.read(reply.data(), reply.size())) {
+                return false;
+            }
+            std::size_t payload_size;
+            rpc::Opcode indx;
+            node_id_t received_from;
+            retrieve_header(nullptr, reply.data(), payload_size, indx, received_from);
+            reply.resize(payload_size);
+            if(indx.function_id != rpc::RPCManager::EXTERNAL_VIEW_REPLY
+               || !bootstrap_socket.read(reply.data(), payload_size)) {
+                return false;
+            }
+            std::unique_ptr<View> new_view = mutils::from_bytes<View>(nullptr, reply.data());
+            std::lock_guard<std::mutex> lock(view_mutex);
+            if(!view || new_view->vid >= view->vid) {
+                view = std::move(new_view);
+            }
+            return true;
+        } catch(const tcp::exception&) {
+            return false;
+        }
+    }
+
+    /** Returns the connection to a member, opening it if needed; the caller
+     * must hold connections_mutex shared. */
+    MemberConnection& get_connection(node_id_t member_id, std::shared_lock<std::shared_timed_mutex>& connections_lock) {
+        auto connection_it = connections.find(member_id);
+        if(connection_it != connections.end()) {
+            return *connection_it->second;
+        }
+        ip_addr_t member_ip;
+        {
+            std::lock_guard<std::mutex> lock(view_mutex);
+            const int rank = view->rank_of(member_id);
+            if(rank < 0) {
+                throw invalid_subgroup_exception("Node " + std::to_string(member_id) + " is not a member of the group");
+            }
+            member_ip = std::get<0>(view->member_ips_and_ports[rank]);
+        }
+        connections_lock.unlock();
+        auto new_connection = std::make_unique<MemberConnection>();
+        new_connection->socket = tcp::socket(member_ip, external_port);
+        {
+            std::unique_lock<std::shared_timed_mutex> exclusive_lock(connections_mutex);
+            if(connections.find(member_id) == connections.end()) {
+                poller.add(new_connection->socket, member_id);
+                connections.emplace(member_id, std::move(new_connection));
+            }
+        }
+        connections_lock.lock();
+        return *connections.at(member_id);
+    }
+
+    /**
+     * Writes a message to a member, and sets up the reply to it, if it is a
+     * query, before it can arrive.
+     * @param dest_node The member to send the message to
+     * @param message The message, header included
+     * @param pending_results_handle The promise object of the query, or null
+     * for a send
+     */
+    void send_to_member(node_id_t dest_node, const std::vector<char>& message, rpc::PendingBase* pending_results_handle) {
+        if(pending_results_handle) {
+            rpc::OutstandingRepliesBase* replies = pending_results_handle->owner;
+            if(replies && !replies->registered.test_and_set()) {
+                std::lock_guard<std::mutex> lock(outstanding_replies_mutex);
+                outstanding_replies_list.push_back(*replies);
+            }
+            pending_results_handle->fulfill_map({dest_node});
+        }
+        bool sent = false;
+        {
+            std::shared_lock<std::shared_timed_mutex> connections_lock(connections_mutex);
+            try {
+                MemberConnection& connection = get_connection(dest_node, connections_lock);
+                std::lock_guard<std::mutex> send_lock(connection.send_mutex);
+                sent = connection.socket.write(message.data(), message.size());
+            } catch(const tcp::exception&) {
+                sent = false;
+            } catch(const std::out_of_range&) {
+                // the connection was dropped while this thread opened it
+                sent = false;
+            }
+        }
+        if(!sent && pending_results_handle) {
+            pending_results_handle->set_exception_for_removed_node(dest_node);
+        }
+    }
+
+    /** Closes the connection to a member and fails the replies still due from it */
+    void drop_connection(node_id_t member_id) {
+        {
+            std::unique_lock<std::shared_timed_mutex> connections_lock(connections_mutex);
+            auto connection_it = connections.find(member_id);
+            if(connection_it == connections.end()) {
+                return;
+            }
+            poller.remove(connection_it->second->socket);
+            connections.erase(connection_it);
+        }
+        std::list<std::reference_wrapper<rpc::OutstandingRepliesBase>> outstanding_replies;
+        {
+            std::lock_guard<std::mutex> lock(outstanding_replies_mutex);
+            outstanding_replies = outstanding_replies_list;
+        }
+        for(auto& replies : outstanding_replies) {
+            replies.get().set_exception_for_removed_node(member_id);
+        }
+    }
+
+    /** Reads the replies from all the connections and fulfills their results */
+    void receive_loop() {
+        using namespace rpc::remote_invocation_utilities;
+        const std::size_t header_size = header_space();
+        std::vector<char> message;
+        while(!thread_shutdown) {
+            // wake up now and then to notice thread_shutdown
+            for(uint64_t member_id : poller.wait(100)) {
+                bool connection_ok = false;
+                {
+                    std::shared_lock<std::shared_timed_mutex> connections_lock(connections_mutex);
+                    auto connection_it = connections.find(member_id);
+                    if(connection_it == connections.end()) {
+                        continue;
+                    }
+                    tcp::socket& socket = connection_it->second->socket;
+                    message.resize(header_size);
+                    if(socket.bytes_available() > 0 && socket.read(message.data(), header_size)) {
+                        std::size_t payload_size;
+                        rpc::Opcode indx;
+                        node_id_t received_from;
+                        retrieve_header(nullptr, message.data(), payload_size, indx, received_from);
+                        message.resize(header_size + payload_size);
+                        connection_ok = socket.read(message.data() + header_size, payload_size);
+                        if(connection_ok) {
+                            std::lock_guard<std::mutex> lock(callers_mutex);
+                            try {
+                                receivers.at(indx)(&dsm, received_from, message.data() + header_size,
+                                                   [](size_t size) -> char* { assert_always(false); });
+                            } catch(const std::out_of_range&) {
+                                // not a reply to any function this client calls
+                                connection_ok = false;
+                            }
+                        }
+                    }
+                }
+                if(!connection_ok) {
+                    drop_connection(member_id);
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * Constructs an ExternalClient and gets the group's current View from
+     * one of the given members.
+     * @param contact_ips The IP addresses of members to ask for the View, in
+     * order; by default, the leader_ip in the configuration
+     * @throws derecho_exception if none of them answers
+     */
+    ExternalClient(const std::vector<ip_addr_t>& contact_ips = {getConfString(CONF_DERECHO_LEADER_IP)})
+            : my_id(getConfUInt32(CONF_DERECHO_LOCAL_ID)),
+              external_port(getConfUInt16(CONF_DERECHO_EXTERNAL_PORT)),
+              contact_ips(contact_ips) {
+        if(!update_view()) {
+            throw derecho_exception("No member of the group answered an external client");
+        }
+        receive_thread = std::thread(&ExternalClient::receive_loop, this);
+    }
+
+    ExternalClient(const ExternalClient&) = delete;
+
+    ~ExternalClient() {
+        thread_shutdown = true;
+        if(receive_thread.joinable()) {
+            receive_thread.join();
+        }
+    }
+
+    /**
+     * Gets the current View again, from a member of the last one or else from
+     * one of the contact IPs, e.g. after a member this client called has failed.
+     * @return true if a member answered
+     */
+    bool update_view() {
+        std::vector<ip_addr_t> member_ips;
+        {
+            std::lock_guard<std::mutex> lock(view_mutex);
+            if(view) {
+                for(const auto& ip_and_ports : view->member_ips_and_ports) {
+                    member_ips.emplace_back(std::get<0>(ip_and_ports));
+                }
+            }
+        }
+        member_ips.insert(member_ips.end(), contact_ips.begin(), contact_ips.end());
+        for(const ip_addr_t& member_ip : member_ips) {
+            if(fetch_view_from(member_ip)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @return The members of each shard of a subgroup in the last View
+     * received, by shard number
+     * @throws invalid_subgroup_exception if there is no such subgroup
+     */
+    template <typename SubgroupType>
+    std::vector<std::vector<node_id_t>> get_shard_members(uint32_t subgroup_index = 0) const {
+        std::lock_guard<std::mutex> lock(view_mutex);
+        try {
+            const subgroup_id_t subgroup_id = view->subgroup_ids_by_type.at(typeid(SubgroupType)).at(subgroup_index);
+            std::vector<std::vector<node_id_t>> shard_members;
+            for(const SubView& shard_view : view->subgroup_shard_views.at(subgroup_id)) {
+                shard_members.emplace_back(shard_view.members);
+            }
+            return shard_members;
+        } catch(std::out_of_range& ex) {
+            throw invalid_subgroup_exception("The group has no such subgroup");
+        }
+    }
+
+    /**
+     * Gets the caller for a subgroup, with which this client can make P2P
+     * calls to its members.
+     * @param subgroup_index The index of the subgroup among those of type
+     * SubgroupType
+     * @return A reference to the ExternalClientCaller for this subgroup
+     * @throws invalid_subgroup_exception if there is no such subgroup
+     */
+    template <typename SubgroupType>
+    ExternalClientCaller<SubgroupType>& get_subgroup_caller(uint32_t subgroup_index = 0) {
+        subgroup_id_t subgroup_id;
+        {
+            std::lock_guard<std::mutex> lock(view_mutex);
+            try {
+                subgroup_id = view->subgroup_ids_by_type.at(typeid(SubgroupType)).at(subgroup_index);
+            } catch(std::out_of_range& ex) {
+                throw invalid_subgroup_exception("The group has no such subgroup");
+            }
+        }
+        std::lock_guard<std::mutex> lock(callers_mutex);
+        auto& caller = callers[std::make_pair(std::type_index(typeid(SubgroupType)), subgroup_index)];
+        if(!caller) {
+            caller = std::make_unique<ExternalClientCaller<SubgroupType>>(*this, subgroup_id, my_id, receivers);
+        }
+        return static_cast<ExternalClientCaller<SubgroupType>&>(*caller);
+    }
+};
+
+template <typename T>
+template <rpc::FunctionTag tag, typename... Args>
+auto ExternalClientCaller<T>::p2p_send_or_query(bool is_query, node_id_t dest_node, Args&&... args) {
+    std::vector<char> message;
+    auto return_pair = wrapped_this->template send<tag>(
+            [&message](size_t size) -> char* {
+                message.resize(size);
+                return message.data();
+            },
+            std::forward<Args>(args)...);
+    client.send_to_member(dest_node, message, is_query ? &return_pair.pending : nullptr);
+    return std::move(return_pair.results);
+}
+}  // namespace derecho
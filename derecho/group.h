@@ -1,15 +1,18 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <ctime>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <thread>
 #include <typeindex>
 #include <utility>
 #include <vector>
@@ -90,6 +93,8 @@ private:
     template <typename T>
     using external_caller_index_map = std::map<uint32_t, ExternalCaller<T>>;
 
+    /** When the constructor started, which the startup timeline is measured from */
+    const std::chrono::steady_clock::time_point construction_start_time;
 #ifndef NOLOG
     std::shared_ptr<spdlog::logger> logger;
 #endif
@@ -168,9 +173,36 @@ private:
      */
     void receive_objects(const std::set<std::pair<subgroup_id_t, node_id_t>>& subgroups_and_leaders);
 
+    /** The threads receiving the state of non-persistent subgroups in a
+     * background state transfer, each from one leader. */
+    std::list<std::thread> background_transfer_threads;
+
+    /** Waits for the background state transfers to this node to finish. */
+    void join_background_transfers();
+
     /** Constructor helper that wires together the component objects of Group. */
     void set_up_components();
 
+    /**
+     * An object that construct_objects found this node needs, split into the
+     * part that calls its factory, which runs on one of the
+     * DERECHO/object_construction_threads threads, and the part that wraps it
+     * in its Replicated<T> and registers its RPC functions, which runs on the
+     * thread that called construct_objects, in order.
+     */
+    struct ObjectConstruction {
+        std::function<void()> construct;
+        std::function<void()> install;
+    };
+
+    /**
+     * Runs the factories of the objects construct_objects found, at most
+     * DERECHO/object_construction_threads at a time, then installs the
+     * objects. If a factory throws, the first exception is rethrown once the
+     * others have finished.
+     */
+    void construct_in_parallel(std::vector<ObjectConstruction>& constructions);
+
     /** A new-view callback that adds and removes TCP connections from the pool
      * of long-standing TCP connections to each member (used mostly by RPCManager). */
     void update_tcp_connections_callback(const View& new_view);
@@ -193,7 +225,7 @@ private:
      */
     template <typename... Empty>
     typename std::enable_if<0 == sizeof...(Empty), std::set<std::pair<subgroup_id_t, node_id_t>>>::type
-    construct_objects(const View&, const vector_int64_2d&) {
+    construct_objects(const View&, const vector_int64_2d&, std::vector<ObjectConstruction>&) {
         return std::set<std::pair<subgroup_id_t, node_id_t>>();
     }
 
@@ -211,13 +243,17 @@ private:
      * @param old_shard_leaders The array of old shard leaders for each subgroup
      * (indexed by subgroup ID), which will contain -1 if there is no previous
      * leader for that shard.
+     * @param constructions Gets the objects that need their factories called,
+     * which construct_in_parallel then constructs; the Replicated<T>s of
+     * those objects don't exist until then.
      * @return The set of subgroup IDs that are un-initialized because this node is
      * joining an existing group and needs to receive initial object state, paired
      * with the ID of the node that should be contacted to receive that state.
      */
     template <typename FirstType, typename... RestTypes>
     std::set<std::pair<subgroup_id_t, node_id_t>> construct_objects(
-            const View& curr_view, const vector_int64_2d& old_shard_leaders);
+            const View& curr_view, const vector_int64_2d& old_shard_leaders,
+            std::vector<ObjectConstruction>& constructions);
 
 public:
     /**
@@ -285,15 +321,87 @@ public:
     template <typename SubgroupType>
     ShardIterator<SubgroupType> get_shard_iterator(uint32_t subgroup_index = 0);
 
+    /**
+     * Queries every shard of a subgroup this node is not a member of,
+     * sending to one replica per shard at once, and reduces the replies as
+     * they arrive; see ShardIterator::scatter_query.
+     * @param subgroup_index The index of the subgroup within the set of
+     * subgroups that replicate the same type of object.
+     * @param shard_timeout How long to wait for each shard's reply
+     * @param reducer Called as reducer(shard_num, node_id, reply) on this
+     * thread for each reply
+     * @param args The arguments to the RPC function
+     * @tparam SubgroupType The object type identifying the subgroup
+     * @tparam tag The RPC function to call
+     * @return The shards that did not reply within shard_timeout
+     * @throws invalid_subgroup_exception If this node is a member of the
+     * requested subgroup, or if no such subgroup exists
+     */
+    template <typename SubgroupType, rpc::FunctionTag tag, typename Reducer, typename... Args>
+    std::vector<uint32_t> scatter_query(uint32_t subgroup_index, std::chrono::nanoseconds shard_timeout,
+                                        Reducer&& reducer, Args&&... args);
+
     /** Causes this node to cleanly leave the group by setting itself to "failed." */
     void leave();
     /** Creates and returns a vector listing the nodes that are currently members of the group. */
     std::vector<node_id_t> get_members();
 
+    /**
+     * Sends ordered sends in several subgroups in one call, in the order
+     * given: the send buffers of all of them are reserved under one lock on
+     * the view, and they are handed to the sender thread together, which
+     * costs less than calling ordered_send on each Replicated<T> in turn.
+     * @param sends The sends, from Replicated<T>::batched_send, e.g.
+     * group.send_batch({a.batched_send<A::f>(x), b.batched_send<B::g>(y)})
+     */
+    void send_batch(std::vector<rpc::BatchedSend> sends);
+
     /** Reports to the GMS that the given node has failed. */
     void report_failure(const node_id_t who);
     /** Waits until all members of the group have called this function. */
     void barrier_sync();
+
+    /**
+     * Publishes a small value, such as this node's load or queue depth, to
+     * every member of the group in one of this node's user SST fields
+     * (DERECHO/user_sst_fields of them). It is a single RDMA write to each
+     * member, not ordered with any message or with other fields' updates,
+     * so members may briefly see different values.
+     * @param index The field, less than DERECHO/user_sst_fields
+     * @param value The field's new value
+     * @throws derecho_exception If there is no such field
+     */
+    void set_user_sst_field(uint32_t index, uint64_t value);
+    /**
+     * @return The latest value of a member's user SST field that has reached
+     * this node, which is 0 until the member sets it
+     * @throws derecho_exception If the node is not a member or there is no
+     * such field
+     */
+    uint64_t get_user_sst_field(node_id_t node_id, uint32_t index);
+    /**
+     * Registers a function to be called on the SST predicate thread as
+     * upcall(node_id, index, value) whenever a member's user SST field
+     * changes, including this node's own. It must not block. A member that
+     * changes a field several times quickly may only be reported with the
+     * last of the values.
+     */
+    void add_user_sst_field_upcall(const user_sst_field_upcall_t& upcall);
+
+    /**
+     * Gets the latencies of the ordered multicasts this node has received in
+     * a subgroup since it joined, from the sender's timestamp to each stage.
+     * They are only recorded if DERECHO/latency_stats is true; otherwise
+     * they are all zeros.
+     *
+     * @param subgroup_index The index of the subgroup within the set of
+     * subgroups that replicate the same type of object.
+     * @tparam SubgroupType The object type identifying the subgroup
+     * @return The summaries of the latencies, indexed by LatencyStage
+     * @throws invalid_subgroup_exception If no such subgroup exists
+     */
+    template <typename SubgroupType>
+    LatencyStats get_latency_stats(uint32_t subgroup_index = 0);
     void debug_print_status() const;
 
 #ifndef NOLOG
@@ -57,7 +57,8 @@ Group<ReplicatedTypes...>::Group(const CallbackSet& callbacks,
                                  const SubgroupInfo& subgroup_info,
                                  std::vector<view_upcall_t> _view_upcalls,
                                  Factory<ReplicatedTypes>... factories)
-        : whenlog(logger(create_logger()), )
+        : construction_start_time(std::chrono::steady_clock::now()),
+          whenlog(logger(create_logger()), )
           my_id(getConfUInt32(CONF_DERECHO_LOCAL_ID)),
           is_starting_leader((getConfString(CONF_DERECHO_LOCAL_IP) == getConfString(CONF_DERECHO_LEADER_IP))
                              && (getConfUInt16(CONF_DERECHO_GMS_PORT) == getConfUInt16(CONF_DERECHO_LEADER_GMS_PORT))),
@@ -67,7 +68,7 @@ Group<ReplicatedTypes...>::Group(const CallbackSet& callbacks,
               }
               return std::nullopt;
           }()),
-          persistence_manager(callbacks.local_persistence_callback),
+          persistence_manager(callbacks.local_persistence_callback, callbacks.local_persistence_range_callback),
           //Initially empty, all connections are added in the new view callback
           tcp_sockets(std::make_shared<tcp::tcp_connections>(my_id, std::map<node_id_t, std::pair<ip_addr_t, uint16_t>>{{my_id, {getConfString(CONF_DERECHO_LOCAL_IP), getConfUInt16(CONF_DERECHO_RPC_PORT)}}})),
           view_manager([&]() {
@@ -87,29 +88,49 @@ Group<ReplicatedTypes...>::Group(const CallbackSet& callbacks,
           rpc_manager(view_manager),
           factories(make_kind_map(factories...)),
           raw_subgroups(construct_raw_subgroups(view_manager.get_current_view().get())) {
+    using std::chrono::steady_clock;
+    const steady_clock::time_point joined_time = steady_clock::now();
     set_up_components();
     vector_int64_2d restart_shard_leaders = view_manager.finish_setup();
+    const steady_clock::time_point set_up_time = steady_clock::now();
     std::set<std::pair<subgroup_id_t, node_id_t>> subgroups_and_leaders_to_receive;
     std::unique_ptr<vector_int64_2d> old_shard_leaders;
+    std::vector<ObjectConstruction> constructions;
     if(is_starting_leader) {
         /* If in total restart mode, ViewManager will have computed the members of each shard
          * with the longest logs, and this node will need to receive state from them even
          * though it's the leader. Otherwise, this vector will be empty because the leader
          * normally doesn't need to receive any object state. */
         subgroups_and_leaders_to_receive = construct_objects<ReplicatedTypes...>(
-                view_manager.get_current_view().get(), restart_shard_leaders);
+                view_manager.get_current_view().get(), restart_shard_leaders, constructions);
     } else {
         // I am a non-leader
         old_shard_leaders = receive_old_shard_leaders(leader_connection.value());
         subgroups_and_leaders_to_receive = construct_objects<ReplicatedTypes...>(
-                view_manager.get_current_view().get(), *old_shard_leaders);
+                view_manager.get_current_view().get(), *old_shard_leaders, constructions);
     }
+    const std::size_t num_constructed = constructions.size();
+    construct_in_parallel(constructions);
+    persistence_manager.set_version_hooks(objects_by_subgroup_id);
+    const steady_clock::time_point constructed_time = steady_clock::now();
     //The next two methods will do nothing unless we're in total restart mode
     view_manager.send_logs_if_total_restart(old_shard_leaders);
     receive_objects(subgroups_and_leaders_to_receive);
+    const steady_clock::time_point received_time = steady_clock::now();
     rpc_manager.start_listening();
     view_manager.start();
     persistence_manager.start();
+    auto ms_between = [](steady_clock::time_point from, steady_clock::time_point to) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+    };
+    whenlog(logger->info("Startup took {} ms: {} ms to join view {}, {} ms to set up its SST and multicast groups, "
+                         "{} ms to construct {} objects, {} ms to receive the state of {} subgroups, {} ms to start",
+                         ms_between(construction_start_time, steady_clock::now()),
+                         ms_between(construction_start_time, joined_time), view_manager.get_current_view().get().vid,
+                         ms_between(joined_time, set_up_time),
+                         ms_between(set_up_time, constructed_time), num_constructed,
+                         ms_between(constructed_time, received_time), subgroups_and_leaders_to_receive.size(),
+                         ms_between(received_time, steady_clock::now())););
 }
 
 template <typename... ReplicatedTypes>
@@ -119,6 +140,7 @@ Group<ReplicatedTypes...>::~Group() {
     // Will a nodebe able to come back once it leaves? if not, maybe we should
     // shut it down on leave().
     persistence_manager.shutdown(true);
+    join_background_transfers();
     tcp_sockets->destroy();
 }
 
@@ -126,7 +148,8 @@ template <typename... ReplicatedTypes>
 template <typename FirstType, typename... RestTypes>
 std::set<std::pair<subgroup_id_t, node_id_t>> Group<ReplicatedTypes...>::construct_objects(
         const View& curr_view,
-        const vector_int64_2d& old_shard_leaders) {
+        const vector_int64_2d& old_shard_leaders,
+        std::vector<ObjectConstruction>& constructions) {
     std::set<std::pair<subgroup_id_t, uint32_t>> subgroups_to_receive;
     if(!curr_view.is_adequately_provisioned) {
         return subgroups_to_receive;
@@ -165,14 +188,26 @@ std::set<std::pair<subgroup_id_t, node_id_t>> Group<ReplicatedTypes...>::constru
                         replicated_objects.template get<FirstType>().emplace(
                                 subgroup_index, Replicated<FirstType>(my_id, subgroup_id, subgroup_index,
                                                                       shard_num, rpc_manager, this));
+                        // Store a reference to the Replicated<T> just constructed
+                        objects_by_subgroup_id.emplace(subgroup_id,
+                                                       replicated_objects.template get<FirstType>().at(subgroup_index));
                     } else {
-                        replicated_objects.template get<FirstType>().emplace(
-                                subgroup_index, Replicated<FirstType>(my_id, subgroup_id, subgroup_index, shard_num, rpc_manager,
-                                                                      factories.template get<FirstType>(), this));
+                        // The factory may open logs, so construct_in_parallel calls it
+                        auto registry = std::make_shared<std::unique_ptr<PersistentRegistry>>(
+                                std::make_unique<PersistentRegistry>(nullptr, std::type_index(typeid(FirstType)), subgroup_index, shard_num));
+                        auto object = std::make_shared<std::unique_ptr<FirstType>>();
+                        constructions.push_back(ObjectConstruction{
+                                [this, registry, object]() {
+                                    *object = factories.template get<FirstType>()(registry->get());
+                                },
+                                [this, registry, object, subgroup_id, subgroup_index, shard_num]() {
+                                    replicated_objects.template get<FirstType>().emplace(
+                                            subgroup_index, Replicated<FirstType>(my_id, subgroup_id, subgroup_index, shard_num, rpc_manager,
+                                                                                  std::move(*registry), std::move(*object), this));
+                                    objects_by_subgroup_id.emplace(subgroup_id,
+                                                                   replicated_objects.template get<FirstType>().at(subgroup_index));
+                                }});
                     }
-                    // Store a reference to the Replicated<T> just constructed
-                    objects_by_subgroup_id.emplace(subgroup_id,
-                                                   replicated_objects.template get<FirstType>().at(subgroup_index));
                     break;  // This node can be in at most one shard, so stop here
                 }
             }
@@ -191,7 +226,49 @@ std::set<std::pair<subgroup_id_t, node_id_t>> Group<ReplicatedTypes...>::constru
                     subgroup_index, ExternalCaller<FirstType>(my_id, subgroup_id, rpc_manager));
         }
     }
-    return functional_insert(subgroups_to_receive, construct_objects<RestTypes...>(curr_view, old_shard_leaders));
+    return functional_insert(subgroups_to_receive, construct_objects<RestTypes...>(curr_view, old_shard_leaders, constructions));
+}
+
+template <typename... ReplicatedTypes>
+void Group<ReplicatedTypes...>::construct_in_parallel(std::vector<ObjectConstruction>& constructions) {
+    const std::size_t num_threads = std::min<std::size_t>(
+            constructions.size(), std::max<uint32_t>(1, getConfUInt32(CONF_DERECHO_OBJECT_CONSTRUCTION_THREADS)));
+    if(num_threads <= 1) {
+        for(ObjectConstruction& construction : constructions) {
+            construction.construct();
+            construction.install();
+        }
+        return;
+    }
+    std::atomic<std::size_t> next_construction{0};
+    std::mutex first_exception_mutex;
+    std::exception_ptr first_exception;
+    auto construct_objects_in_turn = [&]() {
+        for(std::size_t i = next_construction++; i < constructions.size(); i = next_construction++) {
+            try {
+                constructions[i].construct();
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(first_exception_mutex);
+                if(!first_exception) {
+                    first_exception = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> construction_threads;
+    for(std::size_t t = 1; t < num_threads; ++t) {
+        construction_threads.emplace_back(construct_objects_in_turn);
+    }
+    construct_objects_in_turn();
+    for(std::thread& construction_thread : construction_threads) {
+        construction_thread.join();
+    }
+    if(first_exception) {
+        std::rethrow_exception(first_exception);
+    }
+    for(ObjectConstruction& construction : constructions) {
+        construction.install();
+    }
 }
 
 template <typename... ReplicatedTypes>
@@ -247,8 +324,13 @@ void Group<ReplicatedTypes...>::set_up_components() {
     //since ViewManager doesn't know the template parameters
     view_manager.register_initialize_objects_upcall([this](node_id_t my_id, const View& view,
                                                            const vector_int64_2d& old_shard_leaders) {
+        //construct_objects may replace objects whose state is still coming in
+        join_background_transfers();
+        std::vector<ObjectConstruction> constructions;
         std::set<std::pair<subgroup_id_t, node_id_t>> subgroups_and_leaders
-                = construct_objects<ReplicatedTypes...>(view, old_shard_leaders);
+                = construct_objects<ReplicatedTypes...>(view, old_shard_leaders, constructions);
+        construct_in_parallel(constructions);
+        persistence_manager.set_version_hooks(objects_by_subgroup_id);
         receive_objects(subgroups_and_leaders);
         raw_subgroups = construct_raw_subgroups(view);
     });
@@ -257,19 +339,22 @@ void Group<ReplicatedTypes...>::set_up_components() {
 #ifndef NOLOG
 template <typename... ReplicatedTypes>
 std::shared_ptr<spdlog::logger> Group<ReplicatedTypes...>::create_logger() const {
-    spdlog::init_thread_pool(1048576, 1);
+    // The queue's slots are allocated here, once. When it is full the oldest
+    // message is dropped, so that the predicate and delivery threads never
+    // wait for the logging thread.
+    spdlog::init_thread_pool(65536, 1);
     std::vector<spdlog::sink_ptr> log_sinks;
     log_sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
             "derecho_debug_log", 1024 * 1024 * 5, 3));
     // Uncomment this to get debugging output printed to the terminal
     log_sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
     std::shared_ptr<spdlog::logger> log = std::make_shared<spdlog::async_logger>(
-            "derecho_debug_log", log_sinks.begin(), log_sinks.end(), spdlog::thread_pool(), spdlog::async_overflow_policy::block);
+            "derecho_debug_log", log_sinks.begin(), log_sinks.end(), spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
     spdlog::register_logger(log);
     log->set_pattern("[%H:%M:%S.%f] [%n] [Thread %t] [%^%l%$] %v");
     log->set_level(
             whendebug(spdlog::level::debug)
-            whenrelease(spdlog::level::off));
+            whenrelease(spdlog::level::info));
     //    log->set_level(spdlog::level::off);
     auto start_ms = std::chrono::duration_cast<std::chrono::microseconds>(
             std::chrono::high_resolution_clock::now().time_since_epoch());
@@ -373,28 +458,79 @@ ShardIterator<SubgroupType> Group<ReplicatedTypes...>::get_shard_iterator(uint32
     }
 }
 
+template <typename... ReplicatedTypes>
+template <typename SubgroupType, rpc::FunctionTag tag, typename Reducer, typename... Args>
+std::vector<uint32_t> Group<ReplicatedTypes...>::scatter_query(uint32_t subgroup_index,
+                                                               std::chrono::nanoseconds shard_timeout,
+                                                               Reducer&& reducer, Args&&... args) {
+    return get_shard_iterator<SubgroupType>(subgroup_index)
+            .template scatter_query<tag>(shard_timeout, std::forward<Reducer>(reducer), std::forward<Args>(args)...);
+}
+
 template <typename... ReplicatedTypes>
 void Group<ReplicatedTypes...>::receive_objects(const std::set<std::pair<subgroup_id_t, node_id_t>>& subgroups_and_leaders) {
-    //This will receive one object from each shard leader in ascending order of subgroup ID
+    //Each leader sends its objects in ascending order of subgroup ID, over its own
+    //socket, so receive from all the leaders at once. In background state transfer,
+    //it sends the persistent ones first, and the others once the new view runs,
+    //so those are received in the background while their messages are queued
+    const bool background_transfer = getConfBoolean(CONF_DERECHO_BACKGROUND_STATE_TRANSFER);
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_by_leader;
+    std::map<node_id_t, std::vector<subgroup_id_t>> background_subgroups_by_leader;
     for(const auto& subgroup_and_leader : subgroups_and_leaders) {
-        LockedReference<std::unique_lock<std::mutex>, tcp::socket> leader_socket
-                = tcp_sockets->get_socket(subgroup_and_leader.second);
-        ReplicatedObject& subgroup_object = objects_by_subgroup_id.at(subgroup_and_leader.first);
-        if(subgroup_object.is_persistent()) {
-            int64_t log_tail_length = subgroup_object.get_minimum_latest_persisted_version();
-            whenlog(logger->debug("Sending log tail length of {} for subgroup {} to node {}.", log_tail_length, subgroup_and_leader.first, subgroup_and_leader.second));
-            leader_socket.get().write(log_tail_length);
+        if(background_transfer && !objects_by_subgroup_id.at(subgroup_and_leader.first).get().is_persistent()) {
+            background_subgroups_by_leader[subgroup_and_leader.second].push_back(subgroup_and_leader.first);
+        } else {
+            subgroups_by_leader[subgroup_and_leader.second].push_back(subgroup_and_leader.first);
+        }
+    }
+    auto receive_from_leader = [this](node_id_t leader, const std::vector<subgroup_id_t>& subgroups, bool catching_up) {
+        tcp::locked_socket leader_socket = tcp_sockets->get_socket(leader);
+        for(subgroup_id_t subgroup_id : subgroups) {
+            ReplicatedObject& subgroup_object = objects_by_subgroup_id.at(subgroup_id);
+            if(subgroup_object.is_persistent()) {
+                int64_t log_tail_length = subgroup_object.get_minimum_latest_persisted_version();
+                whenlog(logger->debug("Sending log tail length of {} for subgroup {} to node {}.", log_tail_length, subgroup_id, leader));
+                leader_socket.get().write(log_tail_length);
+            }
+            whenlog(logger->debug("Receiving Replicated Object state for subgroup {} from node {}", subgroup_id, leader));
+            // The object arrives in chunks, as the leader serializes it
+            std::vector<char> buffer;
+            bool success = leader_socket.get().read_chunked(buffer);
+            assert_always(success);
+            subgroup_object.receive_object(buffer.data());
+            if(catching_up) {
+                rpc_manager.finish_catch_up(subgroup_id);
+            }
+        }
+    };
+    if(subgroups_by_leader.size() == 1) {
+        receive_from_leader(subgroups_by_leader.begin()->first, subgroups_by_leader.begin()->second, false);
+    } else {
+        std::vector<std::thread> receiver_threads;
+        for(const auto& leader_and_subgroups : subgroups_by_leader) {
+            receiver_threads.emplace_back(receive_from_leader, leader_and_subgroups.first,
+                                          std::cref(leader_and_subgroups.second), false);
+        }
+        for(auto& receiver_thread : receiver_threads) {
+            receiver_thread.join();
         }
-        whenlog(logger->debug("Receiving Replicated Object state for subgroup {} from node {}", subgroup_and_leader.first, subgroup_and_leader.second));
-        std::size_t buffer_size;
-        bool success = leader_socket.get().read(buffer_size);
-        assert_always(success);
-        char buffer[buffer_size];
-        success = leader_socket.get().read(buffer, buffer_size);
-        assert_always(success);
-        subgroup_object.receive_object(buffer);
     }
     whenlog(logger->debug("Done receiving all Replicated Objects from subgroup leaders"));
+    for(const auto& leader_and_subgroups : background_subgroups_by_leader) {
+        for(subgroup_id_t subgroup_id : leader_and_subgroups.second) {
+            rpc_manager.begin_catch_up(subgroup_id);
+        }
+        background_transfer_threads.emplace_back(receive_from_leader, leader_and_subgroups.first,
+                                                 leader_and_subgroups.second, true);
+    }
+}
+
+template <typename... ReplicatedTypes>
+void Group<ReplicatedTypes...>::join_background_transfers() {
+    for(auto& transfer_thread : background_transfer_threads) {
+        transfer_thread.join();
+    }
+    background_transfer_threads.clear();
 }
 
 template <typename... ReplicatedTypes>
@@ -412,11 +548,44 @@ std::vector<node_id_t> Group<ReplicatedTypes...>::get_members() {
     return view_manager.get_members();
 }
 
+template <typename... ReplicatedTypes>
+void Group<ReplicatedTypes...>::send_batch(std::vector<rpc::BatchedSend> sends) {
+    rpc_manager.send_batch(sends);
+}
+
 template <typename... ReplicatedTypes>
 void Group<ReplicatedTypes...>::barrier_sync() {
     view_manager.barrier_sync();
 }
 
+template <typename... ReplicatedTypes>
+void Group<ReplicatedTypes...>::set_user_sst_field(uint32_t index, uint64_t value) {
+    view_manager.set_user_sst_field(index, value);
+}
+
+template <typename... ReplicatedTypes>
+uint64_t Group<ReplicatedTypes...>::get_user_sst_field(node_id_t node_id, uint32_t index) {
+    return view_manager.get_user_sst_field(node_id, index);
+}
+
+template <typename... ReplicatedTypes>
+void Group<ReplicatedTypes...>::add_user_sst_field_upcall(const user_sst_field_upcall_t& upcall) {
+    view_manager.add_user_sst_field_upcall(upcall);
+}
+
+template <typename... ReplicatedTypes>
+template <typename SubgroupType>
+LatencyStats Group<ReplicatedTypes...>::get_latency_stats(uint32_t subgroup_index) {
+    subgroup_id_t subgroup_id;
+    try {
+        View& curr_view = view_manager.get_current_view().get();
+        subgroup_id = curr_view.subgroup_ids_by_type.at(typeid(SubgroupType)).at(subgroup_index);
+    } catch(std::out_of_range& ex) {
+        throw invalid_subgroup_exception("No subgroup of the requested type and index exists");
+    }
+    return view_manager.get_latency_stats(subgroup_id);
+}
+
 template <typename... ReplicatedTypes>
 void Group<ReplicatedTypes...>::debug_print_status() const {
     view_manager.debug_print_status();
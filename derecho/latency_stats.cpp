@@ -0,0 +1,85 @@
+/**
+ * @file latency_stats.cpp
+ */
+
+#include "latency_stats.h"
+
+#include <algorithm>
+
+namespace derecho {
+
+std::size_t LatencyHistogram::bucket_of(uint64_t value) {
+    if(value < sub_bucket_count) {
+        return value;
+    }
+    const int exponent = 63 - __builtin_clzll(value);
+    const uint64_t mantissa = value >> (exponent - sub_bucket_bits);
+    return (exponent - sub_bucket_bits + 1) * sub_bucket_count + (mantissa - sub_bucket_count);
+}
+
+uint64_t LatencyHistogram::value_of(std::size_t bucket) {
+    if(bucket < sub_bucket_count) {
+        return bucket;
+    }
+    const int shift = bucket / sub_bucket_count - 1;
+    const uint64_t lowest = (sub_bucket_count + bucket % sub_bucket_count) << shift;
+    return lowest + (uint64_t{1} << shift) / 2;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    total_count.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(value, std::memory_order_relaxed);
+    uint64_t current_max = max_value.load(std::memory_order_relaxed);
+    while(value > current_max
+          && !max_value.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {
+    }
+}
+
+LatencySummary LatencyHistogram::summarize() const {
+    LatencySummary summary;
+    // Counting the buckets themselves keeps the percentiles consistent with
+    // each other even if values are recorded meanwhile
+    std::array<uint64_t, num_buckets> snapshot;
+    for(std::size_t bucket = 0; bucket < num_buckets; ++bucket) {
+        snapshot[bucket] = counts[bucket].load(std::memory_order_relaxed);
+        summary.count += snapshot[bucket];
+    }
+    if(summary.count == 0) {
+        return summary;
+    }
+    summary.mean = (double)total.load(std::memory_order_relaxed) / total_count.load(std::memory_order_relaxed);
+    summary.max = max_value.load(std::memory_order_relaxed);
+    const std::array<std::pair<double, uint64_t*>, 4> percentiles{{{0.5, &summary.p50},
+                                                                   {0.9, &summary.p90},
+                                                                   {0.99, &summary.p99},
+                                                                   {0.999, &summary.p999}}};
+    std::size_t next_percentile = 0;
+    uint64_t cumulative_count = 0;
+    for(std::size_t bucket = 0; bucket < num_buckets && next_percentile < percentiles.size(); ++bucket) {
+        cumulative_count += snapshot[bucket];
+        while(next_percentile < percentiles.size()
+              && cumulative_count >= percentiles[next_percentile].first * summary.count) {
+            *percentiles[next_percentile].second = std::min(value_of(bucket), summary.max);
+            ++next_percentile;
+        }
+    }
+    return summary;
+}
+
+std::ostream& operator<<(std::ostream& out, const LatencyStats& stats) {
+    static const char* stage_names[num_latency_stages] = {"received", "stable", "delivered", "persisted"};
+    for(std::size_t stage = 0; stage < num_latency_stages; ++stage) {
+        const LatencySummary& summary = stats[stage];
+        out << stage_names[stage] << ": count=" << summary.count
+            << " mean=" << summary.mean / 1000.0 << "us p50=" << summary.p50 / 1000.0
+            << "us p90=" << summary.p90 / 1000.0 << "us p99=" << summary.p99 / 1000.0
+            << "us p99.9=" << summary.p999 / 1000.0 << "us max=" << summary.max / 1000.0 << "us";
+        if(stage + 1 < num_latency_stages) {
+            out << std::endl;
+        }
+    }
+    return out;
+}
+
+}  // namespace derecho
@@ -0,0 +1,80 @@
+/**
+ * @file latency_stats.h
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace derecho {
+
+/**
+ * The points an ordered multicast passes at each member, each timed from the
+ * moment its sender sent it. The time a stage takes is the difference from
+ * the one before.
+ */
+enum class LatencyStage {
+    /** The whole message is in this node's memory */
+    RECEIVED,
+    /** This node has learned that every member of the shard has received it */
+    STABLE,
+    /** Its delivery upcall has returned */
+    DELIVERED,
+    /** Every member of the shard has persisted the version it made */
+    PERSISTED
+};
+
+constexpr std::size_t num_latency_stages = 4;
+
+/**
+ * A summary of the latencies recorded for one stage, in nanoseconds. The
+ * percentiles are accurate to within about 3%.
+ */
+struct LatencySummary {
+    uint64_t count = 0;
+    double mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+/** The latency summaries of a subgroup, indexed by LatencyStage. */
+using LatencyStats = std::array<LatencySummary, num_latency_stages>;
+
+std::ostream& operator<<(std::ostream& out, const LatencyStats& stats);
+
+/**
+ * A histogram of latencies in the style of HdrHistogram: each power of two
+ * is split into 32 equal buckets, so a fixed number of counters covers every
+ * 64-bit value at the same relative precision. Recording is a few relaxed
+ * atomic increments, and may happen on several threads while another reads.
+ */
+class LatencyHistogram {
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr std::size_t sub_bucket_count = 1 << sub_bucket_bits;
+    static constexpr std::size_t num_buckets = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+    std::array<std::atomic<uint64_t>, num_buckets> counts{};
+    std::atomic<uint64_t> total_count{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max_value{0};
+
+    static std::size_t bucket_of(uint64_t value);
+    /** The middle of the range of values in a bucket */
+    static uint64_t value_of(std::size_t bucket);
+
+public:
+    void record(uint64_t value);
+    LatencySummary summarize() const;
+};
+
+/** The histograms of one subgroup, indexed by LatencyStage. */
+using SubgroupLatencyHistograms = std::array<LatencyHistogram, num_latency_stages>;
+
+}  // namespace derecho
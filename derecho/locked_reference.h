@@ -7,6 +7,7 @@
 #pragma once
 
 #include <mutex>
+#include <utility>
 
 namespace derecho {
 
@@ -23,9 +24,14 @@ private:
     LockType lock;
 
 public:
-    LockedReference(T& real_reference, typename LockType::mutex_type& mutex)
+    template <typename Mutex>
+    LockedReference(T& real_reference, Mutex& mutex)
             : reference(real_reference), lock(mutex) {}
 
+    /** Takes over a lock that is already held, for lock types with no single mutex */
+    LockedReference(T& real_reference, LockType&& held_lock)
+            : reference(real_reference), lock(std::move(held_lock)) {}
+
     T& get() {
         return reference;
     }
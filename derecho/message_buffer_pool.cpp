@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cassert>
+
+#include "message_buffer_pool.h"
+#include "sst/registered_memory.h"
+
+namespace derecho {
+
+/** Owns a slab's memory and the memory region registered over it */
+struct MessageBufferPool::Slab {
+    sst::registered_memory_ptr memory;
+    std::unique_ptr<rdma::memory_region> mr;
+
+    Slab(std::size_t size) : memory(sst::allocate_registered_memory(size)) {
+        mr = std::make_unique<rdma::memory_region>(const_cast<char*>(memory.get()), size);
+    }
+    ~Slab() {
+        // Deregister before the memory goes away
+        mr.reset();
+    }
+};
+
+MessageBufferPool::MessageBufferPool(std::size_t min_buffer_size, std::size_t max_buffer_size,
+                                     std::size_t slab_size)
+        : slab_size(slab_size) {
+    assert(max_buffer_size > 0);
+    for(std::size_t class_size = std::max<std::size_t>(1, std::min(min_buffer_size, max_buffer_size));
+        class_size < max_buffer_size; class_size *= 2) {
+        class_sizes.push_back(class_size);
+    }
+    class_sizes.push_back(max_buffer_size);
+    free_buffers.resize(class_sizes.size());
+    reserved_counts.resize(class_sizes.size(), 0);
+}
+
+std::size_t MessageBufferPool::class_for(std::size_t size) const {
+    assert(size <= class_sizes.back());
+    return std::lower_bound(class_sizes.begin(), class_sizes.end(), size) - class_sizes.begin();
+}
+
+void MessageBufferPool::add_slab(std::size_t size_class) {
+    const std::size_t buffer_size = class_sizes[size_class];
+    const std::size_t num_buffers = std::max<std::size_t>(1, slab_size / buffer_size);
+    auto slab = std::make_shared<Slab>(buffer_size * num_buffers);
+    // Every buffer shares ownership of the slab, so it stays mapped while any
+    // of them is in use, even after the pool is gone
+    std::shared_ptr<rdma::memory_region> slab_mr(slab, slab->mr.get());
+    for(std::size_t i = 0; i < num_buffers; ++i) {
+        free_buffers[size_class].emplace_back(slab->mr->buffer + i * buffer_size, slab_mr,
+                                              i * buffer_size, buffer_size);
+    }
+}
+
+std::size_t MessageBufferPool::reserved_bytes(std::size_t size, std::size_t count) const {
+    const std::size_t buffer_size = class_sizes[class_for(size)];
+    const std::size_t buffers_per_slab = std::max<std::size_t>(1, slab_size / buffer_size);
+    const std::size_t num_slabs = (count + buffers_per_slab - 1) / buffers_per_slab;
+    return num_slabs * buffers_per_slab * buffer_size;
+}
+
+MessageBuffer MessageBufferPool::acquire(std::size_t size) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for(std::size_t size_class = class_for(size); size_class < class_sizes.size(); ++size_class) {
+        if(!free_buffers[size_class].empty()) {
+            MessageBuffer buffer = std::move(free_buffers[size_class].back());
+            free_buffers[size_class].pop_back();
+            return buffer;
+        }
+    }
+    return MessageBuffer();
+}
+
+void MessageBufferPool::release(MessageBuffer&& buffer) {
+    // A buffer from a pool with other size classes is just dropped
+    if(!buffer.buffer || !buffer.pooled || buffer.capacity > class_sizes.back()) {
+        return;
+    }
+    const std::size_t size_class = class_for(buffer.capacity);
+    if(class_sizes[size_class] != buffer.capacity) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if(free_buffers[size_class].size() >= reserved_counts[size_class]) {
+        return;
+    }
+    free_buffers[size_class].push_back(std::move(buffer));
+}
+
+void MessageBufferPool::reserve(std::size_t size, std::size_t count) {
+    const std::size_t size_class = class_for(size);
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    reserved_counts[size_class] = count;
+    while(free_buffers[size_class].size() < count) {
+        add_slab(size_class);
+    }
+}
+}  // namespace derecho
@@ -0,0 +1,114 @@
+/**
+ * @file message_buffer_pool.h
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "rdmc/rdmc.h"
+
+namespace derecho {
+
+/**
+ * Represents a block of memory used to store a message. The bytes belong to
+ * a registered RDMA memory region, which may hold other buffers as well, so
+ * the buffer is identified by the region and its offset within it.
+ */
+struct MessageBuffer {
+    /** The start of the buffer, inside mr's memory */
+    char* buffer = nullptr;
+    std::shared_ptr<rdma::memory_region> mr;
+    /** The offset of buffer within mr */
+    std::size_t offset = 0;
+    /** The number of bytes available at buffer */
+    std::size_t capacity = 0;
+    /** False if the application supplied the buffer, so it must not be
+     * returned to a MessageBufferPool */
+    bool pooled = true;
+
+    MessageBuffer() {}
+    MessageBuffer(char* buffer, std::shared_ptr<rdma::memory_region> mr, std::size_t offset, std::size_t capacity)
+            : buffer(buffer), mr(std::move(mr)), offset(offset), capacity(capacity) {}
+    MessageBuffer(const MessageBuffer&) = delete;
+    MessageBuffer(MessageBuffer&& other)
+            : buffer(std::exchange(other.buffer, nullptr)),
+              mr(std::move(other.mr)),
+              offset(std::exchange(other.offset, 0)),
+              capacity(std::exchange(other.capacity, 0)),
+              pooled(other.pooled) {}
+    MessageBuffer& operator=(const MessageBuffer&) = delete;
+    MessageBuffer& operator=(MessageBuffer&& other) {
+        buffer = std::exchange(other.buffer, nullptr);
+        mr = std::move(other.mr);
+        offset = std::exchange(other.offset, 0);
+        capacity = std::exchange(other.capacity, 0);
+        pooled = other.pooled;
+        return *this;
+    }
+};
+
+/**
+ * A pool of registered message buffers in power-of-two size classes, from
+ * min_buffer_size up to max_buffer_size. The buffers of a class are carved
+ * out of slabs, each registered once as a single memory region and backed
+ * by huge pages if they are configured (see sst::allocate_registered_memory).
+ * Slabs are only added by reserve(), which also caps the number of free
+ * buffers the class keeps, so acquire() never allocates or registers memory
+ * on the path of a message; it fails instead, and the caller waits for a
+ * buffer to be released. A pool is shared by the MulticastGroups of
+ * successive views, so a new view doesn't have to register its buffers
+ * again. All of its methods are thread-safe.
+ */
+class MessageBufferPool {
+    struct Slab;
+
+public:
+    /**
+     * @param min_buffer_size The size of the smallest class of buffers
+     * @param max_buffer_size The size of the largest class of buffers, which
+     * is the largest size that acquire() can be asked for
+     * @param slab_size The size of the slabs that buffers are carved from;
+     * a class whose buffers are larger gets one buffer per slab
+     */
+    MessageBufferPool(std::size_t min_buffer_size, std::size_t max_buffer_size,
+                      std::size_t slab_size);
+
+    /** Returns a free buffer that can hold at least size bytes, from the
+     * smallest class that has one, or an empty MessageBuffer (whose buffer
+     * is null) if no class does. Never allocates. */
+    MessageBuffer acquire(std::size_t size);
+    /** Returns a buffer obtained from acquire() to the pool. Buffers from
+     * another pool are accepted if their size is one of this pool's classes,
+     * and dropped otherwise, as are buffers that aren't pooled and buffers
+     * of a class that already has as many free buffers as were reserved. */
+    void release(MessageBuffer&& buffer);
+    /** Makes sure that at least count buffers that can hold size bytes are
+     * free, and makes count the most that their class keeps. */
+    void reserve(std::size_t size, std::size_t count);
+
+    /** The registered memory that reserve(size, count) adds to a pool with
+     * no free buffers of that class */
+    std::size_t reserved_bytes(std::size_t size, std::size_t count) const;
+
+    std::size_t get_max_buffer_size() const { return class_sizes.back(); }
+
+private:
+    const std::size_t slab_size;
+    /** The capacity of the buffers in each class, in increasing order */
+    std::vector<std::size_t> class_sizes;
+    std::mutex pool_mutex;
+    /** The free buffers of each class */
+    std::vector<std::vector<MessageBuffer>> free_buffers;
+    /** The most free buffers each class keeps, as set by reserve() */
+    std::vector<std::size_t> reserved_counts;
+
+    std::size_t class_for(std::size_t size) const;
+    /** Adds a new slab's worth of buffers to a class; the caller must hold pool_mutex */
+    void add_slab(std::size_t size_class);
+};
+}  // namespace derecho
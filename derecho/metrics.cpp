@@ -0,0 +1,170 @@
+/**
+ * @file metrics.cpp
+ */
+
+#include "metrics.h"
+#include "conf/affinity.hpp"
+
+#include "tcp/tcp.h"
+
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace derecho {
+
+std::size_t MetricCounter::shard_of_this_thread() {
+    static thread_local const std::size_t shard
+            = std::hash<std::thread::id>()(std::this_thread::get_id()) % num_shards;
+    return shard;
+}
+
+uint64_t MetricCounter::value() const {
+    uint64_t total = 0;
+    for(const Shard& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+MetricsRegistry& MetricsRegistry::get() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Series& MetricsRegistry::add_series(const std::string& name, const std::string& help,
+                                                     MetricType type, const std::string& labels,
+                                                     std::function<double()> read) {
+    Family& family = families[name];
+    if(family.series.empty()) {
+        family.help = help;
+        family.type = type;
+    }
+    Series& series = family.series[labels];
+    series.id = next_series_id++;
+    series.read = std::move(read);
+    return series;
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name, const std::string& help,
+                                        const std::string& labels) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::unique_ptr<MetricCounter>& counter = counters[name + "{" + labels + "}"];
+    if(!counter) {
+        counter = std::make_unique<MetricCounter>();
+        MetricCounter* counter_ptr = counter.get();
+        add_series(name, help, MetricType::COUNTER, labels,
+                   [counter_ptr]() { return static_cast<double>(counter_ptr->value()); });
+    }
+    return *counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(const std::string& name, const std::string& help,
+                                    const std::string& labels) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::unique_ptr<MetricGauge>& gauge = gauges[name + "{" + labels + "}"];
+    if(!gauge) {
+        gauge = std::make_unique<MetricGauge>();
+        MetricGauge* gauge_ptr = gauge.get();
+        add_series(name, help, MetricType::GAUGE, labels,
+                   [gauge_ptr]() { return static_cast<double>(gauge_ptr->value()); });
+    }
+    return *gauge;
+}
+
+uint64_t MetricsRegistry::add_reader(const std::string& name, const std::string& help, MetricType type,
+                                     const std::string& labels, std::function<double()> read) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const uint64_t id = add_series(name, help, type, labels, std::move(read)).id;
+    readers[id] = {name, labels};
+    return id;
+}
+
+void MetricsRegistry::remove_reader(uint64_t id) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto reader = readers.find(id);
+    if(reader == readers.end()) {
+        return;
+    }
+    auto family = families.find(reader->second.first);
+    auto series = family->second.series.find(reader->second.second);
+    // a later reader with the same name and labels may have replaced this one
+    if(series != family->second.series.end() && series->second.id == id) {
+        family->second.series.erase(series);
+        if(family->second.series.empty()) {
+            families.erase(family);
+        }
+    }
+    readers.erase(reader);
+}
+
+std::string MetricsRegistry::prometheus_text() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::ostringstream text;
+    text << std::setprecision(17);
+    for(const auto& [name, family] : families) {
+        text << "# HELP " << name << " " << family.help << "\n"
+             << "# TYPE " << name << " " << (family.type == MetricType::COUNTER ? "counter" : "gauge") << "\n";
+        for(const auto& [labels, series] : family.series) {
+            text << name;
+            if(!labels.empty()) {
+                text << "{" << labels << "}";
+            }
+            text << " " << series.read() << "\n";
+        }
+    }
+    return text.str();
+}
+
+std::string metric_label(const std::string& name, uint64_t value) {
+    return name + "=\"" + std::to_string(value) + "\"";
+}
+
+MetricsServer::MetricsServer(uint16_t port) : thread_shutdown(false) {
+    if(port != 0) {
+        server_thread = std::thread(&MetricsServer::serve, this, port);
+    }
+}
+
+MetricsServer::~MetricsServer() {
+    thread_shutdown = true;
+    if(server_thread.joinable()) {
+        server_thread.join();
+    }
+}
+
+void MetricsServer::serve(uint16_t port) {
+    name_and_pin_thread("metrics");
+    tcp::connection_listener listener(port);
+    tcp::socket_poller poller;
+    poller.add(listener, 0);
+    // the timeout only bounds how long the destructor waits for this thread
+    constexpr int poll_timeout_ms = 200;
+    while(!thread_shutdown) {
+        if(poller.wait(poll_timeout_ms).empty()) {
+            continue;
+        }
+        tcp::socket client = listener.accept();
+        // Every request gets the metrics, so the request only needs to be
+        // read out of the way, not parsed
+        tcp::socket_poller request_poller;
+        request_poller.add(client, 0);
+        if(request_poller.wait(poll_timeout_ms).empty()) {
+            continue;
+        }
+        std::vector<char> request(client.bytes_available());
+        if(!request.empty() && !client.read(request.data(), request.size())) {
+            continue;
+        }
+        request_poller.remove(client);
+        const std::string body = MetricsRegistry::get().prometheus_text();
+        const std::string header = "HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: "
+                                   + std::to_string(body.size()) + "\r\n\r\n";
+        client.writev({{header.data(), header.size()}, {body.data(), body.size()}});
+    }
+}
+
+}  // namespace derecho
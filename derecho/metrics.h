@@ -0,0 +1,135 @@
+/**
+ * @file metrics.h
+ *
+ * A process-wide registry of counters and gauges, which can be pulled in the
+ * Prometheus text exposition format through a MetricsServer.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace derecho {
+
+/**
+ * A monotonically increasing count, split into cache-line-sized shards so
+ * that threads counting the same event don't contend for one cache line.
+ * Each thread always adds to the same shard, with a relaxed atomic add.
+ */
+class MetricCounter {
+    static constexpr std::size_t num_shards = 16;
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, num_shards> shards;
+
+    static std::size_t shard_of_this_thread();
+
+public:
+    void add(uint64_t amount = 1) {
+        shards[shard_of_this_thread()].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+};
+
+/** A value that can go up and down, such as a queue depth. */
+class MetricGauge {
+    std::atomic<int64_t> current{0};
+
+public:
+    void set(int64_t value) { current.store(value, std::memory_order_relaxed); }
+    void add(int64_t amount) { current.fetch_add(amount, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+};
+
+enum class MetricType {
+    COUNTER,
+    GAUGE
+};
+
+/**
+ * Holds every metric of the process by name and labels. The labels are a
+ * Prometheus label list without the braces, e.g. "subgroup=\"0\"".
+ *
+ * Counters and gauges created here live as long as the process, so code can
+ * keep references to them and update them without any lookup. A value that
+ * is already kept somewhere else, like the length of a queue, is registered
+ * instead as a function that reads it when the metrics are pulled, so that
+ * the hot path pays nothing for it; such a function must be removed before
+ * whatever it reads is destroyed.
+ */
+class MetricsRegistry {
+    struct Series {
+        uint64_t id;
+        std::function<double()> read;
+    };
+    struct Family {
+        std::string help;
+        MetricType type;
+        /** By labels */
+        std::map<std::string, Series> series;
+    };
+
+    /** Held while a read function runs, so removing one waits until it is done */
+    std::mutex registry_mutex;
+    std::map<std::string, Family> families;
+    std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+    std::map<std::string, std::unique_ptr<MetricGauge>> gauges;
+    /** The name and labels of each function registered by add_reader */
+    std::map<uint64_t, std::pair<std::string, std::string>> readers;
+    uint64_t next_series_id = 0;
+
+    Series& add_series(const std::string& name, const std::string& help, MetricType type,
+                       const std::string& labels, std::function<double()> read);
+
+public:
+    static MetricsRegistry& get();
+
+    /** Returns the counter with this name and labels, creating it the first time. */
+    MetricCounter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    /** Returns the gauge with this name and labels, creating it the first time. */
+    MetricGauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    /**
+     * Registers a function that reads the value of a metric when the metrics
+     * are pulled. It is called with the registry's lock held, so it must not
+     * use the registry itself, and must not wait for a thread that might.
+     * @return An ID for remove_reader
+     */
+    uint64_t add_reader(const std::string& name, const std::string& help, MetricType type,
+                        const std::string& labels, std::function<double()> read);
+    /** Unregisters a function added by add_reader; it is not called after this returns. */
+    void remove_reader(uint64_t id);
+
+    /** Reads every metric, in the Prometheus text exposition format. */
+    std::string prometheus_text();
+};
+
+/**
+ * Serves the metrics of MetricsRegistry::get() over HTTP, to any request on
+ * its port, so a Prometheus server can scrape them.
+ */
+class MetricsServer {
+    std::atomic<bool> thread_shutdown;
+    std::thread server_thread;
+
+    void serve(uint16_t port);
+
+public:
+    /** Starts serving on a port, unless it is 0. */
+    MetricsServer(uint16_t port);
+    ~MetricsServer();
+};
+
+/** Renders a label list with a single label, e.g. subgroup="3". */
+std::string metric_label(const std::string& name, uint64_t value);
+
+}  // namespace derecho
@@ -1,16 +1,27 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <limits>
 #include <thread>
 
+#include "conf/affinity.hpp"
+#include "conf/fault_injection.hpp"
+#include "derecho_exception.h"
 #include "derecho_internal.h"
+#include "derecho_log.h"
 #include "multicast_group.h"
+#include "persistent/LogCodec.hpp"
 #include "persistent/Persistent.hpp"
 #include "rdmc/util.h"
+#include "row_min.h"
 
 namespace derecho {
 
+/** The size of the smallest RDMC message buffers */
+static constexpr std::size_t min_message_buffer_size = 4096;
+
 /**
  * Helper function to find the index of an element in a container.
  */
@@ -24,6 +35,110 @@ size_t index_of(T container, U elem) {
     return container.size();
 }
 
+SSTSlotPins::SSTSlotPins(std::shared_ptr<DerechoSST> sst, uint32_t max_pins)
+        : sst(sst),
+          max_pins(max_pins) {}
+
+void SSTSlotPins::add_sender(uint32_t num_received_entry, std::vector<uint32_t> shard_sst_indices) {
+    std::lock_guard<std::mutex> lock(pins_mutex);
+    last_delivered[num_received_entry] = -1;
+    this->shard_sst_indices[num_received_entry] = std::move(shard_sst_indices);
+}
+
+bool SSTSlotPins::try_pin(uint32_t num_received_entry, int32_t sst_index) {
+    std::lock_guard<std::mutex> lock(pins_mutex);
+    if(num_pins >= max_pins || wedged) {
+        return false;
+    }
+    pinned[num_received_entry].insert(sst_index);
+    num_pins++;
+    return true;
+}
+
+void SSTSlotPins::release(uint32_t num_received_entry, int32_t sst_index) {
+    std::lock_guard<std::mutex> lock(pins_mutex);
+    if(pinned[num_received_entry].erase(sst_index)) {
+        num_pins--;
+        update_released(num_received_entry);
+    }
+}
+
+void SSTSlotPins::delivered(uint32_t num_received_entry, int32_t sst_index) {
+    if(!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pins_mutex);
+    auto last_delivered_it = last_delivered.find(num_received_entry);
+    if(last_delivered_it == last_delivered.end() || last_delivered_it->second >= sst_index) {
+        return;
+    }
+    last_delivered_it->second = sst_index;
+    update_released(num_received_entry);
+}
+
+void SSTSlotPins::wedge() {
+    std::lock_guard<std::mutex> lock(pins_mutex);
+    wedged = true;
+}
+
+void SSTSlotPins::update_released(uint32_t num_received_entry) {
+    int32_t released = last_delivered[num_received_entry];
+    const auto& entry_pins = pinned[num_received_entry];
+    if(!entry_pins.empty()) {
+        released = std::min(released, *entry_pins.begin() - 1);
+    }
+    const uint32_t my_row = sst->get_local_index();
+    if(released <= sst->num_released_sst[my_row][num_received_entry]) {
+        return;
+    }
+    sst->num_released_sst[my_row][num_received_entry] = released;
+    // Once the group is wedged the next view has its own SST, and the
+    // members of this one may already be gone
+    if(!wedged) {
+        sst->put_range(shard_sst_indices[num_received_entry], sst->num_released_sst, num_received_entry, 1);
+    }
+}
+
+SSTMessageView::SSTMessageView(std::shared_ptr<SSTSlotPins> slot_pins, uint32_t num_received_entry,
+                               int32_t sst_index, const char* payload, long long int payload_size)
+        : num_received_entry(num_received_entry),
+          sst_index(sst_index),
+          payload(payload),
+          payload_size(payload_size) {
+    if(slot_pins && slot_pins->try_pin(num_received_entry, sst_index)) {
+        pins = std::move(slot_pins);
+    } else {
+        copy = std::unique_ptr<char[]>(new char[payload_size]);
+        memcpy(copy.get(), payload, payload_size);
+        this->payload = copy.get();
+    }
+}
+
+SSTMessageView& SSTMessageView::operator=(SSTMessageView&& other) {
+    if(this != &other) {
+        release();
+        pins = std::move(other.pins);
+        num_received_entry = other.num_received_entry;
+        sst_index = other.sst_index;
+        copy = std::move(other.copy);
+        payload = other.payload;
+        payload_size = other.payload_size;
+        other.payload = nullptr;
+        other.payload_size = 0;
+    }
+    return *this;
+}
+
+void SSTMessageView::release() {
+    if(pins) {
+        pins->release(num_received_entry, sst_index);
+        pins.reset();
+    }
+    copy.reset();
+    payload = nullptr;
+    payload_size = 0;
+}
+
 MulticastGroup::MulticastGroup(
         std::vector<node_id_t> _members, node_id_t my_node_id,
         std::shared_ptr<DerechoSST> sst,
@@ -37,40 +152,71 @@ MulticastGroup::MulticastGroup(
           members(_members),
           num_members(members.size()),
           member_index(index_of(members, my_node_id)),
-          block_size(derecho_params.block_size),
-          max_msg_size(compute_max_msg_size(derecho_params.max_payload_size,
-                                            derecho_params.block_size,
-                                            derecho_params.max_payload_size > derecho_params.max_smc_payload_size)),
-          sst_max_msg_size(derecho_params.max_smc_payload_size + sizeof(header)),
-          rdmc_send_algorithm(derecho_params.rdmc_send_algorithm),
-          window_size(derecho_params.window_size),
           callbacks(callbacks),
           total_num_subgroups(total_num_subgroups),
           subgroup_settings(subgroup_settings_by_id),
           received_intervals(sst->num_received.size(), {-1, -1}),
           rdmc_group_num_offset(0),
+          buffer_pools(total_num_subgroups),
           future_message_indices(total_num_subgroups, 0),
+          skip_null_messages(getConfBoolean(CONF_DERECHO_SKIP_NULL_MESSAGES)),
+          aggregated_stability(getConfBoolean(CONF_DERECHO_AGGREGATED_STABILITY)),
+          aggregation_fanout(std::max(1u, getConfUInt32(CONF_DERECHO_AGGREGATION_FANOUT))),
+          null_skip_ahead(total_num_subgroups, 0),
           next_sends(total_num_subgroups),
+          pending_sst_sends(total_num_subgroups, false),
           pending_sends(total_num_subgroups),
+          rpc_aggregation_size(getConfUInt32(CONF_DERECHO_RPC_AGGREGATION_SIZE)),
+          rpc_aggregation_delay_ns(getConfUInt64(CONF_DERECHO_RPC_AGGREGATION_DELAY_US) * 1000),
+          rpc_aggregates(total_num_subgroups),
           current_sends(total_num_subgroups),
+          current_receives(total_num_subgroups),
+          locally_stable_rdmc_messages(total_num_subgroups),
+          locally_stable_sst_messages(total_num_subgroups),
+          pending_message_timestamps(total_num_subgroups),
+          change_rings(total_num_subgroups, nullptr),
+          pending_persistence(total_num_subgroups),
+          non_persistent_messages(total_num_subgroups),
+          non_persistent_sst_messages(total_num_subgroups),
+          batched_messages(total_num_subgroups),
+          delivery_batches(total_num_subgroups),
           next_message_to_deliver(total_num_subgroups),
+          msg_state_mtxs(total_num_subgroups),
+          shard_rows(total_num_subgroups),
+          shard_minima(total_num_subgroups),
+          global_persistence_frontiers(total_num_subgroups, INVALID_VERSION),
+          sequencer_states(total_num_subgroups),
+          send_gates(total_num_subgroups),
+          adaptive_window(getConfBoolean(CONF_DERECHO_ADAPTIVE_WINDOW)),
           sender_timeout(derecho_params.timeout_ms),
+          failure_phi_threshold(getConfDouble(CONF_DERECHO_FAILURE_PHI_THRESHOLD)),
+          heartbeat_histories(num_members),
+          num_sender_threads(std::max(1u, getConfUInt32(CONF_DERECHO_NUM_SENDER_THREADS))),
+          sender_wakeups(num_sender_threads),
+          send_space_wanted(total_num_subgroups),
+          queued_rdmc_sends(total_num_subgroups),
+          delivery_executors(total_num_subgroups),
           sst(sst),
+          slot_pins(std::make_shared<SSTSlotPins>(sst, derecho_params.max_pinned_sst_messages)),
           sst_multicast_group_ptrs(total_num_subgroups),
           last_transfer_medium(total_num_subgroups),
+          tier_send_counts(total_num_subgroups, {0, 0, 0}),
+          latency_histograms(getConfBoolean(CONF_DERECHO_LATENCY_STATS)
+                                     ? std::make_shared<std::vector<SubgroupLatencyHistograms>>(total_num_subgroups)
+                                     : nullptr),
+          own_delivery_progress(std::make_shared<std::vector<OwnDeliveryProgress>>(total_num_subgroups)),
+          unpersisted_send_timestamps(total_num_subgroups),
+          latency_stats_dump_interval_ns(getConfUInt64(CONF_DERECHO_LATENCY_STATS_DUMP_INTERVAL_MS) * 1000000),
           persistence_manager_callbacks(persistence_manager_callbacks) {
-    assert(window_size >= 1);
-
     for(uint i = 0; i < num_members; ++i) {
         node_id_to_sst_index[members[i]] = i;
     }
 
-    for(const auto p : subgroup_settings_by_id) {
-        auto num_shard_members = p.second.members.size();
-        while(free_message_buffers[p.first].size() < window_size * num_shard_members) {
-            free_message_buffers[p.first].emplace_back(max_msg_size);
-        }
-    }
+    reserve_message_buffers(nullptr);
+    allocate_message_rings();
+    compute_shard_rows();
+    compute_send_gates();
+    register_metrics();
 
     initialize_sst_row();
     bool no_member_failed = true;
@@ -86,8 +232,9 @@ MulticastGroup::MulticastGroup(
         // if groups are created successfully, rdmc_sst_groups_created will be set to true
         rdmc_sst_groups_created = create_rdmc_sst_groups();
     }
+    start_delivery_executors();
     register_predicates();
-    sender_thread = std::thread(&MulticastGroup::send_loop, this);
+    start_sender_threads();
     timeout_thread = std::thread(&MulticastGroup::check_failures_loop, this);
 }
 
@@ -103,42 +250,92 @@ MulticastGroup::MulticastGroup(
           members(_members),
           num_members(members.size()),
           member_index(index_of(members, my_node_id)),
-          block_size(old_group.block_size),
-          max_msg_size(old_group.max_msg_size),
-          sst_max_msg_size(old_group.sst_max_msg_size),
-          rdmc_send_algorithm(old_group.rdmc_send_algorithm),
-          window_size(old_group.window_size),
           callbacks(old_group.callbacks),
           total_num_subgroups(total_num_subgroups),
           subgroup_settings(subgroup_settings_by_id),
           received_intervals(sst->num_received.size(), {-1, -1}),
           rpc_callback(old_group.rpc_callback),
           rdmc_group_num_offset(old_group.rdmc_group_num_offset + old_group.num_members),
+          buffer_pools(total_num_subgroups),
           future_message_indices(total_num_subgroups, 0),
+          skip_null_messages(old_group.skip_null_messages),
+          aggregated_stability(old_group.aggregated_stability),
+          aggregation_fanout(old_group.aggregation_fanout),
+          null_skip_ahead(total_num_subgroups, 0),
           next_sends(total_num_subgroups),
+          pending_sst_sends(total_num_subgroups, false),
           pending_sends(total_num_subgroups),
+          rpc_aggregation_size(old_group.rpc_aggregation_size),
+          rpc_aggregation_delay_ns(old_group.rpc_aggregation_delay_ns),
+          rpc_aggregates(total_num_subgroups),
           current_sends(total_num_subgroups),
+          current_receives(total_num_subgroups),
+          locally_stable_rdmc_messages(total_num_subgroups),
+          locally_stable_sst_messages(total_num_subgroups),
+          pending_message_timestamps(total_num_subgroups),
+          change_rings(total_num_subgroups, nullptr),
+          pending_persistence(total_num_subgroups),
+          non_persistent_messages(total_num_subgroups),
+          non_persistent_sst_messages(total_num_subgroups),
+          batched_messages(total_num_subgroups),
+          delivery_batches(total_num_subgroups),
           next_message_to_deliver(total_num_subgroups),
+          msg_state_mtxs(total_num_subgroups),
+          shard_rows(total_num_subgroups),
+          shard_minima(total_num_subgroups),
+          global_persistence_frontiers(total_num_subgroups, INVALID_VERSION),
+          sequencer_states(total_num_subgroups),
+          send_gates(total_num_subgroups),
+          adaptive_window(old_group.adaptive_window),
           sender_timeout(old_group.sender_timeout),
+          failure_phi_threshold(old_group.failure_phi_threshold),
+          heartbeat_histories(num_members),
+          num_sender_threads(old_group.num_sender_threads),
+          sender_wakeups(num_sender_threads),
+          send_space_wanted(total_num_subgroups),
+          queued_rdmc_sends(total_num_subgroups),
+          delivery_executors(total_num_subgroups),
           sst(sst),
+          slot_pins(std::make_shared<SSTSlotPins>(sst, old_group.slot_pins->get_max_pins())),
           sst_multicast_group_ptrs(total_num_subgroups),
           last_transfer_medium(total_num_subgroups),
+          tier_send_counts(total_num_subgroups, {0, 0, 0}),
+          latency_histograms(old_group.latency_histograms),
+          own_delivery_progress(old_group.own_delivery_progress),
+          unpersisted_send_timestamps(total_num_subgroups),
+          latency_stats_dump_interval_ns(old_group.latency_stats_dump_interval_ns),
           persistence_manager_callbacks(_persistence_manager_callbacks) {
     // Make sure rdmc_group_num_offset didn't overflow.
     assert(old_group.rdmc_group_num_offset <= std::numeric_limits<uint16_t>::max() - old_group.num_members - num_members);
 
     // Just in case
     old_group.wedge();
+    // Wedged, so its predicate thread no longer writes these
+    std::copy_n(old_group.global_persistence_frontiers.begin(),
+                std::min(old_group.global_persistence_frontiers.size(), global_persistence_frontiers.size()),
+                global_persistence_frontiers.begin());
 
     for(uint i = 0; i < num_members; ++i) {
         node_id_to_sst_index[members[i]] = i;
     }
 
+    // Returns a buffer of the old group to the subgroup's pool, or drops it
+    // if this node is no longer in the subgroup
+    auto release_old_buffer = [this](subgroup_id_t subgroup_num, MessageBuffer&& buffer) {
+        if(subgroup_num < buffer_pools.size() && buffer_pools[subgroup_num]) {
+            buffer_pools[subgroup_num]->release(std::move(buffer));
+        }
+    };
+
     // Convience function that takes a msg from the old group and
     // produces one suitable for this group.
-    auto convert_msg = [this](RDMCMessage& msg, subgroup_id_t subgroup_num) {
+    auto convert_msg = [this, &release_old_buffer](RDMCMessage& msg, subgroup_id_t subgroup_num) {
         msg.sender_id = members[member_index];
         msg.index = future_message_indices[subgroup_num]++;
+        // A compressed copy is made again when the message is re-sent
+        if(msg.wire_buffer.buffer) {
+            release_old_buffer(subgroup_num, std::move(msg.wire_buffer));
+        }
         return std::move(msg);
     };
 
@@ -150,84 +347,92 @@ MulticastGroup::MulticastGroup(
         return std::move(msg);
     };
 
-    for(const auto p : subgroup_settings_by_id) {
-        auto num_shard_members = p.second.members.size();
-        while(free_message_buffers[p.first].size() < window_size * num_shard_members) {
-            free_message_buffers[p.first].emplace_back(max_msg_size);
-        }
+    reserve_message_buffers(&old_group);
+    allocate_message_rings();
+    compute_shard_rows();
+    compute_send_gates();
+    register_metrics();
+
+    // The old group's metrics lock its mutexes, so they must be removed
+    // before this holds them
+    old_group.unregister_metrics();
+    // The old group is wedged, so nothing else contends for its locks now
+    std::vector<std::unique_lock<std::mutex>> old_group_locks;
+    for(auto& old_group_mtx : old_group.msg_state_mtxs) {
+        old_group_locks.emplace_back(old_group_mtx);
     }
 
-    // Reclaim RDMCMessageBuffers from the old group, and supplement them with
-    // additional if the group has grown.
-    std::lock_guard<std::mutex> lock(old_group.msg_state_mtx);
-    for(const auto p : subgroup_settings_by_id) {
-        const auto subgroup_num = p.first;
-        auto num_shard_members = p.second.members.size();
-        // for later: don't move extra message buffers
-        free_message_buffers[subgroup_num].swap(old_group.free_message_buffers[subgroup_num]);
-        while(free_message_buffers[subgroup_num].size() < old_group.window_size * num_shard_members) {
-            free_message_buffers[subgroup_num].emplace_back(max_msg_size);
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < old_group.current_receives.size(); ++subgroup_num) {
+        for(auto& msg : old_group.current_receives[subgroup_num]) {
+            release_old_buffer(subgroup_num, std::move(msg.second.message_buffer));
         }
+        old_group.current_receives[subgroup_num].clear();
     }
 
-    for(auto& msg : old_group.current_receives) {
-        free_message_buffers[msg.first.first].push_back(std::move(msg.second.message_buffer));
-    }
-    old_group.current_receives.clear();
-
     // Assume that any locally stable messages failed. If we were the sender
     // than re-attempt, otherwise discard. TODO: Presumably the ragged edge
     // cleanup will want the chance to deliver some of these.
-    for(auto& p : old_group.locally_stable_rdmc_messages) {
-        if(p.second.size() == 0) {
-            continue;
-        }
-
-        for(auto& q : p.second) {
-            if(q.second.sender_id == members[member_index]) {
-                pending_sends[p.first].push(convert_msg(q.second, p.first));
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < old_group.locally_stable_rdmc_messages.size(); ++subgroup_num) {
+        old_group.locally_stable_rdmc_messages[subgroup_num].for_each([&](message_id_t, RDMCMessage& msg) {
+            if(msg.sender_id == members[member_index]) {
+                queue_rdmc_send(subgroup_num, convert_msg(msg, subgroup_num));
             } else {
-                free_message_buffers[p.first].push_back(std::move(q.second.message_buffer));
+                release_old_buffer(subgroup_num, std::move(msg.message_buffer));
             }
-        }
+        });
+        old_group.locally_stable_rdmc_messages[subgroup_num].clear();
     }
-    old_group.locally_stable_rdmc_messages.clear();
 
-    for(auto& p : old_group.locally_stable_sst_messages) {
-        if(p.second.size() == 0) {
-            continue;
-        }
+    for(auto& old_sst_messages : old_group.locally_stable_sst_messages) {
+        old_sst_messages.clear();
     }
-    old_group.locally_stable_sst_messages.clear();
 
     // Any messages that were being sent should be re-attempted.
     for(const auto& p : subgroup_settings_by_id) {
         auto subgroup_num = p.first;
-        if(old_group.current_sends.size() > subgroup_num && old_group.current_sends[subgroup_num]) {
-            pending_sends[subgroup_num].push(convert_msg(*old_group.current_sends[subgroup_num], subgroup_num));
+        if(old_group.current_sends.size() > subgroup_num) {
+            // Re-send the messages that were in flight in the order they were sent
+            std::vector<RDMCMessage*> old_current_sends;
+            for(auto& old_current_send : old_group.current_sends[subgroup_num]) {
+                if(old_current_send) {
+                    old_current_sends.push_back(&*old_current_send);
+                }
+            }
+            std::sort(old_current_sends.begin(), old_current_sends.end(),
+                      [](const RDMCMessage* a, const RDMCMessage* b) { return a->index < b->index; });
+            for(RDMCMessage* old_current_send : old_current_sends) {
+                queue_rdmc_send(subgroup_num, convert_msg(*old_current_send, subgroup_num));
+            }
         }
 
         if(old_group.pending_sends.size() > subgroup_num) {
             while(!old_group.pending_sends[subgroup_num].empty()) {
-                pending_sends[subgroup_num].push(convert_msg(old_group.pending_sends[subgroup_num].front(), subgroup_num));
+                queue_rdmc_send(subgroup_num, convert_msg(old_group.pending_sends[subgroup_num].front(), subgroup_num));
                 old_group.pending_sends[subgroup_num].pop();
             }
         }
 
         if(old_group.next_sends.size() > subgroup_num && old_group.next_sends[subgroup_num]) {
             next_sends[subgroup_num] = convert_msg(*old_group.next_sends[subgroup_num], subgroup_num);
+            // A packed message being filled keeps its buffer, so it can keep filling in this view
+            if(old_group.last_transfer_medium[subgroup_num] && old_group.rpc_aggregates[subgroup_num].payload) {
+                rpc_aggregates[subgroup_num] = old_group.rpc_aggregates[subgroup_num];
+                last_transfer_medium[subgroup_num] = true;
+            }
         }
 
-        for(auto& entry : old_group.non_persistent_messages[subgroup_num]) {
-            non_persistent_messages[subgroup_num].emplace(entry.first,
-                                                          convert_msg(entry.second, subgroup_num));
+        if(old_group.non_persistent_messages.size() > subgroup_num) {
+            old_group.non_persistent_messages[subgroup_num].for_each([&](message_id_t seq_num, RDMCMessage& msg) {
+                non_persistent_messages[subgroup_num].insert_or_assign(seq_num, convert_msg(msg, subgroup_num));
+            });
+            old_group.non_persistent_messages[subgroup_num].clear();
         }
-        old_group.non_persistent_messages.clear();
-        for(auto& entry : old_group.non_persistent_sst_messages[subgroup_num]) {
-            non_persistent_sst_messages[subgroup_num].emplace(entry.first,
-                                                              convert_sst_msg(entry.second, subgroup_num));
+        if(old_group.non_persistent_sst_messages.size() > subgroup_num) {
+            old_group.non_persistent_sst_messages[subgroup_num].for_each([&](message_id_t seq_num, SSTMessage& msg) {
+                non_persistent_sst_messages[subgroup_num].insert_or_assign(seq_num, convert_sst_msg(msg, subgroup_num));
+            });
+            old_group.non_persistent_sst_messages[subgroup_num].clear();
         }
-        old_group.non_persistent_sst_messages.clear();
     }
 
     initialize_sst_row();
@@ -244,8 +449,9 @@ MulticastGroup::MulticastGroup(
         // if groups are created successfully, rdmc_sst_groups_created will be set to true
         rdmc_sst_groups_created = create_rdmc_sst_groups();
     }
+    start_delivery_executors();
     register_predicates();
-    sender_thread = std::thread(&MulticastGroup::send_loop, this);
+    start_sender_threads();
     timeout_thread = std::thread(&MulticastGroup::check_failures_loop, this);
 }
 
@@ -257,10 +463,18 @@ bool MulticastGroup::create_rdmc_sst_groups() {
         std::size_t num_shard_members = shard_members.size();
         std::vector<int> shard_senders = curr_subgroup_settings.senders;
         uint32_t num_shard_senders = get_num_senders(shard_senders);
-        auto shard_sst_indices = get_shard_sst_indices(subgroup_num);
+        const auto& shard_sst_indices = get_shard_sst_indices(subgroup_num);
         sst_multicast_group_ptrs[subgroup_num] = std::make_unique<sst::multicast_group<DerechoSST>>(
-                sst, shard_sst_indices, window_size, sst_max_msg_size, curr_subgroup_settings.senders,
-                curr_subgroup_settings.num_received_offset, window_size * subgroup_num);
+                sst, shard_sst_indices, curr_subgroup_settings.window_size, curr_subgroup_settings.sst_max_msg_size,
+                curr_subgroup_settings.senders, curr_subgroup_settings.num_received_offset,
+                curr_subgroup_settings.slots_offset,
+                slot_pins->enabled() ? &DerechoSST::num_released_sst : nullptr,
+                curr_subgroup_settings.inline_max_msg_size);
+        if(slot_pins->enabled()) {
+            for(uint32_t sender_rank = 0; sender_rank < num_shard_senders; ++sender_rank) {
+                slot_pins->add_sender(curr_subgroup_settings.num_received_offset + sender_rank, shard_sst_indices);
+            }
+        }
         for(uint shard_rank = 0, sender_rank = -1; shard_rank < num_shard_members; ++shard_rank) {
             // don't create RDMC group if the shard member is never going to send
             if(!shard_senders[shard_rank]) {
@@ -268,206 +482,445 @@ bool MulticastGroup::create_rdmc_sst_groups() {
             }
             sender_rank++;
             node_id_t node_id = shard_members[shard_rank];
-            // When RDMC receives a message, it should store it in
-            // locally_stable_rdmc_messages and update the received count
-            rdmc::completion_callback_t rdmc_receive_handler;
-            rdmc_receive_handler = [this, subgroup_num, shard_rank, sender_rank,
-                                    curr_subgroup_settings, node_id,
-                                    num_shard_members, num_shard_senders,
-                                    shard_sst_indices](char* data, size_t size) {
-                assert(this->sst);
-                std::lock_guard<std::mutex> lock(msg_state_mtx);
-                header* h = (header*)data;
-                const int32_t index = h->index;
-                message_id_t sequence_number = index * num_shard_senders + sender_rank;
-
-                whenlog(logger->trace("Locally received message in subgroup {}, sender rank {}, index {}", subgroup_num, shard_rank, index););
-                // Move message from current_receives to locally_stable_rdmc_messages.
-                if(node_id == members[member_index]) {
-                    assert(current_sends[subgroup_num]);
-                    locally_stable_rdmc_messages[subgroup_num][sequence_number] = std::move(*current_sends[subgroup_num]);
-                    current_sends[subgroup_num] = std::nullopt;
-                } else {
-                    auto it = current_receives.find({subgroup_num, node_id});
-                    assert(it != current_receives.end());
-                    auto& message = it->second;
-                    message.index = index;
-                    locally_stable_rdmc_messages[subgroup_num].emplace(sequence_number, std::move(message));
-                    current_receives.erase(it);
-                }
-
-                auto new_num_received = resolve_num_received(index, curr_subgroup_settings.num_received_offset + sender_rank);
-                /* NULL Send Scheme */
-                // only if I am a sender in the subgroup and the subgroup is not in UNORDERED mode
-                if(curr_subgroup_settings.sender_rank >= 0 && curr_subgroup_settings.mode != Mode::UNORDERED) {
-                    if(curr_subgroup_settings.sender_rank < (int)sender_rank) {
-                        while(future_message_indices[subgroup_num] <= new_num_received) {
-                            get_buffer_and_send_auto_null(subgroup_num);
+            // Each lane is a separate RDMC group, so that up to
+            // max_outstanding_rdmc_sends messages from this sender can be in
+            // flight at once. Receivers can see them complete out of order;
+            // resolve_num_received() takes care of that.
+            for(uint32_t lane = 0; lane < curr_subgroup_settings.max_outstanding_rdmc_sends; ++lane) {
+                // When RDMC receives a message, it should store it in
+                // locally_stable_rdmc_messages and update the received count
+                rdmc::completion_callback_t rdmc_receive_handler;
+                rdmc_receive_handler = [this, subgroup_num, shard_rank, sender_rank,
+                                        curr_subgroup_settings, node_id, lane,
+                                        num_shard_members, num_shard_senders,
+                                        shard_sst_indices](char* data, size_t size) {
+                    assert(this->sst);
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                    header* h = (header*)data;
+                    const int32_t index = h->index;
+                    message_id_t sequence_number = index * num_shard_senders + sender_rank;
+
+                    multicast_log(TRACE, "Locally received message in subgroup {}, sender rank {}, index {}", subgroup_num, shard_rank, index);
+                    record_latency(subgroup_num, LatencyStage::RECEIVED, h->timestamp);
+                    // Move message from current_receives to locally_stable_rdmc_messages.
+                    if(node_id == members[member_index]) {
+                        assert(current_sends[subgroup_num][lane]);
+                        if(current_sends[subgroup_num][lane]->wire_buffer.buffer) {
+                            buffer_pools[subgroup_num]->release(std::move(current_sends[subgroup_num][lane]->wire_buffer));
+                        }
+                        locally_stable_rdmc_messages[subgroup_num].insert_or_assign(sequence_number, std::move(*current_sends[subgroup_num][lane]));
+                        current_sends[subgroup_num][lane] = std::nullopt;
+                        if(send_gates[subgroup_num].send_token) {
+                            update_send_token(subgroup_num);
                         }
-                    } else if(curr_subgroup_settings.sender_rank > (int)sender_rank) {
-                        while(future_message_indices[subgroup_num] < new_num_received) {
-                            get_buffer_and_send_auto_null(subgroup_num);
+                    } else {
+                        auto it = current_receives[subgroup_num].find({node_id, lane});
+                        assert(it != current_receives[subgroup_num].end());
+                        auto& message = it->second;
+                        message.index = index;
+                        if(curr_subgroup_settings.rdmc_compression && h->compressed) {
+                            decompress_rdmc_message(subgroup_num, message);
                         }
+                        locally_stable_rdmc_messages[subgroup_num].insert_or_assign(sequence_number, std::move(message));
+                        current_receives[subgroup_num].erase(it);
                     }
-                }
 
-                // deliver immediately if in raw mode
-                if(curr_subgroup_settings.mode == Mode::UNORDERED) {
-                    // issue stability upcalls for the recently sequenced messages
-                    for(int i = sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank] + 1;
-                        i <= new_num_received; ++i) {
-                        message_id_t seq_num = i * num_shard_senders + sender_rank;
-                        if(!locally_stable_sst_messages[subgroup_num].empty()
-                           && locally_stable_sst_messages[subgroup_num].begin()->first == seq_num) {
-                            auto& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
-                            char* buf = const_cast<char*>(msg.buf);
-                            header* h = (header*)(buf);
-                            // no delivery callback for a NULL message
-                            if(msg.size > h->header_size && callbacks.global_stability_callback) {
-                                callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                    msg.index, buf + h->header_size,
-                                                                    msg.size - h->header_size);
-                            }
-                            if(node_id == members[member_index]) {
-                                pending_message_timestamps[subgroup_num].erase(h->timestamp);
+                    auto new_num_received = resolve_num_received(index, curr_subgroup_settings.num_received_offset + sender_rank);
+                    /* NULL Send Scheme */
+                    // only if I am a sender in the subgroup and the subgroup is totally ordered
+                    if(curr_subgroup_settings.sender_rank >= 0 && curr_subgroup_settings.mode == Mode::ORDERED) {
+                        if(curr_subgroup_settings.sender_rank < (int)sender_rank) {
+                            if(future_message_indices[subgroup_num] <= new_num_received) {
+                                get_buffer_and_send_auto_null(subgroup_num, new_num_received + 1 - future_message_indices[subgroup_num]);
                             }
-                            locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
-                        } else {
-                            assert(!locally_stable_rdmc_messages[subgroup_num].empty());
-                            auto it2 = locally_stable_rdmc_messages[subgroup_num].begin();
-                            assert(it2->first == seq_num);
-                            auto& msg = it2->second;
-                            char* buf = msg.message_buffer.buffer.get();
-                            header* h = (header*)(buf);
-                            if(msg.size > h->header_size && callbacks.global_stability_callback) {
-                                callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                    msg.index, buf + h->header_size,
-                                                                    msg.size - h->header_size);
+                        } else if(curr_subgroup_settings.sender_rank > (int)sender_rank) {
+                            if(future_message_indices[subgroup_num] < new_num_received) {
+                                get_buffer_and_send_auto_null(subgroup_num, new_num_received - future_message_indices[subgroup_num]);
                             }
-                            free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
-                            if(node_id == members[member_index]) {
-                                pending_message_timestamps[subgroup_num].erase(h->timestamp);
+                        }
+                    }
+
+                    // deliver immediately if in raw mode
+                    if(curr_subgroup_settings.mode == Mode::UNORDERED) {
+                        // issue stability upcalls for the recently sequenced messages
+                        for(int i = sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank] + 1;
+                            i <= new_num_received; ++i) {
+                            message_id_t seq_num = i * num_shard_senders + sender_rank;
+                            if(!locally_stable_sst_messages[subgroup_num].empty()
+                               && locally_stable_sst_messages[subgroup_num].front_seq() == seq_num) {
+                                auto& msg = locally_stable_sst_messages[subgroup_num].front();
+                                // no delivery callback for a NULL message
+                                sst_stability_upcall(msg, subgroup_num);
+                                slot_pins->delivered(msg.num_received_entry, msg.sst_index);
+                                locally_stable_sst_messages[subgroup_num].pop_front();
+                            } else {
+                                assert(!locally_stable_rdmc_messages[subgroup_num].empty());
+                                assert(locally_stable_rdmc_messages[subgroup_num].front_seq() == seq_num);
+                                auto& msg = locally_stable_rdmc_messages[subgroup_num].front();
+                                char* buf = msg.message_buffer.buffer;
+                                header* h = (header*)(buf);
+                                if(msg.size > h->header_size && callbacks.global_stability_callback) {
+                                    callbacks.global_stability_callback(subgroup_num, msg.sender_id,
+                                                                        msg.index, buf + h->header_size,
+                                                                        msg.size - h->header_size);
+                                }
+                                buffer_pools[subgroup_num]->release(std::move(msg.message_buffer));
+                                locally_stable_rdmc_messages[subgroup_num].pop_front();
                             }
-                            locally_stable_rdmc_messages[subgroup_num].erase(it2);
                         }
                     }
-                }
-                if(new_num_received > sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank]) {
-                    sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank] = new_num_received;
-                    // std::atomic_signal_fence(std::memory_order_acq_rel);
-                    auto* min_ptr = std::min_element(&sst->num_received[member_index][curr_subgroup_settings.num_received_offset],
-                                                     &sst->num_received[member_index][curr_subgroup_settings.num_received_offset + num_shard_senders]);
-                    uint min_index = std::distance(&sst->num_received[member_index][curr_subgroup_settings.num_received_offset], min_ptr);
-                    auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
-                    if(static_cast<message_id_t>(new_seq_num) > sst->seq_num[member_index][subgroup_num]) {
-                        whenlog(logger->trace("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num););
-                        sst->seq_num[member_index][subgroup_num] = new_seq_num;
+                    if(new_num_received > sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank]) {
+                        sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank] = new_num_received;
                         // std::atomic_signal_fence(std::memory_order_acq_rel);
-                        // DERECHO_LOG(node_id, index, "received_message");
-                        // DERECHO_LOG(-1, -1, "stable_num_put_start");
-                        sst->put(shard_sst_indices,
-                                 (char*)std::addressof(sst->seq_num[0][subgroup_num]) - sst->getBaseAddress(),
-                                 sizeof(decltype(sst->seq_num)::value_type));
-                        // DERECHO_LOG(node_id, new_seq_num, "updated_seq_num");
-                        // DERECHO_LOG(-1, -1, "stable_num_put_end");
+                        if(curr_subgroup_settings.mode == Mode::SEQUENCED) {
+                            // The sequencer has to see the new count before it can order the message
+                            sst->put_range(shard_sst_indices, sst->num_received,
+                                           curr_subgroup_settings.num_received_offset + sender_rank, 1);
+                            if(advance_sequenced_seq_num(subgroup_num, curr_subgroup_settings, num_shard_senders)) {
+                                sst->put_range(shard_sst_indices, sst->seq_num, subgroup_num, 1);
+                            }
+                            return;
+                        }
+                        auto* min_ptr = std::min_element(&sst->num_received[member_index][curr_subgroup_settings.num_received_offset],
+                                                         &sst->num_received[member_index][curr_subgroup_settings.num_received_offset + num_shard_senders]);
+                        uint min_index = std::distance(&sst->num_received[member_index][curr_subgroup_settings.num_received_offset], min_ptr);
+                        auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
+                        if(static_cast<message_id_t>(new_seq_num) > sst->seq_num[member_index][subgroup_num]) {
+                            multicast_log(TRACE, "Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
+                            sst->seq_num[member_index][subgroup_num] = new_seq_num;
+                            // std::atomic_signal_fence(std::memory_order_acq_rel);
+                            // DERECHO_LOG(node_id, index, "received_message");
+                            // DERECHO_LOG(-1, -1, "stable_num_put_start");
+                            sst->put_range(shard_sst_indices, sst->seq_num, subgroup_num, 1);
+                            // DERECHO_LOG(node_id, new_seq_num, "updated_seq_num");
+                            // DERECHO_LOG(-1, -1, "stable_num_put_end");
+                        }
+                        // DERECHO_LOG(-1, -1, "num_received_put_start");
+                        sst->put_range(shard_sst_indices, sst->num_received,
+                                       curr_subgroup_settings.num_received_offset + sender_rank, 1);
+                        // DERECHO_LOG(-1, -1, "num_received_put_end");
                     }
-                    // DERECHO_LOG(-1, -1, "num_received_put_start");
-                    sst->put(shard_sst_indices,
-                             (char*)std::addressof(sst->num_received[0][curr_subgroup_settings.num_received_offset + sender_rank])
-                                     - sst->getBaseAddress(),
-                             sizeof(decltype(sst->num_received)::value_type));
-                    // DERECHO_LOG(-1, -1, "num_received_put_end");
-                }
-            };
-            // Capture rdmc_receive_handler by copy! The reference to it won't be valid after this constructor ends!
-            auto receive_handler_plus_notify =
-                    [this, rdmc_receive_handler](char* data, size_t size) {
-                        rdmc_receive_handler(data, size);
-                        // signal background writer thread
-                        sender_cv.notify_all();
+                };
+                // Capture rdmc_receive_handler by copy! The reference to it won't be valid after this constructor ends!
+                auto receive_handler_plus_notify =
+                        [this, subgroup_num, rdmc_receive_handler](char* data, size_t size) {
+                            rdmc_receive_handler(data, size);
+                            // signal background writer thread
+                            wake_sender_thread(subgroup_num);
+                        };
+
+                rdmc::progress_callback_t receive_progress_handler;
+                // A compressed message's prefix can't be read until all of it has arrived
+                if(callbacks.receive_progress_callback && curr_subgroup_settings.mode == Mode::UNORDERED
+                   && !curr_subgroup_settings.rdmc_compression) {
+                    receive_progress_handler = [this, subgroup_num, node_id](char* data, size_t received) {
+                        // The header is in the first block, so it has arrived
+                        const header* h = reinterpret_cast<const header*>(data);
+                        if(received > h->header_size) {
+                            callbacks.receive_progress_callback(subgroup_num, node_id, data + h->header_size,
+                                                                received - h->header_size);
+                        }
                     };
+                }
 
-            // Create a "rotated" vector of members in which the currently selected shard member (shard_rank) is first
-            std::vector<uint32_t> rotated_shard_members(shard_members.size());
-            for(uint k = 0; k < num_shard_members; ++k) {
-                rotated_shard_members[k] = shard_members[(shard_rank + k) % num_shard_members];
-            }
-
-            // don't create rdmc group if there's only one member in the shard
-            if(num_shard_members <= 1) {
-                continue;
-            }
+                // Create a "rotated" vector of members in which the currently selected shard member (shard_rank) is first
+                std::vector<uint32_t> rotated_shard_members(shard_members.size());
+                for(uint k = 0; k < num_shard_members; ++k) {
+                    rotated_shard_members[k] = shard_members[(shard_rank + k) % num_shard_members];
+                }
 
-            if(node_id == members[member_index]) {
-                //Create a group in which this node is the sender, and only self-receives happen
-                if(!rdmc::create_group(
-                           rdmc_group_num_offset, rotated_shard_members, block_size, rdmc_send_algorithm,
-                           [this](size_t length) -> rdmc::receive_destination {
-                               assert_always(false);
-                               return {nullptr, 0};
-                           },
-                           receive_handler_plus_notify,
-                           [](std::optional<uint32_t>) {})) {
-                    return false;
+                // don't create rdmc group if there's only one member in the shard
+                if(num_shard_members <= 1) {
+                    continue;
                 }
-                subgroup_to_rdmc_group[subgroup_num] = rdmc_group_num_offset;
-                rdmc_group_num_offset++;
-            } else {
-                if(!rdmc::create_group(
-                           rdmc_group_num_offset, rotated_shard_members, block_size, rdmc_send_algorithm,
-                           [this, subgroup_num, node_id, sender_rank, num_shard_senders](size_t length) {
-                               std::lock_guard<std::mutex> lock(msg_state_mtx);
-                               assert(!free_message_buffers[subgroup_num].empty());
-                               //Create a Message struct to receive the data into.
-                               RDMCMessage msg;
-                               msg.sender_id = node_id;
-                               msg.size = length;
-                               msg.message_buffer = std::move(free_message_buffers[subgroup_num].back());
-                               free_message_buffers[subgroup_num].pop_back();
-
-                               rdmc::receive_destination ret{msg.message_buffer.mr, 0};
-                               current_receives[{subgroup_num, node_id}] = std::move(msg);
-
-                               assert(ret.mr->buffer != nullptr);
-                               return ret;
-                           },
-                           rdmc_receive_handler, [](std::optional<uint32_t>) {})) {
-                    return false;
+
+                if(node_id == members[member_index]) {
+                    //Create a group in which this node is the sender, and only self-receives happen
+                    if(!rdmc::create_group(
+                               rdmc_group_num_offset, rotated_shard_members, curr_subgroup_settings.block_size,
+                               curr_subgroup_settings.rdmc_send_algorithm,
+                               [this](size_t length) -> rdmc::receive_destination {
+                                   assert_always(false);
+                                   return {nullptr, 0};
+                               },
+                               receive_handler_plus_notify,
+                               [](std::optional<uint32_t>) {}, curr_subgroup_settings.max_msg_size)) {
+                        return false;
+                    }
+                    subgroup_to_rdmc_group[subgroup_num].push_back(rdmc_group_num_offset);
+                    rdmc_group_numbers.push_back(rdmc_group_num_offset);
+                    rdmc_group_num_offset++;
+                } else {
+                    if(!rdmc::create_group(
+                               rdmc_group_num_offset, rotated_shard_members, curr_subgroup_settings.block_size,
+                               curr_subgroup_settings.rdmc_send_algorithm,
+                               [this, subgroup_num, node_id, lane, sender_rank, num_shard_senders,
+                                rdmc_compression = curr_subgroup_settings.rdmc_compression](size_t length) {
+                                   std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                                   //Create a Message struct to receive the data into.
+                                   RDMCMessage msg;
+                                   msg.sender_id = node_id;
+                                   msg.size = length;
+                                   rdmc::receive_destination app_destination{nullptr, 0};
+                                   // A compressed message is decompressed into a pooled buffer
+                                   if(callbacks.receive_allocator && !rdmc_compression) {
+                                       app_destination = callbacks.receive_allocator(subgroup_num, node_id, length);
+                                   }
+                                   if(app_destination.mr) {
+                                       assert(app_destination.mr->size >= app_destination.offset + length);
+                                       assert(app_destination.mr->cuda_device < 0);
+                                       msg.message_buffer = MessageBuffer(app_destination.mr->buffer + app_destination.offset,
+                                                                          app_destination.mr, app_destination.offset, length);
+                                       msg.message_buffer.pooled = false;
+                                   } else {
+                                       // The window keeps the senders from sending more than the pool holds
+                                       msg.message_buffer = buffer_pools[subgroup_num]->acquire(length);
+                                       if(!msg.message_buffer.buffer) {
+                                           throw derecho_exception("Subgroup " + std::to_string(subgroup_num)
+                                                                   + " received more RDMC messages than its window allows");
+                                       }
+                                   }
+
+                                   rdmc::receive_destination ret{msg.message_buffer.mr, msg.message_buffer.offset};
+                                   current_receives[subgroup_num][{node_id, lane}] = std::move(msg);
+
+                                   assert(ret.mr->buffer != nullptr);
+                                   return ret;
+                               },
+                               rdmc_receive_handler, [](std::optional<uint32_t>) {}, curr_subgroup_settings.max_msg_size,
+                               receive_progress_handler)) {
+                        return false;
+                    }
+                    rdmc_group_numbers.push_back(rdmc_group_num_offset);
+                    rdmc_group_num_offset++;
                 }
-                rdmc_group_num_offset++;
             }
         }
     }
     return true;
 }
 
+/** The number of full-size buffers a subgroup's pool holds: a window of
+ * messages for each member of the shard, as the old per-subgroup free lists
+ * had, and with compression, a compressed copy for each of this node's send
+ * lanes and one buffer to decompress a received message into. */
+static std::size_t buffers_for_subgroup(const SubgroupSettings& settings) {
+    std::size_t count = settings.window_size * settings.members.size();
+    if(settings.rdmc_compression) {
+        count += settings.max_outstanding_rdmc_sends + 1;
+    }
+    return count;
+}
+
+void MulticastGroup::reserve_message_buffers(const MulticastGroup* old_group) {
+    for(const auto& [subgroup_num, settings] : subgroup_settings) {
+        if(old_group && subgroup_num < old_group->buffer_pools.size() && old_group->buffer_pools[subgroup_num]
+           && old_group->buffer_pools[subgroup_num]->get_max_buffer_size() == settings.max_msg_size) {
+            buffer_pools[subgroup_num] = old_group->buffer_pools[subgroup_num];
+        } else {
+            buffer_pools[subgroup_num] = std::make_shared<MessageBufferPool>(
+                    min_message_buffer_size, settings.max_msg_size, getConfUInt64(CONF_DERECHO_MESSAGE_BUFFER_SLAB_SIZE));
+        }
+        buffer_pools[subgroup_num]->reserve(settings.max_msg_size, buffers_for_subgroup(settings));
+    }
+}
+
+uint64_t MulticastGroup::reserved_message_buffer_bytes(const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings) {
+    uint64_t total = 0;
+    for(const auto& [subgroup_num, settings] : subgroup_settings) {
+        // Creating a pool doesn't allocate anything
+        const MessageBufferPool pool(min_message_buffer_size, settings.max_msg_size,
+                                     getConfUInt64(CONF_DERECHO_MESSAGE_BUFFER_SLAB_SIZE));
+        total += pool.reserved_bytes(settings.max_msg_size, buffers_for_subgroup(settings));
+    }
+    return total;
+}
+
+void MulticastGroup::allocate_message_rings() {
+    for(const auto& p : subgroup_settings) {
+        current_sends[p.first].resize(p.second.max_outstanding_rdmc_sends);
+        // At most window_size messages per sender can be in flight at once
+        const std::size_t capacity = p.second.window_size * get_num_senders(p.second.senders);
+        locally_stable_rdmc_messages[p.first] = SequenceRing<RDMCMessage>(capacity);
+        locally_stable_sst_messages[p.first] = SequenceRing<SSTMessage>(capacity);
+        // Delivered messages wait for persistence for up to persistence_window
+        const std::size_t persistence_capacity = std::max(p.second.persistence_window, p.second.window_size)
+                                                 * get_num_senders(p.second.senders);
+        pending_persistence[p.first] = SequenceRing<uint64_t>(persistence_capacity);
+        pending_message_timestamps[p.first] = TimestampQueue(p.second.window_size);
+        if(latency_histograms) {
+            unpersisted_send_timestamps[p.first] = SequenceRing<uint64_t>(persistence_capacity);
+        }
+        non_persistent_messages[p.first] = SequenceRing<RDMCMessage>(capacity);
+        non_persistent_sst_messages[p.first] = SequenceRing<SSTMessage>(capacity);
+        if(ChangeStream::enabled() && (p.second.mode == Mode::ORDERED || p.second.mode == Mode::SEQUENCED)) {
+            change_rings[p.first] = ChangeStream::get().ring(p.first);
+        }
+        if(p.second.mode == Mode::SEQUENCED) {
+            // The subgroup's num_received entries, each widened to a window
+            const uint32_t num_shard_senders = get_num_senders(p.second.senders);
+            SequencerState& state = sequencer_states[p.first];
+            state.order_offset = p.second.sequence_order_offset;
+            state.order_length = num_shard_senders * p.second.window_size;
+            state.ordered_through.assign(num_shard_senders, -1);
+            state.received_through.assign(num_shard_senders, -1);
+        }
+    }
+}
+
+void MulticastGroup::compute_shard_rows() {
+    for(const auto& p : subgroup_settings) {
+        ShardRows& rows = shard_rows[p.first];
+        rows.members.clear();
+        rows.member_offsets.clear();
+        rows.senders.clear();
+        rows.sender_shard_ranks.clear();
+        rows.group_rows.clear();
+        rows.group_offsets.clear();
+        rows.leader_rows.clear();
+        rows.leader_offsets.clear();
+        for(uint32_t shard_rank = 0; shard_rank < p.second.members.size(); ++shard_rank) {
+            const uint32_t row = node_id_to_sst_index.at(p.second.members[shard_rank]);
+            rows.members.push_back(row);
+            rows.member_offsets.push_back(reinterpret_cast<volatile char*>(sst->seq_num[row])
+                                          - reinterpret_cast<volatile char*>(sst->seq_num[0]));
+            if(p.second.senders[shard_rank]) {
+                rows.senders.push_back(row);
+                rows.sender_shard_ranks.push_back(shard_rank);
+            }
+        }
+        if(!aggregated_stability) {
+            rows.stable_num_targets = rows.members;
+            continue;
+        }
+        const uint32_t my_shard_rank = p.second.shard_rank;
+        const uint32_t my_group_start = my_shard_rank - my_shard_rank % aggregation_fanout;
+        rows.stable_num_targets = {rows.members[my_group_start]};
+        for(uint32_t shard_rank = 0; shard_rank < rows.members.size(); ++shard_rank) {
+            if(my_shard_rank == my_group_start && shard_rank / aggregation_fanout == my_shard_rank / aggregation_fanout) {
+                rows.group_rows.push_back(rows.members[shard_rank]);
+                rows.group_offsets.push_back(rows.member_offsets[shard_rank]);
+            }
+            if(my_shard_rank == 0 && shard_rank % aggregation_fanout == 0) {
+                rows.leader_rows.push_back(rows.members[shard_rank]);
+                rows.leader_offsets.push_back(rows.member_offsets[shard_rank]);
+            }
+        }
+    }
+}
+
+void MulticastGroup::compute_send_gates() {
+    for(const auto& p : subgroup_settings) {
+        SendGate& gate = send_gates[p.first];
+        gate.shard_sst_indices = shard_rows[p.first].members;
+        gate.num_shard_senders = get_num_senders(p.second.senders);
+        gate.shard_sender_index = p.second.sender_rank;
+        gate.num_received_offset = p.second.num_received_offset;
+        gate.mode = p.second.mode;
+        gate.window_size = p.second.window_size;
+        gate.max_outstanding_rdmc_sends = p.second.max_outstanding_rdmc_sends;
+        gate.persistence_window = std::max(p.second.persistence_window, p.second.window_size);
+        gate.persistence_stall_start = 0;
+        gate.aggregation_size = std::min<uint64_t>(rpc_aggregation_size, p.second.max_msg_size - sizeof(header));
+        // A new view may have new links, so adaptation starts over
+        gate.effective_window = p.second.window_size;
+        gate.send_priority = p.second.send_priority;
+        // A new view starts the token over at sender rank 0
+        gate.send_token = p.second.rdmc_send_token && p.second.sender_rank >= 0 && gate.num_shard_senders > 1;
+        gate.sender_sst_indices = shard_rows[p.first].senders;
+        gate.held_token = 0;
+        gate.token_turn_sends = 0;
+        gate.higher_priority_subgroups.clear();
+        for(const auto& other : subgroup_settings) {
+            if(other.second.sender_rank >= 0 && other.second.send_priority > p.second.send_priority) {
+                gate.higher_priority_subgroups.push_back(other.first);
+            }
+        }
+    }
+}
+
+void MulticastGroup::record_window_send(SendGate& gate) {
+    if(gate.stall_start) {
+        const uint64_t stall_ns = get_time() - gate.stall_start;
+        gate.stall_start = 0;
+        gate.epoch_stalls++;
+        gate.epoch_stall_ns += stall_ns;
+        if(gate.epoch_min_stall_ns == 0 || stall_ns < gate.epoch_min_stall_ns) {
+            gate.epoch_min_stall_ns = stall_ns;
+        }
+    }
+    if(++gate.epoch_sends < gate.effective_window) {
+        return;
+    }
+    if(gate.epoch_stalls * 8 >= gate.epoch_sends) {
+        if(gate.epoch_stall_ns < 4 * gate.epoch_min_stall_ns * gate.epoch_stalls) {
+            gate.effective_window = std::min(2 * gate.effective_window, gate.window_size);
+        } else {
+            gate.effective_window = std::max(gate.effective_window - gate.effective_window / 4, 1u);
+        }
+    }
+    gate.epoch_sends = 0;
+    gate.epoch_stalls = 0;
+    gate.epoch_stall_ns = 0;
+    gate.epoch_min_stall_ns = 0;
+}
+
+void MulticastGroup::start_sender_threads() {
+    for(uint32_t thread_index = 0; thread_index < num_sender_threads; ++thread_index) {
+        sender_threads.emplace_back(&MulticastGroup::send_loop, this, thread_index);
+    }
+}
+
 void MulticastGroup::initialize_sst_row() {
     auto num_received_size = sst->num_received.size();
     auto seq_num_size = sst->seq_num.size();
     for(uint i = 0; i < num_members; ++i) {
         for(uint j = 0; j < num_received_size; ++j) {
             sst->num_received[i][j] = -1;
+            sst->null_skip_index[i][j] = -1;
+            sst->delivered_index[i][j] = -1;
         }
         for(uint j = 0; j < seq_num_size; ++j) {
             sst->seq_num[i][j] = -1;
             sst->stable_num[i][j] = -1;
+            sst->group_stable_num[i][j] = -1;
+            sst->shard_stable_num[i][j] = -1;
             sst->delivered_num[i][j] = -1;
+            sst->sequenced_num[i][j] = -1;
             sst->persisted_num[i][j] = -1;
+            sst->send_token[i][j] = 0;
+            sst->send_token_wanted[i][j] = false;
         }
     }
-    sst->put();
+    // Only these fields changed; the ViewManager pushes the rest of the row
+    sst->num_received.mark_dirty(0, num_received_size);
+    sst->null_skip_index.mark_dirty(0, num_received_size);
+    sst->delivered_index.mark_dirty(0, num_received_size);
+    sst->seq_num.mark_dirty(0, seq_num_size);
+    sst->stable_num.mark_dirty(0, seq_num_size);
+    sst->group_stable_num.mark_dirty(0, seq_num_size);
+    sst->shard_stable_num.mark_dirty(0, seq_num_size);
+    sst->delivered_num.mark_dirty(0, seq_num_size);
+    sst->sequenced_num.mark_dirty(0, seq_num_size);
+    sst->persisted_num.mark_dirty(0, seq_num_size);
+    sst->send_token.mark_dirty(0, seq_num_size);
+    sst->send_token_wanted.mark_dirty(0, seq_num_size);
+    sst->flush_dirty(sst->num_received, sst->null_skip_index, sst->delivered_index,
+                     sst->seq_num, sst->stable_num, sst->group_stable_num, sst->shard_stable_num,
+                     sst->delivered_num, sst->sequenced_num, sst->persisted_num,
+                     sst->send_token, sst->send_token_wanted);
     sst->sync_with_members();
 }
 
 void MulticastGroup::deliver_message(RDMCMessage& msg, subgroup_id_t subgroup_num) {
     if(msg.size > 0) {
-        char* buf = msg.message_buffer.buffer.get();
+        char* buf = msg.message_buffer.buffer;
         header* h = (header*)(buf);
         // cooked send
         if(h->cooked_send) {
             buf += h->header_size;
             auto payload_size = msg.size - h->header_size;
-            rpc_callback(subgroup_num, msg.sender_id, buf, payload_size);
+            deliver_rpc_payload(subgroup_num, msg.sender_id, h->aggregated, buf, payload_size);
         }
         // raw send
         else {
@@ -476,12 +929,12 @@ void MulticastGroup::deliver_message(RDMCMessage& msg, subgroup_id_t subgroup_nu
                                                     buf + h->header_size, msg.size - h->header_size);
             }
         }
-        free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
+        buffer_pools[subgroup_num]->release(std::move(msg.message_buffer));
     }
 }
 
 void MulticastGroup::deliver_message(SSTMessage& msg, subgroup_id_t subgroup_num) {
-    // DERECHO_LOG(-1, -1, "deliver_message()");
+    DERECHO_LOG(subgroup_num, msg.index, "deliver_message");
     if(msg.size > 0) {
         char* buf = const_cast<char*>(msg.buf);
         header* h = (header*)(buf);
@@ -489,38 +942,117 @@ void MulticastGroup::deliver_message(SSTMessage& msg, subgroup_id_t subgroup_num
         if(h->cooked_send) {
             buf += h->header_size;
             auto payload_size = msg.size - h->header_size;
-            rpc_callback(subgroup_num, msg.sender_id, buf, payload_size);
+            deliver_rpc_payload(subgroup_num, msg.sender_id, h->aggregated, buf, payload_size);
         }
         // raw send
         else {
             // DERECHO_LOG(-1, -1, "start_stability_callback");
-            if(msg.size > h->header_size && callbacks.global_stability_callback) {
-                callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
-                                                    buf + h->header_size, msg.size - h->header_size);
-            }
+            sst_stability_upcall(msg, subgroup_num);
             // DERECHO_LOG(-1, -1, "end_stability_callback");
         }
     }
 }
 
-void MulticastGroup::version_message(RDMCMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
-    if(msg.sender_id == members[member_index]) {
-        pending_persistence[subgroup_num][locally_stable_rdmc_messages[subgroup_num].begin()->first] = msg_timestamp;
+void MulticastGroup::deliver_rpc_payload(subgroup_id_t subgroup_num, node_id_t sender_id, bool aggregated,
+                                         char* payload, uint64_t payload_size) {
+    if(!aggregated) {
+        rpc_callback(subgroup_num, sender_id, payload, payload_size);
+        return;
     }
-    // make a version for persistent<t>/volatile<t>
-    uint64_t msg_ts_us = msg_timestamp / 1e3;
-    if(msg_ts_us == 0) {
-        struct timespec now;
-        clock_gettime(CLOCK_REALTIME, &now);
-        msg_ts_us = (uint64_t)now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+    // The packed sends are handed to the RPC layer in the order they were sent
+    uint64_t offset = 0;
+    while(offset + sizeof(uint32_t) <= payload_size) {
+        const uint32_t send_size = *(uint32_t*)(payload + offset);
+        offset += sizeof(uint32_t);
+        assert(offset + send_size <= payload_size);
+        rpc_callback(subgroup_num, sender_id, payload + offset, send_size);
+        offset += send_size;
     }
-    std::get<0>(persistence_manager_callbacks)(subgroup_num,
-                                               persistent::combine_int32s(sst->vid[member_index], seq_num), HLC{msg_ts_us, 0});
+}
+
+void MulticastGroup::sst_stability_upcall(SSTMessage& msg, subgroup_id_t subgroup_num) {
+    char* buf = const_cast<char*>(msg.buf);
+    header* h = (header*)(buf);
+    if(msg.size <= h->header_size) {
+        return;
+    }
+    if(callbacks.global_stability_view_callback) {
+        callbacks.global_stability_view_callback(subgroup_num, msg.sender_id, msg.index,
+                                                 SSTMessageView(slot_pins, msg.num_received_entry, msg.sst_index,
+                                                                buf + h->header_size, msg.size - h->header_size));
+    } else if(callbacks.global_stability_callback) {
+        callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
+                                            buf + h->header_size, msg.size - h->header_size);
+    }
+}
+
+bool MulticastGroup::delivers_in_batch(const char* buf) const {
+    return callbacks.global_stability_batch_callback && !((const header*)buf)->cooked_send;
+}
+
+void MulticastGroup::add_to_batch(RDMCMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
+    char* buf = msg.message_buffer.buffer;
+    header* h = (header*)(buf);
+    if(msg.size > h->header_size) {
+        delivery_batches[subgroup_num].push_back({msg.sender_id, msg.index, buf + h->header_size,
+                                                  static_cast<long long int>(msg.size - h->header_size)});
+    }
+    batched_messages[subgroup_num].push_back({seq_num, msg_timestamp, msg.sender_id, false,
+                                              std::move(msg.message_buffer), 0, -1});
+}
+
+void MulticastGroup::add_to_batch(SSTMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
+    char* buf = const_cast<char*>(msg.buf);
+    if(msg.size > 0) {
+        header* h = (header*)(buf);
+        if(msg.size > h->header_size) {
+            delivery_batches[subgroup_num].push_back({msg.sender_id, msg.index, buf + h->header_size,
+                                                      static_cast<long long int>(msg.size - h->header_size)});
+        }
+    }
+    batched_messages[subgroup_num].push_back({seq_num, msg_timestamp, msg.sender_id, msg.size == 0,
+                                              MessageBuffer(), msg.num_received_entry, msg.sst_index});
+}
+
+void MulticastGroup::deliver_batch(subgroup_id_t subgroup_num) {
+    if(batched_messages[subgroup_num].empty()) {
+        return;
+    }
+    if(!delivery_batches[subgroup_num].empty()) {
+        callbacks.global_stability_batch_callback(subgroup_num, delivery_batches[subgroup_num]);
+    }
+    for(auto& batched : batched_messages[subgroup_num]) {
+        if(!batched.null_message) {
+            version_message(batched.sender_id, subgroup_num, batched.seq_num, batched.timestamp);
+        }
+        if(batched.sst_index >= 0) {
+            slot_pins->delivered(batched.num_received_entry, batched.sst_index);
+        } else {
+            buffer_pools[subgroup_num]->release(std::move(batched.rdmc_buffer));
+        }
+    }
+    multicast_log(TRACE, "Subgroup {}, delivered a batch of {} messages", subgroup_num, batched_messages[subgroup_num].size());
+    batched_messages[subgroup_num].clear();
+    delivery_batches[subgroup_num].clear();
+}
+
+void MulticastGroup::version_message(RDMCMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
+    version_message(msg.sender_id, subgroup_num, seq_num, msg_timestamp);
 }
 
 void MulticastGroup::version_message(SSTMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
-    if(msg.sender_id == members[member_index]) {
-        pending_persistence[subgroup_num][locally_stable_sst_messages[subgroup_num].begin()->first] = msg_timestamp;
+    version_message(msg.sender_id, subgroup_num, seq_num, msg_timestamp);
+}
+
+void MulticastGroup::version_message(node_id_t sender_id, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp) {
+    subgroup_metrics[subgroup_num].messages_delivered->add();
+    count_own_delivery(subgroup_num, sender_id);
+    if(sender_id == members[member_index]) {
+        pending_persistence[subgroup_num].insert_or_assign(seq_num, msg_timestamp);
+    }
+    if(latency_histograms) {
+        record_latency(subgroup_num, LatencyStage::DELIVERED, msg_timestamp);
+        unpersisted_send_timestamps[subgroup_num].insert_or_assign(seq_num, msg_timestamp);
     }
     // make a version for persistent<t>/volatile<t>
     uint64_t msg_ts_us = msg_timestamp / 1e3;
@@ -533,13 +1065,96 @@ void MulticastGroup::version_message(SSTMessage& msg, subgroup_id_t subgroup_num
                                                persistent::combine_int32s(sst->vid[member_index], seq_num), HLC{msg_ts_us, 0});
 }
 
+void MulticastGroup::tap_change(subgroup_id_t subgroup_num, node_id_t sender_id, message_id_t seq_num,
+                                const char* buf, uint64_t size) {
+    ChangeRing* ring = change_rings[subgroup_num];
+    if(!ring || size == 0) {
+        return;
+    }
+    const header* h = (const header*)buf;
+    ring->append({0, persistent::combine_int32s(sst->vid[member_index], seq_num),
+                  h->timestamp / 1000, sender_id, subgroup_num},
+                 buf + h->header_size, size - h->header_size);
+}
+
+void MulticastGroup::count_own_delivery(subgroup_id_t subgroup_num, node_id_t sender_id) {
+    if(sender_id != members[member_index]) {
+        return;
+    }
+    OwnDeliveryProgress& progress = (*own_delivery_progress)[subgroup_num];
+    progress.delivered++;
+    // A waiter increments waiters before it checks delivered, so one of
+    // the two sees the other's increment
+    if(progress.waiters > 0) {
+        std::lock_guard<std::mutex> lock(progress.mutex);
+        progress.delivered_cv.notify_all();
+    }
+}
+
+void OwnDeliveryProgress::wait_for(uint64_t ticket) {
+    if(delivered >= ticket) {
+        return;
+    }
+    waiters++;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        delivered_cv.wait(lock, [&]() { return delivered >= ticket; });
+    }
+    waiters--;
+}
+
+uint64_t MulticastGroup::get_send_ticket(subgroup_id_t subgroup_num) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    // A packed message that is still open is sent later, as one message
+    return (*own_delivery_progress)[subgroup_num].sent + (rpc_aggregates[subgroup_num].payload ? 1 : 0);
+}
+
 void MulticastGroup::deliver_messages_upto(
         const std::vector<int32_t>& max_indices_for_senders,
         subgroup_id_t subgroup_num, uint32_t num_shard_senders) {
     bool msgs_delivered = false;
     // DERECHO_LOG(-1, -1, "deliver_messages_upto");
     assert(max_indices_for_senders.size() == (size_t)num_shard_senders);
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    if(subgroup_settings.at(subgroup_num).mode == Mode::FIFO) {
+        const uint32_t num_received_offset = subgroup_settings.at(subgroup_num).num_received_offset;
+        for(uint sender = 0; sender < num_shard_senders; sender++) {
+            volatile int32_t& delivered_index = sst->delivered_index[member_index][num_received_offset + sender];
+            for(int32_t index = delivered_index + 1; index <= max_indices_for_senders[sender]; ++index) {
+                deliver_fifo_message(subgroup_num, index * num_shard_senders + sender);
+            }
+            if(max_indices_for_senders[sender] > delivered_index) {
+                delivered_index = max_indices_for_senders[sender];
+            }
+        }
+        publish_fifo_delivery(subgroup_num, num_received_offset, num_shard_senders);
+        return;
+    }
+    if(subgroup_settings.at(subgroup_num).mode == Mode::SEQUENCED) {
+        const SubgroupSettings& curr_subgroup_settings = subgroup_settings.at(subgroup_num);
+        const SequencerState& state = sequencer_states[subgroup_num];
+        const uint32_t sequencer_row = shard_rows[subgroup_num].members[0];
+        const message_id_t sequenced_num = sst->sequenced_num[sequencer_row][subgroup_num];
+        // The trim ends on a prefix of the order, so follow the order until
+        // its next message is beyond the trim
+        for(message_id_t seq_num = sst->delivered_num[member_index][subgroup_num] + 1; seq_num <= sequenced_num; ++seq_num) {
+            const uint32_t sender_rank = sst->sequence_order[sequencer_row][state.order_offset + seq_num % state.order_length];
+            if(sst->delivered_index[member_index][curr_subgroup_settings.num_received_offset + sender_rank]
+               >= max_indices_for_senders[sender_rank]) {
+                break;
+            }
+            msgs_delivered |= deliver_sequenced_message(subgroup_num, curr_subgroup_settings, num_shard_senders, seq_num);
+        }
+        deliver_batch(subgroup_num);
+        sst->put_range(get_shard_sst_indices(subgroup_num), sst->delivered_index,
+                       curr_subgroup_settings.num_received_offset, num_shard_senders);
+        sst->put_range(get_shard_sst_indices(subgroup_num), sst->delivered_num, subgroup_num, 1);
+        sst->notify(get_shard_sst_indices(subgroup_num));
+        if(msgs_delivered) {
+            post_persistence_request(subgroup_num, persistent::combine_int32s(sst->vid[member_index], sst->delivered_num[member_index][subgroup_num]));
+        }
+        return;
+    }
     int32_t curr_seq_num = sst->delivered_num[member_index][subgroup_num];
     int32_t max_seq_num = curr_seq_num;
     for(uint sender = 0; sender < num_shard_senders; sender++) {
@@ -554,36 +1169,49 @@ void MulticastGroup::deliver_messages_upto(
         if(index > max_indices_for_senders[sender_rank]) {
             continue;
         }
-        auto rdmc_msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(seq_num);
-        if(rdmc_msg_ptr != locally_stable_rdmc_messages[subgroup_num].end()) {
-            auto& msg = rdmc_msg_ptr->second;
-            char* buf = msg.message_buffer.buffer.get();
+        // A sender that skipped this index left no message in either ring
+        RDMCMessage* rdmc_msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(seq_num);
+        if(rdmc_msg_ptr) {
+            auto& msg = *rdmc_msg_ptr;
+            char* buf = msg.message_buffer.buffer;
             uint64_t msg_ts = ((header*)buf)->timestamp;
             msgs_delivered = true;
-            //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
-            deliver_message(msg, subgroup_num);
-            version_message(msg, subgroup_num, seq_num, msg_ts);
+            tap_change(subgroup_num, msg.sender_id, seq_num, buf, msg.size);
+            if(delivers_in_batch(buf)) {
+                add_to_batch(msg, subgroup_num, seq_num, msg_ts);
+            } else {
+                deliver_batch(subgroup_num);
+                //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
+                deliver_message(msg, subgroup_num);
+                version_message(msg, subgroup_num, seq_num, msg_ts);
+            }
             // DERECHO_LOG(-1, -1, "erase_message");
-            locally_stable_rdmc_messages[subgroup_num].erase(rdmc_msg_ptr);
+            locally_stable_rdmc_messages[subgroup_num].erase(seq_num);
             // DERECHO_LOG(-1, -1, "erase_message_done");
-        } else {
+        } else if(SSTMessage* sst_msg_ptr = locally_stable_sst_messages[subgroup_num].find(seq_num)) {
             msgs_delivered = true;
-            auto& msg = locally_stable_sst_messages[subgroup_num].at(seq_num);
+            auto& msg = *sst_msg_ptr;
             char* buf = (char*)msg.buf;
             uint64_t msg_ts = ((header*)buf)->timestamp;
-            deliver_message(msg, subgroup_num);
-            version_message(msg, subgroup_num, seq_num, msg_ts);
+            tap_change(subgroup_num, msg.sender_id, seq_num, buf, msg.size);
+            if(delivers_in_batch(buf)) {
+                add_to_batch(msg, subgroup_num, seq_num, msg_ts);
+            } else {
+                deliver_batch(subgroup_num);
+                deliver_message(msg, subgroup_num);
+                version_message(msg, subgroup_num, seq_num, msg_ts);
+                slot_pins->delivered(msg.num_received_entry, msg.sst_index);
+            }
             locally_stable_sst_messages[subgroup_num].erase(seq_num);
         }
     }
+    deliver_batch(subgroup_num);
     gmssst::set(sst->delivered_num[member_index][subgroup_num], max_seq_num);
-    sst->put(get_shard_sst_indices(subgroup_num),
-             (char*)std::addressof(sst->delivered_num[0][subgroup_num]) - sst->getBaseAddress(),
-             sizeof(decltype(sst->delivered_num)::value_type));
-    if(subgroup_settings.at(subgroup_num).mode != Mode::UNORDERED && msgs_delivered) {
+    sst->put_range(get_shard_sst_indices(subgroup_num), sst->delivered_num, subgroup_num, 1);
+    sst->notify(get_shard_sst_indices(subgroup_num));
+    if(subgroup_settings.at(subgroup_num).mode == Mode::ORDERED && msgs_delivered) {
         //Call the persistence_manager_post_persist_func
-        std::get<1>(persistence_manager_callbacks)(subgroup_num,
-                                                   persistent::combine_int32s(sst->vid[member_index], sst->delivered_num[member_index][subgroup_num]));
+        post_persistence_request(subgroup_num, persistent::combine_int32s(sst->vid[member_index], sst->delivered_num[member_index][subgroup_num]));
     }
 }
 
@@ -621,14 +1249,51 @@ int32_t MulticastGroup::resolve_num_received(int32_t index, uint32_t num_receive
     return *std::next(received_intervals[num_received_entry].begin());
 }
 
+int32_t MulticastGroup::resolve_skipped_indices(int32_t next_index, uint32_t num_received_entry) {
+    auto& intervals = received_intervals[num_received_entry];
+    // The sender only skips once every message it sent before has been
+    // received, so the skipped indices directly follow the first interval.
+    // Messages with later indices may already have arrived, though.
+    auto first_end = std::next(intervals.begin());
+    if(*first_end < next_index - 1) {
+        *first_end = next_index - 1;
+        auto next_start = std::next(first_end);
+        if(next_start != intervals.end() && *next_start == next_index) {
+            intervals.erase(next_start);
+            intervals.erase(first_end);
+        }
+    }
+    return *std::next(intervals.begin());
+}
+
+void MulticastGroup::apply_null_skips(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                      uint32_t num_shard_senders, DerechoSST& sst) {
+    const ShardRows& rows = shard_rows[subgroup_num];
+    for(uint sender_count = 0; sender_count < num_shard_senders; ++sender_count) {
+        const uint32_t num_received_entry = curr_subgroup_settings.num_received_offset + sender_count;
+        const int32_t next_index = sst.null_skip_index[rows.senders[sender_count]][num_received_entry];
+        if(next_index - 1 <= sst.num_received[member_index][num_received_entry]) {
+            continue;
+        }
+        multicast_log(TRACE, "Subgroup {}: sender rank {} skipped ahead to index {}", subgroup_num, sender_count, next_index);
+        sst.num_received[member_index][num_received_entry] = resolve_skipped_indices(next_index, num_received_entry);
+    }
+}
+
 bool MulticastGroup::receiver_predicate(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                                        const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                                         uint32_t num_shard_senders, const DerechoSST& sst) {
+    const ShardRows& rows = shard_rows[subgroup_num];
     for(uint sender_count = 0; sender_count < num_shard_senders; ++sender_count) {
+        if(sst.null_skip_index[rows.senders[sender_count]][curr_subgroup_settings.num_received_offset + sender_count] - 1
+           > sst.num_received[member_index][curr_subgroup_settings.num_received_offset + sender_count]) {
+            return true;
+        }
         int32_t num_received = sst.num_received_sst[member_index][curr_subgroup_settings.num_received_offset + sender_count] + 1;
+        const unsigned int window_size = curr_subgroup_settings.window_size;
         uint32_t slot = num_received % window_size;
-        if(static_cast<long long int>((uint64_t&)sst.slots[node_id_to_sst_index.at(curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_count)])]
-                                                          [(sst_max_msg_size + 2 * sizeof(uint64_t)) * (subgroup_num * window_size + slot + 1) - sizeof(uint64_t)])
+        const uint64_t slot_size = curr_subgroup_settings.sst_max_msg_size + 2 * sizeof(uint64_t);
+        if(static_cast<long long int>((uint64_t&)sst.slots[rows.senders[sender_count]]
+                                                          [curr_subgroup_settings.slots_offset + slot_size * (slot + 1) - sizeof(uint64_t)])
            == num_received / window_size + 1) {
             return true;
         }
@@ -637,74 +1302,84 @@ bool MulticastGroup::receiver_predicate(subgroup_id_t subgroup_num, const Subgro
 }
 
 void MulticastGroup::sst_receive_handler(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                                         const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                                          uint32_t num_shard_senders, uint32_t sender_rank,
                                          volatile char* data, uint64_t size) {
     header* h = (header*)data;
     const int32_t index = h->index;
 
     message_id_t sequence_number = index * num_shard_senders + sender_rank;
-    whenlog(logger->trace("Locally received message in subgroup {}, sender rank {}, index {}. Header fields: header_size={}, index={}, timestamp={}", subgroup_num, sender_rank, index, h->header_size, h->index, h->timestamp););
+    multicast_log(TRACE, "Locally received message in subgroup {}, sender rank {}, index {}. Header fields: header_size={}, index={}, timestamp={}", subgroup_num, sender_rank, index, h->header_size, h->index, h->timestamp);
 
-    node_id_t node_id = curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_rank)];
+    node_id_t node_id = curr_subgroup_settings.members[shard_rows[subgroup_num].sender_shard_ranks[sender_rank]];
 
-    // DERECHO_LOG(node_id, index, "received_message");
-    locally_stable_sst_messages[subgroup_num][sequence_number] = {node_id, index, size, data};
+    DERECHO_LOG(node_id, index, "received_message");
+    if(size > 0) {
+        record_latency(subgroup_num, LatencyStage::RECEIVED, h->timestamp);
+    }
+    const uint32_t num_received_entry = curr_subgroup_settings.num_received_offset + sender_rank;
+    // receiver_function only advances num_received_sst after this returns
+    const int32_t sst_index = sst->num_received_sst[member_index][num_received_entry] + 1;
+    // An unordered subgroup delivers a message once every earlier one from its
+    // sender has been, which is usually on receipt, and then it isn't queued
+    const bool deliver_on_receipt = curr_subgroup_settings.mode == Mode::UNORDERED
+                                    && index == sst->num_received[member_index][num_received_entry] + 1;
+    if(!deliver_on_receipt) {
+        locally_stable_sst_messages[subgroup_num].insert_or_assign(sequence_number,
+                                                                   {node_id, index, size, data,
+                                                                    num_received_entry, sst_index});
+    }
 
     auto new_num_received = resolve_num_received(index, curr_subgroup_settings.num_received_offset + sender_rank);
     /* NULL Send Scheme */
-    // only if I am a sender in the subgroup and the subgroup is not in UNORDERED mode
-    if(curr_subgroup_settings.sender_rank >= 0 && curr_subgroup_settings.mode != Mode::UNORDERED) {
+    // only if I am a sender in the subgroup and the subgroup is totally ordered
+    if(curr_subgroup_settings.sender_rank >= 0 && curr_subgroup_settings.mode == Mode::ORDERED) {
         if(curr_subgroup_settings.sender_rank < (int)sender_rank) {
-            while(future_message_indices[subgroup_num] <= new_num_received) {
-                get_buffer_and_send_auto_null(subgroup_num);
+            if(future_message_indices[subgroup_num] <= new_num_received) {
+                get_buffer_and_send_auto_null(subgroup_num, new_num_received + 1 - future_message_indices[subgroup_num]);
             }
         } else if(curr_subgroup_settings.sender_rank > (int)sender_rank) {
-            while(future_message_indices[subgroup_num] < new_num_received) {
-                get_buffer_and_send_auto_null(subgroup_num);
+            if(future_message_indices[subgroup_num] < new_num_received) {
+                get_buffer_and_send_auto_null(subgroup_num, new_num_received - future_message_indices[subgroup_num]);
             }
         }
     }
 
     if(curr_subgroup_settings.mode == Mode::UNORDERED) {
-        // issue stability upcalls for the recently sequenced messages
-        for(int i = sst->num_received[member_index][curr_subgroup_settings.num_received_offset + sender_rank] + 1; i <= new_num_received; ++i) {
+        int32_t next_undelivered = sst->num_received[member_index][num_received_entry] + 1;
+        if(deliver_on_receipt) {
+            SSTMessage msg{node_id, index, size, data, num_received_entry, sst_index};
+            if(size > 0) {
+                sst_stability_upcall(msg, subgroup_num);
+            }
+            slot_pins->delivered(num_received_entry, sst_index);
+            next_undelivered++;
+        }
+        // issue stability upcalls for the messages it completes the sequence for
+        for(int i = next_undelivered; i <= new_num_received; ++i) {
             message_id_t seq_num = i * num_shard_senders + sender_rank;
             if(!locally_stable_sst_messages[subgroup_num].empty()
-               && locally_stable_sst_messages[subgroup_num].begin()->first == seq_num) {
-                auto& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
+               && locally_stable_sst_messages[subgroup_num].front_seq() == seq_num) {
+                auto& msg = locally_stable_sst_messages[subgroup_num].front();
                 if(msg.size > 0) {
-                    char* buf = const_cast<char*>(msg.buf);
-                    header* h = (header*)(buf);
-                    if(msg.size > h->header_size && callbacks.global_stability_callback) {
-                        callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                            msg.index, buf + h->header_size,
-                                                            msg.size - h->header_size);
-                    }
-                    if(node_id == members[member_index]) {
-                        pending_message_timestamps[subgroup_num].erase(h->timestamp);
-                    }
+                    sst_stability_upcall(msg, subgroup_num);
                 }
-                locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
+                slot_pins->delivered(msg.num_received_entry, msg.sst_index);
+                locally_stable_sst_messages[subgroup_num].pop_front();
             } else {
                 assert(!locally_stable_rdmc_messages[subgroup_num].empty());
-                auto it2 = locally_stable_rdmc_messages[subgroup_num].begin();
-                assert(it2->first == seq_num);
-                auto& msg = it2->second;
+                assert(locally_stable_rdmc_messages[subgroup_num].front_seq() == seq_num);
+                auto& msg = locally_stable_rdmc_messages[subgroup_num].front();
                 if(msg.size > 0) {
-                    char* buf = msg.message_buffer.buffer.get();
+                    char* buf = msg.message_buffer.buffer;
                     header* h = (header*)(buf);
                     if(msg.size > h->header_size && callbacks.global_stability_callback) {
                         callbacks.global_stability_callback(subgroup_num, msg.sender_id,
                                                             msg.index, buf + h->header_size,
                                                             msg.size - h->header_size);
                     }
-                    free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
-                    if(node_id == members[member_index]) {
-                        pending_message_timestamps[subgroup_num].erase(h->timestamp);
-                    }
+                    buffer_pools[subgroup_num]->release(std::move(msg.message_buffer));
                 }
-                locally_stable_rdmc_messages[subgroup_num].erase(it2);
+                locally_stable_rdmc_messages[subgroup_num].pop_front();
             }
         }
     }
@@ -712,55 +1387,109 @@ void MulticastGroup::sst_receive_handler(subgroup_id_t subgroup_num, const Subgr
 }
 
 void MulticastGroup::receiver_function(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                                       const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                                        uint32_t num_shard_senders, DerechoSST& sst, unsigned int batch_size,
                                        const std::function<void(uint32_t, volatile char*, uint32_t)>& sst_receive_handler_lambda) {
+    const ShardRows& rows = shard_rows[subgroup_num];
     // DERECHO_LOG(receiver_cnt, -1, "in receiver_trig");
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    const unsigned int window_size = curr_subgroup_settings.window_size;
+    const uint64_t slot_size = curr_subgroup_settings.sst_max_msg_size + 2 * sizeof(uint64_t);
     for(uint i = 0; i < batch_size; ++i) {
         for(uint sender_count = 0; sender_count < num_shard_senders; ++sender_count) {
             auto num_received = sst.num_received_sst[member_index][curr_subgroup_settings.num_received_offset + sender_count] + 1;
             uint32_t slot = num_received % window_size;
-            message_id_t next_seq = (uint64_t&)sst.slots[node_id_to_sst_index.at(curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_count)])][(sst_max_msg_size + 2 * sizeof(uint64_t)) * (subgroup_num * window_size + slot + 1) - sizeof(uint64_t)];
+            volatile char* slot_start = &sst.slots[rows.senders[sender_count]][curr_subgroup_settings.slots_offset + slot_size * slot];
+            message_id_t next_seq = (uint64_t&)slot_start[slot_size - sizeof(uint64_t)];
             if(next_seq == num_received / static_cast<int32_t>(window_size) + 1) {
-                whenlog(logger->trace("receiver_trig calling sst_receive_handler_lambda. next_seq = {}, num_received = {}, sender rank = {}. Reading from SST row {}, slot {}",
-                                      next_seq, num_received, sender_count, node_id_to_sst_index.at(curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_count)]), (subgroup_num * window_size + slot)););
+                multicast_log(TRACE, "receiver_trig calling sst_receive_handler_lambda. next_seq = {}, num_received = {}, sender rank = {}. Reading from SST row {}, slot {}",
+                                     next_seq, num_received, sender_count, rows.senders[sender_count], slot);
+                const uint64_t size_word = (uint64_t&)slot_start[slot_size - 2 * sizeof(uint64_t)];
                 sst_receive_handler_lambda(sender_count,
-                                           &sst.slots[node_id_to_sst_index.at(curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_count)])][(sst_max_msg_size + 2 * sizeof(uint64_t)) * (subgroup_num * window_size + slot)],
-                                           (uint64_t&)sst.slots[node_id_to_sst_index.at(curr_subgroup_settings.members[shard_ranks_by_sender_rank.at(sender_count)])][(sst_max_msg_size + 2 * sizeof(uint64_t)) * (subgroup_num * window_size + slot + 1) - 2 * sizeof(uint64_t)]);
+                                           slot_start + sst::slot_message_offset(slot_size, size_word),
+                                           sst::slot_message_size(size_word));
                 sst.num_received_sst[member_index][curr_subgroup_settings.num_received_offset + sender_count] = num_received;
             }
         }
     }
-    sst.put((char*)std::addressof(sst.num_received_sst[0][curr_subgroup_settings.num_received_offset]) - sst.getBaseAddress(),
-            sizeof(decltype(sst.num_received_sst)::value_type) * num_shard_senders);
+    apply_null_skips(subgroup_num, curr_subgroup_settings, num_shard_senders, sst);
     // std::atomic_signal_fence(std::memory_order_acq_rel);
-    auto* min_ptr = std::min_element(&sst.num_received[member_index][curr_subgroup_settings.num_received_offset],
-                                     &sst.num_received[member_index][curr_subgroup_settings.num_received_offset + num_shard_senders]);
-    int min_index = std::distance(&sst.num_received[member_index][curr_subgroup_settings.num_received_offset], min_ptr);
-    message_id_t new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
-    if(new_seq_num > sst.seq_num[member_index][subgroup_num]) {
-        whenlog(logger->trace("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num););
-        sst.seq_num[member_index][subgroup_num] = new_seq_num;
-        sst.put((char*)std::addressof(sst.seq_num[0][subgroup_num]) - sst.getBaseAddress(),
-                sizeof(decltype(sst.seq_num)::value_type));
+    bool seq_num_changed;
+    if(curr_subgroup_settings.mode == Mode::SEQUENCED) {
+        seq_num_changed = advance_sequenced_seq_num(subgroup_num, curr_subgroup_settings, num_shard_senders);
+    } else {
+        volatile int32_t* shard_num_received = &sst.num_received[member_index][curr_subgroup_settings.num_received_offset];
+        const int32_t min_num_received = min_of(shard_num_received, num_shard_senders);
+        // The first sender with the minimum; only this thread writes these counters
+        int min_index = 0;
+        while(shard_num_received[min_index] != min_num_received) {
+            ++min_index;
+        }
+        message_id_t new_seq_num = (min_num_received + 1) * num_shard_senders + min_index - 1;
+        seq_num_changed = new_seq_num > sst.seq_num[member_index][subgroup_num];
+        if(seq_num_changed) {
+            multicast_log(TRACE, "Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
+            sst.seq_num[member_index][subgroup_num] = new_seq_num;
+        }
     }
-    sst.put((char*)std::addressof(sst.num_received[0][curr_subgroup_settings.num_received_offset]) - sst.getBaseAddress(),
-            sizeof(decltype(sst.num_received)::value_type) * num_shard_senders);
+    // The dirty ranges of these fields are shared with the other subgroups' receiver triggers
+    std::lock_guard<std::mutex> dirty_lock(sst_dirty_mtx);
+    sst.num_received_sst.mark_dirty(curr_subgroup_settings.num_received_offset, num_shard_senders);
+    if(seq_num_changed) {
+        sst.seq_num.mark_dirty(subgroup_num);
+    }
+    sst.num_received.mark_dirty(curr_subgroup_settings.num_received_offset, num_shard_senders);
+    sst.flush_dirty(sst.num_received_sst, sst.seq_num, sst.num_received);
 }
 
-void MulticastGroup::delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                                      const uint32_t num_shard_members, DerechoSST& sst) {
-    // DERECHO_LOG(delivery_cnt, -1, "in delivery_trig");
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
-    // compute the min of the stable_num
-    message_id_t min_stable_num
-            = sst.stable_num[node_id_to_sst_index.at(curr_subgroup_settings.members[0])][subgroup_num];
-    for(uint i = 0; i < num_shard_members; ++i) {
-        if(sst.stable_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num] < min_stable_num) {
-            min_stable_num = sst.stable_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num];
+void MulticastGroup::update_shard_minima(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                         uint32_t num_shard_senders, const DerechoSST& sst) {
+    const ShardRows& rows = shard_rows[subgroup_num];
+    ShardMinima& minima = shard_minima[subgroup_num];
+    if(curr_subgroup_settings.mode == Mode::ORDERED || curr_subgroup_settings.mode == Mode::SEQUENCED) {
+        if(!aggregated_stability) {
+            minima.stable_num = min_over_rows(&sst.stable_num[0][subgroup_num], rows.member_offsets);
+        }
+        minima.persisted_num = min_over_rows(&sst.persisted_num[0][subgroup_num], rows.member_offsets);
+    } else {
+        for(uint32_t sender_rank = 0; sender_rank < num_shard_senders; ++sender_rank) {
+            minima.num_received[sender_rank] = min_over_rows(
+                    &sst.num_received[0][curr_subgroup_settings.num_received_offset + sender_rank], rows.member_offsets);
         }
     }
+}
+
+message_id_t MulticastGroup::shard_min_stable_num(subgroup_id_t subgroup_num, DerechoSST& sst) {
+    const ShardRows& rows = shard_rows[subgroup_num];
+    if(!aggregated_stability) {
+        return shard_minima[subgroup_num].stable_num;
+    }
+    const uint32_t root_row = rows.members[0];
+    if(!rows.group_offsets.empty()) {
+        const message_id_t group_min = min_over_rows(&sst.stable_num[0][subgroup_num], rows.group_offsets);
+        if(group_min > sst.group_stable_num[member_index][subgroup_num]) {
+            sst.group_stable_num[member_index][subgroup_num] = group_min;
+            sst.put_range({root_row}, sst.group_stable_num, subgroup_num, 1);
+        }
+    }
+    if(!rows.leader_offsets.empty()) {
+        const message_id_t shard_min = min_over_rows(&sst.group_stable_num[0][subgroup_num], rows.leader_offsets);
+        if(shard_min > sst.shard_stable_num[member_index][subgroup_num]) {
+            sst.shard_stable_num[member_index][subgroup_num] = shard_min;
+            sst.put_range(rows.members, sst.shard_stable_num, subgroup_num, 1);
+        }
+    }
+    return sst.shard_stable_num[root_row][subgroup_num];
+}
+
+void MulticastGroup::delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                      const uint32_t num_shard_members, DerechoSST& sst) {
+    // DERECHO_LOG(delivery_cnt, -1, "in delivery_trig");
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    const ShardRows& rows = shard_rows[subgroup_num];
+    // compute the min of the stable_num
+    message_id_t min_stable_num = shard_min_stable_num(subgroup_num, sst);
+    DeliveryExecutor* executor = delivery_executors[subgroup_num].get();
+    std::deque<DeliveryTask> new_tasks;
 
     bool update_sst = false;
     while(true) {
@@ -770,192 +1499,756 @@ void MulticastGroup::delivery_trigger(subgroup_id_t subgroup_num, const Subgroup
         int32_t least_undelivered_rdmc_seq_num, least_undelivered_sst_seq_num;
         least_undelivered_rdmc_seq_num = least_undelivered_sst_seq_num = std::numeric_limits<int32_t>::max();
         if(!locally_stable_rdmc_messages[subgroup_num].empty()) {
-            least_undelivered_rdmc_seq_num = locally_stable_rdmc_messages[subgroup_num].begin()->first;
+            least_undelivered_rdmc_seq_num = locally_stable_rdmc_messages[subgroup_num].front_seq();
         }
         if(!locally_stable_sst_messages[subgroup_num].empty()) {
-            least_undelivered_sst_seq_num = locally_stable_sst_messages[subgroup_num].begin()->first;
+            least_undelivered_sst_seq_num = locally_stable_sst_messages[subgroup_num].front_seq();
         }
         if(least_undelivered_rdmc_seq_num < least_undelivered_sst_seq_num && least_undelivered_rdmc_seq_num <= min_stable_num) {
             update_sst = true;
-            whenlog(logger->trace("Subgroup {}, can deliver a locally stable RDMC message: min_stable_num={} and least_undelivered_seq_num={}",
-                                  subgroup_num, min_stable_num, least_undelivered_rdmc_seq_num););
-            RDMCMessage& msg = locally_stable_rdmc_messages[subgroup_num].begin()->second;
+            multicast_log(TRACE, "Subgroup {}, can deliver a locally stable RDMC message: min_stable_num={} and least_undelivered_seq_num={}",
+                                 subgroup_num, min_stable_num, least_undelivered_rdmc_seq_num);
+            RDMCMessage& msg = locally_stable_rdmc_messages[subgroup_num].front();
+            tap_change(subgroup_num, msg.sender_id, least_undelivered_rdmc_seq_num, msg.message_buffer.buffer, msg.size);
+            if(executor) {
+                const uint64_t msg_ts = msg.size > 0 ? ((header*)msg.message_buffer.buffer)->timestamp : 0;
+                if(msg.size > 0) {
+                    record_latency(subgroup_num, LatencyStage::STABLE, msg_ts);
+                }
+                new_tasks.push_back({least_undelivered_rdmc_seq_num, msg_ts, std::move(msg), std::nullopt});
+                executor->queued_through = least_undelivered_rdmc_seq_num;
+                locally_stable_rdmc_messages[subgroup_num].pop_front();
+                continue;
+            }
             if(msg.size > 0) {
-                char* buf = msg.message_buffer.buffer.get();
+                char* buf = msg.message_buffer.buffer;
                 uint64_t msg_ts = ((header*)buf)->timestamp;
-                //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
-                deliver_message(msg, subgroup_num);
-                version_message(msg, subgroup_num, least_undelivered_rdmc_seq_num, msg_ts);
+                record_latency(subgroup_num, LatencyStage::STABLE, msg_ts);
+                if(delivers_in_batch(buf)) {
+                    add_to_batch(msg, subgroup_num, least_undelivered_rdmc_seq_num, msg_ts);
+                } else {
+                    deliver_batch(subgroup_num);
+                    //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
+                    deliver_message(msg, subgroup_num);
+                    version_message(msg, subgroup_num, least_undelivered_rdmc_seq_num, msg_ts);
+                }
             }
             // DERECHO_LOG(-1, -1, "deliver_message() done");
             sst.delivered_num[member_index][subgroup_num] = least_undelivered_rdmc_seq_num;
-            locally_stable_rdmc_messages[subgroup_num].erase(locally_stable_rdmc_messages[subgroup_num].begin());
+            locally_stable_rdmc_messages[subgroup_num].pop_front();
             // DERECHO_LOG(-1, -1, "message_erase_done");
         } else if(least_undelivered_sst_seq_num < least_undelivered_rdmc_seq_num && least_undelivered_sst_seq_num <= min_stable_num) {
             update_sst = true;
-            whenlog(logger->trace("Subgroup {}, can deliver a locally stable SST message: min_stable_num={} and least_undelivered_seq_num={}",
-                                  subgroup_num, min_stable_num, least_undelivered_sst_seq_num););
-            SSTMessage& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
+            multicast_log(TRACE, "Subgroup {}, can deliver a locally stable SST message: min_stable_num={} and least_undelivered_seq_num={}",
+                                 subgroup_num, min_stable_num, least_undelivered_sst_seq_num);
+            SSTMessage& msg = locally_stable_sst_messages[subgroup_num].front();
+            tap_change(subgroup_num, msg.sender_id, least_undelivered_sst_seq_num, (const char*)msg.buf, msg.size);
             if(msg.size > 0) {
-                char* buf = (char*)msg.buf;
-                uint64_t msg_ts = ((header*)buf)->timestamp;
-                deliver_message(msg, subgroup_num);
-                version_message(msg, subgroup_num, least_undelivered_sst_seq_num, msg_ts);
+                record_latency(subgroup_num, LatencyStage::STABLE, ((header*)msg.buf)->timestamp);
+            }
+            if(executor) {
+                new_tasks.push_back({least_undelivered_sst_seq_num, msg.size > 0 ? ((header*)msg.buf)->timestamp : 0,
+                                     std::nullopt, msg});
+                executor->queued_through = least_undelivered_sst_seq_num;
+                locally_stable_sst_messages[subgroup_num].pop_front();
+                continue;
+            }
+            // A null message joins a batch in progress, so that its slot isn't released before the batch's slots are
+            if(msg.size > 0 ? delivers_in_batch((char*)msg.buf) : !batched_messages[subgroup_num].empty()) {
+                add_to_batch(msg, subgroup_num, least_undelivered_sst_seq_num,
+                             msg.size > 0 ? ((header*)msg.buf)->timestamp : 0);
+            } else {
+                if(msg.size > 0) {
+                    char* buf = (char*)msg.buf;
+                    uint64_t msg_ts = ((header*)buf)->timestamp;
+                    deliver_batch(subgroup_num);
+                    deliver_message(msg, subgroup_num);
+                    version_message(msg, subgroup_num, least_undelivered_sst_seq_num, msg_ts);
+                }
+                slot_pins->delivered(msg.num_received_entry, msg.sst_index);
             }
             // DERECHO_LOG(-1, -1, "deliver_message() done");
             sst.delivered_num[member_index][subgroup_num] = least_undelivered_sst_seq_num;
-            locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
+            locally_stable_sst_messages[subgroup_num].pop_front();
             // DERECHO_LOG(-1, -1, "message_erase_done");
         } else {
             break;
         }
     }
+    // Whatever is left up to min_stable_num was skipped by its senders
+    if(executor) {
+        if(executor->queued_through < min_stable_num
+           && (locally_stable_rdmc_messages[subgroup_num].empty() || locally_stable_rdmc_messages[subgroup_num].front_seq() > min_stable_num)
+           && (locally_stable_sst_messages[subgroup_num].empty() || locally_stable_sst_messages[subgroup_num].front_seq() > min_stable_num)) {
+            new_tasks.push_back({min_stable_num, 0, std::nullopt, std::nullopt});
+            executor->queued_through = min_stable_num;
+        }
+        if(!new_tasks.empty()) {
+            {
+                std::lock_guard<std::mutex> executor_lock(executor->mtx);
+                for(DeliveryTask& task : new_tasks) {
+                    executor->tasks.push_back(std::move(task));
+                }
+            }
+            executor->cv.notify_one();
+        }
+        return;
+    }
+    if(sst.delivered_num[member_index][subgroup_num] < min_stable_num
+       && (locally_stable_rdmc_messages[subgroup_num].empty() || locally_stable_rdmc_messages[subgroup_num].front_seq() > min_stable_num)
+       && (locally_stable_sst_messages[subgroup_num].empty() || locally_stable_sst_messages[subgroup_num].front_seq() > min_stable_num)) {
+        update_sst = true;
+        sst.delivered_num[member_index][subgroup_num] = min_stable_num;
+    }
+    deliver_batch(subgroup_num);
     if(update_sst) {
         // DERECHO_LOG(-1, -1, "delivery_put_start");
-        sst.put(get_shard_sst_indices(subgroup_num),
-                (char*)std::addressof(sst.delivered_num[0][subgroup_num]) - sst.getBaseAddress(),
-                sizeof(decltype(sst.delivered_num)::value_type));
+        sst.put_range(rows.members, sst.delivered_num, subgroup_num, 1);
         // locally_stable_messages[subgroup_num].erase(locally_stable_messages[subgroup_num].begin());
         //post persistence request for ordered mode.
-        if(curr_subgroup_settings.mode != Mode::UNORDERED) {
-            std::get<1>(persistence_manager_callbacks)(subgroup_num,
-                                                       persistent::combine_int32s(sst.vid[member_index], sst.delivered_num[member_index][subgroup_num]));
+        if(curr_subgroup_settings.mode == Mode::ORDERED) {
+            post_persistence_request(subgroup_num, persistent::combine_int32s(sst.vid[member_index], sst.delivered_num[member_index][subgroup_num]));
+        }
+    }
+}
+
+void MulticastGroup::start_delivery_executors() {
+    for(const auto& p : subgroup_settings) {
+        if(p.second.delivery_executor && p.second.mode == Mode::ORDERED) {
+            delivery_executors[p.first] = std::make_unique<DeliveryExecutor>();
+            delivery_executors[p.first]->thread = std::thread(&MulticastGroup::delivery_executor_loop, this, p.first);
+        }
+    }
+}
+
+void MulticastGroup::stop_delivery_executors() {
+    for(auto& executor : delivery_executors) {
+        if(!executor) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(executor->mtx);
+            executor->shutdown = true;
+        }
+        executor->cv.notify_one();
+        if(executor->thread.joinable()) {
+            executor->thread.join();
         }
     }
 }
+
+void MulticastGroup::delivery_executor_loop(subgroup_id_t subgroup_num) {
+    // Thread names are limited to 16 characters
+    name_and_pin_thread("delivery_" + std::to_string(subgroup_num % 1000000));
+    DeliveryExecutor& executor = *delivery_executors[subgroup_num];
+    std::deque<DeliveryTask> tasks;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(executor.mtx);
+            executor.cv.wait(lock, [&]() { return executor.shutdown || !executor.tasks.empty(); });
+            // Shutting down waits until everything queued is delivered
+            if(executor.tasks.empty()) {
+                return;
+            }
+            tasks.swap(executor.tasks);
+        }
+        run_delivery_tasks(subgroup_num, tasks);
+        tasks.clear();
+    }
+}
+
+void MulticastGroup::run_delivery_tasks(subgroup_id_t subgroup_num, std::deque<DeliveryTask>& tasks) {
+    // The upcalls run without the subgroup's lock, so the predicate thread
+    // can keep receiving while they do
+    std::vector<DeliveredMessage> batch;
+    // Tasks from finished on have been delivered or batched, but not versioned
+    std::size_t finished = 0;
+    for(std::size_t i = 0; i < tasks.size(); ++i) {
+        DeliveryTask& task = tasks[i];
+        char* buf = nullptr;
+        DeliveredMessage message{};
+        if(task.rdmc_msg && task.rdmc_msg->size > 0) {
+            buf = task.rdmc_msg->message_buffer.buffer;
+            message = {task.rdmc_msg->sender_id, task.rdmc_msg->index, buf, static_cast<long long int>(task.rdmc_msg->size)};
+        } else if(task.sst_msg && task.sst_msg->size > 0) {
+            buf = const_cast<char*>(task.sst_msg->buf);
+            message = {task.sst_msg->sender_id, task.sst_msg->index, buf, static_cast<long long int>(task.sst_msg->size)};
+        }
+        // Null messages and skips just wait to be finished in order
+        if(!buf) {
+            continue;
+        }
+        if(delivers_in_batch(buf)) {
+            const uint32_t header_size = ((header*)buf)->header_size;
+            if(message.size > header_size) {
+                batch.push_back({message.sender_id, message.index, buf + header_size, message.size - header_size});
+            }
+            continue;
+        }
+        if(!batch.empty()) {
+            callbacks.global_stability_batch_callback(subgroup_num, batch);
+            batch.clear();
+        }
+        finish_delivery_tasks(subgroup_num, tasks, finished, i);
+        if(task.rdmc_msg) {
+            deliver_message(*task.rdmc_msg, subgroup_num);
+        } else {
+            deliver_message(*task.sst_msg, subgroup_num);
+        }
+        finish_delivery_tasks(subgroup_num, tasks, i, i + 1);
+        finished = i + 1;
+    }
+    if(!batch.empty()) {
+        callbacks.global_stability_batch_callback(subgroup_num, batch);
+    }
+    finish_delivery_tasks(subgroup_num, tasks, finished, tasks.size());
+
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    sst->delivered_num[member_index][subgroup_num] = tasks.back().seq_num;
+    sst->put_range(shard_rows[subgroup_num].members, sst->delivered_num, subgroup_num, 1);
+    post_persistence_request(subgroup_num, persistent::combine_int32s(sst->vid[member_index], tasks.back().seq_num));
+}
+
+void MulticastGroup::finish_delivery_tasks(subgroup_id_t subgroup_num, std::deque<DeliveryTask>& tasks,
+                                           std::size_t begin, std::size_t end) {
+    if(begin == end) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    for(std::size_t i = begin; i < end; ++i) {
+        DeliveryTask& task = tasks[i];
+        if(task.rdmc_msg) {
+            if(task.rdmc_msg->size > 0) {
+                version_message(*task.rdmc_msg, subgroup_num, task.seq_num, task.timestamp);
+            }
+            // deliver_message already released the buffer unless it was batched
+            buffer_pools[subgroup_num]->release(std::move(task.rdmc_msg->message_buffer));
+        } else if(task.sst_msg) {
+            if(task.sst_msg->size > 0) {
+                version_message(*task.sst_msg, subgroup_num, task.seq_num, task.timestamp);
+            }
+            slot_pins->delivered(task.sst_msg->num_received_entry, task.sst_msg->sst_index);
+        }
+    }
+}
+
+void MulticastGroup::deliver_fifo_message(subgroup_id_t subgroup_num, message_id_t seq_num) {
+    if(RDMCMessage* rdmc_msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(seq_num)) {
+        RDMCMessage& msg = *rdmc_msg_ptr;
+        if(msg.size > 0) {
+            const uint64_t msg_ts = ((header*)msg.message_buffer.buffer)->timestamp;
+            record_latency(subgroup_num, LatencyStage::STABLE, msg_ts);
+            // Nothing is persisted, so the message is done with once it is delivered
+            if(msg.sender_id == members[member_index]) {
+                pending_message_timestamps[subgroup_num].erase(msg_ts);
+            }
+            //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
+            deliver_message(msg, subgroup_num);
+            subgroup_metrics[subgroup_num].messages_delivered->add();
+            count_own_delivery(subgroup_num, msg.sender_id);
+            record_latency(subgroup_num, LatencyStage::DELIVERED, msg_ts);
+        }
+        locally_stable_rdmc_messages[subgroup_num].erase(seq_num);
+    } else if(SSTMessage* sst_msg_ptr = locally_stable_sst_messages[subgroup_num].find(seq_num)) {
+        SSTMessage& msg = *sst_msg_ptr;
+        if(msg.size > 0) {
+            const uint64_t msg_ts = ((header*)msg.buf)->timestamp;
+            record_latency(subgroup_num, LatencyStage::STABLE, msg_ts);
+            if(msg.sender_id == members[member_index]) {
+                pending_message_timestamps[subgroup_num].erase(msg_ts);
+            }
+            deliver_message(msg, subgroup_num);
+            subgroup_metrics[subgroup_num].messages_delivered->add();
+            count_own_delivery(subgroup_num, msg.sender_id);
+            record_latency(subgroup_num, LatencyStage::DELIVERED, msg_ts);
+        }
+        slot_pins->delivered(msg.num_received_entry, msg.sst_index);
+        locally_stable_sst_messages[subgroup_num].erase(seq_num);
+    }
+}
+
+void MulticastGroup::publish_fifo_delivery(subgroup_id_t subgroup_num, uint32_t num_received_offset,
+                                           uint32_t num_shard_senders) {
+    // delivered_num is the end of the longest round-robin prefix that has been
+    // delivered, computed like seq_num is from num_received
+    volatile int32_t* shard_delivered_index = &sst->delivered_index[member_index][num_received_offset];
+    const int32_t min_delivered_index = min_of(shard_delivered_index, num_shard_senders);
+    int min_index = 0;
+    while(shard_delivered_index[min_index] != min_delivered_index) {
+        ++min_index;
+    }
+    const message_id_t new_delivered_num = (min_delivered_index + 1) * num_shard_senders + min_index - 1;
+    if(new_delivered_num > sst->delivered_num[member_index][subgroup_num]) {
+        sst->delivered_num[member_index][subgroup_num] = new_delivered_num;
+    }
+    const std::vector<uint32_t>& shard_sst_indices = shard_rows[subgroup_num].members;
+    sst->put_range(shard_sst_indices, sst->delivered_index, num_received_offset, num_shard_senders);
+    sst->put_range(shard_sst_indices, sst->delivered_num, subgroup_num, 1);
+    sst->notify(shard_sst_indices);
+}
+
+void MulticastGroup::fifo_delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                           uint32_t num_shard_senders, DerechoSST& sst) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    const ShardMinima& minima = shard_minima[subgroup_num];
+    bool update_sst = false;
+    for(uint32_t sender_rank = 0; sender_rank < num_shard_senders; ++sender_rank) {
+        const uint32_t num_received_entry = curr_subgroup_settings.num_received_offset + sender_rank;
+        // A sender's messages are stable up to the last one that every member has received
+        const int32_t stable_index = minima.num_received[sender_rank];
+        const int32_t delivered_index = sst.delivered_index[member_index][num_received_entry];
+        if(stable_index <= delivered_index) {
+            continue;
+        }
+        multicast_log(TRACE, "Subgroup {}, delivering sender rank {} up to index {}", subgroup_num, sender_rank, stable_index);
+        for(int32_t index = delivered_index + 1; index <= stable_index; ++index) {
+            deliver_fifo_message(subgroup_num, index * num_shard_senders + sender_rank);
+        }
+        sst.delivered_index[member_index][num_received_entry] = stable_index;
+        update_sst = true;
+    }
+    if(update_sst) {
+        publish_fifo_delivery(subgroup_num, curr_subgroup_settings.num_received_offset, num_shard_senders);
+    }
+}
+
+bool MulticastGroup::advance_sequenced_seq_num(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                               uint32_t num_shard_senders) {
+    const ShardRows& rows = shard_rows[subgroup_num];
+    SequencerState& state = sequencer_states[subgroup_num];
+    const uint32_t sequencer_row = rows.members[0];
+    volatile int32_t* my_num_received = &sst->num_received[member_index][curr_subgroup_settings.num_received_offset];
+    if(sequencer_row == member_index) {
+        const message_id_t first_new = sst->sequenced_num[member_index][subgroup_num] + 1;
+        // A slot of the order can be reused once every member has delivered the message in it
+        const message_id_t last_allowed = min_over_rows(&sst->delivered_num[0][subgroup_num], rows.member_offsets)
+                                          + static_cast<message_id_t>(state.order_length);
+        // Take the senders in turn, so that a busy sender can't starve the others
+        message_id_t next = first_new;
+        bool placed = true;
+        while(placed && next <= last_allowed) {
+            placed = false;
+            for(uint32_t sender_rank = 0; sender_rank < num_shard_senders && next <= last_allowed; ++sender_rank) {
+                if(state.ordered_through[sender_rank] < my_num_received[sender_rank]) {
+                    sst->sequence_order[member_index][state.order_offset + next % state.order_length] = sender_rank;
+                    state.ordered_through[sender_rank]++;
+                    next++;
+                    placed = true;
+                }
+            }
+        }
+        if(next > first_new) {
+            const uint32_t first_slot = first_new % state.order_length;
+            const uint32_t num_placed = next - first_new;
+            if(first_slot + num_placed <= state.order_length) {
+                sst->put_range(rows.members, sst->sequence_order, state.order_offset + first_slot, num_placed);
+            } else {
+                sst->put_range(rows.members, sst->sequence_order, state.order_offset + first_slot,
+                               state.order_length - first_slot);
+                sst->put_range(rows.members, sst->sequence_order, state.order_offset,
+                               num_placed - (state.order_length - first_slot));
+            }
+            // Published after the slots, so that members never read a slot before it is written
+            sst->sequenced_num[member_index][subgroup_num] = next - 1;
+            sst->put_range(rows.members, sst->sequenced_num, subgroup_num, 1);
+        }
+    }
+    const message_id_t sequenced_num = sst->sequenced_num[sequencer_row][subgroup_num];
+    const message_id_t old_seq_num = sst->seq_num[member_index][subgroup_num];
+    message_id_t seq_num = old_seq_num;
+    while(seq_num < sequenced_num) {
+        const uint32_t sender_rank = sst->sequence_order[sequencer_row][state.order_offset + (seq_num + 1) % state.order_length];
+        if(state.received_through[sender_rank] >= my_num_received[sender_rank]) {
+            break;
+        }
+        state.received_through[sender_rank]++;
+        seq_num++;
+    }
+    if(seq_num == old_seq_num) {
+        return false;
+    }
+    multicast_log(TRACE, "Updating seq_num for subgroup {} to {}", subgroup_num, seq_num);
+    sst->seq_num[member_index][subgroup_num] = seq_num;
+    return true;
+}
+
+bool MulticastGroup::deliver_sequenced_message(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                               uint32_t num_shard_senders, message_id_t seq_num) {
+    const SequencerState& state = sequencer_states[subgroup_num];
+    const uint32_t sender_rank = sst->sequence_order[shard_rows[subgroup_num].members[0]]
+                                                    [state.order_offset + seq_num % state.order_length];
+    volatile int32_t& delivered_index = sst->delivered_index[member_index][curr_subgroup_settings.num_received_offset + sender_rank];
+    // The messages are stored under their round-robin sequence numbers, like in ordered subgroups
+    const message_id_t sender_seq_num = (delivered_index + 1) * num_shard_senders + sender_rank;
+    delivered_index = delivered_index + 1;
+    sst->delivered_num[member_index][subgroup_num] = seq_num;
+    if(RDMCMessage* rdmc_msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(sender_seq_num)) {
+        RDMCMessage& msg = *rdmc_msg_ptr;
+        if(msg.size > 0) {
+            char* buf = msg.message_buffer.buffer;
+            uint64_t msg_ts = ((header*)buf)->timestamp;
+            record_latency(subgroup_num, LatencyStage::STABLE, msg_ts);
+            tap_change(subgroup_num, msg.sender_id, seq_num, buf, msg.size);
+            if(delivers_in_batch(buf)) {
+                add_to_batch(msg, subgroup_num, seq_num, msg_ts);
+            } else {
+                deliver_batch(subgroup_num);
+                //Note: deliver_message frees the RDMC buffer in msg, which is why the timestamp must be saved before calling this
+                deliver_message(msg, subgroup_num);
+                version_message(msg, subgroup_num, seq_num, msg_ts);
+            }
+        }
+        locally_stable_rdmc_messages[subgroup_num].erase(sender_seq_num);
+        return true;
+    } else if(SSTMessage* sst_msg_ptr = locally_stable_sst_messages[subgroup_num].find(sender_seq_num)) {
+        SSTMessage& msg = *sst_msg_ptr;
+        tap_change(subgroup_num, msg.sender_id, seq_num, (const char*)msg.buf, msg.size);
+        if(msg.size > 0) {
+            record_latency(subgroup_num, LatencyStage::STABLE, ((header*)msg.buf)->timestamp);
+        }
+        // A null message joins a batch in progress, so that its slot isn't released before the batch's slots are
+        if(msg.size > 0 ? delivers_in_batch((char*)msg.buf) : !batched_messages[subgroup_num].empty()) {
+            add_to_batch(msg, subgroup_num, seq_num, msg.size > 0 ? ((header*)msg.buf)->timestamp : 0);
+        } else {
+            if(msg.size > 0) {
+                char* buf = (char*)msg.buf;
+                uint64_t msg_ts = ((header*)buf)->timestamp;
+                deliver_batch(subgroup_num);
+                deliver_message(msg, subgroup_num);
+                version_message(msg, subgroup_num, seq_num, msg_ts);
+            }
+            slot_pins->delivered(msg.num_received_entry, msg.sst_index);
+        }
+        locally_stable_sst_messages[subgroup_num].erase(sender_seq_num);
+        return true;
+    }
+    return false;
+}
+
+void MulticastGroup::sequenced_delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                                uint32_t num_shard_senders, DerechoSST& sst) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    const ShardRows& rows = shard_rows[subgroup_num];
+    // Every member has received the order, and its messages, up to min_stable_num
+    const message_id_t min_stable_num = shard_min_stable_num(subgroup_num, sst);
+    const message_id_t delivered_num = sst.delivered_num[member_index][subgroup_num];
+    if(min_stable_num <= delivered_num) {
+        return;
+    }
+    multicast_log(TRACE, "Subgroup {}, delivering the sequenced messages up to {}", subgroup_num, min_stable_num);
+    for(message_id_t seq_num = delivered_num + 1; seq_num <= min_stable_num; ++seq_num) {
+        deliver_sequenced_message(subgroup_num, curr_subgroup_settings, num_shard_senders, seq_num);
+    }
+    deliver_batch(subgroup_num);
+    sst.put_range(rows.members, sst.delivered_index, curr_subgroup_settings.num_received_offset, num_shard_senders);
+    sst.put_range(rows.members, sst.delivered_num, subgroup_num, 1);
+    post_persistence_request(subgroup_num, persistent::combine_int32s(sst.vid[member_index], min_stable_num));
+}
+
+std::vector<int32_t> MulticastGroup::sequenced_ragged_trim(subgroup_id_t subgroup_num, message_id_t last_seq_num) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    const SubgroupSettings& curr_subgroup_settings = subgroup_settings.at(subgroup_num);
+    const SequencerState& state = sequencer_states[subgroup_num];
+    const uint32_t sequencer_row = shard_rows[subgroup_num].members[0];
+    const uint32_t num_shard_senders = get_num_senders(curr_subgroup_settings.senders);
+    std::vector<int32_t> last_indices(num_shard_senders);
+    for(uint32_t sender_rank = 0; sender_rank < num_shard_senders; ++sender_rank) {
+        last_indices[sender_rank] = sst->delivered_index[member_index][curr_subgroup_settings.num_received_offset + sender_rank];
+    }
+    for(message_id_t seq_num = sst->delivered_num[member_index][subgroup_num] + 1; seq_num <= last_seq_num; ++seq_num) {
+        last_indices[sst->sequence_order[sequencer_row][state.order_offset + seq_num % state.order_length]]++;
+    }
+    return last_indices;
+}
+
 void MulticastGroup::register_predicates() {
     for(const auto& p : subgroup_settings) {
         subgroup_id_t subgroup_num = p.first;
         const SubgroupSettings& curr_subgroup_settings = p.second;
+        // All of this subgroup's predicates are evaluated by the same thread
+        auto& subgroup_predicates = sst->get_predicates(subgroup_num);
         auto num_shard_members = curr_subgroup_settings.members.size();
-        std::vector<int> shard_senders = curr_subgroup_settings.senders;
-        auto num_shard_senders = get_num_senders(shard_senders);
-        std::map<uint32_t, uint32_t> shard_ranks_by_sender_rank;
-        for(uint j = 0, l = 0; j < num_shard_members; ++j) {
-            if(shard_senders[j]) {
-                shard_ranks_by_sender_rank[l] = j;
-                l++;
-            }
-        }
+        auto num_shard_senders = get_num_senders(curr_subgroup_settings.senders);
+        // Never resized after construction, so the triggers can keep a reference
+        const ShardRows& rows = shard_rows[subgroup_num];
+        ShardMinima& minima = shard_minima[subgroup_num];
+        minima = ShardMinima();
+        minima.num_received.assign(num_shard_senders, -1);
+        shard_minima_handles.emplace_back(subgroup_predicates.insert_named_function(
+                [this, subgroup_num, curr_subgroup_settings, num_shard_senders](const DerechoSST& sst) {
+                    update_shard_minima(subgroup_num, curr_subgroup_settings, num_shard_senders, sst);
+                },
+                "shard_minima subgroup " + std::to_string(subgroup_num)));
 
         auto receiver_pred = [=](const DerechoSST& sst) {
             return receiver_predicate(subgroup_num, curr_subgroup_settings,
-                                      shard_ranks_by_sender_rank, num_shard_senders, sst);
+                                      num_shard_senders, sst);
         };
-        auto batch_size = window_size / 2;
+        auto batch_size = curr_subgroup_settings.window_size / 2;
         if(!batch_size) {
             batch_size = 1;
         }
         auto sst_receive_handler_lambda = [=](uint32_t sender_rank, volatile char* data, uint64_t size) {
             sst_receive_handler(subgroup_num, curr_subgroup_settings,
-                                shard_ranks_by_sender_rank, num_shard_senders,
-                                sender_rank, data, size);
+                                num_shard_senders, sender_rank, data, size);
         };
         auto receiver_trig = [=](DerechoSST& sst) mutable {
             receiver_function(subgroup_num, curr_subgroup_settings,
-                              shard_ranks_by_sender_rank, num_shard_senders, sst,
+                              num_shard_senders, sst,
                               batch_size, sst_receive_handler_lambda);
         };
-        receiver_pred_handles.emplace_back(sst->predicates.insert(receiver_pred, receiver_trig,
-                                                                  sst::PredicateType::RECURRENT));
+        // The receiver predicate only needs to run when a sender's slot guard
+        // or our own num_received_sst counters for this subgroup change
+        sst::watch_list_t receiver_watches;
+        for(uint sender_count = 0; sender_count < num_shard_senders; ++sender_count) {
+            const auto sender_sst_index = rows.senders[sender_count];
+            const uint64_t slot_size = curr_subgroup_settings.sst_max_msg_size + 2 * sizeof(uint64_t);
+            for(uint slot = 0; slot < curr_subgroup_settings.window_size; ++slot) {
+                receiver_watches.emplace_back(&sst->slots[sender_sst_index][curr_subgroup_settings.slots_offset + slot_size * (slot + 1) - sizeof(uint64_t)],
+                                              sizeof(uint64_t));
+            }
+        }
+        receiver_watches.emplace_back(&sst->num_received_sst[member_index][curr_subgroup_settings.num_received_offset],
+                                      num_shard_senders);
+        // and when a sender skips ahead
+        for(uint sender_count = 0; sender_count < num_shard_senders; ++sender_count) {
+            const auto sender_sst_index = rows.senders[sender_count];
+            receiver_watches.emplace_back(&sst->null_skip_index[sender_sst_index][curr_subgroup_settings.num_received_offset + sender_count]);
+        }
+        receiver_pred_handles.emplace_back(subgroup_predicates.insert(receiver_pred, receiver_trig,
+                                                                  sst::PredicateType::RECURRENT,
+                                                                  receiver_watches,
+                                                                  "receiver_pred subgroup " + std::to_string(subgroup_num)));
 
-        if(curr_subgroup_settings.mode != Mode::UNORDERED) {
+        if(curr_subgroup_settings.mode == Mode::ORDERED || curr_subgroup_settings.mode == Mode::SEQUENCED) {
             auto stability_pred = [this](const DerechoSST& sst) { return true; };
-            auto shard_sst_indices = get_shard_sst_indices(subgroup_num);
-            auto stability_trig = [this, subgroup_num, curr_subgroup_settings,
-                                   num_shard_members, shard_sst_indices](DerechoSST& sst) mutable {
+            auto stability_trig = [this, subgroup_num, &rows](DerechoSST& sst) mutable {
                 // DERECHO_LOG(stability_cnt, -1, "in stability_trig");
                 // compute the min of the seq_num
-                message_id_t min_seq_num = sst.seq_num[node_id_to_sst_index.at(curr_subgroup_settings.members[0])][subgroup_num];
-                for(uint i = 0; i < num_shard_members; ++i) {
-                    if(sst.seq_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num] < min_seq_num) {
-                        min_seq_num = sst.seq_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num];
-                    }
-                }
+                message_id_t min_seq_num = min_over_rows(&sst.seq_num[0][subgroup_num], rows.member_offsets);
                 if(min_seq_num > sst.stable_num[member_index][subgroup_num]) {
-                    whenlog(logger->trace("Subgroup {}, updating stable_num to {}", subgroup_num, min_seq_num););
+                    multicast_log(TRACE, "Subgroup {}, updating stable_num to {}", subgroup_num, min_seq_num);
                     sst.stable_num[member_index][subgroup_num] = min_seq_num;
-                    // DERECHO_LOG(stability_cnt, min_seq_num, "stability_trig");
-                    // DERECHO_LOG(-1, -1, "stability_put_start");
-                    sst.put(shard_sst_indices,
-                            (char*)std::addressof(sst.stable_num[0][subgroup_num]) - sst.getBaseAddress(),
-                            sizeof(decltype(sst.stable_num)::value_type));
-                    // DERECHO_LOG(-1, -1, "stability_put_end");
-                    // DERECHO_LOG(stability_cnt, min_seq_num, "updated_stable_num");
+                    sst.put_range(rows.stable_num_targets, sst.stable_num, subgroup_num, 1);
+                    DERECHO_LOG(subgroup_num, min_seq_num, "updated_stable_num");
                 }
             };
-            stability_pred_handles.emplace_back(sst->predicates.insert(
-                    stability_pred, stability_trig, sst::PredicateType::RECURRENT));
+            // Stability, delivery and persistence only depend on one column of
+            // the shard members' rows, so skip them until that column (or its
+            // minimum, for the columns in shard_minima) changes
+            sst::watch_list_t seq_num_watches;
+            for(uint i = 0; i < num_shard_members; ++i) {
+                seq_num_watches.emplace_back(&sst->seq_num[rows.members[i]][subgroup_num]);
+            }
+            sst::watch_list_t stable_num_watches{&minima.stable_num};
+            sst::watch_list_t persisted_num_watches{&minima.persisted_num};
+            // With aggregated stability, a node only looks at the entries
+            // its part of the tree folds, and at the published minimum
+            if(aggregated_stability) {
+                stable_num_watches = {&sst->shard_stable_num[rows.members[0]][subgroup_num]};
+                for(const uint32_t row : rows.group_rows) {
+                    stable_num_watches.emplace_back(&sst->stable_num[row][subgroup_num]);
+                }
+                for(const uint32_t row : rows.leader_rows) {
+                    stable_num_watches.emplace_back(&sst->group_stable_num[row][subgroup_num]);
+                }
+            }
+            stability_pred_handles.emplace_back(subgroup_predicates.insert(
+                    stability_pred, stability_trig, sst::PredicateType::RECURRENT, seq_num_watches,
+                    "stability_pred subgroup " + std::to_string(subgroup_num)));
 
             auto delivery_pred = [this](const DerechoSST& sst) { return true; };
             auto delivery_trig = [=](DerechoSST& sst) mutable {
-                delivery_trigger(subgroup_num, curr_subgroup_settings, num_shard_members, sst);
+                if(curr_subgroup_settings.mode == Mode::SEQUENCED) {
+                    sequenced_delivery_trigger(subgroup_num, curr_subgroup_settings, num_shard_senders, sst);
+                } else {
+                    delivery_trigger(subgroup_num, curr_subgroup_settings, num_shard_members, sst);
+                }
             };
 
-            delivery_pred_handles.emplace_back(sst->predicates.insert(delivery_pred, delivery_trig,
-                                                                      sst::PredicateType::RECURRENT));
+            delivery_pred_handles.emplace_back(subgroup_predicates.insert(delivery_pred, delivery_trig,
+                                                                      sst::PredicateType::RECURRENT,
+                                                                      stable_num_watches,
+                                                                      "delivery_pred subgroup " + std::to_string(subgroup_num)));
 
             auto persistence_pred = [this](const DerechoSST& sst) { return true; };
-            auto persistence_trig = [this, subgroup_num, curr_subgroup_settings, num_shard_members](DerechoSST& sst) mutable {
-                std::lock_guard<std::mutex> lock(msg_state_mtx);
-                // compute the min of the persisted_num
-                persistent::version_t min_persisted_num
-                        = sst.persisted_num[node_id_to_sst_index.at(curr_subgroup_settings.members[0])][subgroup_num];
-                for(uint i = 0; i < num_shard_members; ++i) {
-                    if(sst.persisted_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num] < min_persisted_num) {
-                        min_persisted_num = sst.persisted_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num];
-                    }
+            auto persistence_trig = [this, subgroup_num, &minima](DerechoSST& sst) mutable {
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                const persistent::version_t min_persisted_num = minima.persisted_num;
+                while(!unpersisted_send_timestamps[subgroup_num].empty()
+                      && persistent::combine_int32s(sst.vid[member_index], unpersisted_send_timestamps[subgroup_num].front_seq())
+                                 <= min_persisted_num) {
+                    record_latency(subgroup_num, LatencyStage::PERSISTED, unpersisted_send_timestamps[subgroup_num].front());
+                    unpersisted_send_timestamps[subgroup_num].pop_front();
                 }
                 // callbacks
                 if(callbacks.global_persistence_callback) {
                     callbacks.global_persistence_callback(subgroup_num, min_persisted_num);
                 }
+                // The minimum is computed once per pass, so this reports
+                // everything the pass found persisted in one call
+                if(callbacks.global_persistence_range_callback
+                   && min_persisted_num > global_persistence_frontiers[subgroup_num]) {
+                    callbacks.global_persistence_range_callback(subgroup_num, global_persistence_frontiers[subgroup_num] + 1,
+                                                                min_persisted_num);
+                    global_persistence_frontiers[subgroup_num] = min_persisted_num;
+                }
             };
 
-            persistence_pred_handles.emplace_back(sst->predicates.insert(persistence_pred, persistence_trig, sst::PredicateType::RECURRENT));
+            persistence_pred_handles.emplace_back(subgroup_predicates.insert(persistence_pred, persistence_trig,
+                                                                         sst::PredicateType::RECURRENT,
+                                                                         persisted_num_watches,
+                                                                         "persistence_pred subgroup " + std::to_string(subgroup_num)));
+
+            if(curr_subgroup_settings.mode == Mode::SEQUENCED) {
+                // Members follow the order as the sequencer extends it
+                auto sequencer_pred = [this](const DerechoSST& sst) { return true; };
+                auto sequencer_trig = [this, subgroup_num, curr_subgroup_settings, &rows, num_shard_senders](DerechoSST& sst) {
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                    if(advance_sequenced_seq_num(subgroup_num, curr_subgroup_settings, num_shard_senders)) {
+                        sst.put_range(rows.members, sst.seq_num, subgroup_num, 1);
+                    }
+                };
+                sst::watch_list_t sequenced_num_watches;
+                sequenced_num_watches.emplace_back(&sst->sequenced_num[rows.members[0]][subgroup_num]);
+                // and the sequencer itself may find room in the order once the members deliver more
+                if(rows.members[0] == member_index) {
+                    for(uint i = 0; i < num_shard_members; ++i) {
+                        sequenced_num_watches.emplace_back(&sst->delivered_num[rows.members[i]][subgroup_num]);
+                    }
+                }
+                sequencer_pred_handles.emplace_back(subgroup_predicates.insert(sequencer_pred, sequencer_trig,
+                                                                           sst::PredicateType::RECURRENT,
+                                                                           sequenced_num_watches,
+                                                                           "sequencer_pred subgroup " + std::to_string(subgroup_num)));
+            }
 
-            if(curr_subgroup_settings.sender_rank >= 0) {
-                auto sender_pred = [this, subgroup_num, curr_subgroup_settings, num_shard_members, num_shard_senders](const DerechoSST& sst) {
+            if(curr_subgroup_settings.mode == Mode::ORDERED && curr_subgroup_settings.sender_rank >= 0) {
+                auto sender_pred = [this, subgroup_num, curr_subgroup_settings, &rows, &minima, num_shard_members, num_shard_senders](const DerechoSST& sst) {
                     message_id_t seq_num = next_message_to_deliver[subgroup_num] * num_shard_senders + curr_subgroup_settings.sender_rank;
+                    if(minima.persisted_num < seq_num) {
+                        return false;
+                    }
                     for(uint i = 0; i < num_shard_members; ++i) {
-                        if(sst.delivered_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num] < seq_num
-                           || (sst.persisted_num[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][subgroup_num] < seq_num)) {
+                        if(sst.delivered_num[rows.members[i]][subgroup_num] < seq_num) {
                             return false;
                         }
                     }
                     return true;
                 };
                 auto sender_trig = [this, subgroup_num](DerechoSST& sst) {
-                    sender_cv.notify_all();
+                    wake_sender_thread(subgroup_num);
                     next_message_to_deliver[subgroup_num]++;
                 };
-                sender_pred_handles.emplace_back(sst->predicates.insert(sender_pred, sender_trig,
-                                                                        sst::PredicateType::RECURRENT));
+                sender_pred_handles.emplace_back(subgroup_predicates.insert(sender_pred, sender_trig,
+                                                                        sst::PredicateType::RECURRENT,
+                                                                        "sender_pred subgroup " + std::to_string(subgroup_num)));
             }
+        } else if(curr_subgroup_settings.mode == Mode::FIFO) {
+            // Each sender's messages are delivered as soon as the shard has
+            // received them, so delivery only depends on the minimum of each
+            // sender's num_received entries
+            sst::watch_list_t num_received_watches{{minima.num_received.data(), num_shard_senders}};
+            auto delivery_pred = [this](const DerechoSST& sst) { return true; };
+            auto delivery_trig = [=](DerechoSST& sst) mutable {
+                fifo_delivery_trigger(subgroup_num, curr_subgroup_settings, num_shard_senders, sst);
+            };
+            delivery_pred_handles.emplace_back(subgroup_predicates.insert(delivery_pred, delivery_trig,
+                                                                      sst::PredicateType::RECURRENT,
+                                                                      num_received_watches,
+                                                                      "delivery_pred subgroup " + std::to_string(subgroup_num)));
         } else {
             //This subgroup is in raw mode
             if(curr_subgroup_settings.sender_rank >= 0) {
-                auto sender_pred = [this, subgroup_num, curr_subgroup_settings, num_shard_members](const DerechoSST& sst) {
-                    for(uint i = 0; i < num_shard_members; ++i) {
-                        uint32_t num_received_offset = subgroup_settings.at(subgroup_num).num_received_offset;
-                        if(sst.num_received[node_id_to_sst_index.at(curr_subgroup_settings.members[i])][num_received_offset + curr_subgroup_settings.sender_rank]
-                           < static_cast<int32_t>(future_message_indices[subgroup_num] - 1 - window_size)) {
-                            return false;
-                        }
-                    }
-                    return true;
+                auto sender_pred = [this, subgroup_num, curr_subgroup_settings, &minima](const DerechoSST& sst) {
+                    return minima.num_received[curr_subgroup_settings.sender_rank]
+                           >= static_cast<int32_t>(future_message_indices[subgroup_num] - 1 - curr_subgroup_settings.window_size);
                 };
                 auto sender_trig = [this, subgroup_num](DerechoSST& sst) {
-                    sender_cv.notify_all();
+                    wake_sender_thread(subgroup_num);
                 };
-                sender_pred_handles.emplace_back(sst->predicates.insert(sender_pred, sender_trig,
-                                                                        sst::PredicateType::RECURRENT));
+                sender_pred_handles.emplace_back(subgroup_predicates.insert(sender_pred, sender_trig,
+                                                                        sst::PredicateType::RECURRENT,
+                                                                        "sender_pred subgroup " + std::to_string(subgroup_num)));
+            }
+        }
+        // FIFO and sequenced subgroups track delivery per sender, so a
+        // sender's window opens as the members deliver its own messages
+        if((curr_subgroup_settings.mode == Mode::FIFO || curr_subgroup_settings.mode == Mode::SEQUENCED)
+           && curr_subgroup_settings.sender_rank >= 0) {
+            auto sender_pred = [this, subgroup_num, curr_subgroup_settings, &rows, num_shard_members](const DerechoSST& sst) {
+                const uint32_t num_received_entry = curr_subgroup_settings.num_received_offset + curr_subgroup_settings.sender_rank;
+                for(uint i = 0; i < num_shard_members; ++i) {
+                    if(sst.delivered_index[rows.members[i]][num_received_entry]
+                       < static_cast<int32_t>(future_message_indices[subgroup_num] - 1 - curr_subgroup_settings.window_size)) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+            auto sender_trig = [this, subgroup_num](DerechoSST& sst) {
+                wake_sender_thread(subgroup_num);
+            };
+            sender_pred_handles.emplace_back(subgroup_predicates.insert(sender_pred, sender_trig,
+                                                                    sst::PredicateType::RECURRENT,
+                                                                    "sender_pred subgroup " + std::to_string(subgroup_num)));
+        }
+
+        if(send_gates[subgroup_num].send_token) {
+            // The token moves, or a sender asks for it
+            sst::watch_list_t send_token_watches;
+            for(const uint32_t sender_sst_index : rows.senders) {
+                send_token_watches.emplace_back(&sst->send_token[sender_sst_index][subgroup_num]);
+                send_token_watches.emplace_back(&sst->send_token_wanted[sender_sst_index][subgroup_num]);
+            }
+            auto send_token_pred = [](const DerechoSST& sst) { return true; };
+            auto send_token_trig = [this, subgroup_num](DerechoSST& sst) {
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                update_send_token(subgroup_num);
+            };
+            sender_pred_handles.emplace_back(subgroup_predicates.insert(send_token_pred, send_token_trig,
+                                                                    sst::PredicateType::RECURRENT,
+                                                                    send_token_watches,
+                                                                    "send_token_pred subgroup " + std::to_string(subgroup_num)));
+        }
+
+        if(callbacks.send_space_callback && curr_subgroup_settings.sender_rank >= 0) {
+            // Room opens up in the send window when the shard members deliver
+            // (or, in raw mode, receive) more messages, and in the SST
+            // multicast slots when they receive more SST multicasts from us
+            sst::watch_list_t send_space_watches;
+            for(uint i = 0; i < num_shard_members; ++i) {
+                const auto member_sst_index = rows.members[i];
+                if(curr_subgroup_settings.mode == Mode::ORDERED) {
+                    send_space_watches.emplace_back(&sst->delivered_num[member_sst_index][subgroup_num]);
+                } else if(curr_subgroup_settings.mode == Mode::FIFO || curr_subgroup_settings.mode == Mode::SEQUENCED) {
+                    send_space_watches.emplace_back(&sst->delivered_index[member_sst_index][curr_subgroup_settings.num_received_offset
+                                                                                            + curr_subgroup_settings.sender_rank]);
+                } else {
+                    send_space_watches.emplace_back(&sst->num_received[member_sst_index][curr_subgroup_settings.num_received_offset
+                                                                                         + curr_subgroup_settings.sender_rank]);
+                }
+                send_space_watches.emplace_back(&sst->num_received_sst[member_sst_index][curr_subgroup_settings.num_received_offset
+                                                                                         + curr_subgroup_settings.sender_rank]);
             }
+            auto send_space_pred = [this, subgroup_num](const DerechoSST& sst) {
+                return send_space_wanted[subgroup_num].load(std::memory_order_relaxed);
+            };
+            auto send_space_trig = [this, subgroup_num](DerechoSST& sst) {
+                if(send_space_wanted[subgroup_num].exchange(false)) {
+                    callbacks.send_space_callback(subgroup_num);
+                }
+            };
+            send_space_pred_handles.emplace_back(subgroup_predicates.insert(send_space_pred, send_space_trig,
+                                                                        sst::PredicateType::RECURRENT,
+                                                                        send_space_watches,
+                                                                        "send_space_pred subgroup " + std::to_string(subgroup_num)));
         }
     }
 }
 
 MulticastGroup::~MulticastGroup() {
+    unregister_metrics();
     wedge();
     if(timeout_thread.joinable()) {
         timeout_thread.join();
@@ -975,116 +2268,551 @@ long long unsigned int MulticastGroup::compute_max_msg_size(
     return max_msg_size;
 }
 
+long long unsigned int MulticastGroup::compute_inline_max_msg_size(
+        const long long unsigned int sst_max_msg_size) {
+    const int64_t max_inline_payload_size = getConfInt64(CONF_DERECHO_MAX_INLINE_PAYLOAD_SIZE);
+    if(max_inline_payload_size == 0) {
+        return 0;
+    }
+    // The write also carries the slot's trailer, and the message is padded to a word
+    const uint64_t provider_inline_size = sst::get_max_inline_size();
+    if(provider_inline_size < sizeof(header) + 2 * sizeof(uint64_t)) {
+        return 0;
+    }
+    long long unsigned int inline_max_msg_size = (std::min<uint64_t>(provider_inline_size, sst::cache_line_size)
+                                                  - 2 * sizeof(uint64_t))
+                                                 & ~(sizeof(uint64_t) - 1);
+    if(max_inline_payload_size > 0) {
+        inline_max_msg_size = std::min<long long unsigned int>(inline_max_msg_size, max_inline_payload_size + sizeof(header));
+    }
+    inline_max_msg_size = std::min(inline_max_msg_size, sst_max_msg_size);
+    return inline_max_msg_size >= sizeof(header) ? inline_max_msg_size : 0;
+}
+
+void MulticastGroup::register_metrics() {
+    MetricsRegistry& registry = MetricsRegistry::get();
+    subgroup_metrics.resize(total_num_subgroups);
+    const char* tier_names[] = {"inline", "sst", "rdmc"};
+    for(const auto& [subgroup_num, curr_subgroup_settings] : subgroup_settings) {
+        const std::string subgroup_label = metric_label("subgroup", subgroup_num);
+        SubgroupMetrics& metrics = subgroup_metrics[subgroup_num];
+        for(int tier = 0; tier < 3; ++tier) {
+            metrics.sends_by_tier[tier] = &registry.counter(
+                    "derecho_multicast_sends_total", "Ordered multicasts sent, by transport tier",
+                    subgroup_label + ",tier=\"" + tier_names[tier] + "\"");
+        }
+        metrics.rdmc_bytes_sent = &registry.counter("derecho_rdmc_sent_bytes_total",
+                                                    "Bytes of the RDMC multicasts sent", subgroup_label);
+        metrics.messages_delivered = &registry.counter("derecho_multicast_delivered_total",
+                                                       "Ordered multicasts delivered", subgroup_label);
+        metrics_reader_ids.push_back(registry.add_reader(
+                "derecho_multicast_pending_sends", "RDMC multicasts queued behind the ones being sent",
+                MetricType::GAUGE, subgroup_label, [this, subgroup_num = subgroup_num]() {
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                    return static_cast<double>(pending_sends[subgroup_num].size());
+                }));
+        metrics.persistence_stalls = &registry.counter(
+                "derecho_multicast_persistence_stalls_total",
+                "Ordered multicasts whose send waited for the shard to persist earlier ones", subgroup_label);
+        metrics.persistence_stall_ns = &registry.counter(
+                "derecho_multicast_persistence_stall_nanoseconds_total",
+                "Nanoseconds that sends waited for the shard to persist earlier multicasts", subgroup_label);
+        if(curr_subgroup_settings.mode == Mode::ORDERED) {
+            metrics_reader_ids.push_back(registry.add_reader(
+                    "derecho_multicast_unpersisted", "Ordered multicasts this node has delivered that the shard hasn't all persisted",
+                    MetricType::GAUGE, subgroup_label, [this, subgroup_num = subgroup_num]() {
+                        std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                        const int32_t vid = sst->vid[member_index];
+                        int64_t min_persisted_num = sst->delivered_num[member_index][subgroup_num];
+                        for(const uint32_t sst_index : get_shard_sst_indices(subgroup_num)) {
+                            // A version from an earlier view means nothing of this one is persisted
+                            const auto [persisted_vid, persisted_num] = persistent::unpack_version<int32_t>(sst->persisted_num[sst_index][subgroup_num]);
+                            min_persisted_num = std::min<int64_t>(min_persisted_num, persisted_vid < vid ? -1 : persisted_num);
+                        }
+                        return static_cast<double>(sst->delivered_num[member_index][subgroup_num] - min_persisted_num);
+                    }));
+        }
+        metrics_reader_ids.push_back(registry.add_reader(
+                "derecho_multicast_undelivered", "Ordered multicasts received but not yet stable",
+                MetricType::GAUGE, subgroup_label, [this, subgroup_num = subgroup_num]() {
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                    return static_cast<double>(locally_stable_rdmc_messages[subgroup_num].size()
+                                               + locally_stable_sst_messages[subgroup_num].size());
+                }));
+    }
+    // The SST is replaced with each view, so these restart from 0 after a view change
+    const std::shared_ptr<DerechoSST> view_sst = sst;
+    metrics_reader_ids.push_back(registry.add_reader(
+            "derecho_sst_writes_total", "Remote writes of SST rows in the current view",
+            MetricType::COUNTER, "",
+            [view_sst]() { return static_cast<double>(view_sst->get_put_counters().writes.load(std::memory_order_relaxed)); }));
+    metrics_reader_ids.push_back(registry.add_reader(
+            "derecho_sst_written_bytes_total", "Bytes of the remote writes of SST rows in the current view",
+            MetricType::COUNTER, "",
+            [view_sst]() { return static_cast<double>(view_sst->get_put_counters().bytes.load(std::memory_order_relaxed)); }));
+    for(uint32_t partition = 0; partition < sst->get_num_predicate_partitions(); ++partition) {
+        metrics_reader_ids.push_back(registry.add_reader(
+                "derecho_sst_busy_passes_total", "Passes of a predicate thread in which a predicate fired, in the current view",
+                MetricType::COUNTER, metric_label("partition", partition), [view_sst, partition]() {
+                    return static_cast<double>(view_sst->get_detect_counters(partition).busy_passes.load(std::memory_order_relaxed));
+                }));
+    }
+}
+
+void MulticastGroup::unregister_metrics() {
+    for(const uint64_t reader_id : metrics_reader_ids) {
+        MetricsRegistry::get().remove_reader(reader_id);
+    }
+    metrics_reader_ids.clear();
+}
+
+std::array<uint64_t, 3> MulticastGroup::get_tier_send_counts(subgroup_id_t subgroup_num) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    return tier_send_counts[subgroup_num];
+}
+
+LatencyStats MulticastGroup::get_latency_stats(subgroup_id_t subgroup_num) {
+    LatencyStats stats;
+    if(latency_histograms) {
+        for(std::size_t stage = 0; stage < num_latency_stages; ++stage) {
+            stats[stage] = (*latency_histograms)[subgroup_num][stage].summarize();
+        }
+    }
+    return stats;
+}
+
 void MulticastGroup::wedge() {
     bool thread_shutdown_existing = thread_shutdown.exchange(true);
     if(thread_shutdown_existing) {  // Wedge has already been called
         return;
     }
+    slot_pins->wedge();
+
+    [[maybe_unused]] const uint64_t wedge_start = get_time();
 
-    //Consume and remove all the predicate handles
-    for(auto handle_iter = sender_pred_handles.begin(); handle_iter != sender_pred_handles.end();) {
-        sst->predicates.remove(*handle_iter);
-        handle_iter = sender_pred_handles.erase(handle_iter);
+    //Consume and remove all the predicate handles, taking each partition's locks once
+    std::list<pred_handle> all_pred_handles;
+    for(std::list<pred_handle>* handles : {&sender_pred_handles, &receiver_pred_handles, &stability_pred_handles,
+                                           &delivery_pred_handles, &persistence_pred_handles, &sequencer_pred_handles,
+                                           &send_space_pred_handles, &shard_minima_handles}) {
+        all_pred_handles.splice(all_pred_handles.end(), *handles);
     }
-    for(auto handle_iter = receiver_pred_handles.begin(); handle_iter != receiver_pred_handles.end();) {
-        sst->predicates.remove(*handle_iter);
-        handle_iter = receiver_pred_handles.erase(handle_iter);
+    sst->predicates.remove_all(all_pred_handles);
+    [[maybe_unused]] const uint64_t predicates_removed = get_time();
+    // Nothing more can be queued, and the messages that were must be
+    // delivered before the view change delivers the rest
+    stop_delivery_executors();
+    [[maybe_unused]] const uint64_t executors_stopped = get_time();
+    // A sender waiting for room should try again in the next view
+    if(callbacks.send_space_callback) {
+        for(const auto& subgroup_settings_pair : subgroup_settings) {
+            if(send_space_wanted[subgroup_settings_pair.first].exchange(false)) {
+                callbacks.send_space_callback(subgroup_settings_pair.first);
+            }
+        }
     }
-    for(auto handle_iter = stability_pred_handles.begin(); handle_iter != stability_pred_handles.end();) {
-        sst->predicates.remove(*handle_iter);
-        handle_iter = stability_pred_handles.erase(handle_iter);
+
+    for(const auto& subgroup_settings_pair : subgroup_settings) {
+        multicast_log(DEBUG, "Subgroup {} sent {} messages inline, {} by SST and {} by RDMC", subgroup_settings_pair.first,
+                             tier_send_counts[subgroup_settings_pair.first][static_cast<int>(TransportTier::INLINE)],
+                             tier_send_counts[subgroup_settings_pair.first][static_cast<int>(TransportTier::SST)],
+                             tier_send_counts[subgroup_settings_pair.first][static_cast<int>(TransportTier::RDMC)]);
     }
-    for(auto handle_iter = delivery_pred_handles.begin(); handle_iter != delivery_pred_handles.end();) {
-        sst->predicates.remove(*handle_iter);
-        handle_iter = delivery_pred_handles.erase(handle_iter);
+
+    // Nothing can use the groups once they are detached; destroying them
+    // is left until this MulticastGroup goes away with its view
+    retired_rdmc_groups = rdmc::detach_groups(rdmc_group_numbers);
+    [[maybe_unused]] const uint64_t rdmc_groups_detached = get_time();
+
+    for(auto& wakeup : sender_wakeups) {
+        {
+            std::lock_guard<std::mutex> lock(wakeup.mtx);
+            wakeup.count++;
+        }
+        wakeup.cv.notify_all();
     }
-    for(auto handle_iter = persistence_pred_handles.begin(); handle_iter != persistence_pred_handles.end();) {
-        sst->predicates.remove(*handle_iter);
-        handle_iter = persistence_pred_handles.erase(handle_iter);
+    for(auto& sender_thread : sender_threads) {
+        if(sender_thread.joinable()) {
+            sender_thread.join();
+        }
     }
+    whenlog(const uint64_t wedge_end = get_time();
+            logger->debug("Wedged in {} us: predicates {} us, delivery executors {} us, "
+                          "RDMC groups {} us, sender threads {} us",
+                          (wedge_end - wedge_start) / 1000, (predicates_removed - wedge_start) / 1000,
+                          (executors_stopped - predicates_removed) / 1000,
+                          (rdmc_groups_detached - executors_stopped) / 1000,
+                          (wedge_end - rdmc_groups_detached) / 1000););
+}
 
-    for(uint i = 0; i < num_members; ++i) {
-        rdmc::destroy_group(i + rdmc_group_num_offset);
+void MulticastGroup::wake_sender_thread(subgroup_id_t subgroup_num) {
+    SenderWakeup& wakeup = sender_wakeups[subgroup_num % num_sender_threads];
+    {
+        std::lock_guard<std::mutex> lock(wakeup.mtx);
+        wakeup.count++;
     }
+    wakeup.cv.notify_all();
+}
 
-    sender_cv.notify_all();
-    if(sender_thread.joinable()) {
-        sender_thread.join();
+void MulticastGroup::queue_rdmc_send(subgroup_id_t subgroup_num, RDMCMessage&& msg) {
+    pending_sends[subgroup_num].push(std::move(msg));
+    queued_rdmc_sends[subgroup_num]++;
+}
+
+uint64_t MulticastGroup::current_send_token(subgroup_id_t subgroup_num) const {
+    uint64_t token = 0;
+    for(const uint32_t sst_index : send_gates[subgroup_num].sender_sst_indices) {
+        token = std::max<uint64_t>(token, sst->send_token[sst_index][subgroup_num]);
     }
+    return token;
 }
 
-void MulticastGroup::send_loop() {
-    pthread_setname_np(pthread_self(), "sender_thread");
-    subgroup_id_t subgroup_to_send = 0;
-    auto should_send_to_subgroup = [&](subgroup_id_t subgroup_num) {
-        if(!rdmc_sst_groups_created) {
-            return false;
+bool MulticastGroup::take_send_token(subgroup_id_t subgroup_num) {
+    SendGate& gate = send_gates[subgroup_num];
+    const uint64_t token = current_send_token(subgroup_num);
+    if(token % gate.num_shard_senders != static_cast<uint32_t>(gate.shard_sender_index)) {
+        return false;
+    }
+    if(token != gate.held_token) {
+        gate.held_token = token;
+        gate.token_turn_sends = 0;
+    }
+    if(sst->send_token_wanted[member_index][subgroup_num]) {
+        sst->send_token_wanted[member_index][subgroup_num] = false;
+        sst->put_range(gate.shard_sst_indices, sst->send_token_wanted, subgroup_num, 1);
+    }
+    return true;
+}
+
+void MulticastGroup::update_send_token(subgroup_id_t subgroup_num) {
+    SendGate& gate = send_gates[subgroup_num];
+    if(!take_send_token(subgroup_num)) {
+        return;
+    }
+    // The turn lasts until the sends started in it are done
+    if(std::any_of(current_sends[subgroup_num].begin(), current_sends[subgroup_num].end(),
+                   [](const std::optional<RDMCMessage>& current_send) { return current_send.has_value(); })) {
+        return;
+    }
+    if(should_send_to_subgroup(subgroup_num)) {
+        wake_sender_thread(subgroup_num);
+        return;
+    }
+    // Either the turn is used up or this node can't send now, which must
+    // not hold up the senders whose messages it may be waiting for
+    const uint64_t token = gate.held_token;
+    for(uint32_t step = 1; step < gate.num_shard_senders; ++step) {
+        const uint32_t sender_rank = (gate.shard_sender_index + step) % gate.num_shard_senders;
+        if(sst->send_token_wanted[gate.sender_sst_indices[sender_rank]][subgroup_num]) {
+            multicast_log(TRACE, "Subgroup {}, passing the send token to sender rank {}", subgroup_num, sender_rank);
+            sst->send_token[member_index][subgroup_num] = token + step;
+            sst->put_range(gate.shard_sst_indices, sst->send_token, subgroup_num, 1);
+            return;
         }
-        if(pending_sends[subgroup_num].empty()) {
-            return false;
+    }
+    // Nobody else is waiting, so a used-up turn starts over
+    if(gate.token_turn_sends > 0 && !pending_sends[subgroup_num].empty()) {
+        gate.token_turn_sends = 0;
+        wake_sender_thread(subgroup_num);
+    }
+}
+
+void MulticastGroup::post_persistence_request(subgroup_id_t subgroup_num, persistent::version_t version) {
+    std::get<1>(persistence_manager_callbacks)(subgroup_num, version);
+    if(subgroup_settings.at(subgroup_num).persist_in_memory) {
+        // Delivery means the whole shard has the message in memory
+        sst->persisted_num[member_index][subgroup_num] = version;
+        sst->put_range(shard_rows[subgroup_num].members, sst->persisted_num, subgroup_num, 1);
+    }
+}
+
+void MulticastGroup::compress_rdmc_message(subgroup_id_t subgroup_num, RDMCMessage& msg) {
+    header* h = reinterpret_cast<header*>(msg.message_buffer.buffer);
+    h->compressed = false;
+    const uint64_t payload_size = msg.size - h->header_size;
+    // The compressed payload and its size must fit in the space of the payload
+    if(payload_size <= sizeof(payload_size) || msg.message_buffer.mr->cuda_device >= 0) {
+        return;
+    }
+    MessageBuffer wire_buffer = buffer_pools[subgroup_num]->acquire(msg.size);
+    // Without a free buffer the message is just sent as it is
+    if(!wire_buffer.buffer) {
+        return;
+    }
+    char* compressed_payload = wire_buffer.buffer + h->header_size + sizeof(payload_size);
+    const uint64_t compressed_size = persistent::compressData(persistent::LOG_CODEC_LZ4,
+                                                              msg.message_buffer.buffer + h->header_size, payload_size,
+                                                              compressed_payload, payload_size - sizeof(payload_size));
+    if(compressed_size == 0) {
+        buffer_pools[subgroup_num]->release(std::move(wire_buffer));
+        return;
+    }
+    memcpy(wire_buffer.buffer, h, h->header_size);
+    reinterpret_cast<header*>(wire_buffer.buffer)->compressed = true;
+    memcpy(wire_buffer.buffer + h->header_size, &payload_size, sizeof(payload_size));
+    msg.wire_size = h->header_size + sizeof(payload_size) + compressed_size;
+    msg.wire_buffer = std::move(wire_buffer);
+}
+
+void MulticastGroup::decompress_rdmc_message(subgroup_id_t subgroup_num, RDMCMessage& msg) {
+    const uint32_t header_size = reinterpret_cast<header*>(msg.message_buffer.buffer)->header_size;
+    const uint64_t compressed_offset = header_size + sizeof(uint64_t);
+    const uint64_t max_msg_size = subgroup_settings.at(subgroup_num).max_msg_size;
+    if(msg.size < compressed_offset || header_size > max_msg_size) {
+        throw derecho_exception("Received a compressed RDMC message in subgroup " + std::to_string(subgroup_num)
+                                + " that is too short to hold its payload size");
+    }
+    uint64_t payload_size;
+    memcpy(&payload_size, msg.message_buffer.buffer + header_size, sizeof(payload_size));
+    // The sender compressed a message that fit in the subgroup's buffers
+    if(payload_size > max_msg_size - header_size) {
+        throw derecho_exception("Received a compressed RDMC message in subgroup " + std::to_string(subgroup_num)
+                                + " whose payload of " + std::to_string(payload_size)
+                                + " bytes is larger than the subgroup's messages");
+    }
+    MessageBuffer raw_buffer = buffer_pools[subgroup_num]->acquire(header_size + payload_size);
+    if(!raw_buffer.buffer) {
+        throw derecho_exception("Subgroup " + std::to_string(subgroup_num)
+                                + " has no free buffer to decompress a received RDMC message into");
+    }
+    memcpy(raw_buffer.buffer, msg.message_buffer.buffer, header_size);
+    reinterpret_cast<header*>(raw_buffer.buffer)->compressed = false;
+    try {
+        // fails unless the data decompresses to exactly payload_size bytes
+        persistent::decompressData(persistent::LOG_CODEC_LZ4, msg.message_buffer.buffer + compressed_offset,
+                                   msg.size - compressed_offset, raw_buffer.buffer + header_size, payload_size);
+    } catch(unsigned long long) {
+        // the codecs throw PERSIST_EXP_CODEC, which is an unsigned long long
+        buffer_pools[subgroup_num]->release(std::move(raw_buffer));
+        throw derecho_exception("Received a compressed RDMC message in subgroup " + std::to_string(subgroup_num)
+                                + " that does not decompress to the " + std::to_string(payload_size)
+                                + " bytes it says it holds");
+    }
+    buffer_pools[subgroup_num]->release(std::move(msg.message_buffer));
+    msg.message_buffer = std::move(raw_buffer);
+    msg.size = header_size + payload_size;
+}
+
+bool MulticastGroup::higher_priority_sends_queued(subgroup_id_t subgroup_num) const {
+    for(const subgroup_id_t other : send_gates[subgroup_num].higher_priority_subgroups) {
+        if(queued_rdmc_sends[other].load(std::memory_order_relaxed) > 0) {
+            return true;
         }
-        RDMCMessage& msg = pending_sends[subgroup_num].front();
+    }
+    return false;
+}
 
-        int shard_sender_index = subgroup_settings.at(subgroup_num).sender_rank;
-        std::vector<int> shard_senders = subgroup_settings.at(subgroup_num).senders;
-        uint32_t num_shard_senders = get_num_senders(shard_senders);
-        assert(shard_sender_index >= 0);
+void MulticastGroup::release_lower_priority_senders(subgroup_id_t subgroup_num) {
+    for(const auto& p : subgroup_settings) {
+        if(p.second.sender_rank >= 0 && p.second.send_priority < send_gates[subgroup_num].send_priority
+           && send_space_wanted[p.first].exchange(false)) {
+            callbacks.send_space_callback(p.first);
+        }
+    }
+}
+
+bool MulticastGroup::should_send_to_subgroup(subgroup_id_t subgroup_num) {
+    if(!rdmc_sst_groups_created) {
+        return false;
+    }
+    if(pending_sends[subgroup_num].empty()) {
+        return false;
+    }
+    RDMCMessage& msg = pending_sends[subgroup_num].front();
+    SendGate& gate = send_gates[subgroup_num];
+    assert(gate.shard_sender_index >= 0);
+
+    // Leave room for the messages still in flight on the other lanes
+    if(std::none_of(current_sends[subgroup_num].begin(), current_sends[subgroup_num].end(),
+                    [](const std::optional<RDMCMessage>& current_send) { return !current_send; })) {
+        return false;
+    }
+    if(sst->num_received[member_index][gate.num_received_offset + gate.shard_sender_index]
+       < msg.index - static_cast<int32_t>(gate.max_outstanding_rdmc_sends)) {
+        return false;
+    }
 
-        if(sst->num_received[member_index][subgroup_settings.at(subgroup_num).num_received_offset + shard_sender_index] < msg.index - 1) {
+    assert(gate.shard_sst_indices.size() >= 1);
+    if(gate.mode == Mode::ORDERED) {
+        const message_id_t min_num = (msg.index - gate.effective_window) * gate.num_shard_senders + gate.shard_sender_index;
+        // persisted_num is a version, so compare it with the version of the
+        // message persistence_window messages back, if there is one
+        const message_id_t min_persisted_num = (msg.index - static_cast<int32_t>(gate.persistence_window))
+                                                       * gate.num_shard_senders
+                                               + gate.shard_sender_index;
+        const persistent::version_t min_persisted_version = persistent::combine_int32s(sst->vid[member_index], min_persisted_num);
+        bool persistence_behind = false;
+        for(const uint32_t sst_index : gate.shard_sst_indices) {
+            if(sst->delivered_num[sst_index][subgroup_num] < min_num) {
+                return false;
+            }
+            persistence_behind = persistence_behind
+                                 || (min_persisted_num >= 0 && sst->persisted_num[sst_index][subgroup_num] < min_persisted_version);
+        }
+        if(persistence_behind) {
+            if(!gate.persistence_stall_start) {
+                gate.persistence_stall_start = get_time();
+                subgroup_metrics[subgroup_num].persistence_stalls->add();
+            }
             return false;
         }
-
-        std::vector<node_id_t> shard_members = subgroup_settings.at(subgroup_num).members;
-        auto num_shard_members = shard_members.size();
-        assert(num_shard_members >= 1);
-        if(subgroup_settings.at(subgroup_num).mode != Mode::UNORDERED) {
-            for(uint i = 0; i < num_shard_members; ++i) {
-                if(sst->delivered_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < static_cast<message_id_t>((msg.index - window_size) * num_shard_senders + shard_sender_index)
-                   || (sst->persisted_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < static_cast<message_id_t>((msg.index - window_size) * num_shard_senders + shard_sender_index))) {
-                    return false;
-                }
+        if(gate.persistence_stall_start) {
+            subgroup_metrics[subgroup_num].persistence_stall_ns->add(get_time() - gate.persistence_stall_start);
+            gate.persistence_stall_start = 0;
+        }
+    } else if(gate.mode == Mode::FIFO || gate.mode == Mode::SEQUENCED) {
+        const int32_t min_index = msg.index - static_cast<int32_t>(gate.effective_window);
+        for(const uint32_t sst_index : gate.shard_sst_indices) {
+            if(sst->delivered_index[sst_index][gate.num_received_offset + gate.shard_sender_index] < min_index) {
+                return false;
             }
-        } else {
-            for(uint i = 0; i < num_shard_members; ++i) {
-                auto num_received_offset = subgroup_settings.at(subgroup_num).num_received_offset;
-                if(sst->num_received[node_id_to_sst_index.at(shard_members[i])][num_received_offset + shard_sender_index]
-                   < static_cast<int32_t>(future_message_indices[subgroup_num] - 1 - window_size)) {
-                    return false;
-                }
+        }
+    } else {
+        const int32_t min_received = static_cast<int32_t>(future_message_indices[subgroup_num] - 1 - gate.effective_window);
+        for(const uint32_t sst_index : gate.shard_sst_indices) {
+            if(sst->num_received[sst_index][gate.num_received_offset + gate.shard_sender_index] < min_received) {
+                return false;
             }
         }
+    }
 
-        return true;
+    // Only the holder of the send token may start an RDMC send
+    if(gate.send_token) {
+        if(!take_send_token(subgroup_num)) {
+            if(!sst->send_token_wanted[member_index][subgroup_num]) {
+                sst->send_token_wanted[member_index][subgroup_num] = true;
+                sst->put_range(gate.shard_sst_indices, sst->send_token_wanted, subgroup_num, 1);
+            }
+            return false;
+        }
+        if(gate.token_turn_sends >= gate.max_outstanding_rdmc_sends) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MulticastGroup::send_loop(uint32_t thread_index) {
+    if(num_sender_threads == 1) {
+        name_and_pin_thread("sender_thread");
+    } else {
+        // Thread names are limited to 16 characters
+        name_and_pin_thread("sender_thread_" + std::to_string(thread_index % 100));
+    }
+    // The subgroups this thread sends in: the ones this node is a sender in
+    // that hash to this thread
+    std::vector<subgroup_id_t> my_subgroups;
+    // The same subgroups by send_priority, highest first. Each class keeps
+    // its turn: the subgroup whose turn it is, and the sends it has left.
+    struct PriorityClass {
+        std::vector<subgroup_id_t> subgroups;
+        std::size_t turn = 0;
+        uint32_t sends_left = 0;
     };
-    auto should_send = [&]() {
-        for(uint i = 1; i <= total_num_subgroups; ++i) {
-            auto subgroup_num = (subgroup_to_send + i) % total_num_subgroups;
-            if(should_send_to_subgroup(subgroup_num)) {
-                subgroup_to_send = subgroup_num;
+    std::map<int, PriorityClass, std::greater<int>> priority_classes;
+    for(const auto& p : subgroup_settings) {
+        if(p.second.sender_rank >= 0 && p.first % num_sender_threads == thread_index) {
+            my_subgroups.push_back(p.first);
+            priority_classes[p.second.send_priority].subgroups.push_back(p.first);
+        }
+    }
+    SenderWakeup& wakeup = sender_wakeups[thread_index];
+    FaultInjector& fault_injector = FaultInjector::get();
+    // The subgroup whose last queued message was just sent, if a lower
+    // priority subgroup's SST sends may have been waiting for that
+    std::optional<subgroup_id_t> drained_subgroup;
+    // Checks the subgroups one class at a time, and each class's subgroups
+    // once, starting with the one whose turn it is, and sends the first
+    // pending message that is ready. A subgroup keeps the turn for
+    // send_weight sends in a row. Only one subgroup's lock is held at a
+    // time, so a busy subgroup doesn't hold up the others.
+    auto try_send_in_class = [&](PriorityClass& priority_class) {
+        const std::size_t num_subgroups = priority_class.subgroups.size();
+        for(std::size_t i = 0; i < num_subgroups; ++i) {
+            const std::size_t position = (priority_class.turn + i) % num_subgroups;
+            const subgroup_id_t subgroup_num = priority_class.subgroups[position];
+            std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+            if(thread_shutdown || !should_send_to_subgroup(subgroup_num)) {
+                continue;
+            }
+            if(position != priority_class.turn || priority_class.sends_left == 0) {
+                priority_class.turn = position;
+                priority_class.sends_left = std::max(1u, subgroup_settings.at(subgroup_num).send_weight);
+            }
+            if(--priority_class.sends_left == 0) {
+                priority_class.turn = (position + 1) % num_subgroups;
+            }
+            const subgroup_id_t subgroup_to_send = subgroup_num;
+            auto& lanes = current_sends[subgroup_to_send];
+            const uint32_t lane = std::distance(lanes.begin(),
+                                                std::find_if(lanes.begin(), lanes.end(),
+                                                             [](const std::optional<RDMCMessage>& current_send) { return !current_send; }));
+            auto& current_send = lanes[lane];
+            current_send = std::move(pending_sends[subgroup_to_send].front());
+            if(subgroup_settings.at(subgroup_to_send).rdmc_compression) {
+                compress_rdmc_message(subgroup_to_send, *current_send);
+            }
+            const MessageBuffer& wire_buffer = current_send->wire_buffer.buffer ? current_send->wire_buffer
+                                                                                : current_send->message_buffer;
+            const long long unsigned int wire_size = current_send->wire_buffer.buffer ? current_send->wire_size
+                                                                                      : current_send->size;
+            // DERECHO_LOG(-1, -1, "got_current_send");
+            multicast_log(TRACE, "Calling send in subgroup {} on message {} from sender {} on lane {}", subgroup_to_send, current_send->index, current_send->sender_id, lane);
+            // DERECHO_LOG(-1, -1, "did_log_event");
+            if(!rdmc::send(subgroup_to_rdmc_group[subgroup_to_send][lane],
+                           wire_buffer.mr, wire_buffer.offset, wire_size)) {
+                throw std::runtime_error("rdmc::send returned false");
+            }
+            DERECHO_LOG(subgroup_to_send, current_send->index, "issued_rdmc_send");
+            send_gates[subgroup_to_send].token_turn_sends++;
+            subgroup_metrics[subgroup_to_send].rdmc_bytes_sent->add(wire_size);
+            pending_sends[subgroup_to_send].pop();
+            if(--queued_rdmc_sends[subgroup_to_send] == 0 && callbacks.send_space_callback) {
+                drained_subgroup = subgroup_to_send;
+            }
+            return true;
+        }
+        return false;
+    };
+    auto try_send = [&]() {
+        for(auto& [priority, priority_class] : priority_classes) {
+            if(try_send_in_class(priority_class)) {
                 return true;
             }
         }
         return false;
     };
-    auto should_wake = [&]() { return thread_shutdown || should_send(); };
     try {
-        std::unique_lock<std::mutex> lock(msg_state_mtx);
         while(!thread_shutdown) {
-            sender_cv.wait(lock, should_wake);
-            // DERECHO_LOG(send_cnt, -1, "sender thread woke up");
-            if(!thread_shutdown) {
-                current_sends[subgroup_to_send] = std::move(pending_sends[subgroup_to_send].front());
-                // DERECHO_LOG(-1, -1, "got_current_send");
-                whenlog(logger->trace("Calling send in subgroup {} on message {} from sender {}", subgroup_to_send, current_sends[subgroup_to_send]->index, current_sends[subgroup_to_send]->sender_id););
-                // DERECHO_LOG(-1, -1, "did_log_event");
-                if(!rdmc::send(subgroup_to_rdmc_group[subgroup_to_send],
-                               current_sends[subgroup_to_send]->message_buffer.mr, 0,
-                               current_sends[subgroup_to_send]->size)) {
-                    throw std::runtime_error("rdmc::send returned false");
+            // Read the wakeup count before checking the subgroups, so any
+            // wakeup that arrives while they are being checked is noticed
+            uint64_t wakeups_seen;
+            {
+                std::lock_guard<std::mutex> lock(wakeup.mtx);
+                wakeups_seen = wakeup.count;
+            }
+            // An injected freeze stops the sender without holding any subgroup's lock
+            if(fault_injector.enabled()) {
+                fault_injector.before_send();
+            }
+            const uint64_t next_deadline = flush_expired_rpc_aggregates(my_subgroups);
+            if(try_send()) {
+                if(drained_subgroup) {
+                    release_lower_priority_senders(*drained_subgroup);
+                    drained_subgroup.reset();
                 }
-                // DERECHO_LOG(-1, -1, "issued_rdmc_send");
-                pending_sends[subgroup_to_send].pop();
+                continue;
             }
+            std::unique_lock<std::mutex> lock(wakeup.mtx);
+            auto woken = [&]() { return thread_shutdown || wakeup.count != wakeups_seen; };
+            if(next_deadline) {
+                const uint64_t current_time = get_time();
+                wakeup.cv.wait_for(lock, std::chrono::nanoseconds(next_deadline > current_time ? next_deadline - current_time : 0), woken);
+            } else {
+                wakeup.cv.wait(lock, woken);
+            }
+            // DERECHO_LOG(send_cnt, -1, "sender thread woke up");
         }
         std::cout << "DerechoGroup send thread shutting down" << std::endl;
     } catch(const std::exception& e) {
@@ -1093,31 +2821,44 @@ void MulticastGroup::send_loop() {
 }
 
 uint64_t MulticastGroup::get_time() {
-    struct timespec start_time;
-    clock_gettime(CLOCK_REALTIME, &start_time);
-    return start_time.tv_sec * 1e9 + start_time.tv_nsec;
+    // the clock of the HLCs, so that message timestamps and versions' HLCs agree
+    return read_rtc_ns();
 }
 
 const uint64_t MulticastGroup::compute_global_stability_frontier(uint32_t subgroup_num) {
-    auto global_stability_frontier = sst->local_stability_frontier[member_index][subgroup_num];
-    auto shard_sst_indices = get_shard_sst_indices(subgroup_num);
-    for(auto index : shard_sst_indices) {
-        global_stability_frontier = std::min(global_stability_frontier, static_cast<uint64_t>(sst->local_stability_frontier[index][subgroup_num]));
-    }
-    return global_stability_frontier;
+    // This node's own row is one of the shard's rows
+    return min_over_rows(&sst->local_stability_frontier[0][subgroup_num], shard_rows[subgroup_num].member_offsets);
+}
+
+persistent::version_t MulticastGroup::compute_global_persistence_frontier(subgroup_id_t subgroup_num) {
+    return min_over_rows(&sst->persisted_num[0][subgroup_num], shard_rows[subgroup_num].member_offsets);
 }
 
 void MulticastGroup::check_failures_loop() {
-    pthread_setname_np(pthread_self(), "timeout_thread");
+    name_and_pin_thread("timeout_thread");
+    uint64_t last_latency_stats_dump = get_time();
     while(!thread_shutdown) {
         std::this_thread::sleep_for(std::chrono::milliseconds(sender_timeout));
         if(sst) {
-            std::unique_lock<std::mutex> lock(msg_state_mtx);
             auto current_time = get_time();
-            for(auto p : subgroup_settings) {
-                auto subgroup_num = p.first;
-                auto members = p.second.members;
-                auto sst_indices = get_shard_sst_indices(subgroup_num);
+            if(latency_histograms && latency_stats_dump_interval_ns > 0
+               && current_time - last_latency_stats_dump >= latency_stats_dump_interval_ns) {
+                last_latency_stats_dump = current_time;
+                for(const auto& p : subgroup_settings) {
+                    std::cout << "Latency of the messages in subgroup " << p.first << ":" << std::endl
+                              << get_latency_stats(p.first) << std::endl;
+                }
+            }
+            for(const auto& p : subgroup_settings) {
+                const subgroup_id_t subgroup_num = p.first;
+                // An unordered subgroup has no pending messages to hold its
+                // frontier back, so there is nothing to look at under the lock
+                if(p.second.mode == Mode::UNORDERED) {
+                    sst->local_stability_frontier[member_index][subgroup_num] = current_time;
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+                const auto& sst_indices = get_shard_sst_indices(subgroup_num);
                 // clean up timestamps of persisted messages
                 auto min_persisted_num = sst->persisted_num[member_index][subgroup_num];
                 for(auto i : sst_indices) {
@@ -1125,90 +2866,230 @@ void MulticastGroup::check_failures_loop() {
                         min_persisted_num = sst->persisted_num[i][subgroup_num];
                     }
                 }
-                while(!pending_persistence[subgroup_num].empty() && pending_persistence[subgroup_num].begin()->first <= min_persisted_num) {
-                    auto timestamp = pending_persistence[subgroup_num].begin()->second;
-                    pending_persistence[subgroup_num].erase(pending_persistence[subgroup_num].begin());
+                while(!pending_persistence[subgroup_num].empty() && pending_persistence[subgroup_num].front_seq() <= min_persisted_num) {
+                    auto timestamp = pending_persistence[subgroup_num].front();
+                    pending_persistence[subgroup_num].pop_front();
                     pending_message_timestamps[subgroup_num].erase(timestamp);
                 }
                 if(pending_message_timestamps[subgroup_num].empty()) {
                     sst->local_stability_frontier[member_index][subgroup_num] = current_time;
                 } else {
                     sst->local_stability_frontier[member_index][subgroup_num] = std::min(current_time,
-                                                                                         *pending_message_timestamps[subgroup_num].begin());
+                                                                                         pending_message_timestamps[subgroup_num].front());
                 }
             }
-            sst->put_with_completion((char*)std::addressof(sst->local_stability_frontier[0][0]) - sst->getBaseAddress(),
-                                     sizeof(sst->local_stability_frontier[0][0]) * sst->local_stability_frontier.size());
+            // The heartbeat follows the frontier, so one write carries both
+            sst->heartbeat[member_index]++;
+            const char* frontier_start = (const char*)std::addressof(sst->local_stability_frontier[0][0]);
+            const char* heartbeat_end = (const char*)std::addressof(sst->heartbeat[0]) + sizeof(sst->heartbeat[0]);
+            sst->put_with_completion(frontier_start - sst->getBaseAddress(), heartbeat_end - frontier_start);
+            if(failure_phi_threshold > 0) {
+                check_heartbeats(get_time());
+            }
         }
     }
 
     std::cout << "timeout_thread shutting down" << std::endl;
 }
 
-// we already hold the lock on msg_state_mtx when we call this
-void MulticastGroup::get_buffer_and_send_auto_null(subgroup_id_t subgroup_num) {
+void MulticastGroup::check_heartbeats(uint64_t current_time) {
+    const double min_deviation = sender_timeout * 1e6 / 2;
+    for(uint32_t row = 0; row < num_members; ++row) {
+        HeartbeatHistory& history = heartbeat_histories[row];
+        if(row == member_index || history.reported) {
+            continue;
+        }
+        const uint64_t heartbeat = sst->heartbeat[row];
+        if(heartbeat != history.last_heartbeat) {
+            if(history.last_arrival != 0) {
+                // An exponential moving average weights the recent jitter
+                const double interval = current_time - history.last_arrival;
+                const double difference = interval - history.mean_interval;
+                const double weight = history.num_intervals < 8 ? 1.0 / (history.num_intervals + 1) : 1.0 / 8;
+                history.mean_interval += weight * difference;
+                history.interval_variance = (1 - weight) * (history.interval_variance + weight * difference * difference);
+                history.num_intervals++;
+            }
+            history.last_heartbeat = heartbeat;
+            history.last_arrival = current_time;
+            continue;
+        }
+        if(history.last_arrival == 0) {
+            // Start timing from the first check, in case it never sends one
+            history.last_arrival = current_time;
+            continue;
+        }
+        if(history.num_intervals < 8) {
+            continue;
+        }
+        const double deviation = std::max(std::sqrt(history.interval_variance), min_deviation);
+        const double y = (current_time - history.last_arrival - history.mean_interval) / deviation;
+        // A logistic approximation of the normal distribution's tail
+        const double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+        const double p_later = y > 0 ? e / (1 + e) : 1 - 1 / (1 + e);
+        const double phi = -std::log10(std::max(p_later, std::numeric_limits<double>::min()));
+        if(phi >= failure_phi_threshold) {
+            whenlog(logger->info("Suspecting row {}: no heartbeat for {} ns, phi = {}", row,
+                                 current_time - history.last_arrival, phi););
+            history.reported = true;
+            sst->freeze(row);
+        }
+    }
+}
+
+// we already hold the subgroup's lock in msg_state_mtxs when we call this
+void MulticastGroup::get_buffer_and_send_auto_null(subgroup_id_t subgroup_num, uint32_t num_nulls) {
+    // A packed message has a lower index than the nulls, so it must go first
+    flush_rpc_aggregate(subgroup_num);
+    if(skip_null_messages && skip_null_indices(subgroup_num, num_nulls)) {
+        return;
+    }
     // std::cout << "Sending a null message" << std::endl;
     // short-circuits most of the normal checks because
     // we know that we received a message and are sending a null
     long long unsigned int msg_size = sizeof(header);
     // very unlikely that msg_size does not fit in the max_msg_size since we are sending a NULL
     // but the user might not be interested in using SSTMC at all, then sst::max_msg_size can be zero
-    if(msg_size > sst_max_msg_size) {
-        // Create new Message
-        RDMCMessage msg;
-        msg.sender_id = members[member_index];
-        msg.index = future_message_indices[subgroup_num];
-        msg.size = msg_size;
-        msg.message_buffer = std::move(free_message_buffers[subgroup_num].back());
-        free_message_buffers[subgroup_num].pop_back();
+    if(msg_size > subgroup_settings.at(subgroup_num).sst_max_msg_size) {
+        for(uint32_t i = 0; i < num_nulls; ++i) {
+            // Create new Message
+            RDMCMessage msg;
+            msg.sender_id = members[member_index];
+            msg.index = future_message_indices[subgroup_num];
+            msg.size = msg_size;
+            // The nulls only catch up to the other senders, who are inside the window
+            msg.message_buffer = buffer_pools[subgroup_num]->acquire(msg_size);
+            if(!msg.message_buffer.buffer) {
+                throw derecho_exception("Subgroup " + std::to_string(subgroup_num)
+                                        + " has no free buffer for a null message");
+            }
 
-        auto current_time = get_time();
-        pending_message_timestamps[subgroup_num].insert(current_time);
+            auto current_time = get_time();
+            pending_message_timestamps[subgroup_num].push_back(current_time);
+
+            // Fill header
+            char* buf = msg.message_buffer.buffer;
+            ((header*)buf)->header_size = sizeof(header);
+            ((header*)buf)->index = msg.index;
+            ((header*)buf)->timestamp = current_time;
+            ((header*)buf)->cooked_send = false;
+            ((header*)buf)->aggregated = false;
+            ((header*)buf)->compressed = false;
+            ((header*)buf)->reserved_flags = 0;
+
+            future_message_indices[subgroup_num]++;
+            queue_rdmc_send(subgroup_num, std::move(msg));
+        }
+        wake_sender_thread(subgroup_num);
+    } else {
+        for(uint32_t i = 0; i < num_nulls; ++i) {
+            char* buf = (char*)sst_multicast_group_ptrs[subgroup_num]->get_buffer(msg_size);
 
-        // Fill header
-        char* buf = msg.message_buffer.buffer.get();
-        ((header*)buf)->header_size = sizeof(header);
-        ((header*)buf)->index = msg.index;
-        ((header*)buf)->timestamp = current_time;
-        ((header*)buf)->cooked_send = false;
+            assert(buf);
 
-        future_message_indices[subgroup_num]++;
-        pending_sends[subgroup_num].push(std::move(msg));
-        sender_cv.notify_all();
-    } else {
-        char* buf = (char*)sst_multicast_group_ptrs[subgroup_num]->get_buffer(msg_size);
+            auto current_time = get_time();
+            pending_message_timestamps[subgroup_num].push_back(current_time);
 
-        assert(buf);
+            ((header*)buf)->header_size = sizeof(header);
+            ((header*)buf)->index = future_message_indices[subgroup_num];
+            ((header*)buf)->timestamp = current_time;
+            ((header*)buf)->cooked_send = false;
+            ((header*)buf)->aggregated = false;
+            ((header*)buf)->compressed = false;
+            ((header*)buf)->reserved_flags = 0;
 
-        auto current_time = get_time();
-        pending_message_timestamps[subgroup_num].insert(current_time);
+            future_message_indices[subgroup_num]++;
+        }
+        // the nulls are sent together, with one doorbell per member
+        sst_multicast_group_ptrs[subgroup_num]->send_batch(num_nulls);
+    }
+}
 
-        ((header*)buf)->header_size = sizeof(header);
-        ((header*)buf)->index = future_message_indices[subgroup_num];
-        ((header*)buf)->timestamp = current_time;
-        ((header*)buf)->cooked_send = false;
+bool MulticastGroup::skip_null_indices(subgroup_id_t subgroup_num, uint32_t num_indices) {
+    const SubgroupSettings& curr_subgroup_settings = subgroup_settings.at(subgroup_num);
+    const uint32_t num_received_entry = curr_subgroup_settings.num_received_offset + curr_subgroup_settings.sender_rank;
+    for(const uint32_t member_row : shard_rows[subgroup_num].members) {
+        if(sst->num_received[member_row][num_received_entry] < future_message_indices[subgroup_num] - 1) {
+            null_skip_ahead[subgroup_num] = 0;
+            return false;
+        }
+    }
+    future_message_indices[subgroup_num] += num_indices + null_skip_ahead[subgroup_num];
+    multicast_log(TRACE, "Subgroup {}: skipping ahead to index {}", subgroup_num, future_message_indices[subgroup_num]);
+    sst->null_skip_index[member_index][num_received_entry] = future_message_indices[subgroup_num];
+    sst->put_range(get_shard_sst_indices(subgroup_num), sst->null_skip_index, num_received_entry, 1);
+    // Going further each time an idle sender falls behind saves rounds of
+    // skips, but a message it sends later waits for the others to catch up
+    null_skip_ahead[subgroup_num] = std::min<uint32_t>(2 * null_skip_ahead[subgroup_num] + 1, curr_subgroup_settings.window_size / 2);
+    return true;
+}
 
-        future_message_indices[subgroup_num]++;
-        sst_multicast_group_ptrs[subgroup_num]->send();
+char* MulticastGroup::want_send_space_if_null(subgroup_id_t subgroup_num, char* buffer) {
+    if(!buffer && callbacks.send_space_callback && !thread_shutdown) {
+        send_space_wanted[subgroup_num] = true;
     }
+    return buffer;
 }
 
 char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
                                          long long unsigned int payload_size,
                                          bool cooked_send) {
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
 
     // if rdmc groups were not created because of failures, return NULL
     if(!rdmc_sst_groups_created) {
         return NULL;
     }
+    if(rpc_aggregation_size > 0) {
+        if(rpc_aggregates[subgroup_num].reserved > 0) {
+            return want_send_space_if_null(subgroup_num, nullptr);
+        }
+        if(cooked_send && send_gates[subgroup_num].mode != Mode::UNORDERED
+           && payload_size + sizeof(uint32_t) <= send_gates[subgroup_num].aggregation_size) {
+            return want_send_space_if_null(subgroup_num, get_aggregated_sendbuffer_ptr(subgroup_num, payload_size));
+        }
+        // Anything else must go after the packed message
+        flush_rpc_aggregate(subgroup_num);
+    }
+    return want_send_space_if_null(subgroup_num, get_new_sendbuffer_ptr(subgroup_num, payload_size, cooked_send));
+}
+
+char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                         long long unsigned int payload_size,
+                                         const rdmc::receive_destination& app_buffer) {
+    assert(app_buffer.mr);
+    assert(app_buffer.mr->size >= app_buffer.offset + payload_size + sizeof(header));
+    assert(app_buffer.mr->cuda_device < 0);
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+
+    if(!rdmc_sst_groups_created) {
+        return NULL;
+    }
+    if(rpc_aggregation_size > 0) {
+        if(rpc_aggregates[subgroup_num].reserved > 0) {
+            return want_send_space_if_null(subgroup_num, nullptr);
+        }
+        flush_rpc_aggregate(subgroup_num);
+    }
+    return want_send_space_if_null(subgroup_num, get_new_sendbuffer_ptr(subgroup_num, payload_size, false, app_buffer));
+}
+
+char* MulticastGroup::get_new_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                             long long unsigned int payload_size,
+                                             bool cooked_send,
+                                             const rdmc::receive_destination& app_buffer) {
     long long unsigned int msg_size = payload_size + sizeof(header);
-    if(msg_size > max_msg_size) {
+    const SubgroupSettings& curr_subgroup_settings = subgroup_settings.at(subgroup_num);
+    SendGate& gate = send_gates[subgroup_num];
+    const unsigned int window_size = gate.effective_window;
+    if(msg_size > curr_subgroup_settings.max_msg_size) {
         std::cout << "Can't send messages of size larger than the maximum message "
                      "size which is equal to "
-                  << max_msg_size << std::endl;
+                  << curr_subgroup_settings.max_msg_size << std::endl;
         return nullptr;
     }
+    // This node isn't idle any more
+    null_skip_ahead[subgroup_num] = 0;
 
     std::vector<node_id_t> shard_members = subgroup_settings.at(subgroup_num).members;
     auto num_shard_members = shard_members.size();
@@ -1219,29 +3100,47 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
     num_shard_senders = get_num_senders(shard_senders);
     assert(shard_sender_index >= 0);
 
-    if(subgroup_settings.at(subgroup_num).mode != Mode::UNORDERED) {
+    bool window_full = false;
+    if(subgroup_settings.at(subgroup_num).mode == Mode::ORDERED) {
         for(uint i = 0; i < num_shard_members; ++i) {
-            if(sst->delivered_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num]
+            if(sst->delivered_num[shard_rows[subgroup_num].members[i]][subgroup_num]
                < static_cast<int32_t>((future_message_indices[subgroup_num] - window_size) * num_shard_senders + shard_sender_index)) {
-                return nullptr;
+                window_full = true;
+                break;
+            }
+        }
+    } else if(subgroup_settings.at(subgroup_num).mode == Mode::FIFO
+              || subgroup_settings.at(subgroup_num).mode == Mode::SEQUENCED) {
+        // The receivers keep the message in its slot until they deliver it
+        const uint32_t num_received_entry = subgroup_settings.at(subgroup_num).num_received_offset + shard_sender_index;
+        for(uint i = 0; i < num_shard_members; ++i) {
+            if(sst->delivered_index[shard_rows[subgroup_num].members[i]][num_received_entry]
+               < static_cast<int32_t>(future_message_indices[subgroup_num] - window_size)) {
+                window_full = true;
+                break;
             }
         }
     } else {
         for(uint i = 0; i < num_shard_members; ++i) {
             auto num_received_offset = subgroup_settings.at(subgroup_num).num_received_offset;
-            if(sst->num_received[node_id_to_sst_index.at(shard_members[i])][num_received_offset + shard_sender_index]
+            if(sst->num_received[shard_rows[subgroup_num].members[i]][num_received_offset + shard_sender_index]
                < static_cast<int32_t>(future_message_indices[subgroup_num] - window_size)) {
-                return nullptr;
+                window_full = true;
+                break;
             }
         }
     }
-
-    if(msg_size > sst_max_msg_size) {
-        if(thread_shutdown) {
-            return nullptr;
+    if(window_full) {
+        if(adaptive_window && !gate.stall_start) {
+            gate.stall_start = get_time();
         }
+        return nullptr;
+    }
 
-        if(free_message_buffers[subgroup_num].empty()) {
+    // A message in the application's memory is sent from there, so it can't
+    // be copied into an SST slot
+    if(msg_size > curr_subgroup_settings.sst_max_msg_size || app_buffer.mr) {
+        if(thread_shutdown) {
             return nullptr;
         }
 
@@ -1254,21 +3153,41 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
         msg.sender_id = members[member_index];
         msg.index = future_message_indices[subgroup_num];
         msg.size = msg_size;
-        msg.message_buffer = std::move(free_message_buffers[subgroup_num].back());
-        free_message_buffers[subgroup_num].pop_back();
+        if(app_buffer.mr) {
+            msg.message_buffer = MessageBuffer(app_buffer.mr->buffer + app_buffer.offset,
+                                               app_buffer.mr, app_buffer.offset, msg_size);
+            msg.message_buffer.pooled = false;
+        } else {
+            // All of the subgroup's buffers are in use; try again once
+            // some messages have been delivered
+            msg.message_buffer = buffer_pools[subgroup_num]->acquire(msg_size);
+            if(!msg.message_buffer.buffer) {
+                return nullptr;
+            }
+        }
 
         auto current_time = get_time();
-        pending_message_timestamps[subgroup_num].insert(current_time);
+        // Unordered messages are done with on delivery, so nothing holds
+        // back the stability frontier for them
+        if(gate.mode != Mode::UNORDERED) {
+            pending_message_timestamps[subgroup_num].push_back(current_time);
+        }
 
         // Fill header
-        char* buf = msg.message_buffer.buffer.get();
+        char* buf = msg.message_buffer.buffer;
         ((header*)buf)->header_size = sizeof(header);
         ((header*)buf)->index = msg.index;
         ((header*)buf)->timestamp = current_time;
         ((header*)buf)->cooked_send = cooked_send;
+        ((header*)buf)->aggregated = false;
+        ((header*)buf)->compressed = false;
+        ((header*)buf)->reserved_flags = 0;
 
         next_sends[subgroup_num] = std::move(msg);
         future_message_indices[subgroup_num]++;
+        if(adaptive_window) {
+            record_window_send(gate);
+        }
 
         last_transfer_medium[subgroup_num] = true;
         // DERECHO_LOG(-1, -1, "provided a buffer");
@@ -1277,6 +3196,11 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
         if(pending_sst_sends[subgroup_num] || next_sends[subgroup_num]) {
             return nullptr;
         }
+        // An SST send would compete for the NIC with the higher priority
+        // subgroups' RDMC sends, so it waits until they are all sent
+        if(!gate.higher_priority_subgroups.empty() && higher_priority_sends_queued(subgroup_num)) {
+            return nullptr;
+        }
 
         pending_sst_sends[subgroup_num] = true;
         if(thread_shutdown) {
@@ -1289,14 +3213,22 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
             return nullptr;
         }
         auto current_time = get_time();
-        pending_message_timestamps[subgroup_num].insert(current_time);
+        if(gate.mode != Mode::UNORDERED) {
+            pending_message_timestamps[subgroup_num].push_back(current_time);
+        }
 
         ((header*)buf)->header_size = sizeof(header);
         ((header*)buf)->index = future_message_indices[subgroup_num];
         ((header*)buf)->timestamp = current_time;
         ((header*)buf)->cooked_send = cooked_send;
+        ((header*)buf)->aggregated = false;
+        ((header*)buf)->compressed = false;
+        ((header*)buf)->reserved_flags = 0;
         future_message_indices[subgroup_num]++;
-        whenlog(logger->trace("Subgroup {}: get_sendbuffer_ptr increased future_message_indices to {}", subgroup_num, future_message_indices[subgroup_num]););
+        if(adaptive_window) {
+            record_window_send(gate);
+        }
+        multicast_log(TRACE, "Subgroup {}: get_sendbuffer_ptr increased future_message_indices to {}", subgroup_num, future_message_indices[subgroup_num]);
 
         last_transfer_medium[subgroup_num] = false;
         // DERECHO_LOG(-1, -1, "provided a buffer");
@@ -1304,43 +3236,199 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
     }
 }
 
+char* MulticastGroup::get_aggregated_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                                    long long unsigned int payload_size) {
+    RPCAggregate& aggregate = rpc_aggregates[subgroup_num];
+    const uint32_t aggregation_size = send_gates[subgroup_num].aggregation_size;
+    if(aggregate.payload && aggregate.used + sizeof(uint32_t) + payload_size > aggregation_size) {
+        flush_rpc_aggregate(subgroup_num);
+    }
+    if(!aggregate.payload) {
+        char* payload = get_new_sendbuffer_ptr(subgroup_num, aggregation_size, true);
+        if(!payload) {
+            return nullptr;
+        }
+        ((header*)(payload - sizeof(header)))->aggregated = true;
+        aggregate.payload = payload;
+        aggregate.used = 0;
+        aggregate.deadline = get_time() + rpc_aggregation_delay_ns;
+        // Let the sender thread know about the new deadline
+        wake_sender_thread(subgroup_num);
+    }
+    aggregate.reserved = payload_size;
+    // The size prefix is filled in by send(), once the send is complete
+    return aggregate.payload + aggregate.used + sizeof(uint32_t);
+}
+
+void MulticastGroup::flush_rpc_aggregate(subgroup_id_t subgroup_num) {
+    RPCAggregate& aggregate = rpc_aggregates[subgroup_num];
+    if(!aggregate.payload || aggregate.reserved > 0) {
+        return;
+    }
+    const long long unsigned int msg_size = sizeof(header) + aggregate.used;
+    multicast_log(TRACE, "Subgroup {}: sending a packed message of {} bytes", subgroup_num, msg_size);
+    if(last_transfer_medium[subgroup_num]) {
+        assert(next_sends[subgroup_num]);
+        next_sends[subgroup_num]->size = msg_size;
+        queue_rdmc_send(subgroup_num, std::move(*next_sends[subgroup_num]));
+        next_sends[subgroup_num] = std::nullopt;
+        wake_sender_thread(subgroup_num);
+        count_send(subgroup_num, TransportTier::RDMC);
+    } else {
+        sst_multicast_group_ptrs[subgroup_num]->resize_buffer(msg_size);
+        const bool sent_inline = sst_multicast_group_ptrs[subgroup_num]->send();
+        pending_sst_sends[subgroup_num] = false;
+        count_send(subgroup_num, sent_inline ? TransportTier::INLINE : TransportTier::SST);
+    }
+    aggregate = RPCAggregate();
+}
+
+uint64_t MulticastGroup::flush_expired_rpc_aggregates(const std::vector<subgroup_id_t>& subgroup_nums) {
+    if(rpc_aggregation_size == 0) {
+        return 0;
+    }
+    uint64_t next_deadline = 0;
+    const uint64_t current_time = get_time();
+    for(const subgroup_id_t subgroup_num : subgroup_nums) {
+        std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+        const RPCAggregate& aggregate = rpc_aggregates[subgroup_num];
+        if(!aggregate.payload) {
+            continue;
+        }
+        // A send still being written will check the deadline itself when it completes
+        if(aggregate.deadline <= current_time && aggregate.reserved == 0 && !thread_shutdown) {
+            flush_rpc_aggregate(subgroup_num);
+        } else if(aggregate.reserved == 0 && (next_deadline == 0 || aggregate.deadline < next_deadline)) {
+            next_deadline = aggregate.deadline;
+        }
+    }
+    return next_deadline;
+}
+
 bool MulticastGroup::send(subgroup_id_t subgroup_num) {
+    const bool sent = send_next(subgroup_num);
+    // A send that found the next message still open can go once it is sent;
+    // the subgroup's lock is released by now, so the callback may take it
+    if(callbacks.send_space_callback && send_space_wanted[subgroup_num].exchange(false)) {
+        callbacks.send_space_callback(subgroup_num);
+    }
+    return sent;
+}
+
+bool MulticastGroup::send_next(subgroup_id_t subgroup_num) {
     if(!rdmc_sst_groups_created) {
         return false;
     }
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
-    if(last_transfer_medium[subgroup_num]) {
-        // check thread_shutdown only for RDMC sends
-        if(thread_shutdown) {
-            return false;
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    RPCAggregate& aggregate = rpc_aggregates[subgroup_num];
+    if(aggregate.reserved > 0) {
+        // The send is already in the packed message's buffer, which goes out
+        // in this view or is carried over to the next one
+        *(uint32_t*)(aggregate.payload + aggregate.used) = aggregate.reserved;
+        aggregate.used += sizeof(uint32_t) + aggregate.reserved;
+        aggregate.reserved = 0;
+        if(aggregate.used + sizeof(uint32_t) >= send_gates[subgroup_num].aggregation_size || get_time() >= aggregate.deadline) {
+            flush_rpc_aggregate(subgroup_num);
         }
+        return true;
+    }
+    // check thread_shutdown only for RDMC sends
+    if(last_transfer_medium[subgroup_num] && thread_shutdown) {
+        return false;
+    }
+    send_opened_message(subgroup_num);
+    DERECHO_LOG(subgroup_num, -1, "user_send_finished");
+    return true;
+}
+
+void MulticastGroup::send_opened_message(subgroup_id_t subgroup_num) {
+    if(last_transfer_medium[subgroup_num]) {
         assert(next_sends[subgroup_num]);
-        pending_sends[subgroup_num].push(std::move(*next_sends[subgroup_num]));
+        queue_rdmc_send(subgroup_num, std::move(*next_sends[subgroup_num]));
         next_sends[subgroup_num] = std::nullopt;
-        sender_cv.notify_all();
-        // DERECHO_LOG(-1, -1, "user_send_finished");
-        return true;
+        wake_sender_thread(subgroup_num);
+        count_send(subgroup_num, TransportTier::RDMC);
     } else {
-        sst_multicast_group_ptrs[subgroup_num]->send();
+        const bool sent_inline = sst_multicast_group_ptrs[subgroup_num]->send();
         pending_sst_sends[subgroup_num] = false;
-        // DERECHO_LOG(-1, -1, "user_send_finished");
-        return true;
+        count_send(subgroup_num, sent_inline ? TransportTier::INLINE : TransportTier::SST);
     }
 }
 
-bool MulticastGroup::check_pending_sst_sends(subgroup_id_t subgroup_num) {
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
-    return pending_sst_sends[subgroup_num];
+StreamCursor::StreamCursor(const struct iovec* iov, int iovcnt) : iov(iov), iovcnt(iovcnt) {
+    for(int i = 0; i < iovcnt; ++i) {
+        remaining_bytes += iov[i].iov_len;
+    }
 }
 
-std::vector<uint32_t> MulticastGroup::get_shard_sst_indices(subgroup_id_t subgroup_num) {
-    std::vector<node_id_t> shard_members = subgroup_settings.at(subgroup_num).members;
+void StreamCursor::copy_to(char* dest, std::size_t size) {
+    assert(size <= remaining_bytes);
+    remaining_bytes -= size;
+    while(size > 0) {
+        const std::size_t length = std::min(size, iov->iov_len - iov_offset);
+        memcpy(dest, (const char*)iov->iov_base + iov_offset, length);
+        dest += length;
+        size -= length;
+        iov_offset += length;
+        if(iov_offset == iov->iov_len) {
+            ++iov;
+            --iovcnt;
+            iov_offset = 0;
+        }
+    }
+}
 
-    std::vector<uint32_t> shard_sst_indices;
-    for(auto m : shard_members) {
-        shard_sst_indices.push_back(node_id_to_sst_index.at(m));
+uint32_t MulticastGroup::send_stream(subgroup_id_t subgroup_num, StreamCursor& cursor, uint64_t& last_timestamp) {
+    if(!rdmc_sst_groups_created) {
+        return 0;
     }
-    return shard_sst_indices;
+    uint32_t num_sent = 0;
+    {
+        std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+        if(rpc_aggregation_size > 0) {
+            if(rpc_aggregates[subgroup_num].reserved > 0) {
+                want_send_space_if_null(subgroup_num, nullptr);
+                return 0;
+            }
+            flush_rpc_aggregate(subgroup_num);
+        }
+        const std::size_t max_chunk_size = subgroup_settings.at(subgroup_num).max_msg_size - sizeof(header);
+        // Each message takes one of the send window's slots; stop when they run out
+        while(cursor.remaining() > 0 && !thread_shutdown) {
+            const std::size_t chunk_size = std::min(cursor.remaining(), max_chunk_size);
+            char* payload = get_new_sendbuffer_ptr(subgroup_num, chunk_size, false);
+            if(!payload) {
+                break;
+            }
+            cursor.copy_to(payload, chunk_size);
+            last_timestamp = ((header*)(payload - sizeof(header)))->timestamp;
+            send_opened_message(subgroup_num);
+            num_sent++;
+        }
+        if(num_sent == 0) {
+            want_send_space_if_null(subgroup_num, nullptr);
+        }
+    }
+    if(num_sent > 0 && callbacks.send_space_callback && send_space_wanted[subgroup_num].exchange(false)) {
+        callbacks.send_space_callback(subgroup_num);
+    }
+    return num_sent;
+}
+
+bool MulticastGroup::check_pending_sst_sends(subgroup_id_t subgroup_num) {
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+    // The sender threads are gone once the group is wedged, so nothing else
+    // would send a packed message left in an SST slot
+    if(!last_transfer_medium[subgroup_num]) {
+        flush_rpc_aggregate(subgroup_num);
+    }
+    return pending_sst_sends[subgroup_num];
+}
+
+const std::vector<uint32_t>& MulticastGroup::get_shard_sst_indices(subgroup_id_t subgroup_num) {
+    // Only throws for a subgroup this node doesn't belong to, as before
+    subgroup_settings.at(subgroup_num);
+    return shard_rows[subgroup_num].members;
 }
 
 void MulticastGroup::debug_print() {
@@ -1369,6 +3457,10 @@ void MulticastGroup::debug_print() {
             cout << endl;
         }
         num_received_offset += num_shard_senders;
+        cout << "Messages sent inline, by SST and by RDMC: "
+             << tier_send_counts[subgroup_num][static_cast<int>(TransportTier::INLINE)] << " "
+             << tier_send_counts[subgroup_num][static_cast<int>(TransportTier::SST)] << " "
+             << tier_send_counts[subgroup_num][static_cast<int>(TransportTier::RDMC)] << endl;
         cout << "Printing multicastSST fields" << endl;
         sst_multicast_group_ptrs[subgroup_num]->debug_print();
         cout << endl;
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <assert.h>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
@@ -11,17 +14,26 @@
 #include <ostream>
 #include <queue>
 #include <set>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
 #include <tuple>
 #include <vector>
 
+#include "change_stream.h"
 #include "conf/conf.hpp"
 #include "connection_manager.h"
 #include "derecho_internal.h"
 #include "derecho_modes.h"
 #include "derecho_sst.h"
+#include "latency_stats.h"
+#include "message_buffer_pool.h"
+#include "metrics.h"
 #include "mutils-serialization/SerializationMacros.hpp"
 #include "mutils-serialization/SerializationSupport.hpp"
 #include "rdmc/rdmc.h"
+#include "sequence_ring.h"
+#include "timestamp_queue.h"
 #include "spdlog/spdlog.h"
 #include "sst/multicast.h"
 #include "sst/sst.h"
@@ -29,6 +41,18 @@
 
 namespace derecho {
 
+class SSTMessageView;
+/** Alias for the type of delivery callback that receives SST multicasts as views into their slots. */
+using message_view_callback_t = std::function<void(subgroup_id_t, node_id_t, message_id_t, SSTMessageView)>;
+/** Alias for the type of callback that picks where an incoming RDMC message
+ * from a sender should be received, given an upper bound on its size. */
+using receive_allocator_t = std::function<rdmc::receive_destination(subgroup_id_t, node_id_t, size_t)>;
+/** Alias for the type of callback that is told a subgroup may have room for another send. */
+using send_space_callback_t = std::function<void(subgroup_id_t)>;
+/** Alias for the type of callback that is shown the part of an incoming
+ * message's payload, from its start, that has arrived so far. */
+using receive_progress_callback_t = std::function<void(subgroup_id_t, node_id_t, char*, long long int)>;
+
 /**
  * Bundles together a set of callback functions for message delivery events.
  * These will be invoked by MulticastGroup or ViewManager to hand control back
@@ -40,6 +64,53 @@ struct CallbackSet {
     message_callback_t global_stability_callback;
     persistence_callback_t local_persistence_callback = nullptr;
     persistence_callback_t global_persistence_callback = nullptr;
+    /** If set, raw sends that arrive by SST multicast are delivered to this
+     * callback instead of global_stability_callback */
+    message_view_callback_t global_stability_view_callback = nullptr;
+    /** If set, ordered delivery hands each run of stable raw messages to this
+     * callback in one call, instead of calling global_stability_callback once
+     * per message. Their versions are created once the callback returns.
+     * Cooked (RPC) messages are still delivered one at a time, since each
+     * must be versioned before the next one runs, and so are raw messages in
+     * unordered subgroups. */
+    message_batch_callback_t global_stability_batch_callback = nullptr;
+    /** If set, called for each incoming RDMC message to get a registered
+     * region to receive it into, so that it lands directly in application
+     * memory. The region must have room for the message's header, which
+     * comes before the payload, and must stay valid until the message has
+     * been delivered (and persisted, in persistent subgroups); Derecho never
+     * writes to it again afterwards. It must be in host memory, since
+     * Derecho reads the header on the CPU. Returning a destination with a null mr
+     * receives the message into Derecho's own buffers, as usual. */
+    receive_allocator_t receive_allocator = nullptr;
+    /** If set, called once after get_sendbuffer_ptr (or a try_ordered_send)
+     * has found no room to send in a subgroup, when the send window or the
+     * SST multicast slots of that subgroup may have room again, so that the
+     * sender can try again instead of spinning. It may be called when there
+     * is still no room, in which case trying again arms it again. It is
+     * called on an SST predicate thread, or the thread that finished the
+     * send in the way, so it must not block or send itself; an event loop
+     * can write to an eventfd from it. */
+    send_space_callback_t send_space_callback = nullptr;
+    /** If set, called with each range of versions of a subgroup that this
+     * node has persisted, once per flush of its logs. The range starts just
+     * after the end of the previous one, so it covers each version once. */
+    persistence_range_callback_t local_persistence_range_callback = nullptr;
+    /** If set, called with each range of versions of a subgroup that every
+     * member of its shard has persisted, at most once per pass of the SST
+     * predicate thread however many versions the pass finds persisted, and
+     * only when the range is not empty. Ranges continue from one view to
+     * the next, so each version is reported once. */
+    persistence_range_callback_t global_persistence_range_callback = nullptr;
+    /** If set, called in unordered subgroups as each large (RDMC) message
+     * arrives, with its sender, the start of its payload and the number of
+     * payload bytes from the start that have arrived so far, each time that
+     * number grows, so that the application can start parsing, hashing or
+     * forwarding the message before the rest of it is in. The message is
+     * still delivered to global_stability_callback once it is complete. It
+     * is called on the RDMC polling thread, so it must be quick and must not
+     * send; the payload is only valid until the message is delivered. */
+    receive_progress_callback_t receive_progress_callback = nullptr;
 };
 
 /**
@@ -56,6 +127,18 @@ struct DerechoParams : public mutils::ByteRepresentable {
     unsigned int timeout_ms;
     rdmc::send_algorithm rdmc_send_algorithm;
     uint32_t rpc_port;
+    /** The number of SST multicast messages that delivery handlers may keep
+     * pinned in their receive slots at once; 0 disables pinning. */
+    uint32_t max_pinned_sst_messages;
+    /** The number of RDMC messages a sender can have in flight per subgroup */
+    uint32_t max_outstanding_rdmc_sends;
+    /** The number of a sender's messages that can be delivered but not yet
+     * persisted in an ordered subgroup; 0 means window_size */
+    uint32_t persistence_window;
+    /** Whether RDMC payloads are compressed on the wire */
+    bool rdmc_compression;
+    /** Whether a shard's senders take turns starting RDMC sends */
+    bool rdmc_send_token;
 
     DerechoParams() {
         max_payload_size = derecho::getConfUInt64(CONF_DERECHO_MAX_PAYLOAD_SIZE);
@@ -63,19 +146,96 @@ struct DerechoParams : public mutils::ByteRepresentable {
         block_size = derecho::getConfUInt64(CONF_DERECHO_BLOCK_SIZE);
         window_size = derecho::getConfUInt32(CONF_DERECHO_WINDOW_SIZE);
         timeout_ms = derecho::getConfUInt32(CONF_DERECHO_TIMEOUT_MS);
-        std::string rdmc_send_algorithm_string = derecho::getConfString(CONF_DERECHO_RDMC_SEND_ALGORITHM);
+        rdmc_send_algorithm = send_algorithm_from_string(derecho::getConfString(CONF_DERECHO_RDMC_SEND_ALGORITHM));
+        rpc_port = derecho::getConfUInt32(CONF_DERECHO_RPC_PORT);
+        max_pinned_sst_messages = derecho::getConfUInt32(CONF_DERECHO_MAX_PINNED_SST_MESSAGES);
+        max_outstanding_rdmc_sends = std::max(1u, derecho::getConfUInt32(CONF_DERECHO_MAX_OUTSTANDING_RDMC_SENDS));
+        persistence_window = derecho::getConfUInt32(CONF_DERECHO_PERSISTENCE_WINDOW);
+        rdmc_compression = derecho::getConfBoolean(CONF_DERECHO_RDMC_COMPRESSION);
+        rdmc_send_token = derecho::getConfBoolean(CONF_DERECHO_RDMC_SEND_TOKEN);
+        check_window();
+    }
+
+    static rdmc::send_algorithm send_algorithm_from_string(const std::string& rdmc_send_algorithm_string) {
         if(rdmc_send_algorithm_string == "binomial_send") {
-            rdmc_send_algorithm = rdmc::send_algorithm::BINOMIAL_SEND;
+            return rdmc::send_algorithm::BINOMIAL_SEND;
         } else if(rdmc_send_algorithm_string == "chain_send") {
-            rdmc_send_algorithm = rdmc::send_algorithm::CHAIN_SEND;
+            return rdmc::send_algorithm::CHAIN_SEND;
         } else if(rdmc_send_algorithm_string == "sequential_send") {
-            rdmc_send_algorithm = rdmc::send_algorithm::SEQUENTIAL_SEND;
+            return rdmc::send_algorithm::SEQUENTIAL_SEND;
         } else if(rdmc_send_algorithm_string == "tree_send") {
-            rdmc_send_algorithm = rdmc::send_algorithm::TREE_SEND;
+            return rdmc::send_algorithm::TREE_SEND;
+        } else if(rdmc_send_algorithm_string == "hierarchical_send") {
+            return rdmc::send_algorithm::HIERARCHICAL_SEND;
+        } else if(rdmc_send_algorithm_string == "adaptive_send") {
+            return rdmc::send_algorithm::ADAPTIVE_SEND;
+        } else if(rdmc_send_algorithm_string == "striped_send") {
+            return rdmc::send_algorithm::STRIPED_SEND;
         } else {
             throw "wrong value for RDMC send algorithm: " + rdmc_send_algorithm_string + ". Check your config file.";
         }
-        rpc_port = derecho::getConfUInt32(CONF_DERECHO_RPC_PORT);
+    }
+
+    void check_window() const {
+        if(max_pinned_sst_messages > 0 && max_pinned_sst_messages >= window_size) {
+            throw "max_pinned_sst_messages must be smaller than window_size. Check your config file.";
+        }
+        if(max_outstanding_rdmc_sends > window_size) {
+            throw "max_outstanding_rdmc_sends can't be larger than window_size. Check your config file.";
+        }
+        if(persistence_window != 0 && persistence_window < window_size) {
+            throw "persistence_window can't be smaller than window_size. Check your config file.";
+        }
+    }
+
+    /**
+     * @return These parameters, with the ones that the config file's section
+     * for a subgroup profile ([SUBGROUP/<profile>]) sets replaced by its
+     * values. Only the settings that are laid out per subgroup can be
+     * replaced; the empty profile replaces none.
+     */
+    /** The payload size of a P2P slot: CONF_DERECHO_P2P_SLOT_SIZE, or
+     * max_payload_size if that is 0 or larger */
+    uint64_t p2p_payload_size() const {
+        const uint64_t slot_size = getConfUInt64(CONF_DERECHO_P2P_SLOT_SIZE);
+        return slot_size == 0 ? max_payload_size : std::min<uint64_t>(slot_size, max_payload_size);
+    }
+
+    DerechoParams for_profile(const std::string& profile) const {
+        DerechoParams params = *this;
+        if(profile.empty()) {
+            return params;
+        }
+        const std::string section = CONF_SUBGROUP_PREFIX + profile + "/";
+        if(hasConfKey(section + "max_payload_size")) {
+            params.max_payload_size = getConfUInt64(section + "max_payload_size");
+        }
+        if(hasConfKey(section + "max_smc_payload_size")) {
+            params.max_smc_payload_size = getConfUInt64(section + "max_smc_payload_size");
+        }
+        if(hasConfKey(section + "block_size")) {
+            params.block_size = getConfUInt64(section + "block_size");
+        }
+        if(hasConfKey(section + "window_size")) {
+            params.window_size = getConfUInt32(section + "window_size");
+        }
+        if(hasConfKey(section + "rdmc_send_algorithm")) {
+            params.rdmc_send_algorithm = send_algorithm_from_string(getConfString(section + "rdmc_send_algorithm"));
+        }
+        if(hasConfKey(section + "max_outstanding_rdmc_sends")) {
+            params.max_outstanding_rdmc_sends = std::max(1u, getConfUInt32(section + "max_outstanding_rdmc_sends"));
+        }
+        if(hasConfKey(section + "persistence_window")) {
+            params.persistence_window = getConfUInt32(section + "persistence_window");
+        }
+        if(hasConfKey(section + "rdmc_compression")) {
+            params.rdmc_compression = getConfBoolean(section + "rdmc_compression");
+        }
+        if(hasConfKey(section + "rdmc_send_token")) {
+            params.rdmc_send_token = getConfBoolean(section + "rdmc_send_token");
+        }
+        params.check_window();
+        return params;
     }
 
     DerechoParams(long long unsigned int max_payload_size,
@@ -84,52 +244,54 @@ struct DerechoParams : public mutils::ByteRepresentable {
                   unsigned int window_size,
                   unsigned int timeout_ms,
                   rdmc::send_algorithm rdmc_send_algorithm,
-                  uint32_t rpc_port)
+                  uint32_t rpc_port,
+                  uint32_t max_pinned_sst_messages = 0,
+                  uint32_t max_outstanding_rdmc_sends = 1,
+                  uint32_t persistence_window = 0,
+                  bool rdmc_compression = false,
+                  bool rdmc_send_token = false)
             : max_payload_size(max_payload_size),
               max_smc_payload_size(max_smc_payload_size),
               block_size(block_size),
               window_size(window_size),
               timeout_ms(timeout_ms),
               rdmc_send_algorithm(rdmc_send_algorithm),
-              rpc_port(rpc_port) {
+              rpc_port(rpc_port),
+              max_pinned_sst_messages(max_pinned_sst_messages),
+              max_outstanding_rdmc_sends(std::max(1u, max_outstanding_rdmc_sends)),
+              persistence_window(persistence_window),
+              rdmc_compression(rdmc_compression),
+              rdmc_send_token(rdmc_send_token) {
     }
 
-    DEFAULT_SERIALIZATION_SUPPORT(DerechoParams, max_payload_size, max_smc_payload_size, block_size, window_size, timeout_ms, rdmc_send_algorithm, rpc_port);
+    DEFAULT_SERIALIZATION_SUPPORT(DerechoParams, max_payload_size, max_smc_payload_size, block_size, window_size, timeout_ms, rdmc_send_algorithm, rpc_port, max_pinned_sst_messages, max_outstanding_rdmc_sends, persistence_window, rdmc_compression, rdmc_send_token);
 };
 
 /**
  * The header for an individual multicast message, which will always be the
  * first sizeof(header) bytes in the message's data buffer.
+ *
+ * The flags share the byte that was once cooked_send alone, with cooked_send
+ * in its lowest bit, so the header keeps its size and layout on the wire: a
+ * message that is neither packed nor compressed reads the same to members
+ * that predate the other two flags. Every sender writes the whole byte.
  */
 struct __attribute__((__packed__)) header {
     uint32_t header_size;
     int32_t index;
     uint64_t timestamp;
-    bool cooked_send;
-};
-
-/**
- * Represents a block of memory used to store a message. This object contains
- * both the array of bytes in which the message is stored and the corresponding
- * RDMA memory region (which has registered that array of bytes as its buffer).
- * This is a move-only type, since memory regions can't be copied.
- */
-struct MessageBuffer {
-    std::unique_ptr<char[]> buffer;
-    std::shared_ptr<rdma::memory_region> mr;
-
-    MessageBuffer() {}
-    MessageBuffer(size_t size) {
-        if(size != 0) {
-            buffer = std::unique_ptr<char[]>(new char[size]);
-            mr = std::make_shared<rdma::memory_region>(buffer.get(), size);
-        }
-    }
-    MessageBuffer(const MessageBuffer&) = delete;
-    MessageBuffer(MessageBuffer&&) = default;
-    MessageBuffer& operator=(const MessageBuffer&) = delete;
-    MessageBuffer& operator=(MessageBuffer&&) = default;
+    bool cooked_send : 1;
+    /** True if the payload is several cooked sends packed together, each
+     * preceded by its size as a uint32_t */
+    bool aggregated : 1;
+    /** Only meaningful for an RDMC message in a subgroup with
+     * rdmc_compression: true if the header is followed by the payload's
+     * size as a uint64_t and then the payload compressed with LZ4 */
+    bool compressed : 1;
+    /** The rest of the flag byte, always 0 */
+    uint8_t reserved_flags : 5;
 };
+static_assert(sizeof(header) == 17, "The multicast header must keep its wire size");
 
 /**
  * A structure containing an RDMC message (which consists of some bytes in a
@@ -147,6 +309,11 @@ struct RDMCMessage {
     long long unsigned int size;
     /** The MessageBuffer that contains the message's body. */
     MessageBuffer message_buffer;
+    /** The compressed copy of the message that RDMC is sending, if the
+     * subgroup compresses its messages and this one got smaller */
+    MessageBuffer wire_buffer;
+    /** The size of wire_buffer's contents */
+    long long unsigned int wire_size = 0;
 };
 
 struct SSTMessage {
@@ -158,6 +325,104 @@ struct SSTMessage {
     long long unsigned int size;
     /** Pointer to the message */
     volatile char* buf;
+    /** The sender's entry in the num_received_sst and num_released_sst fields */
+    uint32_t num_received_entry;
+    /** The message's position in the sender's stream of SST multicasts, which
+     * is the value of num_received_sst that acknowledges it */
+    int32_t sst_index;
+};
+
+/**
+ * Keeps track of the SST multicast messages that delivery handlers are still
+ * holding on to in their receive slots. For each sender, this node publishes
+ * in num_released_sst the highest sst_index up to which every message has
+ * been delivered and released, and the sender does not reuse a slot until
+ * every member of the shard has released it. Shared by MulticastGroup and
+ * the SSTMessageViews it hands out, so that it (and the SST holding the
+ * slots) outlives the group if a view is kept past a view change.
+ */
+class SSTSlotPins {
+    std::mutex pins_mutex;
+    const std::shared_ptr<DerechoSST> sst;
+    const uint32_t max_pins;
+    uint32_t num_pins = 0;
+    /** Set once the group is wedged; after that releases are no longer sent */
+    bool wedged = false;
+    /** The following are all indexed by num_received entry */
+    std::map<uint32_t, int32_t> last_delivered;
+    std::map<uint32_t, std::set<int32_t>> pinned;
+    std::map<uint32_t, std::vector<uint32_t>> shard_sst_indices;
+
+    /** Recomputes and, if it changed, publishes num_released_sst for one sender.
+     * Must be called with pins_mutex held. */
+    void update_released(uint32_t num_received_entry);
+
+public:
+    SSTSlotPins(std::shared_ptr<DerechoSST> sst, uint32_t max_pins);
+    uint32_t get_max_pins() const { return max_pins; }
+    bool enabled() const { return max_pins > 0; }
+    /** Registers a sender whose releases must be sent to the given shard rows. */
+    void add_sender(uint32_t num_received_entry, std::vector<uint32_t> shard_sst_indices);
+    /** Pins one message in its slot, unless max_pins messages are already pinned. */
+    bool try_pin(uint32_t num_received_entry, int32_t sst_index);
+    /** Releases a message pinned with try_pin. */
+    void release(uint32_t num_received_entry, int32_t sst_index);
+    /** Records that the delivery upcall for a message has returned. */
+    void delivered(uint32_t num_received_entry, int32_t sst_index);
+    void wedge();
+};
+
+/**
+ * A read-only view of the payload of a delivered SST multicast message. If
+ * the message could be pinned, the view points directly into the message's
+ * SST slot, and the sender can't reuse the slot until the view is destroyed
+ * or release() is called; otherwise the view holds its own copy of the
+ * payload. Views are move-only, and may be kept after the delivery upcall
+ * returns, but every pinned view takes away one slot of its sender's window,
+ * so handlers should release them promptly.
+ */
+class SSTMessageView {
+    std::shared_ptr<SSTSlotPins> pins;
+    uint32_t num_received_entry;
+    int32_t sst_index;
+    std::unique_ptr<char[]> copy;
+    const char* payload;
+    long long int payload_size;
+
+public:
+    SSTMessageView(std::shared_ptr<SSTSlotPins> slot_pins, uint32_t num_received_entry,
+                   int32_t sst_index, const char* payload, long long int payload_size);
+    SSTMessageView(const SSTMessageView&) = delete;
+    SSTMessageView(SSTMessageView&&) = default;
+    SSTMessageView& operator=(const SSTMessageView&) = delete;
+    SSTMessageView& operator=(SSTMessageView&& other);
+    ~SSTMessageView() { release(); }
+
+    const char* data() const { return payload; }
+    long long int size() const { return payload_size; }
+    /** True if the view points into the SST slot rather than at a copy */
+    bool is_pinned() const { return pins != nullptr; }
+    /** Lets the sender reuse the slot; the view can't be read afterwards. */
+    void release();
+};
+
+/**
+ * The part of a stream, given as an array of iovecs, that RawSubgroup::send_stream
+ * hasn't sent yet.
+ */
+class StreamCursor {
+    const struct iovec* iov;
+    int iovcnt;
+    /** The bytes of iov[0] already sent */
+    std::size_t iov_offset = 0;
+    std::size_t remaining_bytes = 0;
+
+public:
+    StreamCursor(const struct iovec* iov, int iovcnt);
+    std::size_t remaining() const { return remaining_bytes; }
+    /** Copies the next size bytes of the stream to dest, which must be at
+     * most remaining(), and advances past them */
+    void copy_to(char* dest, std::size_t size);
 };
 
 /**
@@ -180,6 +445,87 @@ struct SubgroupSettings {
     uint32_t num_received_offset;
     /** The operation mode of the subgroup */
     Mode mode;
+    /** The subgroup's profile, which names the config section whose settings
+     * override the group's DerechoParams for it; empty for none */
+    std::string profile;
+    /* The rest are the subgroup's own DerechoParams, and where its parts of
+     * the SST are; ViewManager::lay_out_subgroups fills them in */
+    /** The block size of the subgroup's RDMC messages */
+    long long unsigned int block_size = 0;
+    /** The largest message, with its header, that can be sent in the subgroup */
+    long long unsigned int max_msg_size = 0;
+    /** The largest message, with its header, that can be sent by SST multicast */
+    long long unsigned int sst_max_msg_size = 0;
+    /** The largest message that can be sent as a single inline write, or 0 */
+    long long unsigned int inline_max_msg_size = 0;
+    rdmc::send_algorithm rdmc_send_algorithm = rdmc::send_algorithm::BINOMIAL_SEND;
+    unsigned int window_size = 0;
+    /** The number of RDMC messages a sender can have in flight in the
+     * subgroup; each sender gets this many RDMC groups ("lanes"), since an
+     * RDMC group only carries one message at a time */
+    uint32_t max_outstanding_rdmc_sends = 1;
+    /** In an ORDERED subgroup, a sender's message can only be sent once the
+     * whole shard has persisted the one persistence_window messages before
+     * it; at least window_size */
+    unsigned int persistence_window = 0;
+    /** Whether the payloads of the subgroup's RDMC messages are compressed */
+    bool rdmc_compression = false;
+    /** Whether the shard's senders take turns starting RDMC sends, passing
+     * a token around in DerechoSST::send_token */
+    bool rdmc_send_token = false;
+    /** Whether this node publishes the subgroup's versions as persisted once
+     * they are delivered, ahead of the flushes of its logs */
+    bool persist_in_memory = false;
+    /** The offset, in bytes, of the subgroup's message slots in the SST's slots
+     * field, which subgroups with no sender in common may share */
+    uint64_t slots_offset = 0;
+    /** The offset of the subgroup's delivery order ring in the SST's
+     * sequence_order field, if it is SEQUENCED */
+    uint32_t sequence_order_offset = 0;
+    /** Whether an ORDERED subgroup's messages are delivered by a thread of
+     * its own instead of the SST predicate thread */
+    bool delivery_executor = false;
+    /** This node's sender thread serves the subgroups with pending sends in
+     * order of send_priority, highest first, and only sends in a subgroup
+     * when no subgroup of a higher priority can send */
+    int send_priority = 0;
+    /** Among subgroups of the same priority, the number of messages in a row
+     * the sender thread sends in the subgroup on its turn */
+    uint32_t send_weight = 1;
+};
+
+/** The ways a message can be sent, from the cheapest to the most general */
+enum class TransportTier {
+    /** A single inline RDMA write of the message and its SST slot's guard */
+    INLINE,
+    /** An SST slot, written separately from its guard */
+    SST,
+    /** An RDMC multicast */
+    RDMC
+};
+
+/**
+ * Counts the messages this node has sent in a subgroup and how many of them
+ * it has delivered, so that a thread can wait until the messages it sent
+ * have been delivered here before it reads the local replica. The counts
+ * carry over from one view to the next, like the messages that a view
+ * change sends again; null messages aren't counted.
+ */
+class OwnDeliveryProgress {
+    /** The messages sent, counting a packed message once when it goes out */
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> delivered{0};
+    /** The number of threads in wait_for(), so delivery only takes the
+     * mutex when someone is waiting */
+    std::atomic<uint32_t> waiters{0};
+    std::mutex mutex;
+    std::condition_variable delivered_cv;
+    friend class MulticastGroup;
+
+public:
+    /** Blocks until ticket (a value of MulticastGroup::get_send_ticket)
+     * of this node's messages have been delivered here */
+    void wait_for(uint64_t ticket);
 };
 
 /** Implements the low-level mechanics of tracking multicasts in a Derecho group,
@@ -200,20 +546,6 @@ private:
     /** index of the local node in the members vector, which should also be its row index in the SST */
     const int member_index;
 
-public:
-    /** Block size used for message transfer.
-     * we keep it simple; one block size for messages from all senders */
-    const long long unsigned int block_size;
-    // maximum size of any message that can be sent
-    const long long unsigned int max_msg_size;
-    // maximum size of message that can be sent using SST multicast
-    const long long unsigned int sst_max_msg_size;
-    /** Send algorithm for constructing a multicast from point-to-point unicast.
-     *  Binomial pipeline by default. */
-    const rdmc::send_algorithm rdmc_send_algorithm;
-    const unsigned int window_size;
-
-private:
     /** Message-delivery event callbacks, supplied by the client, for "raw" sends */
     const CallbackSet callbacks;
     uint32_t total_num_subgroups;
@@ -222,65 +554,326 @@ private:
     const std::map<subgroup_id_t, SubgroupSettings> subgroup_settings;
     /** Used for synchronizing receives by RDMC and SST */
     std::vector<std::list<int32_t>> received_intervals;
-    /** Maps subgroup IDs for which this node is a sender to the RDMC group it should use to send.
-     * Constructed incrementally in create_rdmc_sst_groups(), so it can't be const.  */
-    std::map<subgroup_id_t, uint32_t> subgroup_to_rdmc_group;
+    /** Maps subgroup IDs for which this node is a sender to the RDMC groups it should use to send,
+     * one per lane. Constructed incrementally in create_rdmc_sst_groups(), so it can't be const.  */
+    std::map<subgroup_id_t, std::vector<uint32_t>> subgroup_to_rdmc_group;
     /** These two callbacks are internal, not exposed to clients, so they're not in CallbackSet */
     rpc_handler_t rpc_callback;
 
     /** Offset to add to member ranks to form RDMC group numbers. */
     uint16_t rdmc_group_num_offset;
+    /** Every RDMC group create_rdmc_sst_groups() created */
+    std::vector<uint16_t> rdmc_group_numbers;
+    /** The RDMC groups wedge() removed, which are destroyed with this
+     * MulticastGroup, after the next view is installed, instead of while
+     * the view change waits for the wedge */
+    rdmc::detached_groups retired_rdmc_groups;
     /** false if RDMC groups haven't been created successfully */
     bool rdmc_sst_groups_created = false;
-    /** Stores message buffers not currently in use. Protected by
-     * msg_state_mtx */
-    std::map<uint32_t, std::vector<MessageBuffer>> free_message_buffers;
+    /** The RDMC message buffers of each subgroup that are not currently in
+     * use, indexed by subgroup number; null for the subgroups this node is
+     * not in. Each is sized for the subgroup's window when the view is
+     * installed and doesn't grow, and is shared with the MulticastGroups of
+     * later views while the subgroup's messages keep the same size. */
+    std::vector<std::shared_ptr<MessageBufferPool>> buffer_pools;
 
     /** Index to be used the next time get_sendbuffer_ptr is called.
      * When next_message is not none, then next_message.index = future_message_index-1 */
     std::vector<message_id_t> future_message_indices;
+    /** Whether an ordered subgroup sender that falls behind may skip indices
+     * through null_skip_index, rather than always sending null messages */
+    const bool skip_null_messages;
+    /** Whether the minimum of each shard's stable_num is folded up a tree
+     * of aggregators and published in shard_stable_num, see ShardRows */
+    const bool aggregated_stability;
+    /** With aggregated stability, the number of members in each group */
+    const uint32_t aggregation_fanout;
+    /** How many indices past the ones it must fill each subgroup's next skip
+     * covers. Grows while this node stays idle and goes back to 0 when it
+     * sends a message. Guarded by the subgroup's msg_state_mtxs. */
+    std::vector<uint32_t> null_skip_ahead;
 
     /** next_message is the message that will be sent when send is called the next time.
      * It is std::nullopt when there is no message to send. */
     std::vector<std::optional<RDMCMessage>> next_sends;
-    std::map<uint32_t, bool> pending_sst_sends;
+    /** True while an SST buffer has been handed out but not sent, indexed by
+     * subgroup number. Not a vector<bool>, since the elements of one share
+     * memory words and couldn't be written under different subgroups' locks. */
+    std::vector<char> pending_sst_sends;
     /** Messages that are ready to be sent, but must wait until the current send finishes. */
     std::vector<std::queue<RDMCMessage>> pending_sends;
-    /** Vector of messages that are currently being sent out using RDMC, or boost::none otherwise. */
-    /** one per subgroup */
-    std::vector<std::optional<RDMCMessage>> current_sends;
+    /** Cooked sends in ordered subgroups whose payload, plus its size prefix,
+     * fits in this many bytes are packed together into one message; 0 turns
+     * packing off. A subgroup whose messages are smaller packs into its
+     * largest message instead; see SendGate::aggregation_size. */
+    const uint32_t rpc_aggregation_size;
+    /** How long, in nanoseconds, a packed message waits for more sends */
+    const uint64_t rpc_aggregation_delay_ns;
+    /** The packed message a subgroup is filling. Its buffer is the subgroup's
+     * next_sends entry or pending SST slot, which stays taken until it is sent. */
+    struct RPCAggregate {
+        /** The start of the message's payload, or nullptr if none is open */
+        char* payload = nullptr;
+        /** Bytes of the payload used by completed sends */
+        std::size_t used = 0;
+        /** The size of the send handed out by get_sendbuffer_ptr and not yet sent, or 0 */
+        std::size_t reserved = 0;
+        /** When the message must go out, in get_time() nanoseconds */
+        uint64_t deadline = 0;
+    };
+    /** Indexed by subgroup number; protected by the subgroup's msg_state_mtxs entry */
+    std::vector<RPCAggregate> rpc_aggregates;
+    /** Messages that are currently being sent out using RDMC, by [subgroup number] -> [lane],
+     * or std::nullopt for a lane that is idle */
+    std::vector<std::vector<std::optional<RDMCMessage>>> current_sends;
 
-    /** Messages that are currently being received. */
-    std::map<std::pair<subgroup_id_t, node_id_t>, RDMCMessage> current_receives;
+    /** Messages that are currently being received, by [subgroup number] -> [(sender ID, lane)] */
+    std::vector<std::map<std::pair<node_id_t, uint32_t>, RDMCMessage>> current_receives;
 
     /** Messages that have finished sending/receiving but aren't yet globally stable.
-     * Organized by [subgroup number] -> [sequence number] -> [message] */
-    std::map<subgroup_id_t, std::map<message_id_t, RDMCMessage>> locally_stable_rdmc_messages;
-    /** Same map as locally_stable_rdmc_messages, but for SST messages */
-    std::map<subgroup_id_t, std::map<message_id_t, SSTMessage>> locally_stable_sst_messages;
-    std::map<subgroup_id_t, std::set<uint64_t>> pending_message_timestamps;
-    std::map<subgroup_id_t, std::map<message_id_t, uint64_t>> pending_persistence;
+     * Organized by [subgroup number] -> [sequence number] -> [message]. The
+     * rings are sized for the subgroup's window when the view is installed. */
+    std::vector<SequenceRing<RDMCMessage>> locally_stable_rdmc_messages;
+    /** Same as locally_stable_rdmc_messages, but for SST messages */
+    std::vector<SequenceRing<SSTMessage>> locally_stable_sst_messages;
+    /** The send timestamps of this node's messages that aren't finished with yet
+     * (delivered, or persisted if the subgroup is persistent), by subgroup number */
+    std::vector<TimestampQueue> pending_message_timestamps;
+    /** The ChangeStream ring of each ordered or sequenced subgroup, by subgroup
+     * number, or nullptr if delivered messages aren't being streamed */
+    std::vector<ChangeRing*> change_rings;
+    /** Timestamps of this node's delivered messages, by [subgroup number] -> [sequence number],
+     * until they are persisted by the whole shard */
+    std::vector<SequenceRing<uint64_t>> pending_persistence;
     /** Messages that are currently being written to persistent storage */
-    std::map<subgroup_id_t, std::map<message_id_t, RDMCMessage>> non_persistent_messages;
+    std::vector<SequenceRing<RDMCMessage>> non_persistent_messages;
     /** Messages that are currently being written to persistent storage */
-    std::map<subgroup_id_t, std::map<message_id_t, SSTMessage>> non_persistent_sst_messages;
+    std::vector<SequenceRing<SSTMessage>> non_persistent_sst_messages;
+    /** A delivered raw message whose upcall and version wait for the end of its batch */
+    struct BatchedMessage {
+        message_id_t seq_num;
+        uint64_t timestamp;
+        node_id_t sender_id;
+        /** Null messages are only batched to keep their slots' release in order, and get no version */
+        bool null_message;
+        /** For an RDMC message, the buffer to free once the batch is delivered */
+        MessageBuffer rdmc_buffer;
+        /** For an SST message, its receive slot; sst_index is -1 for RDMC messages */
+        uint32_t num_received_entry;
+        int32_t sst_index;
+    };
+    /** The messages of the delivery batch each subgroup is building, and the
+     * payloads among them that will be passed to global_stability_batch_callback.
+     * Both are always empty outside of delivery_trigger and deliver_messages_upto. */
+    std::vector<std::vector<BatchedMessage>> batched_messages;
+    std::vector<std::vector<DeliveredMessage>> delivery_batches;
 
     std::vector<message_id_t> next_message_to_deliver;
-    std::mutex msg_state_mtx;
-    std::condition_variable sender_cv;
+    /** One lock per subgroup, indexed by subgroup number, protecting all of
+     * the per-subgroup message state above. A thread never holds more than
+     * one of them, except while a new view takes over the old view's state. */
+    std::vector<std::mutex> msg_state_mtxs;
+    /** Serializes the dirty-range tracking of the SST fields that every
+     * subgroup's receiver trigger shares */
+    std::mutex sst_dirty_mtx;
+    /** What a sender thread sleeps on while none of its subgroups can send */
+    struct SenderWakeup {
+        /** Protects count; ordered after any subgroup's msg_state_mtxs entry */
+        std::mutex mtx;
+        std::condition_variable cv;
+        /** Incremented whenever one of the thread's subgroups may have something
+         * new to send, so that the thread can check its subgroups without
+         * holding mtx and still not miss a wakeup */
+        uint64_t count = 0;
+    };
+    /** The values should_send_to_subgroup() needs for a subgroup, computed
+     * once per view instead of on every check */
+    /** The SST rows of a subgroup's shard, looked up once per view instead of
+     * through node_id_to_sst_index every time a predicate runs */
+    struct ShardRows {
+        /** The row of each shard member, by shard rank */
+        std::vector<uint32_t> members;
+        /** The byte offset of each member's row from row 0, for min_over_rows */
+        std::vector<uint32_t> member_offsets;
+        /** The row of each shard sender, by sender rank */
+        std::vector<uint32_t> senders;
+        /** The shard rank of each shard sender, by sender rank */
+        std::vector<uint32_t> sender_shard_ranks;
+        /** The rows this node sends its stable_num to: every member, or with
+         * aggregated stability only the leader of its group */
+        std::vector<uint32_t> stable_num_targets;
+        /** With aggregated stability, the rows of the group this node leads,
+         * and their byte offsets; empty if it leads none. The groups are runs
+         * of aggregation_fanout shard ranks, each led by its first member. */
+        std::vector<uint32_t> group_rows;
+        std::vector<uint32_t> group_offsets;
+        /** With aggregated stability, the rows of the group leaders and their
+         * byte offsets if this node is the shard member with shard rank 0
+         * (the root of the tree); empty otherwise */
+        std::vector<uint32_t> leader_rows;
+        std::vector<uint32_t> leader_offsets;
+    };
+    /** Indexed by subgroup number; only filled in for subgroups this node belongs to */
+    std::vector<ShardRows> shard_rows;
+
+    /**
+     * The minima over a subgroup's shard members of the SST columns its
+     * predicates aggregate. A named function in the subgroup's predicate
+     * partition recomputes them at the start of each pass of the detect loop,
+     * so the predicates and triggers of the pass read (and watch) these
+     * instead of each scanning the rows again. Only written and read by the
+     * subgroup's predicate thread; each starts out at -1, which is no more than
+     * any value the column can hold, until the named function first runs.
+     */
+    struct ShardMinima {
+        /** Ordered and sequenced subgroups without aggregated stability */
+        message_id_t stable_num = -1;
+        /** Ordered and sequenced subgroups */
+        persistent::version_t persisted_num = -1;
+        /** FIFO and raw subgroups: the num_received of each sender, by sender rank */
+        std::vector<int32_t> num_received;
+    };
+    /** Indexed by subgroup number; only filled in for subgroups this node belongs to */
+    std::vector<ShardMinima> shard_minima;
+    /** The newest version of each subgroup reported to
+     * callbacks.global_persistence_range_callback, carried over from the
+     * previous view; only used by the subgroup's predicate thread */
+    std::vector<persistent::version_t> global_persistence_frontiers;
+
+    /**
+     * The progress of this node through the delivery order of a SEQUENCED
+     * subgroup. The sequencer, which is the shard member with shard rank 0,
+     * publishes the order in its sequence_order entries as a ring of sender
+     * ranks: the message with sequence number g is the next message of the
+     * sender in slot g % order_length, and sequenced_num is the last g
+     * assigned. Guarded by the subgroup's msg_state_mtxs.
+     */
+    struct SequencerState {
+        /** The subgroup's first entry in sequence_order, and the number of entries */
+        uint32_t order_offset = 0;
+        uint32_t order_length = 0;
+        /** At the sequencer, the index of each sender's last message placed in the order */
+        std::vector<int32_t> ordered_through;
+        /** The index of each sender's last message up to seq_num in the order */
+        std::vector<int32_t> received_through;
+    };
+    /** Indexed by subgroup number; only filled in for this node's SEQUENCED subgroups */
+    std::vector<SequencerState> sequencer_states;
+
+    struct SendGate {
+        std::vector<uint32_t> shard_sst_indices;
+        uint32_t num_shard_senders = 0;
+        int32_t shard_sender_index = -1;
+        uint32_t num_received_offset = 0;
+        Mode mode = Mode::ORDERED;
+        unsigned int window_size = 0;
+        uint32_t max_outstanding_rdmc_sends = 1;
+        /** The size of the subgroup's packed messages, if packing is on */
+        uint32_t aggregation_size = 0;
+        /** The number of its messages this node lets be in flight, which is
+         * window_size unless adaptive_window moves it below that */
+        unsigned int effective_window = 0;
+        /** The sends of the current adaptation epoch, which lasts for
+         * effective_window sends, and those that had to wait for the window */
+        uint32_t epoch_sends = 0;
+        uint32_t epoch_stalls = 0;
+        /** The total and shortest of those waits, in nanoseconds */
+        uint64_t epoch_stall_ns = 0;
+        uint64_t epoch_min_stall_ns = 0;
+        /** When the current wait for the window started, or 0 */
+        uint64_t stall_start = 0;
+        unsigned int persistence_window = 0;
+        /** When the current wait for the shard to persist started, or 0 */
+        uint64_t persistence_stall_start = 0;
+        int send_priority = 0;
+        /** The subgroups this node sends in with a higher send_priority; an
+         * SST send waits while any of them has an RDMC send queued */
+        std::vector<subgroup_id_t> higher_priority_subgroups;
+        /** Whether this node takes turns with the other senders of the shard
+         * to start RDMC sends (rdmc_send_token with more than one sender) */
+        bool send_token = false;
+        /** The SST row of each shard sender, by sender rank */
+        std::vector<uint32_t> sender_sst_indices;
+        /** The turn of the token this node last saw itself holding */
+        uint64_t held_token = 0;
+        /** The RDMC sends this node has started in that turn */
+        uint32_t token_turn_sends = 0;
+    };
+    /** Indexed by subgroup number; only filled in for subgroups this node belongs to */
+    std::vector<SendGate> send_gates;
+    /** Whether each sender adapts its effective window to how it stalls;
+     * see record_window_send() */
+    const bool adaptive_window;
 
     /** The time, in milliseconds, that a sender can wait to send a message before it is considered failed. */
     unsigned int sender_timeout;
+    /** The suspicion level (phi) at which the timeout thread reports a
+     * member whose heartbeats are late; 0 turns this detection off */
+    const double failure_phi_threshold;
+    /** What the timeout thread has seen of a member's heartbeats */
+    struct HeartbeatHistory {
+        uint64_t last_heartbeat = 0;
+        /** When last_heartbeat arrived, in get_time() nanoseconds */
+        uint64_t last_arrival = 0;
+        /** Moving mean and variance of the nanoseconds between heartbeats */
+        double mean_interval = 0;
+        double interval_variance = 0;
+        uint32_t num_intervals = 0;
+        bool reported = false;
+    };
+    /** Indexed by SST row; only used by the timeout thread */
+    std::vector<HeartbeatHistory> heartbeat_histories;
 
     /** Indicates that the group is being destroyed. */
     std::atomic<bool> thread_shutdown{false};
-    /** The background thread that sends messages with RDMC. */
-    std::thread sender_thread;
+    /** The number of background threads that send messages with RDMC. Each
+     * subgroup is served by the thread numbered (subgroup number % num_sender_threads). */
+    const uint32_t num_sender_threads;
+    /** One per sender thread */
+    std::vector<SenderWakeup> sender_wakeups;
+    /** Whether a get_sendbuffer_ptr has failed in each subgroup since the
+     * last call to callbacks.send_space_callback; only set if it exists */
+    std::vector<std::atomic<bool>> send_space_wanted;
+    /** The number of messages in each subgroup's pending_sends, which the
+     * senders of lower priority subgroups read without taking its lock */
+    std::vector<std::atomic<uint32_t>> queued_rdmc_sends;
+    /** The background threads that send messages with RDMC. */
+    std::vector<std::thread> sender_threads;
 
     std::thread timeout_thread;
 
+    /** A stable message of an ORDERED subgroup, for its delivery executor to
+     * deliver. A task without a message only advances delivered_num over
+     * sequence numbers that their senders skipped. */
+    struct DeliveryTask {
+        message_id_t seq_num;
+        uint64_t timestamp;
+        std::optional<RDMCMessage> rdmc_msg;
+        std::optional<SSTMessage> sst_msg;
+    };
+    /**
+     * The thread that runs the delivery upcalls of an ORDERED subgroup whose
+     * SubgroupSettings::delivery_executor is set, so that a slow handler
+     * doesn't hold up the SST predicate thread. delivery_trigger queues the
+     * stable messages in order, and the thread delivers them, versions them,
+     * and only then releases their buffers and advances delivered_num.
+     */
+    struct DeliveryExecutor {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<DeliveryTask> tasks;
+        bool shutdown = false;
+        /** The last sequence number queued; only used under the subgroup's lock */
+        message_id_t queued_through = -1;
+        std::thread thread;
+    };
+    /** Indexed by subgroup number; null for subgroups without an executor */
+    std::vector<std::unique_ptr<DeliveryExecutor>> delivery_executors;
+
     /** The SST, shared between this group and its GMS. */
     std::shared_ptr<DerechoSST> sst;
+    /** The SST multicast messages pinned by SSTMessageViews, shared with the views */
+    std::shared_ptr<SSTSlotPins> slot_pins;
 
     /** The SSTs for multicasts **/
     std::vector<std::unique_ptr<sst::multicast_group<DerechoSST>>> sst_multicast_group_ptrs;
@@ -290,24 +883,180 @@ private:
     std::list<pred_handle> stability_pred_handles;
     std::list<pred_handle> delivery_pred_handles;
     std::list<pred_handle> persistence_pred_handles;
+    std::list<pred_handle> sequencer_pred_handles;
     std::list<pred_handle> sender_pred_handles;
+    std::list<pred_handle> send_space_pred_handles;
+    std::list<pred_handle> shard_minima_handles;
 
-    std::vector<bool> last_transfer_medium;
+    /** Whether the last buffer handed out for each subgroup was for RDMC (vs. SST).
+     * Not a vector<bool>, for the same reason as pending_sst_sends. */
+    std::vector<char> last_transfer_medium;
+    /** The number of messages each subgroup has sent with each TransportTier;
+     * a packed message counts once. Guarded by the subgroup's msg_state_mtxs. */
+    std::vector<std::array<uint64_t, 3>> tier_send_counts;
+    /** The latency histograms of the messages this node receives, by subgroup
+     * number, or null if latency stats are off. Shared with the next view's
+     * MulticastGroup, so they cover the node's whole time in the group. */
+    std::shared_ptr<std::vector<SubgroupLatencyHistograms>> latency_histograms;
+    /** The own-message counts of each subgroup, by subgroup number; shared
+     * with the next view's MulticastGroup and with threads waiting on them */
+    std::shared_ptr<std::vector<OwnDeliveryProgress>> own_delivery_progress;
+    /** The send timestamps of delivered messages, by [subgroup number] -> [sequence number],
+     * until the shard has persisted them; only kept for latency stats */
+    std::vector<SequenceRing<uint64_t>> unpersisted_send_timestamps;
+    /** How often check_failures_loop prints the latency stats, or 0 for never */
+    const uint64_t latency_stats_dump_interval_ns;
+    /** The registry's counters for one subgroup's traffic, which outlive
+     * this MulticastGroup and keep counting in the next view. */
+    struct SubgroupMetrics {
+        std::array<MetricCounter*, 3> sends_by_tier;
+        MetricCounter* rdmc_bytes_sent;
+        MetricCounter* messages_delivered;
+        /** The sends that waited for the shard to persist earlier messages,
+         * and the nanoseconds they waited */
+        MetricCounter* persistence_stalls;
+        MetricCounter* persistence_stall_ns;
+    };
+    /** Indexed by subgroup number; only filled in for this node's subgroups */
+    std::vector<SubgroupMetrics> subgroup_metrics;
+    /** The metrics this MulticastGroup reads when they are pulled, which the
+     * destructor removes from the registry */
+    std::vector<uint64_t> metrics_reader_ids;
 
     /** persistence manager callbacks */
     persistence_manager_callbacks_t persistence_manager_callbacks;
 
-    /** Continuously waits for a new pending send, then sends it. This function
-     * implements the sender thread. */
-    void send_loop();
+    /** Sends the message opened by get_sendbuffer_ptr; see send() */
+    bool send_next(subgroup_id_t subgroup_num);
+    /** Sends the message opened by get_new_sendbuffer_ptr, by RDMC or SST
+     * multicast; the caller must hold the subgroup's lock */
+    void send_opened_message(subgroup_id_t subgroup_num);
+    /** Arms callbacks.send_space_callback after get_sendbuffer_ptr found no
+     * room for a send, and passes on its result */
+    char* want_send_space_if_null(subgroup_id_t subgroup_num, char* buffer);
+    /** Opens a new message for get_sendbuffer_ptr, in app_buffer if it has
+     * a region; the caller must hold the subgroup's lock */
+    char* get_new_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size, bool cooked_send,
+                                 const rdmc::receive_destination& app_buffer = {nullptr, 0});
+    /** Hands out room for a cooked send in the subgroup's packed message,
+     * opening one if needed. The caller must hold the subgroup's lock. */
+    char* get_aggregated_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size);
+    /** Sends the subgroup's packed message, if it has one and no send is
+     * still being written into it. The caller must hold the subgroup's lock. */
+    void flush_rpc_aggregate(subgroup_id_t subgroup_num);
+    /** Sends the packed messages of the given subgroups whose deadline has
+     * passed. Returns the earliest deadline of the ones left open, or 0. */
+    uint64_t flush_expired_rpc_aggregates(const std::vector<subgroup_id_t>& subgroup_nums);
+
+    /** Continuously waits for a new pending send in one of the thread's
+     * subgroups, then sends it. This function implements the sender threads.
+     * @param thread_index Which of the num_sender_threads threads this is */
+    void send_loop(uint32_t thread_index);
 
     uint64_t get_time();
 
     /** Checks for failures when a sender reaches its timeout. This function
      * implements the timeout thread. */
     void check_failures_loop();
+    /**
+     * Called by the timeout thread after each of its own heartbeats. Updates
+     * what it has seen of each other member's heartbeats, and freezes the
+     * row of a member whose current silence is unlikely enough, given the
+     * mean and jitter of its past intervals: the suspicion is
+     * phi = -log10(P(an interval is at least this long)), from a normal
+     * distribution whose deviation is at least half a tick. A member is
+     * only judged after 8 intervals.
+     */
+    void check_heartbeats(uint64_t current_time);
+
+    /** Times a stage of a message from its header timestamp, if latency stats are on. */
+    void record_latency(subgroup_id_t subgroup_num, LatencyStage stage, uint64_t msg_timestamp) {
+        if(latency_histograms && msg_timestamp != 0) {
+            const uint64_t now = get_time();
+            (*latency_histograms)[subgroup_num][static_cast<int>(stage)].record(now > msg_timestamp ? now - msg_timestamp : 0);
+        }
+    }
+
+    /** Counts a delivered message for OwnDeliveryProgress if this node sent it */
+    void count_own_delivery(subgroup_id_t subgroup_num, node_id_t sender_id);
+    /** Counts a send of a subgroup by its tier. The caller must hold the subgroup's lock. */
+    void count_send(subgroup_id_t subgroup_num, TransportTier tier) {
+        (*own_delivery_progress)[subgroup_num].sent++;
+        tier_send_counts[subgroup_num][static_cast<int>(tier)]++;
+        subgroup_metrics[subgroup_num].sends_by_tier[static_cast<int>(tier)]->add();
+    }
+    /** Creates this node's counters in the MetricsRegistry and registers the
+     * gauges read from this MulticastGroup's queues and SST */
+    void register_metrics();
+    /** Removes the metrics registered by register_metrics that read this MulticastGroup */
+    void unregister_metrics();
+
+    /** Signals the sender thread serving a subgroup that the subgroup may have a message ready to send */
+    void wake_sender_thread(subgroup_id_t subgroup_num);
+    /** Adds a message to the subgroup's pending_sends; the caller must hold
+     * the subgroup's lock or be constructing the group */
+    void queue_rdmc_send(subgroup_id_t subgroup_num, RDMCMessage&& msg);
+    /** The current turn of a subgroup's send token (see DerechoSST::send_token) */
+    uint64_t current_send_token(subgroup_id_t subgroup_num) const;
+    /** Whether this node holds a subgroup's send token; starts a new turn
+     * if it has just received it. The caller must hold the subgroup's lock. */
+    bool take_send_token(subgroup_id_t subgroup_num);
+    /** In a subgroup with a send token, if this node holds it: wakes the
+     * sender thread for its turn, or passes the token on to the next sender
+     * waiting for it once the turn is over. The caller must hold the
+     * subgroup's lock. */
+    void update_send_token(subgroup_id_t subgroup_num);
+    /** Asks the PersistenceManager to persist a subgroup up to a delivered
+     * version, which a persist_in_memory subgroup also publishes as
+     * persisted right away */
+    void post_persistence_request(subgroup_id_t subgroup_num, persistent::version_t version);
+    /** For a subgroup with rdmc_compression: marks whether a message is sent
+     * compressed, and if its payload gets smaller with LZ4, puts the copy
+     * that RDMC should send in its wire_buffer */
+    void compress_rdmc_message(subgroup_id_t subgroup_num, RDMCMessage& msg);
+    /**
+     * Replaces a received compressed message with the message it was made from.
+     * @throws derecho_exception if the message claims a payload larger than
+     * the subgroup's messages, or doesn't decompress to the size it claims;
+     * a member that sends such a message is not following the protocol.
+     */
+    void decompress_rdmc_message(subgroup_id_t subgroup_num, RDMCMessage& msg);
+    /** Whether a subgroup this node sends in with a higher send_priority
+     * than subgroup_num's has RDMC sends queued */
+    bool higher_priority_sends_queued(subgroup_id_t subgroup_num) const;
+    /** Calls callbacks.send_space_callback for the lower priority subgroups
+     * that are waiting for send space, once subgroup_num has no RDMC sends
+     * queued; the caller must not hold any subgroup's lock */
+    void release_lower_priority_senders(subgroup_id_t subgroup_num);
+    /** Fills in shard_rows for the subgroups this node belongs to */
+    void compute_shard_rows();
+    /** Fills in send_gates for the subgroups this node belongs to */
+    void compute_send_gates();
+    /**
+     * Called with the subgroup's lock held for each message get_new_sendbuffer_ptr
+     * hands out while adaptive_window is on. Every effective_window sends, if
+     * the sender had to wait for the window in at least an eighth of them,
+     * the waits show what limits it: if they averaged under four times the
+     * shortest one, the window kept reopening about a round trip after it
+     * filled, so it is doubled, up to window_size; otherwise the receivers
+     * are pushing back, and it is cut by a quarter.
+     */
+    void record_window_send(SendGate& gate);
+    /** Starts the sender threads; called at the end of construction */
+    void start_sender_threads();
+    /** Checks whether a pending RDMC send in the subgroup can go out now;
+     * the caller must hold the subgroup's lock */
+    bool should_send_to_subgroup(subgroup_id_t subgroup_num);
 
     bool create_rdmc_sst_groups();
+    /** Sets up the buffer pool of each subgroup with the full-size buffers
+     * that buffers_for_subgroup() says it needs, reusing old_group's pool
+     * for a subgroup whose messages have the same size in both views.
+     * @param old_group The MulticastGroup of the previous view, or null */
+    void reserve_message_buffers(const MulticastGroup* old_group);
+    /** Preallocates the RDMC send lanes of every subgroup, and the
+     * sequence-number rings of every subgroup this node belongs to */
+    void allocate_message_rings();
     void initialize_sst_row();
     void register_predicates();
 
@@ -324,6 +1073,26 @@ private:
      * @param subgroup_num The ID of the subgroup this message is in
      */
     void deliver_message(SSTMessage& msg, subgroup_id_t subgroup_num);
+    /** Hands a cooked message's payload to the RPC layer, one packed send at a time if it is aggregated */
+    void deliver_rpc_payload(subgroup_id_t subgroup_num, node_id_t sender_id, bool aggregated,
+                             char* payload, uint64_t payload_size);
+
+    /**
+     * Hands the payload of a raw SST multicast to the client, through
+     * global_stability_view_callback if it is set and global_stability_callback
+     * otherwise. Null messages are not delivered.
+     */
+    void sst_stability_upcall(SSTMessage& msg, subgroup_id_t subgroup_num);
+
+    /** True if a raw message from the message buffer buf should be added to
+     * the subgroup's delivery batch instead of being delivered right away */
+    bool delivers_in_batch(const char* buf) const;
+    /** Moves a raw, locally stable message into the subgroup's delivery batch */
+    void add_to_batch(RDMCMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp);
+    void add_to_batch(SSTMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp);
+    /** Delivers the subgroup's delivery batch with one upcall, then versions
+     * and releases its messages. Does nothing if the batch is empty. */
+    void deliver_batch(subgroup_id_t subgroup_num);
 
     /**
      * Enqueues a single message for persistence with the persistence manager.
@@ -343,6 +1112,17 @@ private:
      * @param seq_num The sequence number of the message
      */
     void version_message(SSTMessage& msg, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp);
+    /** Does the work of version_message for a message sent by sender_id */
+    void version_message(node_id_t sender_id, subgroup_id_t subgroup_num, message_id_t seq_num, uint64_t msg_timestamp);
+    /**
+     * Records a message that is about to be delivered, and will get the
+     * version of seq_num, in the subgroup's change ring, if it has one. This
+     * must happen before deliver_message(), which releases an RDMC message's
+     * buffer.
+     * @param buf The message, starting with its header
+     * @param size The size of the message, header included
+     */
+    void tap_change(subgroup_id_t subgroup_num, node_id_t sender_id, message_id_t seq_num, const char* buf, uint64_t size);
 
     uint32_t get_num_senders(const std::vector<int>& shard_senders) {
         uint32_t num = 0;
@@ -355,29 +1135,95 @@ private:
     };
 
     int32_t resolve_num_received(int32_t index, uint32_t num_received_entry);
+    /** Records that a sender skipped every index below next_index that it
+     * had not sent yet, and returns the sender's new num_received. */
+    int32_t resolve_skipped_indices(int32_t next_index, uint32_t num_received_entry);
+    /** Applies the skips that the subgroup's senders announced in
+     * null_skip_index since they were last checked. The caller must hold the
+     * subgroup's lock, and update seq_num afterwards. */
+    void apply_null_skips(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                          uint32_t num_shard_senders, DerechoSST& sst);
+    /** Skips at least num_indices of this node's indices in a subgroup by
+     * announcing them in null_skip_index, if every message it has sent in the
+     * subgroup has been received by all members, so that the receivers can't
+     * mistake a message in flight for a skipped index. The caller must hold
+     * the subgroup's lock.
+     * @return Whether the indices were skipped; if not, nulls must be sent */
+    bool skip_null_indices(subgroup_id_t subgroup_num, uint32_t num_indices);
 
     /* Predicate functions for receiving and delivering messages, parameterized by subgroup.
      * register_predicates will create and bind one of these for each subgroup. */
 
+    /** The named function that updates shard_minima for a subgroup */
+    void update_shard_minima(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                             uint32_t num_shard_senders, const DerechoSST& sst);
+
+    /** The minimum of the stable_num of a subgroup's shard members. With
+     * aggregated stability, this node first does its part of the tree (folds
+     * and forwards its group's minimum if it leads a group, and publishes
+     * the shard's minimum if it is the root), then reads the root's
+     * shard_stable_num. The caller must hold the subgroup's lock. */
+    message_id_t shard_min_stable_num(subgroup_id_t subgroup_num, DerechoSST& sst);
     void delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
                           const uint32_t num_shard_members, DerechoSST& sst);
+    /** Starts the delivery executors of the subgroups that have them */
+    void start_delivery_executors();
+    /** Lets each delivery executor finish the messages queued for it, and
+     * stops it; called by wedge() once no more can be queued */
+    void stop_delivery_executors();
+    void delivery_executor_loop(subgroup_id_t subgroup_num);
+    /** Delivers a run of a subgroup's DeliveryTasks on its executor, with
+     * the same upcalls and batching as delivery_trigger, then publishes
+     * delivered_num for them */
+    void run_delivery_tasks(subgroup_id_t subgroup_num, std::deque<DeliveryTask>& tasks);
+    /** Versions the delivered messages of tasks [begin, end) and releases
+     * their buffers, under the subgroup's lock */
+    void finish_delivery_tasks(subgroup_id_t subgroup_num, std::deque<DeliveryTask>& tasks,
+                               std::size_t begin, std::size_t end);
+
+    /** The delivery trigger of a FIFO subgroup: delivers each sender's
+     * messages, in order, up to the last one that every member has received,
+     * and publishes the new delivered_index of each sender. */
+    void fifo_delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                               uint32_t num_shard_senders, DerechoSST& sst);
+    /** Delivers one message of a FIFO subgroup, without versioning it; the
+     * caller must hold the subgroup's lock. Does nothing if the sender
+     * skipped the sequence number. */
+    void deliver_fifo_message(subgroup_id_t subgroup_num, message_id_t seq_num);
+    /** In a SEQUENCED subgroup, extends the delivery order with the messages
+     * the sequencer has received, if this node is the sequencer, then
+     * advances this node's seq_num along the order as far as it has received
+     * the messages. The caller must hold the subgroup's lock, and publish
+     * seq_num if this returns true. */
+    bool advance_sequenced_seq_num(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                   uint32_t num_shard_senders);
+    /** The delivery trigger of a SEQUENCED subgroup: delivers the messages of
+     * the order up to the stable point, versioned by their place in it. */
+    void sequenced_delivery_trigger(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                    uint32_t num_shard_senders, DerechoSST& sst);
+    /** Delivers the message with sequence number seq_num in a SEQUENCED
+     * subgroup's order, and advances delivered_num and its sender's
+     * delivered_index past it. The caller must hold the subgroup's lock.
+     * @return Whether there was a message to deliver */
+    bool deliver_sequenced_message(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
+                                   uint32_t num_shard_senders, message_id_t seq_num);
+    /** Publishes this node's delivered_index entries of a FIFO subgroup to
+     * the shard, along with the delivered_num they imply. */
+    void publish_fifo_delivery(subgroup_id_t subgroup_num, uint32_t num_received_offset, uint32_t num_shard_senders);
 
     void sst_receive_handler(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                             const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                              uint32_t num_shard_senders, uint32_t sender_rank,
                              volatile char* data, uint64_t size);
 
     bool receiver_predicate(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                            const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                             uint32_t num_shard_senders, const DerechoSST& sst);
 
     void receiver_function(subgroup_id_t subgroup_num, const SubgroupSettings& curr_subgroup_settings,
-                           const std::map<uint32_t, uint32_t>& shard_ranks_by_sender_rank,
                            uint32_t num_shard_senders, DerechoSST& sst, unsigned int batch_size,
                            const std::function<void(uint32_t, volatile char*, uint32_t)>& sst_receive_handler_lambda);
 
-    // Internally used to automatically send a NULL message
-    void get_buffer_and_send_auto_null(subgroup_id_t subgroup_num);
+    // Internally used to automatically send num_nulls NULL messages
+    void get_buffer_and_send_auto_null(subgroup_id_t subgroup_num, uint32_t num_nulls = 1);
 
 public:
     /**
@@ -427,24 +1273,109 @@ public:
     void register_rpc_callback(rpc_handler_t handler) { rpc_callback = std::move(handler); }
 
     void deliver_messages_upto(const std::vector<int32_t>& max_indices_for_senders, subgroup_id_t subgroup_num, uint32_t num_shard_senders);
+    /**
+     * Computes the ragged trim of a SEQUENCED subgroup that ends its order
+     * at last_seq_num, which must be at least this node's delivered_num and
+     * at most its seq_num.
+     * @return The index of the last message of each sender that the trim
+     * delivers, by sender rank
+     */
+    std::vector<int32_t> sequenced_ragged_trim(subgroup_id_t subgroup_num, message_id_t last_seq_num);
     /** Get a pointer into the current buffer, to write data into it before sending */
     char* get_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size, bool cooked_send = false);
+    /**
+     * Like get_sendbuffer_ptr, but the message is sent from a registered
+     * region of the application's instead of one of Derecho's buffers, so a
+     * payload already in that region is sent without being copied. The
+     * region needs sizeof(header) bytes of room at app_buffer.offset, for
+     * the header, followed by the payload, which is where the returned
+     * pointer points. Such a message always goes by RDMC. The region must be
+     * in host memory, and must stay valid and unchanged until the message
+     * has been delivered (and persisted, in persistent subgroups), as with
+     * the regions of CallbackSet::receive_allocator.
+     */
+    char* get_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                             const rdmc::receive_destination& app_buffer);
     /** Note that get_sendbuffer_ptr and send are called one after the another - regexp for using the two is (get_sendbuffer_ptr.send)*
      * This still allows making multiple send calls without acknowledgement; at a single point in time, however,
-     * there is only one message per sender in the RDMC pipeline */
+     * there are at most max_outstanding_rdmc_sends messages per sender in the RDMC pipeline.
+     * Threads that send in the same raw subgroup at once can use RawSubgroup::reserve_send instead. */
     bool send(subgroup_id_t subgroup_num);
+    /**
+     * Sends as much of a stream as the send window has room for, as raw
+     * messages of at most the maximum payload size, taking the subgroup's
+     * lock once rather than twice per message as get_sendbuffer_ptr and send
+     * do. See RawSubgroup::send_stream.
+     * @param cursor The rest of the stream, which is advanced past what is sent
+     * @param last_timestamp Set to the timestamp of the last message sent
+     * @return The number of messages sent, 0 if there was no room
+     */
+    uint32_t send_stream(subgroup_id_t subgroup_num, StreamCursor& cursor, uint64_t& last_timestamp);
     bool check_pending_sst_sends(subgroup_id_t subgroup_num);
 
     const uint64_t compute_global_stability_frontier(subgroup_id_t subgroup_num);
+    /**
+     * @return The latest version that every member of a subgroup's shard has
+     * persisted, from their persisted_num columns, or -1 if there is none yet.
+     * Since it is persisted at every member, a read of this version gets the
+     * same state at each of them.
+     */
+    persistent::version_t compute_global_persistence_frontier(subgroup_id_t subgroup_num);
+
+    /**
+     * @return A ticket for the messages this node has sent in a subgroup so
+     * far, including a packed message still being filled: once this many of
+     * its messages have been delivered here, all of them have been. Pass it
+     * to the wait_for() of get_own_delivery_progress()[subgroup_num].
+     */
+    uint64_t get_send_ticket(subgroup_id_t subgroup_num);
+
+    /**
+     * @return The read index of an ordered or sequenced subgroup: this
+     * node's seq_num, the last message it has received in the delivery
+     * order. Delivering a message at any member needs every member's
+     * stable_num, and so its seq_num, to have reached it first, so every
+     * update delivered anywhere in the shard by now is at or below this.
+     */
+    message_id_t get_read_index(subgroup_id_t subgroup_num) {
+        return sst->seq_num[member_index][subgroup_num];
+    }
+    /** @return Whether this node has delivered every message up to read_index */
+    bool delivered_through(subgroup_id_t subgroup_num, message_id_t read_index) {
+        return sst->delivered_num[member_index][subgroup_num] >= read_index;
+    }
+    std::shared_ptr<std::vector<OwnDeliveryProgress>> get_own_delivery_progress() {
+        return own_delivery_progress;
+    }
 
     /** Stops all sending and receiving in this group, in preparation for shutting it down. */
     void wedge();
     /** Debugging function; prints the current state of the SST to stdout. */
     void debug_print();
+    /** The registered memory that a MulticastGroup with these subgroup
+     * settings reserves for RDMC message buffers when it is constructed */
+    static uint64_t reserved_message_buffer_bytes(const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings);
     static long long unsigned int compute_max_msg_size(
             const long long unsigned int max_payload_size,
             const long long unsigned int block_size,
             bool using_rdmc);
+    /**
+     * Picks the largest message size for the inline tier: the configured
+     * max_inline_payload_size, or, if that is -1, whatever the RDMA provider
+     * can inline along with an SST slot's trailer. Never more than
+     * sst_max_msg_size, or than fits in one cache line with the trailer,
+     * since the tier assumes the NIC places a write that small in one piece.
+     */
+    static long long unsigned int compute_inline_max_msg_size(
+            const long long unsigned int sst_max_msg_size);
+
+    /** @return The number of messages this node has sent in a subgroup with
+     * each TransportTier, indexed by the tier's value. */
+    std::array<uint64_t, 3> get_tier_send_counts(subgroup_id_t subgroup_num);
+
+    /** @return The latencies of the messages this node has received in a
+     * subgroup, or all zeros if latency stats are off. */
+    LatencyStats get_latency_stats(subgroup_id_t subgroup_num);
 
     /**
      * @return a map from subgroup ID to SubgroupSettings for only those subgroups
@@ -453,6 +1384,7 @@ public:
     const std::map<subgroup_id_t, SubgroupSettings>& get_subgroup_settings() {
         return subgroup_settings;
     }
-    std::vector<uint32_t> get_shard_sst_indices(subgroup_id_t subgroup_num);
+    /** @return the SST rows of this node's shard members in a subgroup, by shard rank */
+    const std::vector<uint32_t>& get_shard_sst_indices(subgroup_id_t subgroup_num);
 };
 }  // namespace derecho
@@ -1,13 +1,22 @@
 #include <map>
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <sys/time.h>
 
+#include "conf/affinity.hpp"
 #include "p2p_connections.h"
 #include "sst/poll_utils.h"
 
 namespace sst {
+uint64_t P2PConnections::buffer_size(uint32_t window_size, uint64_t max_p2p_size) {
+    const uint64_t max_msg_size = max_p2p_size + sizeof(uint64_t);
+    // The slots of the four request types, then the doorbells
+    const uint64_t doorbell_offset = (4 * max_msg_size * window_size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+    return doorbell_offset + 4 * sizeof(uint64_t) + sizeof(bool);
+}
+
 P2PConnections::P2PConnections(const P2PParams params)
         : members(params.members),
           num_members(members.size()),
@@ -17,7 +26,8 @@ P2PConnections::P2PConnections(const P2PParams params)
           incoming_p2p_buffers(num_members),
           outgoing_p2p_buffers(num_members),
           res_vec(num_members),
-          p2p_buf_size(4 * max_msg_size * window_size + sizeof(bool)),
+          doorbell_offset((4 * max_msg_size * window_size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t)),
+          p2p_buf_size(buffer_size(window_size, max_msg_size - sizeof(uint64_t))),
           incoming_query_seq_nums(num_members),
           incoming_send_seq_nums(num_members),
           incoming_rpc_reply_seq_nums(num_members),
@@ -26,7 +36,9 @@ P2PConnections::P2PConnections(const P2PParams params)
           outgoing_send_seq_nums(num_members),
           outgoing_rpc_reply_seq_nums(num_members),
           outgoing_p2p_reply_seq_nums(num_members),
-          prev_mode(num_members) {
+          prev_mode(num_members),
+          query_send_times(num_members * window_size),
+          average_reply_latencies(num_members) {
     //Figure out my SST index
     my_index = (uint32_t)-1;
     for(uint32_t i = 0; i < num_members; ++i) {
@@ -38,8 +50,8 @@ P2PConnections::P2PConnections(const P2PParams params)
     assert(my_index != (uint32_t)-1);
 
     for(uint i = 0; i < num_members; ++i) {
-        incoming_p2p_buffers[i] = std::make_unique<volatile char[]>(p2p_buf_size);
-        outgoing_p2p_buffers[i] = std::make_unique<volatile char[]>(p2p_buf_size);
+        incoming_p2p_buffers[i] = sst::allocate_registered_memory(p2p_buf_size);
+        outgoing_p2p_buffers[i] = sst::allocate_registered_memory(p2p_buf_size);
         if(i != my_index) {
 #ifdef USE_VERBS_API
             res_vec[i] = std::make_unique<resources>(i, const_cast<char*>(incoming_p2p_buffers[i].get()),
@@ -53,7 +65,10 @@ P2PConnections::P2PConnections(const P2PParams params)
         }
     }
 
-    timeout_thread = std::thread(&P2PConnections::check_failures_loop, this);
+    // if SST signals some of the writes itself, the send queues drain without it
+    if(sst::get_signal_interval() == 0) {
+        timeout_thread = std::thread(&P2PConnections::check_failures_loop, this);
+    }
 }
 
 P2PConnections::P2PConnections(P2PConnections&& old_connections, const std::vector<uint32_t> new_members)
@@ -65,7 +80,8 @@ P2PConnections::P2PConnections(P2PConnections&& old_connections, const std::vect
           incoming_p2p_buffers(num_members),
           outgoing_p2p_buffers(num_members),
           res_vec(num_members),
-          p2p_buf_size(4 * max_msg_size * window_size + sizeof(bool)),
+          doorbell_offset((4 * max_msg_size * window_size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t)),
+          p2p_buf_size(buffer_size(window_size, max_msg_size - sizeof(uint64_t))),
           incoming_query_seq_nums(num_members),
           incoming_send_seq_nums(num_members),
           incoming_rpc_reply_seq_nums(num_members),
@@ -74,7 +90,9 @@ P2PConnections::P2PConnections(P2PConnections&& old_connections, const std::vect
           outgoing_send_seq_nums(num_members),
           outgoing_rpc_reply_seq_nums(num_members),
           outgoing_p2p_reply_seq_nums(num_members),
-          prev_mode(num_members) {
+          prev_mode(num_members),
+          query_send_times(num_members * window_size),
+          average_reply_latencies(num_members) {
     old_connections.shutdown_failures_thread();
     //Figure out my SST index
     my_index = (uint32_t)-1;
@@ -88,8 +106,8 @@ P2PConnections::P2PConnections(P2PConnections&& old_connections, const std::vect
 
     for(uint i = 0; i < num_members; ++i) {
         if(old_connections.node_id_to_rank.find(members[i]) == old_connections.node_id_to_rank.end()) {
-            incoming_p2p_buffers[i] = std::make_unique<volatile char[]>(p2p_buf_size);
-            outgoing_p2p_buffers[i] = std::make_unique<volatile char[]>(p2p_buf_size);
+            incoming_p2p_buffers[i] = sst::allocate_registered_memory(p2p_buf_size);
+            outgoing_p2p_buffers[i] = sst::allocate_registered_memory(p2p_buf_size);
             if(i != my_index) {
                 res_vec[i] = std::make_unique<resources>(members[i], const_cast<char*>(incoming_p2p_buffers[i].get()),
                                                          const_cast<char*>(outgoing_p2p_buffers[i].get()),
@@ -107,13 +125,19 @@ P2PConnections::P2PConnections(P2PConnections&& old_connections, const std::vect
             outgoing_send_seq_nums[i] = old_connections.outgoing_send_seq_nums[old_rank];
             outgoing_rpc_reply_seq_nums[i] = old_connections.outgoing_rpc_reply_seq_nums[old_rank];
             outgoing_p2p_reply_seq_nums[i] = old_connections.outgoing_p2p_reply_seq_nums[old_rank];
+            std::copy_n(old_connections.query_send_times.begin() + old_rank * window_size, window_size,
+                        query_send_times.begin() + i * window_size);
+            average_reply_latencies[i] = old_connections.average_reply_latencies[old_rank].load();
             if(i != my_index) {
                 res_vec[i] = std::move(old_connections.res_vec[old_rank]);
             }
         }
     }
 
-    timeout_thread = std::thread(&P2PConnections::check_failures_loop, this);
+    // if SST signals some of the writes itself, the send queues drain without it
+    if(sst::get_signal_interval() == 0) {
+        timeout_thread = std::thread(&P2PConnections::check_failures_loop, this);
+    }
 }
 
 P2PConnections::~P2PConnections() {
@@ -132,6 +156,10 @@ uint32_t P2PConnections::get_node_rank(uint32_t node_id) {
     return node_id_to_rank.at(node_id);
 }
 
+bool P2PConnections::contains_node(uint32_t node_id) {
+    return node_id_to_rank.find(node_id) != node_id_to_rank.end();
+}
+
 uint64_t P2PConnections::get_max_p2p_size() {
     return max_msg_size - sizeof(uint64_t);
 }
@@ -179,8 +207,8 @@ uint64_t P2PConnections::getOffsetBufNoIncrement(REQUEST_TYPE type, uint64_t seq
     return 0;
 }
 
-// check if there's a new request from some node
-char* P2PConnections::probe(uint32_t rank) {
+// check the slots of a node for a new message
+char* P2PConnections::probe_slots(uint32_t rank) {
     assert(incoming_p2p_buffers[rank]);
     // first check for RPC replies
     if((uint64_t&)incoming_p2p_buffers[rank][getOffsetSeqNum(REQUEST_TYPE::RPC_REPLY, incoming_rpc_reply_seq_nums[rank])] == incoming_rpc_reply_seq_nums[rank] + 1) {
@@ -191,6 +219,15 @@ char* P2PConnections::probe(uint32_t rank) {
     }
     // then check for P2P replies
     if((uint64_t&)incoming_p2p_buffers[rank][getOffsetSeqNum(REQUEST_TYPE::P2P_REPLY, incoming_p2p_reply_seq_nums[rank])] == incoming_p2p_reply_seq_nums[rank] + 1) {
+        // this is the reply to the query with the same sequence number
+        const auto query_time = query_send_times[rank * window_size + incoming_p2p_reply_seq_nums[rank] % window_size];
+        const int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now() - query_time)
+                                        .count();
+        const int64_t average = average_reply_latencies[rank].load(std::memory_order_relaxed);
+        // weighs the last reply by 1/8, like TCP's smoothed round-trip time
+        average_reply_latencies[rank].store(average == 0 ? std::max<int64_t>(latency, 1) : average + (latency - average) / 8,
+                                            std::memory_order_relaxed);
         return const_cast<char*>(incoming_p2p_buffers[rank].get()) + getOffsetBuf(REQUEST_TYPE::P2P_REPLY, incoming_p2p_reply_seq_nums[rank]);
     }
     // then check for any new queries
@@ -204,11 +241,28 @@ char* P2PConnections::probe(uint32_t rank) {
     return nullptr;
 }
 
+// check if there's a new request from some node
+char* P2PConnections::probe(uint32_t rank) {
+    assert(incoming_p2p_buffers[rank]);
+    // nothing is new unless a doorbell moved
+    volatile uint64_t* doorbells = (volatile uint64_t*)(incoming_p2p_buffers[rank].get() + doorbell_offset);
+    if(doorbells[REQUEST_TYPE::RPC_REPLY] == incoming_rpc_reply_seq_nums[rank]
+       && doorbells[REQUEST_TYPE::P2P_REPLY] == incoming_p2p_reply_seq_nums[rank]
+       && doorbells[REQUEST_TYPE::P2P_QUERY] == incoming_query_seq_nums[rank]
+       && doorbells[REQUEST_TYPE::P2P_SEND] == incoming_send_seq_nums[rank]) {
+        return nullptr;
+    }
+    return probe_slots(rank);
+}
+
 // check if there's a new request from any node
 std::optional<std::pair<uint32_t, char*>> P2PConnections::probe_all() {
-    for(uint rank = 0; rank < num_members; ++rank) {
+    // start after the node found last, so that every node gets its turn
+    for(uint i = 0; i < num_members; ++i) {
+        const uint rank = (next_probe_rank + i) % num_members;
         auto buf = probe(rank);
         if(buf) {
+            next_probe_rank = rank + 1;
             return std::pair<uint32_t, char*>(members[rank], buf);
         }
     }
@@ -236,45 +290,75 @@ char* P2PConnections::get_sendbuffer_ptr(uint32_t rank, REQUEST_TYPE type) {
     }
 }
 
-void P2PConnections::send(uint32_t rank) {
+void P2PConnections::send(uint32_t rank, uint64_t size) {
+    size = std::min<uint64_t>(size, max_msg_size - sizeof(uint64_t));
     if(prev_mode[rank] == REQUEST_TYPE::RPC_REPLY) {
         if(rank == my_index) {
             // there's no reason why memcpy shouldn't also copy guard and data separately
             std::memcpy(const_cast<char*>(incoming_p2p_buffers[rank].get()) + getOffsetBufNoIncrement(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]),
                         const_cast<char*>(outgoing_p2p_buffers[rank].get()) + getOffsetBufNoIncrement(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]),
-                        max_msg_size - sizeof(uint64_t));
+                        size);
             std::memcpy(const_cast<char*>(incoming_p2p_buffers[rank].get()) + getOffsetSeqNum(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]),
                         const_cast<char*>(outgoing_p2p_buffers[rank].get()) + getOffsetSeqNum(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]),
                         sizeof(uint64_t));
+            ((volatile uint64_t*)(incoming_p2p_buffers[rank].get() + doorbell_offset))[REQUEST_TYPE::RPC_REPLY] = outgoing_rpc_reply_seq_nums[rank] + 1;
         } else {
-            res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]), max_msg_size - sizeof(uint64_t));
+            res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]), size);
             res_vec[rank]->post_remote_write(getOffsetSeqNum(prev_mode[rank], outgoing_rpc_reply_seq_nums[rank]), sizeof(uint64_t));
+            ring_doorbell(rank, REQUEST_TYPE::RPC_REPLY, outgoing_rpc_reply_seq_nums[rank] + 1);
             num_rdma_writes++;
         }
         outgoing_rpc_reply_seq_nums[rank]++;
     } else if(prev_mode[rank] == REQUEST_TYPE::P2P_REPLY) {
-        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_p2p_reply_seq_nums[rank]), max_msg_size - sizeof(uint64_t));
+        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_p2p_reply_seq_nums[rank]), size);
         res_vec[rank]->post_remote_write(getOffsetSeqNum(prev_mode[rank], outgoing_p2p_reply_seq_nums[rank]), sizeof(uint64_t));
+        ring_doorbell(rank, REQUEST_TYPE::P2P_REPLY, outgoing_p2p_reply_seq_nums[rank] + 1);
         outgoing_p2p_reply_seq_nums[rank]++;
         num_rdma_writes++;
     } else if(prev_mode[rank] == REQUEST_TYPE::P2P_QUERY) {
-        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_query_seq_nums[rank]), max_msg_size - sizeof(uint64_t));
+        query_send_times[rank * window_size + outgoing_query_seq_nums[rank] % window_size] = std::chrono::steady_clock::now();
+        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_query_seq_nums[rank]), size);
         res_vec[rank]->post_remote_write(getOffsetSeqNum(prev_mode[rank], outgoing_query_seq_nums[rank]), sizeof(uint64_t));
+        ring_doorbell(rank, REQUEST_TYPE::P2P_QUERY, outgoing_query_seq_nums[rank] + 1);
         outgoing_query_seq_nums[rank]++;
         num_rdma_writes++;
     } else {
-        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_send_seq_nums[rank]), max_msg_size - sizeof(uint64_t));
+        res_vec[rank]->post_remote_write(getOffsetBufNoIncrement(prev_mode[rank], outgoing_send_seq_nums[rank]), size);
         res_vec[rank]->post_remote_write(getOffsetSeqNum(prev_mode[rank], outgoing_send_seq_nums[rank]), sizeof(uint64_t));
+        ring_doorbell(rank, REQUEST_TYPE::P2P_SEND, outgoing_send_seq_nums[rank] + 1);
         outgoing_send_seq_nums[rank]++;
         num_rdma_writes++;
     }
 }
 
+uint64_t P2PConnections::get_num_outstanding_queries() const {
+    uint64_t num_outstanding = 0;
+    for(uint32_t rank = 0; rank < num_members; ++rank) {
+        num_outstanding += outgoing_query_seq_nums[rank] - incoming_p2p_reply_seq_nums[rank];
+    }
+    return num_outstanding;
+}
+
+uint64_t P2PConnections::get_num_outstanding_queries(uint32_t rank) const {
+    return outgoing_query_seq_nums[rank] - incoming_p2p_reply_seq_nums[rank];
+}
+
+uint64_t P2PConnections::get_average_reply_latency(uint32_t rank) const {
+    return average_reply_latencies[rank].load(std::memory_order_relaxed);
+}
+
+void P2PConnections::ring_doorbell(uint32_t rank, REQUEST_TYPE type, uint64_t num_sent) {
+    // written after the message on the same connection, so the message is
+    // there by the time the receiver sees it
+    const uint64_t offset = doorbell_offset + type * sizeof(uint64_t);
+    (uint64_t&)outgoing_p2p_buffers[rank][offset] = num_sent;
+    res_vec[rank]->post_remote_write(offset, sizeof(uint64_t));
+}
+
 void P2PConnections::check_failures_loop() {
-    pthread_setname_np(pthread_self(), "p2p_timeout_thread");
-    const auto tid = std::this_thread::get_id();
+    derecho::name_and_pin_thread("p2p_timeout_thread");
     // get id first
-    uint32_t ce_idx = util::polling_data.get_index(tid);
+    uint32_t ce_idx = util::polling_data.get_index();
     while(!thread_shutdown) {
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
         if(num_rdma_writes < 1000) {
@@ -282,7 +366,7 @@ void P2PConnections::check_failures_loop() {
         }
         num_rdma_writes = 0;
 
-        util::polling_data.set_waiting(tid);
+        util::polling_data.set_waiting(ce_idx);
 #ifdef USE_VERBS_API
         struct verbs_sender_ctxt sctxt[num_members];
 #else
@@ -315,7 +399,7 @@ void P2PConnections::check_failures_loop() {
             std::optional<std::pair<int32_t, int32_t>> ce;
             while(true) {
                 // check if polling result is available
-                ce = util::polling_data.get_completion_entry(tid);
+                ce = util::polling_data.get_completion_entry(ce_idx);
                 if(ce) {
                     break;
                 }
@@ -330,7 +414,7 @@ void P2PConnections::check_failures_loop() {
             }
             num_completions++;
         }
-        util::polling_data.reset_waiting(tid);
+        util::polling_data.reset_waiting(ce_idx);
     }
 }
 }  // namespace sst
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -13,6 +14,7 @@
 #else
 #include "sst/lf.h"
 #endif
+#include "sst/registered_memory.h"
 
 namespace sst {
 struct P2PParams {
@@ -38,31 +40,66 @@ class P2PConnections {
     const uint32_t max_msg_size;
     std::map<uint32_t, uint32_t> node_id_to_rank;
     // one element per member for P2P
-    std::vector<std::unique_ptr<volatile char[]>> incoming_p2p_buffers;
-    std::vector<std::unique_ptr<volatile char[]>> outgoing_p2p_buffers;
+    std::vector<sst::registered_memory_ptr> incoming_p2p_buffers;
+    std::vector<sst::registered_memory_ptr> outgoing_p2p_buffers;
     std::vector<std::unique_ptr<resources>> res_vec;
+    /** Where the doorbells are in the P2P buffers. A node's doorbells for
+     * another count the messages of each REQUEST_TYPE it has sent there, and
+     * are written after each message, so the receiver finds out whether a
+     * node sent anything new from one cache line instead of four slots.
+     * Each type has its own, since different threads send them. */
+    uint64_t doorbell_offset;
     uint64_t p2p_buf_size;
     std::vector<uint64_t> incoming_query_seq_nums, incoming_send_seq_nums, incoming_rpc_reply_seq_nums, incoming_p2p_reply_seq_nums,
             outgoing_query_seq_nums, outgoing_send_seq_nums, outgoing_rpc_reply_seq_nums, outgoing_p2p_reply_seq_nums;
+    /** The rank probe_all() starts from, after the last one it found a message from */
+    uint32_t next_probe_rank = 0;
     std::vector<REQUEST_TYPE> prev_mode;
+    /** When each P2P query in the window to each member was sent, by
+     * rank * window_size + sequence number modulo window_size. Replies come
+     * back in the order of the queries, so a reply's query is found by the
+     * reply's sequence number. */
+    std::vector<std::chrono::steady_clock::time_point> query_send_times;
+    /** A moving average of how long each member took to reply to P2P
+     * queries, in nanoseconds, or 0 if it has not replied to any; written
+     * by the thread that polls for replies and read by any. */
+    std::vector<std::atomic<uint64_t>> average_reply_latencies;
     std::atomic<bool> thread_shutdown{false};
     std::thread timeout_thread;
     uint64_t getOffsetSeqNum(REQUEST_TYPE type, uint64_t seq_num);
     uint64_t getOffsetBuf(REQUEST_TYPE type, uint64_t& seq_num);
     uint64_t getOffsetBufNoIncrement(REQUEST_TYPE type, uint64_t seq_num);
+    char* probe_slots(uint32_t rank);
     char* probe(uint32_t rank);
+    void ring_doorbell(uint32_t rank, REQUEST_TYPE type, uint64_t num_sent);
     uint32_t num_rdma_writes = 0;
     void check_failures_loop();
 
 public:
+    /** The size of each of the registered buffers that a member's P2P
+     * connection to another member has, one incoming and one outgoing */
+    static uint64_t buffer_size(uint32_t window_size, uint64_t max_p2p_size);
     P2PConnections(const P2PParams params);
     P2PConnections(P2PConnections&& old_connections, const std::vector<uint32_t> new_members);
     ~P2PConnections();
     void shutdown_failures_thread();
     uint32_t get_node_rank(uint32_t node_id);
+    bool contains_node(uint32_t node_id);
     uint64_t get_max_p2p_size();
     std::optional<std::pair<uint32_t, char*>> probe_all();
     char* get_sendbuffer_ptr(uint32_t rank, REQUEST_TYPE type);
-    void send(uint32_t rank);
+    /** Sends the message in the buffer from get_sendbuffer_ptr; only the
+     * first size bytes of it are written, followed by its sequence number */
+    void send(uint32_t rank, uint64_t size);
+    /** Returns the number of P2P queries sent to any member that it has not
+     * replied to yet. Unsynchronized with the threads sending and receiving
+     * them, so it is only an estimate. */
+    uint64_t get_num_outstanding_queries() const;
+    /** Returns the number of P2P queries sent to one member that it has not
+     * replied to yet, i.e. how full the query window to it is. */
+    uint64_t get_num_outstanding_queries(uint32_t rank) const;
+    /** Returns the moving average of how long a member took to reply to
+     * P2P queries, in nanoseconds, or 0 if it has not replied to any. */
+    uint64_t get_average_reply_latency(uint32_t rank) const;
 };
 }  // namespace sst
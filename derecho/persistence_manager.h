@@ -5,14 +5,23 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <errno.h>
-#include <queue>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <semaphore.h>
 #include <thread>
+#include <time.h>
+#include <vector>
 
+#include "conf/affinity.hpp"
+#include "conf/fault_injection.hpp"
 #include "derecho_internal.h"
+#include "metrics.h"
 #include "replicated.h"
 #include "view_manager.h"
 
@@ -24,10 +33,13 @@ namespace derecho {
 
 template <typename T>
 using replicated_index_map = std::map<uint32_t, Replicated<T>>;
-using persistence_request_t = std::tuple<subgroup_id_t, persistent::version_t>;
 
 /**
  * PersistenceManager is responsible for persisting all the data in a group.
+ * Each subgroup has its own persistence worker, so a slow log doesn't hold up
+ * the others. Versions only grow, so a worker persists only the newest
+ * version requested for its subgroup, which covers all the older requests.
+ * After each flush the worker also trims the logs by their retention policy.
  */
 template <typename... ReplicatedTypes>
 class PersistenceManager {
@@ -37,50 +49,242 @@ private:
     std::shared_ptr<spdlog::logger> logger;
 #endif
 
-    /** Thread handle */
-    std::thread persist_thread;
-    /** A flag to singal the persistent thread to shutdown; set to true when the group is destroyed. */
+    /** The persistence requests of a subgroup, and the thread serving them */
+    struct PersistenceWorker {
+        /** Thread handle */
+        std::thread thread;
+        /** Posted once for every request */
+        sem_t request_sem;
+        /** The newest version requested */
+        std::atomic<persistent::version_t> requested_version;
+        /** The number of requests since the last flush */
+        std::atomic<uint64_t> num_requests;
+        /** The newest version persisted; only used by the thread */
+        persistent::version_t persisted_version;
+        /** Persists the subgroup's Replicated<T> up to a version; found by
+         * the thread on its first flush */
+        std::function<void(const persistent::version_t&)> persist_object;
+
+        PersistenceWorker() : requested_version(INVALID_VERSION),
+                              num_requests(0),
+                              persisted_version(INVALID_VERSION) {
+            if(sem_init(&request_sem, 1, 0) != 0) {
+                throw derecho_exception("Cannot initialize request_sem:errno=" + std::to_string(errno));
+            }
+        }
+        ~PersistenceWorker() {
+            sem_destroy(&request_sem);
+        }
+    };
+
+    /** A flag to singal the persistence workers to shutdown; set to true when the group is destroyed. */
     std::atomic<bool> thread_shutdown;
-    /** The semaphore for persistence request the persistent thread */
-    sem_t persistence_request_sem;
-    /** a queue for the requests */
-    std::queue<persistence_request_t> persistence_request_queue;
-    /** lock for persistence request queue */
-    std::atomic_flag prq_lock = ATOMIC_FLAG_INIT;
+    /** The persistence workers, by subgroup id */
+    std::map<subgroup_id_t, std::unique_ptr<PersistenceWorker>> workers;
+    /** lock for workers */
+    std::mutex workers_mutex;
+    /** Serializes the SST updates and the persistence callbacks of the workers */
+    std::mutex publish_mutex;
 
     /** persistence callback */
     persistence_callback_t persistence_callback;
+    /** Called with the versions each flush persisted, as one range */
+    persistence_range_callback_t persistence_range_callback;
     /** Replicated Objects handle: TODO:make it safer */
     mutils::KindMap<replicated_index_map, ReplicatedTypes...>* replicated_objects;
+    /** The Replicated<T> that make_version versions, by subgroup ID, or
+     * nullptr where this node has no object or its type has no Persistent
+     * fields. Rebuilt by set_version_hooks() whenever a view's objects have
+     * been constructed, which happens before any of the view's messages are
+     * delivered, so the delivery thread reads it without a lock. */
+    std::vector<ReplicatedObject*> version_hooks;
     /** View Manager pointer. Need to access the SST for the purpose of updating persisted_num*/
     ViewManager* view_manager;
 
+    /** How long a flush cycle waits for more requests after the first one */
+    const uint64_t group_commit_delay_us;
+    /** The number of pending requests that ends the wait early */
+    const uint64_t group_commit_max_requests;
+    /** The number of flush cycles and of requests they handled, for reporting batch sizes */
+    std::atomic<uint64_t> num_flush_cycles;
+    std::atomic<uint64_t> num_flushed_requests;
+    std::atomic<uint64_t> max_flush_batch;
+    /** The metrics that read this PersistenceManager, which the destructor
+     * removes from the registry; guarded by workers_mutex */
+    std::vector<uint64_t> metrics_reader_ids;
+
+    /** Finds the map of Replicated<T> that holds a subgroup, and returns a
+     * function persisting the subgroup through it, which then looks only in
+     * that map. Returns an empty function if no map holds the subgroup yet,
+     * which is always the case for raw subgroups. */
+    std::function<void(const persistent::version_t&)> find_persist_object(const subgroup_id_t& subgroup_id) {
+        std::function<void(const persistent::version_t&)> persist_object;
+        if(this->replicated_objects == nullptr) {
+            return persist_object;
+        }
+        this->replicated_objects->for_each([&](auto* pkey, replicated_index_map<auto>& map) {
+            if(map.find(subgroup_id) != map.end()) {
+                // The maps stay in place even as their Replicated<T> come
+                // and go with views, so we keep the map and not the object
+                auto* pmap = &map;
+                persist_object = [pmap, subgroup_id](const persistent::version_t& version) {
+                    auto search = pmap->find(subgroup_id);
+                    if(search != pmap->end()) {
+                        search->second.persist(version);
+                        // The worker trims the logs too, off the critical path
+                        search->second.retain(version);
+                    }
+                };
+            }
+        });
+        return persist_object;
+    }
+
+    /** Persists a subgroup up to a version, publishes the new persisted_num
+     * and calls the persistence callbacks; the range callback is given the
+     * versions after worker.persisted_version, which the caller updates
+     * afterwards */
+    void flush(const subgroup_id_t& subgroup_id, const persistent::version_t& version, PersistenceWorker& worker) {
+        try {
+            if(!worker.persist_object) {
+                worker.persist_object = find_persist_object(subgroup_id);
+            }
+            if(worker.persist_object) {
+                worker.persist_object(version);
+            }
+        } catch(uint64_t exp) {
+            whenlog(logger->debug("exception on persist():subgroup={},ver={},exp={}.", subgroup_id, version, exp););
+            std::cout
+                    << "exception on persistent:subgroup=" << subgroup_id << ",ver=" << version << "exception=0x" << std::hex << exp << std::endl;
+        }
+
+        std::lock_guard<std::mutex> publish_lock(publish_mutex);
+        {
+            // read lock the view
+            std::shared_lock<ViewLock> read_lock(view_manager->view_mutex);
+            // update the persisted_num in SST
+
+            View& Vc = *view_manager->curr_view;
+            // A persist_in_memory subgroup's versions were published as
+            // persisted when they were delivered, which may be past this one
+            const auto& settings = Vc.multicast_group->get_subgroup_settings();
+            const auto subgroup_settings = settings.find(subgroup_id);
+            if(subgroup_settings == settings.end() || !subgroup_settings->second.persist_in_memory) {
+                Vc.gmsSST->persisted_num[Vc.gmsSST->get_local_index()][subgroup_id] = version;
+                Vc.gmsSST->put(Vc.multicast_group->get_shard_sst_indices(subgroup_id),
+                               (char*)std::addressof(Vc.gmsSST->persisted_num[0][subgroup_id]) - Vc.gmsSST->getBaseAddress(),
+                               sizeof(long long int));
+            }
+        }
+
+        // callback
+        if(this->persistence_callback != nullptr) {
+            this->persistence_callback(subgroup_id, version);
+        }
+        if(this->persistence_range_callback != nullptr) {
+            this->persistence_range_callback(subgroup_id, worker.persisted_version + 1, version);
+        }
+    }
+
+    /** The loop of a persistence worker */
+    void run_worker(const subgroup_id_t subgroup_id, PersistenceWorker& worker) {
+        name_and_pin_thread("persistence_" + std::to_string(subgroup_id));
+        FaultInjector& fault_injector = FaultInjector::get();
+        whenlog(logger->debug("The persistence worker of subgroup {} started", subgroup_id););
+        do {
+            // wait for semaphore
+            sem_wait(&worker.request_sem);
+            // Group commit: give more requests a chance to arrive, so that
+            // they share one flush of the logs
+            uint64_t num_posted = 1;
+            if(group_commit_delay_us > 0) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += (deadline.tv_nsec + group_commit_delay_us * 1000) / 1000000000;
+                deadline.tv_nsec = (deadline.tv_nsec + group_commit_delay_us * 1000) % 1000000000;
+                while(num_posted < group_commit_max_requests && !this->thread_shutdown
+                      && sem_timedwait(&worker.request_sem, &deadline) == 0) {
+                    num_posted++;
+                }
+            }
+            const uint64_t num_requests = worker.num_requests.exchange(0);
+            if(num_requests == 0) {
+                if(this->thread_shutdown) {
+                    break;
+                }
+                continue;
+            }
+            // Take the posts of the requests we collected early
+            for(; num_posted < num_requests; num_posted++) {
+                if(sem_trywait(&worker.request_sem) != 0) {
+                    break;
+                }
+            }
+
+            const persistent::version_t version = worker.requested_version.load();
+            if(version > worker.persisted_version) {
+                if(fault_injector.enabled()) {
+                    fault_injector.before_persist();
+                }
+                flush(subgroup_id, version, worker);
+                worker.persisted_version = version;
+            }
+
+            num_flush_cycles++;
+            num_flushed_requests += num_requests;
+            uint64_t max_batch = max_flush_batch.load();
+            while(num_requests > max_batch && !max_flush_batch.compare_exchange_weak(max_batch, num_requests))
+                ;
+            whenlog(logger->debug("persistence flush cycle: subgroup {}, {} requests, version {}", subgroup_id, num_requests, version););
+
+            if(this->thread_shutdown && worker.num_requests.load() == 0) {
+                break;  // finish
+            }
+        } while(true);
+        whenlog(logger->debug("The persistence worker of subgroup {} is exiting", subgroup_id););
+    }
+
 public:
     /** Constructor
      * @param pro pointer to the replicated_objects.
      */
     PersistenceManager(
             mutils::KindMap<replicated_index_map, ReplicatedTypes...>* pro,
-            const persistence_callback_t& _persistence_callback)
+            const persistence_callback_t& _persistence_callback,
+            const persistence_range_callback_t& _persistence_range_callback = nullptr)
             : whenlog(logger(spdlog::get("derecho_debug_log")), )
               thread_shutdown(false),
               persistence_callback(_persistence_callback),
-              replicated_objects(pro) {
-        // initialize semaphore
-        if(sem_init(&persistence_request_sem, 1, 0) != 0) {
-            throw derecho_exception("Cannot initialize persistent_request_sem:errno=" + std::to_string(errno));
-        }
+              persistence_range_callback(_persistence_range_callback),
+              replicated_objects(pro),
+              group_commit_delay_us(getConfUInt64(CONF_PERS_GROUP_COMMIT_DELAY_US)),
+              group_commit_max_requests(std::max<uint64_t>(1, getConfUInt64(CONF_PERS_GROUP_COMMIT_MAX_REQUESTS))),
+              num_flush_cycles(0),
+              num_flushed_requests(0),
+              max_flush_batch(0) {
+        MetricsRegistry& registry = MetricsRegistry::get();
+        metrics_reader_ids.push_back(registry.add_reader(
+                "derecho_persistence_flush_cycles_total", "Flush cycles of the persistence workers",
+                MetricType::COUNTER, "", [this]() { return static_cast<double>(num_flush_cycles.load()); }));
+        metrics_reader_ids.push_back(registry.add_reader(
+                "derecho_persistence_flushed_requests_total", "Persistence requests handled by the flush cycles",
+                MetricType::COUNTER, "", [this]() { return static_cast<double>(num_flushed_requests.load()); }));
     }
 
     /** default Constructor
      */
-    PersistenceManager(const persistence_callback_t& _persistence_callback) : PersistenceManager(nullptr, _persistence_callback) {
+    PersistenceManager(const persistence_callback_t& _persistence_callback,
+                       const persistence_range_callback_t& _persistence_range_callback = nullptr)
+            : PersistenceManager(nullptr, _persistence_callback, _persistence_range_callback) {
     }
 
     /** default Destructor
      */
     virtual ~PersistenceManager() {
-        sem_destroy(&persistence_request_sem);
+        std::lock_guard<std::mutex> workers_lock(workers_mutex);
+        for(const uint64_t reader_id : metrics_reader_ids) {
+            MetricsRegistry::get().remove_reader(reader_id);
+        }
     }
 
     /**
@@ -104,108 +308,96 @@ public:
         this->view_manager = view_manager;
     }
 
-    /** Start the persistent thread. */
+    /** Start persisting. The worker of a subgroup starts with the first
+     * request for it, so this only announces it. */
     void start() {
         //skip for raw subgroups -- NO, DON'T
         // if(replicated_objects == nullptr) return;
+        whenlog(logger->debug("The persistence manager started"););
+    }
 
-        this->persist_thread = std::thread{[this]() {
-            std::cout << "The persist thread started" << std::endl;
-            do {
-                // wait for semaphore
-                sem_wait(&persistence_request_sem);
-                while(prq_lock.test_and_set(std::memory_order_acquire))  // acquire lock
-                    ;                                                    // spin
-                if(this->persistence_request_queue.empty()) {
-                    prq_lock.clear(std::memory_order_release);  // release lock
-                    if(this->thread_shutdown) {
-                        break;
-                    }
-                    continue;
-                }
-
-                subgroup_id_t subgroup_id = std::get<0>(persistence_request_queue.front());
-                persistent::version_t version = std::get<1>(persistence_request_queue.front());
-                persistence_request_queue.pop();
-                prq_lock.clear(std::memory_order_release);  // release lock
-
-                // persist
-                try {
-                    this->replicated_objects->for_each([&](auto* pkey, replicated_index_map<auto>& map) {
-                        auto search = map.find(subgroup_id);
-                        if(search != map.end()) {
-                            search->second.persist(version);
-                        }
-                    });
-                    // read lock the view
-                    std::shared_lock<std::shared_timed_mutex> read_lock(view_manager->view_mutex);
-                    // update the persisted_num in SST
-
-                    View& Vc = *view_manager->curr_view;
-                    Vc.gmsSST->persisted_num[Vc.gmsSST->get_local_index()][subgroup_id] = version;
-                    Vc.gmsSST->put(Vc.multicast_group->get_shard_sst_indices(subgroup_id),
-                                   (char*)std::addressof(Vc.gmsSST->persisted_num[0][subgroup_id]) - Vc.gmsSST->getBaseAddress(),
-                                   sizeof(long long int));
-                } catch(uint64_t exp) {
-                    whenlog(logger->debug("exception on persist():subgroup={},ver={},exp={}.", subgroup_id, version, exp););
-                    std::cout
-                            << "exception on persistent:subgroup=" << subgroup_id << ",ver=" << version << "exception=0x" << std::hex << exp << std::endl;
-                }
-
-                // callback
-                if(this->persistence_callback != nullptr) {
-                    this->persistence_callback(subgroup_id, version);
-                }
-
-                if(this->thread_shutdown) {
-                    while(prq_lock.test_and_set(std::memory_order_acquire))  // acquire lock
-                        ;                                                    // spin
-                    if(persistence_request_queue.empty()) {
-                        prq_lock.clear(std::memory_order_release);  // release lock
-                        break;                                      // finish
-                    }
-                    prq_lock.clear(std::memory_order_release);  // release lock
-                }
-            } while(true);
-            std::cout << "The persist thread is exiting" << std::endl;
-        }};
+    /** Returns the number of flush cycles of all the workers, the number of
+     * persistence requests they handled, and the most requests handled by a
+     * single cycle. */
+    std::tuple<uint64_t, uint64_t, uint64_t> get_flush_statistics() const {
+        return std::make_tuple(num_flush_cycles.load(), num_flushed_requests.load(), max_flush_batch.load());
     }
 
     /** post a persistence request */
     void post_persist_request(const subgroup_id_t& subgroup_id, const persistent::version_t& version) {
-        // request enqueue
-        while(prq_lock.test_and_set(std::memory_order_acquire))  // acquire lock
-            ;                                                    // spin
-        persistence_request_queue.push(std::make_tuple(subgroup_id, version));
-        prq_lock.clear(std::memory_order_release);  // release lock
+        PersistenceWorker* worker;
+        {
+            std::lock_guard<std::mutex> workers_lock(workers_mutex);
+            auto search = workers.find(subgroup_id);
+            if(search == workers.end()) {
+                search = workers.emplace(subgroup_id, std::make_unique<PersistenceWorker>()).first;
+                worker = search->second.get();
+                worker->thread = std::thread{[this, subgroup_id, worker]() {
+                    this->run_worker(subgroup_id, *worker);
+                }};
+                // The gauge doesn't take workers_mutex, so registering it
+                // while holding that lock can't deadlock with a scrape
+                metrics_reader_ids.push_back(MetricsRegistry::get().add_reader(
+                        "derecho_persistence_pending_requests", "Persistence requests waiting for a flush cycle",
+                        MetricType::GAUGE, metric_label("subgroup", subgroup_id),
+                        [worker]() { return static_cast<double>(worker->num_requests.load()); }));
+            } else {
+                worker = search->second.get();
+            }
+        }
+        // collapse the request into the newest one
+        persistent::version_t requested = worker->requested_version.load();
+        while(requested < version && !worker->requested_version.compare_exchange_weak(requested, version))
+            ;
+        worker->num_requests++;
         // post semaphore
-        sem_post(&persistence_request_sem);
+        sem_post(&worker->request_sem);
+    }
+
+    /**
+     * Rebuilds the table that make_version looks subgroups up in, from the
+     * objects of the view just installed.
+     * @param objects_by_subgroup_id The Group's Replicated<T>s, by subgroup ID
+     */
+    void set_version_hooks(const std::map<subgroup_id_t, std::reference_wrapper<ReplicatedObject>>& objects_by_subgroup_id) {
+        std::vector<ReplicatedObject*> hooks(
+                objects_by_subgroup_id.empty() ? 0 : objects_by_subgroup_id.rbegin()->first + 1, nullptr);
+        for(const auto& subgroup_object : objects_by_subgroup_id) {
+            // Without Persistent fields there is nothing to version
+            if(subgroup_object.second.get().is_persistent()) {
+                hooks[subgroup_object.first] = &subgroup_object.second.get();
+            }
+        }
+        version_hooks.swap(hooks);
     }
 
     /** make a version */
     void make_version(const subgroup_id_t& subgroup_id,
                       const persistent::version_t& version, const HLC& mhlc) {
-        // find the corresponding Replicated<T> in replicated_objects
-        this->replicated_objects->for_each([&](auto* pkey, replicated_index_map<auto>& map) {
-            // make a version
-            auto search = map.find(subgroup_id);
-            if(search != map.end()) {
-                search->second.make_version(version, mhlc);
-            }
-        });
+        if(subgroup_id < version_hooks.size() && version_hooks[subgroup_id] != nullptr) {
+            version_hooks[subgroup_id]->make_version(version, mhlc);
+        }
     }
 
-    /** shutdown the thread 
-     * @wait - wait till the thread finished or not.
+    /** shutdown the workers
+     * @wait - wait till the workers finished or not.
      */
     void shutdown(bool wait) {
         // if(replicated_objects == nullptr) return;  //skip for raw subgroups - NO DON'T
 
         thread_shutdown = true;
-        sem_post(&persistence_request_sem);  // kick the persistence thread in case it is sleeping
+        std::lock_guard<std::mutex> workers_lock(workers_mutex);
+        for(auto& subgroup_worker : workers) {
+            // kick the worker in case it is sleeping
+            sem_post(&subgroup_worker.second->request_sem);
+        }
 
         if(wait) {
-            this->persist_thread.join();
+            for(auto& subgroup_worker : workers) {
+                subgroup_worker.second->thread.join();
+            }
+            whenlog(logger->debug("The persistence workers exited after {} flush cycles of {} requests (largest batch: {})",
+                                  num_flush_cycles.load(), num_flushed_requests.load(), max_flush_batch.load()););
         }
     }
 
@@ -6,8 +6,43 @@
 
 #include "raw_subgroup.h"
 
+#include <cstring>
+
 namespace derecho {
 
+void ConcurrentSendQueue::publish(uint64_t ticket, std::unique_ptr<char[]> payload, std::size_t payload_size) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    published.emplace(ticket, StagedSend{std::move(payload), payload_size});
+    if(sending) {
+        return;
+    }
+    sending = true;
+    try {
+        while(!published.empty() && published.begin()->first == next_to_send) {
+            StagedSend staged = std::move(published.begin()->second);
+            published.erase(published.begin());
+            next_to_send++;
+            // Later messages can be published while this one is sent
+            lock.unlock();
+            if(staged.payload) {
+                char* buffer;
+                while(!(buffer = group_view_manager.get_sendbuffer_ptr(subgroup_id, staged.payload_size))) {
+                }
+                memcpy(buffer, staged.payload.get(), staged.payload_size);
+                group_view_manager.send(subgroup_id);
+            }
+            lock.lock();
+        }
+    } catch(...) {
+        if(!lock.owns_lock()) {
+            lock.lock();
+        }
+        sending = false;
+        throw;
+    }
+    sending = false;
+}
+
 char* RawSubgroup::get_sendbuffer_ptr(unsigned long long int payload_size) {
     if(is_valid()) {
         return group_view_manager.get_sendbuffer_ptr(subgroup_id, payload_size);
@@ -16,6 +51,16 @@ char* RawSubgroup::get_sendbuffer_ptr(unsigned long long int payload_size) {
     }
 }
 
+char* RawSubgroup::get_sendbuffer_ptr(std::shared_ptr<rdma::memory_region> mr, std::size_t offset,
+                                      unsigned long long int payload_size) {
+    if(is_valid()) {
+        return group_view_manager.get_sendbuffer_ptr(subgroup_id, payload_size,
+                                                     rdmc::receive_destination{std::move(mr), offset});
+    } else {
+        throw derecho::empty_reference_exception{"Attempted to use an empty RawSubgroup"};
+    }
+}
+
 void RawSubgroup::send() {
     if(is_valid()) {
         group_view_manager.send(subgroup_id);
@@ -24,6 +69,30 @@ void RawSubgroup::send() {
     }
 }
 
+uint64_t RawSubgroup::send_stream(const struct iovec* iov, int iovcnt) {
+    if(is_valid()) {
+        return group_view_manager.send_stream(subgroup_id, iov, iovcnt);
+    } else {
+        throw derecho::empty_reference_exception{"Attempted to use an empty RawSubgroup"};
+    }
+}
+
+SendReservation RawSubgroup::reserve_send(unsigned long long int payload_size) {
+    if(is_valid()) {
+        return SendReservation(concurrent_sends->take_ticket(), payload_size, concurrent_sends);
+    } else {
+        throw derecho::empty_reference_exception{"Attempted to use an empty RawSubgroup"};
+    }
+}
+
+void RawSubgroup::publish(SendReservation&& reservation) {
+    if(!reservation.queue) {
+        return;
+    }
+    std::shared_ptr<ConcurrentSendQueue> queue = std::move(reservation.queue);
+    queue->publish(reservation.ticket, std::move(reservation.payload), reservation.payload_size);
+}
+
 uint64_t RawSubgroup::compute_global_stability_frontier() {
     if(is_valid()) {
         return group_view_manager.compute_global_stability_frontier(subgroup_id);
@@ -10,14 +10,98 @@
 #include "derecho_internal.h"
 #include "view_manager.h"
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
 namespace derecho {
 
+/**
+ * The messages that threads sending in the same raw subgroup at once have
+ * published, waiting to be sent in the order they were reserved in.
+ */
+class ConcurrentSendQueue {
+    const subgroup_id_t subgroup_id;
+    ViewManager& group_view_manager;
+
+    struct StagedSend {
+        /** Null for a reservation that was dropped without being published */
+        std::unique_ptr<char[]> payload;
+        std::size_t payload_size;
+    };
+    /** The ticket the next reservation gets */
+    std::atomic<uint64_t> next_ticket{0};
+    /** Protects everything below */
+    std::mutex queue_mutex;
+    /** Published messages whose turn hasn't come, by ticket */
+    std::map<uint64_t, StagedSend> published;
+    /** The ticket of the next message to send */
+    uint64_t next_to_send = 0;
+    /** Whether some thread is sending the published messages */
+    bool sending = false;
+
+public:
+    ConcurrentSendQueue(subgroup_id_t subgroup_id, ViewManager& view_manager)
+            : subgroup_id(subgroup_id), group_view_manager(view_manager) {}
+
+    uint64_t take_ticket() {
+        return next_ticket.fetch_add(1, std::memory_order_relaxed);
+    }
+    /**
+     * Publishes the message with the given ticket. If its turn has come, the
+     * calling thread sends it and every message published after it whose
+     * turn then comes, waiting for room in the send window if it has to;
+     * otherwise, or if another thread is already doing so, it only queues the
+     * message and returns.
+     */
+    void publish(uint64_t ticket, std::unique_ptr<char[]> payload, std::size_t payload_size);
+};
+
+/**
+ * A send in a raw subgroup reserved by RawSubgroup::reserve_send, whose
+ * payload the reserving thread writes into data() before passing it to
+ * RawSubgroup::publish. A reservation that is destroyed without being
+ * published is skipped, so it doesn't hold up the ones reserved after it.
+ */
+class SendReservation {
+    uint64_t ticket;
+    std::unique_ptr<char[]> payload;
+    std::size_t payload_size;
+    /** Null once the reservation has been published */
+    std::shared_ptr<ConcurrentSendQueue> queue;
+
+    SendReservation(uint64_t ticket, std::size_t payload_size, std::shared_ptr<ConcurrentSendQueue> queue)
+            : ticket(ticket),
+              payload(new char[payload_size]),
+              payload_size(payload_size),
+              queue(std::move(queue)) {}
+    friend class RawSubgroup;
+
+public:
+    SendReservation(SendReservation&&) = default;
+    SendReservation& operator=(SendReservation&&) = delete;
+    ~SendReservation() {
+        if(queue) {
+            try {
+                queue->publish(ticket, nullptr, 0);
+            } catch(...) {
+            }
+        }
+    }
+
+    char* data() { return payload.get(); }
+    std::size_t size() const { return payload_size; }
+};
+
 class RawSubgroup {
 private:
     const node_id_t node_id;
     const subgroup_id_t subgroup_id;
     ViewManager& group_view_manager;
     bool valid;
+    /** Shared by the copies of this RawSubgroup, since they send in the same subgroup */
+    std::shared_ptr<ConcurrentSendQueue> concurrent_sends;
 
 public:
     RawSubgroup(node_id_t node_id,
@@ -26,7 +110,8 @@ public:
             : node_id(node_id),
               subgroup_id(subgroup_id),
               group_view_manager(view_manager),
-              valid(true) {}
+              valid(true),
+              concurrent_sends(std::make_shared<ConcurrentSendQueue>(subgroup_id, view_manager)) {}
 
     RawSubgroup(node_id_t node_id, ViewManager& view_manager) : node_id(node_id),
                                                                 subgroup_id(0),
@@ -48,6 +133,27 @@ public:
      * @return
      */
     char* get_sendbuffer_ptr(unsigned long long int payload_size);
+
+    /**
+     * Like get_sendbuffer_ptr, but for a message that the application has
+     * already written into a memory region it registered itself, which is
+     * sent from there without being copied. The region must have
+     * get_header_size() bytes of room at offset, where Derecho writes the
+     * message header, with the payload right after them. It must be in host
+     * memory, and must stay valid and unchanged until this node has
+     * delivered the message (and persisted it, in a persistent subgroup).
+     * Call send() afterwards, as usual.
+     * @param mr The application's registered region
+     * @param offset Where the room for the header starts in mr
+     * @param payload_size The size of the payload, in bytes
+     * @return A pointer to the payload, or nullptr if the message can't be
+     * sent yet, in which case the caller should try again
+     */
+    char* get_sendbuffer_ptr(std::shared_ptr<rdma::memory_region> mr, std::size_t offset,
+                             unsigned long long int payload_size);
+
+    /** The room a message in the application's memory needs before its payload, for the header. */
+    static std::size_t get_header_size() { return sizeof(header); }
     uint64_t compute_global_stability_frontier();
 
     /**
@@ -55,5 +161,41 @@ public:
      * multicast to the subgroup.
      */
     void send();
+
+    /**
+     * Sends a stream of bytes, the concatenation of iovcnt buffers, as a run
+     * of messages of up to the maximum payload size each, so a large input
+     * needs no chunking loop around get_sendbuffer_ptr and send. Each
+     * message takes a slot of the send window, which is the sender's credit:
+     * while the window has room, messages go out back to back under a single
+     * lock acquisition, which keeps the RDMC pipeline full, and when it is
+     * full this waits for the receivers to make room. The buffers are
+     * copied, so they can be reused once this returns. Receivers get the
+     * stream as ordinary messages, in order.
+     * @return A completion token: every member has delivered (and, in a
+     * persistent subgroup, persisted) the whole stream once
+     * compute_global_stability_frontier() returns more than it
+     */
+    uint64_t send_stream(const struct iovec* iov, int iovcnt);
+
+    /**
+     * Reserves the next place in the order of the subgroup's multicasts from
+     * this node, for one of several threads sending at once. Reserving takes
+     * no lock, and each thread writes its payload into its own reservation,
+     * so they don't have to take turns with get_sendbuffer_ptr and send;
+     * they may publish in any order, and the messages are still sent in the
+     * order they were reserved in. The payload is copied into the send
+     * buffer when its turn comes. Don't mix this with get_sendbuffer_ptr and
+     * send in the same subgroup while reservations are outstanding.
+     * @param payload_size The size of the payload, in bytes
+     */
+    SendReservation reserve_send(unsigned long long int payload_size);
+
+    /**
+     * Submits a reserved message for sending. The thread whose message is
+     * next in line sends it, and the published messages behind it, which may
+     * wait for room in the send window; other threads return at once.
+     */
+    void publish(SendReservation&& reservation);
 };
 }  // namespace derecho
@@ -45,10 +45,10 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
     const Opcode invoke_opcode;
     const Opcode reply_opcode;
 
-    //Maps invocation-instance IDs to results sets
-    std::map<std::size_t, PendingResults<Ret>> results_map;
-    std::mutex map_lock;
-    using lock_t = std::unique_lock<std::mutex>;
+    //The results sets of queries, whose slots invocation-instance IDs name
+    PendingResultsSlab<Ret> pending_slab;
+    //The callbacks of asynchronous queries
+    AsyncReplies<Ret> async_replies;
 
     /* use this from within a derived class to retrieve precisely this RemoteInvoker
      * (this way, all the inherited RemoteInvoker methods in the subclass do not need
@@ -86,6 +86,19 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
         PendingResults<Ret>& pending;
     };
 
+    /**
+     * @return The size of the message that invokes the remote-invocable
+     * function with these arguments, not counting the header
+     */
+    std::size_t get_size(const std::decay_t<Args>&... remote_args) {
+        std::size_t size = mutils::bytes_size(long{0});
+        {
+            auto t = {std::size_t{0}, std::size_t{0}, mutils::bytes_size(remote_args)...};
+            size += std::accumulate(t.begin(), t.end(), 0);
+        }
+        return size;
+    }
+
     /**
      * Called to construct an RPC message to send that will invoke the remote-
      * invocable function targeted by this RemoteInvoker.
@@ -95,6 +108,49 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
      */
     send_return send(const std::function<char*(int)>& out_alloc,
                      const std::decay_t<Args>&... remote_args) {
+        return send_sized(out_alloc, get_size(remote_args...), remote_args...);
+    }
+
+    /**
+     * Like send(), for a caller that already has the size of the message
+     * from get_size(), so that the arguments are walked only once more, to
+     * serialize them, rather than twice.
+     * @param out_alloc A function that can allocate buffers, which will be
+     * used to store the constructed message
+     * @param size The size get_size() returned for these arguments
+     * @param a The arguments to be used when calling the remote-invocable function
+     */
+    send_return send_sized(const std::function<char*(int)>& out_alloc, std::size_t size,
+                           const std::decay_t<Args>&... remote_args) {
+        // allocated first, so that a slot isn't taken if out_alloc throws
+        char* serialized_args = out_alloc(size);
+        long int invocation_id;
+        PendingResults<Ret>& pending_results = pending_slab.allocate(invocation_id);
+        {
+            auto v = serialized_args + mutils::to_bytes(invocation_id, serialized_args);
+            auto check_size = mutils::bytes_size(invocation_id) + serialize_all(v, remote_args...);
+            assert_always(check_size == size);
+        }
+
+        return send_return{size, serialized_args, pending_results.get_future(),
+                           pending_results};
+    }
+
+    /**
+     * Like send(), but for an asynchronous query, whose reply goes to a
+     * callback instead of a QueryResults.
+     * @param out_alloc A function that can allocate buffers, which will be
+     * used to store the constructed message; it may return nullptr, in which
+     * case nothing is sent
+     * @param dest_node The node the query is for
+     * @param callback The callback for the reply
+     * @param a The arguments to be used when calling the remote-invocable function
+     * @return The size of the message, or 0 if out_alloc returned nullptr
+     */
+    std::size_t send_async(const std::function<char*(int)>& out_alloc,
+                           const node_id_t& dest_node, reply_callback_t<Ret>&& callback,
+                           const std::decay_t<Args>&... remote_args) {
+        static_assert(!std::is_same<void, Ret>::value, "Functions that return void have no replies to wait for");
         auto invocation_id = mutils::long_rand();
         std::size_t size = mutils::bytes_size(invocation_id);
         {
@@ -102,18 +158,16 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
             size += std::accumulate(t.begin(), t.end(), 0);
         }
         char* serialized_args = out_alloc(size);
+        if(!serialized_args) {
+            return 0;
+        }
         {
             auto v = serialized_args + mutils::to_bytes(invocation_id, serialized_args);
             auto check_size = mutils::bytes_size(invocation_id) + serialize_all(v, remote_args...);
             assert_always(check_size == size);
         }
-
-        lock_t l{map_lock};
-        // default-initialize the maps
-        PendingResults<Ret>& pending_results = results_map[invocation_id];
-
-        return send_return{size, serialized_args, pending_results.get_future(),
-                           pending_results};
+        async_replies.add(invocation_id, dest_node, std::move(callback));
+        return size;
     }
 
     /**
@@ -130,13 +184,20 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
             const std::function<definitely_char*(int)>&) {
         bool is_exception = response[0];
         long int invocation_id = ((long int*)(response + 1))[0];
-        assert(results_map.count(invocation_id));
-        lock_t l{map_lock};
-        // TODO: garbage collection for the responses.
+        reply_callback_t<Ret> callback;
+        if(async_replies.take(invocation_id, callback)) {
+            if(is_exception) {
+                callback(nid, nullptr, std::make_exception_ptr(remote_exception_occurred{nid}));
+            } else {
+                auto reply = mutils::from_bytes<Ret>(dsm, response + 1 + sizeof(invocation_id));
+                callback(nid, reply.get(), nullptr);
+            }
+            return recv_ret{Opcode(), 0, nullptr, nullptr};
+        }
         if(is_exception) {
-            results_map.at(invocation_id).set_exception(nid, std::make_exception_ptr(remote_exception_occurred{nid}));
+            pending_slab.set_exception(invocation_id, nid, std::make_exception_ptr(remote_exception_occurred{nid}));
         } else {
-            results_map.at(invocation_id).set_value(nid, *mutils::from_bytes<Ret>(dsm, response + 1 + sizeof(invocation_id)));
+            pending_slab.set_value(invocation_id, nid, *mutils::from_bytes<Ret>(dsm, response + 1 + sizeof(invocation_id)));
         }
         return recv_ret{Opcode(), 0, nullptr, nullptr};
     }
@@ -156,20 +217,18 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
     /**
      * Entry point for responses; called when a message is received that
      * contains a response to this RemoteInvocable function's RPC call.
-     * @param dsm
+     * @param dsm The DeserializationManager to deserialize the response with
      * @param nid The ID of the node that sent the response
      * @param response The byte buffer containing the response message
      * @param f
      * @return A recv_ret containing nothing of value.
      */
-    inline recv_ret receive_response(  //mutils::DeserializationManager* dsm,
-            mutils::RemoteDeserialization_v* rdv,
+    inline recv_ret receive_response(
+            mutils::DeserializationManager* dsm,
             const node_id_t& nid, const char* response,
             const std::function<char*(int)>& f) {
         constexpr std::is_same<void, Ret>* choice{nullptr};
-        //        return receive_response(choice, dsm, nid, response, f);
-        mutils::DeserializationManager dsm{*rdv};
-        return receive_response(choice, &dsm, nid, response, f);
+        return receive_response(choice, dsm, nid, response, f);
     }
 
     /**
@@ -181,7 +240,6 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
     inline void fulfill_pending_results_map(long int invocation_id, const node_list_t& who) {
         // I think this function is never called
         assert_always(false);
-        results_map.at(invocation_id).fulfill_map(who);
     }
 
     /**
@@ -192,13 +250,15 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
      * (The actual function implementation is not needed, since only the
      * remote side needs to know how to implement the RPC function.)
      *
+     * @param function_index The position of the function in its class's list
+     * of RPC functions
      * @param receivers A map from RPC message opcodes to handler functions,
      * which this RemoteInvoker should add its functions to.
      */
-    RemoteInvoker(const std::type_index& class_id, uint32_t instance_id,
-                  std::map<Opcode, receive_fun_t>& receivers)
-            : invoke_opcode{class_id, instance_id, Tag, false},
-              reply_opcode{class_id, instance_id, Tag, true} {
+    RemoteInvoker(const std::type_index& class_id, uint32_t instance_id, uint32_t function_index,
+                  ReceiverTable& receivers)
+            : invoke_opcode{class_id, instance_id, Tag, false, function_index},
+              reply_opcode{class_id, instance_id, Tag, true, function_index} {
         receivers.emplace(reply_opcode, [this](auto... a) {
             return this->receive_response(a...);
         });
@@ -279,37 +339,39 @@ struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
      * Entry point for handling an RPC function call to this RemoteInvocable
      * function. Called when a message is received that contains a request to
      * call this function.
-     * @param dsm
+     * @param dsm The DeserializationManager to deserialize the arguments with.
+     * Arguments may be allocated in its DeserializationArena, if it has one,
+     * so they must not outlive the call.
      * @param who The node that sent the message
      * @param recv_buf The buffer containing the received message
      * @param out_alloc A function that can allocate a buffer for the response message
      * @return
      */
-    inline recv_ret receive_call(  //mutils::DeserializationManager* dsm,
-            mutils::RemoteDeserialization_v* rdv,
+    inline recv_ret receive_call(
+            mutils::DeserializationManager* dsm,
             const node_id_t& who, const char* recv_buf,
             const std::function<char*(int)>& out_alloc) {
         constexpr std::is_same<Ret, void>* choice{nullptr};
-        //      return this->receive_call(choice, dsm, who, recv_buf, out_alloc);
-        mutils::DeserializationManager dsm{*rdv};
-        return this->receive_call(choice, &dsm, who, recv_buf, out_alloc);
+        return this->receive_call(choice, dsm, who, recv_buf, out_alloc);
     }
 
     /**
      * Constructs a RemoteInvocable that provides RPC call handling for a
      * specific function, and registers the RPC-handling functions in the
      * given "receivers" map.
+     * @param function_index The position of the function in its class's list
+     * of RPC functions
      * @param receivers A map from RPC message opcodes to handler functions,
      * which this RemoteInvocable should add its functions to.
      * @param f The actual function that should be called when an RPC call
      * arrives.
      */
-    RemoteInvocable(const std::type_index& class_id, uint32_t instance_id,
-                    std::map<Opcode, receive_fun_t>& receivers,
+    RemoteInvocable(const std::type_index& class_id, uint32_t instance_id, uint32_t function_index,
+                    ReceiverTable& receivers,
                     std::function<Ret(Args...)> f)
             : remote_invocable_function(f),
-              invoke_opcode{class_id, instance_id, Tag, false},
-              reply_opcode{class_id, instance_id, Tag, true} {
+              invoke_opcode{class_id, instance_id, Tag, false, function_index},
+              reply_opcode{class_id, instance_id, Tag, true, function_index} {
         receivers.emplace(invoke_opcode, [this](auto... a) {
             return this->receive_call(a...);
         });
@@ -403,9 +465,9 @@ struct RemoteInvocablePairs<wrapped<id, FunType>>
         : public RemoteInvoker<id, FunType>, public RemoteInvocable<id, FunType> {
     RemoteInvocablePairs(const std::type_index& class_id,
                          uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& receivers, FunType function_ptr)
-            : RemoteInvoker<id, FunType>(class_id, instance_id, receivers),
-              RemoteInvocable<id, FunType>(class_id, instance_id, receivers, function_ptr) {}
+                         ReceiverTable& receivers, FunType function_ptr)
+            : RemoteInvoker<id, FunType>(class_id, instance_id, 0, receivers),
+              RemoteInvocable<id, FunType>(class_id, instance_id, 0, receivers, function_ptr) {}
 
     using RemoteInvoker<id, FunType>::get_invoker;
     using RemoteInvocable<id, FunType>::get_handler;
@@ -429,11 +491,11 @@ struct RemoteInvocablePairs<wrapped<id, FunType>, rest...>
     template <typename... RestFunTypes>
     RemoteInvocablePairs(const std::type_index& class_id,
                          uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& receivers,
+                         ReceiverTable& receivers,
                          FunType function_ptr,
                          RestFunTypes&&... function_ptrs)
-            : RemoteInvoker<id, FunType>(class_id, instance_id, receivers),
-              RemoteInvocable<id, FunType>(class_id, instance_id, receivers, function_ptr),
+            : RemoteInvoker<id, FunType>(class_id, instance_id, sizeof...(rest), receivers),
+              RemoteInvocable<id, FunType>(class_id, instance_id, sizeof...(rest), receivers, function_ptr),
               RemoteInvocablePairs<rest...>(class_id, instance_id, receivers, std::forward<RestFunTypes>(function_ptrs)...) {}
 
     //Ensure the inherited functions from RemoteInvoker and RemoteInvokable are visible
@@ -458,8 +520,8 @@ template <FunctionTag Tag, typename FunType>
 struct RemoteInvokers<wrapped<Tag, FunType>> : public RemoteInvoker<Tag, FunType> {
     RemoteInvokers(const std::type_index& class_id,
                    uint32_t instance_id,
-                   std::map<Opcode, receive_fun_t>& receivers)
-            : RemoteInvoker<Tag, FunType>(class_id, instance_id, receivers) {}
+                   ReceiverTable& receivers)
+            : RemoteInvoker<Tag, FunType>(class_id, instance_id, 0, receivers) {}
 
     using RemoteInvoker<Tag, FunType>::get_invoker;
 };
@@ -479,8 +541,8 @@ struct RemoteInvokers<wrapped<Tag, FunType>, RestWrapped...>
         : public RemoteInvoker<Tag, FunType>, public RemoteInvokers<RestWrapped...> {
     RemoteInvokers(const std::type_index& class_id,
                    uint32_t instance_id,
-                   std::map<Opcode, receive_fun_t>& receivers)
-            : RemoteInvoker<Tag, FunType>(class_id, instance_id, receivers),
+                   ReceiverTable& receivers)
+            : RemoteInvoker<Tag, FunType>(class_id, instance_id, sizeof...(RestWrapped), receivers),
               RemoteInvokers<RestWrapped...>(class_id, instance_id, receivers) {}
 
     using RemoteInvoker<Tag, FunType>::get_invoker;
@@ -505,20 +567,19 @@ public:
     const node_id_t nid;
 
     RemoteInvocableClass(node_id_t nid, uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& rvrs, const WrappedFuns&... fs)
+                         ReceiverTable& rvrs, const WrappedFuns&... fs)
             : RemoteInvocablePairs<WrappedFuns...>(std::type_index(typeid(IdentifyingClass)), instance_id, rvrs, fs.fun...),
               logger(spdlog::get("derecho_debug_log")),
               nid(nid) {}
 
+    /**
+     * @return The size of the message that invokes a method of this class
+     * with these arguments, not counting the header
+     */
     template <FunctionTag Tag, typename... Args>
     std::size_t get_size(Args&&... a) {
-        auto invocation_id = mutils::long_rand();
-        std::size_t size = mutils::bytes_size(invocation_id);
-        {
-            auto t = {std::size_t{0}, std::size_t{0}, mutils::bytes_size(a)...};
-            size += std::accumulate(t.begin(), t.end(), 0);
-        }
-        return size;
+        constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
+        return this->get_invoker(choice, a...).get_size(a...);
     }
 
     /**
@@ -533,20 +594,56 @@ public:
      */
     template <FunctionTag Tag, typename... Args>
     auto send(const std::function<char*(int)>& out_alloc, Args&&... args) {
+        const std::size_t size = get_size<Tag>(args...);
+        return send_sized<Tag>(out_alloc, size, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Like send(), for a caller that has already computed the size of the
+     * message with get_size(), e.g. to allocate a buffer, so that the
+     * arguments need not be walked again before serializing them.
+     * @param out_alloc A function that can allocate a buffer for the message
+     * @param size What get_size() returned for these arguments
+     * @param args The arguments that should be given to the method when
+     * invoking it
+     */
+    template <FunctionTag Tag, typename... Args>
+    auto send_sized(const std::function<char*(int)>& out_alloc, std::size_t size, Args&&... args) {
+        return send_sized_with_header<Tag>(true, out_alloc, size, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @return The function_index of the method that Tag names, which
+     * identifies it within its subgroup in a compact RPC header
+     */
+    template <FunctionTag Tag, typename... Args>
+    uint32_t get_function_index(Args&&... a) {
+        constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
+        return this->get_invoker(choice, a...).invoke_opcode.function_index;
+    }
+
+    /**
+     * Like send_sized(), but if rpc_header is false the message is only the
+     * serialized arguments, without the RPC header, and out_alloc is asked
+     * for that much; the caller sends it with a compact header instead.
+     */
+    template <FunctionTag Tag, typename... Args>
+    auto send_sized_with_header(bool rpc_header, const std::function<char*(int)>& out_alloc,
+                                std::size_t size, Args&&... args) {
         using namespace remote_invocation_utilities;
 
         constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
         auto& invoker = this->get_invoker(choice, args...);
-        const auto header_size = header_space();
-        auto sent_return = invoker.send(
+        const auto header_size = rpc_header ? header_space() : 0;
+        auto sent_return = invoker.send_sized(
                 [&out_alloc, &header_size](std::size_t size) {
                     return out_alloc(size + header_size) + header_size;
                 },
-                std::forward<Args>(args)...);
+                size, std::forward<Args>(args)...);
 
-        std::size_t payload_size = sent_return.size;
-        char* buf = sent_return.buf - header_size;
-        populate_header(buf, payload_size, invoker.invoke_opcode, nid);
+        if(rpc_header) {
+            populate_header(sent_return.buf - header_size, sent_return.size, invoker.invoke_opcode, nid);
+        }
 
         using Ret = typename decltype(sent_return.results)::type;
         /*
@@ -561,6 +658,59 @@ public:
                            sent_return.pending};
     }
 
+    /**
+     * Constructs a message that will remotely invoke a method of this class
+     * as an asynchronous query, whose reply goes to a callback.
+     * @param out_alloc A function that can allocate a buffer for the message,
+     * or return nullptr to send nothing
+     * @param dest_node The node the query is for
+     * @param callback The reply_callback_t for the reply
+     * @param args The arguments that should be given to the method when
+     * invoking it
+     * @return A struct containing the size of the message, header included,
+     * or 0 if out_alloc returned nullptr ("size"), and the AsyncReplies that
+     * holds the callback ("replies").
+     */
+    template <FunctionTag Tag, typename Callback, typename... Args>
+    auto send_async(const std::function<char*(int)>& out_alloc, const node_id_t& dest_node,
+                    Callback&& callback, Args&&... args) {
+        using namespace remote_invocation_utilities;
+
+        constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
+        auto& invoker = this->get_invoker(choice, args...);
+        const auto header_size = header_space();
+        char* buf = nullptr;
+        std::size_t payload_size = invoker.send_async(
+                [&out_alloc, &header_size, &buf](std::size_t size) -> char* {
+                    buf = out_alloc(size + header_size);
+                    return buf ? buf + header_size : nullptr;
+                },
+                dest_node, std::forward<Callback>(callback), std::forward<Args>(args)...);
+        struct send_async_return {
+            std::size_t size;
+            OutstandingRepliesBase& replies;
+        };
+        if(payload_size == 0) {
+            return send_async_return{0, invoker.async_replies};
+        }
+        populate_header(buf, payload_size, invoker.invoke_opcode, nid);
+        return send_async_return{payload_size + header_size, invoker.async_replies};
+    }
+
+    /**
+     * Calls a method of the local instance of this class directly, as its
+     * RPC handler would, but with neither a message nor a reply.
+     * @param args The arguments that should be given to the method
+     * @return The return value of the method; an exception it throws is
+     * thrown from here
+     */
+    template <FunctionTag Tag, typename... Args>
+    auto local_call(Args&&... args) {
+        constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
+        auto& handler = this->get_handler(choice, args...);
+        return handler.remote_invocable_function(std::forward<Args>(args)...);
+    }
+
     using specialized_to = IdentifyingClass;
     RemoteInvocableClass& for_class(IdentifyingClass*) {
         return *this;
@@ -582,7 +732,7 @@ public:
  */
 template <class IdentifyingClass, typename... WrappedFuns>
 auto build_remote_invocable_class(const node_id_t nid, const uint32_t instance_id,
-                                  std::map<Opcode, receive_fun_t>& rvrs,
+                                  ReceiverTable& rvrs,
                                   const WrappedFuns&... fs) {
     return std::make_unique<RemoteInvocableClass<IdentifyingClass, WrappedFuns...>>(nid, instance_id, rvrs, fs...);
 }
@@ -604,7 +754,7 @@ public:
     const node_id_t nid;
 
     RemoteInvokerForClass(node_id_t nid, uint32_t instance_id,
-                          std::map<Opcode, receive_fun_t>& rvrs)
+                          ReceiverTable& rvrs)
             : RemoteInvokers<WrappedFuns...>(std::type_index(typeid(IdentifyingClass)), instance_id, rvrs),
               nid(nid) {}
 
@@ -637,6 +787,45 @@ public:
         return send_return{std::move(sent_return.results),
                            sent_return.pending};
     }
+
+    /**
+     * Constructs a message that will remotely invoke a method of this class
+     * as an asynchronous query, whose reply goes to a callback.
+     * @param out_alloc A function that can allocate a buffer for the message,
+     * or return nullptr to send nothing
+     * @param dest_node The node the query is for
+     * @param callback The reply_callback_t for the reply
+     * @param args The arguments that should be given to the method when
+     * invoking it
+     * @return A struct containing the size of the message, header included,
+     * or 0 if out_alloc returned nullptr ("size"), and the AsyncReplies that
+     * holds the callback ("replies").
+     */
+    template <FunctionTag Tag, typename Callback, typename... Args>
+    auto send_async(const std::function<char*(int)>& out_alloc, const node_id_t& dest_node,
+                    Callback&& callback, Args&&... args) {
+        using namespace remote_invocation_utilities;
+
+        constexpr std::integral_constant<FunctionTag, Tag>* choice{nullptr};
+        auto& invoker = this->get_invoker(choice, args...);
+        const auto header_size = header_space();
+        char* buf = nullptr;
+        std::size_t payload_size = invoker.send_async(
+                [&out_alloc, &header_size, &buf](std::size_t size) -> char* {
+                    buf = out_alloc(size + header_size);
+                    return buf ? buf + header_size : nullptr;
+                },
+                dest_node, std::forward<Callback>(callback), std::forward<Args>(args)...);
+        struct send_async_return {
+            std::size_t size;
+            OutstandingRepliesBase& replies;
+        };
+        if(payload_size == 0) {
+            return send_async_return{0, invoker.async_replies};
+        }
+        populate_header(buf, payload_size, invoker.invoke_opcode, nid);
+        return send_async_return{payload_size + header_size, invoker.async_replies};
+    }
 };
 
 /**
@@ -653,7 +842,7 @@ public:
  */
 template <class IdentifyingClass, typename... WrappedFuns>
 auto build_remote_invoker_for_class(const node_id_t nid, const uint32_t instance_id,
-                                    std::map<Opcode, receive_fun_t>& rvrs) {
+                                    ReceiverTable& rvrs) {
     return std::make_unique<RemoteInvokerForClass<IdentifyingClass, WrappedFuns...>>(nid, instance_id, rvrs);
 }
 }  // namespace rpc
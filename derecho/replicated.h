@@ -6,11 +6,16 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "derecho_exception.h"
 #include "derecho_internal.h"
@@ -57,6 +62,7 @@ public:
     virtual std::size_t object_size() const = 0;
     virtual void send_object(tcp::socket& receiver_socket) const = 0;
     virtual void send_object_raw(tcp::socket& receiver_socket) const = 0;
+    virtual std::vector<char> serialize_object() const = 0;
     virtual std::size_t receive_object(char* buffer) = 0;
     virtual bool is_persistent() const = 0;
     virtual void make_version(const persistent::version_t& ver, const HLC& hlc) noexcept(false) = 0;
@@ -99,59 +105,108 @@ private:
     template <rpc::FunctionTag tag, typename... Args>
     auto ordered_send_or_query(bool is_query, const std::vector<node_id_t>& destination_nodes,
                                Args&&... args) {
+        // a catching-up replica is empty, and must not answer queries yet
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
         if(is_valid()) {
             // std::cout << "In ordered_send_or_query: T=" << typeid(T).name() << std::endl;
+            // Walk the arguments for their size once, not on every retry, and
+            // let send_sized serialize them without walking them again
+            const std::size_t payload_size = wrapped_this->template get_size<tag>(args...);
+            if(group_rpc_manager.use_targeted_send(subgroup_id, destination_nodes, payload_size)) {
+                return send_targeted<tag>(is_query, destination_nodes, payload_size, std::forward<Args>(args)...);
+            }
+            const std::size_t message_size = group_rpc_manager.ordered_message_size(subgroup_id, destination_nodes, payload_size);
             char* buffer;
-            while(!(buffer = group_rpc_manager.view_manager.get_sendbuffer_ptr(subgroup_id, wrapped_this->template get_size<tag>(std::forward<Args>(args)...), true))) {
+            while(!(buffer = group_rpc_manager.view_manager.get_sendbuffer_ptr(subgroup_id, message_size, true))) {
             };
             // std::cout << "Obtained a buffer" << std::endl;
-            std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
-
-            std::size_t max_payload_size;
-            int buffer_offset = group_rpc_manager.populate_nodelist_header(destination_nodes,
-                                                                           buffer, max_payload_size);
-            buffer += buffer_offset;
-
-            auto send_return_struct = wrapped_this->template send<tag>(
-                    [&buffer, &max_payload_size](size_t size) -> char* {
-                        if(size <= max_payload_size) {
-                            return buffer;
-                        } else {
-                            return nullptr;
-                        }
-                    },
-                    std::forward<Args>(args)...);
-
-            // std::cout << "Done with serialization" << std::endl;
-            group_rpc_manager.view_manager.view_change_cv.wait(view_read_lock, [&]() {
-                return group_rpc_manager.finish_rpc_send(is_query, subgroup_id, destination_nodes, send_return_struct.pending);
-            });
-            // std::cout << "Done with send" << std::endl;
-            return std::move(send_return_struct.results);
+            return send_in_buffer<tag>(is_query, destination_nodes, buffer, payload_size, std::forward<Args>(args)...);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
         }
     }
 
+    /**
+     * Serializes an RPC message into a send buffer that has already been
+     * obtained for it, and sends it.
+     * @param payload_size The size of the serialized arguments, which the
+     * buffer was obtained for
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto send_in_buffer(bool is_query, const std::vector<node_id_t>& destination_nodes,
+                        char* buffer, std::size_t payload_size, Args&&... args) {
+        std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+
+        std::size_t max_payload_size;
+        const bool compact_header = group_rpc_manager.compact_rpc_headers;
+        int buffer_offset = group_rpc_manager.populate_nodelist_header(
+                subgroup_id, destination_nodes, buffer, max_payload_size,
+                compact_header ? wrapped_this->template get_function_index<tag>(args...) : rpc::Opcode::NO_FUNCTION_INDEX);
+        buffer += buffer_offset;
+
+        auto send_return_struct = wrapped_this->template send_sized_with_header<tag>(
+                !compact_header,
+                [&buffer, &max_payload_size](size_t size) -> char* {
+                    if(size <= max_payload_size) {
+                        return buffer;
+                    } else {
+                        return nullptr;
+                    }
+                },
+                payload_size, std::forward<Args>(args)...);
+
+        // std::cout << "Done with serialization" << std::endl;
+        if(is_query && destination_nodes.empty()) {
+            group_rpc_manager.queue_shard_query(subgroup_id, send_return_struct.pending);
+        }
+        group_rpc_manager.view_manager.view_change_cv.wait(view_read_lock, [&]() {
+            return group_rpc_manager.finish_rpc_send(is_query, subgroup_id, destination_nodes, send_return_struct.pending);
+        });
+        // std::cout << "Done with send" << std::endl;
+        return std::move(send_return_struct.results);
+    }
+
+    /**
+     * Sends an RPC message to part of the shard as a targeted send: its body
+     * goes to the destinations by P2P, and only a placeholder, which gives
+     * it its place in the order, is multicast.
+     * @param payload_size The size of the serialized arguments
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto send_targeted(bool is_query, const std::vector<node_id_t>& destination_nodes,
+                       std::size_t payload_size, Args&&... args) {
+        const std::size_t placeholder_size = group_rpc_manager.targeted_placeholder_size(destination_nodes);
+        char* buffer;
+        while(!(buffer = group_rpc_manager.view_manager.get_sendbuffer_ptr(subgroup_id, placeholder_size, true))) {
+        };
+        std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+        auto send_return_struct = wrapped_this->template send_sized<tag>(
+                [this](size_t size) -> char* {
+                    return group_rpc_manager.get_targeted_body_buffer(size);
+                },
+                payload_size, std::forward<Args>(args)...);
+        group_rpc_manager.send_targeted_body(subgroup_id, destination_nodes, buffer);
+        group_rpc_manager.view_manager.view_change_cv.wait(view_read_lock, [&]() {
+            return group_rpc_manager.finish_rpc_send(is_query, subgroup_id, destination_nodes, send_return_struct.pending);
+        });
+        return std::move(send_return_struct.results);
+    }
+
     template <rpc::FunctionTag tag, typename... Args>
     auto p2p_send_or_query(bool is_query, node_id_t dest_node, Args&&... args) {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
         if(is_valid()) {
             assert(dest_node != node_id);
             //Ensure a view change isn't in progress
-            std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+            std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
             size_t size;
-            auto max_payload_size = group_rpc_manager.view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
             auto return_pair = wrapped_this->template send<tag>(
-                    [this, &is_query, &dest_node, &max_payload_size, &size](size_t _size) -> char* {
+                    [this, &is_query, &dest_node, &size](size_t _size) -> char* {
                         size = _size;
-                        if(size <= max_payload_size) {
-                            return (char*)group_rpc_manager.get_sendbuffer_ptr(dest_node, is_query ? sst::REQUEST_TYPE::P2P_QUERY : sst::REQUEST_TYPE::P2P_SEND);
-                        } else {
-                            return nullptr;
-                        }
+                        return (char*)group_rpc_manager.get_sendbuffer_ptr(dest_node, is_query ? sst::REQUEST_TYPE::P2P_QUERY : sst::REQUEST_TYPE::P2P_SEND, size);
                     },
                     std::forward<Args>(args)...);
-            group_rpc_manager.finish_p2p_send(is_query, dest_node, return_pair.pending);
+            group_rpc_manager.finish_p2p_send(is_query, dest_node, size, return_pair.pending);
             return std::move(return_pair.results);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
@@ -187,6 +242,32 @@ public:
         }
     }
 
+    /**
+     * Constructs a Replicated<T> around an object that has already been
+     * constructed, by a Factory<T> that was given persistent_registry, which
+     * lets the Group construct the objects of its subgroups on other threads.
+     * @param persistent_registry The registry the object's Persistent fields
+     * registered with, constructed with no temporal frontier provider
+     * @param user_object The object
+     */
+    Replicated(node_id_t nid, subgroup_id_t subgroup_id, uint32_t subgroup_index, uint32_t shard_num,
+               rpc::RPCManager& group_rpc_manager, std::unique_ptr<PersistentRegistry> persistent_registry,
+               std::unique_ptr<T> user_object, _Group* group)
+            : persistent_registry_ptr(std::move(persistent_registry)),
+              user_object_ptr(std::make_unique<std::unique_ptr<T>>(std::move(user_object))),
+              node_id(nid),
+              subgroup_id(subgroup_id),
+              subgroup_index(subgroup_index),
+              shard_num(shard_num),
+              group_rpc_manager(group_rpc_manager),
+              wrapped_this(group_rpc_manager.make_remote_invocable_class(user_object_ptr.get(), subgroup_id, T::register_functions())),
+              group(group) {
+        persistent_registry_ptr->updateTemporalFrontierProvider(this);
+        if constexpr(std::is_base_of_v<GroupReference, T>) {
+            (**user_object_ptr).set_group_pointers(group, subgroup_index);
+        }
+    }
+
     /**
      * Constructs a Replicated<T> for an object without actually constructing an
      * instance of that object; the resulting Replicated will be in an invalid
@@ -274,6 +355,91 @@ public:
         ordered_send<tag>({}, std::forward<Args>(args)...);
     }
 
+    /**
+     * Like ordered_send, but returns false instead of waiting when the
+     * subgroup's send window is full. If the group's CallbackSet has a
+     * send_space_callback, it is called once there may be room again, so the
+     * caller can retry then instead of spinning. This still waits for the
+     * subgroup's state if this replica is catching up after joining, and for
+     * a view change in progress.
+     * @param destination_nodes The IDs of the nodes that should be sent the
+     * RPC message; empty means the entire subgroup
+     * @param args The arguments to the RPC function being invoked
+     * @return true if the message was sent, false if there was no room
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    bool try_ordered_send(const std::vector<node_id_t>& destination_nodes, Args&&... args) {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        if(!is_valid()) {
+            throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
+        }
+        const std::size_t payload_size = wrapped_this->template get_size<tag>(args...);
+        char* buffer = group_rpc_manager.view_manager.get_sendbuffer_ptr(
+                subgroup_id, group_rpc_manager.ordered_message_size(subgroup_id, destination_nodes, payload_size), true);
+        if(!buffer) {
+            return false;
+        }
+        send_in_buffer<tag>(false, destination_nodes, buffer, payload_size, std::forward<Args>(args)...);
+        return true;
+    }
+
+    /**
+     * Like ordered_send to the entire subgroup, but returns false instead of
+     * waiting when the subgroup's send window is full; see the other
+     * try_ordered_send.
+     * @param args The arguments to the RPC function being invoked
+     * @return true if the message was sent, false if there was no room
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    bool try_ordered_send(Args&&... args) {
+        return try_ordered_send<tag>({}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Makes an ordered send for Group::send_batch, which sends it together
+     * with ordered sends in other subgroups. It holds the arguments by
+     * reference, so it should be passed to send_batch in the same statement:
+     * group.send_batch({a.batched_send<A::f>(x), b.batched_send<B::g>(y)}).
+     * This should only be used for RPC functions whose return type is void.
+     * @param destination_nodes The IDs of the nodes that should be sent the
+     * RPC message; empty means the entire subgroup
+     * @param args The arguments to the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    rpc::BatchedSend batched_send(const std::vector<node_id_t>& destination_nodes, Args&&... args) {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        if(!is_valid()) {
+            throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
+        }
+        const std::size_t payload_size = wrapped_this->template get_size<tag>(args...);
+        return rpc::BatchedSend{
+                subgroup_id, destination_nodes, payload_size,
+                wrapped_this->template get_function_index<tag>(args...),
+                [this, payload_size, arguments = std::forward_as_tuple(std::forward<Args>(args)...)](
+                        char* buffer, std::size_t max_payload_size, bool rpc_header) -> rpc::PendingBase& {
+                    return std::apply(
+                            [&](auto&... unpacked_args) -> rpc::PendingBase& {
+                                return wrapped_this->template send_sized_with_header<tag>(
+                                                           rpc_header,
+                                                           [buffer, max_payload_size](size_t size) -> char* {
+                                                               return size <= max_payload_size ? buffer : nullptr;
+                                                           },
+                                                           payload_size, unpacked_args...)
+                                        .pending;
+                            },
+                            arguments);
+                }};
+    }
+
+    /**
+     * Like batched_send to the entire subgroup.
+     * @param args The arguments to the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    rpc::BatchedSend batched_send(Args&&... args) {
+        return batched_send<tag>({}, std::forward<Args>(args)...);
+    }
+
     /**
      * Sends a multicast to only some members of the subgroup that replicates
      * this Replicated<T>, invoking the RPC function identified by the
@@ -312,6 +478,8 @@ public:
      * This should only be used for RPC functions whose return type is void.
      * @param dest_node The ID of the node that the P2P message should be sent to
      * @param args The arguments to the RPC function being invoked
+     * @throws message_too_large_exception if the arguments take more than
+     * max_payload_size bytes
      */
     template <rpc::FunctionTag tag, typename... Args>
     void p2p_send(node_id_t dest_node, Args&&... args) {
@@ -329,12 +497,140 @@ public:
      * @param args The arguments to the RPC function being invoked
      * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
      * of the RPC function being invoked
+     * @throws message_too_large_exception if the arguments take more than
+     * max_payload_size bytes
      */
     template <rpc::FunctionTag tag, typename... Args>
     auto p2p_query(node_id_t dest_node, Args&&... args) {
         return p2p_send_or_query<tag>(true, dest_node, std::forward<Args>(args)...);
     }
 
+    /**
+     * Sends a peer-to-peer query to whichever other member of this node's
+     * shard is least loaded: the one with the fewest queries from this node
+     * awaiting a reply, weighed by how long its recent replies took. This
+     * spreads reads over the replicas without the caller picking them.
+     * @param args The arguments to the RPC function being invoked
+     * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
+     * of the RPC function being invoked
+     * @throws invalid_subgroup_exception if this node is alone in its shard
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto p2p_query_any(Args&&... args) {
+        return p2p_query<tag>(group_rpc_manager.pick_shard_member(subgroup_id, shard_num), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Sends an asynchronous peer-to-peer query to a single member of the
+     * subgroup that this Replicated<T> targets, invoking the RPC function identified
+     * by the FunctionTag template parameter. Instead of returning a
+     * QueryResults, this hands the reply to a callback, and never waits: if
+     * the P2P window to the node is full, nothing is sent and it returns
+     * false, so the caller can retry once earlier replies have arrived.
+     * @param dest_node The ID of the node that the P2P message should be sent to
+     * @param callback A callable that can be converted to an
+     * rpc::reply_callback_t<Ret>, where Ret is the return type of the RPC
+     * function being invoked; it is called on the P2P thread
+     * @param args The arguments to the RPC function being invoked
+     * @return true if the query was sent, false if the window was full
+     * @throws message_too_large_exception as p2p_query does; the query would
+     * never fit, so it isn't reported as a full window to retry on
+     */
+    template <rpc::FunctionTag tag, typename Callback, typename... Args>
+    bool p2p_query_async(node_id_t dest_node, Callback&& callback, Args&&... args) {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        if(is_valid()) {
+            assert(dest_node != node_id);
+            //Ensure a view change isn't in progress
+            std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+            auto sent = wrapped_this->template send_async<tag>(
+                    [this, &dest_node](size_t size) -> char* {
+                        return (char*)group_rpc_manager.try_get_query_buffer_ptr(dest_node, size);
+                    },
+                    dest_node, std::forward<Callback>(callback), std::forward<Args>(args)...);
+            if(sent.size == 0) {
+                return false;
+            }
+            group_rpc_manager.finish_p2p_async_query(dest_node, sent.size, sent.replies);
+            return true;
+        } else {
+            throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
+        }
+    }
+
+    /**
+     * Invokes the RPC function identified by the FunctionTag template
+     * parameter on this node's own replica, directly: nothing is serialized
+     * or sent, and the result is returned instead of a QueryResults. The
+     * function sees the state of the replica as of the last message this
+     * node delivered, as a P2P query to it would, and it must not modify
+     * that state, or the replicas will diverge.
+     * @param args The arguments to the RPC function being invoked
+     * @return The value returned by the RPC function; an exception it throws
+     * is thrown from here
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto local_query(Args&&... args) {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        if(is_valid()) {
+            //Ensure a view change isn't in progress, as for a P2P query
+            std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+            return wrapped_this->template local_call<tag>(std::forward<Args>(args)...);
+        } else {
+            throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
+        }
+    }
+
+    /**
+     * @return A ticket covering every message this node has sent to the
+     * subgroup so far, with ordered_send or otherwise, to pass to
+     * wait_for_delivery() or local_query_after(). Taken right after an
+     * ordered_send returns, it covers that send.
+     */
+    uint64_t get_send_ticket() {
+        return group_rpc_manager.view_manager.get_send_ticket(subgroup_id);
+    }
+
+    /**
+     * Blocks until this node has delivered the messages a ticket covers, so
+     * that its replica reflects them. Unlike an ordered_query, this sends
+     * nothing; it only waits for the local delivery. Throws in unordered
+     * subgroups, which don't deliver RPC messages.
+     * @param ticket A value returned by get_send_ticket()
+     */
+    void wait_for_delivery(uint64_t ticket) {
+        group_rpc_manager.view_manager.wait_for_own_delivery(subgroup_id, ticket);
+    }
+
+    /**
+     * Like local_query, but first waits until this node has delivered the
+     * messages a ticket covers, so the function reads its own writes: e.g.
+     * after ordered_send<RPC_NAME(put)>(...), local_query_after<RPC_NAME(get)>(
+     * get_send_ticket(), ...) sees the put.
+     * @param ticket A value returned by get_send_ticket()
+     * @param args The arguments to the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto local_query_after(uint64_t ticket, Args&&... args) {
+        wait_for_delivery(ticket);
+        return local_query<tag>(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Like local_query, but first waits until this node has delivered every
+     * update that any member of its shard had delivered when it was called,
+     * so that the result is linearizable without sending anything. The wait
+     * is usually the time for messages already in flight to become stable.
+     * Only ordered and sequenced subgroups are covered; in others this is
+     * the same as local_query.
+     * @param args The arguments to the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto linearizable_local_query(Args&&... args) {
+        group_rpc_manager.view_manager.wait_for_read_index(subgroup_id);
+        return local_query<tag>(std::forward<Args>(args)...);
+    }
+
     /**
      * Gets a pointer into the send buffer for this subgroup, for the purpose of
      * doing a "raw send" (not an RPC send).
@@ -351,6 +647,30 @@ public:
         return group_rpc_manager.view_manager.compute_global_stability_frontier(subgroup_id);
     }
 
+    /**
+     * @return The latest version of this object that every member of its
+     * shard has persisted, or -1 if there is none yet
+     */
+    persistent::version_t compute_global_persistence_frontier() {
+        return group_rpc_manager.view_manager.compute_global_persistence_frontier(subgroup_id);
+    }
+
+    /**
+     * Invokes a read-only RPC function on this node's own replica, like
+     * local_query, with compute_global_persistence_frontier() as its first
+     * argument. The function is meant to read its Persistent<T> fields at that
+     * version, e.g. with getCached(version), instead of their current state,
+     * so that every replica returns the same result for the same frontier and
+     * nothing goes over the network; the result may be as stale as the
+     * persistence of the latest updates is slow. The function has to handle
+     * a version of -1, before anything is persisted.
+     * @param args The arguments to the RPC function after the version
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto read_at_frontier(Args&&... args) {
+        return local_query<tag>(compute_global_persistence_frontier(), std::forward<Args>(args)...);
+    }
+
     inline const HLC getFrontier() {
         // transform from ns to us:
         HLC hlc(this->compute_global_stability_frontier() / 1e3, 0);
@@ -384,15 +704,17 @@ public:
 
     /**
      * Serializes and sends the state of the "wrapped" object (of type T) for
-     * this Replicated<T> over the given socket. (This includes sending the
-     * object's size before its data, so the receiver knows the size of buffer
-     * to allocate).
+     * this Replicated<T> over the given socket. The object is streamed in
+     * chunks as it is serialized, followed by an end marker, so its size
+     * doesn't have to be computed first; the receiver reads it with
+     * tcp::socket::read_chunked().
      * @param receiver_socket
      */
     void send_object(tcp::socket& receiver_socket) const {
-        auto bind_socket_write = [&receiver_socket](const char* bytes, std::size_t size) { receiver_socket.write(bytes, size); };
-        mutils::post_object(bind_socket_write, object_size());
-        send_object_raw(receiver_socket);
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        tcp::chunked_writer writer(receiver_socket);
+        mutils::post_object(writer.post_function(), **user_object_ptr);
+        writer.finish();
     }
 
     /**
@@ -404,10 +726,25 @@ public:
      * @param receiver_socket
      */
     void send_object_raw(tcp::socket& receiver_socket) const {
-        auto bind_socket_write = [&receiver_socket](const char* bytes, std::size_t size) {
-            receiver_socket.write(bytes, size);
-        };
-        mutils::post_object(bind_socket_write, **user_object_ptr);
+        // post_object hands over the object a field at a time, and a
+        // persistent field's log a header and a data buffer per entry, so
+        // gather the small pieces rather than writing each one separately
+        tcp::buffered_writer writer(receiver_socket);
+        mutils::post_object(writer.post_function(), **user_object_ptr);
+        writer.flush();
+    }
+
+    /**
+     * Serializes the state of the "wrapped" object (of type T) for this
+     * Replicated<T> into a buffer, so that it can be sent after the state has
+     * moved on, as in a background state transfer.
+     * @return The serialized object
+     */
+    std::vector<char> serialize_object() const {
+        group_rpc_manager.wait_for_catch_up(subgroup_id);
+        std::vector<char> buffer(object_size());
+        mutils::to_bytes(**user_object_ptr, buffer.data());
+        return buffer;
     }
 
     /**
@@ -466,6 +803,17 @@ public:
         persistent_registry_ptr->trim(earliest_version);
     };
 
+    /**
+     * Trims the logs like trim(), but on the persistence thread after its
+     * next flush of this subgroup's logs, so it returns without waiting for
+     * them. Meant for RPC handlers, which run on the delivery thread.
+     * @param earliest_version - the version number, before which, logs are
+     * going to be trimmed
+     */
+    void trim_async(const persistent::version_t& earliest_version) noexcept(true) {
+        persistent_registry_ptr->trimAsync(earliest_version);
+    }
+
     /**
      * Truncate the logs of all Persistent<T> members back to the version
      * specified. This deletes recently-used data, so it should only be called
@@ -476,14 +824,33 @@ public:
         persistent_registry_ptr->truncate(latest_version);
     }
 
+    /**
+     * Sets how much of their logs the Persistent<T> members keep, replacing
+     * the PERS/retention_* defaults for this subgroup. Takes effect at the
+     * next flush of the logs.
+     * @param policy The limits beyond which persisted versions are trimmed
+     */
+    void set_retention_policy(const persistent::RetentionPolicy& policy) {
+        persistent_registry_ptr->setRetentionPolicy(policy);
+    }
+
+    /**
+     * Trims the logs of all Persistent<T> members according to the retention
+     * policy, among the versions that have been persisted.
+     * @param persisted_version The latest persisted version
+     */
+    virtual void retain(const persistent::version_t& persisted_version) noexcept(false) {
+        persistent_registry_ptr->retain(persisted_version);
+    }
+
     /**
      * Register a persistent member
      * @param vf - the version function
      * @param pf - the persistent function
      * @param tf - the trim function
      */
-    virtual void register_persistent_member(const char* object_name, const VersionFunc& vf, const PersistFunc& pf, const TrimFunc& tf, const LatestPersistedGetterFunc& gf, TruncateFunc tcf) noexcept(false) {
-        this->persistent_registry_ptr->registerPersist(object_name, vf, pf, tf, gf, tcf);
+    virtual void register_persistent_member(const char* object_name, const VersionFunc& vf, const PersistFunc& pf, const TrimFunc& tf, const LatestPersistedGetterFunc& gf, TruncateFunc tcf, RetainFunc rf) noexcept(false) {
+        this->persistent_registry_ptr->registerPersist(object_name, vf, pf, tf, gf, tcf, rf);
     }
 };
 
@@ -506,20 +873,15 @@ private:
         if(is_valid()) {
             assert(dest_node != node_id);
             //Ensure a view change isn't in progress
-            std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+            std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
             size_t size;
-            auto max_payload_size = group_rpc_manager.view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
             auto return_pair = wrapped_this->template send<tag>(
-                    [this, &is_query, &dest_node, &max_payload_size, &size](size_t _size) -> char* {
+                    [this, &is_query, &dest_node, &size](size_t _size) -> char* {
                         size = _size;
-                        if(size <= max_payload_size) {
-                            return (char*)group_rpc_manager.get_sendbuffer_ptr(dest_node, is_query ? sst::REQUEST_TYPE::P2P_QUERY : sst::REQUEST_TYPE::P2P_SEND);
-                        } else {
-                            return nullptr;
-                        }
+                        return (char*)group_rpc_manager.get_sendbuffer_ptr(dest_node, is_query ? sst::REQUEST_TYPE::P2P_QUERY : sst::REQUEST_TYPE::P2P_SEND, size);
                     },
                     std::forward<Args>(args)...);
-            group_rpc_manager.finish_p2p_send(is_query, dest_node, return_pair.pending);
+            group_rpc_manager.finish_p2p_send(is_query, dest_node, size, return_pair.pending);
             return std::move(return_pair.results);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
@@ -545,6 +907,8 @@ public:
      * This should only be used for RPC functions whose return type is void.
      * @param dest_node The ID of the node that the P2P message should be sent to
      * @param args The arguments to the RPC function being invoked
+     * @throws message_too_large_exception if the arguments take more than
+     * max_payload_size bytes
      */
     template <rpc::FunctionTag tag, typename... Args>
     void p2p_send(node_id_t dest_node, Args&&... args) {
@@ -562,11 +926,81 @@ public:
      * @param args The arguments to the RPC function being invoked
      * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
      * of the RPC function being invoked
+     * @throws message_too_large_exception if the arguments take more than
+     * max_payload_size bytes
      */
     template <rpc::FunctionTag tag, typename... Args>
     auto p2p_query(node_id_t dest_node, Args&&... args) {
         return p2p_send_or_query<tag>(true, dest_node, std::forward<Args>(args)...);
     }
+
+    /**
+     * Sends a peer-to-peer query to one member of a shard of the subgroup
+     * that this ExternalCaller targets, picking the least loaded one: the
+     * member with the fewest queries from this node awaiting a reply,
+     * weighed by how long its recent replies took.
+     * @param shard_num The shard to query
+     * @param args The arguments to the RPC function being invoked
+     * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
+     * of the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename... Args>
+    auto p2p_query_shard(uint32_t shard_num, Args&&... args) {
+        return p2p_query<tag>(group_rpc_manager.pick_shard_member(subgroup_id, shard_num), std::forward<Args>(args)...);
+    }
+
+    /**
+     * Sends a peer-to-peer query to the shard that holds a key, as
+     * p2p_query_shard does. The key's shard is its hash modulo the number of
+     * shards, so it must be hashed the same way it was when it was stored.
+     * @param key The key whose shard should answer the query
+     * @param args The arguments to the RPC function being invoked
+     * @tparam KeyHash The hash function object to use, std::hash by default
+     * @return An instance of rpc::QueryResults<Ret>, where Ret is the return type
+     * of the RPC function being invoked
+     */
+    template <rpc::FunctionTag tag, typename KeyType, typename KeyHash = std::hash<KeyType>, typename... Args>
+    auto p2p_query_by_key(const KeyType& key, Args&&... args) {
+        const uint32_t shard_num = KeyHash{}(key) % group_rpc_manager.get_num_shards(subgroup_id);
+        return p2p_query_shard<tag>(shard_num, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Sends an asynchronous peer-to-peer query to a single member of the
+     * subgroup that this ExternalCaller targets, invoking the RPC function identified
+     * by the FunctionTag template parameter. Instead of returning a
+     * QueryResults, this hands the reply to a callback, and never waits: if
+     * the P2P window to the node is full, nothing is sent and it returns
+     * false, so the caller can retry once earlier replies have arrived.
+     * @param dest_node The ID of the node that the P2P message should be sent to
+     * @param callback A callable that can be converted to an
+     * rpc::reply_callback_t<Ret>, where Ret is the return type of the RPC
+     * function being invoked; it is called on the P2P thread
+     * @param args The arguments to the RPC function being invoked
+     * @return true if the query was sent, false if the window was full
+     * @throws message_too_large_exception as p2p_query does; the query would
+     * never fit, so it isn't reported as a full window to retry on
+     */
+    template <rpc::FunctionTag tag, typename Callback, typename... Args>
+    bool p2p_query_async(node_id_t dest_node, Callback&& callback, Args&&... args) {
+        if(is_valid()) {
+            assert(dest_node != node_id);
+            //Ensure a view change isn't in progress
+            std::shared_lock<ViewLock> view_read_lock(group_rpc_manager.view_manager.view_mutex);
+            auto sent = wrapped_this->template send_async<tag>(
+                    [this, &dest_node](size_t size) -> char* {
+                        return (char*)group_rpc_manager.try_get_query_buffer_ptr(dest_node, size);
+                    },
+                    dest_node, std::forward<Callback>(callback), std::forward<Args>(args)...);
+            if(sent.size == 0) {
+                return false;
+            }
+            group_rpc_manager.finish_p2p_async_query(dest_node, sent.size, sent.replies);
+            return true;
+        } else {
+            throw derecho::empty_reference_exception{"Attempted to use an empty ExternalCaller<T>"};
+        }
+    }
 };
 
 template <typename T>
@@ -598,5 +1032,73 @@ public:
         }
         return query_result_vec;
     }
+
+    /**
+     * Queries every shard, one replica each, and passes each reply to
+     * reducer(shard_num, node_id, reply) on the calling thread as soon as it
+     * arrives, in whatever order the shards answer. All the queries are sent
+     * before any reply is waited for, so they are pipelined through the P2P
+     * windows instead of each waiting out the previous shard's round trip.
+     * @param shard_timeout How long to wait for each shard's reply after the
+     * queries are sent; a shard that has not replied by then is given up on
+     * @param reducer Called once for each shard that replied
+     * @return The numbers of the shards that did not reply in time, or whose
+     * replica failed before replying
+     */
+    template <rpc::FunctionTag tag, typename Reducer, typename... Args>
+    std::vector<uint32_t> scatter_query(std::chrono::nanoseconds shard_timeout, Reducer&& reducer, Args&&... args) {
+        auto query_result_vec = p2p_query<tag>(std::forward<Args>(args)...);
+        // Shards are queued here by the thread that receives their reply
+        struct replied_shards {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::vector<uint32_t> shards;
+        };
+        auto replied = std::make_shared<replied_shards>();
+        for(uint32_t shard = 0; shard < query_result_vec.size(); ++shard) {
+            auto on_reply = [replied, shard]() {
+                std::lock_guard<std::mutex> lock(replied->mutex);
+                replied->shards.push_back(shard);
+                replied->cv.notify_one();
+            };
+            if(!query_result_vec[shard].notifier->set_waiter(on_reply)) {
+                on_reply();
+            }
+        }
+        const auto deadline = std::chrono::steady_clock::now() + shard_timeout;
+        std::vector<bool> answered(query_result_vec.size(), false);
+        std::vector<uint32_t> failed_shards;
+        std::vector<uint32_t> to_reduce;
+        std::size_t num_answered = 0;
+        while(num_answered < query_result_vec.size()) {
+            to_reduce.clear();
+            {
+                std::unique_lock<std::mutex> lock(replied->mutex);
+                if(!replied->cv.wait_until(lock, deadline, [&]() { return !replied->shards.empty(); })) {
+                    break;
+                }
+                to_reduce.swap(replied->shards);
+            }
+            for(uint32_t shard : to_reduce) {
+                answered[shard] = true;
+                num_answered++;
+                const node_id_t node = shard_reps[shard];
+                std::optional<typename decltype(query_result_vec)::value_type::type> reply;
+                try {
+                    reply.emplace(query_result_vec[shard].get().get(node));
+                } catch(const std::exception&) {
+                    failed_shards.push_back(shard);
+                    continue;
+                }
+                reducer(shard, node, std::move(*reply));
+            }
+        }
+        for(uint32_t shard = 0; shard < answered.size(); ++shard) {
+            if(!answered[shard]) {
+                failed_shards.push_back(shard);
+            }
+        }
+        return failed_shards;
+    }
 };
 }  // namespace derecho
@@ -0,0 +1,359 @@
+/**
+ * @file replicated_kv_store.cpp
+ */
+
+#include "replicated_kv_store.h"
+
+#include <cstring>
+
+namespace derecho {
+
+namespace {
+/** 64-bit FNV-1a, which unlike std::hash is the same in every process */
+uint64_t hash_key(const std::string& key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(const char c : key) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+constexpr std::size_t initial_slots = 16;
+
+enum delta_op : uint8_t {
+    DELTA_REMOVE = 0,
+    DELTA_PUT = 1
+};
+
+/** Writes a size_t length followed by the bytes, and returns the size written */
+std::size_t write_bytes(char* v, const char* bytes, std::size_t length) {
+    memcpy(v, &length, sizeof(length));
+    if(length > 0) {
+        memcpy(v + sizeof(length), bytes, length);
+    }
+    return sizeof(length) + length;
+}
+
+/** Reads what write_bytes() wrote at v, and advances v past it */
+std::pair<const char*, std::size_t> read_bytes(const char*& v) {
+    std::size_t length;
+    memcpy(&length, v, sizeof(length));
+    const char* bytes = v + sizeof(length);
+    v = bytes + length;
+    return {bytes, length};
+}
+}  // namespace
+
+Blob::Blob(const char* data, std::size_t length) : length(length) {
+    if(length > 0) {
+        char* copy = new char[length];
+        memcpy(copy, data, length);
+        bytes.reset(copy);
+    }
+}
+
+Blob::Blob(const Blob& other) : Blob() {
+    if(other.borrowed) {
+        *this = Blob(other.data(), other.length);
+    } else {
+        bytes = other.bytes;
+        length = other.length;
+    }
+}
+
+Blob::Blob(Blob&& other) : Blob() {
+    if(other.borrowed) {
+        *this = Blob(other.data(), other.length);
+    } else {
+        bytes = std::move(other.bytes);
+        length = other.length;
+        other.length = 0;
+    }
+}
+
+Blob& Blob::operator=(Blob other) {
+    // other owns its bytes, since constructing it copied any borrowed ones
+    bytes = std::move(other.bytes);
+    length = other.length;
+    borrowed = false;
+    return *this;
+}
+
+std::size_t Blob::to_bytes(char* v) const {
+    return write_bytes(v, bytes.get(), length);
+}
+
+std::size_t Blob::bytes_size() const {
+    return sizeof(length) + length;
+}
+
+void Blob::post_object(const std::function<void(char const* const, std::size_t)>& f) const {
+    f((const char*)&length, sizeof(length));
+    f(bytes.get(), length);
+}
+
+std::unique_ptr<Blob> Blob::from_bytes(mutils::DeserializationManager*, const char* const v) {
+    const char* position = v;
+    auto [data, length] = read_bytes(position);
+    return std::make_unique<Blob>(data, length);
+}
+
+mutils::context_ptr<Blob> Blob::from_bytes_noalloc(mutils::DeserializationManager* dsm, const char* const v) {
+    DeserializationArena* arena = DeserializationArena::get(dsm);
+    if(!arena) {
+        return mutils::context_ptr<Blob>{from_bytes(dsm, v).release()};
+    }
+    const char* position = v;
+    auto [data, length] = read_bytes(position);
+    Blob* blob = new(arena->allocate(sizeof(Blob), alignof(Blob))) Blob();
+    arena->destroy_on_reset(blob);
+    // An empty owner makes the shared_ptr point at the buffer without freeing it
+    blob->bytes = std::shared_ptr<const char[]>(std::shared_ptr<const char[]>(), data);
+    blob->length = length;
+    blob->borrowed = true;
+    return mutils::context_ptr<Blob>{blob, mutils::ContextDeleter<Blob>{true}};
+}
+
+KVTable::KVTable() : slots(initial_slots) {}
+
+std::size_t KVTable::find_slot(const std::string& key) const {
+    const std::size_t mask = slots.size() - 1;
+    std::size_t index = hash_key(key) & mask;
+    // The first tombstone on the way is where the key would be put
+    std::optional<std::size_t> first_removed;
+    while(slots[index].state != slot_state::EMPTY) {
+        if(slots[index].state == slot_state::FULL && slots[index].key == key) {
+            return index;
+        }
+        if(slots[index].state == slot_state::REMOVED && !first_removed) {
+            first_removed = index;
+        }
+        index = (index + 1) & mask;
+    }
+    return first_removed ? *first_removed : index;
+}
+
+void KVTable::resize(std::size_t new_size) {
+    std::vector<slot> old_slots(new_size);
+    old_slots.swap(slots);
+    num_keys = 0;
+    num_removed = 0;
+    for(slot& old_slot : old_slots) {
+        if(old_slot.state == slot_state::FULL) {
+            put_unlogged(old_slot.key, std::move(old_slot.value));
+        }
+    }
+}
+
+bool KVTable::put_unlogged(const std::string& key, Blob value) {
+    // Keep at most 3/4 of the slots in use, counting tombstones, so probes
+    // stay short. If mostly tombstones fill them, rehashing drops those.
+    if(4 * (num_keys + num_removed + 1) > 3 * slots.size()) {
+        resize(2 * (num_keys + 1) > slots.size() ? 2 * slots.size() : slots.size());
+    }
+    slot& target = slots[find_slot(key)];
+    if(target.state == slot_state::FULL) {
+        target.value = std::move(value);
+        return false;
+    }
+    if(target.state == slot_state::REMOVED) {
+        num_removed--;
+    }
+    target.state = slot_state::FULL;
+    target.key = key;
+    target.value = std::move(value);
+    num_keys++;
+    return true;
+}
+
+bool KVTable::remove_unlogged(const std::string& key) {
+    slot& target = slots[find_slot(key)];
+    if(target.state != slot_state::FULL) {
+        return false;
+    }
+    target.state = slot_state::REMOVED;
+    target.key.clear();
+    target.value = Blob();
+    num_keys--;
+    num_removed++;
+    return true;
+}
+
+const Blob* KVTable::find(const std::string& key) const {
+    const slot& target = slots[find_slot(key)];
+    return target.state == slot_state::FULL ? &target.value : nullptr;
+}
+
+bool KVTable::put(const std::string& key, Blob value) {
+    pending_delta.emplace_back(key, value);
+    return put_unlogged(key, std::move(value));
+}
+
+bool KVTable::remove(const std::string& key) {
+    if(!remove_unlogged(key)) {
+        return false;
+    }
+    pending_delta.emplace_back(key, std::nullopt);
+    return true;
+}
+
+void KVTable::for_each(const std::function<void(const std::string&, const Blob&)>& f) const {
+    for(const slot& s : slots) {
+        if(s.state == slot_state::FULL) {
+            f(s.key, s.value);
+        }
+    }
+}
+
+void KVTable::finalizeCurrentDelta(const persistent::DeltaFinalizer& finalizer) {
+    if(pending_delta.empty()) {
+        return;
+    }
+    // A delta is the number of changes, then for each an op, the key, and for puts the value
+    std::size_t delta_size = sizeof(uint64_t);
+    for(const auto& [key, value] : pending_delta) {
+        delta_size += 1 + sizeof(std::size_t) + key.size();
+        if(value) {
+            delta_size += value->bytes_size();
+        }
+    }
+    std::unique_ptr<char[]> delta(new char[delta_size]);
+    const uint64_t num_changes = pending_delta.size();
+    memcpy(delta.get(), &num_changes, sizeof(num_changes));
+    char* position = delta.get() + sizeof(num_changes);
+    for(const auto& [key, value] : pending_delta) {
+        *position++ = value ? DELTA_PUT : DELTA_REMOVE;
+        position += write_bytes(position, key.data(), key.size());
+        if(value) {
+            position += value->to_bytes(position);
+        }
+    }
+    pending_delta.clear();
+    finalizer(delta.get(), delta_size);
+}
+
+void KVTable::applyDelta(char const* const delta) {
+    uint64_t num_changes;
+    memcpy(&num_changes, delta, sizeof(num_changes));
+    const char* position = delta + sizeof(num_changes);
+    for(uint64_t i = 0; i < num_changes; i++) {
+        const uint8_t op = *position++;
+        auto [key_bytes, key_length] = read_bytes(position);
+        std::string key(key_bytes, key_length);
+        if(op == DELTA_PUT) {
+            auto [value_bytes, value_length] = read_bytes(position);
+            put_unlogged(key, Blob(value_bytes, value_length));
+        } else {
+            remove_unlogged(key);
+        }
+    }
+}
+
+std::size_t KVTable::to_bytes(char* v) const {
+    const uint64_t count = num_keys;
+    memcpy(v, &count, sizeof(count));
+    std::size_t offset = sizeof(count);
+    for_each([&](const std::string& key, const Blob& value) {
+        offset += write_bytes(v + offset, key.data(), key.size());
+        offset += value.to_bytes(v + offset);
+    });
+    return offset;
+}
+
+std::size_t KVTable::bytes_size() const {
+    std::size_t size = sizeof(uint64_t);
+    for_each([&](const std::string& key, const Blob& value) {
+        size += sizeof(std::size_t) + key.size() + value.bytes_size();
+    });
+    return size;
+}
+
+void KVTable::post_object(const std::function<void(char const* const, std::size_t)>& f) const {
+    const uint64_t count = num_keys;
+    f((const char*)&count, sizeof(count));
+    for_each([&](const std::string& key, const Blob& value) {
+        const std::size_t key_length = key.size();
+        f((const char*)&key_length, sizeof(key_length));
+        f(key.data(), key_length);
+        value.post_object(f);
+    });
+}
+
+std::unique_ptr<KVTable> KVTable::from_bytes(mutils::DeserializationManager*, const char* const v) {
+    auto table = std::make_unique<KVTable>();
+    uint64_t count;
+    memcpy(&count, v, sizeof(count));
+    std::size_t num_slots = initial_slots;
+    while(4 * count > 3 * num_slots) {
+        num_slots *= 2;
+    }
+    table->resize(num_slots);
+    const char* position = v + sizeof(count);
+    for(uint64_t i = 0; i < count; i++) {
+        auto [key_bytes, key_length] = read_bytes(position);
+        auto [value_bytes, value_length] = read_bytes(position);
+        table->put_unlogged(std::string(key_bytes, key_length), Blob(value_bytes, value_length));
+    }
+    return table;
+}
+
+mutils::context_ptr<KVTable> KVTable::from_bytes_noalloc(mutils::DeserializationManager* dsm, const char* const v) {
+    return mutils::context_ptr<KVTable>{from_bytes(dsm, v).release()};
+}
+
+bool ReplicatedKVStore::put(const std::string& key, const ByteView& value) {
+    return table->put(key, Blob(value));
+}
+
+bool ReplicatedKVStore::remove(const std::string& key) {
+    return table->remove(key);
+}
+
+Blob ReplicatedKVStore::get(const std::string& key) {
+    const Blob* value = table->find(key);
+    return value ? *value : Blob();
+}
+
+bool ReplicatedKVStore::contains(const std::string& key) {
+    return table->find(key) != nullptr;
+}
+
+uint64_t ReplicatedKVStore::multi_put(const std::vector<std::string>& keys, const std::vector<ByteView>& values) {
+    if(keys.size() != values.size()) {
+        throw derecho_exception("multi_put needs a value for every key");
+    }
+    uint64_t new_keys = 0;
+    for(std::size_t i = 0; i < keys.size(); i++) {
+        if(table->put(keys[i], Blob(values[i]))) {
+            new_keys++;
+        }
+    }
+    return new_keys;
+}
+
+std::vector<Blob> ReplicatedKVStore::multi_get(const std::vector<std::string>& keys) {
+    std::vector<Blob> values;
+    values.reserve(keys.size());
+    for(const std::string& key : keys) {
+        values.emplace_back(get(key));
+    }
+    return values;
+}
+
+uint64_t ReplicatedKVStore::size() {
+    return table->size();
+}
+
+uint32_t ReplicatedKVStore::shard_of(const std::string& key, uint32_t num_shards) {
+    // Use the high bits, since the hash table indexes with the low ones
+    return static_cast<uint32_t>((hash_key(key) >> 32) % num_shards);
+}
+
+}  // namespace derecho
+
+void mutils::ContextDeleter<derecho::Blob>::operator()(derecho::Blob* blob) const {
+    if(!in_arena) {
+        delete blob;
+    }
+}
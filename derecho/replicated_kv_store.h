@@ -0,0 +1,201 @@
+/**
+ * @file replicated_kv_store.h
+ *
+ * A replicated, persistent key-value store with string keys and byte-array
+ * values, which can be used as the type of a subgroup.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "byte_view.h"
+#include "deserialization_arena.h"
+#include "register_rpc_functions.h"
+#include "replicated.h"
+#include "persistent/Persistent.hpp"
+#include <mutils-serialization/SerializationSupport.hpp>
+#include <mutils-serialization/context_ptr.hpp>
+
+namespace derecho {
+class Blob;
+}
+
+namespace mutils {
+/** A Blob deserialized into a DeserializationArena belongs to the arena */
+template <>
+struct ContextDeleter<derecho::Blob> {
+    bool in_arena = false;
+    void operator()(derecho::Blob* blob) const;
+};
+}  // namespace mutils
+
+namespace derecho {
+
+/**
+ * An immutable byte array whose copies share the bytes, so that a value can
+ * be stored, recorded in a delta, and returned from a get without being
+ * copied each time. It is serialized like a ByteView, as a size_t length
+ * followed by the bytes, so callers can send a ByteView where a Blob is
+ * expected.
+ *
+ * A Blob that is an argument of an RPC call points into the delivered
+ * message instead, as long as the handler runs; a copy of it that the
+ * handler makes, e.g. to store it, copies the bytes.
+ */
+class Blob : public mutils::ByteRepresentable {
+    std::shared_ptr<const char[]> bytes;
+    std::size_t length;
+    /** Whether bytes points into a message buffer rather than owning them */
+    bool borrowed = false;
+
+public:
+    Blob() : length(0) {}
+    /** Copies length bytes from data */
+    Blob(const char* data, std::size_t length);
+    explicit Blob(const ByteView& view) : Blob(view.data(), view.size()) {}
+    Blob(const Blob& other);
+    Blob(Blob&& other);
+    Blob& operator=(Blob other);
+
+    const char* data() const {
+        return bytes.get();
+    }
+    std::size_t size() const {
+        return length;
+    }
+    bool empty() const {
+        return length == 0;
+    }
+    /** A view of the bytes, which is valid as long as this Blob or a copy
+     * of it exists */
+    ByteView as_view() const {
+        return ByteView(bytes.get(), length);
+    }
+
+    std::size_t to_bytes(char* v) const;
+    std::size_t bytes_size() const;
+    void post_object(const std::function<void(char const* const, std::size_t)>& f) const;
+    void ensure_registered(mutils::DeserializationManager&) {}
+    /** Copies the bytes out of the buffer, since the Blob outlives it */
+    static std::unique_ptr<Blob> from_bytes(mutils::DeserializationManager*, const char* const v);
+    /** If dsm has a DeserializationArena, constructs the Blob there, pointing
+     * into the buffer; otherwise copies the bytes like from_bytes() */
+    static mutils::context_ptr<Blob> from_bytes_noalloc(mutils::DeserializationManager* dsm, const char* const v);
+};
+
+/**
+ * The state of a ReplicatedKVStore: an open-addressing hash table, with
+ * linear probing, from keys to Blobs. Removed keys leave a tombstone until
+ * the table is next resized. As a wrapped type of Persistent<T>, it logs
+ * each version as the keys put and removed since the previous one.
+ */
+class KVTable : public mutils::ByteRepresentable, public persistent::IDeltaSupport {
+    enum class slot_state : uint8_t {
+        EMPTY,
+        FULL,
+        REMOVED
+    };
+    struct slot {
+        slot_state state = slot_state::EMPTY;
+        std::string key;
+        Blob value;
+    };
+    /** The number of slots is always a power of 2 */
+    std::vector<slot> slots;
+    std::size_t num_keys = 0;
+    std::size_t num_removed = 0;
+    /** The puts (with a value) and removes (without one) since the last
+     * call to finalizeCurrentDelta(), in the order they happened */
+    std::vector<std::pair<std::string, std::optional<Blob>>> pending_delta;
+
+    /** The index of key's slot, or of the slot it would be put in */
+    std::size_t find_slot(const std::string& key) const;
+    /** Rehashes the keys into new_size slots, dropping the tombstones */
+    void resize(std::size_t new_size);
+    bool put_unlogged(const std::string& key, Blob value);
+    bool remove_unlogged(const std::string& key);
+
+public:
+    KVTable();
+
+    /** The value of key, or null if the table doesn't have the key. The
+     * pointer is valid until the table is next changed. */
+    const Blob* find(const std::string& key) const;
+    /** Stores value under key; returns true if the key is new */
+    bool put(const std::string& key, Blob value);
+    /** Removes key; returns false if the table didn't have it */
+    bool remove(const std::string& key);
+    std::size_t size() const {
+        return num_keys;
+    }
+    /** Calls f with each key and its value, in no particular order */
+    void for_each(const std::function<void(const std::string&, const Blob&)>& f) const;
+
+    void finalizeCurrentDelta(const persistent::DeltaFinalizer& finalizer) override;
+    void applyDelta(char const* const delta) override;
+
+    std::size_t to_bytes(char* v) const;
+    std::size_t bytes_size() const;
+    void post_object(const std::function<void(char const* const, std::size_t)>& f) const;
+    void ensure_registered(mutils::DeserializationManager&) {}
+    static std::unique_ptr<KVTable> from_bytes(mutils::DeserializationManager*, const char* const v);
+    static mutils::context_ptr<KVTable> from_bytes_noalloc(mutils::DeserializationManager*, const char* const v);
+};
+
+/**
+ * A key-value store that can be a subgroup type, replacing the ad-hoc maps
+ * of the examples. The updates (put, remove, multi_put) must be sent with
+ * ordered_send, and every update makes a version of the persistent table;
+ * the reads (get, contains, multi_get, size) don't change the state and can
+ * be sent with p2p_send to a single member.
+ *
+ * Values arrive as ByteViews, so a put copies the value out of the delivered
+ * message once, straight into the Blob it is stored as; a get serializes the
+ * stored Blob into the reply without another copy.
+ *
+ * To spread the keys over several shards, a client sends each key to shard
+ * shard_of(key, num_shards) of the subgroup.
+ */
+class ReplicatedKVStore : public mutils::ByteRepresentable, public PersistsFields {
+    persistent::Persistent<KVTable> table;
+
+public:
+    /** Stores value under key; returns true if the key is new */
+    bool put(const std::string& key, const ByteView& value);
+    /** Removes key; returns false if the store didn't have it */
+    bool remove(const std::string& key);
+    /** The value of key, or an empty Blob if the store doesn't have it */
+    Blob get(const std::string& key);
+    bool contains(const std::string& key);
+    /**
+     * Stores values[i] under keys[i] for every i, as one version.
+     * @return The number of keys that were new
+     */
+    uint64_t multi_put(const std::vector<std::string>& keys, const std::vector<ByteView>& values);
+    /** The values of keys, with an empty Blob for each key the store doesn't have */
+    std::vector<Blob> multi_get(const std::vector<std::string>& keys);
+    /** The number of keys in the store */
+    uint64_t size();
+
+    /** The shard that key belongs to if the store has num_shards shards.
+     * Every process computes the same shard for a key. */
+    static uint32_t shard_of(const std::string& key, uint32_t num_shards);
+
+    /** Constructor for the subgroup factory: [](PersistentRegistry* pr) {
+     * return std::make_unique<ReplicatedKVStore>(pr); } */
+    ReplicatedKVStore(persistent::PersistentRegistry* pr) : table(nullptr, pr) {}
+    /** Constructor for deserialization */
+    ReplicatedKVStore(persistent::Persistent<KVTable>& table) : table(std::move(table)) {}
+
+    DEFAULT_SERIALIZATION_SUPPORT(ReplicatedKVStore, table);
+    REGISTER_RPC_FUNCTIONS(ReplicatedKVStore, put, remove, get, contains, multi_put, multi_get, size);
+};
+
+}  // namespace derecho
@@ -1,4 +1,6 @@
+#include <list>
 #include <optional>
+#include <thread>
 
 #include "container_template_functions.h"
 #include "restart_state.h"
@@ -14,6 +16,7 @@ void RestartState::load_ragged_trim(const View& curr_view) {
     /* Iterate through all subgroups by type, rather than iterating through my_subgroups,
      * so that I have access to the type_index. This wastes time, but I don't have a map
      * from subgroup ID to type_index within curr_view. */
+    std::unique_ptr<RaggedTrimLog> trim_log = persistent::loadObject<RaggedTrimLog>(ragged_trim_log_name);
     for(const auto& type_and_indices : curr_view.subgroup_ids_by_type) {
         for(uint32_t subgroup_index = 0; subgroup_index < type_and_indices.second.size(); ++subgroup_index) {
             subgroup_id_t subgroup_id = type_and_indices.second.at(subgroup_index);
@@ -22,7 +25,14 @@ void RestartState::load_ragged_trim(const View& curr_view) {
             if(subgroup_shard_ptr != curr_view.my_subgroups.end()) {
                 //If the subgroup ID is in my_subgroups, its value is this node's shard number
                 uint32_t shard_num = subgroup_shard_ptr->second;
-                std::unique_ptr<RaggedTrim> ragged_trim = persistent::loadObject<RaggedTrim>(ragged_trim_filename(subgroup_id, shard_num).c_str());
+                std::unique_ptr<RaggedTrim> ragged_trim;
+                if(trim_log) {
+                    for(const RaggedTrim& logged_trim : trim_log->trims) {
+                        if(logged_trim.subgroup_id == subgroup_id && logged_trim.shard_num == shard_num) {
+                            ragged_trim = std::make_unique<RaggedTrim>(logged_trim);
+                        }
+                    }
+                }
                 //If there was a logged ragged trim from an obsolete View, it's the same as not having a logged ragged trim
                 if(ragged_trim == nullptr || ragged_trim->vid < curr_view.vid) {
                     whenlog(logger->debug("No ragged trim information found for subgroup {}, synthesizing it from logs", subgroup_id););
@@ -102,65 +112,122 @@ RestartLeaderState::RestartLeaderState(std::unique_ptr<View> _curr_view, Restart
 }
 
 void RestartLeaderState::await_quorum(tcp::connection_listener& server_socket) {
-    bool ready_to_restart = false;
+    {
+        std::lock_guard<std::mutex> lock(joiners_mutex);
+        ready_to_restart = false;
+        quorum_start_time = std::chrono::steady_clock::now();
+    }
+    std::list<std::thread> joiner_threads;
     int time_remaining_ms = RESTART_LEADER_TIMEOUT;
-    while(time_remaining_ms > 0) {
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(joiners_mutex);
+            //If all the members have rejoined, no need to keep waiting
+            if(ready_to_restart && progress.last_view_members_rejoined == last_known_view_members.size()) {
+                break;
+            }
+            if(time_remaining_ms <= 0) {
+                if(ready_to_restart) {
+                    break;
+                }
+                //Accept timed out, but we haven't heard from enough nodes yet, so reset the timer
+                time_remaining_ms = RESTART_LEADER_TIMEOUT;
+            }
+        }
+        //Wake up now and then, since the last node's logs may finish arriving at any time
         auto start_time = std::chrono::high_resolution_clock::now();
-        std::optional<tcp::socket> client_socket = server_socket.try_accept(time_remaining_ms);
+        std::optional<tcp::socket> client_socket = server_socket.try_accept(
+                std::min(time_remaining_ms, RESTART_QUORUM_CHECK_INTERVAL));
         auto end_time = std::chrono::high_resolution_clock::now();
         std::chrono::milliseconds time_waited = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
         time_remaining_ms -= time_waited.count();
         if(client_socket) {
-            node_id_t joiner_id = 0;
-            client_socket->read(joiner_id);
-            client_socket->write(JoinResponse{JoinResponseCode::TOTAL_RESTART, my_id});
-            whenlog(logger->debug("Node {} rejoined", joiner_id););
-            rejoined_node_ids.emplace(joiner_id);
-
-            //Receive and process the joining node's logs of the last known View and RaggedTrim
-            receive_joiner_logs(joiner_id, *client_socket);
-
-            //Receive the joining node's ports - this is part of the standard join logic
-            uint16_t joiner_gms_port = 0;
-            client_socket->read(joiner_gms_port);
-            uint16_t joiner_rpc_port = 0;
-            client_socket->read(joiner_rpc_port);
-            uint16_t joiner_sst_port = 0;
-            client_socket->read(joiner_sst_port);
-            uint16_t joiner_rdmc_port = 0;
-            client_socket->read(joiner_rdmc_port);
-            const ip_addr_t& joiner_ip = client_socket->get_remote_ip();
-            rejoined_node_ips_and_ports[joiner_id] = {joiner_ip, joiner_gms_port, joiner_rpc_port, joiner_sst_port, joiner_rdmc_port};
-            //Done receiving from this socket (for now), so store it in waiting_join_sockets for later
-            waiting_join_sockets.emplace(joiner_id, std::move(*client_socket));
-            //Compute the intersection of rejoined_node_ids and last_known_view_members
-            //in the most clumsy, verbose, awkward way possible
-            std::set<node_id_t> intersection_of_ids;
-            std::set_intersection(rejoined_node_ids.begin(), rejoined_node_ids.end(),
-                                  last_known_view_members.begin(), last_known_view_members.end(),
-                                  std::inserter(intersection_of_ids, intersection_of_ids.end()));
-            if(intersection_of_ids.size() >= (last_known_view_members.size() / 2) + 1) {
-                ready_to_restart = compute_restart_view();
-            }
-            //If all the members have rejoined, no need to keep waiting
-            if(intersection_of_ids.size() == last_known_view_members.size() && ready_to_restart) {
-                return;
-            }
-        } else if(!ready_to_restart) {
-            //Accept timed out, but we haven't heard from enough nodes yet, so reset the timer
-            time_remaining_ms = RESTART_LEADER_TIMEOUT;
+            joiner_threads.emplace_back(&RestartLeaderState::receive_joiner, this, std::move(*client_socket));
         }
     }
+    //Nodes still sending their logs are part of this quorum too
+    for(auto& joiner_thread : joiner_threads) {
+        joiner_thread.join();
+    }
+    whenlog(RestartProgress final_progress = get_progress(););
+    whenlog(logger->debug("Received logs from {} nodes ({} bytes) in {} ms",
+                          final_progress.nodes_rejoined, final_progress.log_bytes_received, final_progress.elapsed_ms););
 }
 
-void RestartLeaderState::receive_joiner_logs(const node_id_t& joiner_id, tcp::socket& client_socket) {
+RestartProgress RestartLeaderState::get_progress() const {
+    std::lock_guard<std::mutex> lock(joiners_mutex);
+    RestartProgress snapshot = progress;
+    snapshot.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::steady_clock::now() - quorum_start_time)
+                                  .count();
+    return snapshot;
+}
+
+void RestartLeaderState::receive_joiner(tcp::socket client_socket) {
+    node_id_t joiner_id = 0;
+    client_socket.read(joiner_id);
+    client_socket.write(JoinResponse{JoinResponseCode::TOTAL_RESTART, my_id});
+    whenlog(logger->debug("Node {} rejoined", joiner_id););
+
     //Receive the joining node's saved View
+    uint64_t bytes_received = 0;
     std::size_t size_of_view;
     client_socket.read(size_of_view);
     char view_buffer[size_of_view];
     client_socket.read(view_buffer, size_of_view);
-    auto client_view = mutils::from_bytes<View>(nullptr, view_buffer);
+    std::unique_ptr<View> client_view = mutils::from_bytes<View>(nullptr, view_buffer);
+    bytes_received += size_of_view;
+    //Receive the joining node's RaggedTrims
+    std::size_t num_of_ragged_trims;
+    client_socket.read(num_of_ragged_trims);
+    std::vector<std::unique_ptr<RaggedTrim>> ragged_trims;
+    for(std::size_t i = 0; i < num_of_ragged_trims; ++i) {
+        std::size_t size_of_ragged_trim;
+        client_socket.read(size_of_ragged_trim);
+        char buffer[size_of_ragged_trim];
+        client_socket.read(buffer, size_of_ragged_trim);
+        ragged_trims.emplace_back(mutils::from_bytes<RaggedTrim>(nullptr, buffer));
+        bytes_received += size_of_ragged_trim;
+    }
+
+    //Receive the joining node's ports - this is part of the standard join logic
+    uint16_t joiner_gms_port = 0;
+    client_socket.read(joiner_gms_port);
+    uint16_t joiner_rpc_port = 0;
+    client_socket.read(joiner_rpc_port);
+    uint16_t joiner_sst_port = 0;
+    client_socket.read(joiner_sst_port);
+    uint16_t joiner_rdmc_port = 0;
+    client_socket.read(joiner_rdmc_port);
+    const ip_addr_t& joiner_ip = client_socket.get_remote_ip();
 
+    std::lock_guard<std::mutex> lock(joiners_mutex);
+    rejoined_node_ids.emplace(joiner_id);
+    //Process the joining node's logs of the last known View and RaggedTrim
+    merge_joiner_logs(joiner_id, std::move(client_view), std::move(ragged_trims));
+    rejoined_node_ips_and_ports[joiner_id] = {joiner_ip, joiner_gms_port, joiner_rpc_port, joiner_sst_port, joiner_rdmc_port};
+    //Done receiving from this socket (for now), so store it in waiting_join_sockets for later
+    waiting_join_sockets.emplace(joiner_id, std::move(client_socket));
+    //Compute the intersection of rejoined_node_ids and last_known_view_members
+    //in the most clumsy, verbose, awkward way possible
+    std::set<node_id_t> intersection_of_ids;
+    std::set_intersection(rejoined_node_ids.begin(), rejoined_node_ids.end(),
+                          last_known_view_members.begin(), last_known_view_members.end(),
+                          std::inserter(intersection_of_ids, intersection_of_ids.end()));
+    if(intersection_of_ids.size() >= (last_known_view_members.size() / 2) + 1) {
+        ready_to_restart = compute_restart_view();
+    }
+    progress.nodes_rejoined++;
+    progress.last_view_members_rejoined = intersection_of_ids.size();
+    progress.last_view_size = last_known_view_members.size();
+    progress.log_bytes_received += bytes_received;
+    progress.quorum_reached = ready_to_restart;
+    whenlog(logger->info("Restart progress: {} of {} members of view {} have rejoined", progress.last_view_members_rejoined,
+                         progress.last_view_size, curr_view->vid););
+}
+
+void RestartLeaderState::merge_joiner_logs(const node_id_t& joiner_id, std::unique_ptr<View> client_view,
+                                           std::vector<std::unique_ptr<RaggedTrim>> ragged_trims) {
     if(client_view->vid > curr_view->vid) {
         whenlog(logger->trace("Node {} had newer view {}, replacing view {} and discarding ragged trim", joiner_id, client_view->vid, curr_view->vid););
         //The joining node has a newer View, so discard any ragged trims that are not longest-log records
@@ -175,15 +242,7 @@ void RestartLeaderState::receive_joiner_logs(const node_id_t& joiner_id, tcp::so
             }
         }
     }
-    //Receive the joining node's RaggedTrims
-    std::size_t num_of_ragged_trims;
-    client_socket.read(num_of_ragged_trims);
-    for(std::size_t i = 0; i < num_of_ragged_trims; ++i) {
-        std::size_t size_of_ragged_trim;
-        client_socket.read(size_of_ragged_trim);
-        char buffer[size_of_ragged_trim];
-        client_socket.read(buffer, size_of_ragged_trim);
-        std::unique_ptr<RaggedTrim> ragged_trim = mutils::from_bytes<RaggedTrim>(nullptr, buffer);
+    for(std::unique_ptr<RaggedTrim>& ragged_trim : ragged_trims) {
         whenlog(logger->trace("Received ragged trim for subgroup {}, shard {} from node {}", ragged_trim->subgroup_id, ragged_trim->shard_num, joiner_id););
         /* If the joining node has an obsolete View, we only care about the
          * "ragged trims" if they are actually longest-log records and from
@@ -226,7 +285,25 @@ void RestartLeaderState::receive_joiner_logs(const node_id_t& joiner_id, tcp::so
 
 bool RestartLeaderState::compute_restart_view() {
     restart_view = update_curr_and_next_restart_view();
-    restart_num_received_size = ViewManager::make_subgroup_maps(subgroup_info, curr_view, *restart_view, restart_subgroup_settings);
+    if(can_reuse_layout()) {
+        /* Every member of the last known View came back, and no other node did,
+         * so the layout that was logged with that View still holds. Copy it
+         * instead of running the membership functions again. */
+        whenlog(logger->debug("All members of view {} rejoined, reusing its subgroup layout", curr_view->vid););
+        restart_view->subgroup_ids_by_type = curr_view->subgroup_ids_by_type;
+        restart_view->subgroup_shard_views = curr_view->subgroup_shard_views;
+        restart_view->previous_layouts = ViewManager::layouts_by_type(*curr_view);
+        for(auto& shard_views : restart_view->subgroup_shard_views) {
+            for(SubView& shard_view : shard_views) {
+                shard_view.joined.clear();
+                shard_view.departed.clear();
+            }
+        }
+        restart_subgroup_settings.clear();
+        restart_num_received_size = ViewManager::derive_subgroup_settings(*restart_view, restart_subgroup_settings);
+    } else {
+        restart_num_received_size = ViewManager::make_subgroup_maps(subgroup_info, curr_view, *restart_view, restart_subgroup_settings);
+    }
     if(restart_view->is_adequately_provisioned
        && contains_at_least_one_member_per_subgroup(rejoined_node_ids, *curr_view)) {
         return true;
@@ -237,6 +314,12 @@ bool RestartLeaderState::compute_restart_view() {
     }
 }
 
+bool RestartLeaderState::can_reuse_layout() const {
+    return curr_view->is_adequately_provisioned
+           && !curr_view->subgroup_shard_views.empty()
+           && restart_view->members == curr_view->members;
+}
+
 int64_t RestartLeaderState::send_restart_view(const DerechoParams& derecho_params) {
     for(auto waiting_sockets_iter = waiting_join_sockets.begin();
         waiting_sockets_iter != waiting_join_sockets.end();) {
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -33,13 +35,18 @@ struct RaggedTrim : public mutils::ByteRepresentable {
 };
 
 /**
- * Builds a filename to use for a RaggedTrim logged to disk using its subgroup and shard IDs.
+ * The RaggedTrims a node decided in one view change, for all of its subgroups,
+ * which are logged to disk together in a single file named ragged_trim_log_name
+ * rather than in a file per subgroup, so a view change writes one file.
  */
-inline std::string ragged_trim_filename(subgroup_id_t subgroup_num, uint32_t shard_num) {
-    std::ostringstream string_builder;
-    string_builder << "RaggedTrim_" << subgroup_num << "_" << shard_num;
-    return string_builder.str();
-}
+struct RaggedTrimLog : public mutils::ByteRepresentable {
+    std::vector<RaggedTrim> trims;
+    RaggedTrimLog(std::vector<RaggedTrim> trims) : trims(std::move(trims)) {}
+    DEFAULT_SERIALIZATION_SUPPORT(RaggedTrimLog, trims);
+};
+
+/** The name of the file the RaggedTrimLog is logged to */
+inline const char* ragged_trim_log_name = "RaggedTrims";
 
 /** List of logged ragged trim states, indexed by (subgroup ID, shard num), stored by pointer */
 using ragged_trim_map_t = std::map<subgroup_id_t, std::map<uint32_t, std::unique_ptr<RaggedTrim>>>;
@@ -67,6 +74,27 @@ struct RestartState {
                                                                const std::vector<int32_t>& max_received_by_sender);
 };
 
+/**
+ * How far the restart leader has got in gathering the logs of restarting
+ * nodes, for watching a slow total restart.
+ */
+struct RestartProgress {
+    /** The number of nodes that have rejoined and sent their logs, not
+     * counting the leader */
+    uint32_t nodes_rejoined = 0;
+    /** The number of members of the last known View that have rejoined,
+     * counting the leader */
+    uint32_t last_view_members_rejoined = 0;
+    /** The number of members of the last known View */
+    uint32_t last_view_size = 0;
+    /** The bytes of logged Views and RaggedTrims received */
+    uint64_t log_bytes_received = 0;
+    /** Whether the rejoined nodes are enough for an adequate restart view */
+    bool quorum_reached = false;
+    /** Milliseconds since await_quorum started */
+    int64_t elapsed_ms = 0;
+};
+
 class RestartLeaderState {
 private:
     whenlog(std::shared_ptr<spdlog::logger> logger;);
@@ -91,17 +119,44 @@ private:
     std::vector<std::vector<int64_t>> nodes_with_longest_log;
     const node_id_t my_id;
 
+    /** Guards the state above while await_quorum's threads receive logs
+     * from several rejoining nodes at once, as well as the fields below */
+    mutable std::mutex joiners_mutex;
+    bool ready_to_restart = false;
+    RestartProgress progress;
+    std::chrono::steady_clock::time_point quorum_start_time;
+
     /**
-     * Helper method for await_quorum that processes the logged View and
+     * Helper method for await_quorum that runs on a thread of its own for
+     * each rejoining node: receives the node's logged View, RaggedTrims and
+     * ports, then merges them into the restart state and checks for a quorum.
+     * @param client_socket The TCP socket connected to the rejoining node
+     */
+    void receive_joiner(tcp::socket client_socket);
+    /**
+     * Helper method for receive_joiner that processes the logged View and
      * RaggedTrims from a single rejoining node. This may update curr_view or
-     * logged_ragged_trim if the joiner has newer information.
+     * logged_ragged_trim if the joiner has newer information. Must be called
+     * with joiners_mutex held.
      * @param joiner_id The ID of the rejoining node
-     * @param client_socket The TCP socket connected to the rejoining node
+     * @param client_view The joiner's last known View
+     * @param ragged_trims The joiner's logged RaggedTrims
+     */
+    void merge_joiner_logs(const node_id_t& joiner_id, std::unique_ptr<View> client_view,
+                           std::vector<std::unique_ptr<RaggedTrim>> ragged_trims);
+    /**
+     * Helper method for compute_restart_view: whether restart_view has
+     * exactly the members of curr_view, so that the subgroup layout logged
+     * with curr_view can be used for it as-is, without calling the subgroup
+     * membership functions.
      */
-    void receive_joiner_logs(const node_id_t& joiner_id, tcp::socket& client_socket);
+    bool can_reuse_layout() const;
 
 public:
     static const int RESTART_LEADER_TIMEOUT = 300000;
+    /** How often await_quorum stops waiting for connections to check whether
+     * the rejoined nodes are already enough, in milliseconds */
+    static constexpr int RESTART_QUORUM_CHECK_INTERVAL = 100;
     RestartLeaderState(std::unique_ptr<View> _curr_view, RestartState& restart_state,
                        std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings_map,
                        uint32_t& num_received_size,
@@ -111,10 +166,13 @@ public:
      * Waits for nodes to rejoin at this node, updating the last known View and
      * RaggedTrim (and corresponding longest-log information) as each node connects,
      * until there is a quorum of nodes from the last known View and a new View
-     * can be installed that is adequately provisioned.
+     * can be installed that is adequately provisioned. Each node's logs are
+     * received on a thread of its own, so they arrive concurrently.
      * @param server_socket The TCP socket to listen for rejoining nodes on
      */
     void await_quorum(tcp::connection_listener& server_socket);
+    /** @return A snapshot of how far await_quorum has got */
+    RestartProgress get_progress() const;
     /**
      * Recomputes the restart view based on the current set of nodes that have
      * rejoined (in waiting_join_sockets and rejoined_node_ids).
@@ -0,0 +1,170 @@
+/**
+ * @file row_min.cpp
+ */
+
+#include "row_min.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace derecho {
+
+namespace {
+
+template <typename T>
+const volatile T& entry_at(const volatile T* column, uint32_t row_offset) {
+    return *reinterpret_cast<const volatile T*>(reinterpret_cast<const volatile char*>(column) + row_offset);
+}
+
+template <typename T>
+T min_over_rows_scalar(const volatile T* column, const uint32_t* row_offsets, std::size_t num_rows) {
+    T min = std::numeric_limits<T>::max();
+    for(std::size_t i = 0; i < num_rows; ++i) {
+        min = std::min(min, static_cast<T>(entry_at(column, row_offsets[i])));
+    }
+    return min;
+}
+
+int32_t min_of_scalar(const volatile int32_t* values, std::size_t count) {
+    int32_t min = std::numeric_limits<int32_t>::max();
+    for(std::size_t i = 0; i < count; ++i) {
+        min = std::min(min, static_cast<int32_t>(values[i]));
+    }
+    return min;
+}
+
+#if defined(__x86_64__)
+
+// The vector loads take one snapshot of the entries, just as the volatile
+// reads of the scalar loops do, so dropping the qualifier changes nothing.
+
+__attribute__((target("avx2"))) int32_t min_of_lanes_avx2(__m256i mins) {
+    __m128i m = _mm_min_epi32(_mm256_castsi256_si128(mins), _mm256_extracti128_si256(mins, 1));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(m);
+}
+
+__attribute__((target("avx2"))) int32_t min_over_rows_avx2(const volatile int32_t* column,
+                                                           const uint32_t* row_offsets, std::size_t num_rows) {
+    const int* base = const_cast<const int*>(column);
+    __m256i mins = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+    std::size_t i = 0;
+    for(; i + 8 <= num_rows; i += 8) {
+        const __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_offsets + i));
+        mins = _mm256_min_epi32(mins, _mm256_i32gather_epi32(base, offsets, 1));
+    }
+    return std::min(min_of_lanes_avx2(mins), min_over_rows_scalar(column, row_offsets + i, num_rows - i));
+}
+
+__attribute__((target("avx2"))) int32_t min_of_avx2(const volatile int32_t* values, std::size_t count) {
+    const int32_t* start = const_cast<const int32_t*>(values);
+    __m256i mins = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        mins = _mm256_min_epi32(mins, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(start + i)));
+    }
+    return std::min(min_of_lanes_avx2(mins), min_of_scalar(values + i, count - i));
+}
+
+// GCC's AVX-512 intrinsics start from deliberately undefined vectors, which
+// -Wall reports as uninitialized once they are inlined here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) int32_t min_over_rows_avx512(const volatile int32_t* column,
+                                                                const uint32_t* row_offsets, std::size_t num_rows) {
+    const int* base = const_cast<const int*>(column);
+    __m512i mins = _mm512_set1_epi32(std::numeric_limits<int32_t>::max());
+    std::size_t i = 0;
+    for(; i + 16 <= num_rows; i += 16) {
+        const __m512i offsets = _mm512_loadu_si512(row_offsets + i);
+        mins = _mm512_min_epi32(mins, _mm512_i32gather_epi32(offsets, base, 1));
+    }
+    return std::min(_mm512_reduce_min_epi32(mins), min_over_rows_scalar(column, row_offsets + i, num_rows - i));
+}
+
+// AVX2 has no 64-bit min, so 64-bit columns are only vectorized with AVX-512
+__attribute__((target("avx512f"))) uint64_t min_over_rows_avx512(const volatile uint64_t* column,
+                                                                 const uint32_t* row_offsets, std::size_t num_rows) {
+    const long long* base = const_cast<const long long*>(reinterpret_cast<const volatile long long*>(column));
+    __m512i mins = _mm512_set1_epi64(-1);
+    std::size_t i = 0;
+    for(; i + 8 <= num_rows; i += 8) {
+        const __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_offsets + i));
+        mins = _mm512_min_epu64(mins, _mm512_i32gather_epi64(offsets, base, 1));
+    }
+    return std::min(static_cast<uint64_t>(_mm512_reduce_min_epu64(mins)),
+                    min_over_rows_scalar(column, row_offsets + i, num_rows - i));
+}
+
+__attribute__((target("avx512f"))) int64_t min_over_rows_avx512(const volatile int64_t* column,
+                                                                const uint32_t* row_offsets, std::size_t num_rows) {
+    const long long* base = const_cast<const long long*>(reinterpret_cast<const volatile long long*>(column));
+    __m512i mins = _mm512_set1_epi64(std::numeric_limits<int64_t>::max());
+    std::size_t i = 0;
+    for(; i + 8 <= num_rows; i += 8) {
+        const __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_offsets + i));
+        mins = _mm512_min_epi64(mins, _mm512_i32gather_epi64(offsets, base, 1));
+    }
+    return std::min(static_cast<int64_t>(_mm512_reduce_min_epi64(mins)),
+                    min_over_rows_scalar(column, row_offsets + i, num_rows - i));
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+using RowMinInt32 = int32_t (*)(const volatile int32_t*, const uint32_t*, std::size_t);
+using RowMinUInt64 = uint64_t (*)(const volatile uint64_t*, const uint32_t*, std::size_t);
+using RowMinInt64 = int64_t (*)(const volatile int64_t*, const uint32_t*, std::size_t);
+using MinOfInt32 = int32_t (*)(const volatile int32_t*, std::size_t);
+
+struct MinKernels {
+    RowMinInt32 row_min_int32 = min_over_rows_scalar<int32_t>;
+    RowMinUInt64 row_min_uint64 = min_over_rows_scalar<uint64_t>;
+    RowMinInt64 row_min_int64 = min_over_rows_scalar<int64_t>;
+    MinOfInt32 min_of_int32 = min_of_scalar;
+
+    MinKernels() {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            row_min_int32 = min_over_rows_avx2;
+            min_of_int32 = min_of_avx2;
+        }
+        if(__builtin_cpu_supports("avx512f")) {
+            row_min_int32 = min_over_rows_avx512;
+            row_min_uint64 = min_over_rows_avx512;
+            row_min_int64 = min_over_rows_avx512;
+        }
+#endif
+    }
+};
+
+const MinKernels kernels;
+
+}  // namespace
+
+int32_t min_over_rows(const volatile int32_t* column, const std::vector<uint32_t>& row_offsets) {
+    return kernels.row_min_int32(column, row_offsets.data(), row_offsets.size());
+}
+
+uint64_t min_over_rows(const volatile uint64_t* column, const std::vector<uint32_t>& row_offsets) {
+    return kernels.row_min_uint64(column, row_offsets.data(), row_offsets.size());
+}
+
+int64_t min_over_rows(const volatile int64_t* column, const std::vector<uint32_t>& row_offsets) {
+    return kernels.row_min_int64(column, row_offsets.data(), row_offsets.size());
+}
+
+int32_t min_of(const volatile int32_t* values, std::size_t count) {
+    return kernels.min_of_int32(values, count);
+}
+
+}  // namespace derecho
@@ -0,0 +1,44 @@
+/**
+ * @file row_min.h
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace derecho {
+
+/*
+ * Minimum reductions over SST columns, for the predicates that scan a whole
+ * shard (or a whole row of per-sender counters) every time they run. Each
+ * one is vectorized with AVX-512 or AVX2 when the CPU has it, which is
+ * checked once at startup, and is a plain loop otherwise.
+ *
+ * A column is read through a pointer to its entry in row 0 and the byte
+ * offset of each row from row 0, which is the same for every SST field.
+ */
+
+/**
+ * @param column The address of the column's entry in row 0
+ * @param row_offsets The byte offset of each row to read from row 0; must
+ * not be empty
+ * @return The smallest entry of the column among those rows
+ */
+int32_t min_over_rows(const volatile int32_t* column, const std::vector<uint32_t>& row_offsets);
+
+/** Same as above, for a column of unsigned 64-bit entries */
+uint64_t min_over_rows(const volatile uint64_t* column, const std::vector<uint32_t>& row_offsets);
+
+/** Same as above, for a column of signed 64-bit entries, such as versions */
+int64_t min_over_rows(const volatile int64_t* column, const std::vector<uint32_t>& row_offsets);
+
+/**
+ * @param values The start of a run of contiguous entries in one row
+ * @param count The number of entries; must not be 0
+ * @return The smallest of the entries
+ */
+int32_t min_of(const volatile int32_t* values, std::size_t count);
+
+}  // namespace derecho
@@ -0,0 +1,86 @@
+/**
+ * @file rpc_awaitable.h
+ *
+ * Lets C++20 coroutines co_await the results of ordered_query and p2p_query.
+ * With an older standard this header declares nothing.
+ */
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <functional>
+
+#include "rpc_utils.h"
+
+namespace derecho {
+
+namespace rpc {
+
+/**
+ * Resumes a coroutine whose replies are in. It is called on the thread that
+ * received the last reply, which is one of Derecho's threads, so an executor
+ * should normally hand the coroutine to threads of its own, e.g. by pushing
+ * it on a queue they serve.
+ */
+using coroutine_executor_t = std::function<void(std::coroutine_handle<>)>;
+
+/**
+ * Awaits every reply of a QueryResults, then gives its ReplyMap, whose
+ * futures are all ready by then. No thread is blocked in the meantime.
+ * @tparam Ret The return type of the RPC function
+ */
+template <typename Ret>
+class QueryResultsAwaiter {
+    QueryResults<Ret>& results;
+    coroutine_executor_t executor;
+
+public:
+    QueryResultsAwaiter(QueryResults<Ret>& results, coroutine_executor_t executor)
+            : results(results), executor(std::move(executor)) {}
+
+    bool await_ready() {
+        return results.notifier->ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        // if the last reply came in meanwhile, don't suspend at all
+        return results.notifier->set_waiter([handle, this]() {
+            if(executor) {
+                executor(handle);
+            } else {
+                handle.resume();
+            }
+        });
+    }
+
+    typename QueryResults<Ret>::ReplyMap& await_resume() {
+        return results.get();
+    }
+};
+
+/**
+ * Awaits the replies of a query and resumes through an executor:
+ *     auto& replies = co_await resume_on(results, executor);
+ * The QueryResults must stay in scope until then.
+ */
+template <typename Ret>
+QueryResultsAwaiter<Ret> resume_on(QueryResults<Ret>& results, coroutine_executor_t executor) {
+    return QueryResultsAwaiter<Ret>(results, std::move(executor));
+}
+
+/**
+ * Awaits the replies of a query, resuming on the thread that received the
+ * last one:
+ *     auto& replies = co_await results;
+ */
+template <typename Ret>
+QueryResultsAwaiter<Ret> operator co_await(QueryResults<Ret>& results) {
+    return QueryResultsAwaiter<Ret>(results, nullptr);
+}
+
+}  // namespace rpc
+}  // namespace derecho
+
+#endif
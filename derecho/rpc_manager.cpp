@@ -4,20 +4,61 @@
  * @date Feb 7, 2017
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <set>
 
+#include "derecho_exception.h"
+#include "derecho_log.h"
+#include "deserialization_arena.h"
 #include "rpc_manager.h"
+#include "conf/affinity.hpp"
 
 namespace derecho {
 
 namespace rpc {
 
+/** The P2P send or query of this thread that is too large for a P2P slot,
+ * between get_sendbuffer_ptr and finish_p2p_send */
+static thread_local std::vector<char> large_request_buffer;
+
+/** The body of this thread's targeted send, behind the room for its
+ * TARGETED_SEND_BODY header and id, between get_targeted_body_buffer and
+ * send_targeted_body */
+static thread_local std::vector<char> targeted_body_buffer;
+
+void RPCManager::register_metrics() {
+    MetricsRegistry& registry = MetricsRegistry::get();
+    p2p_sends_by_kind[false] = &registry.counter("derecho_p2p_messages_sent_total", "P2P messages sent", "kind=\"send\"");
+    p2p_sends_by_kind[true] = &registry.counter("derecho_p2p_messages_sent_total", "P2P messages sent", "kind=\"query\"");
+    p2p_sent_bytes = &registry.counter("derecho_p2p_sent_bytes_total", "Bytes of the P2P messages sent");
+    p2p_window_reader_id = registry.add_reader(
+            "derecho_p2p_queries_outstanding", "P2P queries sent that have no reply yet, over all members",
+            MetricType::GAUGE, "", [this]() {
+                std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
+                return static_cast<double>(connections->get_num_outstanding_queries());
+            });
+}
+
 RPCManager::~RPCManager() {
+    MetricsRegistry::get().remove_reader(p2p_window_reader_id);
     thread_shutdown = true;
     if(rpc_thread.joinable()) {
         rpc_thread.join();
     }
+    if(external_client_thread.joinable()) {
+        external_client_thread.join();
+    }
+    for(auto& worker : p2p_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->queue_mutex);
+        }
+        worker->queue_cv.notify_all();
+        worker->thread.join();
+    }
 }
 
 void RPCManager::start_listening() {
@@ -36,10 +77,23 @@ std::exception_ptr RPCManager::receive_message(
     // whenlog(logger->trace("Received an RPC message from {} with opcode: {{ class_id=typeinfo for {}, subgroup_id={}, function_id={}, is_reply={} }}, invocation id: {}",)
     //               received_from, indx.class_id.name(), indx.subgroup_id, indx.function_id, indx.is_reply, invocation_id);
     auto reply_header_size = header_space();
+    // Each thread that delivers messages deserializes their arguments into
+    // its own arena, which is emptied once the outermost call has returned
+    thread_local DeserializationArena arena;
+    thread_local mutils::DeserializationManager dsm{{&arena}};
+    thread_local uint32_t nesting_depth = 0;
+    nesting_depth++;
+    struct arena_reset {
+        ~arena_reset() {
+            if(--nesting_depth == 0) {
+                arena.reset();
+            }
+        }
+    } reset_on_return;
     //TODO: Check that the given Opcode is actually in our receivers map,
     //and reply with a "no such method error" if it is not
     recv_ret reply_return = receivers->at(indx)(
-            &rdv, received_from, buf,
+            &dsm, received_from, buf,
             [&out_alloc, &reply_header_size](std::size_t size) {
                 return out_alloc(size + reply_header_size) + reply_header_size;
             });
@@ -65,61 +119,150 @@ std::exception_ptr RPCManager::parse_and_receive(char* buf, std::size_t size,
 }
 
 void RPCManager::rpc_message_handler(subgroup_id_t subgroup_id, node_id_t sender_id, char* msg_buf, uint32_t payload_size) {
+    using namespace remote_invocation_utilities;
     // WARNING: This assumes the current view doesn't change during execution! (It accesses curr_view without a lock).
-    // extract the destination vector
-    size_t dest_size = ((size_t*)msg_buf)[0];
+    // extract the destination list, and look for this node in it
+    size_t dest_size;
+    bool is_placeholder;
+    uint32_t function_index = Opcode::NO_FUNCTION_INDEX;
+    if(compact_rpc_headers) {
+        const uint32_t word_count = ((uint32_t*)msg_buf)[0];
+        is_placeholder = word_count & COMPACT_TARGETED_SEND_FLAG;
+        dest_size = word_count & ~COMPACT_TARGETED_SEND_FLAG;
+        function_index = ((uint32_t*)msg_buf)[1];
+    } else {
+        dest_size = ((size_t*)msg_buf)[0];
+        is_placeholder = dest_size & TARGETED_SEND_FLAG;
+        dest_size &= ~TARGETED_SEND_FLAG;
+    }
+    // both kinds of node count take the same space
     msg_buf += sizeof(size_t);
     payload_size -= sizeof(size_t);
     bool in_dest = false;
-    for(size_t i = 0; i < dest_size; ++i) {
-        auto n = ((node_id_t*)msg_buf)[0];
-        msg_buf += sizeof(node_id_t);
-        payload_size -= sizeof(node_id_t);
-        if(n == nid) {
-            in_dest = true;
-        }
-    }
-    if(in_dest || dest_size == 0) {
-        //Use the reply-buffer allocation lambda to detect whether handle_receive generated a reply
-        size_t reply_size = 0;
-        char* reply_buf;
-        parse_and_receive(msg_buf, payload_size, [this, &reply_buf, &reply_size, &sender_id](size_t size) -> char* {
-            reply_size = size;
-            if(reply_size <= connections->get_max_p2p_size()) {
-                reply_buf = (char*)connections->get_sendbuffer_ptr(
-                        connections->get_node_rank(sender_id), sst::REQUEST_TYPE::RPC_REPLY);
-                return reply_buf;
-            } else {
-                // the reply size is too large - not part of the design to handle it
-                return nullptr;
-            }
-        });
-        if(reply_size > 0) {
-            if(sender_id == nid) {
-                //The RPC message expects replies, and I was the sender, so I might have a reply-map that needs fulfilling
-                if(dest_size == 0) {
-                    //Destination was "all nodes in my shard of the subgroup"
-                    int my_shard = view_manager.curr_view->multicast_group->get_subgroup_settings().at(subgroup_id).shard_num;
-                    std::lock_guard<std::mutex> lock(pending_results_mutex);
-                    assert(!toFulfillQueue.empty());
-                    // whenlog(logger->trace("Calling fulfill_map on toFulfillQueue.front(), its size is {}", toFulfillQueue.size());)
-                    toFulfillQueue.front().get().fulfill_map(
-                            view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard).members);
-                    fulfilledList.push_back(std::move(toFulfillQueue.front()));
-                    toFulfillQueue.pop();
-                    // whenlog(logger->trace("Popped a PendingResults from toFulfillQueue, size is now {}", toFulfillQueue.size());)
-                }
-                //Immediately handle the reply to myself
-                parse_and_receive(
-                        reply_buf, reply_size,
-                        [](size_t size) -> char* { assert_always(false); });
-            } else {
-                connections->send(connections->get_node_rank(sender_id));
+    if(dest_size > 0) {
+        in_dest = destination_list_contains(msg_buf, dest_size, nid);
+        msg_buf += destination_list_size(dest_size);
+        payload_size -= destination_list_size(dest_size);
+    }
+    if(!in_dest && dest_size != 0) {
+        return;
+    }
+    // the body of a targeted send came separately, by P2P
+    std::vector<char> targeted_body;
+    if(is_placeholder) {
+        targeted_body = wait_for_targeted_body(sender_id, ((uint64_t*)msg_buf)[0]);
+        if(targeted_body.empty()) {
+            return;
+        }
+        msg_buf = targeted_body.data();
+        payload_size = targeted_body.size();
+    }
+    Opcode indx;
+    node_id_t received_from = sender_id;
+    if(compact_rpc_headers && !is_placeholder) {
+        // the sender and the size are the multicast's
+        indx = receivers->invoke_opcode(subgroup_id, function_index);
+    } else {
+        std::size_t rpc_payload_size;
+        retrieve_header(&rdv, msg_buf, rpc_payload_size, indx, received_from);
+        msg_buf += header_space();
+        payload_size = rpc_payload_size;
+    }
+    if(num_catching_up > 0) {
+        std::lock_guard<std::mutex> lock(catch_up_mutex);
+        auto catching_up_it = catching_up.find(subgroup_id);
+        if(catching_up_it != catching_up.end()) {
+            catching_up_it->second.push_back(CaughtUpMessage{
+                    sender_id, indx, received_from, std::vector<char>(msg_buf, msg_buf + payload_size), dest_size == 0});
+            return;
+        }
+    }
+    handle_rpc_message(subgroup_id, sender_id, indx, received_from, msg_buf, payload_size, dest_size == 0);
+}
+
+void RPCManager::handle_rpc_message(subgroup_id_t subgroup_id, node_id_t sender_id, const Opcode& indx,
+                                    node_id_t received_from, char* msg_buf, uint32_t payload_size,
+                                    bool to_whole_shard) {
+    //Use the reply-buffer allocation lambda to detect whether handle_receive generated a reply
+    size_t reply_size = 0;
+    char* reply_buf;
+    std::vector<char> large_reply;
+    receive_message(indx, received_from, msg_buf, payload_size, [this, &reply_buf, &reply_size, &large_reply, &sender_id](size_t size) -> char* {
+        reply_size = size;
+        if(reply_size <= connections->get_max_p2p_size() && connections->contains_node(sender_id)) {
+            reply_buf = (char*)connections->get_sendbuffer_ptr(
+                    connections->get_node_rank(sender_id), sst::REQUEST_TYPE::RPC_REPLY);
+        } else {
+            // the reply is too large for a P2P message, so the sender
+            // fetches it in fragments (or it left while the message was
+            // queued for catch-up, and gets no reply)
+            large_reply.resize(reply_size);
+            reply_buf = large_reply.data();
+        }
+        return reply_buf;
+    });
+    if(reply_size > 0) {
+        if(sender_id == nid) {
+            //The RPC message expects replies, and I was the sender, so I might have a reply-map that needs fulfilling
+            if(to_whole_shard) {
+                //Destination was "all nodes in my shard of the subgroup"
+                int my_shard = view_manager.curr_view->multicast_group->get_subgroup_settings().at(subgroup_id).shard_num;
+                PendingBase* pending = fulfillment_queues.at(subgroup_id)->pop();
+                assert(pending);
+                pending->fulfill_map(view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard).members);
             }
+            //Immediately handle the reply to myself
+            parse_and_receive(
+                    reply_buf, reply_size,
+                    [](size_t size) -> char* { assert_always(false); });
+        } else if(!connections->contains_node(sender_id)) {
+            rpc_log(DEBUG, "Dropping the reply to node {}, which left the group", sender_id);
+        } else if(!large_reply.empty()) {
+            send_large_reply(sender_id, sst::REQUEST_TYPE::RPC_REPLY, std::move(large_reply));
+        } else {
+            connections->send(connections->get_node_rank(sender_id), reply_size);
         }
     }
 }
 
+void RPCManager::begin_catch_up(subgroup_id_t subgroup_id) {
+    std::lock_guard<std::mutex> lock(catch_up_mutex);
+    if(catching_up.emplace(subgroup_id, std::vector<CaughtUpMessage>()).second) {
+        num_catching_up++;
+    }
+}
+
+void RPCManager::finish_catch_up(subgroup_id_t subgroup_id) {
+    {
+        // the replies go out over the P2P connections
+        std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
+        // held while replaying, so that messages delivered meanwhile wait
+        // in rpc_message_handler and stay in order
+        std::lock_guard<std::mutex> lock(catch_up_mutex);
+        auto catching_up_it = catching_up.find(subgroup_id);
+        if(catching_up_it == catching_up.end()) {
+            return;
+        }
+        rpc_log(DEBUG, "Replaying {} messages delivered in subgroup {} while its state was received",
+                       catching_up_it->second.size(), subgroup_id);
+        for(CaughtUpMessage& caught_up : catching_up_it->second) {
+            handle_rpc_message(subgroup_id, caught_up.sender_id, caught_up.opcode, caught_up.received_from,
+                               caught_up.message.data(), caught_up.message.size(), caught_up.to_whole_shard);
+        }
+        catching_up.erase(catching_up_it);
+        num_catching_up--;
+    }
+    catch_up_cv.notify_all();
+}
+
+void RPCManager::wait_for_catch_up(subgroup_id_t subgroup_id) {
+    if(num_catching_up == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(catch_up_mutex);
+    catch_up_cv.wait(lock, [&]() { return catching_up.count(subgroup_id) == 0; });
+}
+
 void RPCManager::p2p_message_handler(node_id_t sender_id, char* msg_buf, uint32_t buffer_size) {
     using namespace remote_invocation_utilities;
     const std::size_t header_size = header_space();
@@ -127,102 +270,785 @@ void RPCManager::p2p_message_handler(node_id_t sender_id, char* msg_buf, uint32_
     Opcode indx;
     node_id_t received_from;
     retrieve_header(nullptr, msg_buf, payload_size, indx, received_from);
+    if(indx.class_id == std::type_index(typeid(RPCManager))) {
+        large_reply_message_handler(sender_id, indx.function_id, msg_buf + header_size, payload_size);
+        return;
+    }
+    if(!indx.is_reply) {
+        // requests see the state of the subgroup, so they wait for it
+        wait_for_catch_up(indx.subgroup_id);
+        if(linearizable_p2p_queries) {
+            view_manager.wait_for_read_index(indx.subgroup_id);
+        }
+    }
     size_t reply_size = 0;
+    std::vector<char> large_reply;
     receive_message(indx, received_from, msg_buf + header_size, payload_size,
-                    [this, &msg_buf, &buffer_size, &reply_size, &sender_id](size_t _size) -> char* {
+                    [this, &msg_buf, &buffer_size, &reply_size, &large_reply, &sender_id](size_t _size) -> char* {
                         reply_size = _size;
                         if(reply_size <= buffer_size) {
                             return (char*)connections->get_sendbuffer_ptr(
                                     connections->get_node_rank(sender_id), sst::REQUEST_TYPE::P2P_REPLY);
                         }
-                        return nullptr;
+                        large_reply.resize(reply_size);
+                        return large_reply.data();
                     });
-    if(reply_size > 0) {
-        connections->send(connections->get_node_rank(sender_id));
+    if(!large_reply.empty()) {
+        send_large_reply(sender_id, sst::REQUEST_TYPE::P2P_REPLY, std::move(large_reply));
+    } else if(reply_size > 0) {
+        connections->send(connections->get_node_rank(sender_id), reply_size);
+    }
+}
+
+std::size_t RPCManager::large_reply_fragment_size() {
+    using namespace remote_invocation_utilities;
+    return connections->get_max_p2p_size() - header_space() - 2 * sizeof(uint64_t);
+}
+
+void RPCManager::send_large_reply(node_id_t requester, sst::REQUEST_TYPE type, std::vector<char>&& message) {
+    using namespace remote_invocation_utilities;
+    uint64_t reply_id;
+    const uint64_t reply_size = message.size();
+    {
+        std::lock_guard<std::mutex> lock(large_replies_mutex);
+        reply_id = next_large_reply_id++;
+        large_replies.emplace(reply_id, LargeReply{requester, std::move(message), 0});
+    }
+    rpc_log(DEBUG, "Sending node {} a descriptor of large reply {} of {} bytes", requester, reply_id, reply_size);
+    const auto rank = connections->get_node_rank(requester);
+    char* buf = connections->get_sendbuffer_ptr(rank, type);
+    populate_header(buf, 2 * sizeof(uint64_t), Opcode{typeid(RPCManager), 0, LARGE_REPLY_DESCRIPTOR, true}, nid);
+    ((uint64_t*)(buf + header_space()))[0] = reply_id;
+    ((uint64_t*)(buf + header_space()))[1] = reply_size;
+    connections->send(rank, header_space() + 2 * sizeof(uint64_t));
+}
+
+void RPCManager::send_large_request(node_id_t dest_id, sst::REQUEST_TYPE type, std::vector<char>&& message) {
+    using namespace remote_invocation_utilities;
+    uint64_t request_id;
+    const uint64_t request_size = message.size();
+    {
+        std::lock_guard<std::mutex> lock(large_replies_mutex);
+        request_id = next_large_reply_id++;
+        large_replies.emplace(request_id, LargeReply{dest_id, std::move(message), 0});
+    }
+    rpc_log(DEBUG, "Sending node {} a descriptor of large request {} of {} bytes", dest_id, request_id, request_size);
+    const auto rank = connections->get_node_rank(dest_id);
+    char* buf = connections->get_sendbuffer_ptr(rank, type);
+    populate_header(buf, 2 * sizeof(uint64_t), Opcode{typeid(RPCManager), 0, LARGE_REQUEST_DESCRIPTOR, false}, nid);
+    ((uint64_t*)(buf + header_space()))[0] = request_id;
+    ((uint64_t*)(buf + header_space()))[1] = request_size;
+    connections->send(rank, header_space() + 2 * sizeof(uint64_t));
+}
+
+void RPCManager::large_reply_message_handler(node_id_t sender_id, FunctionTag type,
+                                             char const* const buf, std::size_t payload_size) {
+    using namespace remote_invocation_utilities;
+    const uint64_t reply_id = ((uint64_t const*)buf)[0];
+    switch(type) {
+        case LARGE_REPLY_DESCRIPTOR: {
+            const uint64_t reply_size = ((uint64_t const*)buf)[1];
+            large_reply_fetches.emplace(std::make_pair(sender_id, reply_id),
+                                        LargeReplyFetch{std::vector<char>(reply_size), 0, 0, false});
+            fetch_large_replies();
+            break;
+        }
+        case LARGE_REQUEST_DESCRIPTOR: {
+            const uint64_t request_size = ((uint64_t const*)buf)[1];
+            large_reply_fetches.emplace(std::make_pair(sender_id, reply_id),
+                                        LargeReplyFetch{std::vector<char>(request_size), 0, 0, true});
+            fetch_large_replies();
+            break;
+        }
+        case TARGETED_SEND_BODY: {
+            receive_targeted_body(sender_id, buf, payload_size);
+            break;
+        }
+        case LARGE_REPLY_FETCH: {
+            const uint64_t offset = ((uint64_t const*)buf)[1];
+            // Every fetch gets a fragment, even an empty one, since that is
+            // what frees its slot in the requester's window
+            const auto rank = connections->get_node_rank(sender_id);
+            char* reply_buf = connections->get_sendbuffer_ptr(rank, sst::REQUEST_TYPE::P2P_REPLY);
+            uint64_t length = 0;
+            {
+                std::lock_guard<std::mutex> lock(large_replies_mutex);
+                auto search = large_replies.find(reply_id);
+                if(search != large_replies.end() && offset < search->second.message.size()) {
+                    LargeReply& reply = search->second;
+                    length = std::min<uint64_t>(large_reply_fragment_size(), reply.message.size() - offset);
+                    memcpy(reply_buf + header_space() + 2 * sizeof(uint64_t), reply.message.data() + offset, length);
+                    reply.bytes_fetched += length;
+                    if(reply.bytes_fetched == reply.message.size()) {
+                        large_replies.erase(search);
+                    }
+                }
+            }
+            populate_header(reply_buf, 2 * sizeof(uint64_t) + length,
+                            Opcode{typeid(RPCManager), 0, LARGE_REPLY_FRAGMENT, true}, nid);
+            ((uint64_t*)(reply_buf + header_space()))[0] = reply_id;
+            ((uint64_t*)(reply_buf + header_space()))[1] = offset;
+            connections->send(rank, header_space() + 2 * sizeof(uint64_t) + length);
+            break;
+        }
+        case LARGE_REPLY_FRAGMENT: {
+            const uint64_t offset = ((uint64_t const*)buf)[1];
+            const std::size_t fragment_size = payload_size - 2 * sizeof(uint64_t);
+            auto search = large_reply_fetches.find(std::make_pair(sender_id, reply_id));
+            if(search == large_reply_fetches.end()) {
+                break;
+            }
+            LargeReplyFetch& fetch = search->second;
+            if(fragment_size == 0 || offset + fragment_size > fetch.message.size()) {
+                // The reply is gone from the node that had it
+                whenlog(logger->warn("Large reply {} from node {} is incomplete", reply_id, sender_id););
+                large_reply_fetches.erase(search);
+                break;
+            }
+            memcpy(fetch.message.data() + offset, buf + 2 * sizeof(uint64_t), fragment_size);
+            fetch.bytes_received += fragment_size;
+            if(fetch.bytes_received == fetch.message.size()) {
+                // The whole message is here: handle it like a small one
+                std::vector<char> message = std::move(fetch.message);
+                const bool is_request = fetch.is_request;
+                large_reply_fetches.erase(search);
+                if(is_request) {
+                    dispatch_p2p_request(sender_id, message.data());
+                    break;
+                }
+                std::size_t payload_size;
+                Opcode indx;
+                node_id_t received_from;
+                retrieve_header(nullptr, message.data(), payload_size, indx, received_from);
+                receive_message(indx, received_from, message.data() + header_space(), payload_size,
+                                [](size_t size) -> char* { assert_always(false); });
+            }
+            break;
+        }
+    }
+}
+
+void RPCManager::fetch_large_replies() {
+    using namespace remote_invocation_utilities;
+    if(large_reply_fetches.empty()) {
+        return;
+    }
+    // Don't wait for an application thread sending a query
+    std::unique_lock<std::mutex> query_lock(p2p_query_mutex, std::try_to_lock);
+    if(!query_lock.owns_lock()) {
+        return;
+    }
+    const std::size_t fragment_size = large_reply_fragment_size();
+    for(auto& [key, fetch] : large_reply_fetches) {
+        const auto rank = connections->get_node_rank(key.first);
+        while(fetch.fetch_offset < fetch.message.size()) {
+            char* buf = connections->get_sendbuffer_ptr(rank, sst::REQUEST_TYPE::P2P_QUERY);
+            if(!buf) {
+                // the window is full
+                break;
+            }
+            populate_header(buf, 2 * sizeof(uint64_t), Opcode{typeid(RPCManager), 0, LARGE_REPLY_FETCH, false}, nid);
+            ((uint64_t*)(buf + header_space()))[0] = key.second;
+            ((uint64_t*)(buf + header_space()))[1] = fetch.fetch_offset;
+            connections->send(rank, header_space() + 2 * sizeof(uint64_t));
+            fetch.fetch_offset += fragment_size;
+        }
     }
 }
 
 void RPCManager::new_view_callback(const View& new_view) {
-    std::lock_guard<std::mutex> connections_lock(p2p_connections_mutex);
+    // a subgroup keeps its queue across views, since its queries sent in one
+    // view may be delivered in the next
+    while(fulfillment_queues.size() < new_view.subgroup_shard_views.size()) {
+        fulfillment_queues.push_back(std::make_unique<FulfillmentQueue>());
+    }
+    std::unique_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
     connections = std::make_unique<sst::P2PConnections>(std::move(*connections), new_view.members);
-    whenlog(logger->debug("Created new connections among the new view members"););
-    std::lock_guard<std::mutex> lock(pending_results_mutex);
-    for(auto& pending : fulfilledList) {
+    rpc_log(DEBUG, "Created new connections among the new view members");
+    // drop the large replies exchanged with departed nodes
+    for(auto removed_id : new_view.departed) {
+        large_reply_fetches.erase(large_reply_fetches.lower_bound(std::make_pair(removed_id, (uint64_t)0)),
+                                  large_reply_fetches.upper_bound(std::make_pair(removed_id, UINT64_MAX)));
+    }
+    {
+        std::lock_guard<std::mutex> large_replies_lock(large_replies_mutex);
+        for(auto it = large_replies.begin(); it != large_replies.end();) {
+            if(std::find(new_view.departed.begin(), new_view.departed.end(), it->second.requester) != new_view.departed.end()) {
+                it = large_replies.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+    {
+        // the placeholders of departed senders' targeted sends that are
+        // still to come will not be delivered
+        std::lock_guard<std::mutex> bodies_lock(targeted_bodies_mutex);
         for(auto removed_id : new_view.departed) {
-            pending.get().set_exception_for_removed_node(removed_id);
+            targeted_bodies.erase(targeted_bodies.lower_bound(std::make_pair(removed_id, (uint64_t)0)),
+                                  targeted_bodies.upper_bound(std::make_pair(removed_id, UINT64_MAX)));
+        }
+    }
+    std::list<std::reference_wrapper<OutstandingRepliesBase>> outstanding_replies;
+    {
+        // a copy, since failing a query may wait for another to be fulfilled
+        std::lock_guard<std::mutex> lock(pending_results_mutex);
+        outstanding_replies = outstanding_replies_list;
+    }
+    for(auto& replies : outstanding_replies) {
+        for(auto removed_id : new_view.departed) {
+            replies.get().set_exception_for_removed_node(removed_id);
         }
     }
 }
 
-int RPCManager::populate_nodelist_header(const std::vector<node_id_t>& dest_nodes, char* buffer,
-                                         std::size_t& max_payload_size) {
+void RPCManager::track_outstanding_replies(const PendingBase& pending_results_handle) {
+    OutstandingRepliesBase* replies = pending_results_handle.owner;
+    if(replies && !replies->registered.test_and_set()) {
+        std::lock_guard<std::mutex> lock(pending_results_mutex);
+        outstanding_replies_list.push_back(*replies);
+    }
+}
+
+int RPCManager::populate_nodelist_header(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                         char* buffer, std::size_t& max_payload_size,
+                                         uint32_t function_index) {
     int header_size = 0;
-    // Put the list of destination nodes in another layer of "header"
-    ((size_t*)buffer)[0] = dest_nodes.size();
+    // Put the destination nodes in another layer of "header": their node
+    // IDs, preceded by their number. No nodes means the whole shard.
+    if(compact_rpc_headers) {
+        ((uint32_t*)buffer)[0] = dest_nodes.size();
+        ((uint32_t*)buffer)[1] = function_index;
+    } else {
+        ((size_t*)buffer)[0] = dest_nodes.size();
+    }
     buffer += sizeof(size_t);
     header_size += sizeof(size_t);
-    for(auto& node_id : dest_nodes) {
-        ((node_id_t*)buffer)[0] = node_id;
-        buffer += sizeof(node_id_t);
-        header_size += sizeof(node_id_t);
-    }
+    header_size += write_destination_list(dest_nodes, buffer);
     //Two return values: the size of the header we just created,
     //and the maximum payload size based on that
-    max_payload_size = view_manager.curr_view->multicast_group->max_msg_size - sizeof(derecho::header) - header_size;
+    max_payload_size = view_manager.curr_view->multicast_group->get_subgroup_settings().at(subgroup_id).max_msg_size
+                       - sizeof(derecho::header) - header_size;
     return header_size;
 }
 
+std::size_t RPCManager::ordered_message_size(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                             std::size_t payload_size) {
+    using namespace remote_invocation_utilities;
+    return sizeof(size_t) + destination_list_size(dest_nodes.size()) + (compact_rpc_headers ? 0 : header_space())
+           + payload_size;
+}
+
+bool RPCManager::use_targeted_send(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                   std::size_t payload_size) {
+    if(targeted_send_threshold == 0 || dest_nodes.empty() || payload_size < targeted_send_threshold) {
+        return false;
+    }
+    std::shared_lock<ViewLock> view_read_lock(view_manager.view_mutex);
+    const uint32_t my_shard = view_manager.curr_view->multicast_group->get_subgroup_settings().at(subgroup_id).shard_num;
+    const SubView& shard_view = view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard);
+    std::vector<bool> is_destination(shard_view.members.size(), false);
+    for(auto& node_id : dest_nodes) {
+        const int rank = shard_view.rank_of(node_id);
+        if(rank >= 0) {
+            is_destination[rank] = true;
+        }
+    }
+    return std::find(is_destination.begin(), is_destination.end(), true) != is_destination.end()
+           && std::find(is_destination.begin(), is_destination.end(), false) != is_destination.end();
+}
+
+std::size_t RPCManager::targeted_placeholder_size(const std::vector<node_id_t>& dest_nodes) {
+    // the node count, the node IDs and the body id
+    return sizeof(size_t) + destination_list_size(dest_nodes.size()) + sizeof(uint64_t);
+}
+
+std::size_t RPCManager::destination_list_size(std::size_t num_dest_nodes) {
+    return (num_dest_nodes * sizeof(node_id_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+std::size_t RPCManager::write_destination_list(const std::vector<node_id_t>& dest_nodes, char* buffer) {
+    node_id_t* list = (node_id_t*)buffer;
+    std::copy(dest_nodes.begin(), dest_nodes.end(), list);
+    // sorted, so that receivers can binary search for themselves
+    std::sort(list, list + dest_nodes.size());
+    const std::size_t list_size = destination_list_size(dest_nodes.size());
+    std::fill(buffer + dest_nodes.size() * sizeof(node_id_t), buffer + list_size, 0);
+    return list_size;
+}
+
+bool RPCManager::destination_list_contains(const char* list, std::size_t num_dest_nodes, node_id_t node_id) {
+    const node_id_t* nodes = (const node_id_t*)list;
+    return std::binary_search(nodes, nodes + num_dest_nodes, node_id);
+}
+
+char* RPCManager::get_targeted_body_buffer(std::size_t size) {
+    using namespace remote_invocation_utilities;
+    targeted_body_buffer.resize(header_space() + sizeof(uint64_t) + size);
+    return targeted_body_buffer.data() + header_space() + sizeof(uint64_t);
+}
+
+void RPCManager::send_targeted_body(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                    char* placeholder) {
+    using namespace remote_invocation_utilities;
+    const uint64_t body_id = next_targeted_body_id++;
+    const std::size_t message_size = targeted_body_buffer.size();
+    populate_header(targeted_body_buffer.data(), message_size - header_space(),
+                    Opcode{typeid(RPCManager), subgroup_id, TARGETED_SEND_BODY, false}, nid);
+    ((uint64_t*)(targeted_body_buffer.data() + header_space()))[0] = body_id;
+    // Only the destinations in the shard get the body, so only they are in
+    // the placeholder's list: if the placeholder is sent again after a view
+    // change, a node that has joined the shard since must not wait for it
+    const uint32_t my_shard = view_manager.curr_view->multicast_group->get_subgroup_settings().at(subgroup_id).shard_num;
+    const SubView& shard_view = view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard);
+    std::vector<node_id_t> shard_dest_nodes;
+    for(const node_id_t dest_id : dest_nodes) {
+        if(shard_view.rank_of(dest_id) >= 0) {
+            shard_dest_nodes.push_back(dest_id);
+        }
+    }
+    // If none of them is in the shard any more, the original list stays,
+    // since an empty one would mean the whole shard
+    std::size_t max_payload_size;
+    const int header_size = populate_nodelist_header(subgroup_id, shard_dest_nodes.empty() ? dest_nodes : shard_dest_nodes,
+                                                     placeholder, max_payload_size);
+    if(compact_rpc_headers) {
+        ((uint32_t*)placeholder)[0] |= COMPACT_TARGETED_SEND_FLAG;
+    } else {
+        ((size_t*)placeholder)[0] |= TARGETED_SEND_FLAG;
+    }
+    ((uint64_t*)(placeholder + header_size))[0] = body_id;
+    for(const node_id_t dest_id : shard_dest_nodes) {
+        if(dest_id == nid) {
+            receive_targeted_body(nid, targeted_body_buffer.data() + header_space(), message_size - header_space());
+        } else if(message_size > connections->get_max_p2p_size()) {
+            send_large_request(dest_id, sst::REQUEST_TYPE::P2P_SEND, std::vector<char>(targeted_body_buffer));
+        } else {
+            volatile char* buf = get_sendbuffer_ptr(dest_id, sst::REQUEST_TYPE::P2P_SEND);
+            memcpy((char*)buf, targeted_body_buffer.data(), message_size);
+            connections->send(connections->get_node_rank(dest_id), message_size);
+        }
+        p2p_sent_bytes->add(message_size);
+    }
+    rpc_log(TRACE, "Sent the body of targeted send {} in subgroup {}, {} bytes", body_id, subgroup_id, message_size);
+}
+
+void RPCManager::receive_targeted_body(node_id_t sender_id, char const* const buf, std::size_t payload_size) {
+    const uint64_t body_id = ((uint64_t const*)buf)[0];
+    {
+        std::lock_guard<std::mutex> lock(targeted_bodies_mutex);
+        targeted_bodies.emplace(std::make_pair(sender_id, body_id),
+                                std::vector<char>(buf + sizeof(uint64_t), buf + payload_size));
+    }
+    targeted_bodies_cv.notify_all();
+}
+
+std::vector<char> RPCManager::wait_for_targeted_body(node_id_t sender_id, uint64_t body_id) {
+    const auto key = std::make_pair(sender_id, body_id);
+    std::unique_lock<std::mutex> lock(targeted_bodies_mutex);
+    while(targeted_bodies.count(key) == 0) {
+        // The sender sent the body before the placeholder, so it is late,
+        // not lost, unless the sender failed in between
+        if(!targeted_bodies_cv.wait_for(lock, std::chrono::seconds(1),
+                                        [&]() { return targeted_bodies.count(key) > 0 || thread_shutdown; })) {
+            whenlog(logger->warn("Still waiting for the body of targeted send {} from node {}", body_id, sender_id););
+        }
+        if(thread_shutdown) {
+            return {};
+        }
+    }
+    std::vector<char> body = std::move(targeted_bodies.at(key));
+    targeted_bodies.erase(key);
+    return body;
+}
+
+void RPCManager::send_batch(std::vector<BatchedSend>& sends) {
+    std::size_t round_start = 0;
+    while(round_start < sends.size()) {
+        // a round takes each subgroup at most once
+        std::set<subgroup_id_t> round_subgroups;
+        std::size_t round_end = round_start;
+        while(round_end < sends.size() && round_subgroups.insert(sends[round_end].subgroup_id).second) {
+            round_end++;
+        }
+        std::vector<char*> buffers(round_end - round_start, nullptr);
+        std::vector<PendingBase*> pending(round_end - round_start, nullptr);
+        std::vector<std::size_t> message_sizes;
+        for(std::size_t i = round_start; i < round_end; ++i) {
+            message_sizes.push_back(ordered_message_size(sends[i].subgroup_id, sends[i].destination_nodes,
+                                                         sends[i].payload_size));
+        }
+        std::shared_lock<ViewLock> view_read_lock(view_manager.view_mutex);
+        while(true) {
+            bool all_reserved = true;
+            for(std::size_t i = round_start; i < round_end; ++i) {
+                char*& buffer = buffers[i - round_start];
+                if(!buffer) {
+                    buffer = view_manager.curr_view->multicast_group->get_sendbuffer_ptr(
+                            sends[i].subgroup_id, message_sizes[i - round_start], true);
+                    all_reserved = all_reserved && buffer;
+                }
+            }
+            if(all_reserved) {
+                break;
+            }
+            // a send window is full; let a view change have the lock
+            // between tries, as ordered_send does
+            view_read_lock.unlock();
+            std::this_thread::yield();
+            view_read_lock.lock();
+        }
+        for(std::size_t i = round_start; i < round_end; ++i) {
+            std::size_t max_payload_size;
+            char* buffer = buffers[i - round_start];
+            buffer += populate_nodelist_header(sends[i].subgroup_id, sends[i].destination_nodes,
+                                               buffer, max_payload_size, sends[i].function_index);
+            pending[i - round_start] = &sends[i].serialize(buffer, max_payload_size, !compact_rpc_headers);
+        }
+        std::size_t next_send = round_start;
+        view_manager.view_change_cv.wait(view_read_lock, [&]() {
+            while(next_send < round_end
+                  && finish_rpc_send(false, sends[next_send].subgroup_id, sends[next_send].destination_nodes,
+                                     *pending[next_send - round_start])) {
+                next_send++;
+            }
+            return next_send == round_end;
+        });
+        round_start = round_end;
+    }
+}
+
 bool RPCManager::finish_rpc_send(bool is_query, uint32_t subgroup_id, const std::vector<node_id_t>& dest_nodes, PendingBase& pending_results_handle) {
     if(!view_manager.curr_view->multicast_group->send(subgroup_id)) {
         return false;
     }
     if(is_query) {
-        std::lock_guard<std::mutex> lock(pending_results_mutex);
+        track_outstanding_replies(pending_results_handle);
         if(dest_nodes.size() != 0) {
             pending_results_handle.fulfill_map(dest_nodes);
-            fulfilledList.push_back(pending_results_handle);
-        } else {
-            toFulfillQueue.push(pending_results_handle);
         }
     }
     return true;
 }
 
+void RPCManager::queue_shard_query(subgroup_id_t subgroup_id, PendingBase& pending_results_handle) {
+    fulfillment_queues.at(subgroup_id)->push(pending_results_handle);
+}
+
+void RPCManager::check_p2p_request_size(std::size_t size) const {
+    using namespace remote_invocation_utilities;
+    if(size > max_p2p_request_size) {
+        throw message_too_large_exception("A P2P request of " + std::to_string(size - header_space())
+                                          + " bytes is larger than max_payload_size ("
+                                          + std::to_string(max_p2p_request_size - header_space()) + ")");
+    }
+}
+
+volatile char* RPCManager::get_sendbuffer_ptr(uint32_t dest_id, sst::REQUEST_TYPE type, std::size_t size) {
+    check_p2p_request_size(size);
+    volatile char* buf = get_sendbuffer_ptr(dest_id, type);
+    if(size <= connections->get_max_p2p_size()) {
+        return buf;
+    }
+    // the slot is kept for the descriptor
+    large_request_buffer.resize(size);
+    return large_request_buffer.data();
+}
+
 volatile char* RPCManager::get_sendbuffer_ptr(uint32_t dest_id, sst::REQUEST_TYPE type) {
     auto dest_rank = connections->get_node_rank(dest_id);
     volatile char* buf;
+    if(type == sst::REQUEST_TYPE::P2P_QUERY) {
+        // hold p2p_query_mutex until finish_p2p_send, but let the P2P
+        // thread have it while the window is full
+        while(true) {
+            p2p_query_mutex.lock();
+            buf = connections->get_sendbuffer_ptr(dest_rank, type);
+            if(buf) {
+                p2p_query_mutex_owner = std::this_thread::get_id();
+                return buf;
+            }
+            p2p_query_mutex.unlock();
+        }
+    }
     do {
         buf = connections->get_sendbuffer_ptr(dest_rank, type);
     } while(!buf);
     return buf;
 }
 
-void RPCManager::finish_p2p_send(bool is_query, node_id_t dest_id, PendingBase& pending_results_handle) {
-    connections->send(connections->get_node_rank(dest_id));
+void RPCManager::finish_p2p_send(bool is_query, node_id_t dest_id, std::size_t size, PendingBase& pending_results_handle) {
+    if(size > connections->get_max_p2p_size()) {
+        send_large_request(dest_id, is_query ? sst::REQUEST_TYPE::P2P_QUERY : sst::REQUEST_TYPE::P2P_SEND,
+                           std::move(large_request_buffer));
+    } else {
+        connections->send(connections->get_node_rank(dest_id), size);
+    }
+    p2p_sends_by_kind[is_query]->add();
+    p2p_sent_bytes->add(size);
+    if(is_query && p2p_query_mutex_owner == std::this_thread::get_id()) {
+        p2p_query_mutex_owner = std::thread::id();
+        p2p_query_mutex.unlock();
+    }
     if(is_query) {
         //only fulfill the reply map if this is a non-void query - sends ignore the PendingResults
+        track_outstanding_replies(pending_results_handle);
         pending_results_handle.fulfill_map({dest_id});
+    }
+}
+
+node_id_t RPCManager::pick_shard_member(subgroup_id_t subgroup_id, uint32_t shard_num) {
+    std::vector<node_id_t> shard_members;
+    {
+        std::shared_lock<ViewLock> view_read_lock(view_manager.view_mutex);
+        shard_members = view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num).members;
+    }
+    std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
+    const uint32_t start = next_pick_start++;
+    std::optional<node_id_t> best_member;
+    double best_cost = 0;
+    for(std::size_t i = 0; i < shard_members.size(); ++i) {
+        const node_id_t member = shard_members[(start + i) % shard_members.size()];
+        if(member == nid || !connections->contains_node(member)) {
+            continue;
+        }
+        const uint32_t rank = connections->get_node_rank(member);
+        // the time to get through the queries ahead in its window, and this one
+        const double cost = (connections->get_num_outstanding_queries(rank) + 1)
+                            * (double)connections->get_average_reply_latency(rank);
+        if(!best_member || cost < best_cost) {
+            best_member = member;
+            best_cost = cost;
+        }
+    }
+    if(!best_member) {
+        throw invalid_subgroup_exception("Shard " + std::to_string(shard_num) + " of subgroup "
+                                         + std::to_string(subgroup_id) + " has no member to query");
+    }
+    return *best_member;
+}
+
+uint32_t RPCManager::get_num_shards(subgroup_id_t subgroup_id) {
+    std::shared_lock<ViewLock> view_read_lock(view_manager.view_mutex);
+    return view_manager.curr_view->subgroup_shard_views.at(subgroup_id).size();
+}
+
+volatile char* RPCManager::try_get_query_buffer_ptr(uint32_t dest_id, std::size_t size) {
+    check_p2p_request_size(size);
+    auto dest_rank = connections->get_node_rank(dest_id);
+    p2p_query_mutex.lock();
+    volatile char* buf = connections->get_sendbuffer_ptr(dest_rank, sst::REQUEST_TYPE::P2P_QUERY);
+    if(!buf) {
+        p2p_query_mutex.unlock();
+        return nullptr;
+    }
+    p2p_query_mutex_owner = std::this_thread::get_id();
+    if(size > connections->get_max_p2p_size()) {
+        large_request_buffer.resize(size);
+        return large_request_buffer.data();
+    }
+    return buf;
+}
+
+void RPCManager::finish_p2p_async_query(node_id_t dest_id, std::size_t size, OutstandingRepliesBase& async_replies) {
+    if(size > connections->get_max_p2p_size()) {
+        send_large_request(dest_id, sst::REQUEST_TYPE::P2P_QUERY, std::move(large_request_buffer));
+    } else {
+        connections->send(connections->get_node_rank(dest_id), size);
+    }
+    p2p_sends_by_kind[true]->add();
+    p2p_sent_bytes->add(size);
+    p2p_query_mutex_owner = std::thread::id();
+    p2p_query_mutex.unlock();
+    if(!async_replies.registered.test_and_set()) {
         std::lock_guard<std::mutex> lock(pending_results_mutex);
-        fulfilledList.push_back(pending_results_handle);
+        outstanding_replies_list.push_back(async_replies);
     }
 }
 
 void RPCManager::p2p_receive_loop() {
-    pthread_setname_np(pthread_self(), "rpc_thread");
-    auto max_payload_size = view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
+    using namespace remote_invocation_utilities;
+    name_and_pin_thread("rpc_thread");
     while(!thread_start) {
         std::unique_lock<std::mutex> lock(thread_start_mutex);
         thread_start_cv.wait(lock, [this]() { return thread_start; });
     }
-    whenlog(logger->debug("P2P listening thread started"););
+    rpc_log(DEBUG, "P2P listening thread started");
     while(!thread_shutdown) {
-        std::lock_guard<std::mutex> connections_lock(p2p_connections_mutex);
+        std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
         auto optional_reply_pair = connections->probe_all();
         if(optional_reply_pair) {
             auto reply_pair = optional_reply_pair.value();
-            p2p_message_handler(reply_pair.first, (char*)reply_pair.second, max_payload_size);
+            std::size_t payload_size;
+            Opcode indx;
+            node_id_t received_from;
+            retrieve_header(nullptr, reply_pair.second, payload_size, indx, received_from);
+            if(indx.is_reply
+               || (indx.class_id == std::type_index(typeid(RPCManager))
+                   && (indx.function_id == LARGE_REQUEST_DESCRIPTOR || indx.function_id == TARGETED_SEND_BODY))) {
+                // replies only fulfill results, so they don't hold anyone up;
+                // the large-message fetches are kept by this thread, and the
+                // bodies of targeted sends must not wait behind a worker
+                p2p_message_handler(reply_pair.first, (char*)reply_pair.second, connections->get_max_p2p_size());
+            } else {
+                dispatch_p2p_request(reply_pair.first, (char*)reply_pair.second);
+            }
+        }
+        // continue the fetches the window held back
+        fetch_large_replies();
+    }
+}
+
+void RPCManager::dispatch_p2p_request(node_id_t sender_id, char* msg_buf) {
+    using namespace remote_invocation_utilities;
+    std::size_t payload_size;
+    Opcode indx;
+    node_id_t received_from;
+    retrieve_header(nullptr, msg_buf, payload_size, indx, received_from);
+    // A fetched targeted send body is kept at once, like a small one. Only
+    // that: a LARGE_REPLY_FETCH sends a reply, so it goes to the worker of
+    // its sender, which is the only thread that sends replies to that node.
+    if(p2p_workers.empty()
+       || (indx.class_id == std::type_index(typeid(RPCManager)) && indx.function_id == TARGETED_SEND_BODY)) {
+        p2p_message_handler(sender_id, msg_buf, connections->get_max_p2p_size());
+        return;
+    }
+    // the sender may reuse the slot once we reply, so the worker gets a copy
+    P2PWorker& worker = *p2p_workers[sender_id % p2p_workers.size()];
+    std::vector<char> message(msg_buf, msg_buf + header_space() + payload_size);
+    {
+        std::lock_guard<std::mutex> lock(worker.queue_mutex);
+        worker.requests.push(P2PRequest{sender_id, std::move(message), (uint32_t)connections->get_max_p2p_size()});
+    }
+    worker.queue_cv.notify_one();
+}
+
+void RPCManager::p2p_worker_loop(P2PWorker& worker) {
+    name_and_pin_thread("p2p_worker");
+    while(true) {
+        P2PRequest request;
+        {
+            std::unique_lock<std::mutex> lock(worker.queue_mutex);
+            worker.queue_cv.wait(lock, [this, &worker]() { return thread_shutdown || !worker.requests.empty(); });
+            if(worker.requests.empty()) {
+                return;
+            }
+            request = std::move(worker.requests.front());
+            worker.requests.pop();
+        }
+        std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
+        // the sender may have left in a view change since
+        if(connections->contains_node(request.sender_id)) {
+            p2p_message_handler(request.sender_id, request.message.data(), request.buffer_size);
+        }
+    }
+}
+
+void RPCManager::external_client_loop() {
+    name_and_pin_thread("external_client");
+    while(!thread_start) {
+        std::unique_lock<std::mutex> lock(thread_start_mutex);
+        thread_start_cv.wait(lock, [this]() { return thread_start; });
+    }
+    rpc_log(DEBUG, "Serving external clients on port {}", getConfUInt16(CONF_DERECHO_EXTERNAL_PORT));
+    const uint64_t listener_tag = 0;
+    uint64_t next_client_tag = listener_tag + 1;
+    tcp::socket_poller poller;
+    poller.add(*external_listener, listener_tag);
+    while(!thread_shutdown) {
+        // wake up now and then to notice thread_shutdown
+        for(uint64_t tag : poller.wait(100)) {
+            if(tag == listener_tag) {
+                tcp::socket client = external_listener->accept();
+                if(external_clients.size() >= max_external_clients) {
+                    whenlog(logger->warn("Turning away an external client at {}: {} are connected already",
+                                         client.get_remote_ip(), external_clients.size()););
+                    continue;
+                }
+                poller.add(client, next_client_tag);
+                external_clients.emplace(next_client_tag++, ExternalConnection{std::move(client), {}, 0});
+                continue;
+            }
+            auto client_it = external_clients.find(tag);
+            if(client_it == external_clients.end()) {
+                continue;
+            }
+            if(!external_request_handler(client_it->second)) {
+                rpc_log(DEBUG, "External client at {} disconnected", client_it->second.socket.get_remote_ip());
+                poller.remove(client_it->second.socket);
+                external_clients.erase(client_it);
+            }
+        }
+    }
+}
+
+bool RPCManager::external_request_handler(ExternalConnection& client) {
+    using namespace remote_invocation_utilities;
+    const std::size_t header_size = header_space();
+    if(client.request.size() < header_size) {
+        client.request.resize(header_size);
+    }
+    // Readable with nothing to read means the client hung up
+    const ssize_t bytes_read = client.socket.read_partial(client.request.data() + client.bytes_read,
+                                                          client.request.size() - client.bytes_read);
+    if(bytes_read <= 0) {
+        return false;
+    }
+    client.bytes_read += bytes_read;
+    if(client.bytes_read < client.request.size()) {
+        return true;
+    }
+    std::size_t payload_size;
+    Opcode indx;
+    node_id_t received_from;
+    retrieve_header(nullptr, client.request.data(), payload_size, indx, received_from);
+    if(client.request.size() == header_size && payload_size > 0) {
+        // The header is in; read the payload as it arrives
+        if(payload_size > max_external_payload_size) {
+            whenlog(logger->warn("Disconnecting the external client at {}: its request of {} bytes is larger than max_payload_size ({})",
+                                 client.socket.get_remote_ip(), payload_size, max_external_payload_size););
+            return false;
+        }
+        client.request.resize(header_size + payload_size);
+        return true;
+    }
+    external_reply_buffer.clear();
+    if(indx.class_id == std::type_index(typeid(RPCManager))) {
+        if(indx.function_id != EXTERNAL_VIEW_REQUEST) {
+            return false;
+        }
+        std::shared_lock<ViewLock> view_read_lock(view_manager.view_mutex);
+        const View& view = *view_manager.curr_view;
+        external_reply_buffer.resize(header_size + mutils::bytes_size(view));
+        mutils::to_bytes(view, external_reply_buffer.data() + header_size);
+        populate_header(external_reply_buffer.data(), external_reply_buffer.size() - header_size,
+                        Opcode{typeid(RPCManager), 0, EXTERNAL_VIEW_REPLY, true}, nid);
+    } else {
+        if(indx.is_reply) {
+            return false;
+        }
+        wait_for_catch_up(indx.subgroup_id);
+        // the same lock the P2P thread runs the handlers under, so that they
+        // don't run during a view change
+        std::shared_lock<std::shared_timed_mutex> connections_lock(p2p_connections_mutex);
+        try {
+            receive_message(indx, received_from, client.request.data() + header_size, payload_size,
+                            [this](size_t size) -> char* {
+                                external_reply_buffer.resize(size);
+                                return external_reply_buffer.data();
+                            });
+        } catch(const std::out_of_range&) {
+            // This node has no handler for it, e.g. since it left the
+            // subgroup; the client finds out when the connection closes
+            rpc_log(DEBUG, "External client at {} called a function of subgroup {} that this node does not serve",
+                           client.socket.get_remote_ip(), indx.subgroup_id);
+            return false;
         }
     }
+    // The next request starts with a header again
+    client.request.resize(header_size);
+    client.bytes_read = 0;
+    return external_reply_buffer.empty() || client.socket.write(external_reply_buffer.data(), external_reply_buffer.size());
 }
 }  // namespace rpc
 }  // namespace derecho
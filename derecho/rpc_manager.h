@@ -6,19 +6,28 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <exception>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 
 #include "derecho_internal.h"
 #include "derecho_type_definitions.h"
+#include "metrics.h"
 #include "mutils-serialization/SerializationSupport.hpp"
 #include "p2p_connections.h"
 #include "remote_invocable.h"
 #include "rpc_utils.h"
+#include "tcp/tcp.h"
 #include "view.h"
 #include "view_manager.h"
 
@@ -31,15 +40,99 @@ class ExternalCaller;
 
 namespace rpc {
 
+/**
+ * One ordered send of a Group::send_batch, made by Replicated<T>::batched_send.
+ * Its arguments are held by reference, so it must be sent in the statement
+ * that makes it, or its arguments must outlive it.
+ */
+struct BatchedSend {
+    subgroup_id_t subgroup_id;
+    /** Empty means the whole shard */
+    std::vector<node_id_t> destination_nodes;
+    /** The size of the serialized arguments */
+    std::size_t payload_size;
+    /** The function_index of the function it calls, for a compact header */
+    uint32_t function_index;
+    /** Serializes the RPC message into a send buffer, after its destination
+     * list, with an RPC header unless headers are compact, and returns the
+     * handle of its (unused) results */
+    std::function<PendingBase&(char* buffer, std::size_t max_payload_size, bool rpc_header)> serialize;
+};
+
+/**
+ * The queries this node has multicast to the whole shard in one subgroup, in
+ * the order it sent them, each waiting for its multicast to be delivered so
+ * that its repliers are known. The sending thread pushes and the delivery
+ * thread pops, and neither takes a lock: it is a singly linked list with one
+ * producer and one consumer, whose popped nodes the producer takes back for
+ * its later pushes, so memory is only allocated while the queue is longer
+ * than it has been before.
+ *
+ * Sends in a subgroup are serialized by its send buffer, which has one
+ * message reserved at a time, so a query is pushed while its buffer is
+ * reserved and before it is sent; the producer is then never more than one
+ * thread at a time, and a query is always in the queue before its delivery.
+ */
+class FulfillmentQueue {
+    struct node {
+        PendingBase* pending = nullptr;
+        std::atomic<node*> next{nullptr};
+    };
+    /** The last node popped, whose successor is the front; the consumer's */
+    std::atomic<node*> head;
+    /** The producer's: the last node pushed, and the oldest node it hasn't
+     * reused yet, which it may reuse until it reaches head */
+    node* tail;
+    node* first_unused;
+
+    node* get_node() {
+        if(first_unused != head.load(std::memory_order_acquire)) {
+            node* reused = first_unused;
+            first_unused = first_unused->next.load(std::memory_order_relaxed);
+            return reused;
+        }
+        return new node;
+    }
+
+public:
+    FulfillmentQueue() : head(new node), tail(head.load()), first_unused(tail) {}
+    FulfillmentQueue(const FulfillmentQueue&) = delete;
+    ~FulfillmentQueue() {
+        while(first_unused) {
+            node* next = first_unused->next.load(std::memory_order_relaxed);
+            delete first_unused;
+            first_unused = next;
+        }
+    }
+
+    void push(PendingBase& pending) {
+        node* pushed = get_node();
+        pushed->pending = &pending;
+        pushed->next.store(nullptr, std::memory_order_relaxed);
+        tail->next.store(pushed, std::memory_order_release);
+        tail = pushed;
+    }
+    /** Removes the oldest query, or returns nullptr if there is none. */
+    PendingBase* pop() {
+        node* front = head.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+        if(!front) {
+            return nullptr;
+        }
+        PendingBase* pending = front->pending;
+        head.store(front, std::memory_order_release);
+        return pending;
+    }
+};
+
 class RPCManager {
     static_assert(std::is_trivially_copyable<Opcode>::value, "Oh no! Opcode is not trivially copyable!");
     /** The ID of the node this RPCManager is running on. */
     const node_id_t nid;
-    /** A map from FunctionIDs to RPC functions, either the "server" stubs that receive
+    /** A table from FunctionIDs to RPC functions, either the "server" stubs that receive
      * remote calls to invoke functions, or the "client" stubs that receive responses
      * from the targets of an earlier remote call.
      * Note that a FunctionID is (class ID, subgroup ID, Function Tag). */
-    std::unique_ptr<std::map<Opcode, receive_fun_t>> receivers;
+    std::unique_ptr<ReceiverTable> receivers;
     /** An emtpy DeserializationManager, in case we need it later. */
     // mutils::DeserializationManager dsm{{}};
     // Weijia: I prefer the deserialization context vector.
@@ -58,16 +151,111 @@ class RPCManager {
     /** Contains an RDMA connection to each member of the group. */
     std::unique_ptr<sst::P2PConnections> connections;
 
-    std::mutex p2p_connections_mutex;
-    /** This mutex guards both toFulfillQueue and fulfilledList. */
+    /** Locked exclusively to replace the connections, and shared by the
+     * threads that use them. */
+    std::shared_timed_mutex p2p_connections_mutex;
+    /** The registry's counters of the P2P messages sent, by [whether it is a query] */
+    std::array<MetricCounter*, 2> p2p_sends_by_kind;
+    MetricCounter* p2p_sent_bytes;
+    /** The registry ID of the gauge that reads the P2P query windows */
+    uint64_t p2p_window_reader_id;
+    /** Where pick_shard_member starts looking, so that ties go round-robin */
+    std::atomic<uint32_t> next_pick_start{0};
+    /** The whole-shard queries this node has sent and not yet delivered, by
+     * subgroup ID. Only new_view_callback adds queues, while the view is
+     * locked exclusively, so no send or delivery is using them. */
+    std::vector<std::unique_ptr<FulfillmentQueue>> fulfillment_queues;
+    /** This mutex guards outstanding_replies_list. */
     std::mutex pending_results_mutex;
-    std::queue<std::reference_wrapper<PendingBase>> toFulfillQueue;
-    std::list<std::reference_wrapper<PendingBase>> fulfilledList;
+    /** The PendingResultsSlabs and AsyncReplies that queries have been sent
+     * for, whose replies fail when their nodes are removed. */
+    std::list<std::reference_wrapper<OutstandingRepliesBase>> outstanding_replies_list;
+
+    /** An RPC message delivered in a subgroup that is catching up, kept
+     * without its headers until the subgroup's state is in */
+    struct CaughtUpMessage {
+        node_id_t sender_id;
+        Opcode opcode;
+        node_id_t received_from;
+        std::vector<char> message;
+        bool to_whole_shard;
+    };
+    /** The subgroups whose state is being received in the background, and
+     * the messages delivered in each meanwhile, in order. Guarded by
+     * catch_up_mutex, which is also held while they are replayed. */
+    std::map<subgroup_id_t, std::vector<CaughtUpMessage>> catching_up;
+    std::mutex catch_up_mutex;
+    /** Notified when a subgroup is done catching up. */
+    std::condition_variable catch_up_cv;
+    /** The size of catching_up, so that rpc_message_handler only takes
+     * catch_up_mutex while some subgroup is catching up. */
+    std::atomic<uint32_t> num_catching_up{0};
 
     /** This is not accessed outside invocations of rpc_message_handler,
      * it's just a member so it won't be newly allocated every time. */
     std::unique_ptr<char[]> replySendBuffer;
 
+    /** The messages of the large-reply protocol, which carry replies too large
+     * for a P2P message. Their opcodes have the class_id of RPCManager. */
+    enum LargeReplyMessage : FunctionTag {
+        /** Sent instead of a large reply: its id and size */
+        LARGE_REPLY_DESCRIPTOR,
+        /** A P2P query for the fragment of a large reply at an offset */
+        LARGE_REPLY_FETCH,
+        /** The reply to a LARGE_REPLY_FETCH: the id, the offset and the data */
+        LARGE_REPLY_FRAGMENT,
+        /** Sent instead of a P2P send or query too large for a P2P slot: its
+         * id and size. The receiver fetches it like a large reply. */
+        LARGE_REQUEST_DESCRIPTOR,
+        /** The body of a targeted send, sent by P2P to each of its
+         * destinations: its id and the RPC message, header included */
+        TARGETED_SEND_BODY
+    };
+    /** Set in the node count of the destination list of a targeted send's
+     * placeholder, which has the id of its body after the list */
+    static constexpr std::size_t TARGETED_SEND_FLAG = std::size_t(1) << 63;
+    /** TARGETED_SEND_FLAG, for the 32-bit node count of a compact header */
+    static constexpr uint32_t COMPACT_TARGETED_SEND_FLAG = uint32_t(1) << 31;
+    /** A large reply, or a large request, kept until the node it is for
+     * has fetched all of it */
+    struct LargeReply {
+        node_id_t requester;
+        /** The reply message, header included */
+        std::vector<char> message;
+        std::size_t bytes_fetched;
+    };
+    /** A large reply being fetched */
+    struct LargeReplyFetch {
+        std::vector<char> message;
+        /** The offset of the next fragment to ask for */
+        std::size_t fetch_offset;
+        std::size_t bytes_received;
+        /** True if it is a P2P send or query, to be handled once it is here */
+        bool is_request;
+    };
+    /** Large replies and requests of this node by id; guarded by
+     * large_replies_mutex, since the multicast and P2P threads send replies
+     * and application threads send requests. */
+    std::map<uint64_t, LargeReply> large_replies;
+    uint64_t next_large_reply_id = 0;
+    std::mutex large_replies_mutex;
+    /** The large replies being fetched from other nodes, by the node and the
+     * reply id. Only used by the P2P thread and new_view_callback, under
+     * p2p_connections_mutex. */
+    std::map<std::pair<node_id_t, uint64_t>, LargeReplyFetch> large_reply_fetches;
+    /** The bodies of targeted sends that have arrived and whose placeholders
+     * have not been delivered yet, by the sender and the body id */
+    std::map<std::pair<node_id_t, uint64_t>, std::vector<char>> targeted_bodies;
+    std::mutex targeted_bodies_mutex;
+    /** Notified when a body is added to targeted_bodies */
+    std::condition_variable targeted_bodies_cv;
+    std::atomic<uint64_t> next_targeted_body_id{0};
+
+    /** Held from getting a P2P query buffer until it is sent, since the P2P
+     * thread sends queries too, for the fragments of large replies. */
+    std::mutex p2p_query_mutex;
+    std::atomic<std::thread::id> p2p_query_mutex_owner;
+
     bool thread_start = false;
     /** Mutex for thread_start_cv. */
     std::mutex thread_start_mutex;
@@ -76,9 +264,92 @@ class RPCManager {
     std::atomic<bool> thread_shutdown{false};
     std::thread rpc_thread;
 
+    /** A P2P send or query waiting for a worker, copied out of its receive slot */
+    struct P2PRequest {
+        node_id_t sender_id;
+        std::vector<char> message;
+        uint32_t buffer_size;
+    };
+    /** A thread that runs the handlers of the P2P requests of some nodes */
+    struct P2PWorker {
+        std::thread thread;
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::queue<P2PRequest> requests;
+    };
+    /** The P2P workers; a node's requests go to the worker numbered (node ID
+     * modulo the number of workers). Empty if p2p_worker_threads is 0, in
+     * which case rpc_thread runs the handlers. */
+    std::vector<std::unique_ptr<P2PWorker>> p2p_workers;
+
     /** Listens for P2P RPC calls over the RDMA P2P connections and handles them. */
     void p2p_receive_loop();
 
+    /** Runs the P2P requests queued for a worker, in order. */
+    void p2p_worker_loop(P2PWorker& worker);
+
+    /**
+     * Handles a P2P send or query from another node on the P2P thread, or
+     * queues a copy of it for the node's worker if there are workers.
+     * @param sender_id The ID of the node that sent the message
+     * @param msg_buf The message, header included
+     */
+    void dispatch_p2p_request(node_id_t sender_id, char* msg_buf);
+
+    /** Accepts the TCP connections of external clients, which are not
+     * members of the group; null unless CONF_DERECHO_EXTERNAL_PORT is set. */
+    std::unique_ptr<tcp::connection_listener> external_listener;
+    /** The most external clients that may be connected at once */
+    const uint32_t max_external_clients;
+    /** The largest payload of an external client's request; a client that
+     * announces a larger one is disconnected. */
+    const std::size_t max_external_payload_size;
+    /** The largest P2P send or query, header included, that this node sends:
+     * a request of max_payload_size. Larger ones than a P2P slot holds are
+     * sent as large requests. */
+    const std::size_t max_p2p_request_size;
+    /** Whether P2P requests to ordered and sequenced subgroups wait for the
+     * read index, per CONF_DERECHO_LINEARIZABLE_P2P_QUERIES */
+    const bool linearizable_p2p_queries;
+    /** The smallest ordered send to part of a shard that is sent as a
+     * targeted send, per CONF_DERECHO_TARGETED_SEND_THRESHOLD; 0 if none is */
+    const uint64_t targeted_send_threshold;
+    /** Whether ordered sends have a compact header, per
+     * CONF_DERECHO_COMPACT_RPC_HEADERS: the destination list's node count
+     * is 32 bits, followed by the 32-bit function_index of the function,
+     * and there is no RPC header after the list. */
+    const bool compact_rpc_headers;
+    /** An external client's connection, and the part of its next request
+     * that has been read so far. Requests are read as their bytes arrive,
+     * so that a slow client doesn't hold up the others. */
+    struct ExternalConnection {
+        tcp::socket socket;
+        /** The request being read, header first; its size is what is
+         * expected so far, the header's until the header has been read */
+        std::vector<char> request;
+        std::size_t bytes_read = 0;
+    };
+    /** The connected external clients, by their tag in the socket_poller.
+     * Only used by external_client_thread. */
+    std::map<uint64_t, ExternalConnection> external_clients;
+    /** The replies to external clients are written in this; a member so it
+     * isn't reallocated every time. */
+    std::vector<char> external_reply_buffer;
+    /** Serves the requests of all the external clients, from one epoll set. */
+    std::thread external_client_thread;
+
+    /** Accepts external clients and handles their requests. */
+    void external_client_loop();
+
+    /**
+     * Reads the bytes an external client has sent so far, without blocking,
+     * and once they complete a request, handles it and replies over the same
+     * connection.
+     * @param client The client, whose socket has data to read
+     * @return false if the connection should be closed
+     */
+    bool external_request_handler(ExternalConnection& client);
+
     /**
      * Handler to be called by rpc_process_loop each time it receives a
      * peer-to-peer message over an RDMA P2P connection.
@@ -119,15 +390,132 @@ class RPCManager {
     std::exception_ptr parse_and_receive(char* buf, std::size_t size,
                                          const std::function<char*(int)>& out_alloc);
 
+    /**
+     * Handles an RPC message that this node is a destination of, once its
+     * headers have been read, and replies to its sender if needed.
+     * @param subgroup_id The subgroup the message was delivered in
+     * @param sender_id The ID of the node that sent the message
+     * @param indx The function opcode of the message
+     * @param received_from The sender in the RPC header, if it had one
+     * @param msg_buf The serialized arguments
+     * @param payload_size The size of the arguments, in bytes
+     * @param to_whole_shard True if the message was sent to the whole shard
+     */
+    void handle_rpc_message(subgroup_id_t subgroup_id, node_id_t sender_id, const Opcode& indx,
+                            node_id_t received_from, char* msg_buf, uint32_t payload_size,
+                            bool to_whole_shard);
+
+    /** The most data a LARGE_REPLY_FRAGMENT can carry */
+    std::size_t large_reply_fragment_size();
+
+    /**
+     * Keeps a reply too large for a P2P message, and sends the requester a
+     * LARGE_REPLY_DESCRIPTOR for it instead, so that it fetches the reply
+     * with LARGE_REPLY_FETCH queries.
+     * @param requester The ID of the node that the reply is for
+     * @param type The kind of reply, RPC_REPLY or P2P_REPLY
+     * @param message The reply message, header included
+     */
+    void send_large_reply(node_id_t requester, sst::REQUEST_TYPE type, std::vector<char>&& message);
+
+    /**
+     * Keeps a P2P send or query too large for a P2P slot, and sends a
+     * LARGE_REQUEST_DESCRIPTOR for it in its slot instead, so that the
+     * destination fetches it with LARGE_REPLY_FETCH queries. The caller
+     * holds the slot, from get_sendbuffer_ptr.
+     * @param dest_id The ID of the node that the request is for
+     * @param type The kind of request, P2P_QUERY or P2P_SEND
+     * @param message The request message, header included
+     */
+    void send_large_request(node_id_t dest_id, sst::REQUEST_TYPE type, std::vector<char>&& message);
+
+    /**
+     * @throws message_too_large_exception if a P2P request of this size,
+     * header included, is larger than max_p2p_request_size
+     */
+    void check_p2p_request_size(std::size_t size) const;
+
+    /**
+     * Handles a message of the large-reply protocol; called by
+     * p2p_message_handler.
+     * @param sender_id The ID of the node that sent the message
+     * @param type The LargeReplyMessage
+     * @param buf The payload of the message
+     * @param payload_size The size of the payload
+     */
+    void large_reply_message_handler(node_id_t sender_id, FunctionTag type,
+                                     char const* const buf, std::size_t payload_size);
+
+    /**
+     * Sends LARGE_REPLY_FETCH queries for the large replies being fetched,
+     * as far as the P2P window allows. Called by the P2P thread, which must
+     * not wait for the window since it is the one that frees it.
+     */
+    void fetch_large_replies();
+
+    /**
+     * Keeps the body of a targeted send that arrived by P2P until its
+     * placeholder is delivered; called by large_reply_message_handler.
+     * @param sender_id The ID of the node that sent it
+     * @param buf The payload of the TARGETED_SEND_BODY message
+     * @param payload_size The size of the payload
+     */
+    void receive_targeted_body(node_id_t sender_id, char const* const buf, std::size_t payload_size);
+
+    /**
+     * Waits for the body of a targeted send whose placeholder has been
+     * delivered, and removes it from targeted_bodies.
+     * @param sender_id The ID of the node that sent it
+     * @param body_id The id in the placeholder
+     * @return The RPC message, header included, or an empty vector if the
+     * RPCManager shut down first
+     */
+    std::vector<char> wait_for_targeted_body(node_id_t sender_id, uint64_t body_id);
+
+    /**
+     * Adds the PendingResultsSlab of a query to outstanding_replies_list,
+     * unless it is there already.
+     * @param pending_results_handle The PendingResults of the query
+     */
+    void track_outstanding_replies(const PendingBase& pending_results_handle);
+    /** Creates the P2P counters in the MetricsRegistry and registers the gauge of the query windows */
+    void register_metrics();
+
 public:
+    /** The messages that external clients exchange with members besides
+     * their P2P sends and queries. Their opcodes have the class_id of
+     * RPCManager, and function tags after those of LargeReplyMessage. */
+    enum ExternalClientMessage : FunctionTag {
+        /** Asks for the member's current View */
+        EXTERNAL_VIEW_REQUEST = 16,
+        /** The reply to EXTERNAL_VIEW_REQUEST: the serialized View */
+        EXTERNAL_VIEW_REPLY
+    };
+
     RPCManager(ViewManager& group_view_manager)
             : nid(getConfUInt32(CONF_DERECHO_LOCAL_ID)),
               receivers(new std::decay_t<decltype(*receivers)>()),
               whenlog(logger(spdlog::get("derecho_debug_log")), )
                       view_manager(group_view_manager),
-              connections(std::make_unique<sst::P2PConnections>(sst::P2PParams{nid, {nid}, group_view_manager.derecho_params.window_size, group_view_manager.derecho_params.max_payload_size})),
-              replySendBuffer(new char[group_view_manager.derecho_params.max_payload_size]) {
+              connections(std::make_unique<sst::P2PConnections>(sst::P2PParams{nid, {nid}, group_view_manager.derecho_params.window_size, group_view_manager.derecho_params.p2p_payload_size()})),
+              replySendBuffer(new char[group_view_manager.derecho_params.max_payload_size]),
+              max_external_clients(getConfUInt32(CONF_DERECHO_MAX_EXTERNAL_CLIENTS)),
+              max_external_payload_size(group_view_manager.derecho_params.max_payload_size),
+              max_p2p_request_size(remote_invocation_utilities::header_space() + group_view_manager.derecho_params.max_payload_size),
+              linearizable_p2p_queries(getConfBoolean(CONF_DERECHO_LINEARIZABLE_P2P_QUERIES)),
+              targeted_send_threshold(getConfUInt64(CONF_DERECHO_TARGETED_SEND_THRESHOLD)),
+              compact_rpc_headers(getConfBoolean(CONF_DERECHO_COMPACT_RPC_HEADERS)) {
+        register_metrics();
+        const uint32_t num_p2p_workers = getConfUInt32(CONF_DERECHO_P2P_WORKER_THREADS);
+        for(uint32_t i = 0; i < num_p2p_workers; i++) {
+            p2p_workers.emplace_back(std::make_unique<P2PWorker>());
+            p2p_workers.back()->thread = std::thread(&RPCManager::p2p_worker_loop, this, std::ref(*p2p_workers.back()));
+        }
         rpc_thread = std::thread(&RPCManager::p2p_receive_loop, this);
+        if(getConfUInt16(CONF_DERECHO_EXTERNAL_PORT) != 0) {
+            external_listener = std::make_unique<tcp::connection_listener>(getConfUInt16(CONF_DERECHO_EXTERNAL_PORT));
+            external_client_thread = std::thread(&RPCManager::external_client_loop, this);
+        }
     }
 
     ~RPCManager();
@@ -216,22 +604,147 @@ public:
      */
     void rpc_message_handler(subgroup_id_t subgroup_id, node_id_t sender_id, char* msg_buf, uint32_t payload_size);
 
+    /**
+     * Starts queueing the RPC messages delivered in a subgroup, instead of
+     * handling them, while its state is received in the background.
+     * @param subgroup_id The subgroup that is catching up
+     */
+    void begin_catch_up(subgroup_id_t subgroup_id);
+
+    /**
+     * Handles the messages queued for a subgroup since begin_catch_up, in the
+     * order they were delivered, then lets its messages be handled as they
+     * are delivered again. Called once the subgroup's state is in.
+     * @param subgroup_id The subgroup that is done catching up
+     */
+    void finish_catch_up(subgroup_id_t subgroup_id);
+
+    /**
+     * Waits until a subgroup is not catching up, so that its state can be
+     * used; returns at once if it is not.
+     * @param subgroup_id The subgroup
+     */
+    void wait_for_catch_up(subgroup_id_t subgroup_id);
+
     /**
      * Writes the "list of destination nodes" header field into the given
-     * buffer, in preparation for sending an RPC message.
+     * buffer, in preparation for sending an RPC message. The list is the
+     * number of nodes, followed by their IDs in ascending order (see
+     * write_destination_list); no nodes means the whole shard.
+     * With compact RPC headers, the function_index of the function that the
+     * message calls goes after the node count.
+     * @param subgroup_id The subgroup the message is sent in
      * @param dest_nodes The list of destination nodes
      * @param buffer The buffer in which to write the header
      * @param max_payload_size Out parameter: the maximum size of a payload
      * that can be written to this buffer after the header has been written.
+     * @param function_index The function's function_index, for a compact
+     * header
      * @return The size of the header.
      */
-    int populate_nodelist_header(const std::vector<node_id_t>& dest_nodes, char* buffer,
-                                 std::size_t& max_payload_size);
+    int populate_nodelist_header(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                 char* buffer, std::size_t& max_payload_size,
+                                 uint32_t function_index = Opcode::NO_FUNCTION_INDEX);
+
+    /**
+     * @return The size of an ordered send with these arguments: its
+     * destination list, its RPC header unless headers are compact, and the
+     * arguments, which is what to get a send buffer for
+     * @param payload_size The size of the serialized arguments
+     */
+    std::size_t ordered_message_size(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                     std::size_t payload_size);
+
+    /**
+     * Decides whether an ordered send should be sent as a targeted send: its
+     * body by P2P to its destinations, and a placeholder by multicast.
+     * @param subgroup_id The subgroup the message is sent in
+     * @param dest_nodes The list of destination nodes; empty means the whole shard
+     * @param payload_size The size of the serialized arguments
+     * @return True if targeted sends are on, the message is at least
+     * targeted_send_threshold bytes, and some members of this node's shard
+     * are destinations but not all of them
+     */
+    bool use_targeted_send(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                           std::size_t payload_size);
+
+    /**
+     * @return The size of the placeholder of a targeted send to these
+     * destinations, to get a multicast buffer for
+     */
+    std::size_t targeted_placeholder_size(const std::vector<node_id_t>& dest_nodes);
+
+    /**
+     * The destinations of an ordered send are listed by node ID, not by
+     * shard rank: a message that is still undelivered when the view changes
+     * is sent again in the next view with the list it was written with, and
+     * must pick out the same members there.
+     * @return The size of the node IDs of a destination list of this many
+     * nodes, which is padded to a whole number of 64-bit words
+     */
+    static std::size_t destination_list_size(std::size_t num_dest_nodes);
+
+    /**
+     * Writes the node IDs of a destination list, in ascending order and
+     * padded as destination_list_size says; the node count goes before them.
+     * @return The number of bytes written
+     */
+    static std::size_t write_destination_list(const std::vector<node_id_t>& dest_nodes, char* buffer);
+
+    /**
+     * @return Whether a node is in the node IDs of a destination list
+     * written by write_destination_list
+     * @param list The node IDs
+     * @param num_dest_nodes The node count that went before them
+     */
+    static bool destination_list_contains(const char* list, std::size_t num_dest_nodes, node_id_t node_id);
+
+    /**
+     * Gets a buffer of this thread's to serialize the body of a targeted
+     * send into, with room in front for the TARGETED_SEND_BODY header.
+     * @param size The size of the RPC message, header included
+     */
+    char* get_targeted_body_buffer(std::size_t size);
+
+    /**
+     * Sends the body in this thread's targeted body buffer to each of its
+     * destinations by P2P, keeping it for this node if it is one, and then
+     * writes the placeholder that points to it into the multicast buffer.
+     * The bodies go out before the placeholder, so they are on their way to
+     * every destination by the time it is delivered. The caller holds a
+     * shared lock on the view.
+     * @param subgroup_id The subgroup the message is sent in
+     * @param dest_nodes The list of destination nodes
+     * @param placeholder The multicast buffer, from get_sendbuffer_ptr with
+     * targeted_placeholder_size()
+     */
+    void send_targeted_body(subgroup_id_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                            char* placeholder);
+
+    /**
+     * Sends several ordered sends, in the order given, possibly in different
+     * subgroups. The send buffers of all of them are reserved first, under
+     * one shared lock on the view, and then they are serialized and handed to
+     * the sender thread together. A subgroup has one message open at a time,
+     * so a batch that sends in a subgroup twice is sent in rounds.
+     * @param sends The sends, from Replicated<T>::batched_send
+     */
+    void send_batch(std::vector<BatchedSend>& sends);
+
+    /**
+     * Queues a query to the whole shard, whose send buffer is reserved, to
+     * learn its repliers when it is delivered. This must come before
+     * finish_rpc_send, so the query is queued before it can be delivered.
+     * @param subgroup_id The subgroup the query is sent in
+     * @param pending_results_handle The PendingResults of the query
+     */
+    void queue_shard_query(subgroup_id_t subgroup_id, PendingBase& pending_results_handle);
 
     /**
      * Sends the next message in the MulticastGroup's send buffer (which is
      * assumed to be an RPC message prepared by earlier functions) and registers
-     * the "promise object" in pending_results_handle to await replies.
+     * the "promise object" in pending_results_handle to await replies; a
+     * query to the whole shard is queued by queue_shard_query instead.
      * @param is_query True if this message represents a query (which expects replies),
      * false if it repesents a send (which does not)
      * @param dest_nodes The list of node IDs the message is being sent to
@@ -246,6 +759,16 @@ public:
      */
     volatile char* get_sendbuffer_ptr(uint32_t dest_id, sst::REQUEST_TYPE type);
 
+    /**
+     * Like get_sendbuffer_ptr, for a P2P send or query of a known size. A
+     * message too large for a P2P slot gets a buffer of this thread's
+     * instead, and finish_p2p_send sends it as a large request.
+     * @param size The size of the message, header included, in bytes
+     * @throws message_too_large_exception if the message's payload is larger
+     * than max_payload_size
+     */
+    volatile char* get_sendbuffer_ptr(uint32_t dest_id, sst::REQUEST_TYPE type, std::size_t size);
+
     /**
      * Sends the message in msg_buf to the node identified by dest_node over a
      * dedicated P2P connection, and registers the "promise object" in
@@ -253,12 +776,48 @@ public:
      * @param is_query True if this message represents a query (which expects replies),
      * false if it repesents a send (which does not)
      * @param dest_node The node to send the message to
-     * @param msg_buf A buffer containing the message
-     * @param size The size of the message, in bytes
+     * @param size The size of the message, header included, in bytes; only
+     * that much of the buffer is written to the remote node
      * @param pending_results_handle A reference to the "promise object" in the
      * send_return for this send.
      */
-    void finish_p2p_send(bool is_query, node_id_t dest_node, PendingBase& pending_results_handle);
+    void finish_p2p_send(bool is_query, node_id_t dest_node, std::size_t size, PendingBase& pending_results_handle);
+
+    /**
+     * Picks the member of a shard to send a P2P query to: the one with the
+     * fewest queries from this node awaiting a reply, weighed by how long
+     * its recent replies took. Members that were never queried go first, so
+     * that their latency gets measured, and ties go round-robin.
+     * @param subgroup_id The subgroup of the shard
+     * @param shard_num The shard
+     * @return The ID of the member to query
+     * @throws invalid_subgroup_exception if the shard has no member other
+     * than this node
+     */
+    node_id_t pick_shard_member(subgroup_id_t subgroup_id, uint32_t shard_num);
+
+    /**
+     * @return The number of shards of a subgroup in the current view
+     */
+    uint32_t get_num_shards(subgroup_id_t subgroup_id);
+
+    /**
+     * Like get_sendbuffer_ptr for a P2P query of a known size, but returns
+     * nullptr instead of waiting if the P2P window to the node is full.
+     * @throws message_too_large_exception as get_sendbuffer_ptr does, so that
+     * a caller that retries on nullptr doesn't retry forever
+     */
+    volatile char* try_get_query_buffer_ptr(uint32_t dest_id, std::size_t size);
+
+    /**
+     * Sends an asynchronous query prepared in the buffer from
+     * try_get_query_buffer_ptr.
+     * @param dest_node The node to send the query to
+     * @param size The size of the message, header included, in bytes
+     * @param async_replies The AsyncReplies holding the query's callback, so
+     * that it can be failed if the node is removed from the group
+     */
+    void finish_p2p_async_query(node_id_t dest_node, std::size_t size, OutstandingRepliesBase& async_replies);
 };
 
 //Now that RPCManager is finished being declared, we can declare these convenience types
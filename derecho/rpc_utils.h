@@ -6,18 +6,23 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <deque>
 #include <exception>
 #include <functional>
 #include <future>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <sstream>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <typeindex>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -58,10 +63,16 @@ using FunctionTag = unsigned long long;
  * std::tuple.
  */
 struct Opcode {
+    /** The function_index of opcodes that aren't for a class's RPC functions */
+    static constexpr uint32_t NO_FUNCTION_INDEX = 0xffffffff;
+
     std::type_index class_id = std::type_index(typeid(void));
     subgroup_id_t subgroup_id;
     FunctionTag function_id;
     bool is_reply;
+    /** The position of the function in its class's list of RPC functions,
+     * which is known at compile time; it indexes the ReceiverTable. */
+    uint32_t function_index = NO_FUNCTION_INDEX;
 };
 inline bool operator<(const Opcode& lhs, const Opcode& rhs) {
     return std::tie(lhs.class_id, lhs.subgroup_id, lhs.function_id, lhs.is_reply)
@@ -125,10 +136,93 @@ struct recv_ret {
  * some RPC message is received.
  */
 using receive_fun_t = std::function<recv_ret(
-        //        mutils::DeserializationManager* dsm,
-        mutils::RemoteDeserialization_v* rdv, const node_id_t&, const char* recv_buf,
+        mutils::DeserializationManager* dsm, const node_id_t&, const char* recv_buf,
         const std::function<char*(int)>& out_alloc)>;
 
+/**
+ * The RPC receive handlers of a node, by Opcode. The handlers of a subgroup's
+ * RPC functions are in a flat table for the subgroup, indexed by their
+ * function_index, so finding one takes two array indexings; any others, such
+ * as those of a second class using the same subgroup ID, are in a map.
+ */
+class ReceiverTable {
+    struct SubgroupHandlers {
+        std::type_index class_id = std::type_index(typeid(void));
+        /** By function_index, then is_reply */
+        std::vector<receive_fun_t> handlers;
+        /** The function tags, by function_index */
+        std::vector<FunctionTag> function_ids;
+    };
+    /** By subgroup ID */
+    std::vector<SubgroupHandlers> subgroup_handlers;
+    std::map<Opcode, receive_fun_t> other_handlers;
+
+    receive_fun_t* find_in_table(const Opcode& opcode) {
+        if(opcode.function_index == Opcode::NO_FUNCTION_INDEX
+           || opcode.subgroup_id >= subgroup_handlers.size()) {
+            return nullptr;
+        }
+        SubgroupHandlers& subgroup = subgroup_handlers[opcode.subgroup_id];
+        const std::size_t index = 2 * (std::size_t)opcode.function_index + opcode.is_reply;
+        if(subgroup.class_id != opcode.class_id || index >= subgroup.handlers.size()
+           || !subgroup.handlers[index]) {
+            return nullptr;
+        }
+        return &subgroup.handlers[index];
+    }
+
+public:
+    /**
+     * Adds a handler, unless there is one for the opcode already, like
+     * std::map::emplace.
+     */
+    void emplace(const Opcode& opcode, receive_fun_t handler) {
+        if(opcode.function_index != Opcode::NO_FUNCTION_INDEX) {
+            if(opcode.subgroup_id >= subgroup_handlers.size()) {
+                subgroup_handlers.resize(opcode.subgroup_id + 1);
+            }
+            SubgroupHandlers& subgroup = subgroup_handlers[opcode.subgroup_id];
+            if(subgroup.handlers.empty()) {
+                subgroup.class_id = opcode.class_id;
+            }
+            if(subgroup.class_id == opcode.class_id) {
+                const std::size_t index = 2 * (std::size_t)opcode.function_index + opcode.is_reply;
+                if(index >= subgroup.handlers.size()) {
+                    subgroup.handlers.resize(index + 1);
+                }
+                if(!subgroup.handlers[index]) {
+                    subgroup.handlers[index] = std::move(handler);
+                }
+                if(opcode.function_index >= subgroup.function_ids.size()) {
+                    subgroup.function_ids.resize(opcode.function_index + 1);
+                }
+                subgroup.function_ids[opcode.function_index] = opcode.function_id;
+                return;
+            }
+        }
+        other_handlers.emplace(opcode, std::move(handler));
+    }
+
+    /**
+     * Rebuilds the opcode of a call of a subgroup's RPC function from its
+     * function_index, for a message with a compact RPC header.
+     * @throws std::out_of_range if the subgroup has no such function
+     */
+    Opcode invoke_opcode(subgroup_id_t subgroup_id, uint32_t function_index) const {
+        const SubgroupHandlers& subgroup = subgroup_handlers.at(subgroup_id);
+        return Opcode{subgroup.class_id, subgroup_id, subgroup.function_ids.at(function_index), false, function_index};
+    }
+
+    /** @throws std::out_of_range if there is no handler for the opcode */
+    receive_fun_t& at(const Opcode& opcode) {
+        receive_fun_t* handler = find_in_table(opcode);
+        if(handler) {
+            return *handler;
+        }
+        return other_handlers.at(opcode);
+    }
+};
+
 /**
  * The type of map contained in a QueryResults::ReplyMap. The template parameter
  * should be the return type of the query.
@@ -136,6 +230,51 @@ using receive_fun_t = std::function<recv_ret(
 template <typename T>
 using reply_map = std::map<node_id_t, std::future<T>>;
 
+/**
+ * Tells the QueryResults of an RPC function call when every node it was sent
+ * to has replied (or has been removed from the group), so that it can be
+ * waited for without a thread blocked on a future.
+ */
+class ReplyNotifier {
+    std::mutex mutex;
+    bool all_replied = false;
+    std::function<void()> waiter;
+
+public:
+    /** Called by PendingResults once every reply is in */
+    void notify() {
+        std::function<void()> to_call;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            all_replied = true;
+            to_call = std::move(waiter);
+        }
+        if(to_call) {
+            to_call();
+        }
+    }
+
+    bool ready() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return all_replied;
+    }
+
+    /**
+     * Sets a function to call once every reply is in, on the thread that
+     * receives the last one.
+     * @return false if every reply is in already, in which case the
+     * function is not called
+     */
+    bool set_waiter(std::function<void()> w) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(all_replied) {
+            return false;
+        }
+        waiter = std::move(w);
+        return true;
+    }
+};
+
 /**
  * Data structure that (indirectly) holds a set of futures for a single RPC
  * function call; there is one future for each node contacted to make the
@@ -153,7 +292,10 @@ struct QueryResults {
     using type = Ret;
 
     map_fut pending_rmap;
-    QueryResults(map_fut pm) : pending_rmap(std::move(pm)) {}
+    /** Notified once every reply is in; see rpc_awaitable.h */
+    std::shared_ptr<ReplyNotifier> notifier;
+    QueryResults(map_fut pm, std::shared_ptr<ReplyNotifier> notifier)
+            : pending_rmap(std::move(pm)), notifier(std::move(notifier)) {}
 
     struct ReplyMap {
     private:
@@ -199,6 +341,7 @@ private:
 public:
     QueryResults(QueryResults&& o)
             : pending_rmap{std::move(o.pending_rmap)},
+              notifier{std::move(o.notifier)},
               replies{std::move(o.replies)} {}
     QueryResults(const QueryResults&) = delete;
 
@@ -241,6 +384,19 @@ struct QueryResults<void> {
     */
 };
 
+/**
+ * Abstract base type for the replies a RemoteInvoker is waiting for, so that
+ * RPCManager can fail the ones from a removed node without knowing their
+ * return types.
+ */
+class OutstandingRepliesBase {
+public:
+    /** Set by RPCManager once it keeps track of these replies */
+    std::atomic_flag registered = ATOMIC_FLAG_INIT;
+    virtual void set_exception_for_removed_node(const node_id_t&) = 0;
+    virtual ~OutstandingRepliesBase() {}
+};
+
 /**
  * Abstract base type for PendingResults. This allows us to store a pointer to
  * any template specialization of PendingResults without knowing the template
@@ -248,6 +404,8 @@ struct QueryResults<void> {
  */
 class PendingBase {
 public:
+    /** The PendingResultsSlab this belongs to, if any */
+    OutstandingRepliesBase* owner = nullptr;
     virtual void fulfill_map(const node_list_t&) = 0;
     virtual void set_exception_for_removed_node(const node_id_t&) = 0;
     virtual ~PendingBase() {}
@@ -276,13 +434,21 @@ private:
     std::future<std::map<node_id_t, std::promise<Ret>>> reply_promises_are_ready;
     std::map<node_id_t, std::promise<Ret>> reply_promises;
 
-    bool map_fulfilled = false;
+    std::atomic<bool> map_fulfilled{false};
     std::set<node_id_t> dest_nodes, responded_nodes;
+    std::shared_ptr<ReplyNotifier> notifier;
     whenlog(std::shared_ptr<spdlog::logger> logger;);
 
+    void notify_if_all_replied() {
+        if(responded_nodes.size() == dest_nodes.size()) {
+            notifier->notify();
+        }
+    }
+
 public:
     PendingResults()
-            : reply_promises_are_ready(promise_for_reply_promises.get_future())
+            : reply_promises_are_ready(promise_for_reply_promises.get_future()),
+              notifier(std::make_shared<ReplyNotifier>())
               whenlog(, logger(spdlog::get("derecho_debug_log"))) {
         whenlog(logger->trace("Created a PendingResults<{}>", typeid(Ret).name()););
     }
@@ -294,16 +460,19 @@ public:
     void fulfill_map(const node_list_t& who) {
         whenlog(logger->trace("Got a call to fulfill_map for PendingResults<{}>", typeid(Ret).name()););
         whenlog(logger->flush(););
-        map_fulfilled = true;
         std::unique_ptr<reply_map<Ret>> futures_map = std::make_unique<reply_map<Ret>>();
         std::map<node_id_t, std::promise<Ret>> promises_map;
         for(const auto& e : who) {
             futures_map->emplace(e, promises_map[e].get_future());
         }
         dest_nodes.insert(who.begin(), who.end());
+        map_fulfilled = true;
         whenlog(logger->trace("Setting a value for reply_promises_are_ready"););
         promise_for_reply_promises.set_value(std::move(promises_map));
         promise_for_pending_map.set_value(std::move(futures_map));
+        if(who.empty()) {
+            notifier->notify();
+        }
     }
 
     void set_exception_for_removed_node(const node_id_t& removed_nid) {
@@ -324,6 +493,7 @@ public:
             reply_promises = std::move(reply_promises_are_ready.get());
         }
         reply_promises.at(nid).set_value(v);
+        notify_if_all_replied();
     }
 
     void set_exception(const node_id_t& nid, const std::exception_ptr e) {
@@ -332,10 +502,20 @@ public:
             reply_promises = std::move(reply_promises_are_ready.get());
         }
         reply_promises.at(nid).set_exception(e);
+        notify_if_all_replied();
     }
 
     QueryResults<Ret> get_future() {
-        return QueryResults<Ret>{promise_for_pending_map.get_future()};
+        return QueryResults<Ret>{promise_for_pending_map.get_future(), notifier};
+    }
+
+    bool is_fulfilled() const {
+        return map_fulfilled;
+    }
+
+    /** True once every node that was called has replied or failed */
+    bool all_replied() const {
+        return map_fulfilled && responded_nodes.size() == dest_nodes.size();
     }
 };
 
@@ -352,6 +532,186 @@ struct PendingResults<void> : public PendingBase {
     QueryResults<void> get_future() { return QueryResults<void>{}; }
 };
 
+/**
+ * The callback of an asynchronous query. It is called once, by the thread
+ * that receives the reply, with the node that was queried and a pointer to
+ * its reply, which is only valid during the call; or, if the query failed,
+ * with a null reply and the exception it failed with. It should return
+ * quickly, since that thread receives all the P2P messages. A query fails
+ * with node_removed_from_group_exception during the view change that removes
+ * its node, so that callback must not send anything to the group.
+ */
+template <typename Ret>
+using reply_callback_t = std::function<void(const node_id_t&, Ret*, std::exception_ptr)>;
+
+/**
+ * The callbacks of the asynchronous queries in flight for one RPC function,
+ * by invocation ID. Unlike PendingResults, a query costs one entry here and
+ * no promises or futures.
+ * @tparam Ret The return type of the RPC function
+ */
+template <typename Ret>
+class AsyncReplies : public OutstandingRepliesBase {
+    struct AsyncQuery {
+        node_id_t dest_node;
+        reply_callback_t<Ret> callback;
+    };
+    std::mutex queries_mutex;
+    std::unordered_map<long int, AsyncQuery> queries;
+
+public:
+    void add(long int invocation_id, const node_id_t& dest_node, reply_callback_t<Ret>&& callback) {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        queries.emplace(invocation_id, AsyncQuery{dest_node, std::move(callback)});
+    }
+
+    /**
+     * Removes the callback of a query, if it is an asynchronous one.
+     * @return true if it was, in which case callback is set to it
+     */
+    bool take(long int invocation_id, reply_callback_t<Ret>& callback) {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        auto search = queries.find(invocation_id);
+        if(search == queries.end()) {
+            return false;
+        }
+        callback = std::move(search->second.callback);
+        queries.erase(search);
+        return true;
+    }
+
+    void set_exception_for_removed_node(const node_id_t& removed_nid) {
+        std::vector<reply_callback_t<Ret>> failed;
+        {
+            std::lock_guard<std::mutex> lock(queries_mutex);
+            for(auto it = queries.begin(); it != queries.end();) {
+                if(it->second.dest_node == removed_nid) {
+                    failed.emplace_back(std::move(it->second.callback));
+                    it = queries.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+        // outside the lock
+        for(auto& callback : failed) {
+            callback(removed_nid, nullptr, std::make_exception_ptr(node_removed_from_group_exception{removed_nid}));
+        }
+    }
+};
+
+/**
+ * A slab of reusable PendingResults for the queries of one RPC function. The
+ * invocation ID of a query names its slot, so a reply finds its
+ * PendingResults without a lookup, and a slot goes back on the free list as
+ * soon as all of its replies are in; the replies themselves live on in the
+ * QueryResults. Slots have stable addresses, so RPCManager can keep
+ * references to them until then.
+ * @tparam Ret The return type of the RPC function
+ */
+template <typename Ret>
+class PendingResultsSlab : public OutstandingRepliesBase {
+    struct Slot {
+        std::optional<PendingResults<Ret>> pending;
+        /** Incremented on every reuse, so that invocation IDs aren't */
+        uint32_t generation = 0;
+    };
+    std::mutex slab_mutex;
+    std::deque<Slot> slots;
+    std::vector<uint32_t> free_slots;
+
+    static long int make_invocation_id(uint32_t index, uint32_t generation) {
+        return (long int)(((uint64_t)generation << 32) | index);
+    }
+
+    /** Must be called with slab_mutex held */
+    PendingResults<Ret>* find(long int invocation_id) {
+        const uint32_t index = (uint32_t)((uint64_t)invocation_id & 0xffffffff);
+        const uint32_t generation = (uint32_t)((uint64_t)invocation_id >> 32);
+        if(index >= slots.size() || slots[index].generation != generation
+           || !slots[index].pending) {
+            return nullptr;
+        }
+        return &*slots[index].pending;
+    }
+
+    /** Must be called with slab_mutex held */
+    void recycle_if_done(long int invocation_id) {
+        const uint32_t index = (uint32_t)((uint64_t)invocation_id & 0xffffffff);
+        if(slots[index].pending->all_replied()) {
+            slots[index].pending.reset();
+            free_slots.push_back(index);
+        }
+    }
+
+public:
+    /**
+     * Takes a free slot, or a new one if there is none.
+     * @param invocation_id Set to the invocation ID of the query
+     */
+    PendingResults<Ret>& allocate(long int& invocation_id) {
+        std::lock_guard<std::mutex> lock(slab_mutex);
+        uint32_t index;
+        if(free_slots.empty()) {
+            index = slots.size();
+            slots.emplace_back();
+        } else {
+            index = free_slots.back();
+            free_slots.pop_back();
+        }
+        Slot& slot = slots[index];
+        slot.generation++;
+        slot.pending.emplace();
+        slot.pending->owner = this;
+        invocation_id = make_invocation_id(index, slot.generation);
+        return *slot.pending;
+    }
+
+    void set_value(long int invocation_id, const node_id_t& nid, const Ret& v) {
+        std::lock_guard<std::mutex> lock(slab_mutex);
+        PendingResults<Ret>* pending = find(invocation_id);
+        assert(pending);
+        pending->set_value(nid, v);
+        recycle_if_done(invocation_id);
+    }
+
+    void set_exception(long int invocation_id, const node_id_t& nid, const std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(slab_mutex);
+        PendingResults<Ret>* pending = find(invocation_id);
+        assert(pending);
+        pending->set_exception(nid, e);
+        recycle_if_done(invocation_id);
+    }
+
+    void set_exception_for_removed_node(const node_id_t& removed_nid) {
+        std::lock_guard<std::mutex> lock(slab_mutex);
+        for(uint32_t index = 0; index < slots.size(); index++) {
+            // the others haven't been sent yet
+            if(slots[index].pending && slots[index].pending->is_fulfilled()) {
+                slots[index].pending->set_exception_for_removed_node(removed_nid);
+                recycle_if_done(make_invocation_id(index, slots[index].generation));
+            }
+        }
+    }
+};
+
+/**
+ * Functions that return void get no replies, so their sends all share one
+ * PendingResults<void>, which does nothing.
+ */
+template <>
+class PendingResultsSlab<void> : public OutstandingRepliesBase {
+    PendingResults<void> pending;
+
+public:
+    PendingResults<void>& allocate(long int& invocation_id) {
+        invocation_id = mutils::long_rand();
+        return pending;
+    }
+
+    void set_exception_for_removed_node(const node_id_t&) {}
+};
+
 /**
  * Utility functions for manipulating the headers of RPC messages
  */
@@ -0,0 +1,154 @@
+/**
+ * @file sequence_ring.h
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "derecho_internal.h"
+
+namespace derecho {
+
+/**
+ * A ring buffer of values keyed by message sequence number, for tracking the
+ * messages of a subgroup between their arrival and their delivery (or
+ * persistence). Since the sequence numbers that are in flight at any time
+ * are dense and bounded by the window, a value's slot is simply its sequence
+ * number modulo the capacity, so lookups, inserts and removals don't search
+ * or allocate. The capacity should be preallocated to cover every sequence
+ * number that can be live at once; if an insert ever falls outside of it,
+ * the ring doubles in size rather than overwrite a live entry.
+ *
+ * Like a std::map, entries are visited in sequence number order, so front()
+ * is always the entry with the lowest sequence number.
+ */
+template <typename T>
+class SequenceRing {
+    std::vector<std::optional<T>> entries;
+    std::size_t count = 0;
+    /** The lowest and highest sequence numbers stored; only meaningful if count > 0 */
+    message_id_t lowest = 0;
+    message_id_t highest = 0;
+
+    std::optional<T>& entry(message_id_t seq) {
+        return entries[static_cast<std::size_t>(seq) % entries.size()];
+    }
+
+    /** Grows the ring until it can hold every sequence number in [low, high]. */
+    void grow_to_fit(message_id_t low, message_id_t high) {
+        std::size_t new_capacity = entries.empty() ? 1 : entries.size();
+        while(static_cast<std::size_t>(high - low) >= new_capacity) {
+            new_capacity *= 2;
+        }
+        if(new_capacity == entries.size()) {
+            return;
+        }
+        std::vector<std::optional<T>> old_entries(new_capacity);
+        old_entries.swap(entries);
+        if(count > 0) {
+            for(message_id_t seq = lowest; seq <= highest; ++seq) {
+                auto& old_entry = old_entries[static_cast<std::size_t>(seq) % old_entries.size()];
+                if(old_entry) {
+                    entry(seq) = std::move(old_entry);
+                }
+            }
+        }
+    }
+
+public:
+    SequenceRing(std::size_t capacity = 0) : entries(capacity) {}
+
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    std::size_t capacity() const { return entries.size(); }
+
+    /** The sequence number of the lowest entry; the ring must not be empty. */
+    message_id_t front_seq() const { return lowest; }
+    T& front() { return *entry(lowest); }
+
+    /** Stores value under seq, replacing any value already stored there. */
+    T& insert_or_assign(message_id_t seq, T value) {
+        const message_id_t new_lowest = count > 0 ? std::min(lowest, seq) : seq;
+        const message_id_t new_highest = count > 0 ? std::max(highest, seq) : seq;
+        if(entries.empty() || static_cast<std::size_t>(new_highest - new_lowest) >= entries.size()) {
+            grow_to_fit(new_lowest, new_highest);
+        }
+        auto& slot = entry(seq);
+        if(!slot) {
+            count++;
+        }
+        slot = std::move(value);
+        lowest = new_lowest;
+        highest = new_highest;
+        return *slot;
+    }
+
+    /** Returns a pointer to the value stored under seq, or nullptr if there is none. */
+    T* find(message_id_t seq) {
+        if(count == 0 || seq < lowest || seq > highest) {
+            return nullptr;
+        }
+        auto& slot = entry(seq);
+        return slot ? &*slot : nullptr;
+    }
+
+    T& at(message_id_t seq) {
+        T* value = find(seq);
+        if(!value) {
+            throw std::out_of_range("SequenceRing::at: no entry for sequence number " + std::to_string(seq));
+        }
+        return *value;
+    }
+
+    /** Removes the value stored under seq, if there is one. */
+    void erase(message_id_t seq) {
+        if(!find(seq)) {
+            return;
+        }
+        entry(seq).reset();
+        count--;
+        if(count == 0) {
+            return;
+        }
+        if(seq == lowest) {
+            while(!entry(lowest)) {
+                lowest++;
+            }
+        } else if(seq == highest) {
+            while(!entry(highest)) {
+                highest--;
+            }
+        }
+    }
+
+    void pop_front() { erase(lowest); }
+
+    /** Calls f(seq, value) on every entry, in sequence number order. */
+    template <typename Func>
+    void for_each(Func&& f) {
+        if(count == 0) {
+            return;
+        }
+        for(message_id_t seq = lowest; seq <= highest; ++seq) {
+            auto& slot = entry(seq);
+            if(slot) {
+                f(seq, *slot);
+            }
+        }
+    }
+
+    void clear() {
+        for(auto& slot : entries) {
+            slot.reset();
+        }
+        count = 0;
+    }
+};
+}  // namespace derecho
@@ -10,6 +10,7 @@
 
 #include "derecho_internal.h"
 #include "subgroup_function_tester.h"
+#include "view_manager.h"
 
 std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t> ip_and_ports_generator() {
     static int invocation_count = 0;
@@ -123,8 +124,16 @@ void test_provision_subgroups(const SubgroupInfo& subgroup_info,
                               View& curr_view) {
     int32_t initial_next_unassigned_rank = curr_view.next_unassigned_rank;
     std::cout << "View has these members: " << curr_view.members << std::endl;
+    if(prev_view) {
+        curr_view.previous_layouts = prev_view->is_adequately_provisioned ? ViewManager::layouts_by_type(*prev_view)
+                                                                          : prev_view->previous_layouts;
+    }
     for(const auto& subgroup_type : subgroup_info.membership_function_order) {
         subgroup_shard_layout_t subgroup_shard_views;
+        auto previous_layout = curr_view.previous_layouts.find(subgroup_type);
+        curr_view.previous_assignment = previous_layout != curr_view.previous_layouts.end()
+                                                ? &previous_layout->second
+                                                : nullptr;
         try {
             auto temp = subgroup_info.subgroup_membership_functions.at(subgroup_type)(curr_view, curr_view.next_unassigned_rank);
             subgroup_shard_views = std::move(temp);
@@ -133,6 +142,7 @@ void test_provision_subgroups(const SubgroupInfo& subgroup_info,
             std::cout << "next_unassigned_rank is " << curr_view.next_unassigned_rank << std::endl
                       << std::endl;
         } catch(subgroup_provisioning_exception& ex) {
+            curr_view.previous_assignment = nullptr;
             curr_view.is_adequately_provisioned = false;
             curr_view.next_unassigned_rank = initial_next_unassigned_rank;
             curr_view.subgroup_shard_views.clear();
@@ -173,6 +183,7 @@ void test_provision_subgroups(const SubgroupInfo& subgroup_info,
                     std::move(subgroup_shard_views[subgroup_index]));
         }
     }
+    curr_view.previous_assignment = nullptr;
 }
 
 std::unique_ptr<View> make_next_view(const View& curr_view,
@@ -4,8 +4,13 @@
  * @date Feb 28, 2017
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <list>
+#include <string>
 #include <vector>
 
+#include "conf/conf.hpp"
 #include "derecho_internal.h"
 #include "derecho_modes.h"
 #include "subgroup_functions.h"
@@ -34,12 +39,24 @@ ShardAllocationPolicy raw_even_sharding_policy(int num_shards, int nodes_per_sha
     return ShardAllocationPolicy{num_shards, true, nodes_per_shard, Mode::UNORDERED, {}, {}};
 }
 
+ShardAllocationPolicy fifo_even_sharding_policy(int num_shards, int nodes_per_shard) {
+    return ShardAllocationPolicy{num_shards, true, nodes_per_shard, Mode::FIFO, {}, {}};
+}
+
+ShardAllocationPolicy sequenced_even_sharding_policy(int num_shards, int nodes_per_shard) {
+    return ShardAllocationPolicy{num_shards, true, nodes_per_shard, Mode::SEQUENCED, {}, {}};
+}
+
 ShardAllocationPolicy custom_shards_policy(const std::vector<int>& num_nodes_by_shard,
                                            const std::vector<Mode>& delivery_modes_by_shard) {
     return ShardAllocationPolicy{static_cast<int>(num_nodes_by_shard.size()), false, -1, Mode::ORDERED,
                                  num_nodes_by_shard, delivery_modes_by_shard};
 }
 
+ShardAllocationPolicy standby_sharding_policy(int num_shards, int nodes_per_shard, int standbys_per_shard) {
+    return ShardAllocationPolicy{num_shards, true, nodes_per_shard, Mode::ORDERED, {}, {}, "", standbys_per_shard};
+}
+
 SubgroupAllocationPolicy one_subgroup_policy(const ShardAllocationPolicy& policy) {
     return SubgroupAllocationPolicy{1, true, {policy}};
 }
@@ -51,88 +68,288 @@ SubgroupAllocationPolicy identical_subgroups_policy(int num_subgroups, const Sha
 /**
  * Allocates members to a single subgroup, using that subgroup's
  * ShardAllocationPolicy, and pushes the resulting vector of SubViews onto the
- * back of previous_assignment's outer vector. This should be called
+ * back of the assignment's outer vector. This should be called
  * num_subgroups times, in order of subgroup number.
  * @param curr_view A reference to the same curr_view passed to operator()
  * @param next_unassigned_rank A reference to the same next_unassigned_rank
  * "cursor" passed to operator()
  * @param subgroup_policy The ShardAllocationPolicy to use for this subgroup
+ * @param assignment The layout being built
  * @return True if the subgroup was assigned successfully, false if the View
  * ran out of nodes and the subgroup could not be fully populated.
  */
-bool DefaultSubgroupAllocator::assign_subgroup(const View& curr_view, int& next_unassigned_rank, const ShardAllocationPolicy& subgroup_policy) {
+bool DefaultSubgroupAllocator::assign_subgroup(const View& curr_view, int& next_unassigned_rank, const ShardAllocationPolicy& subgroup_policy,
+                                               subgroup_shard_layout_t& assignment) {
+    const int standbys = subgroup_policy.standbys_per_shard;
     if(subgroup_policy.even_shards) {
         if(static_cast<int>(curr_view.members.size()) - next_unassigned_rank
-           < subgroup_policy.num_shards * subgroup_policy.nodes_per_shard) {
+           < subgroup_policy.num_shards * (subgroup_policy.nodes_per_shard + standbys)) {
             return false;
         }
     }
-    previous_assignment->emplace_back(std::vector<SubView>());
+    assignment.emplace_back(std::vector<SubView>());
     for(int shard_num = 0; shard_num < subgroup_policy.num_shards; ++shard_num) {
-        if(!subgroup_policy.even_shards && next_unassigned_rank + subgroup_policy.num_nodes_by_shard[shard_num] >= (int)curr_view.members.size()) {
+        if(!subgroup_policy.even_shards && next_unassigned_rank + subgroup_policy.num_nodes_by_shard[shard_num] + standbys >= (int)curr_view.members.size()) {
             return false;
         }
         int nodes_needed = subgroup_policy.even_shards ? subgroup_policy.nodes_per_shard : subgroup_policy.num_nodes_by_shard[shard_num];
         std::vector<node_id_t> desired_nodes(&curr_view.members[next_unassigned_rank],
-                                             &curr_view.members[next_unassigned_rank + nodes_needed]);
-        next_unassigned_rank += nodes_needed;
+                                             &curr_view.members[next_unassigned_rank + nodes_needed + standbys]);
+        next_unassigned_rank += nodes_needed + standbys;
+        // The standbys come last, and are the only members that don't send
+        std::vector<int> is_sender;
+        if(standbys > 0) {
+            is_sender.assign(nodes_needed, true);
+            is_sender.resize(nodes_needed + standbys, false);
+        }
         Mode delivery_mode = subgroup_policy.even_shards ? subgroup_policy.shards_mode : subgroup_policy.modes_by_shard[shard_num];
-        (*previous_assignment).back().emplace_back(curr_view.make_subview(desired_nodes, delivery_mode));
+        assignment.back().emplace_back(curr_view.make_subview(desired_nodes, delivery_mode, is_sender, subgroup_policy.profile));
     }
     return true;
 }
 
+SubView DefaultSubgroupAllocator::replace_with_standbys(const View& curr_view, int& next_unassigned_rank,
+                                                        const SubView& previous_shard) {
+    std::list<node_id_t> standbys;
+    for(std::size_t shard_rank = 0; shard_rank < previous_shard.members.size(); ++shard_rank) {
+        if(!previous_shard.is_sender[shard_rank] && curr_view.rank_of(previous_shard.members[shard_rank]) != -1) {
+            standbys.push_back(previous_shard.members[shard_rank]);
+        }
+    }
+    // The senders that are still in the View keep their places, and a standby
+    // takes the place of each one that isn't, before any unassigned node does
+    std::vector<node_id_t> members;
+    for(std::size_t shard_rank = 0; shard_rank < previous_shard.members.size(); ++shard_rank) {
+        if(!previous_shard.is_sender[shard_rank]) {
+            continue;
+        }
+        if(curr_view.rank_of(previous_shard.members[shard_rank]) != -1) {
+            members.push_back(previous_shard.members[shard_rank]);
+        } else if(!standbys.empty()) {
+            members.push_back(standbys.front());
+            standbys.pop_front();
+        } else if(next_unassigned_rank < static_cast<int>(curr_view.members.size())) {
+            members.push_back(curr_view.members[next_unassigned_rank++]);
+        } else {
+            throw subgroup_provisioning_exception();
+        }
+    }
+    std::vector<int> is_sender(members.size(), true);
+    is_sender.resize(members.size() + standbys.size(), false);
+    members.insert(members.end(), standbys.begin(), standbys.end());
+    return curr_view.make_subview(members, previous_shard.mode, is_sender, previous_shard.profile);
+}
+
 subgroup_shard_layout_t DefaultSubgroupAllocator::operator()(const View& curr_view,
                                                              int& next_unassigned_rank) {
-    if(previous_assignment) {
+    if(curr_view.previous_assignment) {
+        const subgroup_shard_layout_t& previous_assignment = *curr_view.previous_assignment;
         //Assume the new assignment will be the same as the previous except for a few changes
-        auto next_assignment = std::make_unique<subgroup_shard_layout_t>(*previous_assignment);
+        subgroup_shard_layout_t next_assignment(previous_assignment);
         for(int subgroup_num = 0; subgroup_num < policy.num_subgroups; ++subgroup_num) {
-            int num_shards_in_subgroup;
-            if(policy.identical_subgroups) {
-                num_shards_in_subgroup = policy.shard_policy_by_subgroup[0].num_shards;
-            } else {
-                num_shards_in_subgroup = policy.shard_policy_by_subgroup[subgroup_num].num_shards;
-            }
-            for(int shard_num = 0; shard_num < num_shards_in_subgroup; ++shard_num) {
+            const ShardAllocationPolicy& subgroup_policy
+                    = policy.shard_policy_by_subgroup[policy.identical_subgroups ? 0 : subgroup_num];
+            for(int shard_num = 0; shard_num < subgroup_policy.num_shards; ++shard_num) {
+                if(subgroup_policy.standbys_per_shard > 0) {
+                    next_assignment[subgroup_num][shard_num] = replace_with_standbys(
+                            curr_view, next_unassigned_rank, previous_assignment[subgroup_num][shard_num]);
+                    continue;
+                }
                 //Check each member of the shard in the previous assignment
                 for(std::size_t shard_rank = 0;
-                    shard_rank < (*previous_assignment)[subgroup_num][shard_num].members.size();
+                    shard_rank < previous_assignment[subgroup_num][shard_num].members.size();
                     ++shard_rank) {
-                    if(curr_view.rank_of((*previous_assignment)[subgroup_num][shard_num].members[shard_rank]) == -1) {
+                    if(curr_view.rank_of(previous_assignment[subgroup_num][shard_num].members[shard_rank]) == -1) {
                         //This node is not in the current view, so take the next available one
                         if(next_unassigned_rank >= static_cast<int>(curr_view.members.size())) {
                             throw subgroup_provisioning_exception();
                         }
-                        (*next_assignment)[subgroup_num][shard_num].members[shard_rank] = curr_view.members[next_unassigned_rank];
-                        (*next_assignment)[subgroup_num][shard_num].member_ips_and_ports[shard_rank] = curr_view.member_ips_and_ports[next_unassigned_rank];
+                        next_assignment[subgroup_num][shard_num].members[shard_rank] = curr_view.members[next_unassigned_rank];
+                        next_assignment[subgroup_num][shard_num].member_ips_and_ports[shard_rank] = curr_view.member_ips_and_ports[next_unassigned_rank];
                         next_unassigned_rank++;
                     }
                 }
                 //These will be initialized from scratch by the calling ViewManager
-                (*next_assignment)[subgroup_num][shard_num].joined.clear();
-                (*next_assignment)[subgroup_num][shard_num].departed.clear();
+                next_assignment[subgroup_num][shard_num].joined.clear();
+                next_assignment[subgroup_num][shard_num].departed.clear();
             }
         }
-        //If we reached this point without throwing an exception, the new assignment is adequate and can be saved
-        previous_assignment = std::move(next_assignment);
-    } else {
-        previous_assignment = std::make_unique<subgroup_shard_layout_t>();
+        // Vacant standby places are only refilled once every shard has its
+        // senders, and only from nodes no one else needs, so running short of
+        // standbys doesn't make the View inadequate
         for(int subgroup_num = 0; subgroup_num < policy.num_subgroups; ++subgroup_num) {
-            bool assignment_success;
-            if(policy.identical_subgroups) {
-                assignment_success = assign_subgroup(curr_view, next_unassigned_rank, policy.shard_policy_by_subgroup[0]);
-            } else {
-                assignment_success = assign_subgroup(curr_view, next_unassigned_rank, policy.shard_policy_by_subgroup[subgroup_num]);
+            const ShardAllocationPolicy& subgroup_policy
+                    = policy.shard_policy_by_subgroup[policy.identical_subgroups ? 0 : subgroup_num];
+            for(SubView& shard : next_assignment[subgroup_num]) {
+                const std::size_t num_standbys = shard.members.size() - shard.num_senders();
+                if(num_standbys >= static_cast<std::size_t>(subgroup_policy.standbys_per_shard)
+                   || next_unassigned_rank >= static_cast<int>(curr_view.members.size())) {
+                    continue;
+                }
+                std::vector<node_id_t> members(shard.members);
+                std::vector<int> is_sender(shard.is_sender);
+                for(std::size_t added = num_standbys;
+                    added < static_cast<std::size_t>(subgroup_policy.standbys_per_shard)
+                    && next_unassigned_rank < static_cast<int>(curr_view.members.size());
+                    ++added) {
+                    members.push_back(curr_view.members[next_unassigned_rank++]);
+                    is_sender.push_back(false);
+                }
+                shard = curr_view.make_subview(members, shard.mode, is_sender, shard.profile);
+            }
+        }
+        return next_assignment;
+    }
+    subgroup_shard_layout_t assignment;
+    for(int subgroup_num = 0; subgroup_num < policy.num_subgroups; ++subgroup_num) {
+        bool assignment_success;
+        if(policy.identical_subgroups) {
+            assignment_success = assign_subgroup(curr_view, next_unassigned_rank, policy.shard_policy_by_subgroup[0], assignment);
+        } else {
+            assignment_success = assign_subgroup(curr_view, next_unassigned_rank, policy.shard_policy_by_subgroup[subgroup_num], assignment);
+        }
+        if(!assignment_success) {
+            throw subgroup_provisioning_exception();
+        }
+    }
+    return assignment;
+}
+
+/**
+ * Parses a list of node_id:value pairs separated by commas, the format of the
+ * node_racks and node_capacities options.
+ */
+static std::map<node_id_t, uint32_t> parse_node_map(const std::string& conf_key, const std::string& map_string) {
+    std::map<node_id_t, uint32_t> values;
+    std::size_t start = 0;
+    while(start < map_string.size()) {
+        std::size_t end = map_string.find(',', start);
+        if(end == std::string::npos) end = map_string.size();
+        const std::string entry = map_string.substr(start, end - start);
+        unsigned int node, value;
+        char extra;
+        if(sscanf(entry.c_str(), " %u : %u %c", &node, &value, &extra) == 2) {
+            values[node] = value;
+        } else if(entry.find_first_not_of(" \t") != std::string::npos) {
+            printf("Ignoring malformed %s entry \"%s\"\n", conf_key.c_str(), entry.c_str());
+            fflush(stdout);
+        }
+        start = end + 1;
+    }
+    return values;
+}
+
+LocalityAwareSubgroupAllocator::LocalityAwareSubgroupAllocator(const SubgroupAllocationPolicy& allocation_policy)
+        : policy(allocation_policy),
+          node_capacities(parse_node_map(CONF_DERECHO_NODE_CAPACITIES, getConfString(CONF_DERECHO_NODE_CAPACITIES))) {
+    const std::string racks = getConfString(CONF_DERECHO_NODE_RACKS);
+    if(!racks.empty()) {
+        node_racks = parse_node_map(CONF_DERECHO_NODE_RACKS, racks);
+    } else {
+        node_racks = parse_node_map(CONF_DERECHO_RDMC_RACK_MAP, getConfString(CONF_DERECHO_RDMC_RACK_MAP));
+    }
+}
+
+uint64_t LocalityAwareSubgroupAllocator::rack_of(node_id_t node) const {
+    auto rack = node_racks.find(node);
+    // The listed racks are 32-bit, so an unlisted node's own domain can't collide with them
+    return rack != node_racks.end() ? rack->second : (uint64_t{1} << 32) | node;
+}
+
+uint32_t LocalityAwareSubgroupAllocator::capacity_of(node_id_t node) const {
+    auto capacity = node_capacities.find(node);
+    return capacity != node_capacities.end() ? capacity->second : 1;
+}
+
+int64_t LocalityAwareSubgroupAllocator::choose_member(const std::vector<node_id_t>& shard_members,
+                                                      const std::map<node_id_t, uint32_t>& shard_counts) const {
+    int64_t best = -1;
+    uint32_t best_rack_sharers = 0;
+    uint32_t best_count = 0;
+    uint32_t best_capacity = 1;
+    // shard_counts is ordered by node ID, so ties go to the lowest ID on every member
+    for(const auto& node_count : shard_counts) {
+        const node_id_t node = node_count.first;
+        const uint32_t count = node_count.second;
+        const uint32_t capacity = capacity_of(node);
+        if(count >= capacity
+           || std::find(shard_members.begin(), shard_members.end(), node) != shard_members.end()) {
+            continue;
+        }
+        uint32_t rack_sharers = 0;
+        for(const node_id_t member : shard_members) {
+            if(rack_of(member) == rack_of(node)) {
+                ++rack_sharers;
+            }
+        }
+        // Compare count / capacity without dividing
+        const uint64_t load = uint64_t{count} * best_capacity;
+        const uint64_t best_load = uint64_t{best_count} * capacity;
+        if(best == -1 || rack_sharers < best_rack_sharers
+           || (rack_sharers == best_rack_sharers && load < best_load)) {
+            best = node;
+            best_rack_sharers = rack_sharers;
+            best_count = count;
+            best_capacity = capacity;
+        }
+    }
+    return best;
+}
+
+subgroup_shard_layout_t LocalityAwareSubgroupAllocator::operator()(const View& curr_view,
+                                                                   int& next_unassigned_rank) {
+    // The nodes this allocator may use, and the number of its shards each one is in
+    std::map<node_id_t, uint32_t> shard_counts;
+    for(std::size_t rank = next_unassigned_rank; rank < curr_view.members.size(); ++rank) {
+        shard_counts[curr_view.members[rank]] = 0;
+    }
+    const subgroup_shard_layout_t* previous_assignment = curr_view.previous_assignment;
+    std::vector<std::vector<std::vector<node_id_t>>> members_by_shard(policy.num_subgroups);
+    // Keep every previous member that is still available first, so that the
+    // vacancies are filled around them
+    for(int subgroup_num = 0; subgroup_num < policy.num_subgroups; ++subgroup_num) {
+        const ShardAllocationPolicy& subgroup_policy
+                = policy.shard_policy_by_subgroup[policy.identical_subgroups ? 0 : subgroup_num];
+        members_by_shard[subgroup_num].resize(subgroup_policy.num_shards);
+        if(!previous_assignment) {
+            continue;
+        }
+        for(int shard_num = 0; shard_num < subgroup_policy.num_shards; ++shard_num) {
+            const std::size_t nodes_needed = subgroup_policy.even_shards ? subgroup_policy.nodes_per_shard
+                                                                         : subgroup_policy.num_nodes_by_shard[shard_num];
+            std::vector<node_id_t>& shard_members = members_by_shard[subgroup_num][shard_num];
+            for(const node_id_t member : (*previous_assignment)[subgroup_num][shard_num].members) {
+                auto available = shard_counts.find(member);
+                if(available != shard_counts.end() && available->second < capacity_of(member)
+                   && shard_members.size() < nodes_needed) {
+                    shard_members.push_back(member);
+                    available->second++;
+                }
             }
-            if(!assignment_success) {
-                //Delete the partially-created "previous assignment," since it won't be installed
-                previous_assignment.reset();
-                throw subgroup_provisioning_exception();
+        }
+    }
+    subgroup_shard_layout_t next_assignment(policy.num_subgroups);
+    for(int subgroup_num = 0; subgroup_num < policy.num_subgroups; ++subgroup_num) {
+        const ShardAllocationPolicy& subgroup_policy
+                = policy.shard_policy_by_subgroup[policy.identical_subgroups ? 0 : subgroup_num];
+        for(int shard_num = 0; shard_num < subgroup_policy.num_shards; ++shard_num) {
+            const std::size_t nodes_needed = subgroup_policy.even_shards ? subgroup_policy.nodes_per_shard
+                                                                         : subgroup_policy.num_nodes_by_shard[shard_num];
+            std::vector<node_id_t>& shard_members = members_by_shard[subgroup_num][shard_num];
+            while(shard_members.size() < nodes_needed) {
+                const int64_t chosen = choose_member(shard_members, shard_counts);
+                if(chosen == -1) {
+                    throw subgroup_provisioning_exception();
+                }
+                shard_members.push_back(chosen);
+                shard_counts[chosen]++;
             }
+            Mode delivery_mode = subgroup_policy.even_shards ? subgroup_policy.shards_mode : subgroup_policy.modes_by_shard[shard_num];
+            next_assignment[subgroup_num].emplace_back(curr_view.make_subview(shard_members, delivery_mode, {}, subgroup_policy.profile));
         }
     }
-    return *previous_assignment;
+    next_unassigned_rank = curr_view.members.size();
+    return next_assignment;
 }
 
 subgroup_shard_layout_t CrossProductAllocator::operator()(const View& curr_view,
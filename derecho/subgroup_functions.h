@@ -6,7 +6,9 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <string>
 
 #include "derecho_internal.h"
 #include "derecho_modes.h"
@@ -52,6 +54,20 @@ struct ShardAllocationPolicy {
      * indicating which delivery mode it should use. (Ignored if even_shards is
      * true). */
     std::vector<Mode> modes_by_shard;
+    /** The subgroup's profile, the name of the config file section (e.g.
+     * [SUBGROUP/bulk] for "bulk") whose settings replace the group's
+     * DerechoParams for this subgroup, so that e.g. a control subgroup can
+     * have small messages and a deep window while a bulk subgroup sends
+     * large messages. Empty to use the group's DerechoParams. */
+    std::string profile;
+    /** The number of hot standbys DefaultSubgroupAllocator adds to each shard
+     * on top of its members: members that receive and deliver every message,
+     * so their replicas and logs stay current, but never send. When one of a
+     * shard's senders fails, a standby takes its place as a sender, which
+     * needs no state transfer, and the standby's place is refilled from
+     * unassigned nodes if any are left over. The first layout needs every
+     * standby, as it does every member. */
+    int standbys_per_shard = 0;
 };
 
 struct SubgroupAllocationPolicy {
@@ -84,18 +100,46 @@ ShardAllocationPolicy even_sharding_policy(int num_shards, int nodes_per_shard);
  * @return A ShardAllocationPolicy value with these parameters.
  */
 ShardAllocationPolicy raw_even_sharding_policy(int num_shards, int nodes_per_shard);
+/**
+ * Returns a ShardAllocationPolicy that specifies num_shards shards with
+ * the same number of nodes in each shard, and every shard running in
+ * per-sender FIFO delivery mode.
+ * @param num_shards The number of shards to request in this policy.
+ * @param nodes_per_shard The number of nodes per shard to request.
+ * @return A ShardAllocationPolicy value with these parameters.
+ */
+ShardAllocationPolicy fifo_even_sharding_policy(int num_shards, int nodes_per_shard);
+/**
+ * Returns a ShardAllocationPolicy that specifies num_shards shards with
+ * the same number of nodes in each shard, and every shard running in
+ * leader-sequenced delivery mode.
+ * @param num_shards The number of shards to request in this policy.
+ * @param nodes_per_shard The number of nodes per shard to request.
+ * @return A ShardAllocationPolicy value with these parameters.
+ */
+ShardAllocationPolicy sequenced_even_sharding_policy(int num_shards, int nodes_per_shard);
 /**
  * Returns a ShardAllocationPolicy for a subgroup that has a different number of
  * members in each shard, and possibly has each shard in a different delivery mode.
  * Note that the two parameter vectors must be the same length.
  * @param num_nodes_by_shard A vector specifying how many nodes should be in each
  * shard; the ith shard will have num_nodes_by_shard[i] members.
- * @param delivery_modes_by_shard A vector specifying the delivery mode (Raw or
- * Ordered) for each shard, in the same order as the other vector.
+ * @param delivery_modes_by_shard A vector specifying the delivery mode (Raw,
+ * Ordered, FIFO or Sequenced) for each shard, in the same order as the other vector.
  * @return A ShardAllocationPolicy that specifies these shard sizes and modes.
  */
 ShardAllocationPolicy custom_shards_policy(const std::vector<int>& num_nodes_by_shard,
                                            const std::vector<Mode>& delivery_modes_by_shard);
+/**
+ * Returns a ShardAllocationPolicy that specifies num_shards ordered shards with
+ * the same number of nodes in each shard, each of which also has
+ * standbys_per_shard hot standbys (see ShardAllocationPolicy::standbys_per_shard).
+ * @param num_shards The number of shards to request in this policy.
+ * @param nodes_per_shard The number of sending nodes per shard to request.
+ * @param standbys_per_shard The number of standbys per shard to request.
+ * @return A ShardAllocationPolicy value with these parameters.
+ */
+ShardAllocationPolicy standby_sharding_policy(int num_shards, int nodes_per_shard, int standbys_per_shard);
 
 /**
  * Returns a SubgroupAllocationPolicy for a replicated type that only has a
@@ -121,25 +165,86 @@ SubgroupAllocationPolicy identical_subgroups_policy(int num_subgroups, const Sha
  * allocation algorithm, parameterized based on a SubgroupAllocationPolicy. Its
  * operator() will throw a subgroup_provisioning_exception if there are not
  * enough nodes in the current view to populate all of the subgroups and shards.
+ *
+ * If the View has a previous layout for the subgroup type, every member of it
+ * that is still in the View keeps its place, and only the departed members
+ * are replaced, so a membership change only costs state transfers to the
+ * replacements. A shard with standbys replaces a departed sender with one of
+ * them first, which costs no state transfer at all. Otherwise the shards
+ * take consecutive ranks, with each shard's standbys after its senders.
  */
 class DefaultSubgroupAllocator {
 protected:
-    std::unique_ptr<subgroup_shard_layout_t> previous_assignment;
     const SubgroupAllocationPolicy policy;
 
-    bool assign_subgroup(const View& curr_view, int& next_unassigned_rank, const ShardAllocationPolicy& subgroup_policy);
+    bool assign_subgroup(const View& curr_view, int& next_unassigned_rank, const ShardAllocationPolicy& subgroup_policy,
+                         subgroup_shard_layout_t& assignment);
+    /**
+     * Lays out a shard with standbys from its previous layout, promoting a
+     * surviving standby in place of each departed sender and falling back to
+     * unassigned nodes; vacant standby places are left for operator() to
+     * refill.
+     */
+    SubView replace_with_standbys(const View& curr_view, int& next_unassigned_rank,
+                                  const SubView& previous_shard);
 
 public:
     DefaultSubgroupAllocator(const SubgroupAllocationPolicy& allocation_policy)
             : policy(allocation_policy) {}
     DefaultSubgroupAllocator(const DefaultSubgroupAllocator& to_copy)
-            : previous_assignment(deep_pointer_copy(to_copy.previous_assignment)),
-              policy(to_copy.policy) {}
+            : policy(to_copy.policy) {}
     DefaultSubgroupAllocator(DefaultSubgroupAllocator&&) = default;
 
     subgroup_shard_layout_t operator()(const View& curr_view, int& next_unassigned_rank);
 };
 
+/**
+ * Functor of type shard_view_generator_t that allocates shards by the same
+ * SubgroupAllocationPolicy as DefaultSubgroupAllocator, but picks each
+ * shard's members by where they are and how busy they are instead of taking
+ * consecutive ranks. Each vacancy in a shard goes to the available node that
+ * shares a failure domain (node_racks) with the fewest of the shard's
+ * members, and among those to the one with the fewest shard memberships
+ * relative to its capacity (node_capacities); a node with a capacity above 1
+ * may be a member of several of this allocator's shards. Like
+ * DefaultSubgroupAllocator, it keeps every member of the View's previous
+ * layout that is still available in its place.
+ *
+ * It may use any node from next_unassigned_rank onward, so it claims all of
+ * them; it should be the last function in the membership function order. Its
+ * operator() throws a subgroup_provisioning_exception if those nodes can't
+ * fill every shard.
+ */
+class LocalityAwareSubgroupAllocator {
+    const SubgroupAllocationPolicy policy;
+    /** The failure domain of each node listed in node_racks */
+    std::map<node_id_t, uint32_t> node_racks;
+    /** The capacity of each node listed in node_capacities */
+    std::map<node_id_t, uint32_t> node_capacities;
+
+    /** A node's failure domain; an unlisted node is in one by itself */
+    uint64_t rack_of(node_id_t node) const;
+    uint32_t capacity_of(node_id_t node) const;
+    /**
+     * Picks the node that should fill a vacancy in a shard.
+     * @param shard_members The shard's members so far
+     * @param shard_counts The number of shards each available node is in
+     * @return The node, or -1 if no available node has room
+     */
+    int64_t choose_member(const std::vector<node_id_t>& shard_members,
+                          const std::map<node_id_t, uint32_t>& shard_counts) const;
+
+public:
+    LocalityAwareSubgroupAllocator(const SubgroupAllocationPolicy& allocation_policy);
+    LocalityAwareSubgroupAllocator(const LocalityAwareSubgroupAllocator& to_copy)
+            : policy(to_copy.policy),
+              node_racks(to_copy.node_racks),
+              node_capacities(to_copy.node_capacities) {}
+    LocalityAwareSubgroupAllocator(LocalityAwareSubgroupAllocator&&) = default;
+
+    subgroup_shard_layout_t operator()(const View& curr_view, int& next_unassigned_rank);
+};
+
 struct CrossProductPolicy {
     /** The (type, index) pair identifying the "source" subgroup of the cross-product.
      * Each member of this subgroup will be a sender in T subgroups, where T is the
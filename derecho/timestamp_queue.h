@@ -0,0 +1,80 @@
+/**
+ * @file timestamp_queue.h
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * The send timestamps of a subgroup's messages from this node that are still
+ * pending, in the order they were sent. The timestamps are taken as the
+ * messages are sent, so the oldest one, front(), is also the earliest and
+ * the queue never has to be searched for its minimum. Messages are almost
+ * always finished with in the order they were sent, so erasing one usually
+ * pops the front; erasing a later one only marks it, and it is dropped when
+ * it reaches the front.
+ *
+ * The entries are kept in a ring that only grows when more messages are
+ * pending than it has ever held before, so in steady state adding and
+ * removing timestamps doesn't allocate.
+ */
+class TimestampQueue {
+    struct entry {
+        uint64_t timestamp;
+        bool erased;
+    };
+    std::vector<entry> entries;
+    /** The position of the oldest entry, and the number of entries from there
+     * on, including any erased ones that haven't reached the front yet */
+    std::size_t head = 0;
+    std::size_t count = 0;
+
+    entry& at(std::size_t i) {
+        return entries[(head + i) % entries.size()];
+    }
+
+    void grow() {
+        std::vector<entry> new_entries(entries.empty() ? 1 : 2 * entries.size());
+        for(std::size_t i = 0; i < count; ++i) {
+            new_entries[i] = at(i);
+        }
+        entries.swap(new_entries);
+        head = 0;
+    }
+
+public:
+    TimestampQueue(std::size_t capacity = 0) : entries(capacity) {}
+
+    bool empty() const { return count == 0; }
+    /** The timestamp of the oldest pending message; the queue must not be empty. */
+    uint64_t front() const { return entries[head].timestamp; }
+
+    void push_back(uint64_t timestamp) {
+        if(count == entries.size()) {
+            grow();
+        }
+        at(count) = {timestamp, false};
+        count++;
+    }
+
+    /** Removes one pending message with this timestamp, if there is one. */
+    void erase(uint64_t timestamp) {
+        for(std::size_t i = 0; i < count; ++i) {
+            entry& e = at(i);
+            if(!e.erased && e.timestamp == timestamp) {
+                e.erased = true;
+                break;
+            }
+        }
+        while(count > 0 && entries[head].erased) {
+            head = (head + 1) % entries.size();
+            count--;
+        }
+    }
+};
+}  // namespace derecho
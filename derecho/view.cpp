@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -25,12 +26,14 @@ SubView::SubView(Mode mode,
                  const std::vector<node_id_t>& members,
                  std::vector<int> is_sender,
                  const std::vector<std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t,
-                                              uint16_t>>& member_ips_and_ports)
+                                              uint16_t>>& member_ips_and_ports,
+                 const std::string& profile)
         : mode(mode),
           members(members),
           is_sender(members.size(), 1),
           member_ips_and_ports(member_ips_and_ports),
-          my_rank(-1) {
+          my_rank(-1),
+          profile(profile) {
     // if the sender information is not provided, assume that all members are
     // senders
     if(is_sender.size()) {
@@ -87,15 +90,24 @@ View::View(const int32_t vid, const std::vector<node_id_t>& members,
           joined(joined),
           departed(departed),
           num_members(num_members),
-          my_rank(0),              // This will always get overwritten by the receiver after deserializing
-          next_unassigned_rank(0), /* next_unassigned_rank should never be serialized, since each
-                                    * node must re-run the allocation functions independently */
+          my_rank(0),  // This will always get overwritten by the receiver after deserializing
+          next_unassigned_rank(0),
           subgroup_ids_by_type(subgroup_ids_by_type),
           subgroup_shard_views(subgroup_shard_views),
           my_subgroups(my_subgroups) {
     for(int rank = 0; rank < num_members; ++rank) {
         node_id_to_rank[members[rank]] = rank;
     }
+    /* next_unassigned_rank isn't serialized, but every member above the
+     * highest-ranked one in a SubView is certainly unassigned, which is all
+     * that the membership functions need to know to fill the layout's holes */
+    for(const auto& shard_views : subgroup_shard_views) {
+        for(const SubView& shard_view : shard_views) {
+            for(const node_id_t member : shard_view.members) {
+                next_unassigned_rank = std::max(next_unassigned_rank, rank_of(member) + 1);
+            }
+        }
+    }
 }
 
 int View::rank_of_leader() const {
@@ -152,7 +164,8 @@ int View::rank_of(const node_id_t& who) const {
 
 SubView View::make_subview(const std::vector<node_id_t>& with_members,
                            const Mode mode,
-                           const std::vector<int>& is_sender) const {
+                           const std::vector<int>& is_sender,
+                           const std::string& profile) const {
     std::vector<std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t>> subview_member_ips_and_ports(with_members.size());
     for(std::size_t subview_rank = 0; subview_rank < with_members.size();
         ++subview_rank) {
@@ -165,7 +178,7 @@ SubView View::make_subview(const std::vector<node_id_t>& with_members,
         subview_member_ips_and_ports[subview_rank] = member_ips_and_ports[member_pos];
     }
     // Note that joined and departed do not need to get initialized here; they wiill be initialized by ViewManager
-    return SubView(mode, with_members, is_sender, subview_member_ips_and_ports);
+    return SubView(mode, with_members, is_sender, subview_member_ips_and_ports, profile);
 }
 
 int View::subview_rank_of_shard_leader(subgroup_id_t subgroup_id,
@@ -310,7 +323,12 @@ std::size_t StreamlinedView::bytes_size() const {
     return mutils::bytes_size(wrapped_view.vid) + mutils::bytes_size(wrapped_view.members)
            + mutils::bytes_size(wrapped_view.member_ips_and_ports) + mutils::bytes_size(wrapped_view.failed)
            + mutils::bytes_size(wrapped_view.joined) + mutils::bytes_size(wrapped_view.departed)
-           + mutils::bytes_size(wrapped_view.num_members);
+           + mutils::bytes_size(wrapped_view.num_members)
+           + mutils::bytes_size(wrapped_view.is_adequately_provisioned)
+           + mutils::bytes_size(wrapped_view.next_unassigned_rank)
+           + mutils::bytes_size(wrapped_view.subgroup_ids_by_type)
+           + mutils::bytes_size(wrapped_view.subgroup_shard_views)
+           + mutils::bytes_size(wrapped_view.previous_layouts);
 }
 
 std::size_t StreamlinedView::to_bytes(char* buffer) const {
@@ -320,7 +338,12 @@ std::size_t StreamlinedView::to_bytes(char* buffer) const {
     bytes_written += mutils::to_bytes(wrapped_view.failed, buffer + bytes_written);
     bytes_written += mutils::to_bytes(wrapped_view.joined, buffer + bytes_written);
     bytes_written += mutils::to_bytes(wrapped_view.departed, buffer + bytes_written);
-    return bytes_written + mutils::to_bytes(wrapped_view.num_members, buffer + bytes_written);
+    bytes_written += mutils::to_bytes(wrapped_view.num_members, buffer + bytes_written);
+    bytes_written += mutils::to_bytes(wrapped_view.is_adequately_provisioned, buffer + bytes_written);
+    bytes_written += mutils::to_bytes(wrapped_view.next_unassigned_rank, buffer + bytes_written);
+    bytes_written += mutils::to_bytes(wrapped_view.subgroup_ids_by_type, buffer + bytes_written);
+    bytes_written += mutils::to_bytes(wrapped_view.subgroup_shard_views, buffer + bytes_written);
+    return bytes_written + mutils::to_bytes(wrapped_view.previous_layouts, buffer + bytes_written);
 }
 
 void StreamlinedView::post_object(const std::function<void(char const* const, std::size_t)>& write_func) const {
@@ -331,6 +354,11 @@ void StreamlinedView::post_object(const std::function<void(char const* const, st
     mutils::post_object(write_func, wrapped_view.joined);
     mutils::post_object(write_func, wrapped_view.departed);
     mutils::post_object(write_func, wrapped_view.num_members);
+    mutils::post_object(write_func, wrapped_view.is_adequately_provisioned);
+    mutils::post_object(write_func, wrapped_view.next_unassigned_rank);
+    mutils::post_object(write_func, wrapped_view.subgroup_ids_by_type);
+    mutils::post_object(write_func, wrapped_view.subgroup_shard_views);
+    mutils::post_object(write_func, wrapped_view.previous_layouts);
 }
 
 std::unique_ptr<View> StreamlinedView::view_from_bytes(mutils::DeserializationManager* dsm, const char* buffer) {
@@ -347,9 +375,21 @@ std::unique_ptr<View> StreamlinedView::view_from_bytes(mutils::DeserializationMa
     auto temp_departed = mutils::from_bytes_noalloc<std::vector<node_id_t>>(dsm, buffer + bytes_read);
     bytes_read += mutils::bytes_size(*temp_departed);
     auto temp_num_members = mutils::from_bytes_noalloc<int32_t>(dsm, buffer + bytes_read);
+    bytes_read += mutils::bytes_size(*temp_num_members);
+    auto temp_is_adequately_provisioned = mutils::from_bytes_noalloc<bool>(dsm, buffer + bytes_read);
+    bytes_read += mutils::bytes_size(*temp_is_adequately_provisioned);
+    auto temp_next_unassigned_rank = mutils::from_bytes_noalloc<int32_t>(dsm, buffer + bytes_read);
+    bytes_read += mutils::bytes_size(*temp_next_unassigned_rank);
     //This constructor will copy all the vectors into the new View, which is why it's OK to use noalloc
-    return std::make_unique<View>(*temp_vid, *temp_members, *temp_member_ips_and_ports, *temp_failed,
-                                  *temp_joined, *temp_departed, *temp_num_members);
+    auto view = std::make_unique<View>(*temp_vid, *temp_members, *temp_member_ips_and_ports, *temp_failed,
+                                       *temp_joined, *temp_departed, 0, *temp_next_unassigned_rank);
+    view->is_adequately_provisioned = *temp_is_adequately_provisioned;
+    view->subgroup_ids_by_type = *mutils::from_bytes<std::map<std::type_index, std::vector<subgroup_id_t>>>(dsm, buffer + bytes_read);
+    bytes_read += mutils::bytes_size(view->subgroup_ids_by_type);
+    view->subgroup_shard_views = *mutils::from_bytes<std::vector<std::vector<SubView>>>(dsm, buffer + bytes_read);
+    bytes_read += mutils::bytes_size(view->subgroup_shard_views);
+    view->previous_layouts = *mutils::from_bytes<std::map<std::type_index, subgroup_shard_layout_t>>(dsm, buffer + bytes_read);
+    return view;
 }
 
 }  // namespace derecho
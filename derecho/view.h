@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "derecho_internal.h"
@@ -15,6 +16,7 @@
 #include "derecho_sst.h"
 #include "multicast_group.h"
 #include "sst/sst.h"
+#include "subgroup_info.h"
 #include "type_index_serialization.h"
 #include <mutils-serialization/SerializationMacros.hpp>
 #include <mutils-serialization/SerializationSupport.hpp>
@@ -47,6 +49,10 @@ public:
     /** The rank of this node within the subgroup/shard, or -1 if this node is
      * not a member of the subgroup/shard. */
     int32_t my_rank;
+    /** The subgroup's profile, whose config section overrides the group's
+     * DerechoParams for it (see DerechoParams::for_profile); empty for none.
+     * Every shard of a subgroup must have the same profile. */
+    std::string profile;
     /** Looks up the sub-view rank of a node ID. Returns -1 if
      * that node ID is not a member of this subgroup/shard. */
     int rank_of(const node_id_t& who) const;
@@ -59,23 +65,26 @@ public:
     SubView(int32_t num_members);
 
     DEFAULT_SERIALIZATION_SUPPORT(SubView, mode, members, is_sender,
-                                  member_ips_and_ports, joined, departed);
+                                  member_ips_and_ports, joined, departed, profile);
     SubView(Mode mode, const std::vector<node_id_t>& members,
             std::vector<int> is_sender,
             const std::vector<std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t>>& member_ips_and_ports,
             const std::vector<node_id_t>& joined,
-            const std::vector<node_id_t>& departed)
+            const std::vector<node_id_t>& departed,
+            const std::string& profile)
             : mode(mode),
               members(members),
               is_sender(is_sender),
               member_ips_and_ports(member_ips_and_ports),
               joined(joined),
               departed(departed),
-              my_rank(-1) {}
+              my_rank(-1),
+              profile(profile) {}
 
     SubView(Mode mode, const std::vector<node_id_t>& members,
             std::vector<int> is_sender,
-            const std::vector<std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t>>& member_ips_and_ports);
+            const std::vector<std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t>>& member_ips_and_ports,
+            const std::string& profile = "");
 };
 
 class View : public mutils::ByteRepresentable {
@@ -120,6 +129,15 @@ public:
      * Note that this contains an entry for every subgroup and shard, even those
      * that the current node does not belong to. */
     std::vector<std::vector<SubView>> subgroup_shard_views;
+    /** For each subgroup type, the layout it had in the most recent adequately
+     * provisioned View before this one, if there was one. Subgroup membership
+     * functions start from it, so that a membership change only moves the
+     * nodes it has to. Not serialized with the rest of the View. */
+    std::map<std::type_index, subgroup_shard_layout_t> previous_layouts;
+    /** While ViewManager::make_subgroup_maps runs a subgroup type's membership
+     * function, points to that type's entry in previous_layouts, or is null if
+     * it has none; null at all other times. */
+    const subgroup_shard_layout_t* previous_assignment = nullptr;
     /** Lists the (subgroup ID, shard num) pairs that this node is a member of */
     std::map<subgroup_id_t, uint32_t> my_subgroups;
     /** Reverse index of members[]; maps node ID -> SST rank */
@@ -136,7 +154,8 @@ public:
      * @throws subgroup_provisioning_exception if any of the requested members
      * are not actually in this View's members vector.
      */
-    SubView make_subview(const std::vector<node_id_t>& with_members, const Mode mode = Mode::ORDERED, const std::vector<int>& is_sender = {}) const;
+    SubView make_subview(const std::vector<node_id_t>& with_members, const Mode mode = Mode::ORDERED, const std::vector<int>& is_sender = {},
+                         const std::string& profile = "") const;
 
     /** Looks up the SST rank of an IP address. Returns -1 if that IP is not a member of this view. */
     int rank_of(const std::tuple<ip_addr_t, uint16_t, uint16_t, uint16_t, uint16_t>& who) const;
@@ -188,7 +207,10 @@ public:
 /**
  * Simple wrapper for View that implements alternate serialization methods, so
  * that we can choose to send only a "streamlined" version of a View over the
- * network (instead of all the state it normally serializes).
+ * network (instead of all the state it normally serializes). This is what the
+ * leader sends a joining node: the membership, and the subgroup layout that the
+ * leader computed for it, so that the joiner can adopt that layout instead of
+ * computing one that might not match.
  */
 class StreamlinedView : public mutils::ByteRepresentable {
 private:
@@ -0,0 +1,139 @@
+/**
+ * @file view_lock.h
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * The lock that guards ViewManager's curr_view. Every send, query and view
+ * lookup holds it shared, and only a view change holds it exclusively, so it
+ * is built for readers: instead of one counter that every reader's CPU has to
+ * write, as in std::shared_timed_mutex, each thread announces that it is
+ * reading by incrementing a counter in its own cache line (one of a fixed
+ * set, which threads share only once there are more of them than slots),
+ * and then checks that no view change is running. A view change announces
+ * itself and then waits for a grace period, until every reader that was
+ * already inside has left, after which curr_view is its own until unlock().
+ * Readers that arrive while it runs wait for it to finish.
+ *
+ * A thread may take the lock shared again while it already holds it shared,
+ * even while a view change is waiting, since the view change cannot start
+ * before the outer shared lock is released anyway.
+ *
+ * It meets the SharedMutex requirements that std::shared_lock,
+ * std::unique_lock and std::condition_variable_any use.
+ */
+class ViewLock {
+    static constexpr std::size_t num_reader_slots = 64;
+    struct alignas(64) reader_slot {
+        std::atomic<uint64_t> readers{0};
+    };
+    std::array<reader_slot, num_reader_slots> reader_slots;
+    /** Set from the start of a view change's grace period until it unlocks */
+    std::atomic<bool> writer_active{false};
+    /** Held by a view change throughout, so readers can block on it */
+    std::mutex writer_mutex;
+
+    static std::size_t thread_slot() {
+        static std::atomic<std::size_t> next_slot{0};
+        thread_local const std::size_t slot = next_slot++ % num_reader_slots;
+        return slot;
+    }
+    /** The number of shared locks this thread holds on this ViewLock */
+    uint32_t& read_depth() {
+        struct held_lock {
+            const ViewLock* lock;
+            uint32_t depth;
+        };
+        thread_local std::vector<held_lock> held_locks;
+        held_lock* unused = nullptr;
+        for(held_lock& held : held_locks) {
+            if(held.lock == this) {
+                return held.depth;
+            }
+            if(held.depth == 0) {
+                unused = &held;
+            }
+        }
+        if(unused) {
+            *unused = {this, 0};
+            return unused->depth;
+        }
+        held_locks.push_back({this, 0});
+        return held_locks.back().depth;
+    }
+
+public:
+    ViewLock() = default;
+    ViewLock(const ViewLock&) = delete;
+    ViewLock& operator=(const ViewLock&) = delete;
+
+    void lock_shared() {
+        uint32_t& depth = read_depth();
+        std::atomic<uint64_t>& readers = reader_slots[thread_slot()].readers;
+        readers.fetch_add(1);
+        if(depth == 0) {
+            while(writer_active.load()) {
+                readers.fetch_sub(1);
+                std::lock_guard<std::mutex> wait_for_writer(writer_mutex);
+                readers.fetch_add(1);
+            }
+        }
+        depth++;
+    }
+    bool try_lock_shared() {
+        uint32_t& depth = read_depth();
+        std::atomic<uint64_t>& readers = reader_slots[thread_slot()].readers;
+        readers.fetch_add(1);
+        if(depth == 0 && writer_active.load()) {
+            readers.fetch_sub(1);
+            return false;
+        }
+        depth++;
+        return true;
+    }
+    void unlock_shared() {
+        read_depth()--;
+        reader_slots[thread_slot()].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() {
+        writer_mutex.lock();
+        writer_active.store(true);
+        for(reader_slot& slot : reader_slots) {
+            while(slot.readers.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    bool try_lock() {
+        if(!writer_mutex.try_lock()) {
+            return false;
+        }
+        writer_active.store(true);
+        for(reader_slot& slot : reader_slots) {
+            if(slot.readers.load() != 0) {
+                writer_active.store(false);
+                writer_mutex.unlock();
+                return false;
+            }
+        }
+        return true;
+    }
+    void unlock() {
+        writer_active.store(false);
+        writer_mutex.unlock();
+    }
+};
+
+}  // namespace derecho
@@ -4,11 +4,16 @@
  * @date Feb 6, 2017
  */
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <sstream>
 #include <tuple>
 
+#include "conf/affinity.hpp"
 #include "container_template_functions.h"
 #include "derecho_exception.h"
+#include "derecho_log.h"
+#include "p2p_connections.h"
 #include "replicated.h"  //Needed for the ReplicatedObject interface
 #include "view_manager.h"
 
@@ -18,7 +23,34 @@ namespace derecho {
 
 using lock_guard_t = std::lock_guard<std::mutex>;
 using unique_lock_t = std::unique_lock<std::mutex>;
-using shared_lock_t = std::shared_lock<std::shared_timed_mutex>;
+using shared_lock_t = std::shared_lock<ViewLock>;
+
+/**
+ * Parses the comma-separated list of CPU cores in CONF_DERECHO_SST_PREDICATE_CPUS.
+ * Entries that are not numbers are returned as -1, meaning "don't pin".
+ */
+static std::vector<int> get_sst_predicate_cpus() {
+    std::vector<int> cpus;
+    std::istringstream cpu_list(getConfString(CONF_DERECHO_SST_PREDICATE_CPUS));
+    std::string cpu;
+    while(std::getline(cpu_list, cpu, ',')) {
+        try {
+            cpus.push_back(std::stoi(cpu));
+        } catch(const std::logic_error&) {
+            cpus.push_back(-1);
+        }
+    }
+    return cpus;
+}
+
+/** Reads the SST predicate threads' backoff policy from the configuration. */
+static sst::DetectBackoffPolicy get_sst_backoff_policy() {
+    sst::DetectBackoffPolicy policy;
+    policy.spin_us = getConfUInt64(CONF_DERECHO_SST_SPIN_US);
+    policy.yield_us = getConfUInt64(CONF_DERECHO_SST_YIELD_US);
+    policy.sleep_us = getConfUInt64(CONF_DERECHO_SST_SLEEP_US);
+    return policy;
+}
 
 /* Leader/Restart Leader Constructor */
 ViewManager::ViewManager(
@@ -29,7 +61,10 @@ ViewManager::ViewManager(
         std::vector<view_upcall_t> _view_upcalls)
         : whenlog(logger(spdlog::get("derecho_debug_log")), )
           curr_view(persistent::loadObject<View>()),  //Attempt to load a saved View from disk, to see if one is there
+          join_batch_window(getConfUInt32(CONF_DERECHO_JOIN_BATCH_WINDOW_MS)),
           server_socket(getConfUInt16(CONF_DERECHO_GMS_PORT)),
+          metrics_server(getConfUInt16(CONF_DERECHO_METRICS_PORT)),
+          change_stream_server(getConfUInt16(CONF_DERECHO_CDC_PORT)),
           thread_shutdown(false),
           view_upcalls(_view_upcalls),
           subgroup_info(subgroup_info),
@@ -43,7 +78,7 @@ ViewManager::ViewManager(
     uint32_t my_id = getConfUInt32(CONF_DERECHO_LOCAL_ID);
     if(curr_view) {
         is_total_restart = true;
-        whenlog(logger->debug("Found view {} on disk", curr_view->vid););
+        view_log(DEBUG, "Found view {} on disk", curr_view->vid);
         whenlog(logger->info("Logged View found on disk. Restarting in recovery mode."););
         restart_state = std::make_unique<RestartState>();
         restart_state->load_ragged_trim(*curr_view);
@@ -66,9 +101,11 @@ ViewManager::ViewManager(
     last_suspected = std::vector<bool>(curr_view->members.size());
     persistent::saveObject(*curr_view);
     initialize_rdmc_sst();
-    whenlog(logger->debug("Initializing SST and RDMC for the first time."););
+    view_log(DEBUG, "Initializing SST and RDMC for the first time.");
     construct_multicast_group(callbacks, subgroup_settings_map, num_received_size);
     curr_view->gmsSST->vid[curr_view->my_rank] = curr_view->vid;
+    view_metrics.vid.set(curr_view->vid);
+    view_metrics.num_members.set(curr_view->num_members);
     if(is_total_restart) {
         restart_existing_tcp_connections(my_id);
     }
@@ -84,7 +121,10 @@ ViewManager::ViewManager(
         std::vector<view_upcall_t> _view_upcalls)
         : whenlog(logger(spdlog::get("derecho_debug_log")), )
           curr_view(persistent::loadObject<View>()),  //Attempt to load a saved View from disk, to see if one is there
+          join_batch_window(getConfUInt32(CONF_DERECHO_JOIN_BATCH_WINDOW_MS)),
           server_socket(getConfUInt16(CONF_DERECHO_GMS_PORT)),
+          metrics_server(getConfUInt16(CONF_DERECHO_METRICS_PORT)),
+          change_stream_server(getConfUInt16(CONF_DERECHO_CDC_PORT)),
           thread_shutdown(false),
           view_upcalls(_view_upcalls),
           subgroup_info(subgroup_info),
@@ -103,25 +143,32 @@ ViewManager::ViewManager(
     initialize_rdmc_sst();
     std::map<subgroup_id_t, SubgroupSettings> subgroup_settings_map;
     uint32_t num_received_size;
-    if(is_total_restart) {
-        num_received_size = derive_subgroup_settings(*curr_view, subgroup_settings_map);
-    } else {
-        num_received_size = make_subgroup_maps(subgroup_info, std::unique_ptr<View>(), *curr_view, subgroup_settings_map);
-    };
-    whenlog(logger->trace("Received initial view: {}", curr_view->debug_string()););
+    // The leader sent the subgroup layout along with the View, so adopt it
+    // rather than run the membership functions without the previous layouts
+    num_received_size = derive_subgroup_settings(*curr_view, subgroup_settings_map);
+    view_log(TRACE, "Received initial view: {}", curr_view->debug_string());
     //Persist the initial View to disk as soon as possible, which is after subgroup membership has been assigned
 
     persistent::saveObject(*curr_view);
 
-    whenlog(logger->debug("Initializing SST and RDMC for the first time."););
+    view_log(DEBUG, "Initializing SST and RDMC for the first time.");
     construct_multicast_group(callbacks, subgroup_settings_map,
                               num_received_size);
     curr_view->gmsSST->vid[curr_view->my_rank] = curr_view->vid;
+    view_metrics.vid.set(curr_view->vid);
+    view_metrics.num_members.set(curr_view->num_members);
     if(is_total_restart) {
         restart_existing_tcp_connections(my_id);
     }
 }
 
+ViewManager::ViewMetrics::ViewMetrics()
+        : view_changes(MetricsRegistry::get().counter("derecho_view_changes_total", "View changes installed")),
+          view_change_time_us(MetricsRegistry::get().counter(
+                  "derecho_view_change_microseconds_total", "Time from wedging each view to installing the next one")),
+          vid(MetricsRegistry::get().gauge("derecho_view_id", "The ID of the current view")),
+          num_members(MetricsRegistry::get().gauge("derecho_view_members", "The number of members of the current view")) {}
+
 ViewManager::~ViewManager() {
     thread_shutdown = true;
     // force accept to return.
@@ -133,6 +180,9 @@ ViewManager::~ViewManager() {
     if(old_view_cleanup_thread.joinable()) {
         old_view_cleanup_thread.join();
     }
+    for(auto& transfer_thread : background_transfer_threads) {
+        transfer_thread.join();
+    }
 }
 
 /* ----------  1. Constructor Components ------------- */
@@ -142,7 +192,7 @@ bool ViewManager::receive_configuration(node_id_t my_id, tcp::socket& leader_con
     do {
         leader_redirect = false;
         bool success;
-        whenlog(logger->debug("Socket connected to leader, exchanging IDs."););
+        view_log(DEBUG, "Socket connected to leader, exchanging IDs.");
         success = leader_connection.write(my_id);
         if(!success) throw derecho_exception("Failed to exchange IDs with the leader! Leader has crashed.");
         success = leader_connection.read(leader_response);
@@ -169,30 +219,25 @@ bool ViewManager::receive_configuration(node_id_t my_id, tcp::socket& leader_con
 
     bool is_total_restart = (leader_response.code == JoinResponseCode::TOTAL_RESTART);
     if(is_total_restart) {
-        whenlog(logger->debug("In restart mode, sending view {} to leader", curr_view->vid););
-        bool success = leader_connection.write(mutils::bytes_size(*curr_view));
-        if(!success) throw derecho_exception("Restart leader crashed before sending a restart View!");
-        auto leader_socket_write = [&leader_connection](const char* bytes, std::size_t size) {
-            if(!leader_connection.write(bytes, size)) {
-                throw derecho_exception("Restart leader crashed before sending a restart View!");
-            }
-        };
-        mutils::post_object(leader_socket_write, *curr_view);
+        view_log(DEBUG, "In restart mode, sending view {} to leader", curr_view->vid);
+        // The View and the ragged trims are posted a field at a time, so
+        // gather them into as few writes as possible
+        tcp::buffered_writer leader_writer(leader_connection);
+        leader_writer.write(mutils::bytes_size(*curr_view));
+        mutils::post_object(leader_writer.post_function(), *curr_view);
         restart_state = std::make_unique<RestartState>();
         restart_state->load_ragged_trim(*curr_view);
-        whenlog(logger->debug("In restart mode, sending {} ragged trims to leader", restart_state->logged_ragged_trim.size()););
+        view_log(DEBUG, "In restart mode, sending {} ragged trims to leader", restart_state->logged_ragged_trim.size());
         /* Protocol: Send the number of RaggedTrim objects, then serialize each RaggedTrim */
         /* Since we know this node is only a member of one shard per subgroup,
          * the size of the outer map (subgroup IDs) is the number of RaggedTrims. */
-        success
-                = leader_connection.write(restart_state->logged_ragged_trim.size());
-        if(!success) throw derecho_exception("Restart leader crashed before sending a restart View!");
+        leader_writer.write(restart_state->logged_ragged_trim.size());
         for(const auto& id_to_shard_map : restart_state->logged_ragged_trim) {
             const std::unique_ptr<RaggedTrim>& ragged_trim = id_to_shard_map.second.begin()->second;  //The inner map has one entry
-            success = leader_connection.write(mutils::bytes_size(*ragged_trim));
-            if(!success) throw derecho_exception("Restart leader crashed before sending a restart View!");
-            mutils::post_object(leader_socket_write, *ragged_trim);
+            leader_writer.write(mutils::bytes_size(*ragged_trim));
+            mutils::post_object(leader_writer.post_function(), *ragged_trim);
         }
+        if(!leader_writer.flush()) throw derecho_exception("Restart leader crashed before sending a restart View!");
     }
     leader_connection.write(getConfUInt16(CONF_DERECHO_GMS_PORT));
     leader_connection.write(getConfUInt16(CONF_DERECHO_RPC_PORT));
@@ -230,7 +275,7 @@ bool ViewManager::receive_configuration(node_id_t my_id, tcp::socket& leader_con
         derecho_params = *mutils::from_bytes<DerechoParams>(nullptr, buffer2);
         if(is_total_restart) {
             //In total restart mode, the leader will also send the RaggedTrims it has collected
-            whenlog(logger->debug("In restart mode, receiving ragged trim from leader"););
+            view_log(DEBUG, "In restart mode, receiving ragged trim from leader");
             restart_state->logged_ragged_trim.clear();
             std::size_t num_of_ragged_trims;
             leader_connection.read(num_of_ragged_trims);
@@ -250,7 +295,7 @@ bool ViewManager::receive_configuration(node_id_t my_id, tcp::socket& leader_con
         if(!success) {
             throw derecho_exception("Leader crashed before it could send the initial View! Try joining again at the new leader.");
         }
-        whenlog(logger->debug("Received view {} from leader. View_confirmed = {}", curr_view->vid, view_confirmed););
+        view_log(DEBUG, "Received view {} from leader. View_confirmed = {}", curr_view->vid, view_confirmed);
     }
     return is_total_restart;
 }
@@ -258,14 +303,14 @@ bool ViewManager::receive_configuration(node_id_t my_id, tcp::socket& leader_con
 std::vector<std::vector<int64_t>> ViewManager::finish_setup() {
     curr_view->gmsSST->put();
     curr_view->gmsSST->sync_with_members();
-    whenlog(logger->debug("Done setting up initial SST and RDMC"););
+    view_log(DEBUG, "Done setting up initial SST and RDMC");
 
     if(curr_view->vid != 0 && curr_view->my_rank != curr_view->rank_of_leader()) {
         // If this node is joining an existing group with a non-initial view, copy the leader's num_changes, num_acked, and num_committed
         // Otherwise, you'll immediately think that there's a new proposed view change because gmsSST.num_changes[leader] > num_acked[my_rank]
         curr_view->gmsSST->init_local_change_proposals(curr_view->rank_of_leader());
         curr_view->gmsSST->put();
-        whenlog(logger->debug("Joining node initialized its SST row from the leader"););
+        view_log(DEBUG, "Joining node initialized its SST row from the leader");
     }
     create_threads();
     register_predicates();
@@ -293,19 +338,21 @@ void ViewManager::send_logs_if_total_restart(const std::unique_ptr<std::vector<s
         restart_state->restart_shard_leaders = *shard_leaders;
     }
     node_id_t my_id = curr_view->members[curr_view->my_rank];
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_by_receiver;
     for(subgroup_id_t subgroup_id = 0; subgroup_id < restart_state->restart_shard_leaders.size(); ++subgroup_id) {
         for(uint32_t shard = 0; shard < restart_state->restart_shard_leaders[subgroup_id].size(); ++shard) {
             if(my_id == restart_state->restart_shard_leaders[subgroup_id][shard]) {
-                whenlog(logger->debug("This node is the restart leader for subgroup {}, shard {}. Sending object data to shard members.", subgroup_id, shard););
+                view_log(DEBUG, "This node is the restart leader for subgroup {}, shard {}. Sending object data to shard members.", subgroup_id, shard);
                 //Send object data to all shard members, since they will all be in receive_objects()
                 for(node_id_t shard_member : curr_view->subgroup_shard_views[subgroup_id][shard].members) {
                     if(shard_member != my_id) {
-                        send_subgroup_object(subgroup_id, shard_member);
+                        subgroups_by_receiver[shard_member].push_back(subgroup_id);
                     }
                 }
             }
         }
     }
+    send_subgroup_objects(subgroups_by_receiver);
 }
 
 void ViewManager::restart_existing_tcp_connections(node_id_t my_id) {
@@ -331,21 +378,26 @@ void ViewManager::start() {
      * and then truncate its own logs if they are longer than the leader's ragged trim proposal.
      */
     if(restart_state) {
+        std::vector<RaggedTrim> trims;
         for(const auto& subgroup_and_map : restart_state->logged_ragged_trim) {
             for(const auto& shard_and_trim : subgroup_and_map.second) {
-                persistent::saveObject(*shard_and_trim.second, ragged_trim_filename(subgroup_and_map.first, shard_and_trim.first).c_str());
+                trims.emplace_back(*shard_and_trim.second);
             }
         }
-        whenlog(logger->debug("Truncating persistent logs to conform to leader's ragged trim"););
+        RaggedTrimLog trim_log(std::move(trims));
+        persistent::saveObject(trim_log, ragged_trim_log_name);
+        view_log(DEBUG, "Truncating persistent logs to conform to leader's ragged trim");
         truncate_persistent_logs(restart_state->logged_ragged_trim);
         //Once this is finished, we no longer need logged_ragged_trim or restart_shard_leaders
         restart_state.reset();
     }
-    whenlog(logger->debug("Starting predicate evaluation"););
+    view_log(DEBUG, "Starting predicate evaluation");
     curr_view->gmsSST->start_predicate_evaluation();
 }
 
 void ViewManager::truncate_persistent_logs(const ragged_trim_map_t& logged_ragged_trim) {
+    //Each subgroup's log is in its own files, so truncate them all at once
+    std::vector<std::thread> truncate_threads;
     for(const auto& id_to_shard_map : logged_ragged_trim) {
         subgroup_id_t subgroup_id = id_to_shard_map.first;
         const auto find_my_shard = curr_view->my_subgroups.find(subgroup_id);
@@ -355,9 +407,14 @@ void ViewManager::truncate_persistent_logs(const ragged_trim_map_t& logged_ragge
         const auto& my_shard_ragged_trim = id_to_shard_map.second.at(find_my_shard->second);
         persistent::version_t max_delivered_version = RestartState::ragged_trim_to_latest_version(
                 my_shard_ragged_trim->vid, my_shard_ragged_trim->max_received_by_sender);
-        whenlog(logger->trace("Truncating persistent log for subgroup {} to version {}", subgroup_id, max_delivered_version););
+        view_log(TRACE, "Truncating persistent log for subgroup {} to version {}", subgroup_id, max_delivered_version);
         whenlog(logger->flush(););
-        subgroup_objects.at(subgroup_id).get().truncate(max_delivered_version);
+        truncate_threads.emplace_back([this, subgroup_id, max_delivered_version]() {
+            subgroup_objects.at(subgroup_id).get().truncate(max_delivered_version);
+        });
+    }
+    for(auto& truncate_thread : truncate_threads) {
+        truncate_thread.join();
     }
 }
 
@@ -366,42 +423,99 @@ void ViewManager::await_first_view(const node_id_t my_id,
                                    uint32_t& num_received_size) {
     std::map<node_id_t, tcp::socket> waiting_join_sockets;
     std::set<node_id_t> members_sent_view;
+    /* Joiners are handled as their bytes arrive, rather than one at a time in
+     * blocking reads, so that a slow or stalled joiner doesn't hold up the
+     * others. A handshake has sent_ok once the joiner's ID was accepted, and
+     * then awaits the joiner's ports. */
+    struct JoinHandshake {
+        tcp::socket socket;
+        node_id_t joiner_id;
+        bool sent_ok;
+    };
+    std::map<uint64_t, JoinHandshake> handshakes;
+    const uint64_t listener_tag = 0;
+    uint64_t next_handshake_tag = 1;
+    tcp::socket_poller poller;
+    poller.add(server_socket, listener_tag);
+    auto handshakes_awaiting_ports = [&handshakes]() {
+        return std::any_of(handshakes.begin(), handshakes.end(),
+                           [](const auto& tag_handshake) { return tag_handshake.second.sent_ok; });
+    };
     curr_view->is_adequately_provisioned = false;
     bool joiner_failed = false;
     do {
-        while(!curr_view->is_adequately_provisioned) {
-            tcp::socket client_socket = server_socket.accept();
-            node_id_t joiner_id = 0;
-            client_socket.read(joiner_id);
-            if(curr_view->rank_of(joiner_id) != -1) {
-                client_socket.write(JoinResponse{JoinResponseCode::ID_IN_USE, my_id});
-                continue;
+        //Once the view is adequate, only finish the joins that were already told OK
+        while(!curr_view->is_adequately_provisioned || handshakes_awaiting_ports()) {
+            for(const uint64_t ready_tag : poller.wait(-1)) {
+                if(ready_tag == listener_tag) {
+                    tcp::socket client_socket = server_socket.accept();
+                    poller.add(client_socket, next_handshake_tag);
+                    handshakes.emplace(next_handshake_tag++, JoinHandshake{std::move(client_socket), 0, false});
+                    continue;
+                }
+                auto handshake_iter = handshakes.find(ready_tag);
+                if(handshake_iter == handshakes.end()) {
+                    continue;
+                }
+                tcp::socket& client_socket = handshake_iter->second.socket;
+                const std::size_t bytes_available = client_socket.bytes_available();
+                if(bytes_available == 0) {
+                    //Readable with nothing to read: the joiner hung up before finishing
+                    poller.remove(client_socket);
+                    handshakes.erase(handshake_iter);
+                    continue;
+                }
+                if(!handshake_iter->second.sent_ok) {
+                    if(bytes_available < sizeof(node_id_t)) {
+                        continue;
+                    }
+                    node_id_t joiner_id = 0;
+                    client_socket.read(joiner_id);
+                    const bool id_in_use = curr_view->rank_of(joiner_id) != -1
+                                           || std::any_of(handshakes.begin(), handshakes.end(),
+                                                          [joiner_id](const auto& tag_handshake) {
+                                                              return tag_handshake.second.sent_ok
+                                                                     && tag_handshake.second.joiner_id == joiner_id;
+                                                          });
+                    if(id_in_use) {
+                        client_socket.write(JoinResponse{JoinResponseCode::ID_IN_USE, my_id});
+                        poller.remove(client_socket);
+                        handshakes.erase(handshake_iter);
+                        continue;
+                    }
+                    client_socket.write(JoinResponse{JoinResponseCode::OK, my_id});
+                    handshake_iter->second.joiner_id = joiner_id;
+                    handshake_iter->second.sent_ok = true;
+                    continue;
+                }
+                if(bytes_available < 4 * sizeof(uint16_t)) {
+                    continue;
+                }
+                const node_id_t joiner_id = handshake_iter->second.joiner_id;
+                uint16_t joiner_gms_port = 0;
+                client_socket.read(joiner_gms_port);
+                uint16_t joiner_rpc_port = 0;
+                client_socket.read(joiner_rpc_port);
+                uint16_t joiner_sst_port = 0;
+                client_socket.read(joiner_sst_port);
+                uint16_t joiner_rdmc_port = 0;
+                client_socket.read(joiner_rdmc_port);
+                poller.remove(client_socket);
+                const ip_addr_t& joiner_ip = client_socket.get_remote_ip();
+                //Construct a new view by appending this joiner to the previous view
+                //None of these views are ever installed, so we don't use curr_view/next_view like normal,
+                //and the subgroup functions lay each one out from scratch
+                curr_view = std::make_unique<View>(curr_view->vid,
+                                                   functional_append(curr_view->members, joiner_id),
+                                                   functional_append(curr_view->member_ips_and_ports, {joiner_ip, joiner_gms_port, joiner_rpc_port, joiner_sst_port, joiner_rdmc_port}),
+                                                   std::vector<char>(curr_view->num_members + 1, 0),
+                                                   functional_append(curr_view->joined, joiner_id),
+                                                   std::vector<node_id_t>{}, 0, 0);
+                num_received_size = make_subgroup_maps(subgroup_info, std::unique_ptr<View>(), *curr_view, subgroup_settings);
+                view_log(DEBUG, "Node {} connected from IP address {} and GMS port {}", joiner_id, joiner_ip, joiner_gms_port);
+                waiting_join_sockets.emplace(joiner_id, std::move(client_socket));
+                handshakes.erase(handshake_iter);
             }
-            client_socket.write(JoinResponse{JoinResponseCode::OK, my_id});
-            uint16_t joiner_gms_port = 0;
-            client_socket.read(joiner_gms_port);
-            uint16_t joiner_rpc_port = 0;
-            client_socket.read(joiner_rpc_port);
-            uint16_t joiner_sst_port = 0;
-            client_socket.read(joiner_sst_port);
-            uint16_t joiner_rdmc_port = 0;
-            client_socket.read(joiner_rdmc_port);
-            const ip_addr_t& joiner_ip = client_socket.get_remote_ip();
-            ip_addr_t my_ip = client_socket.get_self_ip();
-            //Construct a new view by appending this joiner to the previous view
-            //None of these views are ever installed, so we don't use curr_view/next_view like normal
-            //If we're here because a joiner failed, the subgroup functions have previously run to completion,
-            //so preserve next_unassigned_rank.
-            int next_unassigned_rank = joiner_failed ? curr_view->next_unassigned_rank : 0;
-            curr_view = std::make_unique<View>(curr_view->vid,
-                                               functional_append(curr_view->members, joiner_id),
-                                               functional_append(curr_view->member_ips_and_ports, {joiner_ip, joiner_gms_port, joiner_rpc_port, joiner_sst_port, joiner_rdmc_port}),
-                                               std::vector<char>(curr_view->num_members + 1, 0),
-                                               functional_append(curr_view->joined, joiner_id),
-                                               std::vector<node_id_t>{}, 0, next_unassigned_rank);
-            num_received_size = make_subgroup_maps(subgroup_info, std::unique_ptr<View>(), *curr_view, subgroup_settings);
-            waiting_join_sockets.emplace(joiner_id, std::move(client_socket));
-            whenlog(logger->debug("Node {} connected from IP address {} and GMS port {}", joiner_id, joiner_ip, joiner_gms_port););
         }
         StreamlinedView view_memento(*curr_view);
         joiner_failed = false;
@@ -414,21 +528,13 @@ void ViewManager::await_first_view(const node_id_t my_id,
             bool send_success;
             //Within this try block, any send that returns failure throws the ID of the node that failed
             try {
-                send_success = waiting_sockets_iter->second.write(view_buffer_size);
-                if(!send_success) {
-                    throw waiting_sockets_iter->first;
-                }
                 mutils::to_bytes(view_memento, view_buffer);
-                send_success = waiting_sockets_iter->second.write(view_buffer, view_buffer_size);
-                if(!send_success) {
-                    throw waiting_sockets_iter->first;
-                }
-                send_success = waiting_sockets_iter->second.write(params_buffer_size);
-                if(!send_success) {
-                    throw waiting_sockets_iter->first;
-                }
                 mutils::to_bytes(derecho_params, params_buffer);
-                send_success = waiting_sockets_iter->second.write(params_buffer, params_buffer_size);
+                send_success = waiting_sockets_iter->second.writev(
+                        {{reinterpret_cast<const char*>(&view_buffer_size), sizeof(view_buffer_size)},
+                         {view_buffer, view_buffer_size},
+                         {reinterpret_cast<const char*>(&params_buffer_size), sizeof(params_buffer_size)},
+                         {params_buffer, params_buffer_size}});
                 if(!send_success) {
                     throw waiting_sockets_iter->first;
                 }
@@ -446,15 +552,11 @@ void ViewManager::await_first_view(const node_id_t my_id,
                                  filtered_ips_and_ports.begin(), curr_view->member_ips_and_ports[curr_view->rank_of(failed_joiner_id)]);
                 std::remove_copy(curr_view->joined.begin(), curr_view->joined.end(),
                                  filtered_joiners.begin(), failed_joiner_id);
-                /* Since curr_view was adequate, it already had subgroups assigned and had the next_unassigned_rank
-                 * pointer moved by the subgroup allocation functions. Ideally we should tell the subgroup functions
-                 * to "forget" their previous assignment and reset next_unassigned_rank to 0, because that assignment
-                 * was never installed or used, but for now, decrement it by 1 if the failed node was assigned to a
-                 * subgroup (just like in make_next_view). */
-                int next_unassigned_rank = (curr_view->rank_of(failed_joiner_id) <= curr_view->next_unassigned_rank) ? curr_view->next_unassigned_rank - 1 : curr_view->next_unassigned_rank;
+                /* The assignment curr_view had was never installed or used, and the subgroup functions only
+                 * start from the layouts of installed Views, so lay out the new view from scratch. */
                 curr_view = std::make_unique<View>(0, filtered_members, filtered_ips_and_ports,
                                                    std::vector<char>(curr_view->num_members - 1, 0), filtered_joiners,
-                                                   std::vector<node_id_t>{}, 0, next_unassigned_rank);
+                                                   std::vector<node_id_t>{}, 0, 0);
                 /* This will update curr_view->is_adequately_provisioned, so set joiner_failed to true
                  * to start over from the beginning and test if we need to wait for more joiners. */
                 num_received_size = make_subgroup_maps(subgroup_info, std::unique_ptr<View>(), *curr_view, subgroup_settings);
@@ -465,12 +567,12 @@ void ViewManager::await_first_view(const node_id_t my_id,
         }  //for (waiting_join_sockets)
         //Tell each node whether to commit or abort the view they received, which is the opposite of joiner_failed
         for(const node_id_t& member_sent_view : members_sent_view) {
-            whenlog(logger->debug("Sending view commit message to node {}: {}", member_sent_view, !joiner_failed););
+            view_log(DEBUG, "Sending view commit message to node {}: {}", member_sent_view, !joiner_failed);
             waiting_join_sockets.at(member_sent_view).write(!joiner_failed);
         }
         members_sent_view.clear();
     } while(joiner_failed);
-    whenlog(logger->trace("Decided on initial view: {}", curr_view->debug_string()););
+    view_log(TRACE, "Decided on initial view: {}", curr_view->debug_string());
     //At this point, we have successfully sent an initial view to all joining nodes
     //Now send a "0" as the size of the "old shard leaders" vector, since there are no old leaders, and close the socket
     for(auto waiting_sockets_iter = waiting_join_sockets.begin();
@@ -478,6 +580,11 @@ void ViewManager::await_first_view(const node_id_t my_id,
         waiting_sockets_iter->second.write(std::size_t{0});
         waiting_sockets_iter = waiting_join_sockets.erase(waiting_sockets_iter);
     }
+    //Connections that arrived too late for the initial view will join it normally
+    for(auto& tag_handshake : handshakes) {
+        poller.remove(tag_handshake.second.socket);
+        pending_join_sockets.locked().access.emplace_back(std::move(tag_handshake.second.socket));
+    }
 }
 
 void ViewManager::await_rejoining_nodes(const node_id_t my_id,
@@ -487,7 +594,7 @@ void ViewManager::await_rejoining_nodes(const node_id_t my_id,
     bool still_need_quorum = true;
     while(still_need_quorum) {
         restart_leader_state_machine.await_quorum(server_socket);
-        whenlog(logger->debug("Reached a quorum of nodes from view {}, created view {}", restart_leader_state_machine.get_curr_view().vid, restart_leader_state_machine.get_restart_view().vid););
+        view_log(DEBUG, "Reached a quorum of nodes from view {}, created view {}", restart_leader_state_machine.get_curr_view().vid, restart_leader_state_machine.get_restart_view().vid);
         still_need_quorum = false;
         //Compute a final ragged trim
         //Actually, I don't think there's anything to "compute" because
@@ -513,7 +620,7 @@ void ViewManager::await_rejoining_nodes(const node_id_t my_id,
             while(can_restart) {
                 failed_node_id = restart_leader_state_machine.send_restart_view(derecho_params);
                 if(failed_node_id != -1) {
-                    whenlog(logger->debug("Recomputed View would still have been adequate, but node {} failed while sending it!", failed_node_id););
+                    view_log(DEBUG, "Recomputed View would still have been adequate, but node {} failed while sending it!", failed_node_id);
                     restart_leader_state_machine.confirm_restart_view(false);
                     //Recompute the restart view again, and try again if it's still adequate
                     can_restart = restart_leader_state_machine.compute_restart_view();
@@ -525,7 +632,7 @@ void ViewManager::await_rejoining_nodes(const node_id_t my_id,
             }
         }
     }
-    whenlog(logger->trace("Decided on restart view: {}", restart_leader_state_machine.get_restart_view().debug_string()););
+    view_log(TRACE, "Decided on restart view: {}", restart_leader_state_machine.get_restart_view().debug_string());
     //Commit the restart view at all joining clients
     restart_leader_state_machine.confirm_restart_view(true);
     restart_leader_state_machine.send_shard_leaders();
@@ -533,7 +640,7 @@ void ViewManager::await_rejoining_nodes(const node_id_t my_id,
 }
 
 void ViewManager::initialize_rdmc_sst() {
-    whenlog(logger->debug("Starting global initialization of RDMC and SST, including internal TCP connection setup"););
+    view_log(DEBUG, "Starting global initialization of RDMC and SST, including internal TCP connection setup");
     // construct member_ips
     auto member_ips_and_rdmc_ports_map = make_member_ips_and_ports_map<PORT_TYPE::RDMC>(*curr_view);
     if(!rdmc::initialize(member_ips_and_rdmc_ports_map,
@@ -554,17 +661,44 @@ void ViewManager::initialize_rdmc_sst() {
 
 void ViewManager::create_threads() {
     client_listener_thread = std::thread{[this]() {
-        pthread_setname_np(pthread_self(), "client_thread");
+        name_and_pin_thread("client_thread");
+        /* A connection is only handed to the join predicate once the joiner's ID
+         * has arrived, so the predicate's first read never waits on a slow client. */
+        std::map<uint64_t, tcp::socket> connecting_sockets;
+        const uint64_t listener_tag = 0;
+        uint64_t next_socket_tag = 1;
+        tcp::socket_poller poller;
+        poller.add(server_socket, listener_tag);
         while(!thread_shutdown) {
-            tcp::socket client_socket = server_socket.accept();
-            whenlog(logger->debug("Background thread got a client connection from {}", client_socket.get_remote_ip()););
-            pending_join_sockets.locked().access.emplace_back(std::move(client_socket));
+            for(const uint64_t ready_tag : poller.wait(-1)) {
+                if(ready_tag == listener_tag) {
+                    tcp::socket client_socket = server_socket.accept();
+                    view_log(DEBUG, "Background thread got a client connection from {}", client_socket.get_remote_ip());
+                    poller.add(client_socket, next_socket_tag);
+                    connecting_sockets.emplace(next_socket_tag++, std::move(client_socket));
+                    continue;
+                }
+                auto socket_iter = connecting_sockets.find(ready_tag);
+                if(socket_iter == connecting_sockets.end()) {
+                    continue;
+                }
+                const std::size_t bytes_available = socket_iter->second.bytes_available();
+                if(bytes_available == 0) {
+                    //The client hung up without sending anything
+                    poller.remove(socket_iter->second);
+                    connecting_sockets.erase(socket_iter);
+                } else if(bytes_available >= sizeof(node_id_t)) {
+                    poller.remove(socket_iter->second);
+                    pending_join_sockets.locked().access.emplace_back(std::move(socket_iter->second));
+                    connecting_sockets.erase(socket_iter);
+                }
+            }
         }
         std::cout << "Connection listener thread shutting down." << std::endl;
     }};
 
     old_view_cleanup_thread = std::thread([this]() {
-        pthread_setname_np(pthread_self(), "old_view");
+        name_and_pin_thread("old_view");
         while(!thread_shutdown) {
             unique_lock_t old_views_lock(old_views_mutex);
             old_views_cv.wait(old_views_lock, [this]() {
@@ -589,7 +723,15 @@ void ViewManager::register_predicates() {
     auto suspected_changed_trig = [this](DerechoSST& sst) { new_suspicion(sst); };
 
     auto start_join_pred = [this](const DerechoSST& sst) {
-        return curr_view->i_am_leader() && has_pending_join();
+        if(!curr_view->i_am_leader() || !has_pending_join()) {
+            return false;
+        }
+        //Wait out the batch window from the first join, so that the joins arriving in it share a view change
+        const auto now = std::chrono::steady_clock::now();
+        if(!first_pending_join_time) {
+            first_pending_join_time = now;
+        }
+        return now - *first_pending_join_time >= join_batch_window;
     };
     auto start_join_trig = [this](DerechoSST& sst) { leader_start_join(sst); };
 
@@ -621,36 +763,49 @@ void ViewManager::register_predicates() {
     if(!suspected_changed_handle.is_valid()) {
         suspected_changed_handle = curr_view->gmsSST->predicates.insert(
                 suspected_changed, suspected_changed_trig,
-                sst::PredicateType::RECURRENT);
+                sst::PredicateType::RECURRENT, "suspected_changed");
     }
     if(!start_join_handle.is_valid()) {
         start_join_handle = curr_view->gmsSST->predicates.insert(
-                start_join_pred, start_join_trig, sst::PredicateType::RECURRENT);
+                start_join_pred, start_join_trig, sst::PredicateType::RECURRENT, "start_join_pred");
     }
     if(!reject_join_handle.is_valid()) {
         reject_join_handle = curr_view->gmsSST->predicates.insert(reject_join_pred, reject_join,
-                                                                  sst::PredicateType::RECURRENT);
+                                                                  sst::PredicateType::RECURRENT,
+                                                                  "reject_join_pred");
     }
     if(!change_commit_ready_handle.is_valid()) {
         change_commit_ready_handle = curr_view->gmsSST->predicates.insert(
-                change_commit_ready, commit_change, sst::PredicateType::RECURRENT);
+                change_commit_ready, commit_change, sst::PredicateType::RECURRENT,
+                "change_commit_ready");
     }
     if(!leader_proposed_handle.is_valid()) {
         leader_proposed_handle = curr_view->gmsSST->predicates.insert(
                 leader_proposed_change, ack_proposed_change,
-                sst::PredicateType::RECURRENT);
+                sst::PredicateType::RECURRENT, "leader_proposed_change");
     }
     if(!leader_committed_handle.is_valid()) {
         leader_committed_handle = curr_view->gmsSST->predicates.insert(
                 leader_committed_changes, view_change_trig,
-                sst::PredicateType::ONE_TIME);
+                sst::PredicateType::ONE_TIME, "leader_committed_changes");
+    }
+    if(!user_sst_fields_handle.is_valid() && curr_view->gmsSST->user_fields.size() > 0) {
+        // Only runs when some member's user fields change
+        sst::watch_list_t user_fields_watches;
+        for(uint32_t row = 0; row < curr_view->gmsSST->get_num_rows(); ++row) {
+            user_fields_watches.emplace_back(&curr_view->gmsSST->user_fields[row][0], curr_view->gmsSST->user_fields.size());
+        }
+        user_sst_fields_handle = curr_view->gmsSST->predicates.insert(
+                [](const DerechoSST& sst) { return true; },
+                [this](DerechoSST& sst) { report_user_sst_fields(sst); },
+                sst::PredicateType::RECURRENT, user_fields_watches, "user_sst_fields");
     }
 }
 
 /* ------------- 2. Predicate-Triggers That Implement View Management Logic ---------- */
 
 void ViewManager::new_suspicion(DerechoSST& gmsSST) {
-    whenlog(logger->debug("Suspected[] changed"););
+    view_log(DEBUG, "Suspected[] changed");
     View& Vc = *curr_view;
     int myRank = curr_view->my_rank;
     // Aggregate suspicions into gmsSST[myRank].Suspected;
@@ -667,13 +822,13 @@ void ViewManager::new_suspicion(DerechoSST& gmsSST) {
             // This is safer than copy_suspected, since suspected[] might change
             // during this loop
             last_suspected[q] = gmsSST.suspected[myRank][q];
-            whenlog(logger->debug("Marking {} failed", Vc.members[q]););
+            view_log(DEBUG, "Marking {} failed", Vc.members[q]);
 
             if(Vc.num_failed >= (Vc.num_members + 1) / 2) {
                 throw derecho_exception("Majority of a Derecho group simultaneously failed ... shutting down");
             }
 
-            whenlog(logger->debug("GMS telling SST to freeze row {}", q););
+            view_log(DEBUG, "GMS telling SST to freeze row {}", q);
             gmsSST.freeze(q);  // Cease to accept new updates from q
             Vc.multicast_group->wedge();
             gmssst::set(gmsSST.wedged[myRank],
@@ -702,7 +857,7 @@ void ViewManager::new_suspicion(DerechoSST& gmsSST) {
                         gmsSST.changes[myRank][next_change_index],
                         Vc.members[q]);  // Reports the failure (note that q NotIn members)
                 gmssst::increment(gmsSST.num_changes[myRank]);
-                whenlog(logger->debug("Leader proposed a change to remove failed node {}", Vc.members[q]););
+                view_log(DEBUG, "Leader proposed a change to remove failed node {}", Vc.members[q]);
                 gmsSST.put(
                         (char*)std::addressof(gmsSST.changes[0][next_change_index]) - gmsSST.getBaseAddress(),
                         sizeof(gmsSST.changes[0][next_change_index]));
@@ -714,15 +869,42 @@ void ViewManager::new_suspicion(DerechoSST& gmsSST) {
 }
 
 void ViewManager::leader_start_join(DerechoSST& gmsSST) {
-    whenlog(logger->debug("GMS handling a new client connection"););
-    {
-        //Hold the lock on pending_join_sockets while moving a socket into proposed_join_sockets
-        auto pending_join_sockets_locked = pending_join_sockets.locked();
-        proposed_join_sockets.splice(proposed_join_sockets.end(), pending_join_sockets_locked.access, pending_join_sockets_locked.access.begin());
+    first_pending_join_time.reset();
+    //Propose every join that is waiting, or as many as there is room for, as one batch
+    bool proposed_any = false;
+    while(has_pending_join()
+          && gmsSST.num_changes[curr_view->my_rank] - gmsSST.num_committed[curr_view->my_rank]
+                     < (int)gmsSST.changes.size()) {
+        view_log(DEBUG, "GMS handling a new client connection");
+        {
+            //Hold the lock on pending_join_sockets while moving a socket into proposed_join_sockets
+            auto pending_join_sockets_locked = pending_join_sockets.locked();
+            proposed_join_sockets.splice(proposed_join_sockets.end(), pending_join_sockets_locked.access, pending_join_sockets_locked.access.begin());
+        }
+        bool success = receive_join(proposed_join_sockets.back());
+        //If the join failed, close the socket
+        if(!success) {
+            proposed_join_sockets.pop_back();
+        } else {
+            proposed_any = true;
+        }
+    }
+    if(!proposed_any) {
+        return;
     }
-    bool success = receive_join(proposed_join_sockets.back());
-    //If the join failed, close the socket
-    if(!success) proposed_join_sockets.pop_back();
+    view_log(DEBUG, "Wedging view {}", curr_view->vid);
+    curr_view->wedge();
+    view_log(DEBUG, "Leader done wedging view.");
+    /* The proposals are only pushed once they are all in place, so that the
+     * other members acknowledge, and the leader commits, all of them at once.
+     * The puts are separate to be sure that if we were relying on any
+     * ordering guarantees, we won't run into issue when guarantees do not hold */
+    gmsSST.put(gmsSST.changes.get_base() - gmsSST.getBaseAddress(),
+               gmsSST.joiner_ips.get_base() - gmsSST.changes.get_base());
+    gmsSST.put(gmsSST.joiner_ips.get_base() - gmsSST.getBaseAddress(),
+               gmsSST.num_changes.get_base() - gmsSST.joiner_ips.get_base());
+    gmsSST.put(gmsSST.num_changes.get_base() - gmsSST.getBaseAddress(),
+               gmsSST.num_committed.get_base() - gmsSST.num_changes.get_base());
 }
 
 void ViewManager::redirect_join_attempt(DerechoSST& gmsSST) {
@@ -736,16 +918,17 @@ void ViewManager::redirect_join_attempt(DerechoSST& gmsSST) {
     client_socket.read(joiner_id);
     client_socket.write(JoinResponse{JoinResponseCode::LEADER_REDIRECT, curr_view->members[curr_view->my_rank]});
     //Send the client the IP address of the current leader
-    client_socket.write(mutils::bytes_size(std::get<0>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()])));
-    auto bind_socket_write = [&client_socket](const char* bytes, std::size_t size) { client_socket.write(bytes, size); };
-    mutils::post_object(bind_socket_write, std::get<0>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()]));
-    client_socket.write(std::get<PORT_TYPE::GMS>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()]));
+    tcp::buffered_writer client_writer(client_socket);
+    client_writer.write(mutils::bytes_size(std::get<0>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()])));
+    mutils::post_object(client_writer.post_function(), std::get<0>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()]));
+    client_writer.write(std::get<PORT_TYPE::GMS>(curr_view->member_ips_and_ports[curr_view->rank_of_leader()]));
+    client_writer.flush();
 }
 
 void ViewManager::leader_commit_change(DerechoSST& gmsSST) {
     gmssst::set(gmsSST.num_committed[gmsSST.get_local_index()],
                 min_acked(gmsSST, curr_view->failed));  // Leader commits a new request
-    whenlog(logger->debug("Leader committing change proposal #{}", gmsSST.num_committed[gmsSST.get_local_index()]););
+    view_log(DEBUG, "Leader committing change proposal #{}", gmsSST.num_committed[gmsSST.get_local_index()]);
     gmsSST.put(gmsSST.num_committed.get_base() - gmsSST.getBaseAddress(),
                sizeof(gmsSST.num_committed[0]));
 }
@@ -753,7 +936,7 @@ void ViewManager::leader_commit_change(DerechoSST& gmsSST) {
 void ViewManager::acknowledge_proposed_change(DerechoSST& gmsSST) {
     int myRank = gmsSST.get_local_index();
     int leader = curr_view->rank_of_leader();
-    whenlog(logger->debug("Detected that leader proposed change #{}. Acknowledging.", gmsSST.num_changes[leader]););
+    view_log(DEBUG, "Detected that leader proposed change #{}. Acknowledging.", gmsSST.num_changes[leader]);
     if(myRank != leader) {
         // Echo the count
         gmssst::set(gmsSST.num_changes[myRank], gmsSST.num_changes[leader]);
@@ -791,14 +974,14 @@ void ViewManager::acknowledge_proposed_change(DerechoSST& gmsSST) {
     gmsSST.put(gmsSST.num_acked.get_base() - gmsSST.getBaseAddress(),
                gmsSST.num_installed.get_base() - gmsSST.num_acked.get_base());
     gmsSST.put(gmsSST.num_installed.get_base() - gmsSST.getBaseAddress(),
-               gmsSST.num_received.get_base() - gmsSST.num_installed.get_base());
-    whenlog(logger->debug("Wedging current view."););
+               sizeof(gmsSST.num_installed[0]));
+    view_log(DEBUG, "Wedging current view.");
     curr_view->wedge();
-    whenlog(logger->debug("Done wedging current view."););
+    view_log(DEBUG, "Done wedging current view.");
 }
 
 void ViewManager::start_meta_wedge(DerechoSST& gmsSST) {
-    whenlog(logger->debug("Meta-wedging view {}", curr_view->vid););
+    view_log(DEBUG, "Meta-wedging view {}", curr_view->vid);
     // Disable all the other SST predicates, except suspected_changed and the
     // one I'm about to register
     gmsSST.predicates.remove(start_join_handle);
@@ -807,6 +990,7 @@ void ViewManager::start_meta_wedge(DerechoSST& gmsSST) {
     gmsSST.predicates.remove(leader_proposed_handle);
 
     curr_view->wedge();
+    view_change_start_time = std::chrono::steady_clock::now();
 
     /* We now need to wait for all other nodes to wedge the current view,
    * which is called "meta-wedged." To do that, this predicate trigger
@@ -827,27 +1011,27 @@ void ViewManager::start_meta_wedge(DerechoSST& gmsSST) {
         terminate_epoch(next_subgroup_settings, 0, gmsSST);
     };
     gmsSST.predicates.insert(is_meta_wedged, meta_wedged_continuation,
-                             sst::PredicateType::ONE_TIME);
+                             sst::PredicateType::ONE_TIME, "is_meta_wedged");
 }
 
 void ViewManager::terminate_epoch(
         std::shared_ptr<std::map<subgroup_id_t, SubgroupSettings>>
                 next_subgroup_settings,
         uint32_t next_num_received_size, DerechoSST& gmsSST) {
-    whenlog(logger->debug("MetaWedged is true; continuing epoch termination"););
+    view_log(DEBUG, "MetaWedged is true; continuing epoch termination");
     // If this is the first time terminate_epoch() was called, next_view will
     // still be null
     bool first_call = false;
     if(!next_view) {
         first_call = true;
     }
-    std::unique_lock<std::shared_timed_mutex> write_lock(view_mutex);
+    std::unique_lock<ViewLock> write_lock(view_mutex);
     next_view = make_next_view(curr_view, gmsSST whenlog(, logger));
-    whenlog(logger->debug("Checking provisioning of view {}", next_view->vid););
+    view_log(DEBUG, "Checking provisioning of view {}", next_view->vid);
     next_subgroup_settings->clear();
     next_num_received_size = make_subgroup_maps(subgroup_info, curr_view, *next_view, *next_subgroup_settings);
     if(!next_view->is_adequately_provisioned) {
-        whenlog(logger->debug("Next view would not be adequately provisioned, waiting for more joins."););
+        view_log(DEBUG, "Next view would not be adequately provisioned, waiting for more joins.");
         if(first_call) {
             // Re-register the predicates for accepting and acknowledging joins
             register_predicates();
@@ -866,7 +1050,7 @@ void ViewManager::terminate_epoch(
             terminate_epoch(next_subgroup_settings, next_num_received_size, sst);
         };
         gmsSST.predicates.insert(leader_committed_change, retry_next_view,
-                                 sst::PredicateType::ONE_TIME);
+                                 sst::PredicateType::ONE_TIME, "leader_committed_change");
         return;
     }
     // If execution reached here, we have a valid next view
@@ -876,16 +1060,7 @@ void ViewManager::terminate_epoch(
         curr_view->multicast_group->get_subgroup_settings()) {
         const subgroup_id_t subgroup_id = shard_settings_pair.first;
         const auto& curr_subgroup_settings = shard_settings_pair.second;
-        auto num_shard_members = curr_subgroup_settings.members.size();
-        std::vector<int> shard_senders = curr_subgroup_settings.senders;
-        auto num_shard_senders = curr_view->multicast_group->get_num_senders(shard_senders);
-        std::map<uint32_t, uint32_t> shard_ranks_by_sender_rank;
-        for(uint j = 0, l = 0; j < num_shard_members; ++j) {
-            if(shard_senders[j]) {
-                shard_ranks_by_sender_rank[l] = j;
-                l++;
-            }
-        }
+        auto num_shard_senders = curr_view->multicast_group->get_num_senders(curr_subgroup_settings.senders);
         // wait for all pending sst sends to finish
         while(curr_view->multicast_group->check_pending_sst_sends(subgroup_id)) {
         }
@@ -893,20 +1068,18 @@ void ViewManager::terminate_epoch(
         curr_view->gmsSST->sync_with_members(
                 curr_view->multicast_group->get_shard_sst_indices(subgroup_id));
         while(curr_view->multicast_group->receiver_predicate(
-                subgroup_id, curr_subgroup_settings, shard_ranks_by_sender_rank,
-                num_shard_senders, *curr_view->gmsSST)) {
+                subgroup_id, curr_subgroup_settings, num_shard_senders, *curr_view->gmsSST)) {
             auto sst_receive_handler_lambda =
-                    [this, subgroup_id, curr_subgroup_settings,
-                     shard_ranks_by_sender_rank, num_shard_senders](
+                    [this, subgroup_id, curr_subgroup_settings, num_shard_senders](
                             uint32_t sender_rank, volatile char* data, uint32_t size) {
                         curr_view->multicast_group->sst_receive_handler(
-                                subgroup_id, curr_subgroup_settings, shard_ranks_by_sender_rank,
+                                subgroup_id, curr_subgroup_settings,
                                 num_shard_senders, sender_rank, data, size);
                     };
             curr_view->multicast_group->receiver_function(
-                    subgroup_id, curr_subgroup_settings, shard_ranks_by_sender_rank,
+                    subgroup_id, curr_subgroup_settings,
                     num_shard_senders, *curr_view->gmsSST,
-                    curr_view->multicast_group->window_size, sst_receive_handler_lambda);
+                    curr_subgroup_settings.window_size, sst_receive_handler_lambda);
         }
     }
 
@@ -914,8 +1087,10 @@ void ViewManager::terminate_epoch(
     curr_view->gmsSST->sync_with_members();
 
     // First, for subgroups in which I'm the shard leader, do RaggedEdgeCleanup
-    // for the leader
+    // for the leader. The ragged trims of all subgroups are logged to disk
+    // together, in one file, once every subgroup has done its cleanup.
     auto follower_subgroups_and_shards = std::make_shared<std::map<subgroup_id_t, uint32_t>>();
+    auto ragged_trims = std::make_shared<std::vector<RaggedTrim>>();
     for(const auto& shard_settings_pair :
         curr_view->multicast_group->get_subgroup_settings()) {
         const subgroup_id_t subgroup_id = shard_settings_pair.first;
@@ -928,10 +1103,10 @@ void ViewManager::terminate_epoch(
         }
         if(num_shard_senders) {
             if(shard_view.my_rank == curr_view->subview_rank_of_shard_leader(subgroup_id, shard_num)) {
-                leader_ragged_edge_cleanup(
+                ragged_trims->emplace_back(leader_ragged_edge_cleanup(
                         *curr_view, subgroup_id,
                         shard_settings_pair.second.num_received_offset, shard_view.members,
-                        num_shard_senders, whenlog(logger, ) next_view->members);
+                        num_shard_senders, whenlog(logger, ) next_view->members));
             } else {
                 // Keep track of which subgroups I'm a non-leader in, and what my
                 // corresponding shard ID is
@@ -940,96 +1115,101 @@ void ViewManager::terminate_epoch(
         }
     }
 
-    // Wait for the shard leaders of subgroups I'm not a leader in to post
-    // global_min_ready before continuing
-    auto leader_global_mins_are_ready =
-            [this, follower_subgroups_and_shards](const DerechoSST& gmsSST) {
-                for(const auto& subgroup_shard_pair : *follower_subgroups_and_shards) {
-                    SubView& shard_view = curr_view->subgroup_shard_views.at(subgroup_shard_pair.first)
-                                                  .at(subgroup_shard_pair.second);
-                    node_id_t shard_leader = shard_view.members.at(curr_view->subview_rank_of_shard_leader(
-                            subgroup_shard_pair.first, subgroup_shard_pair.second));
-                    if(!gmsSST.global_min_ready[curr_view->rank_of(shard_leader)]
-                                               [subgroup_shard_pair.first])
-                        return false;
+    // Wait for persistence to finish for messages delivered in RaggedEdgeCleanup
+    auto persistence_finished_pred = [this](const DerechoSST& gmsSST) {
+        // For each subgroup/shard that this node is a member of...
+        for(auto subgroup_shard_pair : curr_view->my_subgroups) {
+            subgroup_id_t subgroup_id = subgroup_shard_pair.first;
+            const uint32_t shard_num = subgroup_shard_pair.second;
+            const Mode mode = curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num).mode;
+            if(mode != Mode::ORDERED && mode != Mode::SEQUENCED) {
+                // Skip non-ordered subgroups, they never do persistence
+                continue;
+            }
+            message_id_t last_delivered_seq_num = gmsSST.delivered_num[curr_view->my_rank][subgroup_id];
+            // For each member of that shard...
+            for(const node_id_t& shard_member : curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num).members) {
+                uint member_row = curr_view->rank_of(shard_member);
+                // Check to see if the member persisted up to the ragged edge trim
+                if(!curr_view->failed[member_row] && persistent::unpack_version<int32_t>(gmsSST.persisted_num[member_row][subgroup_id]).second < last_delivered_seq_num) {
+                    return false;
                 }
-                return true;
-            };
+            }
+        }
+        return true;
+    };
 
-    auto global_min_ready_continuation =
+    auto finish_view_change_trig =
             [this, follower_subgroups_and_shards, next_subgroup_settings,
              next_num_received_size](DerechoSST& gmsSST) {
-                whenlog(logger->debug("GlobalMins are ready for all {} subgroup leaders this node is waiting on", follower_subgroups_and_shards->size()););
-                // Finish RaggedEdgeCleanup for subgroups in which I'm not the leader
-                for(const auto& subgroup_shard_pair : *follower_subgroups_and_shards) {
-                    const subgroup_id_t subgroup_id = subgroup_shard_pair.first;
-                    const uint32_t shard_num = subgroup_shard_pair.second;
-                    SubView& shard_view = curr_view->subgroup_shard_views.at(subgroup_id)
-                                                  .at(shard_num);
-                    uint num_shard_senders = 0;
-                    for(auto v : shard_view.is_sender) {
-                        if(v)
-                            num_shard_senders++;
-                    }
-                    node_id_t shard_leader = shard_view.members[curr_view->subview_rank_of_shard_leader(
-                            subgroup_id, shard_num)];
-                    follower_ragged_edge_cleanup(
-                            *curr_view, subgroup_id,
-                            curr_view->rank_of(shard_leader),
-                            curr_view->multicast_group->get_subgroup_settings()
-                                    .at(subgroup_id)
-                                    .num_received_offset,
-                            shard_view.members, num_shard_senders whenlog(, logger));
-                }
-
-                // Wait for persistence to finish for messages delivered in RaggedEdgeCleanup
-                auto persistence_finished_pred = [this](const DerechoSST& gmsSST) {
-                    // For each subgroup/shard that this node is a member of...
-                    for(auto subgroup_shard_pair : curr_view->my_subgroups) {
-                        subgroup_id_t subgroup_id = subgroup_shard_pair.first;
-                        const uint32_t shard_num = subgroup_shard_pair.second;
-                        if(curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num).mode == Mode::UNORDERED) {
-                            // Skip non-ordered subgroups, they never do persistence
-                            continue;
-                        }
-                        message_id_t last_delivered_seq_num = gmsSST.delivered_num[curr_view->my_rank][subgroup_id];
-                        // For each member of that shard...
-                        for(const node_id_t& shard_member : curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num).members) {
-                            uint member_row = curr_view->rank_of(shard_member);
-                            // Check to see if the member persisted up to the ragged edge trim
-                            if(!curr_view->failed[member_row] && persistent::unpack_version<int32_t>(gmsSST.persisted_num[member_row][subgroup_id]).second < last_delivered_seq_num) {
-                                return false;
-                            }
-                        }
-                    }
-                    return true;
-                };
-
-                auto finish_view_change_trig =
-                        [this, follower_subgroups_and_shards, next_subgroup_settings,
-                         next_num_received_size](DerechoSST& gmsSST) {
-                            finish_view_change(follower_subgroups_and_shards,
-                                               next_subgroup_settings, next_num_received_size,
-                                               gmsSST);
-                        };
-
-                // Last statement in global_min_ready_continuation: register finish_view_change_trig
-                gmsSST.predicates.insert(persistence_finished_pred,
-                                         finish_view_change_trig,
-                                         sst::PredicateType::ONE_TIME);
+                finish_view_change(follower_subgroups_and_shards,
+                                   next_subgroup_settings, next_num_received_size,
+                                   gmsSST);
             };
 
-    // Last statement in finish_view_change: register global_min_ready_continuation
-    gmsSST.predicates.insert(leader_global_mins_are_ready,
-                             global_min_ready_continuation,
-                             sst::PredicateType::ONE_TIME);
+    auto wait_for_persistence = [this, ragged_trims, persistence_finished_pred, finish_view_change_trig](DerechoSST& gmsSST) {
+        view_log(DEBUG, "Logging {} ragged trims to disk", ragged_trims->size());
+        RaggedTrimLog trim_log(std::move(*ragged_trims));
+        persistent::saveObject(trim_log, ragged_trim_log_name);
+        gmsSST.predicates.insert(persistence_finished_pred,
+                                 finish_view_change_trig,
+                                 sst::PredicateType::ONE_TIME, "persistence_finished_pred");
+    };
+
+    if(follower_subgroups_and_shards->empty()) {
+        wait_for_persistence(gmsSST);
+        return;
+    }
+
+    // Finish RaggedEdgeCleanup for each subgroup I'm not the leader in as soon
+    // as its shard leader posts global_min_ready, so that a slow shard doesn't
+    // hold up the others; the last one to finish waits for persistence. All of
+    // these predicates are evaluated by the same thread.
+    auto num_cleanups_pending = std::make_shared<uint32_t>(follower_subgroups_and_shards->size());
+    for(const auto& subgroup_shard_pair : *follower_subgroups_and_shards) {
+        const subgroup_id_t subgroup_id = subgroup_shard_pair.first;
+        const uint32_t shard_num = subgroup_shard_pair.second;
+        SubView& shard_view = curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num);
+        const uint32_t shard_leader_rank = curr_view->rank_of(shard_view.members.at(
+                curr_view->subview_rank_of_shard_leader(subgroup_id, shard_num)));
+
+        auto leader_global_min_is_ready = [subgroup_id, shard_leader_rank](const DerechoSST& gmsSST) {
+            return gmsSST.global_min_ready[shard_leader_rank][subgroup_id];
+        };
+
+        auto follower_cleanup = [this, subgroup_id, shard_num, shard_leader_rank,
+                                 num_cleanups_pending, wait_for_persistence](DerechoSST& gmsSST) {
+            view_log(DEBUG, "GlobalMin is ready for subgroup {}", subgroup_id);
+            SubView& shard_view = curr_view->subgroup_shard_views.at(subgroup_id).at(shard_num);
+            uint num_shard_senders = 0;
+            for(auto v : shard_view.is_sender) {
+                if(v)
+                    num_shard_senders++;
+            }
+            ragged_trims->emplace_back(follower_ragged_edge_cleanup(
+                    *curr_view, subgroup_id, shard_leader_rank,
+                    curr_view->multicast_group->get_subgroup_settings()
+                            .at(subgroup_id)
+                            .num_received_offset,
+                    shard_view.members, num_shard_senders whenlog(, logger)));
+            if(--(*num_cleanups_pending) == 0) {
+                view_log(DEBUG, "Finished RaggedEdgeCleanup for all subgroups this node is a follower in");
+                wait_for_persistence(gmsSST);
+            }
+        };
+
+        gmsSST.predicates.insert(leader_global_min_is_ready, follower_cleanup,
+                                 sst::PredicateType::ONE_TIME,
+                                 {sst::WatchedRange(&gmsSST.global_min_ready[shard_leader_rank][subgroup_id])},
+                                 "leader_global_min_is_ready subgroup " + std::to_string(subgroup_id));
+    }
 }
 
 void ViewManager::finish_view_change(
         std::shared_ptr<std::map<subgroup_id_t, uint32_t>> follower_subgroups_and_shards,
         std::shared_ptr<std::map<subgroup_id_t, SubgroupSettings>> next_subgroup_settings,
         uint32_t next_num_received_size, DerechoSST& gmsSST) {
-    std::unique_lock<std::shared_timed_mutex> write_lock(view_mutex);
+    std::unique_lock<ViewLock> write_lock(view_mutex);
 
     // Disable all the other SST predicates, except suspected_changed
     gmsSST.predicates.remove(start_join_handle);
@@ -1054,16 +1234,18 @@ void ViewManager::finish_view_change(
     // deleting it
     gmsSST.predicates.remove(leader_committed_handle);
     gmsSST.predicates.remove(suspected_changed_handle);
+    gmsSST.predicates.remove(user_sst_fields_handle);
 
     node_id_t my_id = next_view->members[next_view->my_rank];
-    whenlog(logger->debug("Starting creation of new SST and DerechoGroup for view {}", next_view->vid););
+    view_log(DEBUG, "Starting creation of new SST and DerechoGroup for view {}", next_view->vid);
     for(const node_id_t failed_node_id : next_view->departed) {
-        whenlog(logger->debug("Removing global TCP connections for failed node {} from RDMC and SST", failed_node_id););
+        view_log(DEBUG, "Removing global TCP connections for failed node {} from RDMC and SST", failed_node_id);
 #ifdef USE_VERBS_API
         rdma::impl::verbs_remove_connection(failed_node_id);
 #else
         rdma::impl::lf_remove_connection(failed_node_id);
 #endif
+        rdmc::remove_node(failed_node_id);
         sst::remove_node(failed_node_id);
     }
     // if new members have joined, add their RDMA connections to SST and RDMC
@@ -1071,7 +1253,7 @@ void ViewManager::finish_view_change(
         // The new members will be the last joined.size() elements of the members
         // lists
         int joiner_rank = next_view->num_members - next_view->joined.size() + i;
-        whenlog(logger->debug("Adding RDMC connection to node {}, at IP {} and port {}", next_view->members[joiner_rank], std::get<0>(next_view->member_ips_and_ports[joiner_rank]), std::get<PORT_TYPE::RDMC>(next_view->member_ips_and_ports[joiner_rank])););
+        view_log(DEBUG, "Adding RDMC connection to node {}, at IP {} and port {}", next_view->members[joiner_rank], std::get<0>(next_view->member_ips_and_ports[joiner_rank]), std::get<PORT_TYPE::RDMC>(next_view->member_ips_and_ports[joiner_rank]));
 
 #ifdef USE_VERBS_API
         rdma::impl::verbs_add_connection(next_view->members[joiner_rank],
@@ -1104,19 +1286,17 @@ void ViewManager::finish_view_change(
             // Send the array of old shard leaders, so the new member knows who to
             // receive from
             std::size_t size_of_vector = mutils::bytes_size(old_shard_leaders_by_id);
-            joiner_sockets.front().write(size_of_vector);
-            mutils::post_object(
-                    [&joiner_sockets](const char* bytes, std::size_t size) {
-                        joiner_sockets.front().write(bytes, size);
-                    },
-                    old_shard_leaders_by_id);
+            tcp::buffered_writer joiner_writer(joiner_sockets.front());
+            joiner_writer.write(size_of_vector);
+            mutils::post_object(joiner_writer.post_function(), old_shard_leaders_by_id);
+            joiner_writer.flush();
             joiner_sockets.pop_front();
         }
     }
     // New members can now proceed to view_manager.start(), which will call sync()
     next_view->gmsSST->put();
     next_view->gmsSST->sync_with_members();
-    whenlog(logger->debug("Done setting up SST and DerechoGroup for view {}", next_view->vid););
+    view_log(DEBUG, "Done setting up SST and DerechoGroup for view {}", next_view->vid);
     {
         lock_guard_t old_views_lock(old_views_mutex);
         old_views.push(std::move(curr_view));
@@ -1150,27 +1330,176 @@ void ViewManager::finish_view_change(
 
     // Re-initialize this node's RPC objects, which includes receiving them
     // from shard leaders if it is newly a member of a subgroup
-    whenlog(logger->debug("Initializing local Replicated Objects"););
+    view_log(DEBUG, "Initializing local Replicated Objects");
     initialize_subgroup_objects(my_id, *curr_view, old_shard_leaders_by_id);
     // It's only safe to start evaluating predicates once all RPC objects exist
     curr_view->gmsSST->start_predicate_evaluation();
+    view_metrics.view_changes.add();
+    view_metrics.view_change_time_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                 std::chrono::steady_clock::now() - view_change_start_time)
+                                                 .count());
+    view_metrics.vid.set(curr_view->vid);
+    view_metrics.num_members.set(curr_view->num_members);
     view_change_cv.notify_all();
 }
 
 /* ------------- 3. Helper Functions for Predicates and Triggers -------------
  */
 
+std::pair<uint64_t, uint32_t> ViewManager::lay_out_subgroups(const View& view, const DerechoParams& group_params,
+                                                             std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings) {
+    uint64_t slots_size = 0;
+    uint32_t sequence_order_size = 0;
+    /* A row's slots are only written by the member the row belongs to, in the
+     * subgroups it sends in, so the windows of subgroups that have no sender
+     * in common can overlap. Each subgroup's window goes at the lowest offset
+     * where it overlaps no window of a subgroup it shares a sender with, and
+     * the slots only take as much of each row as the busiest senders need. */
+    struct slot_window {
+        uint64_t offset;
+        uint64_t size;
+        std::vector<node_id_t> senders;
+    };
+    std::vector<slot_window> slot_windows;
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < view.subgroup_shard_views.size(); ++subgroup_num) {
+        const std::vector<SubView>& shard_views = view.subgroup_shard_views[subgroup_num];
+        // The membership functions give every shard of a subgroup the same profile
+        const std::string& profile = shard_views.empty() ? "" : shard_views[0].profile;
+        const DerechoParams params = group_params.for_profile(profile);
+        const uint64_t sst_max_msg_size = params.max_smc_payload_size + sizeof(header);
+        uint32_t max_shard_senders = 0;
+        bool sequenced = false;
+        std::vector<node_id_t> senders;
+        for(const SubView& shard_view : shard_views) {
+            if(shard_view.num_senders() > max_shard_senders) {
+                // As make_subgroup_maps counts the subgroup's num_received entries
+                max_shard_senders = shard_view.members.size();
+            }
+            sequenced = sequenced || shard_view.mode == Mode::SEQUENCED;
+            for(std::size_t rank = 0; rank < shard_view.members.size(); ++rank) {
+                if(shard_view.is_sender[rank]) {
+                    senders.push_back(shard_view.members[rank]);
+                }
+            }
+        }
+        const uint64_t window_bytes = (sst_max_msg_size + 2 * sizeof(uint64_t)) * params.window_size;
+        uint64_t slots_offset = 0;
+        for(bool moved = true; moved;) {
+            moved = false;
+            for(const slot_window& placed : slot_windows) {
+                if(slots_offset < placed.offset + placed.size && placed.offset < slots_offset + window_bytes
+                   && std::find_first_of(senders.begin(), senders.end(), placed.senders.begin(), placed.senders.end())
+                              != senders.end()) {
+                    slots_offset = placed.offset + placed.size;
+                    moved = true;
+                }
+            }
+        }
+        slots_size = std::max(slots_size, slots_offset + window_bytes);
+        auto settings = subgroup_settings.find(subgroup_num);
+        if(settings != subgroup_settings.end()) {
+            SubgroupSettings& curr_subgroup_settings = settings->second;
+            curr_subgroup_settings.block_size = params.block_size;
+            curr_subgroup_settings.max_msg_size = MulticastGroup::compute_max_msg_size(
+                    params.max_payload_size, params.block_size, params.max_payload_size > params.max_smc_payload_size);
+            curr_subgroup_settings.sst_max_msg_size = sst_max_msg_size;
+            curr_subgroup_settings.inline_max_msg_size = MulticastGroup::compute_inline_max_msg_size(sst_max_msg_size);
+            curr_subgroup_settings.rdmc_send_algorithm = params.rdmc_send_algorithm;
+            curr_subgroup_settings.window_size = params.window_size;
+            curr_subgroup_settings.max_outstanding_rdmc_sends = params.max_outstanding_rdmc_sends;
+            curr_subgroup_settings.persistence_window = params.persistence_window == 0 ? params.window_size
+                                                                                       : params.persistence_window;
+            curr_subgroup_settings.rdmc_compression = params.rdmc_compression;
+            curr_subgroup_settings.rdmc_send_token = params.rdmc_send_token;
+            curr_subgroup_settings.slots_offset = slots_offset;
+            curr_subgroup_settings.sequence_order_offset = sequence_order_size;
+            // Only this node's threads depend on it, so the members needn't agree
+            const std::string executor_key = CONF_SUBGROUP_PREFIX + profile + "/delivery_executor";
+            curr_subgroup_settings.delivery_executor = !profile.empty() && hasConfKey(executor_key)
+                                                               ? getConfBoolean(executor_key)
+                                                               : getConfBoolean(CONF_DERECHO_DELIVERY_EXECUTOR);
+            // Each member publishes its own persisted_num, so this is local too
+            const std::string replicas_key = CONF_SUBGROUP_PREFIX + profile + "/memory_durable_replicas";
+            const uint32_t memory_durable_replicas = !profile.empty() && hasConfKey(replicas_key)
+                                                             ? getConfUInt32(replicas_key)
+                                                             : getConfUInt32(CONF_PERS_MEMORY_DURABLE_REPLICAS);
+            curr_subgroup_settings.persist_in_memory = memory_durable_replicas > 0
+                                                       && curr_subgroup_settings.members.size() > memory_durable_replicas
+                                                       && (curr_subgroup_settings.mode == Mode::ORDERED
+                                                           || curr_subgroup_settings.mode == Mode::SEQUENCED);
+            if(!profile.empty() && hasConfKey(CONF_SUBGROUP_PREFIX + profile + "/send_priority")) {
+                curr_subgroup_settings.send_priority = getConfInt32(CONF_SUBGROUP_PREFIX + profile + "/send_priority");
+            }
+            if(!profile.empty() && hasConfKey(CONF_SUBGROUP_PREFIX + profile + "/send_weight")) {
+                curr_subgroup_settings.send_weight = std::max(1u, getConfUInt32(CONF_SUBGROUP_PREFIX + profile + "/send_weight"));
+            }
+        }
+        slot_windows.push_back({slots_offset, window_bytes, std::move(senders)});
+        if(sequenced) {
+            // A window of the delivery order per num_received entry
+            sequence_order_size += max_shard_senders * params.window_size;
+        }
+    }
+    return {slots_size, sequence_order_size};
+}
+
+RegisteredMemoryPlan ViewManager::plan_registered_memory(const View& view, const DerechoParams& group_params,
+                                                         const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                                         uint64_t slots_size, uint32_t sequence_order_size) {
+    const uint64_t num_members = view.members.size();
+    RegisteredMemoryPlan plan;
+    plan.sst_bytes = num_members * (slots_size + sequence_order_size * sizeof(uint16_t));
+    // RPCManager keeps a P2P connection to every member, including itself
+    plan.p2p_bytes = 2 * num_members * sst::P2PConnections::buffer_size(group_params.window_size, group_params.p2p_payload_size());
+    plan.rdmc_bytes = MulticastGroup::reserved_message_buffer_bytes(subgroup_settings);
+    return plan;
+}
+
+void ViewManager::check_registered_memory(const View& view, const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                          uint64_t slots_size, uint32_t sequence_order_size) {
+    const RegisteredMemoryPlan plan = plan_registered_memory(view, derecho_params, subgroup_settings,
+                                                             slots_size, sequence_order_size);
+    whenlog(logger->info("View {} needs {} bytes of registered memory: {} for SST slots, {} for P2P buffers, {} for RDMC buffers",
+                         view.vid, plan.total(), plan.sst_bytes, plan.p2p_bytes, plan.rdmc_bytes););
+    const uint64_t max_registered_memory = getConfUInt64(CONF_DERECHO_MAX_REGISTERED_MEMORY);
+    if(max_registered_memory == 0 || plan.total() <= max_registered_memory) {
+        return;
+    }
+    std::ostringstream message;
+    message << "View " << view.vid << " needs " << plan.total() << " bytes of registered memory, more than max_registered_memory ("
+            << max_registered_memory << "): " << plan.sst_bytes << " for SST slots, " << plan.p2p_bytes
+            << " for P2P buffers, and " << plan.rdmc_bytes << " for RDMC buffers. ";
+    if(plan.sst_bytes >= plan.p2p_bytes && plan.sst_bytes >= plan.rdmc_bytes) {
+        message << "The SST slots are largest; lower max_smc_payload_size, or window_size in the group or in the profiles of its largest subgroups.";
+    } else if(plan.p2p_bytes >= plan.rdmc_bytes) {
+        message << "The P2P buffers are largest; set p2p_slot_size below max_payload_size, or lower window_size.";
+    } else {
+        message << "The RDMC buffers are largest; lower max_payload_size or window_size, in the group or in the profiles of its subgroups with large messages.";
+    }
+    // All three grow about linearly with the window
+    message << " All three shrink with window_size: about "
+            << std::max<uint64_t>(1, derecho_params.window_size * max_registered_memory / plan.total())
+            << " or less would fit.";
+    throw derecho_exception(message.str());
+}
+
 void ViewManager::construct_multicast_group(CallbackSet callbacks,
-                                            const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                            std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
                                             const uint32_t num_received_size) {
     const auto num_subgroups = curr_view->subgroup_shard_views.size();
+    const auto [slots_size, sequence_order_size] = lay_out_subgroups(*curr_view, derecho_params, subgroup_settings);
+    check_registered_memory(*curr_view, subgroup_settings, slots_size, sequence_order_size);
     curr_view->gmsSST = std::make_shared<DerechoSST>(
             sst::SSTParams(
                     curr_view->members, curr_view->members[curr_view->my_rank],
                     [this](const uint32_t node_id) { report_failure(node_id); },
-                    curr_view->failed, false),
-            num_subgroups, num_received_size, derecho_params.window_size,
-            derecho_params.max_smc_payload_size + sizeof(header) + 2 * sizeof(uint64_t));
+                    curr_view->failed, false,
+                    getConfUInt32(CONF_DERECHO_SST_PREDICATE_THREADS), get_sst_predicate_cpus(),
+                    get_sst_backoff_policy(), getConfBoolean(CONF_DERECHO_SST_CACHE_LINE_LAYOUT),
+                    getConfBoolean(CONF_DERECHO_SST_PROFILE_PREDICATES),
+                    getConfUInt64(CONF_DERECHO_SST_PROFILE_DUMP_INTERVAL_MS)),
+            num_subgroups, num_received_size, slots_size, sequence_order_size,
+            getConfUInt32(CONF_DERECHO_USER_SST_FIELDS));
 
     curr_view->multicast_group = std::make_unique<MulticastGroup>(
             curr_view->members, curr_view->members[curr_view->my_rank],
@@ -1179,16 +1508,22 @@ void ViewManager::construct_multicast_group(CallbackSet callbacks,
 }
 
 void ViewManager::transition_multicast_group(
-        const std::map<subgroup_id_t, SubgroupSettings>& new_subgroup_settings,
+        std::map<subgroup_id_t, SubgroupSettings>& new_subgroup_settings,
         const uint32_t new_num_received_size) {
     const auto num_subgroups = next_view->subgroup_shard_views.size();
+    const auto [slots_size, sequence_order_size] = lay_out_subgroups(*next_view, derecho_params, new_subgroup_settings);
+    check_registered_memory(*next_view, new_subgroup_settings, slots_size, sequence_order_size);
     next_view->gmsSST = std::make_shared<DerechoSST>(
             sst::SSTParams(
                     next_view->members, next_view->members[next_view->my_rank],
                     [this](const uint32_t node_id) { report_failure(node_id); },
-                    next_view->failed, false),
-            num_subgroups, new_num_received_size, derecho_params.window_size,
-            derecho_params.max_smc_payload_size + sizeof(header) + 2 * sizeof(uint64_t));
+                    next_view->failed, false,
+                    getConfUInt32(CONF_DERECHO_SST_PREDICATE_THREADS), get_sst_predicate_cpus(),
+                    get_sst_backoff_policy(), getConfBoolean(CONF_DERECHO_SST_CACHE_LINE_LAYOUT),
+                    getConfBoolean(CONF_DERECHO_SST_PROFILE_PREDICATES),
+                    getConfUInt64(CONF_DERECHO_SST_PROFILE_DUMP_INTERVAL_MS)),
+            num_subgroups, new_num_received_size, slots_size, sequence_order_size,
+            getConfUInt32(CONF_DERECHO_USER_SST_FIELDS));
 
     next_view->multicast_group = std::make_unique<MulticastGroup>(
             next_view->members, next_view->members[next_view->my_rank],
@@ -1218,7 +1553,8 @@ bool ViewManager::receive_join(tcp::socket& client_socket) {
     node_id_t joining_client_id = 0;
     client_socket.read(joining_client_id);
 
-    if(curr_view->rank_of(joining_client_id) != -1) {
+    //A node proposed earlier in the same batch has taken the ID as well
+    if(curr_view->rank_of(joining_client_id) != -1 || changes_contains(gmsSST, joining_client_id)) {
         whenlog(logger->warn("Joining node at IP {} announced it has ID {}, which is already in the View!", client_socket.get_remote_ip(), joining_client_id););
         client_socket.write(JoinResponse{JoinResponseCode::ID_IN_USE, curr_view->members[curr_view->my_rank]});
         return false;
@@ -1234,7 +1570,7 @@ bool ViewManager::receive_join(tcp::socket& client_socket) {
     uint16_t joiner_rdmc_port = 0;
     client_socket.read(joiner_rdmc_port);
 
-    whenlog(logger->debug("Proposing change to add node {}", joining_client_id););
+    view_log(DEBUG, "Proposing change to add node {}", joining_client_id);
     size_t next_change = gmsSST.num_changes[curr_view->my_rank] - gmsSST.num_installed[curr_view->my_rank];
     gmssst::set(gmsSST.changes[curr_view->my_rank][next_change],
                 joining_client_id);
@@ -1250,40 +1586,30 @@ bool ViewManager::receive_join(tcp::socket& client_socket) {
                 joiner_rdmc_port);
 
     gmssst::increment(gmsSST.num_changes[curr_view->my_rank]);
-
-    whenlog(logger->debug("Wedging view {}", curr_view->vid););
-    curr_view->wedge();
-    whenlog(logger->debug("Leader done wedging view."););
-    // gmsSST.put(gmsSST.changes.get_base() - gmsSST.getBaseAddress(),
-    // gmsSST.num_committed.get_base() - gmsSST.changes.get_base());
-    /* breaking the above put statement into individual put calls, to be sure
-       * that if we were relying on any ordering guarantees, we won't run into
-       * issue when guarantees do not hold*/
-    gmsSST.put(gmsSST.changes.get_base() - gmsSST.getBaseAddress(),
-               gmsSST.joiner_ips.get_base() - gmsSST.changes.get_base());
-    gmsSST.put(gmsSST.joiner_ips.get_base() - gmsSST.getBaseAddress(),
-               gmsSST.num_changes.get_base() - gmsSST.joiner_ips.get_base());
-    gmsSST.put(gmsSST.num_changes.get_base() - gmsSST.getBaseAddress(),
-               gmsSST.num_committed.get_base() - gmsSST.num_changes.get_base());
     return true;
 }
 
 void ViewManager::commit_join(const View& new_view, tcp::socket& client_socket) {
-    whenlog(logger->debug("Sending client the new view"););
-    auto bind_socket_write = [&client_socket](const char* bytes, std::size_t size) { client_socket.write(bytes, size); };
+    view_log(DEBUG, "Sending client the new view");
     StreamlinedView view_memento(new_view);
     std::size_t size_of_view = mutils::bytes_size(view_memento);
-    client_socket.write(size_of_view);
-    mutils::post_object(bind_socket_write, view_memento);
+    std::vector<char> view_buffer(size_of_view);
+    mutils::to_bytes(view_memento, view_buffer.data());
     std::size_t size_of_derecho_params = mutils::bytes_size(derecho_params);
-    client_socket.write(size_of_derecho_params);
-    mutils::post_object(bind_socket_write, derecho_params);
+    std::vector<char> params_buffer(size_of_derecho_params);
+    mutils::to_bytes(derecho_params, params_buffer.data());
     //Send True to indicate that the client should commit this View (for compatibility with restart mode)
-    client_socket.write(true);
+    const bool commit = true;
+    client_socket.writev({{reinterpret_cast<const char*>(&size_of_view), sizeof(size_of_view)},
+                          {view_buffer.data(), size_of_view},
+                          {reinterpret_cast<const char*>(&size_of_derecho_params), sizeof(size_of_derecho_params)},
+                          {params_buffer.data(), size_of_derecho_params},
+                          {reinterpret_cast<const char*>(&commit), sizeof(commit)}});
 }
 
 void ViewManager::send_objects_to_new_members(const std::vector<std::vector<int64_t>>& old_shard_leaders) {
     node_id_t my_id = curr_view->members[curr_view->my_rank];
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_by_joiner;
     for(subgroup_id_t subgroup_id = 0; subgroup_id < old_shard_leaders.size(); ++subgroup_id) {
         for(uint32_t shard = 0; shard < old_shard_leaders[subgroup_id].size(); ++shard) {
             //if I was the leader of the shard in the old view...
@@ -1291,12 +1617,72 @@ void ViewManager::send_objects_to_new_members(const std::vector<std::vector<int6
                 //send its object state to the new members
                 for(node_id_t shard_joiner : curr_view->subgroup_shard_views[subgroup_id][shard].joined) {
                     if(shard_joiner != my_id) {
-                        send_subgroup_object(subgroup_id, shard_joiner);
+                        subgroups_by_joiner[shard_joiner].push_back(subgroup_id);
                     }
                 }
             }
         }
     }
+    send_subgroup_objects(subgroups_by_joiner);
+}
+
+void ViewManager::send_subgroup_objects(const std::map<node_id_t, std::vector<subgroup_id_t>>& subgroups_by_receiver) {
+    //The background sends of the last view change come first on their sockets
+    for(auto& transfer_thread : background_transfer_threads) {
+        transfer_thread.join();
+    }
+    background_transfer_threads.clear();
+    //In background state transfer, only the persistent subgroups are sent now,
+    //since the receiver needs their logs before it can persist anything; the
+    //others are copied as they are, and sent while the new view runs
+    const bool background_transfer = getConfBoolean(CONF_DERECHO_BACKGROUND_STATE_TRANSFER);
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_to_send_now;
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_to_send_later;
+    for(const auto& receiver_and_subgroups : subgroups_by_receiver) {
+        for(subgroup_id_t subgroup_id : receiver_and_subgroups.second) {
+            if(background_transfer && !subgroup_objects.at(subgroup_id).get().is_persistent()) {
+                subgroups_to_send_later[receiver_and_subgroups.first].push_back(subgroup_id);
+            } else {
+                subgroups_to_send_now[receiver_and_subgroups.first].push_back(subgroup_id);
+            }
+        }
+    }
+    if(subgroups_to_send_now.size() == 1) {
+        for(subgroup_id_t subgroup_id : subgroups_to_send_now.begin()->second) {
+            send_subgroup_object(subgroup_id, subgroups_to_send_now.begin()->first);
+        }
+    } else {
+        //Each receiver has its own socket, so send to all of them at once; a receiver
+        //expects its objects in ascending order of subgroup ID, as they are listed
+        std::vector<std::thread> sender_threads;
+        for(const auto& receiver_and_subgroups : subgroups_to_send_now) {
+            sender_threads.emplace_back([this, &receiver_and_subgroups]() {
+                for(subgroup_id_t subgroup_id : receiver_and_subgroups.second) {
+                    send_subgroup_object(subgroup_id, receiver_and_subgroups.first);
+                }
+            });
+        }
+        for(auto& sender_thread : sender_threads) {
+            sender_thread.join();
+        }
+    }
+    for(const auto& receiver_and_subgroups : subgroups_to_send_later) {
+        std::vector<std::vector<char>> objects;
+        for(subgroup_id_t subgroup_id : receiver_and_subgroups.second) {
+            objects.emplace_back(subgroup_objects.at(subgroup_id).get().serialize_object());
+        }
+        background_transfer_threads.emplace_back([this, receiver_id = receiver_and_subgroups.first,
+                                                  objects = std::move(objects)]() {
+            tcp::locked_socket receiver_socket = group_member_sockets->get_socket(receiver_id);
+            for(const std::vector<char>& object : objects) {
+                view_log(DEBUG, "Sending {} bytes of Replicated Object state to node {} in the background", object.size(), receiver_id);
+                // Framed like send_object(), which is what the receiver expects
+                tcp::chunked_writer writer(receiver_socket.get());
+                writer.write(object.data(), object.size());
+                writer.finish();
+            }
+        });
+    }
 }
 
 /* Note for the future: Since this "send" requires first receiving the log tail length,
@@ -1306,16 +1692,16 @@ void ViewManager::send_objects_to_new_members(const std::vector<std::vector<int6
  * different object to A, and neither node will be able to send the log tail length that
  * the other one is waiting on. */
 void ViewManager::send_subgroup_object(subgroup_id_t subgroup_id, node_id_t new_node_id) {
-    LockedReference<std::unique_lock<std::mutex>, tcp::socket> joiner_socket = group_member_sockets->get_socket(new_node_id);
+    tcp::locked_socket joiner_socket = group_member_sockets->get_socket(new_node_id);
     ReplicatedObject& subgroup_object = subgroup_objects.at(subgroup_id);
     if(subgroup_object.is_persistent()) {
         //First, read the log tail length sent by the joining node
         int64_t persistent_log_length = 0;
         joiner_socket.get().read(persistent_log_length);
         PersistentRegistry::setEarliestVersionToSerialize(persistent_log_length);
-        whenlog(logger->debug("Got log tail length {}", persistent_log_length););
+        view_log(DEBUG, "Got log tail length {}", persistent_log_length);
     }
-    whenlog(logger->debug("Sending Replicated Object state for subgroup {} to node {}", subgroup_id, new_node_id););
+    view_log(DEBUG, "Sending Replicated Object state for subgroup {} to node {}", subgroup_id, new_node_id);
     subgroup_object.send_object(joiner_socket.get());
 }
 
@@ -1335,6 +1721,17 @@ uint32_t ViewManager::compute_num_received_size(const View& view) {
     return num_received_size;
 }
 
+std::map<std::type_index, subgroup_shard_layout_t> ViewManager::layouts_by_type(const View& view) {
+    std::map<std::type_index, subgroup_shard_layout_t> layouts;
+    for(const auto& type_and_ids : view.subgroup_ids_by_type) {
+        subgroup_shard_layout_t& layout = layouts[type_and_ids.first];
+        for(const subgroup_id_t subgroup_id : type_and_ids.second) {
+            layout.push_back(view.subgroup_shard_views[subgroup_id]);
+        }
+    }
+    return layouts;
+}
+
 uint32_t ViewManager::make_subgroup_maps(const SubgroupInfo& subgroup_info,
                                          const std::unique_ptr<View>& prev_view, View& curr_view,
                                          std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings) {
@@ -1342,8 +1739,17 @@ uint32_t ViewManager::make_subgroup_maps(const SubgroupInfo& subgroup_info,
     int32_t initial_next_unassigned_rank = curr_view.next_unassigned_rank;
     curr_view.subgroup_shard_views.clear();
     curr_view.subgroup_ids_by_type.clear();
+    if(prev_view) {
+        // An inadequate View has no layout, so pass on the last one that was adequate
+        curr_view.previous_layouts = prev_view->is_adequately_provisioned ? layouts_by_type(*prev_view)
+                                                                          : prev_view->previous_layouts;
+    }
     for(const auto& subgroup_type : subgroup_info.membership_function_order) {
         subgroup_shard_layout_t curr_type_subviews;
+        auto previous_layout = curr_view.previous_layouts.find(subgroup_type);
+        curr_view.previous_assignment = previous_layout != curr_view.previous_layouts.end()
+                                                ? &previous_layout->second
+                                                : nullptr;
         // This is the only place the subgroup membership functions are called; the results are then saved in the View
         try {
             auto temp = subgroup_info.subgroup_membership_functions.at(subgroup_type)(
@@ -1353,6 +1759,7 @@ uint32_t ViewManager::make_subgroup_maps(const SubgroupInfo& subgroup_info,
         } catch(subgroup_provisioning_exception& ex) {
             // Mark the view as inadequate and roll back everything done by previous
             // allocation functions
+            curr_view.previous_assignment = nullptr;
             curr_view.is_adequately_provisioned = false;
             curr_view.next_unassigned_rank = initial_next_unassigned_rank;
             curr_view.subgroup_shard_views.clear();
@@ -1387,13 +1794,14 @@ uint32_t ViewManager::make_subgroup_maps(const SubgroupInfo& subgroup_info,
                             shard_view.is_sender,
                             shard_view.sender_rank_of(shard_view.my_rank),
                             num_received_offset,
-                            shard_view.mode};
+                            shard_view.mode,
+                            shard_view.profile};
                 }
-                if(prev_view) {
+                const subgroup_shard_layout_t* prev_layout = curr_view.previous_assignment;
+                if(prev_view && prev_layout && subgroup_index < prev_layout->size()
+                   && shard_num < (*prev_layout)[subgroup_index].size()) {
                     // Initialize this shard's SubView.joined and SubView.departed
-                    subgroup_id_t prev_subgroup_id = prev_view->subgroup_ids_by_type.at(subgroup_type)
-                                                             .at(subgroup_index);
-                    SubView& prev_shard_view = prev_view->subgroup_shard_views[prev_subgroup_id][shard_num];
+                    const SubView& prev_shard_view = (*prev_layout)[subgroup_index][shard_num];
                     std::set<node_id_t> prev_members(prev_shard_view.members.begin(),
                                                      prev_shard_view.members.end());
                     std::set<node_id_t> curr_members(shard_view.members.begin(),
@@ -1414,6 +1822,7 @@ uint32_t ViewManager::make_subgroup_maps(const SubgroupInfo& subgroup_info,
             num_received_offset += max_shard_senders;
         }  // for (subgroup_index)
     }
+    curr_view.previous_assignment = nullptr;
     return num_received_offset;
 }
 
@@ -1444,7 +1853,8 @@ uint32_t ViewManager::derive_subgroup_settings(View& curr_view,
                         shard_view.is_sender,
                         shard_view.sender_rank_of(shard_view.my_rank),
                         num_received_offset,
-                        shard_view.mode};
+                        shard_view.mode,
+                        shard_view.profile};
             }
         }  // for(shard_num)
         num_received_offset += max_shard_senders;
@@ -1495,7 +1905,7 @@ std::unique_ptr<View> ViewManager::make_next_view(const std::unique_ptr<View>& c
                                                            gmsSST.joiner_rpc_ports[myRank][join_index],
                                                            gmsSST.joiner_sst_ports[myRank][join_index],
                                                            gmsSST.joiner_rdmc_ports[myRank][join_index]};
-        whenlog(logger->debug("Next view will add new member with ID {}", joiner_id););
+        view_log(DEBUG, "Next view will add new member with ID {}", joiner_id);
     }
     for(const auto& leaver_rank : leave_ranks) {
         departed.emplace_back(curr_view->members[leaver_rank]);
@@ -1505,8 +1915,8 @@ std::unique_ptr<View> ViewManager::make_next_view(const std::unique_ptr<View>& c
             next_unassigned_rank--;
         }
     }
-    whenlog(logger->debug("Next view will exclude {} failed members.",
-                          leave_ranks.size()););
+    view_log(DEBUG, "Next view will exclude {} failed members.",
+                    leave_ranks.size());
 
     // Copy member information, excluding the members that have failed
     int new_rank = 0;
@@ -1635,9 +2045,9 @@ int ViewManager::min_acked(const DerechoSST& gmsSST,
     return min;
 }
 
-void ViewManager::deliver_in_order(const View& Vc, const int shard_leader_rank,
-                                   const uint32_t subgroup_num, const uint32_t num_received_offset,
-                                   const std::vector<node_id_t>& shard_members, uint num_shard_senders whenlog(, std::shared_ptr<spdlog::logger> logger)) {
+RaggedTrim ViewManager::deliver_in_order(const View& Vc, const int shard_leader_rank,
+                                         const uint32_t subgroup_num, const uint32_t num_received_offset,
+                                         const std::vector<node_id_t>& shard_members, uint num_shard_senders whenlog(, std::shared_ptr<spdlog::logger> logger)) {
     // Ragged cleanup is finished, deliver in the implied order
     std::vector<int32_t> max_received_indices(num_shard_senders);
     std::stringstream delivery_order;
@@ -1656,18 +2066,17 @@ void ViewManager::deliver_in_order(const View& Vc, const int shard_leader_rank,
     uint32_t shard_num = Vc.my_subgroups.at(subgroup_num);
     RaggedTrim trim_log{subgroup_num, shard_num, Vc.vid,
                         static_cast<int32_t>(Vc.members[Vc.rank_of_leader()]), max_received_indices};
-    whenlog(logger->debug("Logging ragged trim to disk"););
-    persistent::saveObject(trim_log, ragged_trim_filename(subgroup_num, shard_num).c_str());
-    whenlog(logger->debug("Delivering ragged-edge messages in order: {}", delivery_order.str()););
+    view_log(DEBUG, "Delivering ragged-edge messages in order: {}", delivery_order.str());
     Vc.multicast_group->deliver_messages_upto(max_received_indices, subgroup_num, num_shard_senders);
+    return trim_log;
 }
 
-void ViewManager::leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
-                                             const uint32_t num_received_offset,
-                                             const std::vector<node_id_t>& shard_members, uint num_shard_senders,
-                                             whenlog(std::shared_ptr<spdlog::logger> logger, )
-                                             const std::vector<node_id_t>& next_view_members) {
-    whenlog(logger->debug("Running leader RaggedEdgeCleanup for subgroup {}", subgroup_num););
+RaggedTrim ViewManager::leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
+                                                   const uint32_t num_received_offset,
+                                                   const std::vector<node_id_t>& shard_members, uint num_shard_senders,
+                                                   whenlog(std::shared_ptr<spdlog::logger> logger, )
+                                                   const std::vector<node_id_t>& next_view_members) {
+    view_log(DEBUG, "Running leader RaggedEdgeCleanup for subgroup {}", subgroup_num);
     int myRank = Vc.my_rank;
     bool found = false;
     for(uint n = 0; n < shard_members.size() && !found; n++) {
@@ -1680,7 +2089,22 @@ void ViewManager::leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgr
         }
     }
 
-    if(!found) {
+    if(!found && Vc.multicast_group->get_subgroup_settings().at(subgroup_num).mode == Mode::SEQUENCED) {
+        // Every member must stop at the same place in the sequencer's order:
+        // the end of the part of it that every surviving member has received,
+        // which is past anything a member could have delivered
+        message_id_t last_seq_num = Vc.gmsSST->stable_num[myRank][subgroup_num];
+        for(uint r = 0; r < shard_members.size(); r++) {
+            const auto node_rank = Vc.rank_of(shard_members[r]);
+            if(!Vc.failed[node_rank] && last_seq_num > Vc.gmsSST->stable_num[node_rank][subgroup_num]) {
+                last_seq_num = Vc.gmsSST->stable_num[node_rank][subgroup_num];
+            }
+        }
+        const std::vector<int32_t> last_indices = Vc.multicast_group->sequenced_ragged_trim(subgroup_num, last_seq_num);
+        for(uint n = 0; n < num_shard_senders; n++) {
+            gmssst::set(Vc.gmsSST->global_min[myRank][num_received_offset + n], last_indices[n]);
+        }
+    } else if(!found) {
         for(uint n = 0; n < num_shard_senders; n++) {
             int min = Vc.gmsSST->num_received[myRank][num_received_offset + n];
             for(uint r = 0; r < shard_members.size(); r++) {
@@ -1695,7 +2119,7 @@ void ViewManager::leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgr
         }
     }
 
-    whenlog(logger->debug("Shard leader for subgroup {} finished computing global_min", subgroup_num););
+    view_log(DEBUG, "Shard leader for subgroup {} finished computing global_min", subgroup_num);
     gmssst::set(Vc.gmsSST->global_min_ready[myRank][subgroup_num], true);
     Vc.gmsSST->put(
             Vc.multicast_group->get_shard_sst_indices(subgroup_num),
@@ -1706,19 +2130,20 @@ void ViewManager::leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgr
             (char*)std::addressof(Vc.gmsSST->global_min_ready[0][subgroup_num]) - Vc.gmsSST->getBaseAddress(),
             sizeof(Vc.gmsSST->global_min_ready[0][subgroup_num]));
 
-    deliver_in_order(Vc, myRank, subgroup_num, num_received_offset, shard_members,
-                     num_shard_senders whenlog(, logger));
-    whenlog(logger->debug("Done with RaggedEdgeCleanup for subgroup {}", subgroup_num););
+    RaggedTrim trim_log = deliver_in_order(Vc, myRank, subgroup_num, num_received_offset, shard_members,
+                                           num_shard_senders whenlog(, logger));
+    view_log(DEBUG, "Done with RaggedEdgeCleanup for subgroup {}", subgroup_num);
+    return trim_log;
 }
 
-void ViewManager::follower_ragged_edge_cleanup(
+RaggedTrim ViewManager::follower_ragged_edge_cleanup(
         View& Vc, const subgroup_id_t subgroup_num, uint shard_leader_rank,
         const uint32_t num_received_offset,
         const std::vector<node_id_t>& shard_members,
         uint num_shard_senders whenlog(, std::shared_ptr<spdlog::logger> logger)) {
     int myRank = Vc.my_rank;
     // Learn the leader's data and push it before acting upon it
-    whenlog(logger->debug("Running follower RaggedEdgeCleanup for subgroup {}; echoing leader's global_min", subgroup_num););
+    view_log(DEBUG, "Running follower RaggedEdgeCleanup for subgroup {}; echoing leader's global_min", subgroup_num);
     gmssst::set(Vc.gmsSST->global_min[myRank] + num_received_offset,
                 Vc.gmsSST->global_min[shard_leader_rank] + num_received_offset,
                 num_shard_senders);
@@ -1731,16 +2156,17 @@ void ViewManager::follower_ragged_edge_cleanup(
             Vc.multicast_group->get_shard_sst_indices(subgroup_num),
             (char*)std::addressof(Vc.gmsSST->global_min_ready[0][subgroup_num]) - Vc.gmsSST->getBaseAddress(),
             sizeof(Vc.gmsSST->global_min_ready[0][subgroup_num]));
-    deliver_in_order(Vc, shard_leader_rank, subgroup_num, num_received_offset,
-                     shard_members, num_shard_senders whenlog(, logger));
-    whenlog(logger->debug("Done with RaggedEdgeCleanup for subgroup {}", subgroup_num);)
+    RaggedTrim trim_log = deliver_in_order(Vc, shard_leader_rank, subgroup_num, num_received_offset,
+                                           shard_members, num_shard_senders whenlog(, logger));
+    view_log(DEBUG, "Done with RaggedEdgeCleanup for subgroup {}", subgroup_num);
+    return trim_log;
 }
 
 /* ------------- 4. Public-Interface methods of ViewManager ------------- */
 
 void ViewManager::report_failure(const node_id_t who) {
     int r = curr_view->rank_of(who);
-    whenlog(logger->debug("Node ID {} failure reported; marking suspected[{}]", who, r););
+    view_log(DEBUG, "Node ID {} failure reported; marking suspected[{}]", who, r);
     curr_view->gmsSST->suspected[curr_view->my_rank][r] = true;
     int cnt = 0;
     for(r = 0; r < (int)curr_view->gmsSST->suspected.size(); r++) {
@@ -1759,7 +2185,7 @@ void ViewManager::report_failure(const node_id_t who) {
 
 void ViewManager::leave() {
     shared_lock_t lock(view_mutex);
-    whenlog(logger->debug("Cleanly leaving the group."););
+    view_log(DEBUG, "Cleanly leaving the group.");
     curr_view->multicast_group->wedge();
     curr_view->gmsSST->predicates.clear();
     curr_view->gmsSST->suspected[curr_view->my_rank][curr_view->my_rank] = true;
@@ -1778,6 +2204,14 @@ char* ViewManager::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
             subgroup_num, payload_size, cooked_send);
 }
 
+char* ViewManager::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                      unsigned long long int payload_size,
+                                      const rdmc::receive_destination& app_buffer) {
+    shared_lock_t lock(view_mutex);
+    return curr_view->multicast_group->get_sendbuffer_ptr(
+            subgroup_num, payload_size, app_buffer);
+}
+
 void ViewManager::send(subgroup_id_t subgroup_num) {
     shared_lock_t lock(view_mutex);
     view_change_cv.wait(lock, [&]() {
@@ -1785,11 +2219,83 @@ void ViewManager::send(subgroup_id_t subgroup_num) {
     });
 }
 
+uint64_t ViewManager::send_stream(subgroup_id_t subgroup_num, const struct iovec* iov, int iovcnt) {
+    StreamCursor cursor(iov, iovcnt);
+    uint64_t last_timestamp = 0;
+    while(cursor.remaining() > 0) {
+        {
+            shared_lock_t lock(view_mutex);
+            if(curr_view->multicast_group->send_stream(subgroup_num, cursor, last_timestamp) > 0) {
+                continue;
+            }
+        }
+        // The send window is full, or a view change is under way; let it
+        // take the view lock before trying again
+        std::this_thread::yield();
+    }
+    return last_timestamp;
+}
+
 const uint64_t ViewManager::compute_global_stability_frontier(subgroup_id_t subgroup_num) {
     shared_lock_t lock(view_mutex);
     return curr_view->multicast_group->compute_global_stability_frontier(subgroup_num);
 }
 
+persistent::version_t ViewManager::compute_global_persistence_frontier(subgroup_id_t subgroup_num) {
+    shared_lock_t lock(view_mutex);
+    return curr_view->multicast_group->compute_global_persistence_frontier(subgroup_num);
+}
+
+uint64_t ViewManager::get_send_ticket(subgroup_id_t subgroup_num) {
+    shared_lock_t lock(view_mutex);
+    return curr_view->multicast_group->get_send_ticket(subgroup_num);
+}
+
+void ViewManager::wait_for_own_delivery(subgroup_id_t subgroup_num, uint64_t ticket) {
+    std::shared_ptr<std::vector<OwnDeliveryProgress>> progress;
+    {
+        shared_lock_t lock(view_mutex);
+        if(curr_view->multicast_group->get_subgroup_settings().at(subgroup_num).mode == Mode::UNORDERED) {
+            throw derecho_exception("Unordered subgroups don't track the delivery of their own messages");
+        }
+        progress = curr_view->multicast_group->get_own_delivery_progress();
+    }
+    (*progress)[subgroup_num].wait_for(ticket);
+}
+
+void ViewManager::wait_for_read_index(subgroup_id_t subgroup_num) {
+    int32_t vid = -1;
+    message_id_t read_index = -1;
+    while(!thread_shutdown) {
+        {
+            shared_lock_t lock(view_mutex);
+            MulticastGroup& multicast_group = *curr_view->multicast_group;
+            const auto settings = multicast_group.get_subgroup_settings().find(subgroup_num);
+            if(settings == multicast_group.get_subgroup_settings().end()
+               || (settings->second.mode != Mode::ORDERED && settings->second.mode != Mode::SEQUENCED)) {
+                return;
+            }
+            // A message delivered elsewhere in a view this node hadn't
+            // installed yet needed this node's row of that view; so after a
+            // view change, start over from the new view's read index
+            if(curr_view->vid != vid) {
+                vid = curr_view->vid;
+                read_index = multicast_group.get_read_index(subgroup_num);
+            }
+            if(multicast_group.delivered_through(subgroup_num, read_index)) {
+                return;
+            }
+        }
+        // Not holding the view lock, so a view change can go on meanwhile
+        std::this_thread::yield();
+    }
+}
+
+LatencyStats ViewManager::get_latency_stats(subgroup_id_t subgroup_num) {
+    shared_lock_t lock(view_mutex);
+    return curr_view->multicast_group->get_latency_stats(subgroup_num);
+}
+
 void ViewManager::add_view_upcall(const view_upcall_t& upcall) {
     view_upcalls.emplace_back(upcall);
 }
@@ -1801,7 +2307,80 @@ std::vector<node_id_t> ViewManager::get_members() {
 
 void ViewManager::barrier_sync() {
     shared_lock_t read_lock(view_mutex);
-    curr_view->gmsSST->sync_with_members();
+    std::lock_guard<std::mutex> barrier_lock(barrier_mutex);
+    DerechoSST& gmsSST = *curr_view->gmsSST;
+    const uint32_t num_rows = gmsSST.get_num_rows();
+    const uint32_t my_row = gmsSST.get_local_index();
+    // A dissemination barrier: in round r each member signals the member 2^r
+    // rows after it and waits for the one 2^r rows before it, so after
+    // ceil(log2(n)) rounds each member has heard, directly or through the
+    // others, that every member has reached the barrier.
+    const uint64_t barrier_num = gmsSST.barrier_rounds[my_row][0] + 1;
+    uint32_t round = 0;
+    for(uint32_t distance = 1; distance < num_rows; distance *= 2, ++round) {
+        const uint32_t signal_row = (my_row + distance) % num_rows;
+        const uint32_t wait_row = (my_row + num_rows - distance) % num_rows;
+        gmsSST.barrier_rounds[my_row][round] = barrier_num;
+        gmsSST.put_range({signal_row}, gmsSST.barrier_rounds, round, 1);
+        // A member that has failed will never signal, so stop waiting for it
+        // once it is suspected, as sync_with_members skipped frozen rows
+        while(gmsSST.barrier_rounds[wait_row][round] < barrier_num
+              && !gmsSST.suspected[my_row][wait_row]) {
+            std::this_thread::yield();
+        }
+    }
+    if(round == 0) {
+        // With only one member, there is no one to wait for
+        gmsSST.barrier_rounds[my_row][0] = barrier_num;
+    }
+}
+
+void ViewManager::set_user_sst_field(uint32_t index, uint64_t value) {
+    shared_lock_t read_lock(view_mutex);
+    DerechoSST& gmsSST = *curr_view->gmsSST;
+    if(index >= gmsSST.user_fields.size()) {
+        throw derecho_exception("User SST field " + std::to_string(index) + " does not exist; DERECHO/user_sst_fields is "
+                                + std::to_string(gmsSST.user_fields.size()));
+    }
+    gmsSST.user_fields[gmsSST.get_local_index()][index] = value;
+    gmsSST.put_range(gmsSST.user_fields, index, 1);
+}
+
+uint64_t ViewManager::get_user_sst_field(node_id_t node_id, uint32_t index) {
+    shared_lock_t read_lock(view_mutex);
+    DerechoSST& gmsSST = *curr_view->gmsSST;
+    const int row = curr_view->rank_of(node_id);
+    if(row < 0) {
+        throw derecho_exception("Node " + std::to_string(node_id) + " is not a member of the current view");
+    }
+    if(index >= gmsSST.user_fields.size()) {
+        throw derecho_exception("User SST field " + std::to_string(index) + " does not exist; DERECHO/user_sst_fields is "
+                                + std::to_string(gmsSST.user_fields.size()));
+    }
+    return gmsSST.user_fields[row][index];
+}
+
+void ViewManager::add_user_sst_field_upcall(const user_sst_field_upcall_t& upcall) {
+    std::lock_guard<std::mutex> lock(user_sst_field_mutex);
+    user_sst_field_upcalls.emplace_back(upcall);
+}
+
+void ViewManager::report_user_sst_fields(const DerechoSST& gmsSST) {
+    std::lock_guard<std::mutex> lock(user_sst_field_mutex);
+    for(uint32_t row = 0; row < gmsSST.get_num_rows(); ++row) {
+        const node_id_t node_id = curr_view->members[row];
+        std::vector<uint64_t>& reported = reported_user_sst_fields[node_id];
+        reported.resize(gmsSST.user_fields.size(), 0);
+        for(uint32_t index = 0; index < reported.size(); ++index) {
+            const uint64_t value = gmsSST.user_fields[row][index];
+            if(value != reported[index]) {
+                reported[index] = value;
+                for(const auto& upcall : user_sst_field_upcalls) {
+                    upcall(node_id, index, value);
+                }
+            }
+        }
+    }
 }
 
 SharedLockedReference<View> ViewManager::get_current_view() {
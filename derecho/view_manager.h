@@ -5,21 +5,27 @@
  */
 #pragma once
 
+#include <chrono>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "change_stream.h"
 #include "conf/conf.hpp"
 #include "derecho_internal.h"
 #include "locked_reference.h"
+#include "metrics.h"
 #include "multicast_group.h"
 #include "restart_state.h"
 #include "subgroup_info.h"
 #include "view.h"
+#include "view_lock.h"
 
 #include <mutils-serialization/SerializationSupport.hpp>
 #include <spdlog/spdlog.h>
@@ -82,10 +88,29 @@ struct JoinResponse {
     node_id_t leader_id;
 };
 
+/**
+ * The registered memory that a View takes on this node, by the part of the
+ * group that registers it. Only what the configuration scales is counted;
+ * the SST's other fields, for example, take a few bytes per subgroup.
+ */
+struct RegisteredMemoryPlan {
+    /** The SST's message slots and sequence orders, in every member's row */
+    uint64_t sst_bytes = 0;
+    /** The P2P buffers to and from every member */
+    uint64_t p2p_bytes = 0;
+    /** The RDMC message buffers reserved for this node's subgroups */
+    uint64_t rdmc_bytes = 0;
+    uint64_t total() const {
+        return sst_bytes + p2p_bytes + rdmc_bytes;
+    }
+};
+
 template <typename T>
-using SharedLockedReference = LockedReference<std::shared_lock<std::shared_timed_mutex>, T>;
+using SharedLockedReference = LockedReference<std::shared_lock<ViewLock>, T>;
 
 using view_upcall_t = std::function<void(const View&)>;
+/** Called as upcall(node_id, index, value) when a member's user SST field changes */
+using user_sst_field_upcall_t = std::function<void(node_id_t, uint32_t, uint64_t)>;
 
 class ViewManager {
 private:
@@ -107,10 +132,21 @@ private:
     whenlog(std::shared_ptr<spdlog::logger> logger;);
 
     /** Controls access to curr_view. Read-only accesses should acquire a
-     * shared_lock, while view changes acquire a unique_lock. */
-    std::shared_timed_mutex view_mutex;
+     * shared_lock, while view changes acquire a unique_lock; shared locks
+     * only touch a per-thread counter, and a unique_lock waits for them to
+     * drain. */
+    ViewLock view_mutex;
     /** Notified when curr_view changes (i.e. we are finished with a pending view change).*/
     std::condition_variable_any view_change_cv;
+    /** Keeps the barrier_sync calls of different threads from overlapping,
+     * since they share the barrier counters in the SST */
+    std::mutex barrier_mutex;
+    /** Guards user_sst_field_upcalls, which application threads add to */
+    std::mutex user_sst_field_mutex;
+    std::vector<user_sst_field_upcall_t> user_sst_field_upcalls;
+    /** The user SST fields of each member as last reported to the upcalls;
+     * only used by the SST predicate thread */
+    std::map<node_id_t, std::vector<uint64_t>> reported_user_sst_fields;
 
     /** The current View, containing the state of the managed group.
      *  Must be a pointer so we can re-assign it, but will never be null.*/
@@ -129,6 +165,22 @@ private:
 
     /** The sockets connected to clients that will join in the next view, if any */
     std::list<tcp::socket> proposed_join_sockets;
+    /** How long the leader waits for more joins to add in the same view change */
+    const std::chrono::milliseconds join_batch_window;
+    /** When the leader first saw a join waiting that it has not yet proposed,
+     * if there is one. Only used by the predicate thread. */
+    std::optional<std::chrono::steady_clock::time_point> first_pending_join_time;
+    /** The registry's metrics of this node's view changes and current view */
+    struct ViewMetrics {
+        MetricCounter& view_changes;
+        MetricCounter& view_change_time_us;
+        MetricGauge& vid;
+        MetricGauge& num_members;
+        ViewMetrics();
+    };
+    ViewMetrics view_metrics;
+    /** When this node wedged the current view, for timing the view change */
+    std::chrono::steady_clock::time_point view_change_start_time;
     /** The node ID that has been assigned to the client that is currently joining, if any. */
     node_id_t joining_client_id;
     /** A cached copy of the last known value of this node's suspected[] array.
@@ -136,11 +188,19 @@ private:
     std::vector<bool> last_suspected;
 
     tcp::connection_listener server_socket;
+    /** Serves the metrics over HTTP, if CONF_DERECHO_METRICS_PORT is set */
+    MetricsServer metrics_server;
+    /** Streams delivered messages to external subscribers, if CONF_DERECHO_CDC_PORT is set */
+    ChangeStreamServer change_stream_server;
     /** A flag to signal background threads to shut down; set to true when the group is destroyed. */
     std::atomic<bool> thread_shutdown;
     /** The background thread that listens for clients connecting on our server socket. */
     std::thread client_listener_thread;
     std::thread old_view_cleanup_thread;
+    /** The threads sending the state of non-persistent subgroups to new
+     * members in a background state transfer; only the view change thread
+     * starts them, and it joins them before starting more. */
+    std::list<std::thread> background_transfer_threads;
 
     //Handles for all the predicates the GMS registered with the current view's SST.
     pred_handle suspected_changed_handle;
@@ -149,6 +209,7 @@ private:
     pred_handle change_commit_ready_handle;
     pred_handle leader_proposed_handle;
     pred_handle leader_committed_handle;
+    pred_handle user_sst_fields_handle;
 
     /** Functions to be called whenever the view changes, to report the
      * new view to some other component. */
@@ -188,7 +249,9 @@ private:
     bool has_pending_join() { return pending_join_sockets.locked().access.size() > 0; }
 
     /**
-     * Assuming this node is the leader, handles a join request from a client.
+     * Assuming this node is the leader, handles a join request from a client,
+     * adding it to the proposed changes in this node's row of the SST. The
+     * row is not pushed; leader_start_join does that once for a whole batch.
      * @return True if the join succeeded, false if it failed because the
      *         client's ID was already in use.
      */
@@ -214,6 +277,8 @@ private:
     /** Called when there is a new failure suspicion. Updates the suspected[]
      * array and, for the leader, proposes new views to exclude failed members. */
     void new_suspicion(DerechoSST& gmsSST);
+    /** Calls the user SST field upcalls for the fields that changed since they were last called */
+    void report_user_sst_fields(const DerechoSST& gmsSST);
     /** Runs only on the group leader; proposes new views to include new members. */
     void leader_start_join(DerechoSST& gmsSST);
     /** Runs on non-leaders to redirect confused new members to the current leader. */
@@ -251,23 +316,30 @@ private:
     /** Sends a single subgroup's replicated object to a new member after a view change. */
     void send_subgroup_object(subgroup_id_t subgroup_id, node_id_t new_node_id);
 
+    /** Sends the replicated objects of some subgroups to each of some nodes,
+     * to all of the nodes concurrently. In background state transfer, the
+     * non-persistent ones are copied, and sent by background threads. */
+    void send_subgroup_objects(const std::map<node_id_t, std::vector<subgroup_id_t>>& subgroups_by_receiver);
+
     /* -- Static helper methods that implement chunks of view-management functionality -- */
-    static void deliver_in_order(const View& Vc, const int shard_leader_rank,
-                                 const subgroup_id_t subgroup_num, const uint32_t nReceived_offset,
-                                 const std::vector<node_id_t>& shard_members, uint num_shard_senders
-                                 whenlog(, std::shared_ptr<spdlog::logger> logger));
-    static void leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
-                                           const uint32_t num_received_offset,
-                                           const std::vector<node_id_t>& shard_members,
-                                           uint num_shard_senders,
-                                           whenlog(std::shared_ptr<spdlog::logger> logger, )
-                                           const std::vector<node_id_t>& next_view_members);
-    static void follower_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
-                                             uint shard_leader_rank,
-                                             const uint32_t num_received_offset,
-                                             const std::vector<node_id_t>& shard_members,
-                                             uint num_shard_senders
-                                             whenlog(, std::shared_ptr<spdlog::logger> logger));
+    /* The RaggedEdgeCleanup functions return the ragged trim they delivered
+     * up to, which the caller logs to disk along with those of the other subgroups */
+    static RaggedTrim deliver_in_order(const View& Vc, const int shard_leader_rank,
+                                       const subgroup_id_t subgroup_num, const uint32_t nReceived_offset,
+                                       const std::vector<node_id_t>& shard_members, uint num_shard_senders
+                                       whenlog(, std::shared_ptr<spdlog::logger> logger));
+    static RaggedTrim leader_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
+                                                 const uint32_t num_received_offset,
+                                                 const std::vector<node_id_t>& shard_members,
+                                                 uint num_shard_senders,
+                                                 whenlog(std::shared_ptr<spdlog::logger> logger, )
+                                                 const std::vector<node_id_t>& next_view_members);
+    static RaggedTrim follower_ragged_edge_cleanup(View& Vc, const subgroup_id_t subgroup_num,
+                                                   uint shard_leader_rank,
+                                                   const uint32_t num_received_offset,
+                                                   const std::vector<node_id_t>& shard_members,
+                                                   uint num_shard_senders
+                                                   whenlog(, std::shared_ptr<spdlog::logger> logger));
 
     static bool suspected_not_equal(const DerechoSST& gmsSST, const std::vector<bool>& old);
     static void copy_suspected(const DerechoSST& gmsSST, std::vector<bool>& old);
@@ -319,16 +391,17 @@ private:
      * Creates the SST and MulticastGroup for the first time, using the current view's member list.
      * @param callbacks The custom callbacks to supply to the MulticastGroup
      * @param derecho_params The initial DerechoParams to supply to the MulticastGroup
-     * @param subgroup_settings The subgroup settings map to supply to the MulticastGroup
+     * @param subgroup_settings The subgroup settings map to supply to the
+     * MulticastGroup, whose parameters are filled in by lay_out_subgroups
      * @param num_received_size The size of the num_received field in the SST (derived from subgroup_settings)
      */
     void construct_multicast_group(CallbackSet callbacks,
-                                   const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                   std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
                                    const uint32_t num_received_size);
 
     /** Sets up the SST and MulticastGroup for a new view, based on the settings in the current view,
      * and copies over the SST data from the current view. */
-    void transition_multicast_group(const std::map<subgroup_id_t, SubgroupSettings>& new_subgroup_settings,
+    void transition_multicast_group(std::map<subgroup_id_t, SubgroupSettings>& new_subgroup_settings,
                                     const uint32_t new_num_received_size);
     /**
      * Initializes curr_view with subgroup information based on the membership
@@ -350,14 +423,54 @@ private:
                                        const std::unique_ptr<View>& prev_view,
                                        View& curr_view,
                                        std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings);
+    /**
+     * Fills in each subgroup's own DerechoParams in subgroup_settings: the
+     * group's, with the overrides of the subgroup's profile. Lays out the
+     * windows of message slots of every subgroup in the View's SST, and the
+     * delivery orders of the SEQUENCED ones, at offsets that every member
+     * computes the same way. The windows of subgroups with no sender in
+     * common share space.
+     * @param view The View, whose SubViews have been initialized
+     * @param group_params The group's DerechoParams
+     * @param subgroup_settings The settings of the subgroups this node belongs to
+     * @return The sizes to provide to DerechoSST for its slots and
+     * sequence_order fields
+     */
+    static std::pair<uint64_t, uint32_t> lay_out_subgroups(const View& view, const DerechoParams& group_params,
+                                                           std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings);
+    /**
+     * Computes the registered memory that a View's SST, P2P connections, and
+     * RDMC message buffers will take on this node.
+     * @param view The View, whose SubViews have been initialized
+     * @param group_params The group's DerechoParams
+     * @param subgroup_settings The settings of the subgroups this node
+     * belongs to, filled in by lay_out_subgroups
+     * @param slots_size The size of the SST's slots field, from lay_out_subgroups
+     * @param sequence_order_size The size of the SST's sequence_order field
+     */
+    static RegisteredMemoryPlan plan_registered_memory(const View& view, const DerechoParams& group_params,
+                                                       const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                                       uint64_t slots_size, uint32_t sequence_order_size);
+    /**
+     * Logs a View's RegisteredMemoryPlan before any of the memory is
+     * registered, and checks it against CONF_DERECHO_MAX_REGISTERED_MEMORY.
+     * @throws derecho_exception if the View needs more than that, saying
+     * which part needs the most and what to lower to make it fit
+     */
+    void check_registered_memory(const View& view, const std::map<subgroup_id_t, SubgroupSettings>& subgroup_settings,
+                                 uint64_t slots_size, uint32_t sequence_order_size);
+    /** Collects each subgroup type's layout from an adequately provisioned View,
+     * in the form its membership function returned it */
+    static std::map<std::type_index, subgroup_shard_layout_t> layouts_by_type(const View& view);
 
     /**
      * Creates the subgroup-settings map that MulticastGroup's constructor needs
      * (and the num_received_size for the SST) based on the subgroup information
      * already in curr_view. Also reinitializes curr_view's my_subgroups to
-     * indicate which subgroups this node belongs to. This function is only used
-     * during total restart, when a joining node receives a View that already
-     * has subgroup_shard_views populated.
+     * indicate which subgroups this node belongs to. This function is used
+     * when a joining node receives a View that already has
+     * subgroup_shard_views populated by the leader, including during total
+     * restart.
      * @param curr_view A mutable reference to the current View, which will have its
      * my_subgroups corrected
      * @param subgroup_settings A mutable reference to the subgroup settings map,
@@ -498,11 +611,41 @@ public:
      * buffer. */
     char* get_sendbuffer_ptr(subgroup_id_t subgroup_num,
                              long long unsigned int payload_size, bool cooked_send = false);
+    /** Like get_sendbuffer_ptr, but for a message in a registered region of
+     * the application's; see MulticastGroup::get_sendbuffer_ptr. */
+    char* get_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                             long long unsigned int payload_size,
+                             const rdmc::receive_destination& app_buffer);
     /** Instructs the managed DerechoGroup's to send the next message. This
      * returns immediately; the send is scheduled to happen some time in the future. */
     void send(subgroup_id_t subgroup_num);
+    /** Sends a stream as raw messages, waiting for room in the send window
+     * as it goes; see RawSubgroup::send_stream.
+     * @return The timestamp of the last message sent, or 0 if the stream is empty */
+    uint64_t send_stream(subgroup_id_t subgroup_num, const struct iovec* iov, int iovcnt);
 
     const uint64_t compute_global_stability_frontier(subgroup_id_t subgroup_num);
+    /** See MulticastGroup::compute_global_persistence_frontier */
+    persistent::version_t compute_global_persistence_frontier(subgroup_id_t subgroup_num);
+
+    /** @return A ticket for the messages this node has sent in the subgroup
+     * so far; see MulticastGroup::get_send_ticket */
+    uint64_t get_send_ticket(subgroup_id_t subgroup_num);
+    /** Blocks until the messages a ticket covers have been delivered here,
+     * without holding the view lock, so a view change can go on meanwhile.
+     * Not available in unordered subgroups, which deliver raw messages only. */
+    void wait_for_own_delivery(subgroup_id_t subgroup_num, uint64_t ticket);
+    /**
+     * Blocks until this node has delivered every update to an ordered or
+     * sequenced subgroup that any member of its shard had delivered when it
+     * was called, so that a read of the local replica is linearizable. See
+     * MulticastGroup::get_read_index. Returns at once for other subgroups.
+     */
+    void wait_for_read_index(subgroup_id_t subgroup_num);
+
+    /** @return The latencies of the messages this node has received in a
+     * subgroup, or all zeros if latency stats are off. */
+    LatencyStats get_latency_stats(subgroup_id_t subgroup_num);
 
     /**
      * @return a reference to the current View, wrapped in a container that
@@ -524,6 +667,13 @@ public:
     /** Waits until all members of the group have called this function. */
     void barrier_sync();
 
+    /** Publishes one of this node's user SST fields to every member */
+    void set_user_sst_field(uint32_t index, uint64_t value);
+    /** The latest value of a member's user SST field to reach this node */
+    uint64_t get_user_sst_field(node_id_t node_id, uint32_t index);
+    /** Adds a function to call when a member's user SST field changes */
+    void add_user_sst_field_upcall(const user_sst_field_upcall_t& upcall);
+
     /**
      * Registers a function that will initialize all the RPC objects at this node,
      * given a new view and a list of the shard leaders in the previous view (needed
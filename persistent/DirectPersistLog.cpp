@@ -0,0 +1,815 @@
+#include "DirectPersistLog.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace persistent {
+
+/////////////////////////
+// internal structures //
+/////////////////////////
+
+// the entry at a log index
+///// READ or WRITE LOCK on LOG REQUIRED to use the following MACROs!!!!
+#define DPL_ENTRY_AT(idx) (&this->m_entries[(idx)-META_HEADER->fields.head])
+#define DPL_CURR_ENTRY DPL_ENTRY_AT(CURR_LOG_IDX)
+#define DPL_NUM_USED_BYTES ((NUM_USED_SLOTS == 0) ? 0 : (DPL_CURR_ENTRY->fields.ofst + DPL_CURR_ENTRY->fields.dlen - DPL_ENTRY_AT(META_HEADER->fields.head)->fields.ofst))
+#define DPL_NUM_FREE_BYTES (MAX_DATA_SIZE - DPL_NUM_USED_BYTES)
+
+#define ALIGN_DOWN(x) ((x) - (x) % DIRECT_IO_ALIGNMENT)
+#define ALIGN_UP(x) ALIGN_DOWN((x) + DIRECT_IO_ALIGNMENT - 1)
+
+// allocate a buffer aligned for O_DIRECT
+static unique_ptr<char, void (*)(void *)> allocAligned(const uint64_t &size) noexcept(false);
+
+// open a file for direct I/O, or for synchronous I/O where O_DIRECT isn't
+// supported (e.g. on tmpfs)
+static int openDirect(const string &file) noexcept(false);
+
+// read or write a range of a ring buffer file, wrapping around its end
+static void readRing(int fd, const uint64_t &ring_size, const uint64_t &pos, char *buf, const uint64_t &len) noexcept(false);
+static void writeRing(int fd, const uint64_t &ring_size, const uint64_t &pos, const char *buf, const uint64_t &len) noexcept(false);
+
+////////////////////////
+// visible to outside //
+////////////////////////
+
+DirectPersistLog::DirectPersistLog(const string &name, const string &dataPath) noexcept(false) : PersistLog(name),
+                                                                                                 m_sDataPath(dataPath),
+                                                                                                 m_sMetaFile(dataPath + "/" + name + "." + META_FILE_SUFFIX),
+                                                                                                 m_sLogFile(dataPath + "/" + name + "." + DIRECT_LOG_FILE_SUFFIX),
+                                                                                                 m_sDataFile(dataPath + "/" + name + "." + DIRECT_DATA_FILE_SUFFIX),
+                                                                                                 m_iLogFileDesc(-1),
+                                                                                                 m_iDataFileDesc(-1),
+                                                                                                 m_pTailBlock(allocAligned(DIRECT_IO_ALIGNMENT)),
+                                                                                                 m_cacheCapacity(getPersDirectReadCacheSize()),
+                                                                                                 m_iPersistedTail(0) {
+    if(pthread_rwlock_init(&this->m_rwlock, NULL) != 0) {
+        throw PERSIST_EXP_RWLOCK_INIT(errno);
+    }
+    if(pthread_mutex_init(&this->m_perslock, NULL) != 0) {
+        throw PERSIST_EXP_MUTEX_INIT(errno);
+    }
+    dbg_trace("{0} constructor: before load()", name);
+    load();
+    dbg_trace("{0} constructor: after load()", name);
+}
+
+void DirectPersistLog::load() noexcept(false) {
+    dbg_trace("{0}:load state...begin", this->m_sName);
+    // STEP 0: check if data path exists
+    checkOrCreateDir(this->m_sDataPath);
+    // STEP 1: check and create files.
+    bool bCreate = checkOrCreateFileWithSize(this->m_sMetaFile, META_SIZE);
+    this->m_uMaxLogEntry = getFileSizeOr(this->m_sLogFile, sizeof(LogEntry) * getPersMaxLogEntry()) / sizeof(LogEntry);
+    this->m_uMaxDataSize = getFileSizeOr(this->m_sDataFile, getPersMaxDataSize());
+    // blocks are written whole
+    if(MAX_LOG_ENTRY < 2 || MAX_LOG_SIZE % DIRECT_IO_ALIGNMENT != 0 || MAX_DATA_SIZE == 0 || MAX_DATA_SIZE % DIRECT_IO_ALIGNMENT != 0) {
+        dbg_error("{0}:log capacity of {1} entries and {2} bytes is not block aligned.", this->m_sName, MAX_LOG_ENTRY, MAX_DATA_SIZE);
+        throw PERSIST_EXP_INV_CAPACITY;
+    }
+    checkOrCreateFileWithSize(this->m_sLogFile, MAX_LOG_SIZE);
+    checkOrCreateFileWithSize(this->m_sDataFile, MAX_DATA_SIZE);
+    // STEP 2: open files
+    this->m_iLogFileDesc = openDirect(this->m_sLogFile);
+    this->m_iDataFileDesc = openDirect(this->m_sDataFile);
+    // STEP 3: initialize the header for new created Metafile
+    if(bCreate) {
+        META_HEADER->fields.head = 0ll;
+        META_HEADER->fields.tail = 0ll;
+        META_HEADER->fields.ver = INVALID_VERSION;
+        META_HEADER_PERS->fields.head = -1ll;  // -1 means uninitialized
+        META_HEADER_PERS->fields.tail = -1ll;  // -1 means uninitialized
+        META_HEADER_PERS->fields.ver = INVALID_VERSION;
+        // persist the header
+        FPL_RDLOCK;
+        FPL_PERS_LOCK;
+
+        try {
+            persistMetaHeaderAtomically(META_HEADER);
+        } catch(uint64_t e) {
+            FPL_PERS_UNLOCK;
+            FPL_UNLOCK;
+            throw e;
+        }
+        FPL_PERS_UNLOCK;
+        FPL_UNLOCK;
+        dbg_info("{0}:new header initialized.", this->m_sName);
+    } else {  // load META_HEADER and the log entries from disk
+        FPL_WRLOCK;
+        FPL_PERS_LOCK;
+        try {
+            int fd = open(this->m_sMetaFile.c_str(), O_RDONLY);
+            if(fd == -1) {
+                throw PERSIST_EXP_OPEN_FILE(errno);
+            }
+            ssize_t nRead = read(fd, (void *)META_HEADER_PERS, sizeof(MetaHeader));
+            if(nRead != sizeof(MetaHeader)) {
+                close(fd);
+                throw PERSIST_EXP_READ_FILE(errno);
+            }
+            close(fd);
+            *META_HEADER = *META_HEADER_PERS;
+            if(NUM_USED_SLOTS > 0) {
+                this->hidx.reserve(NUM_USED_SLOTS);
+                const int64_t first = META_HEADER->fields.head - META_HEADER->fields.head % (int64_t)ENTRIES_PER_BLOCK;
+                const uint64_t len = ALIGN_UP((META_HEADER->fields.tail - first) * sizeof(LogEntry));
+                auto buf = allocAligned(len);
+                readRing(this->m_iLogFileDesc, MAX_LOG_SIZE, (first % MAX_LOG_ENTRY) * sizeof(LogEntry), buf.get(), len);
+                const LogEntry *ples = (const LogEntry *)buf.get();
+                for(int64_t idx = META_HEADER->fields.head; idx < META_HEADER->fields.tail; idx++) {
+                    this->m_entries.push_back(ples[idx - first]);
+                    // update mhlc index
+                    this->hidx.insert(hlc_index_entry{ples[idx - first].fields.hlc_r, ples[idx - first].fields.hlc_l, idx});
+                }
+            }
+            this->m_iPersistedTail = META_HEADER->fields.tail;
+        } catch(uint64_t e) {
+            FPL_PERS_UNLOCK;
+            FPL_UNLOCK;
+            throw e;
+        }
+
+        FPL_PERS_UNLOCK;
+        FPL_UNLOCK;
+    }
+    dbg_trace("{0}:load state...done", this->m_sName);
+}
+
+DirectPersistLog::~DirectPersistLog() noexcept(true) {
+    pthread_rwlock_destroy(&this->m_rwlock);
+    pthread_mutex_destroy(&this->m_perslock);
+    if(this->m_iLogFileDesc != -1) {
+        close(this->m_iLogFileDesc);
+    }
+    if(this->m_iDataFileDesc != -1) {
+        close(this->m_iDataFileDesc);
+    }
+}
+
+void DirectPersistLog::append(const void *pdat, const uint64_t &size, const int64_t &ver, const HLC &mhlc) noexcept(false) {
+    dbg_trace("{0} append event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
+    memcpy(this->reserve(size), pdat, size);
+    this->commit(ver, mhlc);
+}
+
+void *DirectPersistLog::reserve(const uint64_t &size) noexcept(false) {
+    dbg_trace("{0} reserve {1} bytes", this->m_sName, size);
+    FPL_WRLOCK;
+    if(NUM_FREE_SLOTS < 1) {
+        dbg_error("{0}-reserve exception no free slots in log! NUM_FREE_SLOTS={1}",
+                  this->m_sName, NUM_FREE_SLOTS);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NOSPACE_LOG;
+    }
+    if(DPL_NUM_FREE_BYTES < size) {
+        dbg_error("{0}-reserve exception no space for data: NUM_FREE_BYTES={1}, size={2}",
+                  this->m_sName, DPL_NUM_FREE_BYTES, size);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NOSPACE_DATA;
+    }
+    // The entry is kept in memory, and becomes its cache entry on commit()
+    this->m_pReserved = make_unique<char[]>(MAX(size, 1ul));
+    this->m_iReservedSize = (int64_t)size;
+    this->m_iReservedTail = META_HEADER->fields.tail;
+    void *pdat = this->m_pReserved.get();
+    FPL_UNLOCK;
+    return pdat;
+}
+
+void DirectPersistLog::commit(const int64_t &ver, const HLC &mhlc) noexcept(false) {
+    dbg_trace("{0} commit event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
+    FPL_WRLOCK;
+    // A truncate() or applyLogTail() since reserve() moves the next entry
+    if(this->m_iReservedSize < 0 || this->m_iReservedTail != META_HEADER->fields.tail) {
+        dbg_error("{0}-commit exception no valid reservation!", this->m_sName);
+        dbg_flush();
+        this->m_iReservedSize = -1;
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NO_RESERVATION;
+    }
+    if((CURR_LOG_IDX != -1) && (META_HEADER->fields.ver >= ver)) {
+        dbg_error("{0}-commit version already exists! cur_ver:{1} new_ver:{2}", this->m_sName,
+                  (int64_t)META_HEADER->fields.ver, (int64_t)ver);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_VERSION;
+    }
+
+    // fill the log entry
+    LogEntry entry;
+    memset(&entry, 0, sizeof(LogEntry));
+    entry.fields.ver = ver;
+    entry.fields.dlen = (uint64_t)this->m_iReservedSize;
+    entry.fields.ofst = nextDataOfst();
+    entry.fields.hlc_r = mhlc.m_rtc_us;
+    entry.fields.hlc_l = mhlc.m_logic;
+    this->m_entries.push_back(entry);
+    {
+        lock_guard<mutex> lck(this->m_cacheMutex);
+        cacheEntryLocked(META_HEADER->fields.tail, std::move(this->m_pReserved), entry.fields.dlen);
+    }
+    this->m_iReservedSize = -1;
+
+    // update meta header
+    this->hidx.insert(hlc_index_entry{mhlc, META_HEADER->fields.tail});
+    META_HEADER->fields.tail++;
+    META_HEADER->fields.ver = ver;
+    dbg_debug("{0} append a log ver:{1} hlc:({2},{3})", this->m_sName,
+              ver, mhlc.m_rtc_us, mhlc.m_logic);
+    FPL_UNLOCK;
+}
+
+void DirectPersistLog::advanceVersion(const int64_t &ver) noexcept(false) {
+    FPL_WRLOCK;
+    if(META_HEADER->fields.ver < ver) {
+        META_HEADER->fields.ver = ver;
+    } else {
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_VERSION;
+    }
+    FPL_UNLOCK;
+}
+
+const int64_t DirectPersistLog::persist(const bool preLocked) noexcept(false) {
+    int64_t ver_ret = INVALID_VERSION;
+    if(!preLocked) {
+        FPL_PERS_LOCK;
+        FPL_RDLOCK;
+    }
+
+    if(*META_HEADER == *META_HEADER_PERS) {
+        if(CURR_LOG_IDX != -1) {
+            ver_ret = META_HEADER->fields.ver;
+        }
+        if(!preLocked) {
+            FPL_UNLOCK;
+            FPL_PERS_UNLOCK;
+        }
+        return ver_ret;
+    }
+
+    dbg_trace("{0} write data,log,and meta.", this->m_sName);
+    try {
+        // shadow the current state. The entries that haven't been written
+        // stay in the cache, so their data can be written without the lock.
+        MetaHeader shadow_header = *META_HEADER;
+        const int64_t first = MAX(META_HEADER_PERS->fields.tail, META_HEADER->fields.head);
+        // the log is written in whole blocks, including the older entries
+        // that share a block with the first new one
+        const int64_t block_first = MAX(first - first % (int64_t)ENTRIES_PER_BLOCK, META_HEADER->fields.head);
+        vector<LogEntry> log_entries;
+        vector<LogEntry> data_entries;
+        vector<const char *> data;
+        for(int64_t idx = block_first; idx < META_HEADER->fields.tail; idx++) {
+            log_entries.push_back(*DPL_ENTRY_AT(idx));
+            if(idx >= first) {
+                data_entries.push_back(*DPL_ENTRY_AT(idx));
+                data.push_back(loadEntryData(idx, *DPL_ENTRY_AT(idx)));
+            }
+        }
+        if(NUM_USED_SLOTS > 0) {
+            ver_ret = META_HEADER->fields.ver;
+        }
+        if(!preLocked) {
+            FPL_UNLOCK;
+        }
+        if(!data_entries.empty()) {
+            writeData(data_entries, data);
+            writeLogEntries(block_first, log_entries);
+        }
+        // flush meta data
+        this->persistMetaHeaderAtomically(&shadow_header);
+        this->m_iPersistedTail = shadow_header.fields.tail;
+    } catch(uint64_t e) {
+        if(!preLocked) {
+            FPL_PERS_UNLOCK;
+        }
+        throw e;
+    }
+    dbg_trace("{0} write data,log,and meta...done.", this->m_sName);
+
+    if(!preLocked) {
+        FPL_PERS_UNLOCK;
+    }
+    return ver_ret;
+}
+
+int64_t DirectPersistLog::getLength() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t len = NUM_USED_SLOTS;
+    FPL_UNLOCK;
+
+    return len;
+}
+
+int64_t DirectPersistLog::getEarliestIndex() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t idx = (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
+    FPL_UNLOCK;
+    return idx;
+}
+
+int64_t DirectPersistLog::getLatestIndex() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t idx = CURR_LOG_IDX;
+    FPL_UNLOCK;
+    return idx;
+}
+
+int64_t DirectPersistLog::getEarliestVersion() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t ver = (NUM_USED_SLOTS == 0) ? INVALID_VERSION : this->m_entries.front().fields.ver;
+    FPL_UNLOCK;
+    return ver;
+}
+
+int64_t DirectPersistLog::getLatestVersion() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t ver = (NUM_USED_SLOTS == 0) ? INVALID_VERSION : this->m_entries.back().fields.ver;
+    FPL_UNLOCK;
+    return ver;
+}
+
+const int64_t DirectPersistLog::getLastPersisted() noexcept(false) {
+    int64_t last_persisted = INVALID_VERSION;
+    FPL_PERS_LOCK;
+
+    last_persisted = META_HEADER_PERS->fields.ver;
+
+    FPL_PERS_UNLOCK;
+    return last_persisted;
+}
+
+const void *DirectPersistLog::getEntryByIndex(const int64_t &eidx) noexcept(false) {
+    FPL_RDLOCK;
+    dbg_trace("{0}-getEntryByIndex-head:{1},tail:{2},eidx:{3}",
+              this->m_sName, META_HEADER->fields.head, META_HEADER->fields.tail, eidx);
+
+    int64_t ridx = (eidx < 0) ? (META_HEADER->fields.tail + eidx) : eidx;
+
+    if(META_HEADER->fields.tail <= ridx || ridx < META_HEADER->fields.head) {
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_ENTRY_IDX(eidx);
+    }
+    LogEntry entry = *DPL_ENTRY_AT(ridx);
+    FPL_UNLOCK;
+
+    return loadEntryData(ridx, entry);
+}
+
+const void *DirectPersistLog::getEntry(const int64_t &ver) noexcept(false) {
+    FPL_RDLOCK;
+    int64_t l_idx = searchVersion(ver);
+    // no object exists before the requested version.
+    if(l_idx == -1) {
+        FPL_UNLOCK;
+        return nullptr;
+    }
+    LogEntry entry = *DPL_ENTRY_AT(l_idx);
+    FPL_UNLOCK;
+
+    return loadEntryData(l_idx, entry);
+}
+
+const void *DirectPersistLog::getEntry(const HLC &rhlc) noexcept(false) {
+    int64_t l_idx = this->getEntryIndex(rhlc);
+    // no object exists before the requested timestamp.
+    if(l_idx == -1) {
+        return nullptr;
+    }
+    return this->getEntryByIndex(l_idx);
+}
+
+int64_t DirectPersistLog::getEntryIndex(const int64_t &ver) noexcept(false) {
+    FPL_RDLOCK;
+    int64_t l_idx = searchVersion(ver);
+    FPL_UNLOCK;
+
+    return l_idx;
+}
+
+int64_t DirectPersistLog::getEntryIndex(const HLC &rhlc) noexcept(false) {
+    int64_t l_idx = -1;
+
+    FPL_RDLOCK;
+    struct hlc_index_entry skey(rhlc, 0);
+    auto key = this->hidx.upper_bound(skey);
+    if(key != this->hidx.begin() && this->hidx.size() > 0) {
+        key--;
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            l_idx = key->log_idx;
+        }
+    }
+    FPL_UNLOCK;
+
+    return l_idx;
+}
+
+int64_t DirectPersistLog::getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false) {
+    FPL_RDLOCK;
+    // data offsets only grow along the log, so the bytes from an entry to
+    // the end shrink as the entry moves up
+    int64_t low = META_HEADER->fields.head;
+    int64_t high = META_HEADER->fields.tail;
+    if(low < high) {
+        const uint64_t end_ofst = DPL_ENTRY_AT(high - 1)->fields.ofst + DPL_ENTRY_AT(high - 1)->fields.dlen;
+        while(low < high) {
+            const int64_t mid = low + (high - low) / 2;
+            if(end_ofst - DPL_ENTRY_AT(mid)->fields.ofst <= max_bytes) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+    }
+    FPL_UNLOCK;
+
+    return low;
+}
+
+std::vector<int64_t> DirectPersistLog::getEntryIndices(const HLC &from, const HLC &to) noexcept(false) {
+    std::vector<int64_t> indices;
+
+    FPL_RDLOCK;
+    auto first = this->hidx.lower_bound(hlc_index_entry(from, 0));
+    auto last = this->hidx.upper_bound(hlc_index_entry(to, 0));
+    for(auto key = first; key < last; key++) {
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            indices.push_back(key->log_idx);
+        }
+    }
+    FPL_UNLOCK;
+
+    return indices;
+}
+
+// trim by index
+void DirectPersistLog::trimByIndex(const int64_t &idx) noexcept(false) {
+    dbg_trace("{0} trim at index: {1}", this->m_sName, idx);
+    FPL_RDLOCK;
+    // validate check
+    if(idx < META_HEADER->fields.head || idx >= META_HEADER->fields.tail) {
+        FPL_UNLOCK;
+        return;
+    }
+    FPL_UNLOCK;
+
+    FPL_PERS_LOCK;
+    FPL_WRLOCK;
+    //validate check again
+    if(idx < META_HEADER->fields.head || idx >= META_HEADER->fields.tail) {
+        FPL_UNLOCK;
+        FPL_PERS_UNLOCK;
+        return;
+    }
+    this->m_entries.erase(this->m_entries.begin(), this->m_entries.begin() + (idx + 1 - META_HEADER->fields.head));
+    META_HEADER->fields.head = idx + 1;
+    try {
+        persist(true);
+    } catch(uint64_t e) {
+        FPL_UNLOCK;
+        FPL_PERS_UNLOCK;
+        throw e;
+    }
+    dropCachedEntries(META_HEADER->fields.head, META_HEADER->fields.tail);
+    this->hidx.trim(META_HEADER->fields.head);
+    FPL_UNLOCK;
+    FPL_PERS_UNLOCK;
+    dbg_trace("{0} trim at index: {1}...done", this->m_sName, idx);
+}
+
+void DirectPersistLog::trim(const int64_t &ver) noexcept(false) {
+    dbg_trace("{0} trim at version: {1}", this->m_sName, ver);
+    int64_t idx = this->getEntryIndex(ver);
+    if(idx != -1) {
+        this->trimByIndex(idx);
+    }
+    dbg_trace("{0} trim at version: {1}...done", this->m_sName, ver);
+}
+
+void DirectPersistLog::trim(const HLC &hlc) noexcept(false) {
+    //TODO: This is hard because HLC order does not agree with index order.
+    throw PERSIST_EXP_UNIMPLEMENTED;
+}
+
+void DirectPersistLog::truncate(const int64_t &ver) noexcept(false) {
+    dbg_trace("{0} truncate at version: {1}.", this->m_sName, ver);
+    FPL_WRLOCK;
+    // STEP 1: search for the log entry
+    int64_t l_idx = searchVersion(ver);
+    // STEP 2: update META_HEADER
+    // if no adequate log is found, we remove all logs.
+    const int64_t tail = (l_idx == -1) ? META_HEADER->fields.head : l_idx + 1;
+    this->m_entries.erase(this->m_entries.begin() + (tail - META_HEADER->fields.head), this->m_entries.end());
+    META_HEADER->fields.tail = tail;
+    this->hidx.truncate(tail);
+    if(META_HEADER->fields.ver > ver)
+        META_HEADER->fields.ver = ver;
+    // STEP 3: update PERSISTENT STATE. The remaining entries may not have
+    // been written yet, so this is a full persist.
+    FPL_PERS_LOCK;
+    try {
+        persist(true);
+    } catch(uint64_t e) {
+        FPL_PERS_UNLOCK;
+        FPL_UNLOCK;
+        throw e;
+    }
+    dropCachedEntries(META_HEADER->fields.head, META_HEADER->fields.tail);
+    FPL_PERS_UNLOCK;
+    FPL_UNLOCK;
+    dbg_trace("{0} truncate at version: {1}....done", this->m_sName, ver);
+}
+
+// The serialized log format is the same as FilePersistLog's:
+// [latest_version(int64_t)][nr_log_entry(int64_t)][log_enty1][log_entry2]...
+// where each entry is a LogEntry followed by its data.
+size_t DirectPersistLog::bytes_size(const int64_t &ver) noexcept(false) {
+    size_t bsize = (sizeof(int64_t) + sizeof(int64_t));
+    int64_t first;
+    FPL_RDLOCK;
+    vector<LogEntry> entries = getEntriesBeyondVersion(ver, first);
+    FPL_UNLOCK;
+    for(const LogEntry &entry : entries) {
+        bsize += sizeof(LogEntry) + entry.fields.dlen;
+    }
+    return bsize;
+}
+
+size_t DirectPersistLog::to_bytes(char *buf, const int64_t &ver) noexcept(false) {
+    size_t ofst = 0;
+    this->post_object([&](char const *const data, std::size_t size) {
+        memcpy(buf + ofst, data, size);
+        ofst += size;
+    },
+                      ver);
+    return ofst;
+}
+
+void DirectPersistLog::post_object(const std::function<void(char const *const, std::size_t)> &f,
+                                   const int64_t &ver) noexcept(false) {
+    int64_t first;
+    FPL_RDLOCK;
+    // latest_version
+    int64_t latest_version = META_HEADER->fields.ver;
+    vector<LogEntry> entries = getEntriesBeyondVersion(ver, first);
+    FPL_UNLOCK;
+    f((char *)&latest_version, sizeof(int64_t));
+    // nr_log_entry
+    int64_t nr_log_entry = entries.size();
+    f((char *)&nr_log_entry, sizeof(int64_t));
+    // log_entries
+    for(size_t i = 0; i < entries.size(); i++) {
+        f((const char *)&entries[i], sizeof(LogEntry));
+        if(entries[i].fields.dlen > 0) {
+            f(loadEntryData(first + i, entries[i]), entries[i].fields.dlen);
+        }
+    }
+}
+
+void DirectPersistLog::applyLogTail(char const *v) noexcept(false) {
+    size_t ofst = 0;
+    // latest_version
+    int64_t latest_version = *(const int64_t *)(v + ofst);
+    ofst += sizeof(int64_t);
+    // nr_log_entry
+    int64_t nr_log_entry = *(const int64_t *)(v + ofst);
+    ofst += sizeof(int64_t);
+    // log_entries
+    while(nr_log_entry--) {
+        const LogEntry *cple = (const LogEntry *)(v + ofst);
+        ofst += sizeof(LogEntry);
+        // version grows monotonically.
+        FPL_RDLOCK;
+        const int64_t cur_ver = META_HEADER->fields.ver;
+        FPL_UNLOCK;
+        if(cple->fields.ver > cur_ver) {
+            memcpy(this->reserve(cple->fields.dlen), v + ofst, cple->fields.dlen);
+            this->commit(cple->fields.ver, HLC{cple->fields.hlc_r, cple->fields.hlc_l});
+        } else {
+            dbg_trace("{0} skip log entry version {1}.", __func__, cple->fields.ver);
+        }
+        ofst += cple->fields.dlen;
+    }
+    // update the latest version.
+    FPL_WRLOCK;
+    META_HEADER->fields.ver = latest_version;
+    FPL_UNLOCK;
+}
+
+void DirectPersistLog::persistMetaHeaderAtomically(MetaHeader *pShadowHeader) noexcept(false) {
+    // STEP 1: get file name
+    const string swpFile = this->m_sMetaFile + "." + SWAP_FILE_SUFFIX;
+
+    // STEP 2: write current meta header to swap file
+    int fd = open(swpFile.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if(fd == -1) {
+        throw PERSIST_EXP_OPEN_FILE(errno);
+    }
+    ssize_t nWrite = write(fd, pShadowHeader, sizeof(MetaHeader));
+    if(nWrite != sizeof(MetaHeader)) {
+        close(fd);
+        throw PERSIST_EXP_WRITE_FILE(errno);
+    }
+    // the data and log writes are synchronous, so the header must be too
+    if(fdatasync(fd) != 0) {
+        close(fd);
+        throw PERSIST_EXP_WRITE_FILE(errno);
+    }
+    close(fd);
+
+    // STEP 3: atomically update the meta file
+    if(rename(swpFile.c_str(), this->m_sMetaFile.c_str()) != 0) {
+        throw PERSIST_EXP_RENAME_FILE(errno);
+    }
+
+    // STEP 4: update the persisted header in memory
+    *META_HEADER_PERS = *pShadowHeader;
+}
+
+int64_t DirectPersistLog::searchVersion(const int64_t &ver) noexcept(false) {
+    auto itr = std::upper_bound(this->m_entries.cbegin(), this->m_entries.cend(), ver,
+                                [](const int64_t &v, const LogEntry &entry) {
+                                    return v < entry.fields.ver;
+                                });
+    if(itr == this->m_entries.cbegin()) {
+        return -1;
+    }
+    return META_HEADER->fields.head + (itr - this->m_entries.cbegin()) - 1;
+}
+
+uint64_t DirectPersistLog::nextDataOfst() noexcept(false) {
+    return (CURR_LOG_IDX == -1) ? 0 : (DPL_CURR_ENTRY->fields.ofst + DPL_CURR_ENTRY->fields.dlen);
+}
+
+vector<LogEntry> DirectPersistLog::getEntriesBeyondVersion(const int64_t &ver, int64_t &first) noexcept(false) {
+    // INVALID_VERSION means all logs; searchVersion() returns -1 for it, as
+    // it does for versions earlier than the earliest log.
+    int64_t l_idx = (ver == INVALID_VERSION) ? -1 : searchVersion(ver);
+    first = (l_idx == -1) ? META_HEADER->fields.head : l_idx + 1;
+    return vector<LogEntry>(this->m_entries.begin() + (first - META_HEADER->fields.head), this->m_entries.end());
+}
+
+const char *DirectPersistLog::loadEntryData(const int64_t &idx, const LogEntry &entry) noexcept(false) {
+    {
+        lock_guard<mutex> lck(this->m_cacheMutex);
+        auto search = this->m_cache.find(idx);
+        if(search != this->m_cache.end()) {
+            this->m_cacheLru.splice(this->m_cacheLru.begin(), this->m_cacheLru, search->second.lru_pos);
+            return search->second.data.get();
+        }
+    }
+    // cache miss: read the blocks holding the entry
+    const uint64_t start = ALIGN_DOWN(entry.fields.ofst);
+    const uint64_t len = ALIGN_UP(entry.fields.ofst + entry.fields.dlen) - start;
+    auto data = make_unique<char[]>(MAX(entry.fields.dlen, 1ul));
+    if(len > 0) {
+        auto buf = allocAligned(len);
+        readRing(this->m_iDataFileDesc, MAX_DATA_SIZE, start, buf.get(), len);
+        memcpy(data.get(), buf.get() + (entry.fields.ofst - start), entry.fields.dlen);
+    }
+    lock_guard<mutex> lck(this->m_cacheMutex);
+    return cacheEntryLocked(idx, std::move(data), entry.fields.dlen);
+}
+
+const char *DirectPersistLog::cacheEntryLocked(const int64_t &idx, unique_ptr<char[]> data, const uint64_t &size) {
+    auto inserted = this->m_cache.emplace(idx, CachedEntry{std::move(data), size, this->m_cacheLru.end()});
+    if(!inserted.second) {
+        // another thread has read it in the meantime
+        this->m_cacheLru.splice(this->m_cacheLru.begin(), this->m_cacheLru, inserted.first->second.lru_pos);
+        return inserted.first->second.data.get();
+    }
+    this->m_cacheLru.push_front(idx);
+    inserted.first->second.lru_pos = this->m_cacheLru.begin();
+    this->m_cacheBytes += size;
+    // evict the least recently used entries that have been written
+    for(auto itr = std::prev(this->m_cacheLru.end());
+        this->m_cacheBytes > this->m_cacheCapacity && itr != this->m_cacheLru.begin();) {
+        auto victim = itr--;
+        if(*victim >= this->m_iPersistedTail) {
+            continue;
+        }
+        auto search = this->m_cache.find(*victim);
+        this->m_cacheBytes -= search->second.size;
+        this->m_cache.erase(search);
+        this->m_cacheLru.erase(victim);
+    }
+    return inserted.first->second.data.get();
+}
+
+void DirectPersistLog::dropCachedEntries(const int64_t &head, const int64_t &tail) {
+    lock_guard<mutex> lck(this->m_cacheMutex);
+    for(auto itr = this->m_cache.begin(); itr != this->m_cache.end();) {
+        if(itr->first < head || itr->first >= tail) {
+            this->m_cacheBytes -= itr->second.size;
+            this->m_cacheLru.erase(itr->second.lru_pos);
+            itr = this->m_cache.erase(itr);
+        } else {
+            itr++;
+        }
+    }
+}
+
+void DirectPersistLog::writeData(const vector<LogEntry> &entries, const vector<const char *> &data) noexcept(false) {
+    const uint64_t start = entries.front().fields.ofst;
+    const uint64_t end = entries.back().fields.ofst + entries.back().fields.dlen;
+    if(end == start) {
+        return;
+    }
+    const uint64_t astart = ALIGN_DOWN(start);
+    const uint64_t aend = ALIGN_UP(end);
+    auto buf = allocAligned(aend - astart);
+    // complete the partial block at the start
+    if(astart < start) {
+        if(this->m_uTailBlockOfst == astart) {
+            memcpy(buf.get(), this->m_pTailBlock.get(), start - astart);
+        } else {
+            readRing(this->m_iDataFileDesc, MAX_DATA_SIZE, astart, buf.get(), DIRECT_IO_ALIGNMENT);
+        }
+    }
+    for(size_t i = 0; i < entries.size(); i++) {
+        memcpy(buf.get() + (entries[i].fields.ofst - astart), data[i], entries[i].fields.dlen);
+    }
+    memset(buf.get() + (end - astart), 0, aend - end);
+    writeRing(this->m_iDataFileDesc, MAX_DATA_SIZE, astart, buf.get(), aend - astart);
+    // keep the partial block at the end for the next write
+    if(end % DIRECT_IO_ALIGNMENT != 0) {
+        memcpy(this->m_pTailBlock.get(), buf.get() + (aend - DIRECT_IO_ALIGNMENT - astart), DIRECT_IO_ALIGNMENT);
+        this->m_uTailBlockOfst = aend - DIRECT_IO_ALIGNMENT;
+    } else {
+        this->m_uTailBlockOfst = UINT64_MAX;
+    }
+}
+
+void DirectPersistLog::writeLogEntries(const int64_t &first, const vector<LogEntry> &entries) noexcept(false) {
+    // the slots before first in its block have been trimmed
+    const int64_t block_first = first - first % (int64_t)ENTRIES_PER_BLOCK;
+    const int64_t end = first + entries.size();
+    const uint64_t len = ALIGN_UP((end - block_first) * sizeof(LogEntry));
+    auto buf = allocAligned(len);
+    memset(buf.get(), 0, len);
+    memcpy(buf.get() + (first - block_first) * sizeof(LogEntry), entries.data(), entries.size() * sizeof(LogEntry));
+    writeRing(this->m_iLogFileDesc, MAX_LOG_SIZE, (block_first % MAX_LOG_ENTRY) * sizeof(LogEntry), buf.get(), len);
+}
+
+//////////////////////////
+// invisible to outside //
+//////////////////////////
+unique_ptr<char, void (*)(void *)> allocAligned(const uint64_t &size) noexcept(false) {
+    void *buf = nullptr;
+    int ret = posix_memalign(&buf, DIRECT_IO_ALIGNMENT, size);
+    if(ret != 0) {
+        throw PERSIST_EXP_ALLOC(ret);
+    }
+    return unique_ptr<char, void (*)(void *)>((char *)buf, free);
+}
+
+int openDirect(const string &file) noexcept(false) {
+    int fd = open(file.c_str(), O_RDWR | O_DIRECT | O_DSYNC);
+    if(fd == -1 && errno == EINVAL) {
+        dbg_warn("{0}: O_DIRECT is not supported, using synchronous buffered I/O.", file);
+        fd = open(file.c_str(), O_RDWR | O_DSYNC);
+    }
+    if(fd == -1) {
+        throw PERSIST_EXP_OPEN_FILE(errno);
+    }
+    return fd;
+}
+
+void readRing(int fd, const uint64_t &ring_size, const uint64_t &pos, char *buf, const uint64_t &len) noexcept(false) {
+    uint64_t done = 0;
+    while(done < len) {
+        const uint64_t rpos = (pos + done) % ring_size;
+        ssize_t nRead = pread(fd, buf + done, MIN(len - done, ring_size - rpos), rpos);
+        if(nRead <= 0) {
+            throw PERSIST_EXP_READ_FILE(errno);
+        }
+        done += nRead;
+    }
+}
+
+void writeRing(int fd, const uint64_t &ring_size, const uint64_t &pos, const char *buf, const uint64_t &len) noexcept(false) {
+    uint64_t done = 0;
+    while(done < len) {
+        const uint64_t wpos = (pos + done) % ring_size;
+        ssize_t nWrite = pwrite(fd, buf + done, MIN(len - done, ring_size - wpos), wpos);
+        if(nWrite <= 0) {
+            throw PERSIST_EXP_WRITE_FILE(errno);
+        }
+        done += nWrite;
+    }
+}
+}
@@ -0,0 +1,194 @@
+#ifndef DIRECT_PERSIST_LOG_HPP
+#define DIRECT_PERSIST_LOG_HPP
+
+#include "FilePersistLog.hpp"
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace persistent {
+
+#define DIRECT_LOG_FILE_SUFFIX "dlog"
+#define DIRECT_DATA_FILE_SUFFIX "ddata"
+
+// O_DIRECT transfers have to be aligned to the logical block size of the
+// device, which no device we use exceeds.
+#define DIRECT_IO_ALIGNMENT ((uint64_t)4096)
+#define ENTRIES_PER_BLOCK (DIRECT_IO_ALIGNMENT / sizeof(LogEntry))
+
+/**
+ * DirectPersistLog is a PersistLog that bypasses the page cache. Like
+ * FilePersistLog, it keeps a meta header file, a ring of log entries, and a
+ * ring of data, but instead of mapping them into memory and relying on
+ * writeback and msync(), it writes them with aligned O_DIRECT writes when the
+ * log is persisted. Appended entries are kept in memory until they are
+ * written; older entries are read back through a read cache of
+ * PERS/direct_read_cache_size bytes. The meta header has the same format and
+ * file name as FilePersistLog's, so FilePersistLog::getMinimumLatestPersistedVersion()
+ * covers both kinds of logs.
+ *
+ * The pointers returned by getEntry() and getEntryByIndex() stay valid until
+ * the entry is trimmed, truncated, or evicted from the read cache, so the
+ * data should be used (e.g. deserialized) right away. Entries are stored
+ * uncompressed; setCodec() has no effect.
+ */
+class DirectPersistLog : public PersistLog {
+protected:
+    // the current meta header
+    MetaHeader m_currMetaHeader;
+    // the persisted meta header
+    MetaHeader m_persMetaHeader;
+    // path of the data files
+    const std::string m_sDataPath;
+    // full meta file name
+    const std::string m_sMetaFile;
+    // full log file name
+    const std::string m_sLogFile;
+    // full data file name
+    const std::string m_sDataFile;
+
+    // the log file descriptor
+    int m_iLogFileDesc;
+    // the data file descriptor
+    int m_iDataFileDesc;
+    // the number of entries in the log ring, used by MAX_LOG_ENTRY
+    uint64_t m_uMaxLogEntry = 0;
+    // the size of the data ring, used by MAX_DATA_SIZE
+    uint64_t m_uMaxDataSize = 0;
+
+    // the log entries from head to tail
+    std::deque<LogEntry> m_entries;
+    // read/write lock, used by the FPL_* lock macros
+    pthread_rwlock_t m_rwlock;
+    // persistent lock
+    pthread_mutex_t m_perslock;
+
+    // the space handed out by reserve()
+    std::unique_ptr<char[]> m_pReserved;
+    // size of the reserved space, or -1 if there is none
+    int64_t m_iReservedSize = -1;
+    // the tail of the log when the space was reserved
+    int64_t m_iReservedTail = -1;
+
+    // the last data block written, which the next write has to complete
+    std::unique_ptr<char, void (*)(void *)> m_pTailBlock;
+    // the data offset of m_pTailBlock, or UINT64_MAX if there is none
+    uint64_t m_uTailBlockOfst = UINT64_MAX;
+
+    struct CachedEntry {
+        std::unique_ptr<char[]> data;
+        uint64_t size;
+        // position in m_cacheLru
+        std::list<int64_t>::iterator lru_pos;
+    };
+    // read cache, by log index
+    std::unordered_map<int64_t, CachedEntry> m_cache;
+    // log indexes in the cache, the most recently used first
+    std::list<int64_t> m_cacheLru;
+    // the number of data bytes in the cache
+    uint64_t m_cacheBytes = 0;
+    const uint64_t m_cacheCapacity;
+    std::mutex m_cacheMutex;
+    // entries at or after this index haven't been written yet, so they must
+    // stay in the cache
+    std::atomic<int64_t> m_iPersistedTail;
+
+    // load the log from files. This method may through exceptions if read from
+    // file failed.
+    virtual void load() noexcept(false);
+
+    // Persistent the Metadata header, we assume
+    // FPL_PERS_LOCK is acquired.
+    virtual void persistMetaHeaderAtomically(MetaHeader *) noexcept(false);
+
+public:
+    //Constructor
+    DirectPersistLog(const std::string &name, const std::string &dataPath) noexcept(false);
+    DirectPersistLog(const std::string &name) noexcept(false) : DirectPersistLog(name, getPersFilePath()){};
+    //Destructor
+    virtual ~DirectPersistLog() noexcept(true);
+
+    //Derived from PersistLog
+    virtual void append(const void *pdata,
+                        const uint64_t &size, const int64_t &ver,
+                        const HLC &mhlc) noexcept(false);
+    virtual void *reserve(const uint64_t &size) noexcept(false);
+    virtual void commit(const int64_t &ver, const HLC &mhlc) noexcept(false);
+    virtual void advanceVersion(const int64_t &ver) noexcept(false);
+    virtual int64_t getLength() noexcept(false);
+    virtual int64_t getEarliestIndex() noexcept(false);
+    virtual int64_t getLatestIndex() noexcept(false);
+    virtual int64_t getEarliestVersion() noexcept(false);
+    virtual int64_t getLatestVersion() noexcept(false);
+    virtual const int64_t getLastPersisted() noexcept(false);
+    virtual const void *getEntryByIndex(const int64_t &eno) noexcept(false);
+    virtual const void *getEntry(const int64_t &ver) noexcept(false);
+    virtual const void *getEntry(const HLC &hlc) noexcept(false);
+    virtual int64_t getEntryIndex(const int64_t &ver) noexcept(false);
+    virtual int64_t getEntryIndex(const HLC &hlc) noexcept(false);
+    virtual int64_t getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false);
+    virtual std::vector<int64_t> getEntryIndices(const HLC &from, const HLC &to) noexcept(false);
+    virtual const int64_t persist(const bool preLocked = false) noexcept(false);
+    virtual void trimByIndex(const int64_t &eno) noexcept(false);
+    virtual void trim(const int64_t &ver) noexcept(false);
+    virtual void trim(const HLC &hlc) noexcept(false);
+    virtual void truncate(const int64_t &ver) noexcept(false);
+    virtual size_t bytes_size(const int64_t &ver) noexcept(false);
+    virtual size_t to_bytes(char *buf, const int64_t &ver) noexcept(false);
+    virtual void post_object(const std::function<void(char const *const, std::size_t)> &f,
+                             const int64_t &ver) noexcept(false);
+    virtual void applyLogTail(char const *v) noexcept(false);
+
+private:
+    /**
+     * Find the maximum index of the entries whose version <= ver.
+     * Note: no lock protected, use FPL_RDLOCK
+     * @return index of the log entry found or -1 if not found.
+     */
+    int64_t searchVersion(const int64_t &ver) noexcept(false);
+    /**
+     * The data offset of the next entry.
+     * Note: no lock protected, use FPL_RDLOCK
+     */
+    uint64_t nextDataOfst() noexcept(false);
+    /**
+     * Get the entries from the first one newer than ver to the tail, like
+     * FilePersistLog::getMinimumIndexBeyondVersion() does.
+     * Note: no lock protected, use FPL_RDLOCK
+     * @PARAM first - receives the index of the first entry returned
+     */
+    std::vector<LogEntry> getEntriesBeyondVersion(const int64_t &ver, int64_t &first) noexcept(false);
+    /**
+     * Return the data of an entry, from the read cache or from the data file.
+     * @PARAM idx - the log index of the entry
+     * @PARAM entry - a copy of the entry, taken under FPL_RDLOCK
+     */
+    const char *loadEntryData(const int64_t &idx, const LogEntry &entry) noexcept(false);
+    /**
+     * Add an entry to the read cache and evict entries beyond its capacity.
+     * Note: m_cacheMutex must be held
+     * @RETURN the cached data, which may have been cached by another thread
+     */
+    const char *cacheEntryLocked(const int64_t &idx, std::unique_ptr<char[]> data, const uint64_t &size);
+    /**
+     * Drop the cached entries outside of [head, tail).
+     */
+    void dropCachedEntries(const int64_t &head, const int64_t &tail);
+    /**
+     * Write entries to the data ring; their data must be contiguous.
+     */
+    void writeData(const std::vector<LogEntry> &entries, const std::vector<const char *> &data) noexcept(false);
+    /**
+     * Write the blocks of the log ring holding the entries from first on.
+     * @PARAM first - the index of entries[0]; must start a block, or the
+     *        entries before it in the block must be included with it
+     */
+    void writeLogEntries(const int64_t &first, const std::vector<LogEntry> &entries) noexcept(false);
+};
+}
+
+#endif  //DIRECT_PERSIST_LOG_HPP
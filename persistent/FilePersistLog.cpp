@@ -1,5 +1,7 @@
 #include "FilePersistLog.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <condition_variable>
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
@@ -8,6 +10,7 @@
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
 using namespace std;
@@ -22,10 +25,64 @@ namespace persistent {
 static bool checkOrCreateMetaFile(const string &metaFile) noexcept(false);
 
 // verify the existence of the log file
-static bool checkOrCreateLogFile(const string &logFile) noexcept(false);
+static bool checkOrCreateLogFile(const string &logFile, const uint64_t &size) noexcept(false);
 
 // verify the existence of the data file
-static bool checkOrCreateDataFile(const string &dataFile) noexcept(false);
+static bool checkOrCreateDataFile(const string &dataFile, const uint64_t &size) noexcept(false);
+
+// Prepares the space ahead of the append cursors of the process's logs, one
+// log at a time, on a background thread. It is never destroyed, so logs that
+// outlive static destruction can still cancel their requests.
+class LogPreallocator {
+    std::mutex mutex;
+    std::condition_variable requested;
+    std::condition_variable finished;
+    // the logs waiting to be prepared, each at most once
+    std::list<FilePersistLog *> pending;
+    // the log being prepared, which must not be destroyed until it is done
+    FilePersistLog *preparing = nullptr;
+
+    LogPreallocator() {
+        std::thread(&LogPreallocator::run, this).detach();
+    }
+
+    void run() {
+        pthread_setname_np(pthread_self(), "log_prealloc");
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true) {
+            requested.wait(lock, [this]() { return !pending.empty(); });
+            preparing = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            preparing->preallocate();
+            lock.lock();
+            preparing = nullptr;
+            finished.notify_all();
+        }
+    }
+
+public:
+    static LogPreallocator &get() {
+        static LogPreallocator *preallocator = new LogPreallocator();
+        return *preallocator;
+    }
+
+    void request(FilePersistLog *log) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(std::find(pending.begin(), pending.end(), log) != pending.end()) {
+            return;
+        }
+        pending.push_back(log);
+        requested.notify_one();
+    }
+
+    // Drops a log's request, and waits if it is being prepared
+    void cancel(FilePersistLog *log) {
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.remove(log);
+        finished.wait(lock, [this, log]() { return preparing != log; });
+    }
+};
 
 ////////////////////////
 // visible to outside //
@@ -38,8 +95,12 @@ FilePersistLog::FilePersistLog(const string &name, const string &dataPath) noexc
                                                                                              m_sDataFile(dataPath + "/" + name + "." + DATA_FILE_SUFFIX),
                                                                                              m_iLogFileDesc(-1),
                                                                                              m_iDataFileDesc(-1),
+                                                                                             m_uMaxLogEntry(0),
+                                                                                             m_uMaxDataSize(0),
                                                                                              m_pLog(MAP_FAILED),
-                                                                                             m_pData(MAP_FAILED) {
+                                                                                             m_pData(MAP_FAILED),
+                                                                                             m_decompressedCapacity(getPersCodecCacheSize()),
+                                                                                             m_uPreallocSize(getPersPreallocSize()) {
     if(pthread_rwlock_init(&this->m_rwlock, NULL) != 0) {
         throw PERSIST_EXP_RWLOCK_INIT(errno);
     }
@@ -57,9 +118,16 @@ void FilePersistLog::load() noexcept(false) {
     checkOrCreateDir(this->m_sDataPath);
     dbg_trace("{0}:checkOrCreateDir passed.", this->m_sName);
     // STEP 1: check and create files.
+    this->m_uMaxLogEntry = getFileSizeOr(this->m_sLogFile, sizeof(LogEntry) * getPersMaxLogEntry()) / sizeof(LogEntry);
+    this->m_uMaxDataSize = getFileSizeOr(this->m_sDataFile, getPersMaxDataSize());
+    // both rings are mapped twice, back to back
+    if(MAX_LOG_ENTRY < 2 || MAX_LOG_SIZE % PAGE_SIZE != 0 || MAX_DATA_SIZE == 0 || MAX_DATA_SIZE % PAGE_SIZE != 0) {
+        dbg_error("{0}:log capacity of {1} entries and {2} bytes is not page aligned.", this->m_sName, MAX_LOG_ENTRY, MAX_DATA_SIZE);
+        throw PERSIST_EXP_INV_CAPACITY;
+    }
     bool bCreate = checkOrCreateMetaFile(this->m_sMetaFile);
-    checkOrCreateLogFile(this->m_sLogFile);
-    checkOrCreateDataFile(this->m_sDataFile);
+    checkOrCreateLogFile(this->m_sLogFile, MAX_LOG_SIZE);
+    checkOrCreateDataFile(this->m_sDataFile, MAX_DATA_SIZE);
     dbg_trace("{0}:checkOrCreateDataFile passed.", this->m_sName);
     // STEP 2: open files
     this->m_iLogFileDesc = open(this->m_sLogFile.c_str(), O_RDWR);
@@ -139,14 +207,10 @@ void FilePersistLog::load() noexcept(false) {
             }
             close(fd);
             *META_HEADER = *META_HEADER_PERS;
-            // update mhlc index
-            for(int64_t idx = META_HEADER->fields.head; idx < META_HEADER->fields.tail; idx++) {
-                struct hlc_index_entry _ent;
-                _ent.hlc.m_rtc_us = LOG_ENTRY_AT(idx)->fields.hlc_r;
-                _ent.hlc.m_logic = LOG_ENTRY_AT(idx)->fields.hlc_l;
-                _ent.log_idx = idx;
-                this->hidx.insert(_ent);
-            }
+            // Walking the whole log to build the mhlc index would fault in
+            // every page of it; most logs are never queried by hlc, so the
+            // first query builds it instead.
+            this->m_bHidxLoaded.store(false, std::memory_order_release);
         } catch(uint64_t e) {
             FPL_PERS_UNLOCK;
             FPL_UNLOCK;
@@ -168,6 +232,9 @@ void FilePersistLog::load() noexcept(false) {
 }
 
 FilePersistLog::~FilePersistLog() noexcept(true) {
+    if(this->m_uPreallocSize > 0) {
+        LogPreallocator::get().cancel(this);
+    }
     pthread_rwlock_destroy(&this->m_rwlock);
     pthread_mutex_destroy(&this->m_perslock);
     if(this->m_pData != MAP_FAILED) {
@@ -188,57 +255,88 @@ FilePersistLog::~FilePersistLog() noexcept(true) {
 
 void FilePersistLog::append(const void *pdat, const uint64_t &size, const int64_t &ver, const HLC &mhlc) noexcept(false) {
     dbg_trace("{0} append event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
-    FPL_RDLOCK;
+    memcpy(this->reserve(size), pdat, size);
+    dbg_trace("{0} append:data is copied to log.", this->m_sName);
+    this->commit(ver, mhlc);
+}
 
-#define __DO_VALIDATION                                                                            \
-    do {                                                                                           \
-        if(NUM_FREE_SLOTS < 1) {                                                                   \
-            dbg_error("{0}-append exception no free slots in log! NUM_FREE_SLOTS={1}",             \
-                      this->m_sName, NUM_FREE_SLOTS);                                              \
-            dbg_flush();                                                                           \
-            FPL_UNLOCK;                                                                            \
-            throw PERSIST_EXP_NOSPACE_LOG;                                                         \
-        }                                                                                          \
-        if(NUM_FREE_BYTES < size) {                                                                \
-            dbg_error("{0}-append exception no space for data: NUM_FREE_BYTES={1}, size={2}",      \
-                      this->m_sName, NUM_FREE_BYTES, size);                                        \
-            dbg_flush();                                                                           \
-            FPL_UNLOCK;                                                                            \
-            throw PERSIST_EXP_NOSPACE_DATA;                                                        \
-        }                                                                                          \
-        if((CURR_LOG_IDX != -1) && (META_HEADER->fields.ver >= ver)) {                             \
-            int64_t cver = META_HEADER->fields.ver;                                                \
-            dbg_error("{0}-append version already exists! cur_ver:{1} new_ver:{2}", this->m_sName, \
-                      (int64_t)cver, (int64_t)ver);                                                \
-            dbg_flush();                                                                           \
-            FPL_UNLOCK;                                                                            \
-            throw PERSIST_EXP_INV_VERSION;                                                         \
-        }                                                                                          \
-    } while(0)
-
-#pragma GCC diagnostic ignored "-Wunused-variable"
-    __DO_VALIDATION;
-#pragma GCC diagnostic pop
+void *FilePersistLog::reserve(const uint64_t &size) noexcept(false) {
+    dbg_trace("{0} reserve {1} bytes", this->m_sName, size);
+    FPL_WRLOCK;
+    if(NUM_FREE_SLOTS < 1) {
+        dbg_error("{0}-reserve exception no free slots in log! NUM_FREE_SLOTS={1}",
+                  this->m_sName, NUM_FREE_SLOTS);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NOSPACE_LOG;
+    }
+    if(NUM_FREE_BYTES < size) {
+        dbg_error("{0}-reserve exception no space for data: NUM_FREE_BYTES={1}, size={2}",
+                  this->m_sName, NUM_FREE_BYTES, size);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NOSPACE_DATA;
+    }
+    // The space stays free until the next entry is appended, which only
+    // commit() does. Remember where it is, in case the log moves under us.
+    void *pdat = NEXT_DATA;
+    this->m_iReservedSize = (int64_t)size;
+    this->m_uReservedOfst = NEXT_DATA_OFST;
+    // with a codec, the data is compressed into that space by commit()
+    this->m_reservedCodec = this->m_codec;
+    if(this->m_reservedCodec != LOG_CODEC_NONE) {
+        if(this->m_reservedRaw.size() < size) {
+            this->m_reservedRaw.resize(size);
+        }
+        pdat = this->m_reservedRaw.data();
+    }
     FPL_UNLOCK;
-    dbg_trace("{0} append:validate check1 Finished.", this->m_sName);
+    return pdat;
+}
 
+void FilePersistLog::commit(const int64_t &ver, const HLC &mhlc) noexcept(false) {
+    dbg_trace("{0} commit event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
     FPL_WRLOCK;
-//check
-#pragma GCC diagnostic ignored "-Wunused-variable"
-    __DO_VALIDATION;
-#pragma GCC diagnostic pop
-    dbg_trace("{0} append:validate check2 Finished.", this->m_sName);
-
-    // copy data
-    memcpy(NEXT_DATA, pdat, size);
-    dbg_trace("{0} append:data is copied to log.", this->m_sName);
+    // A truncate() or applyLogTail() since reserve() moves the next entry
+    if(this->m_iReservedSize < 0 || this->m_uReservedOfst != NEXT_DATA_OFST) {
+        dbg_error("{0}-commit exception no valid reservation!", this->m_sName);
+        dbg_flush();
+        this->m_iReservedSize = -1;
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NO_RESERVATION;
+    }
+    if((CURR_LOG_IDX != -1) && (META_HEADER->fields.ver >= ver)) {
+        dbg_error("{0}-commit version already exists! cur_ver:{1} new_ver:{2}", this->m_sName,
+                  (int64_t)META_HEADER->fields.ver, (int64_t)ver);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_VERSION;
+    }
+    dbg_trace("{0} commit:validate check Finished.", this->m_sName);
+
+    // compress the data, unless that doesn't save space
+    const uint64_t rlen = (uint64_t)this->m_iReservedSize;
+    uint64_t dlen = rlen;
+    LogCodec codec = LOG_CODEC_NONE;
+    if(this->m_reservedCodec != LOG_CODEC_NONE) {
+        const uint64_t clen = (rlen > 0) ? compressData(this->m_reservedCodec, this->m_reservedRaw.data(), rlen, NEXT_DATA, rlen - 1) : 0;
+        if(clen > 0) {
+            dlen = clen;
+            codec = this->m_reservedCodec;
+        } else {
+            memcpy(NEXT_DATA, this->m_reservedRaw.data(), rlen);
+        }
+    }
 
     // fill the log entry
     NEXT_LOG_ENTRY->fields.ver = ver;
-    NEXT_LOG_ENTRY->fields.dlen = size;
+    NEXT_LOG_ENTRY->fields.dlen = dlen;
     NEXT_LOG_ENTRY->fields.ofst = NEXT_DATA_OFST;
     NEXT_LOG_ENTRY->fields.hlc_r = mhlc.m_rtc_us;
     NEXT_LOG_ENTRY->fields.hlc_l = mhlc.m_logic;
+    NEXT_LOG_ENTRY->fields.rlen = rlen;
+    NEXT_LOG_ENTRY->fields.codec = codec;
+    this->m_iReservedSize = -1;
     /* No Sync required here.
     if (msync(ALIGN_TO_PAGE(NEXT_LOG_ENTRY), 
         sizeof(LogEntry) + (((uint64_t)NEXT_LOG_ENTRY) % PAGE_SIZE),MS_SYNC) != 0) {
@@ -248,10 +346,17 @@ void FilePersistLog::append(const void *pdat, const uint64_t &size, const int64_
 */
 
     // update meta header
-    this->hidx.insert(hlc_index_entry{mhlc, META_HEADER->fields.tail});
+    if(this->m_bHidxLoaded.load(std::memory_order_relaxed)) {
+        this->hidx.insert(hlc_index_entry{mhlc, META_HEADER->fields.tail});
+    }
+    FPL_SEQ_WRITE_BEGIN;
     META_HEADER->fields.tail++;
     META_HEADER->fields.ver = ver;
-    dbg_trace("{0} append:log entry and meta data are updated.", this->m_sName);
+    FPL_SEQ_WRITE_END;
+    dbg_trace("{0} commit:log entry and meta data are updated.", this->m_sName);
+    if(this->m_uPreallocSize > 0) {
+        this->requestPreallocation();
+    }
     /* No sync
     if (msync(this->m_pMeta,sizeof(MetaHeader),MS_SYNC) != 0) {
       FPL_UNLOCK;
@@ -263,10 +368,73 @@ void FilePersistLog::append(const void *pdat, const uint64_t &size, const int64_
     FPL_UNLOCK;
 }
 
+void FilePersistLog::requestPreallocation() noexcept(true) {
+    const uint64_t data_ofst = NEXT_DATA_OFST;
+    const uint64_t log_ofst = META_HEADER->fields.tail * sizeof(LogEntry);
+    const uint64_t data_ahead = std::min(this->m_uPreallocSize, (uint64_t)MAX_DATA_SIZE);
+    const uint64_t log_ahead = std::min(this->m_uPreallocSize, (uint64_t)MAX_LOG_SIZE);
+    if(data_ofst + data_ahead / 2 < this->m_uPrepareDataTarget.load(std::memory_order_relaxed)
+       && log_ofst + log_ahead / 2 < this->m_uPrepareLogTarget.load(std::memory_order_relaxed)) {
+        return;
+    }
+    this->m_uPrepareDataTarget.store(data_ofst + data_ahead, std::memory_order_relaxed);
+    this->m_uPrepareLogTarget.store(log_ofst + log_ahead, std::memory_order_relaxed);
+    LogPreallocator::get().request(this);
+}
+
+void FilePersistLog::preallocate() noexcept(true) {
+    const uint64_t data_target = this->m_uPrepareDataTarget.load(std::memory_order_relaxed);
+    const uint64_t log_target = this->m_uPrepareLogTarget.load(std::memory_order_relaxed);
+    // Skip what was prepared before, but no further back than one
+    // prealloc_size from the target: a truncated log moves the cursor back,
+    // and a loaded one starts far ahead of 0.
+    const uint64_t data_from = std::max(this->m_uPreparedDataOfst, data_target - std::min(data_target, std::min(this->m_uPreallocSize, (uint64_t)MAX_DATA_SIZE)));
+    const uint64_t log_from = std::max(this->m_uPreparedLogOfst, log_target - std::min(log_target, std::min(this->m_uPreallocSize, (uint64_t)MAX_LOG_SIZE)));
+    if(data_from < data_target) {
+        this->preallocateRange(this->m_iDataFileDesc, this->m_pData, MAX_DATA_SIZE, data_from, data_target);
+    }
+    if(log_from < log_target) {
+        this->preallocateRange(this->m_iLogFileDesc, this->m_pLog, MAX_LOG_SIZE, log_from, log_target);
+    }
+    this->m_uPreparedDataOfst = data_target;
+    this->m_uPreparedLogOfst = log_target;
+}
+
+void FilePersistLog::preallocateRange(int fd, void *ring, uint64_t ring_size, uint64_t from, uint64_t to) noexcept(true) {
+    // both rings are mapped twice, so a range that wraps around the end of
+    // the file is contiguous in memory, but not in the file
+    const uint64_t page_size = PAGE_SIZE;
+    uint64_t start = (from % ring_size) / page_size * page_size;
+    const uint64_t end = std::min(start + ring_size, ((from % ring_size) + (to - from) + page_size - 1) / page_size * page_size);
+    for(uint64_t ofst = start; this->m_bCanFallocate && ofst < end;) {
+        const uint64_t file_ofst = ofst % ring_size;
+        const uint64_t len = std::min(end - ofst, ring_size - file_ofst);
+        if(fallocate(fd, 0, file_ofst, len) != 0) {
+            if(errno == EOPNOTSUPP) {
+                this->m_bCanFallocate = false;
+            } else {
+                dbg_warn("{0}: fallocate of {1} bytes at {2} failed, errno={3}", this->m_sName, len, file_ofst, errno);
+                break;
+            }
+        }
+        ofst += len;
+    }
+#ifdef MADV_POPULATE_WRITE
+    const int advice = MADV_POPULATE_WRITE;
+#else
+    const int advice = MADV_WILLNEED;
+#endif
+    if(madvise((void *)((uint64_t)ring + start), end - start, advice) != 0) {
+        dbg_warn("{0}: prefaulting {1} bytes at {2} failed, errno={3}", this->m_sName, end - start, start, errno);
+    }
+}
+
 void FilePersistLog::advanceVersion(const int64_t &ver) noexcept(false) {
     FPL_WRLOCK;
     if(META_HEADER->fields.ver < ver) {
+        FPL_SEQ_WRITE_BEGIN;
         META_HEADER->fields.ver = ver;
+        FPL_SEQ_WRITE_END;
     } else {
         FPL_UNLOCK;
         throw PERSIST_EXP_INV_VERSION;
@@ -318,14 +486,10 @@ const int64_t FilePersistLog::persist(const bool preLocked) noexcept(false) {
             FPL_UNLOCK;
         }
         if(flush_dlen > 0) {
-            if(msync(flush_dstart, flush_dlen, MS_SYNC) != 0) {
-                throw PERSIST_EXP_MSYNC(errno);
-            }
+            this->syncRange(flush_dstart, flush_dlen);
         }
         if(flush_llen > 0) {
-            if(msync(flush_lstart, flush_llen, MS_SYNC) != 0) {
-                throw PERSIST_EXP_MSYNC(errno);
-            }
+            this->syncRange(flush_lstart, flush_llen);
         }
         // flush meta data
         this->persistMetaHeaderAtomically(&shadow_header);
@@ -344,41 +508,35 @@ const int64_t FilePersistLog::persist(const bool preLocked) noexcept(false) {
 }
 
 int64_t FilePersistLog::getLength() noexcept(false) {
-    FPL_RDLOCK;
-    int64_t len = NUM_USED_SLOTS;
-    FPL_UNLOCK;
-
-    return len;
+    return seqRead([&]() -> int64_t {
+        return NUM_USED_SLOTS;
+    });
 }
 
 int64_t FilePersistLog::getEarliestIndex() noexcept(false) {
-    FPL_RDLOCK;
-    int64_t idx = (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
-    FPL_UNLOCK;
-    return idx;
+    return seqRead([&]() -> int64_t {
+        return (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
+    });
 }
 
 int64_t FilePersistLog::getLatestIndex() noexcept(false) {
-    FPL_RDLOCK;
-    int64_t idx = CURR_LOG_IDX;
-    FPL_UNLOCK;
-    return idx;
+    return seqRead([&]() -> int64_t {
+        return CURR_LOG_IDX;
+    });
 }
 
 int64_t FilePersistLog::getEarliestVersion() noexcept(false) {
-    FPL_RDLOCK;
-    int64_t idx = (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
-    int64_t ver = (idx == INVALID_INDEX) ? INVALID_VERSION : (LOG_ENTRY_AT(idx)->fields.ver);
-    FPL_UNLOCK;
-    return ver;
+    return seqRead([&]() -> int64_t {
+        int64_t idx = (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
+        return (idx == INVALID_INDEX) ? INVALID_VERSION : (LOG_ENTRY_AT(idx)->fields.ver);
+    });
 }
 
 int64_t FilePersistLog::getLatestVersion() noexcept(false) {
-    FPL_RDLOCK;
-    int64_t idx = CURR_LOG_IDX;
-    int64_t ver = (idx == INVALID_INDEX) ? INVALID_VERSION : (LOG_ENTRY_AT(idx)->fields.ver);
-    FPL_UNLOCK;
-    return ver;
+    return seqRead([&]() -> int64_t {
+        int64_t idx = CURR_LOG_IDX;
+        return (idx == -1) ? INVALID_VERSION : (LOG_ENTRY_AT(idx)->fields.ver);
+    });
 }
 
 const int64_t FilePersistLog::getLastPersisted() noexcept(false) {
@@ -393,17 +551,15 @@ const int64_t FilePersistLog::getLastPersisted() noexcept(false) {
 }
 
 const void *FilePersistLog::getEntryByIndex(const int64_t &eidx) noexcept(false) {
-    FPL_RDLOCK;
-    dbg_trace("{0}-getEntryByIndex-head:{1},tail:{2},eidx:{3}",
-              this->m_sName, META_HEADER->fields.head, META_HEADER->fields.tail, eidx);
+    int64_t ridx = seqRead([&]() -> int64_t {
+        int64_t idx = (eidx < 0) ? (META_HEADER->fields.tail + eidx) : eidx;
+        return (META_HEADER->fields.tail <= idx || idx < META_HEADER->fields.head) ? INVALID_INDEX : idx;
+    });
+    dbg_trace("{0}-getEntryByIndex-eidx:{1},ridx:{2}", this->m_sName, eidx, ridx);
 
-    int64_t ridx = (eidx < 0) ? (META_HEADER->fields.tail + eidx) : eidx;
-
-    if(META_HEADER->fields.tail <= ridx || ridx < META_HEADER->fields.head) {
-        FPL_UNLOCK;
+    if(ridx == INVALID_INDEX) {
         throw PERSIST_EXP_INV_ENTRY_IDX(eidx);
     }
-    FPL_UNLOCK;
 
     dbg_trace("{0} getEntryByIndex at idx:{1} ver:{2} time:({3},{4})",
               this->m_sName,
@@ -412,7 +568,7 @@ const void *FilePersistLog::getEntryByIndex(const int64_t &eidx) noexcept(false)
               (LOG_ENTRY_AT(ridx))->fields.hlc_r,
               (LOG_ENTRY_AT(ridx))->fields.hlc_l);
 
-    return LOG_ENTRY_DATA(LOG_ENTRY_AT(ridx));
+    return getEntryData(ridx);
 }
 
 /** MOVED TO .hpp
@@ -464,36 +620,25 @@ const void *FilePersistLog::getEntryByIndex(const int64_t &eidx) noexcept(false)
 */
 
 const void *FilePersistLog::getEntry(const int64_t &ver) noexcept(false) {
-    LogEntry *ple = nullptr;
-
-    FPL_RDLOCK;
-
     //binary search
     dbg_trace("{0} - begin binary search.", this->m_sName);
-    int64_t l_idx = binarySearch<int64_t>(
-            [&](const LogEntry *ple) {
-                return ple->fields.ver;
-            },
-            ver,
-            META_HEADER->fields.head,
-            META_HEADER->fields.tail);
-    ple = (l_idx == -1) ? nullptr : LOG_ENTRY_AT(l_idx);
+    int64_t l_idx = this->getEntryIndex(ver);
     dbg_trace("{0} - end binary search.", this->m_sName);
 
-    FPL_UNLOCK;
-
     // no object exists before the requested timestamp.
-    if(ple == nullptr) {
+    if(l_idx == -1) {
         return nullptr;
     }
 
-    dbg_trace("{0} getEntry at ({1},{2})", this->m_sName, ple->fields.hlc_r, ple->fields.hlc_l);
+    dbg_trace("{0} getEntry at ({1},{2})", this->m_sName, LOG_ENTRY_AT(l_idx)->fields.hlc_r, LOG_ENTRY_AT(l_idx)->fields.hlc_l);
 
-    return LOG_ENTRY_DATA(ple);
+    return getEntryData(l_idx);
 }
 
 const void *FilePersistLog::getEntry(const HLC &rhlc) noexcept(false) {
+    this->loadHidx();
     LogEntry *ple = nullptr;
+    int64_t l_idx = -1;
     //    unsigned __int128 key = ((((unsigned __int128)rhlc.m_rtc_us)<<64) | rhlc.m_logic);
 
     FPL_RDLOCK;
@@ -514,7 +659,6 @@ const void *FilePersistLog::getEntry(const HLC &rhlc) noexcept(false) {
     dbg_trace("getEntry for hlc({0},{1})", rhlc.m_rtc_us, rhlc.m_logic);
     struct hlc_index_entry skey(rhlc, 0);
     auto key = this->hidx.upper_bound(skey);
-    FPL_UNLOCK;
 
 #ifndef NDEBUG
     dbg_trace("hidx.size = {}", this->hidx.size());
@@ -526,9 +670,14 @@ const void *FilePersistLog::getEntry(const HLC &rhlc) noexcept(false) {
 
     if(key != this->hidx.begin() && this->hidx.size() > 0) {
         key--;
-        ple = LOG_ENTRY_AT(key->log_idx);
-        dbg_trace("getEntry returns: hlc:({0},{1}),idx:{2}", key->hlc.m_rtc_us, key->hlc.m_logic, key->log_idx);
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            l_idx = key->log_idx;
+            ple = LOG_ENTRY_AT(l_idx);
+            dbg_trace("getEntry returns: hlc:({0},{1}),idx:{2}", key->hlc.m_rtc_us, key->hlc.m_logic, key->log_idx);
+        }
     }
+    FPL_UNLOCK;
 
     // no object exists before the requested timestamp.
     if(ple == nullptr) {
@@ -537,7 +686,95 @@ const void *FilePersistLog::getEntry(const HLC &rhlc) noexcept(false) {
 
     dbg_trace("{0} getEntry at ({1},{2})", this->m_sName, ple->fields.hlc_r, ple->fields.hlc_l);
 
-    return LOG_ENTRY_DATA(ple);
+    return getEntryData(l_idx);
+}
+
+int64_t FilePersistLog::getEntryIndex(const int64_t &ver) noexcept(false) {
+    return seqRead([&]() -> int64_t {
+        return binarySearch<int64_t>(
+                [&](const LogEntry *ple) {
+                    return ple->fields.ver;
+                },
+                ver,
+                META_HEADER->fields.head,
+                META_HEADER->fields.tail);
+    });
+}
+
+int64_t FilePersistLog::getEntryIndex(const HLC &rhlc) noexcept(false) {
+    this->loadHidx();
+    int64_t l_idx = -1;
+
+    FPL_RDLOCK;
+    struct hlc_index_entry skey(rhlc, 0);
+    auto key = this->hidx.upper_bound(skey);
+    if(key != this->hidx.begin() && this->hidx.size() > 0) {
+        key--;
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            l_idx = key->log_idx;
+        }
+    }
+    FPL_UNLOCK;
+
+    return l_idx;
+}
+
+int64_t FilePersistLog::getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false) {
+    FPL_RDLOCK;
+    // data offsets only grow along the log, so the bytes from an entry to
+    // the end shrink as the entry moves up
+    int64_t low = META_HEADER->fields.head;
+    int64_t high = META_HEADER->fields.tail;
+    if(low < high) {
+        const uint64_t end_ofst = LOG_ENTRY_AT(high - 1)->fields.ofst + LOG_ENTRY_AT(high - 1)->fields.dlen;
+        while(low < high) {
+            const int64_t mid = low + (high - low) / 2;
+            if(end_ofst - LOG_ENTRY_AT(mid)->fields.ofst <= max_bytes) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+    }
+    FPL_UNLOCK;
+
+    return low;
+}
+
+std::vector<int64_t> FilePersistLog::getEntryIndices(const HLC &from, const HLC &to) noexcept(false) {
+    this->loadHidx();
+    std::vector<int64_t> indices;
+
+    FPL_RDLOCK;
+    auto first = this->hidx.lower_bound(hlc_index_entry(from, 0));
+    auto last = this->hidx.upper_bound(hlc_index_entry(to, 0));
+    for(auto key = first; key < last; key++) {
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            indices.push_back(key->log_idx);
+        }
+    }
+    FPL_UNLOCK;
+
+    return indices;
+}
+
+void FilePersistLog::loadHidx() noexcept(false) {
+    if(this->m_bHidxLoaded.load(std::memory_order_acquire)) {
+        return;
+    }
+    FPL_WRLOCK;
+    if(!this->m_bHidxLoaded.load(std::memory_order_relaxed)) {
+        dbg_trace("{0}:building the hlc index of {1} entries.", this->m_sName, NUM_USED_SLOTS);
+        this->hidx.clear();
+        this->hidx.reserve(NUM_USED_SLOTS);
+        for(int64_t idx = META_HEADER->fields.head; idx < META_HEADER->fields.tail; idx++) {
+            this->hidx.insert(hlc_index_entry{LOG_ENTRY_AT(idx)->fields.hlc_r, LOG_ENTRY_AT(idx)->fields.hlc_l, idx});
+        }
+        this->m_bHidxLoaded.store(true, std::memory_order_release);
+    }
+    FPL_UNLOCK;
 }
 
 // trim by index
@@ -559,7 +796,9 @@ void FilePersistLog::trimByIndex(const int64_t &idx) noexcept(false) {
         FPL_PERS_UNLOCK;
         return;
     }
+    FPL_SEQ_WRITE_BEGIN;
     META_HEADER->fields.head = idx + 1;
+    FPL_SEQ_WRITE_END;
     try {
         persist(true);
     } catch(uint64_t e) {
@@ -567,8 +806,9 @@ void FilePersistLog::trimByIndex(const int64_t &idx) noexcept(false) {
         FPL_PERS_UNLOCK;
         throw e;
     }
-    //TODO: remove entry from index...this is tricky because HLC
-    // order does not agree with index order.
+    if(this->m_bHidxLoaded.load(std::memory_order_relaxed)) {
+        this->hidx.trim(META_HEADER->fields.head);
+    }
     FPL_UNLOCK;
     FPL_PERS_UNLOCK;
     // throw PERSIST_EXP_UNIMPLEMENTED;
@@ -595,6 +835,12 @@ void FilePersistLog::trim(const HLC &hlc) noexcept(false) {
     dbg_trace("{0} trim at time: {1}.{2}...done", this->m_sName, hlc.m_rtc_us, hlc.m_logic);
 }
 
+void FilePersistLog::syncRange(void *start, size_t len) noexcept(false) {
+    if(msync(start, len, MS_SYNC) != 0) {
+        throw PERSIST_EXP_MSYNC(errno);
+    }
+}
+
 void FilePersistLog::persistMetaHeaderAtomically(MetaHeader *pShadowHeader) noexcept(false) {
     // STEP 1: get file name
     const string swpFile = this->m_sMetaFile + "." + SWAP_FILE_SUFFIX;
@@ -671,7 +917,7 @@ int64_t FilePersistLog::getMinimumIndexBeyondVersion(const int64_t &ver) noexcep
 // 1) size_t byteSizeOfLogEntry(const LogEntry * ple);
 // 2) size_t writeLogEntryToByteArray(const LogEntry * ple, char * ba);
 // 3) size_t postLogEntry(const std::function<void (char const *const, std::size_t)> f, const LogEntry *ple);
-// 4) size_t mergeLogEntryFromByteArray(const char * ba);
+// 4) size_t mergeLogEntriesFromByteArray(const char * ba, int64_t nr_log_entry);
 size_t FilePersistLog::bytes_size(const int64_t &ver) noexcept(false) {
     size_t bsize = (sizeof(int64_t) + sizeof(int64_t));
     int64_t idx = this->getMinimumIndexBeyondVersion(ver);
@@ -731,11 +977,11 @@ void FilePersistLog::applyLogTail(char const *v) noexcept(false) {
     int64_t nr_log_entry = *(const int64_t *)(v + ofst);
     ofst += sizeof(int64_t);
     // log_entries
-    while(nr_log_entry--) {
-        ofst += mergeLogEntryFromByteArray(v + ofst);
-    }
+    ofst += mergeLogEntriesFromByteArray(v + ofst, nr_log_entry);
     // update the latest version.
+    FPL_SEQ_WRITE_BEGIN;
     META_HEADER->fields.ver = latest_version;
+    FPL_SEQ_WRITE_END;
 }
 
 size_t FilePersistLog::byteSizeOfLogEntry(const LogEntry *ple) noexcept(false) {
@@ -764,32 +1010,121 @@ size_t FilePersistLog::postLogEntry(const std::function<void(char const *const,
     return nr_written;
 }
 
-size_t FilePersistLog::mergeLogEntryFromByteArray(const char *ba) noexcept(false) {
-    const LogEntry *cple = (const LogEntry *)ba;
-    // valid check
-    // 0) version grows monotonically.
-    if(cple->fields.ver <= META_HEADER->fields.ver) {
-        dbg_trace("{0} skip log entry version {1}, we are at {2}.", __func__, cple->fields.ver, META_HEADER->fields.ver);
-        return cple->fields.dlen + sizeof(LogEntry);
+size_t FilePersistLog::mergeLogEntriesFromByteArray(const char *ba, int64_t nr_log_entry) noexcept(false) {
+    // 1) validate the whole range before changing anything: find the entries
+    // to merge, whose versions grow monotonically past ours, and the space
+    // they need
+    int64_t last_ver = META_HEADER->fields.ver;
+    int64_t nr_merge = 0;
+    uint64_t merge_dlen = 0;
+    size_t ofst = 0;
+    for(int64_t i = 0; i < nr_log_entry; i++) {
+        const LogEntry *cple = (const LogEntry *)(ba + ofst);
+        if(cple->fields.ver <= last_ver) {
+            dbg_trace("{0} skip log entry version {1}, we are at {2}.", __func__, cple->fields.ver, last_ver);
+        } else {
+            last_ver = cple->fields.ver;
+            nr_merge++;
+            merge_dlen += cple->fields.dlen;
+        }
+        ofst += sizeof(LogEntry) + cple->fields.dlen;
+    }
+    if(nr_merge == 0) {
+        return ofst;
     }
-    // 1) do we have space to merge it?
-    if(NUM_FREE_SLOTS == 0) {
-        dbg_trace("{0} failed to merge log entry, we don't empty log entry.", __func__);
+    if(static_cast<int64_t>(NUM_FREE_SLOTS) < nr_merge) {
+        dbg_trace("{0} failed to merge {1} log entries, we have only {2} empty log entries.", __func__, nr_merge, NUM_FREE_SLOTS);
         throw PERSIST_EXP_NOSPACE_LOG;
     }
-    if(NUM_FREE_BYTES < cple->fields.dlen) {
-        dbg_trace("{0} failed to merge log entry, we need {1} bytes data space, but we have only {2} bytes.", __func__, cple->fields.dlen, NUM_FREE_BYTES);
+    if(NUM_FREE_BYTES < merge_dlen) {
+        dbg_trace("{0} failed to merge log entries, we need {1} bytes data space, but we have only {2} bytes.", __func__, merge_dlen, NUM_FREE_BYTES);
         throw PERSIST_EXP_NOSPACE_DATA;
     }
-    // 2) merge it!
-    memcpy(NEXT_DATA, (const void *)(ba + sizeof(LogEntry)), cple->fields.dlen);
-    memcpy(NEXT_LOG_ENTRY, cple, sizeof(LogEntry));
-    NEXT_LOG_ENTRY->fields.ofst = NEXT_DATA_OFST;
-    this->hidx.insert(hlc_index_entry{HLC{cple->fields.hlc_r, cple->fields.hlc_l}, META_HEADER->fields.tail});
-    META_HEADER->fields.tail++;
-    META_HEADER->fields.ver = cple->fields.ver;
-    dbg_trace("{0} merge log:log entry and meta data are updated.", __func__);
-    return cple->fields.dlen + sizeof(LogEntry);
+    // 2) merge them! The data of the merged entries is contiguous in the
+    // data buffer, which is mapped twice, so it never has to be split where
+    // the buffer wraps around.
+    const int64_t tail = META_HEADER->fields.tail;
+    uint64_t next_data_ofst = NEXT_DATA_OFST;
+    const bool hidx_loaded = this->m_bHidxLoaded.load(std::memory_order_relaxed);
+    if(hidx_loaded) {
+        this->hidx.reserve(this->hidx.size() + nr_merge);
+    }
+    last_ver = META_HEADER->fields.ver;
+    ofst = 0;
+    for(int64_t i = 0, merged = 0; i < nr_log_entry; i++) {
+        const LogEntry *cple = (const LogEntry *)(ba + ofst);
+        ofst += sizeof(LogEntry) + cple->fields.dlen;
+        if(cple->fields.ver <= last_ver) {
+            continue;
+        }
+        last_ver = cple->fields.ver;
+        LogEntry *ple = LOG_ENTRY_AT(tail + merged);
+        memcpy(ple, cple, sizeof(LogEntry));
+        ple->fields.ofst = next_data_ofst;
+        memcpy(LOG_ENTRY_DATA(ple), (const void *)(cple + 1), cple->fields.dlen);
+        next_data_ofst += cple->fields.dlen;
+        if(hidx_loaded) {
+            this->hidx.insert(hlc_index_entry{HLC{cple->fields.hlc_r, cple->fields.hlc_l}, tail + merged});
+        }
+        merged++;
+    }
+    FPL_SEQ_WRITE_BEGIN;
+    META_HEADER->fields.tail += nr_merge;
+    META_HEADER->fields.ver = last_ver;
+    FPL_SEQ_WRITE_END;
+    dbg_trace("{0} merge log: {1} log entries and meta data are updated.", __func__, nr_merge);
+    return ofst;
+}
+
+void FilePersistLog::setCodec(const LogCodec &codec) noexcept(false) {
+    if(codec != LOG_CODEC_NONE && codec != LOG_CODEC_LZ4) {
+        throw PERSIST_EXP_CODEC(codec);
+    }
+    FPL_WRLOCK;
+    this->m_codec = codec;
+    FPL_UNLOCK;
+}
+
+const void *FilePersistLog::getEntryData(const int64_t &idx) noexcept(false) {
+    const LogEntry entry = *LOG_ENTRY_AT(idx);
+    if(entry.fields.codec == LOG_CODEC_NONE) {
+        return LOG_ENTRY_DATA(&entry);
+    }
+    {
+        lock_guard<mutex> lck(this->m_decompressedMutex);
+        auto search = this->m_decompressed.find(idx);
+        if(search != this->m_decompressed.end()) {
+            if(search->second.ver == entry.fields.ver && search->second.ofst == entry.fields.ofst) {
+                this->m_decompressedLru.splice(this->m_decompressedLru.begin(), this->m_decompressedLru, search->second.lru_pos);
+                return search->second.data.get();
+            }
+            // the entry was truncated, and its slot reused
+            this->m_decompressedBytes -= search->second.size;
+            this->m_decompressedLru.erase(search->second.lru_pos);
+            this->m_decompressed.erase(search);
+        }
+    }
+    auto data = make_unique<char[]>(MAX(entry.fields.rlen, 1ul));
+    decompressData(entry.fields.codec, LOG_ENTRY_DATA(&entry), entry.fields.dlen, data.get(), entry.fields.rlen);
+
+    lock_guard<mutex> lck(this->m_decompressedMutex);
+    auto inserted = this->m_decompressed.emplace(idx, DecompressedEntry{std::move(data), entry.fields.rlen, entry.fields.ver, entry.fields.ofst, this->m_decompressedLru.end()});
+    if(!inserted.second) {
+        // another thread has decompressed it in the meantime
+        this->m_decompressedLru.splice(this->m_decompressedLru.begin(), this->m_decompressedLru, inserted.first->second.lru_pos);
+        return inserted.first->second.data.get();
+    }
+    this->m_decompressedLru.push_front(idx);
+    inserted.first->second.lru_pos = this->m_decompressedLru.begin();
+    this->m_decompressedBytes += entry.fields.rlen;
+    // evict the least recently used entries, but not the one just added
+    while(this->m_decompressedBytes > this->m_decompressedCapacity && this->m_decompressedLru.size() > 1) {
+        auto victim = this->m_decompressed.find(this->m_decompressedLru.back());
+        this->m_decompressedBytes -= victim->second.size;
+        this->m_decompressed.erase(victim);
+        this->m_decompressedLru.pop_back();
+    }
+    return inserted.first->second.data.get();
 }
 //////////////////////////
 // invisible to outside //
@@ -841,12 +1176,12 @@ bool checkOrCreateMetaFile(const string &metaFile) noexcept(false) {
     return checkOrCreateFileWithSize(metaFile, META_SIZE);
 }
 
-bool checkOrCreateLogFile(const string &logFile) noexcept(false) {
-    return checkOrCreateFileWithSize(logFile, MAX_LOG_SIZE);
+bool checkOrCreateLogFile(const string &logFile, const uint64_t &size) noexcept(false) {
+    return checkOrCreateFileWithSize(logFile, size);
 }
 
-bool checkOrCreateDataFile(const string &dataFile) noexcept(false) {
-    return checkOrCreateFileWithSize(dataFile, MAX_DATA_SIZE);
+bool checkOrCreateDataFile(const string &dataFile, const uint64_t &size) noexcept(false) {
+    return checkOrCreateFileWithSize(dataFile, size);
 }
 
 void FilePersistLog::truncate(const int64_t &ver) noexcept(false) {
@@ -866,6 +1201,7 @@ void FilePersistLog::truncate(const int64_t &ver) noexcept(false) {
             ver, head, tail);
     dbg_trace("{0} - end binary search.", this->m_sName);
     // STEP 2: update META_HEADER
+    FPL_SEQ_WRITE_BEGIN;
     if(l_idx == -1) {  // not adequate log found. We need to remove all logs.
         // TODO: this may not be safe in case the log has been trimmed beyond 'ver' !!!
         META_HEADER->fields.tail = META_HEADER->fields.head;
@@ -875,6 +1211,10 @@ void FilePersistLog::truncate(const int64_t &ver) noexcept(false) {
     }
     if(META_HEADER->fields.ver > ver)
         META_HEADER->fields.ver = ver;
+    FPL_SEQ_WRITE_END;
+    if(this->m_bHidxLoaded.load(std::memory_order_relaxed)) {
+        this->hidx.truncate(META_HEADER->fields.tail);
+    }
     // STEP 3: update PERSISTENT STATE
     FPL_PERS_LOCK;
     try {
@@ -889,9 +1229,9 @@ void FilePersistLog::truncate(const int64_t &ver) noexcept(false) {
     dbg_trace("{0} truncate at version: {1}....done", this->m_sName, ver);
 }
 
-  const uint64_t FilePersistLog::getMinimumLatestPersistedVersion(const std::string & prefix) {
+  const uint64_t FilePersistLog::getMinimumLatestPersistedVersion(const std::string & prefix, const std::string & path) {
     // STEP 1: list all meta files in the path
-    DIR *dir = opendir(getPersFilePath().c_str());
+    DIR *dir = opendir(path.c_str());
     if (dir == NULL) {
       // We cannot open the persistent directory, so just return error.
       dbg_error("{}:{} failed to open the directory. errno={}, err={}.",
@@ -910,7 +1250,7 @@ void FilePersistLog::truncate(const int64_t &ver) noexcept(false) {
       ) {
         MetaHeader mh;
         char fn[1024];
-        sprintf(fn,"%s/%s",getPersFilePath().c_str(),dent->d_name);
+        sprintf(fn,"%s/%s",path.c_str(),dent->d_name);
         int fd = open(fn,O_RDONLY);
         if (fd < 0) {
           dbg_warn("{}:{} cannot read file:{}, errno={}, err={}.",
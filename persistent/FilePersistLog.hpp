@@ -3,8 +3,14 @@
 
 #include "PersistLog.hpp"
 #include "util.hpp"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <pthread.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace persistent {
 
@@ -36,18 +42,18 @@ typedef union log_entry {
         uint64_t ofst;   // offset of the data in the memory buffer
         uint64_t hlc_r;  // realtime component of hlc
         uint64_t hlc_l;  // logic component of hlc
+        uint64_t rlen;   // length of the data before compression
+        LogCodec codec;  // codec of the data
     } fields;
     uint8_t bytes[64];
 } LogEntry;
 
-// TODO: make this hard-wired number configurable.
-// Currently, we allow 1M(2^20-1) log entries and
-// 512GB data size.
-#define MAX_LOG_ENTRY ((uint64_t)(1UL << 20))
-// #define MAX_LOG_ENTRY         (1UL<<6)
+// The capacity of a log, set when it is loaded: PERS/max_log_entry entries
+// (of which one slot stays free) and PERS/max_data_size bytes of data by
+// default, or what its existing files were created with.
+#define MAX_LOG_ENTRY (this->m_uMaxLogEntry)
 #define MAX_LOG_SIZE (sizeof(LogEntry) * MAX_LOG_ENTRY)
-#define MAX_DATA_SIZE ((uint64_t)(1UL << 39))
-// #define MAX_DATA_SIZE         (1UL<<12)
+#define MAX_DATA_SIZE (this->m_uMaxDataSize)
 #define META_SIZE (sizeof(MetaHeader))
 
 // helpers:
@@ -61,7 +67,7 @@ typedef union log_entry {
 #define NUM_FREE_SLOTS (MAX_LOG_ENTRY - 1 - NUM_USED_SLOTS)
 // #define NUM_FREE_SLOTS_PERS   (MAX_LOG_ENTRY - 1 - NUM_USERD_SLOTS_PERS)
 
-#define LOG_ENTRY_AT(idx) (LOG_ENTRY_ARRAY + (int)((idx) % MAX_LOG_ENTRY))
+#define LOG_ENTRY_AT(idx) (LOG_ENTRY_ARRAY + (int64_t)((idx) % MAX_LOG_ENTRY))
 #define NEXT_LOG_ENTRY LOG_ENTRY_AT(META_HEADER->fields.tail)
 #define NEXT_LOG_ENTRY_PERS LOG_ENTRY_AT( \
         MAX(META_HEADER_PERS->fields.tail, META_HEADER->fields.head))
@@ -103,6 +109,10 @@ protected:
     // the data file descriptor
     int m_iDataFileDesc;
 
+    // the number of entries in the log ring
+    uint64_t m_uMaxLogEntry;
+    // the size of the data ring
+    uint64_t m_uMaxDataSize;
     // memory mapped Log RingBuffer
     void *m_pLog;
     // memory mapped Data RingBuffer
@@ -111,6 +121,52 @@ protected:
     pthread_rwlock_t m_rwlock;
     // persistent lock
     pthread_mutex_t m_perslock;
+    // size of the space handed out by reserve(), or -1 if there is none
+    int64_t m_iReservedSize = -1;
+    // data offset of the reserved space
+    uint64_t m_uReservedOfst = 0;
+    // sequence number of the meta header, odd while a writer changes it
+    std::atomic<uint64_t> m_uHeaderSeq{0};
+    // whether hidx holds the log; a loaded log only builds it on the first
+    // lookup by hlc, and until then the writers leave it alone
+    std::atomic<bool> m_bHidxLoaded{true};
+    // with a codec, reserve() hands out this buffer, which commit() compresses
+    // into the log
+    std::vector<char> m_reservedRaw;
+    // the codec when the space was reserved
+    LogCodec m_reservedCodec = LOG_CODEC_NONE;
+
+    struct DecompressedEntry {
+        std::unique_ptr<char[]> data;
+        uint64_t size;
+        // the entry it was decompressed from, since truncated slots are
+        // reused
+        int64_t ver;
+        uint64_t ofst;
+        // position in m_decompressedLru
+        std::list<int64_t>::iterator lru_pos;
+    };
+    // compressed entries read by getEntry*(), decompressed, by log index
+    std::unordered_map<int64_t, DecompressedEntry> m_decompressed;
+    // log indexes in m_decompressed, the most recently used first
+    std::list<int64_t> m_decompressedLru;
+    // the number of bytes in m_decompressed
+    uint64_t m_decompressedBytes = 0;
+    const uint64_t m_decompressedCapacity;
+    std::mutex m_decompressedMutex;
+
+    // the number of bytes of each ring to prepare ahead of the append cursor,
+    // or 0 to not prepare them
+    const uint64_t m_uPreallocSize;
+    // the stream offsets in the data and log rings up to which the
+    // preallocator has been asked to prepare space, and has prepared it
+    std::atomic<uint64_t> m_uPrepareDataTarget{0};
+    std::atomic<uint64_t> m_uPrepareLogTarget{0};
+    uint64_t m_uPreparedDataOfst = 0;
+    uint64_t m_uPreparedLogOfst = 0;
+    // cleared if the file system can't fallocate() the files
+    bool m_bCanFallocate = true;
+    friend class LogPreallocator;
 // lock macro
 #define FPL_WRLOCK                                        \
     do {                                                  \
@@ -136,6 +192,22 @@ protected:
         dbg_trace("FPL_UNLOCK");                          \
     } while(0)
 
+// Writers bracket their changes to the meta header with these, under
+// FPL_WRLOCK, so that readers can read it without the lock; see seqRead().
+#define FPL_SEQ_WRITE_BEGIN                                            \
+    do {                                                               \
+        this->m_uHeaderSeq.fetch_add(1, std::memory_order_relaxed);    \
+        std::atomic_thread_fence(std::memory_order_release);           \
+    } while(0)
+
+#define FPL_SEQ_WRITE_END                                              \
+    do {                                                               \
+        this->m_uHeaderSeq.fetch_add(1, std::memory_order_release);    \
+    } while(0)
+
+// the number of times a lock-free read is retried before it takes FPL_RDLOCK
+#define FPL_SEQ_READ_RETRIES (64)
+
 #define FPL_PERS_LOCK                                    \
     do {                                                 \
         if(pthread_mutex_lock(&this->m_perslock) != 0) { \
@@ -160,6 +232,19 @@ protected:
     // FPL_PERS_LOCK is acquired.
     virtual void persistMetaHeaderAtomically(MetaHeader *) noexcept(false);
 
+    // Make a range of the mapped log or data durable; page aligned.
+    virtual void syncRange(void *start, size_t len) noexcept(false);
+
+    // Called by commit() with FPL_WRLOCK held: asks the preallocator to
+    // prepare more space if the cursor is halfway through what it prepared.
+    void requestPreallocation() noexcept(true);
+    // Called on the preallocator's thread: allocates and faults in the space
+    // up to the targets.
+    void preallocate() noexcept(true);
+    // Allocates the blocks of stream offsets [from, to) of a ring in its file
+    // and faults in their pages.
+    void preallocateRange(int fd, void *ring, uint64_t ring_size, uint64_t from, uint64_t to) noexcept(true);
+
 public:
     //Constructor
     FilePersistLog(const std::string &name, const std::string &dataPath) noexcept(false);
@@ -171,6 +256,8 @@ public:
     virtual void append(const void *pdata,
                         const uint64_t &size, const int64_t &ver,
                         const HLC &mhlc) noexcept(false);
+    virtual void *reserve(const uint64_t &size) noexcept(false);
+    virtual void commit(const int64_t &ver, const HLC &mhlc) noexcept(false);
     virtual void advanceVersion(const int64_t &ver) noexcept(false);
     virtual int64_t getLength() noexcept(false);
     virtual int64_t getEarliestIndex() noexcept(false);
@@ -181,12 +268,17 @@ public:
     virtual const void *getEntryByIndex(const int64_t &eno) noexcept(false);
     virtual const void *getEntry(const int64_t &ver) noexcept(false);
     virtual const void *getEntry(const HLC &hlc) noexcept(false);
+    virtual int64_t getEntryIndex(const int64_t &ver) noexcept(false);
+    virtual int64_t getEntryIndex(const HLC &hlc) noexcept(false);
+    virtual int64_t getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false);
+    virtual std::vector<int64_t> getEntryIndices(const HLC &from, const HLC &to) noexcept(false);
     //virtual const __int128 persist(const __int128 & ver = -1) noexcept(false);
     virtual const int64_t persist(const bool preLocked = false) noexcept(false);
     virtual void trimByIndex(const int64_t &eno) noexcept(false);
     virtual void trim(const int64_t &ver) noexcept(false);
     virtual void trim(const HLC &hlc) noexcept(false);
     virtual void truncate(const int64_t &ver) noexcept(false);
+    virtual void setCodec(const LogCodec &codec) noexcept(false);
     virtual size_t bytes_size(const int64_t &ver) noexcept(false);
     virtual size_t to_bytes(char *buf, const int64_t &ver) noexcept(false);
     virtual void post_object(const std::function<void(char const *const, std::size_t)> &f,
@@ -211,7 +303,9 @@ public:
         FPL_WRLOCK;
         idx = binarySearch<TKey>(keyGetter, key, META_HEADER->fields.head, META_HEADER->fields.tail);
         if(idx != -1) {
+            FPL_SEQ_WRITE_BEGIN;
             META_HEADER->fields.head = (idx + 1);
+            FPL_SEQ_WRITE_END;
             FPL_PERS_LOCK;
             try {
                 persist(true);
@@ -221,9 +315,9 @@ public:
                 throw e;
             }
             FPL_PERS_UNLOCK;
-            //TODO:remove delete entries from the index. This is tricky because
-            // HLC order and idex order does not agree with each other.
-            // throw PERSIST_EXP_UNIMPLEMENTED;
+            if(this->m_bHidxLoaded.load(std::memory_order_relaxed)) {
+                this->hidx.trim(META_HEADER->fields.head);
+            }
         } else {
             FPL_UNLOCK;
             return;
@@ -236,9 +330,38 @@ public:
      * @PARAM prefix the subgroup/shard prefix
      * @RETURN the minimum latest persisted version
      */
-    static const uint64_t getMinimumLatestPersistedVersion(const std::string & prefix);
+    static const uint64_t getMinimumLatestPersistedVersion(const std::string & prefix,
+                                                           const std::string & path = getPersFilePath());
 
 private:
+    /**
+     * Run a read of the meta header and the log entries without FPL_RDLOCK.
+     * Entries between head and tail don't change, so a read only has to be
+     * retried if a writer changed the header while it ran, which
+     * m_uHeaderSeq tells. If writers keep getting in the way, the read is
+     * done under FPL_RDLOCK instead.
+     * The reader may see a torn header, so it must not throw or have side
+     * effects; it can only index the log ring through LOG_ENTRY_AT(), which
+     * stays inside the mapping.
+     */
+    template <typename Reader>
+    auto seqRead(const Reader &reader) noexcept(false) -> decltype(reader()) {
+        for(int retry = 0; retry < FPL_SEQ_READ_RETRIES; retry++) {
+            const uint64_t seq = this->m_uHeaderSeq.load(std::memory_order_acquire);
+            if(seq & 1) {
+                continue;
+            }
+            auto ret = reader();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(this->m_uHeaderSeq.load(std::memory_order_relaxed) == seq) {
+                return ret;
+            }
+        }
+        FPL_RDLOCK;
+        auto ret = reader();
+        FPL_UNLOCK;
+        return ret;
+    }
     /**
      * Get the minimum index greater than a given version
      * Note: no lock protected, use FPL_RDLOCK
@@ -247,6 +370,17 @@ private:
      *         that no log entry is available for the requested version.
      */
     int64_t getMinimumIndexBeyondVersion(const int64_t &ver) noexcept(false);
+    /**
+     * Build hidx from the log entries if it hasn't been built yet.
+     * Note: takes FPL_WRLOCK, so no lock may be held
+     */
+    void loadHidx() noexcept(false);
+    /**
+     * Return the data of an entry, decompressed if it is compressed.
+     * Note: no lock protected; idx must be between head and tail
+     * @PARAM idx - the log index of the entry
+     */
+    const void *getEntryData(const int64_t &idx) noexcept(false);
     /**
      * get the byte size of log entry
      * Note: no lock protected, use FPL_RDLOCK
@@ -270,12 +404,15 @@ private:
      */
     size_t postLogEntry(const std::function<void(char const *const, std::size_t)> &f, const LogEntry *ple) noexcept(false);
     /**
-     * merge the log entry to current state.
+     * merge a range of log entries to current state, skipping those whose
+     * versions we already have. The whole range is checked for space first,
+     * so either all of its new entries are merged or, on an exception, none.
      * Note: no lock protected, use FPL_WRLOCK
-     * @PARAM ba - serialize form of the entry
-     * @RETURN - number of size read from the entry.
+     * @PARAM ba - serialize form of the entries
+     * @PARAM nr_log_entry - number of entries in ba
+     * @RETURN - number of size read from the entries.
      */
-    size_t mergeLogEntryFromByteArray(const char *ba) noexcept(false);
+    size_t mergeLogEntriesFromByteArray(const char *ba, int64_t nr_log_entry) noexcept(false);
 
     /**
      * binary search through the log, return the maximum index of the entries
@@ -1,86 +1,191 @@
 #include "HLC.hpp"
+#include "conf/conf.hpp"
 #include <errno.h>
 #include <time.h>
 
-// return microsecond
-uint64_t read_rtc_us() noexcept(false) {
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+uint64_t read_system_rtc_ns() noexcept(false) {
     struct timespec tp;
     if(clock_gettime(CLOCK_REALTIME, &tp) != 0) {
         throw HLC_EXP_READ_RTC(errno);
     } else {
-        return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+        return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+    }
+}
+
+#if defined(__x86_64__)
+
+// Real time read from the TSC. The TSC rate is measured once against the
+// system clock; each thread then anchors the TSC to the system clock and
+// re-anchors it every TSC_ANCHOR_NS, so the rate's error can't build up.
+constexpr uint64_t TSC_ANCHOR_NS = 100000000;
+
+class TscClock {
+    double ticks_per_ns = 0;
+
+public:
+    TscClock() {
+        unsigned int eax, ebx, ecx, edx;
+        // Only an invariant TSC ticks at a constant rate across frequency changes and sleep states
+        if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+            return;
+        }
+        const uint64_t start_ns = read_system_rtc_ns();
+        const uint64_t start_tsc = __rdtsc();
+        const struct timespec calibration_time = {0, 50000000};
+        nanosleep(&calibration_time, nullptr);
+        const uint64_t end_tsc = __rdtsc();
+        const uint64_t end_ns = read_system_rtc_ns();
+        if(end_ns > start_ns) {
+            ticks_per_ns = (double)(end_tsc - start_tsc) / (end_ns - start_ns);
+        }
+    }
+
+    bool usable() const { return ticks_per_ns > 0; }
+
+    uint64_t read_ns() noexcept(false) {
+        thread_local uint64_t anchor_tsc = 0;
+        thread_local uint64_t anchor_ns = 0;
+        const uint64_t tsc = __rdtsc();
+        const uint64_t elapsed_ns = (uint64_t)((tsc - anchor_tsc) / ticks_per_ns);
+        if(anchor_tsc == 0 || tsc < anchor_tsc || elapsed_ns >= TSC_ANCHOR_NS) {
+            anchor_ns = read_system_rtc_ns();
+            anchor_tsc = __rdtsc();
+            return anchor_ns;
+        }
+        return anchor_ns + elapsed_ns;
     }
+};
+
+#endif
+
+typedef unsigned __int128 hlc_pair_t;
+
+inline hlc_pair_t make_pair(uint64_t rtc_us, uint64_t logic) {
+    return ((hlc_pair_t)logic << 64) | rtc_us;
+}
+
+// Replaces the (m_rtc_us, m_logic) pair at clock with desired if it still
+// holds expected; otherwise loads its current value into expected.
+inline bool compare_and_swap_pair(hlc_pair_t* clock, hlc_pair_t& expected, hlc_pair_t desired) {
+#if defined(__x86_64__)
+    // Without -mcx16 GCC would route a 16-byte CAS through libatomic
+    uint64_t expected_low = (uint64_t)expected;
+    uint64_t expected_high = (uint64_t)(expected >> 64);
+    bool swapped;
+    asm volatile("lock cmpxchg16b %1"
+                 : "=@ccz"(swapped), "+m"(*clock), "+a"(expected_low), "+d"(expected_high)
+                 : "b"((uint64_t)desired), "c"((uint64_t)(desired >> 64))
+                 : "memory");
+    expected = make_pair(expected_low, expected_high);
+    return swapped;
+#else
+    return __atomic_compare_exchange_n(clock, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+}  // namespace
+
+// return nanosecond
+uint64_t read_rtc_ns() noexcept(false) {
+#if defined(__x86_64__)
+    static const bool use_tsc = derecho::getConfBoolean(CONF_PERS_HLC_TSC_CLOCK);
+    if(use_tsc) {
+        static TscClock tsc_clock;
+        if(tsc_clock.usable()) {
+            return tsc_clock.read_ns();
+        }
+    }
+#endif
+    return read_system_rtc_ns();
+}
+
+// return microsecond
+uint64_t read_rtc_us() noexcept(false) {
+    return read_rtc_ns() / 1000;
 }
 
 HLC::HLC() noexcept(false) {
     this->m_rtc_us = read_rtc_us();
     this->m_logic = 0L;
-    if(pthread_spin_init(&this->m_oLck, PTHREAD_PROCESS_SHARED) != 0) {
-        throw HLC_EXP_SPIN_INIT(errno);
-    }
 }
 
 HLC::HLC(uint64_t _r, uint64_t _l) : m_rtc_us(_r), m_logic(_l) {
-    if(pthread_spin_init(&this->m_oLck, PTHREAD_PROCESS_SHARED) != 0) {
-        throw HLC_EXP_SPIN_INIT(errno);
-    }
 }
 
 HLC::~HLC() noexcept(false) {
-    if(pthread_spin_destroy(&this->m_oLck) != 0) {
-        throw HLC_EXP_SPIN_DESTROY(errno);
-    }
 }
 
-#define HLC_LOCK                                \
-    if(pthread_spin_lock(&this->m_oLck) != 0) { \
-        throw HLC_EXP_SPIN_LOCK(errno);         \
-    }
-#define HLC_UNLOCK                                \
-    if(pthread_spin_unlock(&this->m_oLck) != 0) { \
-        throw HLC_EXP_SPIN_UNLOCK(errno);         \
-    }
-
 void HLC::tick(bool thread_safe) noexcept(false) {
-    if(thread_safe) {
-        HLC_LOCK
-    }
-
     uint64_t rtc = read_rtc_us();
-    if(rtc <= this->m_rtc_us) {
-        this->m_logic++;
-    } else {
-        this->m_rtc_us = rtc;
-        this->m_logic = 0ull;
+    if(!thread_safe) {
+        if(rtc <= this->m_rtc_us) {
+            this->m_logic++;
+        } else {
+            this->m_rtc_us = rtc;
+            this->m_logic = 0ull;
+        }
+        return;
     }
 
-    if(thread_safe) {
-        HLC_UNLOCK
-    }
+    hlc_pair_t* clock = reinterpret_cast<hlc_pair_t*>(&this->m_rtc_us);
+    // A torn read here only makes the first compare-and-swap fail
+    hlc_pair_t current = make_pair(this->m_rtc_us, this->m_logic);
+    hlc_pair_t next;
+    do {
+        const uint64_t curr_rtc = (uint64_t)current;
+        const uint64_t curr_logic = (uint64_t)(current >> 64);
+        if(rtc <= curr_rtc) {
+            next = make_pair(curr_rtc, curr_logic + 1);
+        } else {
+            next = make_pair(rtc, 0ull);
+        }
+    } while(!compare_and_swap_pair(clock, current, next));
 }
 
 void HLC::tick(const HLC &msgHlc, bool thread_safe) noexcept(false) {
-    if(thread_safe) {
-        HLC_LOCK
-    }
-
     uint64_t rtc = read_rtc_us();
-    if((rtc > this->m_rtc_us) && (rtc > msgHlc.m_rtc_us)) {
-        // use rtc
-        this->m_rtc_us = rtc;
-        this->m_logic = 0ull;
-    } else if(*this >= msgHlc) {
-        // use this hlc
-        this->m_logic++;
-    } else {
-        // use msg hlc
-        this->m_rtc_us = msgHlc.m_rtc_us;
-        this->m_logic = msgHlc.m_logic + 1;
+    const uint64_t msg_rtc = msgHlc.m_rtc_us;
+    const uint64_t msg_logic = msgHlc.m_logic;
+    if(!thread_safe) {
+        if((rtc > this->m_rtc_us) && (rtc > msg_rtc)) {
+            // use rtc
+            this->m_rtc_us = rtc;
+            this->m_logic = 0ull;
+        } else if(*this >= HLC(msg_rtc, msg_logic)) {
+            // use this hlc
+            this->m_logic++;
+        } else {
+            // use msg hlc
+            this->m_rtc_us = msg_rtc;
+            this->m_logic = msg_logic + 1;
+        }
+        return;
     }
 
-    if(thread_safe) {
-        HLC_UNLOCK
-    }
+    hlc_pair_t* clock = reinterpret_cast<hlc_pair_t*>(&this->m_rtc_us);
+    hlc_pair_t current = make_pair(this->m_rtc_us, this->m_logic);
+    hlc_pair_t next;
+    do {
+        const uint64_t curr_rtc = (uint64_t)current;
+        const uint64_t curr_logic = (uint64_t)(current >> 64);
+        if((rtc > curr_rtc) && (rtc > msg_rtc)) {
+            // use rtc
+            next = make_pair(rtc, 0ull);
+        } else if(curr_rtc > msg_rtc || (curr_rtc == msg_rtc && curr_logic >= msg_logic)) {
+            // use this hlc
+            next = make_pair(curr_rtc, curr_logic + 1);
+        } else {
+            // use msg hlc
+            next = make_pair(msg_rtc, msg_logic + 1);
+        }
+    } while(!compare_and_swap_pair(clock, current, next));
 }
 
 bool HLC::operator>(const HLC &hlc) const
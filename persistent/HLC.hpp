@@ -1,16 +1,14 @@
 #ifndef HLC_HPP
 #define HLC_HPP
 #include <inttypes.h>
-#include <pthread.h>
 #include <sys/types.h>
 
 class HLC {
-private:
-    pthread_spinlock_t m_oLck;  // spinlock
-
 public:
-    uint64_t m_rtc_us;  // real-time clock in microseconds
-    uint64_t m_logic;   // logic clock
+    // The thread-safe ticks update the two clocks together with one 16-byte
+    // compare-and-swap, so they must stay adjacent, in this order.
+    alignas(16) uint64_t m_rtc_us;  // real-time clock in microseconds
+    uint64_t m_logic;               // logic clock
 
     // constructors
     HLC()
@@ -21,7 +19,7 @@ public:
     // destructors
     virtual ~HLC() noexcept(false);
 
-    // ticking method - thread safe
+    // ticking method - thread safe and lock-free unless thread_safe is false
     virtual void tick(bool thread_safe = true) noexcept(false);
     virtual void tick(const HLC& msgHlc, bool thread_safe = true) noexcept(false);
 
@@ -45,7 +43,9 @@ public:
 #define HLC_EXP_SPIN_LOCK(x) HLC_EXP(3, (x))
 #define HLC_EXP_SPIN_UNLOCK(x) HLC_EXP(4, (x))
 
-// read the rtc clock in microseconds
+// read the rtc clock in microseconds, from the TSC if PERS/hlc_tsc_clock is set
 uint64_t read_rtc_us() noexcept(false);
+// read the same clock in nanoseconds, e.g. to timestamp messages
+uint64_t read_rtc_ns() noexcept(false);
 
 #endif  //HLC_HPP
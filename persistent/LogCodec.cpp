@@ -0,0 +1,198 @@
+#include "LogCodec.hpp"
+#include "PersistException.hpp"
+#include <string.h>
+
+namespace persistent {
+
+/////////////////////////
+// internal structures //
+/////////////////////////
+
+// LZ4 block format: a sequence is a token, whose high and low nibbles are the
+// number of literals and the match length minus LZ4_MIN_MATCH (15 meaning
+// more length bytes follow), the literals, and a 2-byte little endian offset
+// back to the match. The last sequence has only literals.
+#define LZ4_MIN_MATCH (4)
+#define LZ4_MAX_OFFSET (65535)
+// the last match must start at least this far from the end of the input...
+#define LZ4_MF_LIMIT (12)
+// ...and end at least this far from it
+#define LZ4_LAST_LITERALS (5)
+#define LZ4_HASH_LOG (12)
+
+static uint64_t lz4Compress(const uint8_t *src, const uint64_t &size, uint8_t *dst, const uint64_t &capacity) noexcept(true);
+static bool lz4Decompress(const uint8_t *src, const uint64_t &size, uint8_t *dst, const uint64_t &raw_size) noexcept(true);
+
+////////////////////////
+// visible to outside //
+////////////////////////
+
+uint64_t compressData(const LogCodec &codec, const void *src, const uint64_t &size,
+                      void *dst, const uint64_t &capacity) noexcept(false) {
+    switch(codec) {
+        case LOG_CODEC_LZ4:
+            return lz4Compress((const uint8_t *)src, size, (uint8_t *)dst, capacity);
+        default:
+            throw PERSIST_EXP_CODEC(codec);
+    }
+}
+
+void decompressData(const LogCodec &codec, const void *src, const uint64_t &size,
+                    void *dst, const uint64_t &raw_size) noexcept(false) {
+    switch(codec) {
+        case LOG_CODEC_LZ4:
+            if(!lz4Decompress((const uint8_t *)src, size, (uint8_t *)dst, raw_size)) {
+                throw PERSIST_EXP_CODEC(codec);
+            }
+            break;
+        default:
+            throw PERSIST_EXP_CODEC(codec);
+    }
+}
+
+//////////////////////////
+// invisible to outside //
+//////////////////////////
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// write a length beyond the 15 that fits in a token
+static inline uint8_t *writeLength(uint8_t *op, uint64_t len) {
+    for(; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// write a sequence, or return nullptr if it doesn't fit before oend
+static uint8_t *writeSequence(uint8_t *op, uint8_t *oend, const uint8_t *literals, const uint64_t &nliterals,
+                              const uint64_t &offset, const uint64_t &match_len) {
+    // the token, the literals, their length bytes, the offset and the match
+    // length bytes, at most
+    const uint64_t worst = 1 + nliterals + nliterals / 255 + 1 + 2 + match_len / 255 + 1;
+    if((uint64_t)(oend - op) < worst) {
+        return nullptr;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((nliterals >= 15 ? 15 : nliterals) << 4);
+    if(nliterals >= 15) {
+        op = writeLength(op, nliterals - 15);
+    }
+    memcpy(op, literals, nliterals);
+    op += nliterals;
+    if(match_len == 0) {
+        return op;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    const uint64_t ml = match_len - LZ4_MIN_MATCH;
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if(ml >= 15) {
+        op = writeLength(op, ml - 15);
+    }
+    return op;
+}
+
+uint64_t lz4Compress(const uint8_t *src, const uint64_t &size, uint8_t *dst, const uint64_t &capacity) noexcept(true) {
+    // the positions of the last 4-byte sequences seen, plus one
+    uint64_t table[1 << LZ4_HASH_LOG] = {0};
+    uint8_t *op = dst;
+    uint8_t *const oend = dst + capacity;
+    uint64_t anchor = 0;
+
+    if(size > LZ4_MF_LIMIT) {
+        const uint64_t mf_limit = size - LZ4_MF_LIMIT;
+        const uint64_t match_limit = size - LZ4_LAST_LITERALS;
+        uint64_t ip = 0;
+        while(ip < mf_limit) {
+            const uint32_t seq = read32(src + ip);
+            const uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+            const uint64_t ref = table[h];
+            table[h] = ip + 1;
+            if(ref == 0 || ip - (ref - 1) > LZ4_MAX_OFFSET || read32(src + ref - 1) != seq) {
+                // skip faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            const uint64_t match = ref - 1;
+            uint64_t len = LZ4_MIN_MATCH;
+            while(ip + len < match_limit && src[match + len] == src[ip + len]) {
+                len++;
+            }
+            op = writeSequence(op, oend, src + anchor, ip - anchor, ip - match, len);
+            if(op == nullptr) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+    }
+    op = writeSequence(op, oend, src + anchor, size - anchor, 0, 0);
+    if(op == nullptr) {
+        return 0;
+    }
+    return (uint64_t)(op - dst);
+}
+
+// read a length beyond the 15 that fits in a token
+static inline bool readLength(const uint8_t *src, const uint64_t &size, uint64_t &ip, uint64_t &len) {
+    uint8_t b;
+    do {
+        if(ip >= size) {
+            return false;
+        }
+        b = src[ip++];
+        len += b;
+    } while(b == 255);
+    return true;
+}
+
+bool lz4Decompress(const uint8_t *src, const uint64_t &size, uint8_t *dst, const uint64_t &raw_size) noexcept(true) {
+    uint64_t ip = 0, op = 0;
+    while(ip < size) {
+        const uint8_t token = src[ip++];
+        uint64_t nliterals = token >> 4;
+        if(nliterals == 15 && !readLength(src, size, ip, nliterals)) {
+            return false;
+        }
+        if(nliterals > size - ip || nliterals > raw_size - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, nliterals);
+        ip += nliterals;
+        op += nliterals;
+        if(ip == size) {
+            // the last sequence
+            break;
+        }
+        if(size - ip < 2) {
+            return false;
+        }
+        const uint64_t offset = src[ip] | ((uint64_t)src[ip + 1] << 8);
+        ip += 2;
+        uint64_t len = token & 0xf;
+        if(len == 15 && !readLength(src, size, ip, len)) {
+            return false;
+        }
+        len += LZ4_MIN_MATCH;
+        if(offset == 0 || offset > op || len > raw_size - op) {
+            return false;
+        }
+        if(offset >= len) {
+            memcpy(dst + op, dst + op - offset, len);
+            op += len;
+        } else {
+            // the match overlaps what it produces
+            for(uint64_t i = 0; i < len; i++, op++) {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+    return op == raw_size;
+}
+}
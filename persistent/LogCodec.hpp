@@ -0,0 +1,42 @@
+#ifndef LOG_CODEC_HPP
+#define LOG_CODEC_HPP
+
+#include <inttypes.h>
+
+namespace persistent {
+
+// Codecs for the data of log entries. The codec of an entry is recorded in the
+// entry, so a log may hold entries written with different codecs.
+enum LogCodec : uint8_t {
+    LOG_CODEC_NONE = 0,
+    // the LZ4 block format
+    LOG_CODEC_LZ4 = 1
+};
+
+/**
+ * Compress data with a codec.
+ * @param codec - the codec; must not be LOG_CODEC_NONE
+ * @param src - the data
+ * @param size - length of the data
+ * @param dst - receives the compressed data
+ * @param capacity - the space at dst
+ * @return the length of the compressed data, or 0 if it would take more than
+ *         capacity bytes, in which case the data should be stored as it is.
+ */
+uint64_t compressData(const LogCodec &codec, const void *src, const uint64_t &size,
+                      void *dst, const uint64_t &capacity) noexcept(false);
+
+/**
+ * Decompress data compressed by compressData(). This throws
+ * PERSIST_EXP_CODEC if the data is corrupt or the codec is unknown.
+ * @param codec - the codec the data was compressed with
+ * @param src - the compressed data
+ * @param size - length of the compressed data
+ * @param dst - receives raw_size bytes of decompressed data
+ * @param raw_size - length of the data before it was compressed
+ */
+void decompressData(const LogCodec &codec, const void *src, const uint64_t &size,
+                    void *dst, const uint64_t &raw_size) noexcept(false);
+}
+
+#endif  //LOG_CODEC_HPP
@@ -0,0 +1,171 @@
+#ifndef MAPPED_ARRAY_HPP
+#define MAPPED_ARRAY_HPP
+
+#include "PersistException.hpp"
+#include "Persistent.hpp"
+#include <cstring>
+#include <memory>
+#include <sys/mman.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace persistent {
+
+/**
+ * A fixed-size array of Length trivially copyable elements, for large flat
+ * state such as a matrix, to be wrapped in a Persistent<T>. The elements live
+ * in an anonymous page-aligned mapping instead of on the heap, and the array
+ * tracks which pages have been written since the last version, so that
+ * Persistent<T> logs each version as those pages only (through IDeltaSupport)
+ * and not as a serialized copy of the whole array. Persisting a version then
+ * flushes only the log entry of the dirty pages.
+ *
+ * Writes go through modify() or set(), which mark the pages they touch as
+ * dirty; writing through the pointer of data() is not tracked. A page that
+ * is written several times between versions is logged once.
+ */
+template <typename T, std::size_t Length>
+class MappedArray : public mutils::ByteRepresentable, public IDeltaSupport {
+    static_assert(std::is_trivially_copyable<T>::value, "MappedArray elements must be trivially copyable");
+    static_assert(Length > 0, "MappedArray must not be empty");
+
+    static constexpr std::size_t data_size = sizeof(T) * Length;
+
+    struct unmapper {
+        std::size_t size;
+        void operator()(char *p) const {
+            munmap(p, size);
+        }
+    };
+    const std::size_t page_size;
+    const std::size_t num_pages;
+    std::unique_ptr<char, unmapper> region;
+    // a flag for each page, and the pages flagged, in the order they were
+    // first written since the last version
+    std::vector<bool> page_dirty;
+    std::vector<uint64_t> dirty_pages;
+    // reused by finalizeCurrentDelta(), so versions don't allocate
+    std::vector<char> delta_buffer;
+
+    void mark_dirty(std::size_t offset, std::size_t size) {
+        if(size == 0) {
+            return;
+        }
+        const std::size_t last_page = (offset + size - 1) / page_size;
+        for(std::size_t page = offset / page_size; page <= last_page; ++page) {
+            if(!page_dirty[page]) {
+                page_dirty[page] = true;
+                dirty_pages.push_back(page);
+            }
+        }
+    }
+    // the number of bytes of a page that belong to the array
+    std::size_t page_bytes(std::size_t page) const {
+        return std::min(page_size, data_size - page * page_size);
+    }
+
+public:
+    MappedArray()
+            : page_size(sysconf(_SC_PAGESIZE)),
+              num_pages((data_size + page_size - 1) / page_size),
+              region(nullptr, unmapper{num_pages * page_size}),
+              page_dirty(num_pages, false) {
+        void *p = mmap(nullptr, num_pages * page_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) {
+            throw PERSIST_EXP_MMAP_FILE(errno);
+        }
+        // anonymous pages start out zeroed
+        region.reset(static_cast<char *>(p));
+    }
+    MappedArray(const MappedArray &) = delete;
+    MappedArray &operator=(const MappedArray &) = delete;
+
+    static constexpr std::size_t size() {
+        return Length;
+    }
+    const T *data() const {
+        return reinterpret_cast<const T *>(region.get());
+    }
+    const T &operator[](std::size_t i) const {
+        return data()[i];
+    }
+    /**
+     * Returns a pointer through which elements first to first + count - 1
+     * may be written until the next version; their pages are logged with it.
+     */
+    T *modify(std::size_t first, std::size_t count) {
+        mark_dirty(first * sizeof(T), count * sizeof(T));
+        return reinterpret_cast<T *>(region.get()) + first;
+    }
+    void set(std::size_t i, const T &value) {
+        *modify(i, 1) = value;
+    }
+
+    // A delta is the number of pages, then for each its number and bytes
+    void finalizeCurrentDelta(const DeltaFinalizer &finalizer) override {
+        if(dirty_pages.empty()) {
+            return;
+        }
+        std::size_t delta_size = sizeof(uint64_t);
+        for(uint64_t page : dirty_pages) {
+            delta_size += sizeof(page) + page_bytes(page);
+        }
+        delta_buffer.resize(delta_size);
+        char *position = delta_buffer.data();
+        const uint64_t num_dirty = dirty_pages.size();
+        memcpy(position, &num_dirty, sizeof(num_dirty));
+        position += sizeof(num_dirty);
+        for(uint64_t page : dirty_pages) {
+            memcpy(position, &page, sizeof(page));
+            position += sizeof(page);
+            memcpy(position, region.get() + page * page_size, page_bytes(page));
+            position += page_bytes(page);
+            page_dirty[page] = false;
+        }
+        dirty_pages.clear();
+        finalizer(delta_buffer.data(), delta_size);
+    }
+
+    void applyDelta(char const *const delta) override {
+        uint64_t num_dirty;
+        memcpy(&num_dirty, delta, sizeof(num_dirty));
+        const char *position = delta + sizeof(num_dirty);
+        for(uint64_t i = 0; i < num_dirty; ++i) {
+            uint64_t page;
+            memcpy(&page, position, sizeof(page));
+            position += sizeof(page);
+            if(page >= num_pages) {
+                throw PERSIST_EXP_INV_ENTRY_IDX(page);
+            }
+            memcpy(region.get() + page * page_size, position, page_bytes(page));
+            position += page_bytes(page);
+        }
+    }
+
+    // A full copy is just the elements
+    std::size_t to_bytes(char *v) const {
+        memcpy(v, region.get(), data_size);
+        return data_size;
+    }
+    std::size_t bytes_size() const {
+        return data_size;
+    }
+    void post_object(const std::function<void(char const *const, std::size_t)> &f) const {
+        f(region.get(), data_size);
+    }
+    void ensure_registered(mutils::DeserializationManager &) {}
+    static std::unique_ptr<MappedArray> from_bytes(mutils::DeserializationManager *, const char *const v) {
+        auto array = std::make_unique<MappedArray>();
+        memcpy(array->region.get(), v, data_size);
+        return array;
+    }
+    static mutils::context_ptr<MappedArray> from_bytes_noalloc(mutils::DeserializationManager *dsm, const char *const v) {
+        return mutils::context_ptr<MappedArray>(from_bytes(dsm, v).release());
+    }
+};
+
+}  // namespace persistent
+
+#endif  // MAPPED_ARRAY_HPP
@@ -0,0 +1,474 @@
+#include "MemPersistLog.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+namespace persistent {
+
+/////////////////////////
+// internal structures //
+/////////////////////////
+
+// the entry at a log index, and its data
+///// READ or WRITE LOCK on LOG REQUIRED to use the following MACROs!!!!
+#define MPL_ENTRY_AT(idx) (&this->m_entries[(idx)-META_HEADER->fields.head])
+#define MPL_CURR_ENTRY MPL_ENTRY_AT(CURR_LOG_IDX)
+#define MPL_DATA_AT(ofst) (this->m_pData.get() + (ofst) % MAX_DATA_SIZE)
+#define MPL_ENTRY_DATA(e) MPL_DATA_AT((e)->fields.ofst)
+
+////////////////////////
+// visible to outside //
+////////////////////////
+
+MemPersistLog::MemPersistLog(const string &name) noexcept(false) : PersistLog(name),
+                                                                   m_uMaxLogEntry(getPersMaxLogEntry()),
+                                                                   m_uMaxDataSize(getPersMemLogSize()) {
+    if(MAX_LOG_ENTRY < 2 || MAX_DATA_SIZE == 0) {
+        dbg_error("{0}:log capacity of {1} entries and {2} bytes is too small.", this->m_sName, MAX_LOG_ENTRY, MAX_DATA_SIZE);
+        throw PERSIST_EXP_INV_CAPACITY;
+    }
+    // The pages of the ring are only touched as entries are appended
+    this->m_pData.reset(new(nothrow) char[MAX_DATA_SIZE]);
+    if(this->m_pData == nullptr) {
+        throw PERSIST_EXP_OOM(MAX_DATA_SIZE);
+    }
+    if(pthread_rwlock_init(&this->m_rwlock, NULL) != 0) {
+        throw PERSIST_EXP_RWLOCK_INIT(errno);
+    }
+    if(pthread_mutex_init(&this->m_perslock, NULL) != 0) {
+        throw PERSIST_EXP_MUTEX_INIT(errno);
+    }
+    META_HEADER->fields.head = 0ll;
+    META_HEADER->fields.tail = 0ll;
+    META_HEADER->fields.ver = INVALID_VERSION;
+    *META_HEADER_PERS = *META_HEADER;
+    dbg_trace("{0} constructor: {1} entries, {2} bytes", name, MAX_LOG_ENTRY, MAX_DATA_SIZE);
+}
+
+MemPersistLog::~MemPersistLog() noexcept(true) {
+    pthread_rwlock_destroy(&this->m_rwlock);
+    pthread_mutex_destroy(&this->m_perslock);
+}
+
+void MemPersistLog::append(const void *pdat, const uint64_t &size, const int64_t &ver, const HLC &mhlc) noexcept(false) {
+    dbg_trace("{0} append event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
+    memcpy(this->reserve(size), pdat, size);
+    this->commit(ver, mhlc);
+}
+
+void *MemPersistLog::reserve(const uint64_t &size) noexcept(false) {
+    dbg_trace("{0} reserve {1} bytes", this->m_sName, size);
+    FPL_WRLOCK;
+    if(size > MAX_DATA_SIZE) {
+        dbg_error("{0}-reserve exception no space for data: MAX_DATA_SIZE={1}, size={2}",
+                  this->m_sName, MAX_DATA_SIZE, size);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NOSPACE_DATA;
+    }
+    const uint64_t ofst = nextDataOfst(size);
+    overwriteOldest(ofst, size);
+    this->m_iReservedSize = (int64_t)size;
+    this->m_uReservedOfst = ofst;
+    this->m_iReservedTail = META_HEADER->fields.tail;
+    void *pdat = MPL_DATA_AT(ofst);
+    FPL_UNLOCK;
+    return pdat;
+}
+
+void MemPersistLog::commit(const int64_t &ver, const HLC &mhlc) noexcept(false) {
+    dbg_trace("{0} commit event ({1},{2})", this->m_sName, mhlc.m_rtc_us, mhlc.m_logic);
+    FPL_WRLOCK;
+    // A truncate() or applyLogTail() since reserve() moves the next entry
+    if(this->m_iReservedSize < 0 || this->m_iReservedTail != META_HEADER->fields.tail) {
+        dbg_error("{0}-commit exception no valid reservation!", this->m_sName);
+        dbg_flush();
+        this->m_iReservedSize = -1;
+        FPL_UNLOCK;
+        throw PERSIST_EXP_NO_RESERVATION;
+    }
+    if((CURR_LOG_IDX != -1) && (META_HEADER->fields.ver >= ver)) {
+        dbg_error("{0}-commit version already exists! cur_ver:{1} new_ver:{2}", this->m_sName,
+                  (int64_t)META_HEADER->fields.ver, (int64_t)ver);
+        dbg_flush();
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_VERSION;
+    }
+
+    // fill the log entry
+    LogEntry entry;
+    memset(&entry, 0, sizeof(LogEntry));
+    entry.fields.ver = ver;
+    entry.fields.dlen = (uint64_t)this->m_iReservedSize;
+    entry.fields.ofst = this->m_uReservedOfst;
+    entry.fields.hlc_r = mhlc.m_rtc_us;
+    entry.fields.hlc_l = mhlc.m_logic;
+    this->m_entries.push_back(entry);
+    this->m_iReservedSize = -1;
+
+    // update meta header
+    this->hidx.insert(hlc_index_entry{mhlc, META_HEADER->fields.tail});
+    META_HEADER->fields.tail++;
+    META_HEADER->fields.ver = ver;
+    dbg_debug("{0} append a log ver:{1} hlc:({2},{3})", this->m_sName,
+              ver, mhlc.m_rtc_us, mhlc.m_logic);
+    FPL_UNLOCK;
+}
+
+void MemPersistLog::advanceVersion(const int64_t &ver) noexcept(false) {
+    FPL_WRLOCK;
+    if(META_HEADER->fields.ver < ver) {
+        META_HEADER->fields.ver = ver;
+    } else {
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_VERSION;
+    }
+    FPL_UNLOCK;
+}
+
+const int64_t MemPersistLog::persist(const bool preLocked) noexcept(false) {
+    int64_t ver_ret = INVALID_VERSION;
+    if(!preLocked) {
+        FPL_PERS_LOCK;
+        FPL_RDLOCK;
+    }
+    // the entries are already where they will be read from
+    if(CURR_LOG_IDX != -1) {
+        ver_ret = META_HEADER->fields.ver;
+    }
+    *META_HEADER_PERS = *META_HEADER;
+    if(!preLocked) {
+        FPL_UNLOCK;
+        FPL_PERS_UNLOCK;
+    }
+    return ver_ret;
+}
+
+int64_t MemPersistLog::getLength() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t len = NUM_USED_SLOTS;
+    FPL_UNLOCK;
+
+    return len;
+}
+
+int64_t MemPersistLog::getEarliestIndex() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t idx = (NUM_USED_SLOTS == 0) ? INVALID_INDEX : META_HEADER->fields.head;
+    FPL_UNLOCK;
+    return idx;
+}
+
+int64_t MemPersistLog::getLatestIndex() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t idx = CURR_LOG_IDX;
+    FPL_UNLOCK;
+    return idx;
+}
+
+int64_t MemPersistLog::getEarliestVersion() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t ver = (NUM_USED_SLOTS == 0) ? INVALID_VERSION : this->m_entries.front().fields.ver;
+    FPL_UNLOCK;
+    return ver;
+}
+
+int64_t MemPersistLog::getLatestVersion() noexcept(false) {
+    FPL_RDLOCK;
+    int64_t ver = (NUM_USED_SLOTS == 0) ? INVALID_VERSION : this->m_entries.back().fields.ver;
+    FPL_UNLOCK;
+    return ver;
+}
+
+const int64_t MemPersistLog::getLastPersisted() noexcept(false) {
+    int64_t last_persisted = INVALID_VERSION;
+    FPL_PERS_LOCK;
+
+    last_persisted = META_HEADER_PERS->fields.ver;
+
+    FPL_PERS_UNLOCK;
+    return last_persisted;
+}
+
+const void *MemPersistLog::getEntryByIndex(const int64_t &eidx) noexcept(false) {
+    FPL_RDLOCK;
+    dbg_trace("{0}-getEntryByIndex-head:{1},tail:{2},eidx:{3}",
+              this->m_sName, META_HEADER->fields.head, META_HEADER->fields.tail, eidx);
+
+    int64_t ridx = (eidx < 0) ? (META_HEADER->fields.tail + eidx) : eidx;
+
+    if(META_HEADER->fields.tail <= ridx || ridx < META_HEADER->fields.head) {
+        FPL_UNLOCK;
+        throw PERSIST_EXP_INV_ENTRY_IDX(eidx);
+    }
+    const void *pdat = MPL_ENTRY_DATA(MPL_ENTRY_AT(ridx));
+    FPL_UNLOCK;
+
+    return pdat;
+}
+
+const void *MemPersistLog::getEntry(const int64_t &ver) noexcept(false) {
+    const void *pdat = nullptr;
+    FPL_RDLOCK;
+    int64_t l_idx = searchVersion(ver);
+    // no object exists before the requested version.
+    if(l_idx != -1) {
+        pdat = MPL_ENTRY_DATA(MPL_ENTRY_AT(l_idx));
+    }
+    FPL_UNLOCK;
+
+    return pdat;
+}
+
+const void *MemPersistLog::getEntry(const HLC &rhlc) noexcept(false) {
+    int64_t l_idx = this->getEntryIndex(rhlc);
+    // no object exists before the requested timestamp.
+    if(l_idx == -1) {
+        return nullptr;
+    }
+    return this->getEntryByIndex(l_idx);
+}
+
+int64_t MemPersistLog::getEntryIndex(const int64_t &ver) noexcept(false) {
+    FPL_RDLOCK;
+    int64_t l_idx = searchVersion(ver);
+    FPL_UNLOCK;
+
+    return l_idx;
+}
+
+int64_t MemPersistLog::getEntryIndex(const HLC &rhlc) noexcept(false) {
+    int64_t l_idx = -1;
+
+    FPL_RDLOCK;
+    struct hlc_index_entry skey(rhlc, 0);
+    auto key = this->hidx.upper_bound(skey);
+    if(key != this->hidx.begin() && this->hidx.size() > 0) {
+        key--;
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            l_idx = key->log_idx;
+        }
+    }
+    FPL_UNLOCK;
+
+    return l_idx;
+}
+
+int64_t MemPersistLog::getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false) {
+    FPL_RDLOCK;
+    // data offsets only grow along the log, so the bytes from an entry to
+    // the end shrink as the entry moves up
+    int64_t low = META_HEADER->fields.head;
+    int64_t high = META_HEADER->fields.tail;
+    if(low < high) {
+        const uint64_t end_ofst = MPL_ENTRY_AT(high - 1)->fields.ofst + MPL_ENTRY_AT(high - 1)->fields.dlen;
+        while(low < high) {
+            const int64_t mid = low + (high - low) / 2;
+            if(end_ofst - MPL_ENTRY_AT(mid)->fields.ofst <= max_bytes) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+    }
+    FPL_UNLOCK;
+
+    return low;
+}
+
+std::vector<int64_t> MemPersistLog::getEntryIndices(const HLC &from, const HLC &to) noexcept(false) {
+    std::vector<int64_t> indices;
+
+    FPL_RDLOCK;
+    auto first = this->hidx.lower_bound(hlc_index_entry(from, 0));
+    auto last = this->hidx.upper_bound(hlc_index_entry(to, 0));
+    for(auto key = first; key < last; key++) {
+        // the index may still hold some trimmed entries
+        if(key->log_idx >= META_HEADER->fields.head) {
+            indices.push_back(key->log_idx);
+        }
+    }
+    FPL_UNLOCK;
+
+    return indices;
+}
+
+// trim by index
+void MemPersistLog::trimByIndex(const int64_t &idx) noexcept(false) {
+    dbg_trace("{0} trim at index: {1}", this->m_sName, idx);
+    FPL_PERS_LOCK;
+    FPL_WRLOCK;
+    // validate check
+    if(idx < META_HEADER->fields.head || idx >= META_HEADER->fields.tail) {
+        FPL_UNLOCK;
+        FPL_PERS_UNLOCK;
+        return;
+    }
+    this->m_entries.erase(this->m_entries.begin(), this->m_entries.begin() + (idx + 1 - META_HEADER->fields.head));
+    META_HEADER->fields.head = idx + 1;
+    this->hidx.trim(META_HEADER->fields.head);
+    META_HEADER_PERS->fields.head = META_HEADER->fields.head;
+    FPL_UNLOCK;
+    FPL_PERS_UNLOCK;
+    dbg_trace("{0} trim at index: {1}...done", this->m_sName, idx);
+}
+
+void MemPersistLog::trim(const int64_t &ver) noexcept(false) {
+    dbg_trace("{0} trim at version: {1}", this->m_sName, ver);
+    int64_t idx = this->getEntryIndex(ver);
+    if(idx != -1) {
+        this->trimByIndex(idx);
+    }
+    dbg_trace("{0} trim at version: {1}...done", this->m_sName, ver);
+}
+
+void MemPersistLog::trim(const HLC &hlc) noexcept(false) {
+    //TODO: This is hard because HLC order does not agree with index order.
+    throw PERSIST_EXP_UNIMPLEMENTED;
+}
+
+void MemPersistLog::truncate(const int64_t &ver) noexcept(false) {
+    dbg_trace("{0} truncate at version: {1}.", this->m_sName, ver);
+    FPL_PERS_LOCK;
+    FPL_WRLOCK;
+    // STEP 1: search for the log entry
+    int64_t l_idx = searchVersion(ver);
+    // STEP 2: update META_HEADER
+    // if no adequate log is found, we remove all logs.
+    const int64_t tail = (l_idx == -1) ? META_HEADER->fields.head : l_idx + 1;
+    this->m_entries.erase(this->m_entries.begin() + (tail - META_HEADER->fields.head), this->m_entries.end());
+    META_HEADER->fields.tail = tail;
+    this->hidx.truncate(tail);
+    if(META_HEADER->fields.ver > ver)
+        META_HEADER->fields.ver = ver;
+    // STEP 3: update PERSISTENT STATE
+    persist(true);
+    FPL_UNLOCK;
+    FPL_PERS_UNLOCK;
+    dbg_trace("{0} truncate at version: {1}....done", this->m_sName, ver);
+}
+
+// The serialized log format is the same as FilePersistLog's:
+// [latest_version(int64_t)][nr_log_entry(int64_t)][log_enty1][log_entry2]...
+// where each entry is a LogEntry followed by its data.
+size_t MemPersistLog::bytes_size(const int64_t &ver) noexcept(false) {
+    size_t bsize = (sizeof(int64_t) + sizeof(int64_t));
+    FPL_RDLOCK;
+    for(int64_t idx = getMinimumIndexBeyondVersion(ver); idx < META_HEADER->fields.tail; idx++) {
+        bsize += sizeof(LogEntry) + MPL_ENTRY_AT(idx)->fields.dlen;
+    }
+    FPL_UNLOCK;
+    return bsize;
+}
+
+size_t MemPersistLog::to_bytes(char *buf, const int64_t &ver) noexcept(false) {
+    size_t ofst = 0;
+    this->post_object([&](char const *const data, std::size_t size) {
+        memcpy(buf + ofst, data, size);
+        ofst += size;
+    },
+                      ver);
+    return ofst;
+}
+
+void MemPersistLog::post_object(const std::function<void(char const *const, std::size_t)> &f,
+                                const int64_t &ver) noexcept(false) {
+    // the data is posted in place, so an append can't overwrite it meanwhile
+    FPL_RDLOCK;
+    try {
+        const int64_t first = getMinimumIndexBeyondVersion(ver);
+        // latest_version
+        int64_t latest_version = META_HEADER->fields.ver;
+        f((char *)&latest_version, sizeof(int64_t));
+        // nr_log_entry
+        int64_t nr_log_entry = META_HEADER->fields.tail - first;
+        f((char *)&nr_log_entry, sizeof(int64_t));
+        // log_entries
+        for(int64_t idx = first; idx < META_HEADER->fields.tail; idx++) {
+            const LogEntry *ple = MPL_ENTRY_AT(idx);
+            f((const char *)ple, sizeof(LogEntry));
+            if(ple->fields.dlen > 0) {
+                f(MPL_ENTRY_DATA(ple), ple->fields.dlen);
+            }
+        }
+    } catch(...) {
+        FPL_UNLOCK;
+        throw;
+    }
+    FPL_UNLOCK;
+}
+
+void MemPersistLog::applyLogTail(char const *v) noexcept(false) {
+    size_t ofst = 0;
+    // latest_version
+    int64_t latest_version = *(const int64_t *)(v + ofst);
+    ofst += sizeof(int64_t);
+    // nr_log_entry
+    int64_t nr_log_entry = *(const int64_t *)(v + ofst);
+    ofst += sizeof(int64_t);
+    // log_entries
+    while(nr_log_entry--) {
+        const LogEntry *cple = (const LogEntry *)(v + ofst);
+        ofst += sizeof(LogEntry);
+        // version grows monotonically.
+        FPL_RDLOCK;
+        const int64_t cur_ver = META_HEADER->fields.ver;
+        FPL_UNLOCK;
+        if(cple->fields.ver > cur_ver) {
+            memcpy(this->reserve(cple->fields.dlen), v + ofst, cple->fields.dlen);
+            this->commit(cple->fields.ver, HLC{cple->fields.hlc_r, cple->fields.hlc_l});
+        } else {
+            dbg_trace("{0} skip log entry version {1}.", __func__, cple->fields.ver);
+        }
+        ofst += cple->fields.dlen;
+    }
+    // update the latest version.
+    FPL_WRLOCK;
+    META_HEADER->fields.ver = latest_version;
+    FPL_UNLOCK;
+}
+
+int64_t MemPersistLog::searchVersion(const int64_t &ver) noexcept(false) {
+    auto itr = std::upper_bound(this->m_entries.cbegin(), this->m_entries.cend(), ver,
+                                [](const int64_t &v, const LogEntry &entry) {
+                                    return v < entry.fields.ver;
+                                });
+    if(itr == this->m_entries.cbegin()) {
+        return -1;
+    }
+    return META_HEADER->fields.head + (itr - this->m_entries.cbegin()) - 1;
+}
+
+uint64_t MemPersistLog::nextDataOfst(const uint64_t &size) noexcept(false) {
+    uint64_t ofst = (CURR_LOG_IDX == -1) ? 0 : (MPL_CURR_ENTRY->fields.ofst + MPL_CURR_ENTRY->fields.dlen);
+    // skip the rest of the ring rather than wrap around its end
+    if(ofst % MAX_DATA_SIZE + size > MAX_DATA_SIZE) {
+        ofst += MAX_DATA_SIZE - ofst % MAX_DATA_SIZE;
+    }
+    return ofst;
+}
+
+void MemPersistLog::overwriteOldest(const uint64_t &ofst, const uint64_t &size) noexcept(false) {
+    const int64_t head = META_HEADER->fields.head;
+    while(NUM_USED_SLOTS > 0
+          && (NUM_FREE_SLOTS < 1 || ofst + size - this->m_entries.front().fields.ofst > MAX_DATA_SIZE)) {
+        this->m_entries.pop_front();
+        META_HEADER->fields.head++;
+    }
+    if(META_HEADER->fields.head != head) {
+        dbg_debug("{0} overwrite {1} oldest entries", this->m_sName, META_HEADER->fields.head - head);
+        this->hidx.trim(META_HEADER->fields.head);
+    }
+}
+
+int64_t MemPersistLog::getMinimumIndexBeyondVersion(const int64_t &ver) noexcept(false) {
+    // INVALID_VERSION means all logs; searchVersion() returns -1 for it, as
+    // it does for versions earlier than the earliest log.
+    int64_t l_idx = (ver == INVALID_VERSION) ? -1 : searchVersion(ver);
+    return (l_idx == -1) ? META_HEADER->fields.head : l_idx + 1;
+}
+}
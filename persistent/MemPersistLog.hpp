@@ -0,0 +1,119 @@
+#ifndef MEM_PERSIST_LOG_HPP
+#define MEM_PERSIST_LOG_HPP
+
+#include "FilePersistLog.hpp"
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace persistent {
+
+/**
+ * MemPersistLog is the PersistLog of volatile (ST_MEM) fields. It keeps its
+ * log entries and a ring of data on the heap, so appending and persisting
+ * make no system calls; persist() only marks the entries as persisted. The
+ * data ring holds PERS/mem_log_size bytes, and the log at most
+ * PERS/max_log_entry entries. Instead of failing when the log is full, an
+ * append overwrites the oldest entries, as many as it needs the space of.
+ * The log starts out empty: nothing survives the process.
+ *
+ * The pointers returned by getEntry() and getEntryByIndex() stay valid until
+ * the entry is trimmed, truncated, or overwritten, so the data should be used
+ * (e.g. deserialized) right away. Entries are stored uncompressed; setCodec()
+ * has no effect.
+ */
+class MemPersistLog : public PersistLog {
+protected:
+    // the current meta header
+    MetaHeader m_currMetaHeader;
+    // the persisted meta header
+    MetaHeader m_persMetaHeader;
+
+    // the number of entries in the log, used by MAX_LOG_ENTRY
+    const uint64_t m_uMaxLogEntry;
+    // the size of the data ring, used by MAX_DATA_SIZE
+    const uint64_t m_uMaxDataSize;
+    // the data ring. An entry's data never wraps around its end, so it can
+    // be returned in place.
+    std::unique_ptr<char[]> m_pData;
+
+    // the log entries from head to tail
+    std::deque<LogEntry> m_entries;
+    // read/write lock, used by the FPL_* lock macros
+    pthread_rwlock_t m_rwlock;
+    // persistent lock
+    pthread_mutex_t m_perslock;
+
+    // size of the space handed out by reserve(), or -1 if there is none
+    int64_t m_iReservedSize = -1;
+    // data offset of the reserved space
+    uint64_t m_uReservedOfst = 0;
+    // the tail of the log when the space was reserved
+    int64_t m_iReservedTail = -1;
+
+public:
+    //Constructor
+    MemPersistLog(const std::string &name) noexcept(false);
+    //Destructor
+    virtual ~MemPersistLog() noexcept(true);
+
+    //Derived from PersistLog
+    virtual void append(const void *pdata,
+                        const uint64_t &size, const int64_t &ver,
+                        const HLC &mhlc) noexcept(false);
+    virtual void *reserve(const uint64_t &size) noexcept(false);
+    virtual void commit(const int64_t &ver, const HLC &mhlc) noexcept(false);
+    virtual void advanceVersion(const int64_t &ver) noexcept(false);
+    virtual int64_t getLength() noexcept(false);
+    virtual int64_t getEarliestIndex() noexcept(false);
+    virtual int64_t getLatestIndex() noexcept(false);
+    virtual int64_t getEarliestVersion() noexcept(false);
+    virtual int64_t getLatestVersion() noexcept(false);
+    virtual const int64_t getLastPersisted() noexcept(false);
+    virtual const void *getEntryByIndex(const int64_t &eno) noexcept(false);
+    virtual const void *getEntry(const int64_t &ver) noexcept(false);
+    virtual const void *getEntry(const HLC &hlc) noexcept(false);
+    virtual int64_t getEntryIndex(const int64_t &ver) noexcept(false);
+    virtual int64_t getEntryIndex(const HLC &hlc) noexcept(false);
+    virtual int64_t getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false);
+    virtual std::vector<int64_t> getEntryIndices(const HLC &from, const HLC &to) noexcept(false);
+    virtual const int64_t persist(const bool preLocked = false) noexcept(false);
+    virtual void trimByIndex(const int64_t &eno) noexcept(false);
+    virtual void trim(const int64_t &ver) noexcept(false);
+    virtual void trim(const HLC &hlc) noexcept(false);
+    virtual void truncate(const int64_t &ver) noexcept(false);
+    virtual size_t bytes_size(const int64_t &ver) noexcept(false);
+    virtual size_t to_bytes(char *buf, const int64_t &ver) noexcept(false);
+    virtual void post_object(const std::function<void(char const *const, std::size_t)> &f,
+                             const int64_t &ver) noexcept(false);
+    virtual void applyLogTail(char const *v) noexcept(false);
+
+private:
+    /**
+     * Find the maximum index of the entries whose version <= ver.
+     * Note: no lock protected, use FPL_RDLOCK
+     * @return index of the log entry found or -1 if not found.
+     */
+    int64_t searchVersion(const int64_t &ver) noexcept(false);
+    /**
+     * The data offset of the next entry of size bytes, moved to the start of
+     * the ring if the entry would wrap around its end.
+     * Note: no lock protected, use FPL_RDLOCK
+     */
+    uint64_t nextDataOfst(const uint64_t &size) noexcept(false);
+    /**
+     * Drop the oldest entries until an entry of size bytes at data offset
+     * ofst fits in the log.
+     * Note: no lock protected, use FPL_WRLOCK
+     */
+    void overwriteOldest(const uint64_t &ofst, const uint64_t &size) noexcept(false);
+    /**
+     * Get the index of the first entry newer than ver, or of the head if ver
+     * is INVALID_VERSION.
+     * Note: no lock protected, use FPL_RDLOCK
+     */
+    int64_t getMinimumIndexBeyondVersion(const int64_t &ver) noexcept(false);
+};
+}
+
+#endif  //MEM_PERSIST_LOG_HPP
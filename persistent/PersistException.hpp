@@ -44,6 +44,9 @@ namespace persistent {
 #define PERSIST_EXP_BEYOND_GSF PERSIST_EXP(31, 0)
 #define PERSIST_EXP_OOM(x) PERSIST_EXP(32, (x))
 #define PERSIST_EXP_INV_OBJNAME PERSIST_EXP(33, 0)
+#define PERSIST_EXP_NO_RESERVATION PERSIST_EXP(34, 0)
+#define PERSIST_EXP_INV_CAPACITY PERSIST_EXP(35, 0)
+#define PERSIST_EXP_CODEC(x) PERSIST_EXP(36, (x))
 }
 
 #endif  //PERSISTENT_EXCEPTION_HPP
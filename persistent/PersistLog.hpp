@@ -6,13 +6,16 @@
 #endif
 
 #include "HLC.hpp"
+#include "LogCodec.hpp"
 #include "PersistException.hpp"
+#include <algorithm>
 #include <functional>
 #include <inttypes.h>
 #include <map>
 #include <set>
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 namespace persistent {
 
@@ -20,7 +23,9 @@ namespace persistent {
 enum StorageType {
     ST_FILE = 0,
     ST_MEM,
-    ST_3DXP
+    ST_3DXP,
+    // file system, bypassing the page cache
+    ST_DIRECT
 };
 
 //#define INVALID_VERSION ((__int128)-1L)
@@ -52,13 +57,138 @@ struct hlc_index_entry_comp {
     }
 };
 
+/**
+ * The hlc index of a log: its entries sorted by hlc in a flat array. Entries
+ * are appended in hlc order almost always, so insert() just pushes them to the
+ * back, and only moves entries when an hlc arrives out of order. Like the
+ * std::set it replaces, it keeps one entry per hlc.
+ *
+ * Next to the entries it keeps a sparse index of millisecond buckets: for
+ * each millisecond of real time that has entries, the position of its first
+ * one. A lookup finds its millisecond among the buckets first and then only
+ * searches that millisecond's entries, so scans over many timestamps touch a
+ * few cache lines each instead of the whole array.
+ *
+ * trim() drops the entries at the front below the new head of the log; since
+ * the hlc order may not agree with the log order, some trimmed entries may be
+ * left after an out-of-order one, so lookups must still check the log index
+ * against the head of the log.
+ */
+class HLCIndex {
+private:
+    std::vector<hlc_index_entry> m_entries;
+    // the entries before m_entries[m_first] are trimmed
+    size_t m_first = 0;
+    // (millisecond, position in m_entries of its first entry), in order
+    std::vector<std::pair<uint64_t, size_t>> m_buckets;
+
+    static uint64_t bucket_of(const hlc_index_entry &e) {
+        return e.hlc.m_rtc_us / 1000;
+    }
+    void rebuild_buckets() {
+        m_buckets.clear();
+        for(size_t pos = 0; pos < m_entries.size(); pos++) {
+            if(m_buckets.empty() || m_buckets.back().first < bucket_of(m_entries[pos])) {
+                m_buckets.emplace_back(bucket_of(m_entries[pos]), pos);
+            }
+        }
+    }
+
+public:
+    typedef std::vector<hlc_index_entry>::const_iterator const_iterator;
+
+private:
+    // the untrimmed entries in e's millisecond: every entry before them has
+    // a smaller hlc than e, and every entry after them a greater one
+    std::pair<const_iterator, const_iterator> bucket_range(const hlc_index_entry &e) const {
+        const uint64_t bucket = bucket_of(e);
+        auto first_bucket = std::lower_bound(m_buckets.begin(), m_buckets.end(), bucket,
+                                             [](const std::pair<uint64_t, size_t> &b, const uint64_t &ms) { return b.first < ms; });
+        const size_t first = (first_bucket == m_buckets.end()) ? m_entries.size() : first_bucket->second;
+        size_t last = first;
+        if(first_bucket != m_buckets.end() && first_bucket->first == bucket) {
+            last = (first_bucket + 1 == m_buckets.end()) ? m_entries.size() : (first_bucket + 1)->second;
+        }
+        return {m_entries.cbegin() + std::max(first, m_first), m_entries.cbegin() + std::max(last, m_first)};
+    }
+
+public:
+
+    const_iterator begin() const {
+        return m_entries.cbegin() + m_first;
+    }
+    const_iterator end() const {
+        return m_entries.cend();
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+    size_t size() const {
+        return m_entries.size() - m_first;
+    }
+    void reserve(const size_t &n) {
+        m_entries.reserve(m_first + n);
+    }
+    void clear() {
+        m_entries.clear();
+        m_buckets.clear();
+        m_first = 0;
+    }
+    // the first entry whose hlc is not less than e's
+    const_iterator lower_bound(const hlc_index_entry &e) const {
+        auto range = bucket_range(e);
+        return std::lower_bound(range.first, range.second, e, hlc_index_entry_comp());
+    }
+    // the first entry whose hlc is greater than e's
+    const_iterator upper_bound(const hlc_index_entry &e) const {
+        auto range = bucket_range(e);
+        return std::upper_bound(range.first, range.second, e, hlc_index_entry_comp());
+    }
+    void insert(const hlc_index_entry &e) {
+        if(size() == 0 || m_entries.back().hlc < e.hlc) {
+            if(m_buckets.empty() || m_buckets.back().first < bucket_of(e)) {
+                m_buckets.emplace_back(bucket_of(e), m_entries.size());
+            }
+            m_entries.push_back(e);
+            return;
+        }
+        auto pos = std::lower_bound(m_entries.begin() + m_first, m_entries.end(), e, hlc_index_entry_comp());
+        if(pos == m_entries.end() || e.hlc < pos->hlc) {
+            m_entries.insert(pos, e);
+            rebuild_buckets();
+        }
+    }
+    // drop the entries from the front whose log index is below head
+    void trim(const int64_t &head) {
+        while(m_first < m_entries.size() && m_entries[m_first].log_idx < head) {
+            m_first++;
+        }
+        // reclaim the trimmed space once it is the larger part
+        if(m_first > 0 && m_first >= m_entries.size() / 2) {
+            m_entries.erase(m_entries.begin(), m_entries.begin() + m_first);
+            m_first = 0;
+            rebuild_buckets();
+        }
+    }
+    // drop the entries whose log index is tail or above
+    void truncate(const int64_t &tail) {
+        m_entries.erase(std::remove_if(m_entries.begin() + m_first, m_entries.end(),
+                                       [&tail](const hlc_index_entry &e) { return e.log_idx >= tail; }),
+                        m_entries.end());
+        rebuild_buckets();
+    }
+};
+
 // Persistent log interfaces
 class PersistLog {
 public:
     // LogName
     const std::string m_sName;
     // HLCIndex
-    std::set<hlc_index_entry, hlc_index_entry_comp> hidx;
+    HLCIndex hidx;
 #ifndef NDEBUG
     void dump_hidx();
 #endif  //NDEBUG
@@ -84,6 +214,23 @@ public:
                         const HLC &mhlc) noexcept(false)
             = 0;
 
+    /** Two-phase Append
+     * reserve() returns the space where the data of the next entry will be
+     * stored, so that the caller can serialize straight into the log instead
+     * of into a temporary buffer; commit() then appends the entry. Only the
+     * latest reservation can be committed, and one that is never committed
+     * is simply replaced by the next reserve() or append().
+     * @param size - length of the data to be written
+     * @return a pointer to size bytes of writable space
+     */
+    virtual void *reserve(const uint64_t &size) noexcept(false) = 0;
+
+    /**
+     * Append the data written to the reserved space as a new entry, with the
+     * same requirements on ver and mhlc as append().
+     */
+    virtual void commit(const int64_t &ver, const HLC &mhlc) noexcept(false) = 0;
+
     /**
      * Advance the version number without appendding a log. This is useful
      * to create gap between versions.
@@ -122,6 +269,21 @@ public:
     // Get a version specified by hlc
     virtual const void *getEntry(const HLC &hlc) noexcept(false) = 0;
 
+    // Get the index of the latest version equal or earlier than ver, or -1
+    // if there is none.
+    virtual int64_t getEntryIndex(const int64_t &ver) noexcept(false) = 0;
+
+    // Get the index of a version specified by hlc, or -1 if there is none.
+    virtual int64_t getEntryIndex(const HLC &hlc) noexcept(false) = 0;
+
+    // Get the earliest index from which the entries up to the latest hold at
+    // most max_bytes of data, or the tail if the latest one alone holds more.
+    virtual int64_t getEarliestIndexWithin(const uint64_t &max_bytes) noexcept(false) = 0;
+
+    // Get the indices of the versions whose hlc is in [from, to], in hlc
+    // order, which is almost always the log order.
+    virtual std::vector<int64_t> getEntryIndices(const HLC &from, const HLC &to) noexcept(false) = 0;
+
     /**
      * Persist the log till specified version
      * @return - the version till which has been persisted.
@@ -187,6 +349,23 @@ public:
      * @param ver - all log entry strict after ver will be truncated.
      */
     virtual void truncate(const int64_t &ver) noexcept(false) = 0;
+
+    /**
+     * Set the codec that compresses the data of the entries appended from
+     * now on. Entries record their codec, so entries written before keep
+     * theirs. Logs that don't support compression store data uncompressed.
+     * The getEntry*() methods return compressed entries decompressed into a
+     * cache of PERS/codec_cache_size bytes, where the data stays valid until
+     * it is evicted, so it should be used right away.
+     * @param codec - the codec, or LOG_CODEC_NONE not to compress
+     */
+    virtual void setCodec(const LogCodec &codec) noexcept(false) {
+        this->m_codec = codec;
+    }
+
+protected:
+    // the codec for new entries
+    LogCodec m_codec = LOG_CODEC_NONE;
 };
 }
 
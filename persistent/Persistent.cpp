@@ -13,7 +13,15 @@ DEFINE_PERSISTENT_REGISTRY_STATIC_MEMBERS;
     // In case we get a valid version from log stored in other storage type, we should return INVALID_VERSION for 1)
     // but return the valid version for 2).
     uint64_t mlpv = INVALID_VERSION;
-    mlpv = FilePersistLog::getMinimumLatestPersistedVersion(PersistentRegistry::generate_prefix(subgroup_type,subgroup_index,shard_num));
+    const std::string prefix = PersistentRegistry::generate_prefix(subgroup_type,subgroup_index,shard_num);
+    mlpv = FilePersistLog::getMinimumLatestPersistedVersion(prefix);
+    // ST_3DXP logs use the same meta header, possibly in another directory
+    if (getPersPmemPath() != getPersFilePath()) {
+      uint64_t pmem_mlpv = FilePersistLog::getMinimumLatestPersistedVersion(prefix,getPersPmemPath());
+      if (mlpv == (uint64_t)INVALID_VERSION || (pmem_mlpv != (uint64_t)INVALID_VERSION && (int64_t)pmem_mlpv < (int64_t)mlpv)) {
+        mlpv = pmem_mlpv;
+      }
+    }
     return mlpv;
   }
 }
@@ -2,23 +2,35 @@
 #ifndef PERSISTENT_HPP
 #define PERSISTENT_HPP
 
+#include "DirectPersistLog.hpp"
 #include "FilePersistLog.hpp"
 #include "HLC.hpp"
+#include "MemPersistLog.hpp"
 #include "PersistentTypenames.hpp"
 #include "PersistException.hpp"
 #include "PersistLog.hpp"
 #include "PersistNoLog.hpp"
+#include "PmemPersistLog.hpp"
 #include "SerializationSupport.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <functional>
+#include <future>
 #include <inttypes.h>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <pthread.h>
 #include <string>
 #include <sys/types.h>
 #include <time.h>
+#include <type_traits>
 #include <typeindex>
+#include <unordered_map>
+#include <vector>
 
 #if defined(_PERFORMANCE_DEBUG) || !defined(NDEBUG)
 #include "time.h"
@@ -93,13 +105,20 @@ std::pair<int_type, int_type> unpack_version(const version_t packed_int) {
    * - makeVersion(const int64_t & ver): create a version 
    * - persist(): persist the existing versions
    * - trim(const int64_t & ver): trim all versions earlier than ver
+   * - trimAsync(const int64_t & ver): have the next retain() do the trim
+   * - retain(const int64_t & ver): trim the versions up to ver beyond the
+   *   retention policy
    */
 class PersistentRegistry:public mutils::RemoteDeserializationContext{
 public:
     // TODO: take the subgroup_type,shubgroup_index,shard_num
     PersistentRegistry(ITemporalQueryFrontierProvider * tqfp, const std::type_index& subgroup_type, uint32_t subgroup_index, uint32_t shard_num):
         _subgroup_prefix(generate_prefix(subgroup_type,subgroup_index,shard_num)),
-        _temporal_query_frontier_provider(tqfp){
+        _temporal_query_frontier_provider(tqfp),
+        _parallel_persist(getPersParallelPersist()){
+        this->_retention_policy.max_versions = getPersRetentionMaxVersions();
+        this->_retention_policy.max_age_us = getPersRetentionMaxAgeUs();
+        this->_retention_policy.max_bytes = getPersRetentionMaxBytes();
     };
     virtual ~PersistentRegistry() {
         dbg_warn("PersistentRegistry@{} has been deallocated!", (void *)this);
@@ -110,14 +129,19 @@ public:
 #define TRIM_FUNC_IDX (2)
 #define GET_ML_PERSISTED_VER (3)
 #define TRUNCATE_FUNC_IDX (4)
+#define RETAIN_FUNC_IDX (5)
     /** Make a new version capturing the current state of the object. */
     void makeVersion(const int64_t &ver, const HLC &mhlc) noexcept(false) {
         callFunc<VERSION_FUNC_IDX>(ver, mhlc);
     };
 
-    /** (attempt to) Persist all existing versions
+    /** (attempt to) Persist all existing versions. With PERS/parallel_persist,
+     * the fields are persisted concurrently.
      * @return The newest version number that was actually persisted. */
     const int64_t persist() noexcept(false) {
+        if(this->_parallel_persist && this->_registry.size() > 1) {
+            return callFuncMinConcurrently<PERSIST_FUNC_IDX, int64_t>();
+        }
         return callFuncMin<PERSIST_FUNC_IDX, int64_t>();
     };
 
@@ -126,6 +150,20 @@ public:
         callFunc<TRIM_FUNC_IDX>(earliest_version);
     };
 
+    /**
+     * Asks for the logs to be trimmed like trim(), but only records the
+     * version and returns; the next retain(), which the persistence worker
+     * calls after each flush, does the trim. Of several requests made before
+     * then, the one with the newest version wins. Lets an RPC handler on the
+     * delivery thread trim without waiting for the logs' write locks.
+     */
+    void trimAsync(const int64_t &earliest_version) noexcept(true) {
+        int64_t pending = this->_pending_trim_version.load(std::memory_order_relaxed);
+        while(pending < earliest_version
+              && !this->_pending_trim_version.compare_exchange_weak(pending, earliest_version)) {
+        }
+    }
+
     /** Returns the minimum of the latest persisted versions among all Persistent fields. */
     const int64_t getMinimumLatestPersistedVersion() noexcept(false) {
         return callFuncMin<GET_ML_PERSISTED_VER, int64_t>();
@@ -161,6 +199,31 @@ public:
         callFunc<TRUNCATE_FUNC_IDX>(last_version);
     }
 
+    /** Sets the retention policy that retain() applies to every log */
+    void setRetentionPolicy(const RetentionPolicy &policy) noexcept(true) {
+        std::lock_guard<std::mutex> lock(_retention_policy_mutex);
+        this->_retention_policy = policy;
+    }
+
+    /** Does the trim requested by trimAsync(), if any, and then trims every
+     * log according to the retention policy, among the versions up to
+     * persisted_version. */
+    void retain(const int64_t &persisted_version) noexcept(false) {
+        const int64_t pending_trim = this->_pending_trim_version.exchange(INVALID_VERSION);
+        if(pending_trim != INVALID_VERSION) {
+            callFunc<TRIM_FUNC_IDX>(pending_trim);
+        }
+        RetentionPolicy policy;
+        {
+            std::lock_guard<std::mutex> lock(_retention_policy_mutex);
+            policy = this->_retention_policy;
+        }
+        if(policy.max_versions == 0 && policy.max_age_us == 0 && policy.max_bytes == 0) {
+            return;
+        }
+        callFunc<RETAIN_FUNC_IDX>(policy, persisted_version);
+    }
+
     // set the latest version for serialization
     // register a Persistent<T> along with its lambda
     void registerPersist(const char *obj_name,
@@ -168,15 +231,16 @@ public:
                          const PersistFunc &pf,
                          const TrimFunc &tf,
                          const LatestPersistedGetterFunc &lpgf,
-                         const TruncateFunc &tcf) noexcept(false) {
-        //this->_registry.push_back(std::make_tuple(vf,pf,tf));
-        auto tuple_val = std::make_tuple(vf, pf, tf, lpgf, tcf);
-        std::size_t key = std::hash<std::string>{}(obj_name);
-        auto res = this->_registry.insert(std::pair<std::size_t, std::tuple<VersionFunc, PersistFunc, TrimFunc, LatestPersistedGetterFunc, TruncateFunc>>(key, tuple_val));
-        if(res.second == false) {
+                         const TruncateFunc &tcf,
+                         const RetainFunc &rf) noexcept(false) {
+        RegistryEntry entry{std::hash<std::string>{}(obj_name), std::make_tuple(vf, pf, tf, lpgf, tcf, rf)};
+        auto pos = std::lower_bound(this->_registry.begin(), this->_registry.end(), entry.key,
+                                    [](const RegistryEntry &e, const std::size_t &key) { return e.key < key; });
+        if(pos != this->_registry.end() && pos->key == entry.key) {
             //override the previous value:
-            this->_registry.erase(res.first);
-            this->_registry.insert(std::pair<std::size_t, std::tuple<VersionFunc, PersistFunc, TrimFunc, LatestPersistedGetterFunc, TruncateFunc>>(key, tuple_val));
+            *pos = std::move(entry);
+        } else {
+            this->_registry.insert(pos, std::move(entry));
         }
     };
     // deregister
@@ -252,12 +316,24 @@ public:
 protected:
     const std::string _subgroup_prefix;  // this appears in the first part of storage file for persistent<T>
     ITemporalQueryFrontierProvider *_temporal_query_frontier_provider;
-    std::map<std::size_t, std::tuple<VersionFunc, PersistFunc, TrimFunc, LatestPersistedGetterFunc, TruncateFunc>> _registry;
+    RetentionPolicy _retention_policy;
+    std::mutex _retention_policy_mutex;
+    // whether persist() calls the fields' persist functions concurrently
+    const bool _parallel_persist;
+    // the newest version given to trimAsync() since the last retain()
+    std::atomic<int64_t> _pending_trim_version{INVALID_VERSION};
+    // the callbacks of a Persistent<T>, under the hash of its name
+    struct RegistryEntry {
+        std::size_t key;
+        std::tuple<VersionFunc, PersistFunc, TrimFunc, LatestPersistedGetterFunc, TruncateFunc, RetainFunc> funcs;
+    };
+    // the registered fields, sorted by key
+    std::vector<RegistryEntry> _registry;
     template <int funcIdx, typename... Args>
     void callFunc(Args... args) {
         for(auto itr = this->_registry.begin();
             itr != this->_registry.end(); ++itr) {
-            std::get<funcIdx>(itr->second)(args...);
+            std::get<funcIdx>(itr->funcs)(args...);
         }
     };
     template <int funcIdx, typename ReturnType, typename... Args>
@@ -265,7 +341,7 @@ protected:
         ReturnType min_ret = -1;  // -1 means invalid value.
         for(auto itr = this->_registry.begin();
             itr != this->_registry.end(); ++itr) {
-            ReturnType ret = std::get<funcIdx>(itr->second)(args...);
+            ReturnType ret = std::get<funcIdx>(itr->funcs)(args...);
             if(itr == this->_registry.begin()) {
                 min_ret = ret;
             } else if(min_ret > ret) {
@@ -274,11 +350,153 @@ protected:
         }
         return min_ret;
     }
+    // Like callFuncMin, but calls the first field's function on this thread
+    // and each of the others' on a thread of its own, then waits for them
+    // all. If any of them throws, the exception is rethrown after the others
+    // have returned. The registry must not be empty.
+    template <int funcIdx, typename ReturnType, typename... Args>
+    ReturnType callFuncMinConcurrently(Args... args) {
+        std::vector<std::future<ReturnType>> results;
+        results.reserve(this->_registry.size() - 1);
+        for(auto itr = std::next(this->_registry.begin());
+            itr != this->_registry.end(); ++itr) {
+            const auto &func = std::get<funcIdx>(itr->funcs);
+            results.emplace_back(std::async(std::launch::async, [&func, args...]() { return func(args...); }));
+        }
+        ReturnType min_ret = std::get<funcIdx>(this->_registry.front().funcs)(args...);
+        for(auto &result : results) {
+            min_ret = std::min(min_ret, result.get());
+        }
+        return min_ret;
+    }
     static thread_local int64_t earliest_version_to_serialize;
 };
 #define DEFINE_PERSISTENT_REGISTRY_STATIC_MEMBERS \
     thread_local int64_t PersistentRegistry::earliest_version_to_serialize = INVALID_VERSION;
 
+// A function that receives the bytes of a delta
+using DeltaFinalizer = std::function<void(char const *const, std::size_t)>;
+
+/**
+ * A wrapped type can implement IDeltaSupport to have Persistent<T> log each
+ * version as the changes made since the previous one, instead of a full
+ * serialized copy of the object. The first version in a log, and every
+ * PERS/delta_checkpoint_interval-th version after it, is still logged as a
+ * full copy, which bounds how many deltas have to be replayed to rebuild a
+ * version.
+ */
+class IDeltaSupport {
+public:
+    virtual ~IDeltaSupport() {}
+    /**
+     * Passes the changes made since the last call to the finalizer, as a
+     * buffer that can be given to applyDelta(), and starts recording anew.
+     * The finalizer doesn't have to be called if nothing changed.
+     */
+    virtual void finalizeCurrentDelta(const DeltaFinalizer &finalizer) = 0;
+    // Applies a delta produced by finalizeCurrentDelta() to this object.
+    virtual void applyDelta(char const *const delta) = 0;
+};
+
+// The first byte of each log entry of a type with IDeltaSupport
+enum DeltaLogEntryType : char {
+    DELTA_LOG_CHECKPOINT = 0,
+    DELTA_LOG_DELTA = 1
+};
+
+/**
+ * A version of a wrapped object as it is serialized in the log, for reading a
+ * few of its fields without deserializing the whole object. Nothing is
+ * decoded until field() or object() is called, and the bytes are only valid
+ * in the lambda it is passed to.
+ */
+template <typename ObjectType>
+class SerializedVersion {
+private:
+    char const *const m_pBytes;
+    mutils::DeserializationManager *const m_pDsm;
+
+public:
+    SerializedVersion(char const *const bytes, mutils::DeserializationManager *dm)
+            : m_pBytes(bytes), m_pDsm(dm) {}
+
+    // the serialized object
+    char const *bytes() const {
+        return m_pBytes;
+    }
+
+    // feed the user lambda the field serialized at offset bytes into the object
+    template <typename FieldType, typename Func>
+    auto field(const std::size_t &offset, const Func &fun) const {
+        return mutils::deserialize_and_run<FieldType>(m_pDsm, const_cast<char *>(m_pBytes + offset), fun);
+    }
+
+    // feed the user lambda the whole object
+    template <typename Func>
+    auto object(const Func &fun) const {
+        return mutils::deserialize_and_run<ObjectType>(m_pDsm, const_cast<char *>(m_pBytes), fun);
+    }
+};
+
+/**
+ * The decoded versions kept by Persistent<T>::getCached(), by log index, the
+ * least recently used evicted first once there are PERS/version_cache_size
+ * of them. Log indexes are only reused after a truncate, which clears it.
+ */
+template <typename ObjectType>
+class VersionCache {
+private:
+    struct CachedVersion {
+        std::shared_ptr<const ObjectType> object;
+        // position in m_lru
+        std::list<int64_t>::iterator lru_pos;
+    };
+    std::unordered_map<int64_t, CachedVersion> m_versions;
+    // log indexes in the cache, the most recently used first
+    std::list<int64_t> m_lru;
+    const uint64_t m_capacity;
+    std::mutex m_mutex;
+
+public:
+    VersionCache() : m_capacity(getPersVersionCacheSize()) {}
+
+    // the cached version at a log index, or nullptr
+    std::shared_ptr<const ObjectType> find(const int64_t &idx) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_versions.find(idx);
+        if(it == m_versions.end()) {
+            return nullptr;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru_pos);
+        return it->second.object;
+    }
+
+    // cache the version at a log index, unless another thread already did
+    std::shared_ptr<const ObjectType> insert(const int64_t &idx, std::shared_ptr<const ObjectType> object) {
+        if(m_capacity == 0) {
+            return object;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_versions.find(idx);
+        if(it != m_versions.end()) {
+            return it->second.object;
+        }
+        m_lru.push_front(idx);
+        m_versions.emplace(idx, CachedVersion{object, m_lru.begin()});
+        while(m_versions.size() > m_capacity) {
+            m_versions.erase(m_lru.back());
+            m_lru.pop_back();
+        }
+        return object;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_versions.clear();
+        m_lru.clear();
+    }
+};
+
 // Persistent represents a variable backed up by persistent storage. The
 // backend is PersistLog class. PersistLog handles only raw bytes and this
 // class is repsonsible for converting it back and forth between raw bytes
@@ -300,13 +518,16 @@ protected:
 //     'pdata' buffer.
 // - StorageType: storage type is defined in PersistLog. The value could be
 //   ST_FILE/ST_MEM/ST_3DXP ... I will start with ST_FILE and extend it to
-//   other persistent Storage.
+//   other persistent Storage. ST_DIRECT is like ST_FILE, but writes the log
+//   with direct I/O instead of through the page cache.
+//   ST_MEM keeps the log on the heap, see MemPersistLog.
 // TODO:comments
 //TODO: Persistent<T> has to be serializable, extending from mutils::ByteRepresentable
 template <typename ObjectType,
           StorageType storageType = ST_FILE>
 class Persistent : public mutils::ByteRepresentable {
 protected:
+    static constexpr bool has_delta_support = std::is_base_of<IDeltaSupport, ObjectType>::value;
     /** initialize from local state.
        *  @param object_name Object name
        */
@@ -323,13 +544,26 @@ protected:
                 break;
             // volatile
             case ST_MEM: {
-                // const std::string tmpfsPath = "/dev/shm/volatile_t";
-                this->m_pLog = std::make_unique<FilePersistLog>(object_name, getPersRamdiskPath());
+                this->m_pLog = std::make_unique<MemPersistLog>(object_name);
                 if(this->m_pLog == nullptr) {
                     throw PERSIST_EXP_NEW_FAILED_UNKNOWN;
                 }
                 break;
             }
+            // persistent memory
+            case ST_3DXP:
+                this->m_pLog = std::make_unique<PmemPersistLog>(object_name);
+                if(this->m_pLog == nullptr) {
+                    throw PERSIST_EXP_NEW_FAILED_UNKNOWN;
+                }
+                break;
+            // file system with direct I/O
+            case ST_DIRECT:
+                this->m_pLog = std::make_unique<DirectPersistLog>(object_name);
+                if(this->m_pLog == nullptr) {
+                    throw PERSIST_EXP_NEW_FAILED_UNKNOWN;
+                }
+                break;
             //default
             default:
                 throw PERSIST_EXP_STORAGE_TYPE_UNKNOWN(storageType);
@@ -355,7 +589,8 @@ protected:
                     std::bind(&Persistent<ObjectType, storageType>::persist, this),
                     std::bind(&Persistent<ObjectType, storageType>::trim<const int64_t>, this, std::placeholders::_1),  //trim by version:(const int64_t)
                     std::bind(&Persistent<ObjectType, storageType>::getLatestVersion, this),                            //get the latest persisted versions
-                    std::bind(&Persistent<ObjectType, storageType>::truncate, this, std::placeholders::_1)              // truncate persistent versions.
+                    std::bind(&Persistent<ObjectType, storageType>::truncate, this, std::placeholders::_1),             // truncate persistent versions.
+                    std::bind(&Persistent<ObjectType, storageType>::retain, this, std::placeholders::_1, std::placeholders::_2)  // trim by retention policy
                     );
         }
     }
@@ -370,14 +605,20 @@ public:
        * log and register itself to a persistent registry.
        * @param object_name This name is used for persistent data in file.
        * @param persistent_registry A normal pointer to the registry.
+       * @param codec The codec that compresses new versions in the log.
+       *        ST_DIRECT logs don't compress.
        */
     Persistent(
             const char * object_name = nullptr,
-            PersistentRegistry * persistent_registry = nullptr) // TODO: get the subgroup_type,subgroup_id,shard_num to intialize Persistent<T>
+            PersistentRegistry * persistent_registry = nullptr, // TODO: get the subgroup_type,subgroup_id,shard_num to intialize Persistent<T>
+            const LogCodec codec = LOG_CODEC_NONE)
             noexcept(false)
             : m_pRegistry(persistent_registry) {
         // Initialize log
-        initialize_log((object_name == nullptr) ? (*Persistent::getNameMaker().make(persistent_registry ? persistent_registry->get_subgroup_prefix() : nullptr)).c_str() : object_name);
+        initialize_log((object_name == nullptr) ? (*Persistent::getNameMaker(makerPrefix(persistent_registry)).make(persistent_registry ? persistent_registry->get_subgroup_prefix() : nullptr)).c_str() : object_name);
+        if(codec != LOG_CODEC_NONE) {
+            this->m_pLog->setCodec(codec);
+        }
         // Initialize object
         initialize_object_from_log();
         // Register Callbacks
@@ -520,14 +761,22 @@ public:
             int64_t idx,
             const Func &fun,
             mutils::DeserializationManager *dm = nullptr) noexcept(false) {
-        return mutils::deserialize_and_run<ObjectType>(dm, (char *)this->m_pLog->getEntryByIndex(idx), fun);
+        if constexpr(has_delta_support) {
+            return fun(*this->reconstructByIndex(idx, dm));
+        } else {
+            return mutils::deserialize_and_run<ObjectType>(dm, (char *)this->m_pLog->getEntryByIndex(idx), fun);
+        }
     };
 
     // get a version of value T. returns a unique pointer to the object
     std::unique_ptr<ObjectType> getByIndex(
             int64_t idx,
             mutils::DeserializationManager *dm = nullptr) noexcept(false) {
-        return mutils::from_bytes<ObjectType>(dm, (char const *)this->m_pLog->getEntryByIndex(idx));
+        if constexpr(has_delta_support) {
+            return this->reconstructByIndex(idx, dm);
+        } else {
+            return mutils::from_bytes<ObjectType>(dm, (char const *)this->m_pLog->getEntryByIndex(idx));
+        }
     };
 
     // get a version of Value T, specified by version. the user lambda will be fed with
@@ -539,11 +788,19 @@ public:
             const int64_t &ver,
             const Func &fun,
             mutils::DeserializationManager *dm = nullptr) noexcept(false) {
-        char *pdat = (char *)this->m_pLog->getEntry(ver);
-        if(pdat == nullptr) {
-            throw PERSIST_EXP_INV_VERSION;
+        if constexpr(has_delta_support) {
+            const int64_t idx = this->m_pLog->getEntryIndex(ver);
+            if(idx < 0) {
+                throw PERSIST_EXP_INV_VERSION;
+            }
+            return fun(*this->reconstructByIndex(idx, dm));
+        } else {
+            char *pdat = (char *)this->m_pLog->getEntry(ver);
+            if(pdat == nullptr) {
+                throw PERSIST_EXP_INV_VERSION;
+            }
+            return mutils::deserialize_and_run<ObjectType>(dm, pdat, fun);
         }
-        return mutils::deserialize_and_run<ObjectType>(dm, pdat, fun);
     };
 
     // get a version of value T. specified version.
@@ -551,6 +808,13 @@ public:
     std::unique_ptr<ObjectType> get(
             const int64_t &ver,
             mutils::DeserializationManager *dm = nullptr) noexcept(false) {
+        if constexpr(has_delta_support) {
+            const int64_t idx = this->m_pLog->getEntryIndex(ver);
+            if(idx < 0) {
+                throw PERSIST_EXP_INV_VERSION;
+            }
+            return this->reconstructByIndex(idx, dm);
+        }
         char const *pdat = (char const *)this->m_pLog->getEntry(ver);
         if(pdat == nullptr) {
             throw PERSIST_EXP_INV_VERSION;
@@ -559,19 +823,105 @@ public:
         return mutils::from_bytes<ObjectType>(dm, pdat);
     }
 
+    // get a version of value T, specified by version, without deserializing
+    // it: the user lambda will be fed with a SerializedVersion<T> over the
+    // log, to decode only the fields it reads.
+    // zerocopy: the view will not live once it returns.
+    // return value is decided by the user lambda.
+    template <typename Func>
+    auto getSerialized(
+            const int64_t &ver,
+            const Func &fun,
+            mutils::DeserializationManager *dm = nullptr) noexcept(false) {
+        static_assert(!has_delta_support, "A version logged as a delta has no serialized object to read");
+        char const *pdat = (char const *)this->m_pLog->getEntry(ver);
+        if(pdat == nullptr) {
+            throw PERSIST_EXP_INV_VERSION;
+        }
+        return fun(SerializedVersion<ObjectType>(pdat, dm));
+    }
+
+    // get a version of value T, specified by version, from a cache of the
+    // recently read versions, decoding it only if it isn't there.
+    // return a copy shared with the other readers of the version.
+    std::shared_ptr<const ObjectType> getCached(const int64_t &ver) noexcept(false) {
+        const int64_t idx = this->m_pLog->getEntryIndex(ver);
+        if(idx < 0) {
+            throw PERSIST_EXP_INV_VERSION;
+        }
+        if(std::shared_ptr<const ObjectType> cached = this->m_versionCache.find(idx)) {
+            return cached;
+        }
+        if constexpr(has_delta_support) {
+            return this->m_versionCache.insert(idx, this->reconstructByIndex(idx, nullptr));
+        } else {
+            return this->m_versionCache.insert(idx, mutils::from_bytes<ObjectType>(
+                                                            nullptr, (char const *)this->m_pLog->getEntryByIndex(idx)));
+        }
+    }
+
     template <typename TKey>
     void trim(const TKey &k) noexcept(false) {
         dbg_trace("trim.");
-        this->m_pLog->trim(k);
+        if constexpr(has_delta_support) {
+            // Keep the checkpoint that the remaining deltas apply to
+            const int64_t idx = this->m_pLog->getEntryIndex(k);
+            if(idx >= 0) {
+                int64_t first_kept = idx + 1;
+                if(first_kept <= this->m_pLog->getLatestIndex()) {
+                    first_kept = this->findCheckpointIndex(first_kept);
+                }
+                this->m_pLog->trimByIndex(first_kept - 1);
+            }
+        } else {
+            this->m_pLog->trim(k);
+        }
         dbg_trace("trim...done");
     }
 
+    // trim the persisted versions, up to persisted_version, that are beyond
+    // the limits of a retention policy; the latest version is always kept.
+    // Deltas keep the checkpoint they apply to, like trim() does.
+    void retain(const RetentionPolicy &policy, const int64_t &persisted_version) noexcept(false) {
+        if(this->getNumOfVersions() == 0) {
+            return;
+        }
+        const int64_t earliest = this->m_pLog->getEarliestIndex();
+        const int64_t latest = this->m_pLog->getLatestIndex();
+        int64_t first_kept = earliest;
+        if(policy.max_versions > 0) {
+            first_kept = std::max(first_kept, latest + 1 - static_cast<int64_t>(policy.max_versions));
+        }
+        if(policy.max_age_us > 0) {
+            const HLC now;
+            if(now.m_rtc_us > policy.max_age_us) {
+                first_kept = std::max(first_kept, this->m_pLog->getEntryIndex(HLC(now.m_rtc_us - policy.max_age_us, 0)) + 1);
+            }
+        }
+        if(policy.max_bytes > 0) {
+            first_kept = std::max(first_kept, this->m_pLog->getEarliestIndexWithin(policy.max_bytes));
+        }
+        first_kept = std::min({first_kept, latest, this->m_pLog->getEntryIndex(persisted_version) + 1});
+        if constexpr(has_delta_support) {
+            if(first_kept > earliest) {
+                first_kept = this->findCheckpointIndex(first_kept);
+            }
+        }
+        if(first_kept > earliest) {
+            dbg_trace("retain: trim {} up to index {}.", this->m_pLog->m_sName, first_kept - 1);
+            this->m_pLog->trimByIndex(first_kept - 1);
+        }
+    }
+
     // truncate the log
     // @param ver: all versions strictly newer than 'ver' will be truncated.
     //
     void truncate(const int64_t &ver) {
         dbg_trace("truncate.");
         this->m_pLog->truncate(ver);
+        this->m_iDeltasSinceCheckpoint = -1;
+        // the indexes of the truncated versions will be reused
+        this->m_versionCache.clear();
         dbg_trace("truncate...done");
     }
 
@@ -588,11 +938,19 @@ public:
         if(m_pRegistry != nullptr && m_pRegistry->getFrontier() <= hlc) {
             throw PERSIST_EXP_BEYOND_GSF;
         }
-        char *pdat = (char *)this->m_pLog->getEntry(hlc);
-        if(pdat == nullptr) {
-            throw PERSIST_EXP_INV_HLC;
+        if constexpr(has_delta_support) {
+            const int64_t idx = this->m_pLog->getEntryIndex(hlc);
+            if(idx < 0) {
+                throw PERSIST_EXP_INV_HLC;
+            }
+            return fun(*this->reconstructByIndex(idx, dm));
+        } else {
+            char *pdat = (char *)this->m_pLog->getEntry(hlc);
+            if(pdat == nullptr) {
+                throw PERSIST_EXP_INV_HLC;
+            }
+            return mutils::deserialize_and_run<ObjectType>(dm, pdat, fun);
         }
-        return mutils::deserialize_and_run<ObjectType>(dm, pdat, fun);
     };
 
     // get a version of value T. specified by HLC clock.
@@ -603,6 +961,13 @@ public:
         if(m_pRegistry != nullptr && m_pRegistry->getFrontier() <= hlc) {
             throw PERSIST_EXP_BEYOND_GSF;
         }
+        if constexpr(has_delta_support) {
+            const int64_t idx = this->m_pLog->getEntryIndex(hlc);
+            if(idx < 0) {
+                throw PERSIST_EXP_INV_HLC;
+            }
+            return this->reconstructByIndex(idx, dm);
+        }
         char const *pdat = (char const *)this->m_pLog->getEntry(hlc);
         if(pdat == nullptr) {
             throw PERSIST_EXP_INV_HLC;
@@ -611,6 +976,48 @@ public:
         return mutils::from_bytes<ObjectType>(dm, pdat);
     }
 
+    // feed the user lambda every version of T whose HLC clock is in [from, to],
+    // in HLC order. The versions are read one after the other from the log,
+    // and wrapped types with delta support apply each delta to the previous
+    // version instead of rebuilding every version from its checkpoint.
+    // zerocopy: each object will not live once the lambda returns.
+    template <typename Func>
+    void get_range(
+            const HLC &from,
+            const HLC &to,
+            const Func &fun,
+            mutils::DeserializationManager *dm = nullptr) noexcept(false) {
+        // global stability frontier test
+        if(m_pRegistry != nullptr && m_pRegistry->getFrontier() <= to) {
+            throw PERSIST_EXP_BEYOND_GSF;
+        }
+        const std::vector<int64_t> indices = this->m_pLog->getEntryIndices(from, to);
+        if constexpr(has_delta_support) {
+            std::unique_ptr<ObjectType> object;
+            int64_t object_idx = -1;
+            for(const int64_t idx : indices) {
+                if(object && idx > object_idx) {
+                    for(int64_t i = object_idx + 1; i <= idx; ++i) {
+                        char const *entry = (char const *)this->m_pLog->getEntryByIndex(i);
+                        if(*entry == DELTA_LOG_CHECKPOINT) {
+                            object = mutils::from_bytes<ObjectType>(dm, entry + 1);
+                        } else {
+                            object->applyDelta(entry + 1);
+                        }
+                    }
+                } else {
+                    object = this->reconstructByIndex(idx, dm);
+                }
+                object_idx = idx;
+                fun(*object);
+            }
+        } else {
+            for(const int64_t idx : indices) {
+                mutils::deserialize_and_run<ObjectType>(dm, (char *)this->m_pLog->getEntryByIndex(idx), fun);
+            }
+        }
+    }
+
     // syntax sugar: get a specified version of T without DSM
     /*
       std::unique_ptr<ObjectType> operator [](const int64_t idx)
@@ -657,12 +1064,19 @@ public:
     // make a version with version and mhlc clock
     virtual void set(const ObjectType &v, const int64_t &ver, const HLC &mhlc) noexcept(false) {
         dbg_trace("append to log with ver({}),hlc({},{})", ver, mhlc.m_rtc_us, mhlc.m_logic);
-        auto size = mutils::bytes_size(v);
-        char *buf = new char[size];
-        bzero(buf, size);
-        mutils::to_bytes(v, buf);
-        this->m_pLog->append((void *)buf, size, ver, mhlc);
-        delete buf;
+        // A full copy of a type with delta support is marked as a checkpoint
+        const std::size_t header_size = has_delta_support ? 1 : 0;
+        auto size = mutils::bytes_size(v) + header_size;
+        // serialize straight into the log
+        char *buf = (char *)this->m_pLog->reserve(size);
+        if constexpr(has_delta_support) {
+            buf[0] = DELTA_LOG_CHECKPOINT;
+        }
+        mutils::to_bytes(v, buf + header_size);
+        this->m_pLog->commit(ver, mhlc);
+        if constexpr(has_delta_support) {
+            this->m_iDeltasSinceCheckpoint = 0;
+        }
     };
 
     // make a version with version
@@ -685,7 +1099,37 @@ public:
     virtual void version(const int64_t &ver) noexcept(false) {
         //TODO: compare if value has been changed?
         dbg_trace("In Persistent<T>: make version {}.", ver);
-        this->set(*this->m_pWrappedObject, ver);
+        if constexpr(has_delta_support) {
+            if(this->m_iDeltasSinceCheckpoint < 0) {
+                this->m_iDeltasSinceCheckpoint = this->countDeltasSinceCheckpoint();
+            }
+            if(this->getNumOfVersions() == 0
+               || static_cast<uint64_t>(this->m_iDeltasSinceCheckpoint) + 1 >= getPersDeltaCheckpointInterval()) {
+                // The checkpoint already includes the pending changes
+                this->m_pWrappedObject->finalizeCurrentDelta([](char const *const, std::size_t) {});
+                this->set(*this->m_pWrappedObject, ver);
+                return;
+            }
+            HLC mhlc;
+            bool appended = false;
+            auto append_delta = [&](char const *const delta, std::size_t size) {
+                char *buf = (char *)this->m_pLog->reserve(size + 1);
+                buf[0] = DELTA_LOG_DELTA;
+                if(size > 0) {
+                    memcpy(buf + 1, delta, size);
+                }
+                this->m_pLog->commit(ver, mhlc);
+                appended = true;
+            };
+            this->m_pWrappedObject->finalizeCurrentDelta(append_delta);
+            if(!appended) {
+                // Every version needs an entry, even if nothing changed
+                append_delta(nullptr, 0);
+            }
+            this->m_iDeltasSinceCheckpoint++;
+        } else {
+            this->set(*this->m_pWrappedObject, ver);
+        }
     }
 
     /** persist till version
@@ -756,8 +1200,60 @@ protected:
     std::unique_ptr<PersistLog> m_pLog;
     // Persistence Registry
     PersistentRegistry *m_pRegistry;
+    // The number of deltas logged since the latest checkpoint, or -1 if it
+    // has to be counted again. Only used with IDeltaSupport.
+    int64_t m_iDeltasSinceCheckpoint = -1;
+    // Recently read versions, for getCached()
+    VersionCache<ObjectType> m_versionCache;
+
+    // Returns the index of the latest checkpoint at or before a log index.
+    int64_t findCheckpointIndex(int64_t idx) noexcept(false) {
+        const int64_t earliest = this->m_pLog->getEarliestIndex();
+        for(int64_t i = idx; i >= earliest; --i) {
+            if(*(char const *)this->m_pLog->getEntryByIndex(i) == DELTA_LOG_CHECKPOINT) {
+                return i;
+            }
+        }
+        // trim() always keeps a checkpoint, so the log must be damaged
+        throw PERSIST_EXP_INV_ENTRY_IDX(idx);
+    }
+
+    // Counts the deltas after the latest checkpoint in the log.
+    int64_t countDeltasSinceCheckpoint() noexcept(false) {
+        if(this->getNumOfVersions() == 0) {
+            return 0;
+        }
+        const int64_t latest = this->m_pLog->getLatestIndex();
+        return latest - this->findCheckpointIndex(latest);
+    }
+
+    // Rebuilds the version at a log index, which may be negative to count
+    // back from the end like getEntryByIndex(), by applying the deltas after
+    // the latest checkpoint before it to that checkpoint.
+    std::unique_ptr<ObjectType> reconstructByIndex(int64_t idx,
+                                                   mutils::DeserializationManager *dm) noexcept(false) {
+        if(idx < 0) {
+            idx += this->m_pLog->getLatestIndex() + 1;
+        }
+        const int64_t checkpoint = this->findCheckpointIndex(idx);
+        std::unique_ptr<ObjectType> object = mutils::from_bytes<ObjectType>(
+                dm, (char const *)this->m_pLog->getEntryByIndex(checkpoint) + 1);
+        for(int64_t i = checkpoint + 1; i <= idx; ++i) {
+            object->applyDelta((char const *)this->m_pLog->getEntryByIndex(i) + 1);
+        }
+        return object;
+    }
     // get the static name maker.
     static _NameMaker &getNameMaker(const std::string & prefix = std::string(""));
+    // Unnamed fields are numbered across all subgroups, unless the objects of
+    // different subgroups are constructed concurrently, which would make the
+    // numbers depend on timing; then they are numbered within their subgroup.
+    static std::string makerPrefix(PersistentRegistry *persistent_registry) {
+        if(persistent_registry == nullptr || !getPersPerSubgroupLogNames()) {
+            return std::string("");
+        }
+        return persistent_registry->get_subgroup_prefix();
+    }
 
     //serialization supports
 public:
@@ -860,6 +1356,9 @@ template <typename ObjectType, StorageType storageType>
 typename Persistent<ObjectType, storageType>::_NameMaker &
 Persistent<ObjectType, storageType>::getNameMaker(const std::string & prefix) noexcept(false) {
     static std::map<std::string,Persistent<ObjectType,storageType>::_NameMaker> name_makers;
+    // the objects of different subgroups may be constructed concurrently
+    static std::mutex name_makers_mutex;
+    std::lock_guard<std::mutex> lock(name_makers_mutex);
     // make sure prefix does exist.
     auto search = name_makers.find(prefix);
     if (search == name_makers.end()) {
@@ -876,11 +1375,13 @@ public:
      * log and register itself to a persistent registry.
      * @param object_name This name is used for persistent data in file.
      * @param persistent_registry A normal pointer to the registry.
+     * @param codec The codec that compresses new versions in the log.
      */
     Volatile(
             const char *object_name = nullptr,
-            PersistentRegistry *persistent_registry = nullptr) noexcept(false)
-            : Persistent<ObjectType, ST_MEM>(object_name, persistent_registry) {}
+            PersistentRegistry *persistent_registry = nullptr,
+            const LogCodec codec = LOG_CODEC_NONE) noexcept(false)
+            : Persistent<ObjectType, ST_MEM>(object_name, persistent_registry, codec) {}
 
     /** constructor 2 is move constructor. It "steals" the resource from
      * another object.
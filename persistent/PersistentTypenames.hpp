@@ -21,6 +21,19 @@ using PersistFunc = std::function<const version_t(void)>;
 using TrimFunc = std::function<void(const version_t &)>;
 using LatestPersistedGetterFunc = std::function<const version_t(void)>;
 using TruncateFunc = std::function<void(const int64_t &)>;
+
+// How much of its log a Persistent<T> keeps. Once a version is persisted,
+// it is trimmed if it is beyond any of the limits, but the latest version is
+// always kept. 0 means no limit.
+struct RetentionPolicy {
+    // the number of versions
+    uint64_t max_versions = 0;
+    // the age of a version, by its HLC
+    uint64_t max_age_us = 0;
+    // the bytes of data in the log
+    uint64_t max_bytes = 0;
+};
+using RetainFunc = std::function<void(const RetentionPolicy &, const version_t &)>;
 // this function is obsolete, now we use a shared pointer to persistence registry
 // using PersistentCallbackRegisterFunc = std::function<void(const char*,VersionFunc,PersistFunc,TrimFunc)>;
 }
@@ -0,0 +1,202 @@
+#include "PmemPersistLog.hpp"
+#include "util.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+namespace persistent {
+
+/////////////////////////
+// internal structures //
+/////////////////////////
+
+#define CACHE_LINE_SIZE (64)
+
+#define PMEM_META_SLOT(i) ((MetaHeader *)((uint8_t *)this->m_pMeta + (i)*PMEM_META_SLOT_SIZE))
+#define PMEM_META_SEQ(i) ((volatile uint64_t *)((uint8_t *)this->m_pMeta + (i)*PMEM_META_SLOT_SIZE + PMEM_META_SEQ_OFST))
+
+// map a file with MAP_SYNC, which only succeeds on a DAX file system. A
+// failed MAP_FIXED mapping may have destroyed the one it was replacing.
+static void *mapSync(void *addr, size_t len, int fd) noexcept(true);
+
+// write the cache lines of a range back to memory, and wait for them
+static void flushCacheLines(const void *addr, size_t len) noexcept(true);
+
+////////////////////////
+// visible to outside //
+////////////////////////
+
+PmemPersistLog::PmemPersistLog(const string &name, const string &dataPath) noexcept(false) : FilePersistLog(name, recoverMetaHeader(name, dataPath)),
+                                                                                             m_bDax(false),
+                                                                                             m_pMeta(MAP_FAILED),
+                                                                                             m_uMetaSeq(0) {
+    // STEP 1: map the meta file
+    int fd = open(this->m_sMetaFile.c_str(), O_RDWR);
+    if(fd == -1) {
+        throw PERSIST_EXP_OPEN_FILE(errno);
+    }
+    // FilePersistLog creates it with a single header
+    if(ftruncate(fd, PMEM_META_FILE_SIZE) != 0) {
+        close(fd);
+        throw PERSIST_EXP_TRUNCATE_FILE(errno);
+    }
+#if defined(__x86_64__)
+    this->m_pMeta = mapSync(NULL, PMEM_META_FILE_SIZE, fd);
+#endif
+    if(this->m_pMeta != MAP_FAILED) {
+        // STEP 2: on DAX, switch the log and data to MAP_SYNC too, both
+        // halves of each ring
+        this->m_bDax = true;
+        if(mapSync(this->m_pLog, MAX_LOG_SIZE, this->m_iLogFileDesc) == MAP_FAILED
+           || mapSync((void *)((uint64_t)this->m_pLog + MAX_LOG_SIZE), MAX_LOG_SIZE, this->m_iLogFileDesc) == MAP_FAILED
+           || mapSync(this->m_pData, (size_t)MAX_DATA_SIZE, this->m_iDataFileDesc) == MAP_FAILED
+           || mapSync((void *)((uint64_t)this->m_pData + MAX_DATA_SIZE), (size_t)MAX_DATA_SIZE, this->m_iDataFileDesc) == MAP_FAILED) {
+            dbg_error("{0}:remap log and data with MAP_SYNC failed.", this->m_sName);
+            close(fd);
+            throw PERSIST_EXP_MMAP_FILE(errno);
+        }
+    } else {
+        dbg_warn("{0}: {1} is not on a DAX file system; persisting with msync().", this->m_sName, dataPath);
+        this->m_pMeta = mmap(NULL, PMEM_META_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(this->m_pMeta == MAP_FAILED) {
+            close(fd);
+            throw PERSIST_EXP_MMAP_FILE(errno);
+        }
+    }
+    close(fd);
+    // STEP 3: continue the sequence of meta headers
+    this->m_uMetaSeq = MAX(*PMEM_META_SEQ(0), *PMEM_META_SEQ(1));
+}
+
+PmemPersistLog::~PmemPersistLog() noexcept(true) {
+    if(this->m_pMeta != MAP_FAILED) {
+        munmap(this->m_pMeta, PMEM_META_FILE_SIZE);
+    }
+}
+
+const string &PmemPersistLog::recoverMetaHeader(const string &name, const string &dataPath) noexcept(false) {
+    const string metaFile = dataPath + "/" + name + "." + META_FILE_SUFFIX;
+    if(!checkRegularFile(metaFile)) {
+        return dataPath;
+    }
+    int fd = open(metaFile.c_str(), O_RDWR);
+    if(fd == -1) {
+        throw PERSIST_EXP_OPEN_FILE(errno);
+    }
+    uint8_t buf[PMEM_META_FILE_SIZE];
+    ssize_t nRead = pread(fd, buf, PMEM_META_FILE_SIZE, 0);
+    if(nRead == (ssize_t)PMEM_META_FILE_SIZE) {
+        const uint64_t seq0 = *(uint64_t *)(buf + PMEM_META_SEQ_OFST);
+        const uint64_t seq1 = *(uint64_t *)(buf + PMEM_META_SLOT_SIZE + PMEM_META_SEQ_OFST);
+        // The second copy is written and sealed first, so it is newer only
+        // if the first one may be torn.
+        if(seq1 > seq0) {
+            dbg_warn("{0}: recovering the meta header from its second copy.", name);
+            if(pwrite(fd, buf + PMEM_META_SLOT_SIZE, PMEM_META_SLOT_SIZE, 0) != (ssize_t)PMEM_META_SLOT_SIZE
+               || fsync(fd) != 0) {
+                close(fd);
+                throw PERSIST_EXP_WRITE_FILE(errno);
+            }
+        }
+    }
+    close(fd);
+    return dataPath;
+}
+
+void PmemPersistLog::persistMetaHeaderAtomically(MetaHeader *pShadowHeader) noexcept(false) {
+    if(!this->m_bDax) {
+        FilePersistLog::persistMetaHeaderAtomically(pShadowHeader);
+        return;
+    }
+    const uint64_t seq = ++this->m_uMetaSeq;
+    // the second copy first, then the first one
+    for(int slot = 1; slot >= 0; slot--) {
+        memcpy(PMEM_META_SLOT(slot), pShadowHeader, sizeof(MetaHeader));
+        flushCacheLines(PMEM_META_SLOT(slot), sizeof(MetaHeader));
+        *PMEM_META_SEQ(slot) = seq;
+        flushCacheLines((const void *)PMEM_META_SEQ(slot), sizeof(uint64_t));
+    }
+
+    // update the persisted header in memory
+    *META_HEADER_PERS = *pShadowHeader;
+}
+
+void PmemPersistLog::syncRange(void *start, size_t len) noexcept(false) {
+    if(!this->m_bDax) {
+        FilePersistLog::syncRange(start, len);
+        return;
+    }
+    flushCacheLines(start, len);
+}
+
+//////////////////////////
+// invisible to outside //
+//////////////////////////
+void *mapSync(void *addr, size_t len, int fd) noexcept(true) {
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+    return mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC | (addr ? MAP_FIXED : 0), fd, 0);
+#else
+    return MAP_FAILED;
+#endif
+}
+
+#if defined(__x86_64__)
+enum FlushInstruction {
+    FLUSH_CLFLUSH,
+    FLUSH_CLFLUSHOPT,
+    FLUSH_CLWB
+};
+
+static FlushInstruction detectFlushInstruction() {
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if(ebx & (1u << 24)) {
+            return FLUSH_CLWB;
+        }
+        if(ebx & (1u << 23)) {
+            return FLUSH_CLFLUSHOPT;
+        }
+    }
+    return FLUSH_CLFLUSH;
+}
+
+void flushCacheLines(const void *addr, size_t len) noexcept(true) {
+    static const FlushInstruction flush_instruction = detectFlushInstruction();
+    for(uint64_t line = (uint64_t)addr - (uint64_t)addr % CACHE_LINE_SIZE; line < (uint64_t)addr + len; line += CACHE_LINE_SIZE) {
+        // the assembler may not know clwb and clflushopt, so they are
+        // spelled as their prefixed encodings
+        switch(flush_instruction) {
+            case FLUSH_CLWB:
+                asm volatile(".byte 0x66; xsaveopt %0"
+                             : "+m"(*(volatile char *)line));
+                break;
+            case FLUSH_CLFLUSHOPT:
+                asm volatile(".byte 0x66; clflush %0"
+                             : "+m"(*(volatile char *)line));
+                break;
+            default:
+                asm volatile("clflush %0"
+                             : "+m"(*(volatile char *)line));
+        }
+    }
+    // clflush is ordered already
+    if(flush_instruction != FLUSH_CLFLUSH) {
+        asm volatile("sfence" ::
+                             : "memory");
+    }
+}
+#else
+// only used on DAX, which needs x86-64 here
+void flushCacheLines(const void *addr, size_t len) noexcept(true) {
+}
+#endif
+}
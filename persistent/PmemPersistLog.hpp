@@ -0,0 +1,58 @@
+#ifndef PMEM_PERSIST_LOG_HPP
+#define PMEM_PERSIST_LOG_HPP
+
+#include "FilePersistLog.hpp"
+#include <string>
+
+namespace persistent {
+
+// The meta file of a PmemPersistLog holds two copies of the meta header, each
+// followed by a sequence number. The first copy is where FilePersistLog keeps
+// its header, so the file can be read like FilePersistLog's.
+#define PMEM_META_SEQ_OFST (META_SIZE)
+#define PMEM_META_SLOT_SIZE (META_SIZE + 64)
+#define PMEM_META_FILE_SIZE (PMEM_META_SLOT_SIZE * 2)
+
+/**
+ * PmemPersistLog is a FilePersistLog for files on persistent memory, which
+ * the log maps directly with DAX (MAP_SYNC). Persisting then doesn't need
+ * msync(): the written cache lines are flushed with clwb (or clflushopt, or
+ * clflush), followed by an sfence. The meta header is updated in place
+ * rather than through a swap file: a new header is first written to the
+ * second copy in the meta file, then to the first, and each copy is only
+ * valid once its sequence number is written after it, since persistent
+ * memory only guarantees that aligned 8-byte stores are atomic.
+ *
+ * If the files aren't on a DAX file system, or the CPU isn't x86-64, the log
+ * works like a FilePersistLog.
+ */
+class PmemPersistLog : public FilePersistLog {
+protected:
+    // true if the files are mapped with MAP_SYNC, so cache flushes persist them
+    bool m_bDax;
+    // the mapped meta file
+    void *m_pMeta;
+    // the sequence number of the latest meta header
+    uint64_t m_uMetaSeq;
+
+    virtual void persistMetaHeaderAtomically(MetaHeader *) noexcept(false);
+    virtual void syncRange(void *start, size_t len) noexcept(false);
+
+public:
+    //Constructor
+    PmemPersistLog(const std::string &name, const std::string &dataPath) noexcept(false);
+    PmemPersistLog(const std::string &name) noexcept(false) : PmemPersistLog(name, getPersPmemPath()){};
+    //Destructor
+    virtual ~PmemPersistLog() noexcept(true);
+
+    /**
+     * Repair the first meta header of a log from the second one, if a crash
+     * interrupted an update after the second one was written. This has to be
+     * done before FilePersistLog loads the first one.
+     * @RETURN dataPath
+     */
+    static const std::string &recoverMetaHeader(const std::string &name, const std::string &dataPath) noexcept(false);
+};
+}
+
+#endif  //PMEM_PERSIST_LOG_HPP
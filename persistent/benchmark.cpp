@@ -0,0 +1,259 @@
+/**
+ * @file benchmark.cpp
+ *
+ * Drives a PersistLog backend directly through append/persist, getEntry and
+ * trim workloads, like fio does for a disk, so that storage can be sized and
+ * backends compared. Each thread works on a log of its own.
+ */
+#include "DirectPersistLog.hpp"
+#include "FilePersistLog.hpp"
+#include "MemPersistLog.hpp"
+#include "PmemPersistLog.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace persistent;
+using std::cout;
+using std::endl;
+using std::cerr;
+
+using bench_clock = std::chrono::steady_clock;
+
+struct BenchmarkOptions {
+    std::string backend;
+    std::string workload;
+    uint64_t entry_size = 4096;
+    // appends per persist(), and entries per trim()
+    uint64_t batch = 1;
+    uint64_t threads = 1;
+    // entries per thread
+    uint64_t count = 10000;
+};
+
+// what one thread measured in one workload
+struct ThreadResult {
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    // the time of each persist() or trim() call, or of each sampled getEntry()
+    std::vector<uint64_t> latencies_ns;
+};
+
+static void printhelp() {
+    cout << "usage: pbench <file|direct|pmem|mem> <append|read|trim|all> "
+            "[entry_size=<bytes>] [batch=<n>] [threads=<n>] [count=<entries per thread>]"
+         << endl;
+    cout << "\tappend: appends count entries of entry_size bytes, and persists every batch appends" << endl;
+    cout << "\tread:   appends and persists count entries, then reads them with getEntry in random order" << endl;
+    cout << "\ttrim:   appends and persists count entries, then trims them batch entries at a time" << endl;
+    cout << "\tall:    append, read and trim in turn" << endl;
+    cout << "The logs, named pbench_<thread>, are kept in the persistent file path (see derecho.cfg)." << endl;
+}
+
+static bool parse_options(int argc, char **argv, BenchmarkOptions &options) {
+    if(argc < 3) {
+        return false;
+    }
+    options.backend = argv[1];
+    options.workload = argv[2];
+    for(int i = 3; i < argc; i++) {
+        const std::string arg = argv[i];
+        const std::size_t equals = arg.find('=');
+        if(equals == std::string::npos) {
+            return false;
+        }
+        const std::string name = arg.substr(0, equals);
+        const uint64_t value = std::stoull(arg.substr(equals + 1));
+        if(name == "entry_size") {
+            options.entry_size = value;
+        } else if(name == "batch") {
+            options.batch = value;
+        } else if(name == "threads") {
+            options.threads = value;
+        } else if(name == "count") {
+            options.count = value;
+        } else {
+            return false;
+        }
+    }
+    return (options.backend == "file" || options.backend == "direct" || options.backend == "pmem"
+            || options.backend == "mem")
+           && (options.workload == "append" || options.workload == "read"
+               || options.workload == "trim" || options.workload == "all")
+           && options.entry_size > 0 && options.batch > 0 && options.threads > 0 && options.count > 0;
+}
+
+static std::unique_ptr<PersistLog> open_log(const std::string &backend, const std::string &name) {
+    if(backend == "direct") {
+        return std::make_unique<DirectPersistLog>(name);
+    } else if(backend == "pmem") {
+        return std::make_unique<PmemPersistLog>(name);
+    } else if(backend == "mem") {
+        return std::make_unique<MemPersistLog>(name);
+    }
+    return std::make_unique<FilePersistLog>(name);
+}
+
+static uint64_t elapsed_ns(const bench_clock::time_point &since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - since).count();
+}
+
+// Appends count entries after the log's latest version, persisting every
+// batch of them, and times each persist(). Versions start no lower than the
+// current time in microseconds, so they keep growing across runs even if an
+// earlier run trimmed its log empty.
+static void append_entries(PersistLog &log, const BenchmarkOptions &options, ThreadResult &result) {
+    const std::vector<char> data(options.entry_size, 'p');
+    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch())
+                                   .count();
+    int64_t ver = std::max<int64_t>(log.getLatestVersion() + 1, now_us);
+    for(uint64_t i = 0; i < options.count; i++, ver++) {
+        log.append(data.data(), data.size(), ver, HLC(ver, 0));
+        if((i + 1) % options.batch == 0 || i + 1 == options.count) {
+            const auto start = bench_clock::now();
+            log.persist();
+            result.latencies_ns.push_back(elapsed_ns(start));
+        }
+    }
+    result.ops = options.count;
+    result.bytes = options.count * options.entry_size;
+}
+
+// Reads every entry appended by append_entries once, in random order, and
+// times one read in every hundred.
+static void read_entries(PersistLog &log, const BenchmarkOptions &options, ThreadResult &result) {
+    const int64_t latest = log.getLatestVersion();
+    std::vector<int64_t> versions(options.count);
+    for(uint64_t i = 0; i < options.count; i++) {
+        versions[i] = latest - i;
+    }
+    std::shuffle(versions.begin(), versions.end(), std::mt19937_64(latest));
+    uint64_t checksum = 0;
+    for(uint64_t i = 0; i < versions.size(); i++) {
+        const auto start = bench_clock::now();
+        const char *entry = static_cast<const char *>(log.getEntry(versions[i]));
+        if(i % 100 == 0) {
+            result.latencies_ns.push_back(elapsed_ns(start));
+        }
+        // touch the entry, so a backend that maps it lazily pays for it here
+        checksum += entry ? entry[0] + entry[options.entry_size - 1] : 0;
+    }
+    if(checksum == 0) {
+        cerr << "warning: getEntry found no data" << endl;
+    }
+    result.ops = options.count;
+    result.bytes = options.count * options.entry_size;
+}
+
+// Trims the entries appended by append_entries, batch entries at a time,
+// and times each trim().
+static void trim_entries(PersistLog &log, const BenchmarkOptions &options, ThreadResult &result) {
+    const int64_t latest = log.getLatestVersion();
+    for(int64_t ver = latest - options.count + options.batch; ver < latest + (int64_t)options.batch;
+        ver += options.batch) {
+        const auto start = bench_clock::now();
+        log.trim(std::min(ver, latest));
+        result.latencies_ns.push_back(elapsed_ns(start));
+    }
+    result.ops = options.count;
+    result.bytes = options.count * options.entry_size;
+}
+
+static void print_result(const std::string &workload, const std::string &latency_name,
+                         const BenchmarkOptions &options, std::vector<ThreadResult> &results,
+                         const uint64_t wall_ns) {
+    uint64_t ops = 0, bytes = 0;
+    std::vector<uint64_t> latencies_ns;
+    for(auto &result : results) {
+        ops += result.ops;
+        bytes += result.bytes;
+        latencies_ns.insert(latencies_ns.end(), result.latencies_ns.begin(), result.latencies_ns.end());
+    }
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile_us = [&latencies_ns](double fraction) {
+        if(latencies_ns.empty()) {
+            return 0.0;
+        }
+        return latencies_ns[std::min(latencies_ns.size() - 1, (std::size_t)(fraction * latencies_ns.size()))] / 1000.0;
+    };
+    const double seconds = wall_ns / 1e9;
+    printf("%s: backend=%s entry_size=%lu batch=%lu threads=%lu count=%lu\n", workload.c_str(),
+           options.backend.c_str(), options.entry_size, options.batch, options.threads, options.count);
+    printf("\t%.0f ops/s\t%.2f MB/s\n", ops / seconds, bytes / seconds / (1 << 20));
+    printf("\t%s latency (us): p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f (%lu samples)\n",
+           latency_name.c_str(), percentile_us(0.5), percentile_us(0.9), percentile_us(0.99),
+           percentile_us(0.999), latencies_ns.empty() ? 0.0 : latencies_ns.back() / 1000.0,
+           latencies_ns.size());
+}
+
+// Runs a workload on every thread's log at once, after the setup (if any)
+// has prepared each log.
+static void run_workload(const std::string &workload, const std::string &latency_name,
+                         const BenchmarkOptions &options, std::vector<std::unique_ptr<PersistLog>> &logs,
+                         void (*work)(PersistLog &, const BenchmarkOptions &, ThreadResult &),
+                         void (*setup)(PersistLog &, const BenchmarkOptions &, ThreadResult &) = nullptr) {
+    if(setup) {
+        for(auto &log : logs) {
+            ThreadResult unused;
+            setup(*log, options, unused);
+        }
+    }
+    std::vector<ThreadResult> results(logs.size());
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> ready(0);
+    std::atomic<bool> go(false);
+    for(std::size_t t = 0; t < logs.size(); t++) {
+        threads.emplace_back([&, t]() {
+            ready++;
+            while(!go) {
+            }
+            work(*logs[t], options, results[t]);
+        });
+    }
+    while(ready < logs.size()) {
+    }
+    const auto start = bench_clock::now();
+    go = true;
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    print_result(workload, latency_name, options, results, elapsed_ns(start));
+}
+
+int main(int argc, char **argv) {
+    BenchmarkOptions options;
+    if(!parse_options(argc, argv, options)) {
+        printhelp();
+        return -1;
+    }
+    try {
+        std::vector<std::unique_ptr<PersistLog>> logs;
+        for(uint64_t t = 0; t < options.threads; t++) {
+            logs.push_back(open_log(options.backend, "pbench_" + std::to_string(t)));
+        }
+        const bool all = (options.workload == "all");
+        if(all || options.workload == "append") {
+            run_workload("append", "persist", options, logs, append_entries);
+        }
+        if(all || options.workload == "read") {
+            run_workload("read", "getEntry", options, logs, read_entries, all ? nullptr : append_entries);
+        }
+        if(all || options.workload == "trim") {
+            run_workload("trim", "trim", options, logs, trim_entries, all ? nullptr : append_entries);
+        }
+    } catch(unsigned long long exp) {
+        cerr << "Exception caught 0x" << std::hex << exp << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -76,6 +76,64 @@ inline std::string getPersFilePath() {
     return std::string(derecho::getConfString(CONF_PERS_FILE_PATH));
 }
 
+inline uint64_t getPersDeltaCheckpointInterval() {
+    return derecho::getConfUInt64(CONF_PERS_DELTA_CHECKPOINT_INTERVAL);
+}
+
+inline std::string getPersPmemPath() {
+    std::string path = derecho::getConfString(CONF_PERS_PMEM_PATH);
+    return path.empty() ? getPersFilePath() : path;
+}
+
+inline uint64_t getPersDirectReadCacheSize() {
+    return derecho::getConfUInt64(CONF_PERS_DIRECT_READ_CACHE_SIZE);
+}
+
+inline uint64_t getPersMaxLogEntry() {
+    return derecho::getConfUInt64(CONF_PERS_MAX_LOG_ENTRY);
+}
+
+inline uint64_t getPersMaxDataSize() {
+    return derecho::getConfUInt64(CONF_PERS_MAX_DATA_SIZE);
+}
+
+inline uint64_t getPersMemLogSize() {
+    return derecho::getConfUInt64(CONF_PERS_MEM_LOG_SIZE);
+}
+
+inline uint64_t getPersCodecCacheSize() {
+    return derecho::getConfUInt64(CONF_PERS_CODEC_CACHE_SIZE);
+}
+
+inline uint64_t getPersVersionCacheSize() {
+    return derecho::getConfUInt64(CONF_PERS_VERSION_CACHE_SIZE);
+}
+
+inline uint64_t getPersRetentionMaxVersions() {
+    return derecho::getConfUInt64(CONF_PERS_RETENTION_MAX_VERSIONS);
+}
+
+inline uint64_t getPersRetentionMaxAgeUs() {
+    return derecho::getConfUInt64(CONF_PERS_RETENTION_MAX_AGE_MS) * 1000;
+}
+
+inline uint64_t getPersRetentionMaxBytes() {
+    return derecho::getConfUInt64(CONF_PERS_RETENTION_MAX_BYTES);
+}
+
+inline bool getPersParallelPersist() {
+    return derecho::getConfBoolean(CONF_PERS_PARALLEL_PERSIST);
+}
+
+// The objects of subgroups are constructed concurrently
+inline bool getPersPerSubgroupLogNames() {
+    return derecho::getConfUInt32(CONF_DERECHO_OBJECT_CONSTRUCTION_THREADS) > 1;
+}
+
+inline uint64_t getPersPreallocSize() {
+    return derecho::getConfUInt64(CONF_PERS_PREALLOC_SIZE);
+}
+
 // verify the existence of a folder
 // Check if directory exists or not. Create it on absence.
 // return error if creating failed
@@ -86,8 +144,8 @@ inline void checkOrCreateDir(const std::string& dirPath) noexcept(false) {
             throw PERSIST_EXP_INV_PATH;
         }
     } else {
-        // create it
-        if(mkdir(dirPath.c_str(), 0700) != 0) {
+        // create it, unless a log constructed on another thread just did
+        if(mkdir(dirPath.c_str(), 0700) != 0 && errno != EEXIST) {
             throw PERSIST_EXP_CREATE_PATH(errno);
         }
     }
@@ -129,4 +187,15 @@ inline bool checkOrCreateFileWithSize(const std::string& file, uint64_t size) no
     return bCreate;
 }
 
+// the size of a file, or the given size if it doesn't exist yet. An existing
+// ring buffer file keeps the capacity it was created with.
+inline uint64_t getFileSizeOr(const std::string& file, uint64_t size) noexcept(false) {
+    struct stat sb;
+
+    if(checkRegularFile(file) && stat(file.c_str(), &sb) == 0) {
+        size = (uint64_t)sb.st_size;
+    }
+    return size;
+}
+
 #endif  //UTIL_HPP
@@ -1,6 +1,7 @@
 
 #include "rdmc.h"
 #include "schedule.h"
+#include "schedule_simulator.h"
 #include "util.h"
 #include "verbs_helper.h"
 
@@ -17,6 +18,7 @@
 #include <set>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 using namespace std;
@@ -285,6 +287,62 @@ void compare_send_types() {
     puts("");
     fflush(stdout);
 }
+/**
+ * Measures which of the sequential, chain and binomial algorithms delivers
+ * messages of each number of blocks fastest in every group size, and prints
+ * the winners as a value for the rdmc_adaptive_thresholds option.
+ */
+void calibrate_adaptive() {
+    puts("=========================================================");
+    puts("=        Calibrate Adaptive Send - Time (ms)            =");
+    puts("=========================================================");
+    puts("Group Size, Blocks, Sequential Send, Chain Send, Binomial Pipeline");
+    fflush(stdout);
+
+    const size_t block_size = 1 << 20;
+    const size_t iterations = 16;
+    const vector<pair<rdmc::send_algorithm, string>> candidates = {
+            {rdmc::SEQUENTIAL_SEND, "sequential_send"},
+            {rdmc::CHAIN_SEND, "chain_send"},
+            {rdmc::BINOMIAL_SEND, "binomial_send"}};
+    const vector<size_t> block_counts = {1, 4, 16, 64, 256};
+    string thresholds;
+    for(uint32_t gsize = 2; gsize <= num_nodes; ++gsize) {
+        vector<size_t> winners;
+        printf("%d", (int)gsize);
+        for(size_t num_blocks : block_counts) {
+            printf(", %d", (int)num_blocks);
+            size_t winner = 0;
+            double winner_time = 0;
+            for(size_t c = 0; c < candidates.size(); ++c) {
+                auto s = measure_multicast(num_blocks * block_size, block_size, gsize,
+                                           iterations, candidates[c].first);
+                printf(", %f", s.time.mean);
+                if(c == 0 || s.time.mean < winner_time) {
+                    winner = c;
+                    winner_time = s.time.mean;
+                }
+            }
+            winners.push_back(winner);
+        }
+        puts("");
+        fflush(stdout);
+
+        // One rule per run of block counts with the same winner; the last run
+        // covers messages of any size
+        for(size_t b = 0; b < block_counts.size(); ++b) {
+            if(b + 1 < block_counts.size() && winners[b + 1] == winners[b]) {
+                continue;
+            }
+            const size_t max_blocks = b + 1 < block_counts.size() ? block_counts[b] : 0;
+            thresholds += (thresholds.empty() ? "" : ",") + to_string(gsize) + ":"
+                          + to_string(max_blocks) + ":" + candidates[winners[b]].second;
+        }
+    }
+    printf("rdmc_adaptive_thresholds = %s\n", thresholds.c_str());
+    puts("");
+    fflush(stdout);
+}
 void bandwidth_group_size() {
     puts("=========================================================");
     puts("=              Bandwidth vs. Group Size                 =");
@@ -669,6 +727,115 @@ void test_pattern() {
     puts("PASS");
 }
 
+// Builds every member's schedule for an algorithm, without any networking.
+// Hierarchical groups are split into racks of rack_size consecutive members.
+vector<unique_ptr<schedule>> make_schedules(rdmc::send_algorithm algorithm,
+                                            uint32_t group_size,
+                                            uint32_t rack_size = 4) {
+    vector<uint32_t> member_racks;
+    for(uint32_t m = 0; m < group_size; m++) member_racks.push_back(m / rack_size);
+
+    vector<unique_ptr<schedule>> schedules;
+    for(uint32_t m = 0; m < group_size; m++) {
+        if(algorithm == rdmc::BINOMIAL_SEND) {
+            schedules.push_back(make_unique<binomial_schedule>(group_size, m));
+        } else if(algorithm == rdmc::CHAIN_SEND) {
+            schedules.push_back(make_unique<chain_schedule>(group_size, m));
+        } else if(algorithm == rdmc::SEQUENTIAL_SEND) {
+            schedules.push_back(make_unique<sequential_schedule>(group_size, m));
+        } else if(algorithm == rdmc::TREE_SEND) {
+            schedules.push_back(make_unique<tree_schedule>(group_size, m));
+        } else if(algorithm == rdmc::STRIPED_SEND) {
+            schedules.push_back(make_unique<striped_schedule>(group_size, m));
+        } else if(algorithm == rdmc::HIERARCHICAL_SEND) {
+            schedules.push_back(make_unique<hierarchical_schedule>(group_size, m, member_racks));
+        }
+    }
+    return schedules;
+}
+
+const vector<pair<string, rdmc::send_algorithm>> simulated_algorithms = {
+        {"binomial", rdmc::BINOMIAL_SEND},
+        {"chain", rdmc::CHAIN_SEND},
+        {"sequential", rdmc::SEQUENTIAL_SEND},
+        {"tree", rdmc::TREE_SEND},
+        {"hierarchical", rdmc::HIERARCHICAL_SEND},
+        {"striped", rdmc::STRIPED_SEND}};
+
+// Checks every simulated algorithm against the simulator for a range of group
+// and message sizes, like test_pattern does for the binomial pipeline.
+void test_schedules() {
+    bool passed = true;
+    for(const auto& algorithm : simulated_algorithms) {
+        for(uint32_t group_size = 2; group_size <= 64; group_size++) {
+            for(size_t num_blocks = 1; num_blocks <= 32; num_blocks++) {
+                try {
+                    simulate_schedule(make_schedules(algorithm.second, group_size),
+                                      num_blocks, 1, 1.0, 0.0);
+                } catch(const invalid_schedule& e) {
+                    printf("%s: group_size = %d, blocks = %d: %s\n",
+                           algorithm.first.c_str(), (int)group_size,
+                           (int)num_blocks, e.what());
+                    passed = false;
+                }
+            }
+        }
+    }
+    puts(passed ? "PASS" : "FAIL");
+}
+
+// Predicts how long one multicast takes with a schedule, on a network where
+// every node has one link with the given bandwidth and latency, and prints
+// the result in the units the measured experiments use. With "plan", also
+// prints every transfer.
+void simulate_send(int argc, char *argv[]) {
+    if(argc < 8) {
+        puts("Usage: simulate <algorithm> <group_size> <size> <block_size> "
+             "<link Gb/s> <link latency us> [plan]");
+        return;
+    }
+    auto algorithm = find_if(simulated_algorithms.begin(),
+                             simulated_algorithms.end(),
+                             [&](const pair<string, rdmc::send_algorithm> &a) {
+                                 return a.first == argv[2];
+                             });
+    if(algorithm == simulated_algorithms.end()) {
+        puts("Unrecognized algorithm name.");
+        return;
+    }
+    const uint32_t group_size = atoi(argv[3]);
+    const size_t size = strtoull(argv[4], nullptr, 0);
+    const size_t block_size = strtoull(argv[5], nullptr, 0);
+    const double link_gbps = atof(argv[6]);
+    const double link_latency_us = atof(argv[7]);
+
+    schedule_simulation simulation;
+    try {
+        simulation = simulate_schedule(
+                make_schedules(algorithm->second, group_size), size, block_size,
+                link_gbps * 1e9 / 8, link_latency_us * 1e-6);
+    } catch(const exception &e) {
+        printf("Invalid schedule: %s\n", e.what());
+        return;
+    }
+
+    if(argc >= 9 && strcmp(argv[8], "plan") == 0) {
+        puts("step  sender  receiver  block  start (us)  end (us)");
+        for(const simulated_transfer &t : simulation.transfers) {
+            printf("%4d  %6d  %8d  %5d  %10.3f  %8.3f\n", (int)t.step,
+                   (int)t.sender, (int)t.receiver, (int)t.block_number,
+                   t.start_time * 1e6, t.end_time * 1e6);
+        }
+    }
+    printf("Blocks = %d, steps = %d, transfers = %d\n",
+           (int)simulation.num_blocks, (int)simulation.total_steps,
+           (int)simulation.transfers.size());
+    printf("Predicted latency = %f ms\n", simulation.completion_time * 1e3);
+    printf("Predicted bandwidth = %f Gb/s\n",
+           size * 8.0 / simulation.completion_time * 1e-9);
+    fflush(stdout);
+}
+
 int main(int argc, char *argv[]) {
     // rlimit rlim;
     // rlim.rlim_cur = RLIM_INFINITY;
@@ -678,6 +845,12 @@ int main(int argc, char *argv[]) {
     if(argc >= 2 && strcmp(argv[1], "test_pattern") == 0) {
         test_pattern();
         exit(0);
+    } else if(argc >= 2 && strcmp(argv[1], "test_schedules") == 0) {
+        test_schedules();
+        exit(0);
+    } else if(argc >= 2 && strcmp(argv[1], "simulate") == 0) {
+        simulate_send(argc, argv);
+        exit(0);
     } else if(argc >= 2 && strcmp(argv[1], "spin") == 0) {
         volatile bool b = true;
         while(b)
@@ -725,6 +898,8 @@ int main(int argc, char *argv[]) {
         blocksize_v_bandwidth(16);
     } else if(strcmp(argv[1], "sendtypes") == 0) {
         compare_send_types();
+    } else if(strcmp(argv[1], "calibrate_adaptive") == 0) {
+        calibrate_adaptive();
     } else if(strcmp(argv[1], "bandwidth") == 0) {
         bandwidth_group_size();
     } else if(strcmp(argv[1], "overhead") == 0) {
@@ -8,8 +8,10 @@
   #include "lf_helper.h"
 #endif
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <thread>
 
 using namespace std;
 using namespace rdma;
@@ -22,6 +24,33 @@ extern mutex groups_lock;
 
 decltype(polling_group::message_types) polling_group::message_types;
 
+/**
+ * A connection to a peer for the ready-for-block messages of every group that
+ * has it as a neighbor, so that a node in many groups doesn't need a queue
+ * pair per group for them. Each group using it keeps a receive posted on it;
+ * the immediate says which group a message is for.
+ */
+struct ready_for_block_connection {
+#ifdef USE_VERBS_API
+    rdma::queue_pair connection;
+#else
+    rdma::endpoint connection;
+#endif
+    size_t num_groups = 0;
+    size_t posted_receives = 1;
+};
+/** Maps node IDs to their ready-for-block connections */
+static map<uint32_t, shared_ptr<ready_for_block_connection>> ready_for_block_connections;
+static mutex ready_for_block_connections_lock;
+
+static uint32_t get_num_rails() {
+#ifdef USE_VERBS_API
+    return 1;
+#else
+    return rdma::impl::lf_num_rails();
+#endif
+}
+
 group::group(uint16_t _group_number, size_t _block_size,
              vector<uint32_t> _members, uint32_t _member_index,
              incoming_message_callback_t upcall,
@@ -53,14 +82,17 @@ void polling_group::initialize_message_types() {
                                            size_t length) {
         ParsedTag parsed_tag = parse_tag(tag);
         shared_ptr<group> g = find_group(parsed_tag.group_number);
-        if(g) g->receive_block(immediate, length);
+        if(g) g->receive_block(immediate, length, parsed_tag.target);
     };
     auto send_ready_for_block = [](uint64_t, uint32_t, size_t) {};
     auto receive_ready_for_block = [find_group](
                                            uint64_t tag, uint32_t immediate, size_t length) {
-        ParsedTag parsed_tag = parse_tag(tag);
-        shared_ptr<group> g = find_group(parsed_tag.group_number);
-        if(g) g->receive_ready_for_block(immediate, parsed_tag.target);
+        // Receives on the shared connections are tagged with the peer's node ID
+        const uint32_t sender_node = parse_tag(tag).target;
+        repost_ready_for_block_receive(sender_node);
+        ParsedReadyImmediate parsed_immediate = parse_ready_immediate(immediate);
+        shared_ptr<group> g = find_group(parsed_immediate.group_number);
+        if(g) g->receive_ready_for_block(parsed_immediate.slices, sender_node);
     };
 
     message_types.data_block = message_type("rdmc.data_block", send_data_block, receive_data_block);
@@ -71,45 +103,61 @@ polling_group::polling_group(uint16_t _group_number, size_t _block_size,
                              vector<uint32_t> _members, uint32_t _member_index,
                              incoming_message_callback_t upcall,
                              completion_callback_t callback,
-                             unique_ptr<schedule> _schedule)
+                             unique_ptr<schedule> _schedule,
+                             size_t _block_overhead,
+                             uint32_t _block_credits,
+                             progress_callback_t _progress_callback)
         : group(_group_number, _block_size, _members, _member_index, upcall,
                 callback, std::move(_schedule)),
-          first_block_buffer(nullptr) {
+          block_overhead(_block_overhead),
+          message_block_size(_block_size),
+          num_rails(get_num_rails()),
+          block_credits(num_rails > 1 ? 1 : max<uint32_t>(_block_credits, 1)),
+          progress_callback(std::move(_progress_callback)) {
     if(member_index != 0) {
-        first_block_buffer = unique_ptr<char[]>(new char[block_size]);
-        memset(first_block_buffer.get(), 0, block_size);
-        first_block_mr = make_unique<memory_region>(first_block_buffer.get(), block_size);
+        first_block_mr = make_unique<memory_region>(block_size);
+        memset(first_block_mr->buffer, 0, block_size);
     }
 
+    // Each connection waits on a handshake with its neighbor, so they are
+    // all made at once instead of one neighbor after another
+    LOG_EVENT(group_number, -1, -1, "connecting");
     auto connections = transfer_schedule->get_connections();
+    vector<thread> connect_threads;
     for(auto c : connections) {
-        connect(c);
+        connect_threads.emplace_back([this, c]() { connect(c); });
     }
+    for(auto& t : connect_threads) {
+        t.join();
+    }
+    LOG_EVENT(group_number, -1, -1, "connected");
 
     if(member_index > 0) {
         auto transfer = transfer_schedule->get_first_block(num_blocks);
         first_block_number = transfer->block_number;
         post_recv(*transfer);
-        incoming_block = transfer->block_number;
-        send_ready_for_block(transfer->target);
+        send_ready_for_block(transfer->target, 1);
         // puts("Issued Ready For Block CCCCCCCCC");
     }
 }
-void polling_group::receive_block(uint32_t send_imm, size_t received_block_size) {
+void polling_group::receive_block(uint32_t send_imm, size_t received_block_size, uint32_t sender) {
     unique_lock<mutex> lock(monitor);
 
     assert(member_index > 0);
 
     if(receive_step == 0) {
         num_blocks = parse_immediate(send_imm).total_blocks;
+        block_size_shift = parse_immediate(send_imm).block_size_shift;
+        message_block_size = block_size >> block_size_shift;
         first_block_number = min(transfer_schedule->get_first_block(num_blocks)->block_number,
                                  num_blocks - 1);
-        message_size = num_blocks * block_size;
-        if(num_blocks == 1) {
-            message_size = received_block_size;
+        message_size = num_blocks * message_block_size;
+        if(*first_block_number == num_blocks - 1) {
+            message_size = (num_blocks - 1) * message_block_size + received_block_size;
         }
 
-        assert(*first_block_number == parse_immediate(send_imm).block_number);
+        assert(!parse_immediate(send_imm).block_number
+               || *first_block_number == *parse_immediate(send_imm).block_number);
 
         //////////////////////////////////////////////////////
         auto destination = incoming_message_upcall(message_size);
@@ -122,6 +170,14 @@ void polling_group::receive_block(uint32_t send_imm, size_t received_block_size)
         num_received_blocks = 1;
         received_blocks = vector<bool>(num_blocks);
         received_blocks[*first_block_number] = true;
+        if(progress_callback) {
+            // The first block is forwarded from first_block_mr, but it can
+            // be copied to its place now, so that it counts as progress
+            const size_t first_block_offset = message_block_size * (*first_block_number);
+            mr->copy_from_host(mr_offset + first_block_offset, first_block_mr->buffer,
+                               min(message_block_size, message_size - first_block_offset));
+            report_progress();
+        }
 
         LOG_EVENT(group_number, message_number, *first_block_number,
                   "initialized_internal_datastructures");
@@ -133,39 +189,13 @@ void polling_group::receive_block(uint32_t send_imm, size_t received_block_size)
             transfer = transfer_schedule->get_incoming_transfer(num_blocks, ++receive_step);
         }
 
-        // cout << "receive_step = " << receive_step
-        //      << " transfer->block_number = "
-        //      << transfer->block_number
-        //      << " first_block_number = " << *first_block_number
-        //      << " total_steps = " << get_total_steps() << endl;
-
         LOG_EVENT(group_number, message_number, *first_block_number,
                   "found_next_transfer");
 
         if(transfer) {
             LOG_EVENT(group_number, message_number, transfer->block_number,
                       "posting_recv");
-            // printf("Posting recv #%d (receive_step = %d,
-            // *first_block_number =
-            // %d, total_steps = %d)\n",
-            //        (int)transfer->block_number, (int)receive_step,
-            // (int)*first_block_number, (int)get_total_steps());
-            post_recv(*transfer);
-            incoming_block = transfer->block_number;
-            send_ready_for_block(transfer->target);
-            // cout << "Issued Ready For Block AAAAAAAA (receive_step = "
-            //      << receive_step << ", target = " << transfer->target << ")"
-            //      << endl;
-
-            for(auto r = receive_step + 1; r < transfer_schedule->get_total_steps(num_blocks); r++) {
-                auto t = transfer_schedule->get_incoming_transfer(num_blocks, r);
-                if(t) {
-                    // cout << "posting block for step " << (int)r
-                    //      << " (block #" << (*t).block_number << ")" << endl;
-                    post_recv(*t);
-                    break;
-                }
-            }
+            post_incoming_transfers();
         }
 
         LOG_EVENT(group_number, message_number, *first_block_number,
@@ -180,48 +210,44 @@ void polling_group::receive_block(uint32_t send_imm, size_t received_block_size)
             complete_message();
         }
     } else {
-        //        assert(tag.index() <= tag.message_size());
-        size_t block_number = incoming_block;
-        if(block_number != parse_immediate(send_imm).block_number) {
+        // The rest of the block's slices are still arriving on other rails
+        received_slice_bytes += received_block_size;
+        if(++received_slices < num_rails) {
+            return;
+        }
+        received_block_size = received_slice_bytes;
+        received_slices = 0;
+        received_slice_bytes = 0;
+
+        auto incoming = find_if(posted_transfers.begin(), posted_transfers.end(),
+                                [sender](const auto& posted) { return posted.first.target == sender; });
+        assert(incoming != posted_transfers.end() && incoming->second);
+        const size_t block_number = incoming->first.block_number;
+        posted_transfers.erase(incoming);
+        const auto sent_block_number = parse_immediate(send_imm).block_number;
+        if(sent_block_number && block_number != *sent_block_number) {
             printf("Expected block #%d but got #%d on step %d\n",
                    (int)block_number,
-                   (int)parse_immediate(send_imm).block_number,
+                   (int)*sent_block_number,
                    (int)receive_step);
             fflush(stdout);
         }
-        assert(block_number == parse_immediate(send_imm).block_number);
+        assert(!sent_block_number || block_number == *sent_block_number);
 
         if(block_number == num_blocks - 1) {
-            message_size = (num_blocks - 1) * block_size + received_block_size;
+            message_size = (num_blocks - 1) * message_block_size + received_block_size;
         } else {
-            assert(received_block_size == block_size);
+            assert(received_block_size == message_block_size);
         }
 
         received_blocks[block_number] = true;
 
         LOG_EVENT(group_number, message_number, block_number, "received_block");
+        report_progress();
 
-        // Figure out the next block to receive.
-        std::optional<schedule::block_transfer> transfer;
-        while(!transfer && receive_step + 1 < transfer_schedule->get_total_steps(num_blocks)) {
-            transfer = transfer_schedule->get_incoming_transfer(num_blocks, ++receive_step);
-        }
-
-        // Post a receive for it.
-        if(transfer) {
-            incoming_block = transfer->block_number;
-            send_ready_for_block(transfer->target);
-            // cout << "Issued Ready For Block BBBBBBBB (receive_step = "
-            //      << receive_step << ", target = " << transfer->target
-            //      << ", total_steps = " << get_total_steps() << ")" << endl;
-            for(auto r = receive_step + 1; r < transfer_schedule->get_total_steps(num_blocks); r++) {
-                auto t = transfer_schedule->get_incoming_transfer(num_blocks, r);
-                if(t) {
-                    post_recv(*t);
-                    break;
-                }
-            }
-        }
+        // Post receives for the blocks after the ones still expected, and
+        // tell their senders
+        post_incoming_transfers();
 
         // If we just finished receiving a block and we weren't
         // previously sending, then try to send now.
@@ -235,20 +261,59 @@ void polling_group::receive_block(uint32_t send_imm, size_t received_block_size)
         }
     }
 }
-void polling_group::receive_ready_for_block(uint32_t step, uint32_t sender) {
+void polling_group::post_incoming_transfers() {
+    const size_t total_steps = transfer_schedule->get_total_steps(num_blocks);
+    // One receive is posted ahead of the ones senders know about, so that
+    // the next ready-for-block goes out with its receive already in place
+    while(posted_transfers.size() < block_credits + 1 && receive_step < total_steps) {
+        auto transfer = transfer_schedule->get_incoming_transfer(num_blocks, receive_step++);
+        if(transfer) {
+            post_recv(*transfer);
+            posted_transfers.emplace_back(*transfer, false);
+        }
+    }
+    uint32_t granted = 0;
+    for(auto& posted : posted_transfers) {
+        if(granted == block_credits) {
+            break;
+        }
+        if(!posted.second) {
+            send_ready_for_block(posted.first.target, num_rails);
+            posted.second = true;
+        }
+        ++granted;
+    }
+}
+void polling_group::report_progress() {
+    if(!progress_callback) {
+        return;
+    }
+    const size_t previous = progressed_blocks;
+    while(progressed_blocks < num_blocks && received_blocks[progressed_blocks]) {
+        ++progressed_blocks;
+    }
+    // The last block's size is only known once it has arrived, which it has
+    // if the run covers it
+    if(progressed_blocks > previous) {
+        progress_callback(mr->buffer + mr_offset,
+                          progressed_blocks == num_blocks ? message_size
+                                                          : progressed_blocks * message_block_size);
+    }
+}
+polling_group::~polling_group() {
+    unique_lock<mutex> lock(ready_for_block_connections_lock);
+    for(auto& connection : rfb_connections) {
+        connection.second->num_groups--;
+    }
+}
+void polling_group::receive_ready_for_block(uint32_t slices, uint32_t sender_node) {
     unique_lock<mutex> lock(monitor);
 
-#ifdef USE_VERBS_API
-    auto it = rfb_queue_pairs.find(sender);
-    assert(it != rfb_queue_pairs.end());
-#else
-    auto it = rfb_endpoints.find(sender);
-    assert(it != rfb_endpoints.end());
-#endif
-    it->second.post_empty_recv(form_tag(group_number, sender),
-                               message_types.ready_for_block);
-
-    receivers_ready.insert(sender);
+    const uint32_t sender = find(members.begin(), members.end(), sender_node) - members.begin();
+    if(sender == num_members) {
+        return;
+    }
+    receivers_ready[sender].push_back(slices);
 
     if(!sending && mr) {
         send_next_block();
@@ -257,6 +322,10 @@ void polling_group::receive_ready_for_block(uint32_t step, uint32_t sender) {
 void polling_group::complete_block_send() {
     unique_lock<mutex> lock(monitor);
 
+    if(--pending_send_slices > 0) {
+        return;
+    }
+
     LOG_EVENT(group_number, message_number, outgoing_block,
               "finished_sending_block");
 
@@ -286,8 +355,10 @@ void polling_group::send_message(shared_ptr<memory_region> message_mr, size_t of
     mr = message_mr;
     mr_offset = offset;
     message_size = length;
-    num_blocks = (message_size - 1) / block_size + 1;
-    if(num_blocks > std::numeric_limits<uint16_t>::max())
+    block_size_shift = choose_block_size_shift(length);
+    message_block_size = block_size >> block_size_shift;
+    num_blocks = (message_size - 1) / message_block_size + 1;
+    if(num_blocks > MAX_MESSAGE_BLOCKS)
         throw rdmc::invalid_args();
     // printf("message_size = %lu, block_size = %lu, num_blocks = %lu\n",
     //        message_size, block_size, num_blocks);
@@ -297,6 +368,31 @@ void polling_group::send_message(shared_ptr<memory_region> message_mr, size_t of
     // No need to worry about completion here. We must send at least
     // one block, so we can't be done already.
 }
+uint32_t polling_group::choose_block_size_shift(size_t length) const {
+    if(block_overhead == 0) {
+        return 0;
+    }
+    // Only consider block sizes that divide block_size, so a message never
+    // needs more room than it would in blocks of block_size
+    uint32_t best_shift = 0;
+    uint64_t best_cost = 0;
+    for(uint32_t shift = 0; shift <= MAX_BLOCK_SIZE_SHIFT && block_size % (1ull << shift) == 0; ++shift) {
+        const size_t candidate_size = block_size >> shift;
+        const size_t candidate_blocks = (length - 1) / candidate_size + 1;
+        if(candidate_blocks > MAX_MESSAGE_BLOCKS) {
+            break;
+        }
+        // Every step takes about as long as its block plus the overhead, so
+        // this trades pipeline depth for per-block overhead
+        const uint64_t cost = transfer_schedule->get_total_steps(candidate_blocks)
+                              * (min(candidate_size, length) + block_overhead);
+        if(shift == 0 || cost < best_cost) {
+            best_shift = shift;
+            best_cost = cost;
+        }
+    }
+    return best_shift;
+}
 void polling_group::send_next_block() {
     sending = false;
     if(send_step == transfer_schedule->get_total_steps(num_blocks)) {
@@ -315,46 +411,45 @@ void polling_group::send_next_block() {
 
     if(member_index > 0 && !received_blocks[block_number]) return;
 
-    if(receivers_ready.count(transfer->target) == 0) {
+    auto ready = receivers_ready.find(transfer->target);
+    if(ready == receivers_ready.end() || ready->second.empty()) {
         LOG_EVENT(group_number, message_number, block_number,
                   "receiver_not_ready");
         return;
     }
 
-    receivers_ready.erase(transfer->target);
+    const uint32_t slices = ready->second.front();
+    ready->second.pop_front();
     sending = true;
     ++send_step;
 
     // printf("sending block #%d to node #%d on step %d\n", (int)block_number,
     // 	   (int)target, (int)send_step-1);
     // fflush(stdout);
-#ifdef USE_VERBS_API
-    auto it = queue_pairs.find(target);
-    assert(it != queue_pairs.end());
-#else
-    auto it = endpoints.find(target);
-    assert(it != endpoints.end());
-#endif
-    if(first_block_number && block_number == *first_block_number) {
-        CHECK(it->second.post_send(*first_block_mr, 0, block_size,
-                                   form_tag(group_number, target),
-                                   form_immediate(num_blocks, block_number),
-                                   message_types.data_block));
-    } else {
-        size_t offset = block_number * block_size;
-        size_t nbytes = min(block_size, message_size - offset);
-        CHECK(it->second.post_send(*mr, mr_offset + offset, nbytes,
-                                   form_tag(group_number, target),
-                                   form_immediate(num_blocks, block_number),
-                                   message_types.data_block));
+    const bool from_first_block = first_block_number && block_number == *first_block_number;
+    const memory_region& source = from_first_block ? *first_block_mr : *mr;
+    const size_t offset = block_number * message_block_size;
+    const size_t source_offset = from_first_block ? 0 : mr_offset + offset;
+    const size_t nbytes = min(message_block_size, message_size - offset);
+    // Slices past the end of a short last block are sent empty, since the
+    // receiver has a receive posted for each one
+    const size_t slice = slices == 1 ? nbytes : slice_size();
+    pending_send_slices = slices;
+    for(uint32_t rail = 0; rail < slices; ++rail) {
+        const size_t start = min(nbytes, rail * slice);
+        CHECK(data_connection(target, rail).post_send(source, source_offset + start,
+                                                      min(slice, nbytes - start),
+                                                      form_tag(group_number, target),
+                                                      form_immediate(num_blocks, block_number, block_size_shift),
+                                                      message_types.data_block));
     }
     outgoing_block = block_number;
     LOG_EVENT(group_number, message_number, block_number,
               "started_sending_block");
 }
 void polling_group::complete_message() {
-    // remap first_block into buffer
-    if(member_index > 0 && first_block_number) {
+    // remap first_block into buffer, unless it was copied when it arrived
+    if(member_index > 0 && first_block_number && !progress_callback) {
         LOG_EVENT(group_number, message_number, *first_block_number,
                   "starting_remap_first_block");
         // if(block_size > (128 << 10) && (block_size % 4096 == 0)) {
@@ -370,8 +465,10 @@ void polling_group::complete_message() {
         //            buffer + block_size * (*first_block_number));
         //     first_block_buffer = tmp_buffer;
         // } else {
-        memcpy(mr->buffer + mr_offset + block_size * (*first_block_number),
-               first_block_buffer.get(), block_size);
+        const size_t first_block_offset = message_block_size * (*first_block_number);
+        // The destination may be in GPU memory
+        mr->copy_from_host(mr_offset + first_block_offset,
+                           first_block_mr->buffer, min(message_block_size, message_size - first_block_offset));
         // }
         LOG_EVENT(group_number, message_number, *first_block_number,
                   "finished_remap_first_block");
@@ -382,6 +479,8 @@ void polling_group::complete_message() {
     sending = false;
     send_step = 0;
     receive_step = 0;
+    posted_transfers.clear();
+    progressed_blocks = 0;
     mr.reset();
     // if(first_block_buffer == nullptr && member_index > 0){
     //     first_block_buffer = (char*)mmap(NULL, block_size,
@@ -399,75 +498,130 @@ void polling_group::complete_message() {
         assert(transfer);
         first_block_number = transfer->block_number;
         post_recv(*transfer);
-        incoming_block = transfer->block_number;
-        send_ready_for_block(transfer->target);
+        send_ready_for_block(transfer->target, 1);
         // cout << "Issued Ready For Block DDDDDDD (target = " <<
         // transfer->target
         //      << ")" << endl;
     }
 }
-void polling_group::post_recv(schedule::block_transfer transfer) {
 #ifdef USE_VERBS_API
-    auto it = queue_pairs.find(transfer.target);
+rdma::queue_pair& polling_group::data_connection(size_t neighbor, uint32_t rail) {
+    assert(rail == 0);
+    auto it = queue_pairs.find(neighbor);
     assert(it != queue_pairs.end());
-#else 
-    auto it = endpoints.find(transfer.target);
-    assert(it != endpoints.end());
+    return it->second;
+}
+#else
+rdma::endpoint& polling_group::data_connection(size_t neighbor, uint32_t rail) {
+    auto it = endpoints.find(neighbor);
+    assert(it != endpoints.end() && rail < it->second.size());
+    return it->second[rail];
+}
 #endif
+void polling_group::post_recv(schedule::block_transfer transfer) {
     // printf("Posting receive buffer for block #%d from node #%d\n",
     //        (int)transfer.block_number, (int)transfer.target);
     // fflush(stdout);
 
     if(first_block_number && transfer.block_number == *first_block_number) {
-        CHECK(it->second.post_recv(*first_block_mr, 0, block_size,
-                                   form_tag(group_number, transfer.target),
-                                   message_types.data_block));
+        CHECK(data_connection(transfer.target, 0).post_recv(*first_block_mr, 0, block_size,
+                                                            form_tag(group_number, transfer.target),
+                                                            message_types.data_block));
     } else {
-        size_t offset = block_size * transfer.block_number;
-        size_t length = min(block_size, (size_t)(message_size - offset));
+        size_t offset = message_block_size * transfer.block_number;
+        size_t length = min(message_block_size, (size_t)(message_size - offset));
 
         if(length > 0) {
-            CHECK(it->second.post_recv(*mr, mr_offset + offset, length,
-                                       form_tag(group_number, transfer.target),
-                                       message_types.data_block));
+            const size_t slice = slice_size();
+            for(uint32_t rail = 0; rail < num_rails; ++rail) {
+                const size_t start = min(length, rail * slice);
+                CHECK(data_connection(transfer.target, rail).post_recv(*mr, mr_offset + offset + start,
+                                                                       min(slice, length - start),
+                                                                       form_tag(group_number, transfer.target),
+                                                                       message_types.data_block));
+            }
         }
     }
     LOG_EVENT(group_number, message_number, transfer.block_number,
               "posted_receive_buffer");
 }
 void polling_group::connect(uint32_t neighbor) {
+    // The ready-for-block connection comes first, so that the peer has
+    // posted its receive for this group by the time the data connection's
+    // handshake completes
+    connect_ready_for_block(neighbor);
 #ifdef USE_VERBS_API
-    queue_pairs.emplace(neighbor, queue_pair(members[neighbor]));
-    
-    auto post_recv = [this, neighbor](rdma::queue_pair* qp) {
-        qp->post_empty_recv(form_tag(group_number, neighbor),
-                            message_types.ready_for_block);
-    };
-
-    rfb_queue_pairs.emplace(neighbor, endpoint(members[neighbor], post_recv));
+    queue_pair qp(members[neighbor]);
+    // The neighbors are connected in parallel
+    unique_lock<mutex> lock(monitor);
+    queue_pairs.emplace(neighbor, std::move(qp));
 #else
     // Decide whether the endpoint will act as a server in the connection
     bool is_lf_server = members[member_index] < members[neighbor];
-    endpoints.emplace(neighbor, endpoint(members[neighbor], is_lf_server));
-    
-    auto post_recv = [this, neighbor](rdma::endpoint* ep) {
-        ep->post_empty_recv(form_tag(group_number, neighbor),
-                            message_types.ready_for_block);
-    };
-
-    rfb_endpoints.emplace(neighbor, endpoint(members[neighbor], is_lf_server, post_recv));
+    vector<endpoint> rails;
+    for(uint32_t rail = 0; rail < num_rails; ++rail) {
+        rails.emplace_back(members[neighbor], is_lf_server, [](rdma::endpoint*) {}, rail);
+    }
+    // The neighbors are connected in parallel
+    unique_lock<mutex> lock(monitor);
+    endpoints.emplace(neighbor, std::move(rails));
 #endif
 }
-
-void polling_group::send_ready_for_block(uint32_t neighbor) {
+void polling_group::connect_ready_for_block(uint32_t neighbor) {
+    const uint32_t node_id = members[neighbor];
+    unique_lock<mutex> lock(ready_for_block_connections_lock);
+    auto it = ready_for_block_connections.find(node_id);
+    if(it == ready_for_block_connections.end()) {
+        // Both nodes make the connection in the first group they share, as
+        // groups are created in the same order everywhere. The handshake
+        // waits for the peer, so don't hold up other peers' receives meanwhile.
+        lock.unlock();
 #ifdef USE_VERBS_API
-    auto it = rfb_queue_pairs.find(neighbor);
-    assert(it != rfb_queue_pairs.end());
+        auto post_recv = [node_id](rdma::queue_pair* qp) {
+            qp->post_empty_recv(form_tag(0, node_id), message_types.ready_for_block);
+        };
+        shared_ptr<ready_for_block_connection> connection(
+                new ready_for_block_connection{queue_pair(node_id, post_recv)});
 #else
-    auto it = rfb_endpoints.find(neighbor);
-    assert(it != rfb_endpoints.end());
+        bool is_lf_server = members[member_index] < node_id;
+        auto post_recv = [node_id](rdma::endpoint* ep) {
+            ep->post_empty_recv(form_tag(0, node_id), message_types.ready_for_block);
+        };
+        shared_ptr<ready_for_block_connection> connection(
+                new ready_for_block_connection{endpoint(node_id, is_lf_server, post_recv)});
 #endif
+        lock.lock();
+        it = ready_for_block_connections.emplace(node_id, std::move(connection)).first;
+    }
+    shared_ptr<ready_for_block_connection>& connection = it->second;
+    // The peer may tell this group it is ready for up to block_credits
+    // blocks before any of those messages are taken off the connection
+    connection->num_groups++;
+    while(connection->posted_receives < connection->num_groups * block_credits) {
+        connection->connection.post_empty_recv(form_tag(0, node_id), message_types.ready_for_block);
+        connection->posted_receives++;
+    }
+    rfb_connections.emplace(neighbor, connection);
+}
+void polling_group::repost_ready_for_block_receive(uint32_t node_id) {
+    unique_lock<mutex> lock(ready_for_block_connections_lock);
+    auto it = ready_for_block_connections.find(node_id);
+    if(it != ready_for_block_connections.end()) {
+        it->second->connection.post_empty_recv(form_tag(0, node_id), message_types.ready_for_block);
+    }
+}
+void polling_group::remove_peer(uint32_t node_id) {
+    unique_lock<mutex> lock(ready_for_block_connections_lock);
+    ready_for_block_connections.erase(node_id);
+}
+
+void polling_group::send_ready_for_block(uint32_t neighbor, uint32_t slices) {
+    auto it = rfb_connections.find(neighbor);
+    assert(it != rfb_connections.end());
 
-    it->second.post_empty_send(form_tag(group_number, neighbor), 0,
-                               message_types.ready_for_block);
+    // The immediate tells the sender which group this is for, and how many
+    // slices to send the block in
+    it->second->connection.post_empty_send(form_tag(group_number, neighbor),
+                                           form_ready_immediate(group_number, slices),
+                                           message_types.ready_for_block);
 }
@@ -11,20 +11,23 @@
     #include "lf_helper.h"
 #endif
 
+#include <deque>
 #include <optional>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <set>
 #include <vector>
 
 using rdmc::completion_callback_t;
 using rdmc::incoming_message_callback_t;
+using rdmc::progress_callback_t;
 using std::map;
 using std::unique_ptr;
 using std::vector;
 using std::optional;
 
+struct ready_for_block_connection;
+
 class group {
 protected:
     const vector<uint32_t> members;  // first element is the sender
@@ -54,8 +57,8 @@ protected:
 public:
     virtual ~group();
 
-    virtual void receive_block(uint32_t send_imm, size_t size) = 0;
-    virtual void receive_ready_for_block(uint32_t step, uint32_t sender) = 0;
+    virtual void receive_block(uint32_t send_imm, size_t size, uint32_t sender) = 0;
+    virtual void receive_ready_for_block(uint32_t slices, uint32_t sender_node) = 0;
     virtual void complete_block_send() = 0;
     virtual void send_message(std::shared_ptr<rdma::memory_region> message_mr,
                               size_t offset, size_t length)
@@ -64,16 +67,36 @@ public:
 
 class polling_group : public group {
 private:
-    // Set of receivers who are ready to receive the next block from us.
-    std::set<uint32_t> receivers_ready;
+    // Receivers who are ready to receive blocks from us, mapped to the
+    // number of slices they want each of those blocks in, in the order they
+    // will be sent.
+    map<uint32_t, std::deque<uint32_t>> receivers_ready;
 
     unique_ptr<rdma::memory_region> first_block_mr;
     optional<size_t> first_block_number;
-    unique_ptr<char[]> first_block_buffer;
 
-    size_t incoming_block;
     size_t message_number = 0;
 
+    /** What each step of a schedule costs besides moving its block, as the
+     * number of bytes that take as long to send; 0 disables block size tuning */
+    const size_t block_overhead;
+    /** The current message's blocks are block_size >> block_size_shift bytes */
+    uint32_t block_size_shift = 0;
+    size_t message_block_size;
+    /** The number of rails (NICs or ports) that each block is striped across,
+     * one slice per rail. A receiver gets the first block of a message whole
+     * on rail 0, since it doesn't know the block's size until it arrives. */
+    const uint32_t num_rails;
+    /** The number of its upcoming blocks a receiver tells their senders it
+     * is ready for at once; 1 with several rails, whose slices could
+     * otherwise arrive interleaved with those of the next block */
+    const uint32_t block_credits;
+    /** Slices of the outgoing block that haven't finished sending yet */
+    uint32_t pending_send_slices = 0;
+    /** Slices of the incoming block that have arrived so far, and their size */
+    uint32_t received_slices = 0;
+    size_t received_slice_bytes = 0;
+
     size_t outgoing_block;
     bool sending = false;  // Whether a block send is in progress
     size_t send_step = 0;  // Number of blocks sent/stalls so far
@@ -83,15 +106,26 @@ private:
     size_t num_received_blocks = 0;
     size_t receive_step = 0;
     vector<bool> received_blocks;
+    // Called as the run of received blocks from the start of a message
+    // grows, if set, and the length of that run so far
+    progress_callback_t progress_callback;
+    size_t progressed_blocks = 0;
+    // The incoming transfers whose receives are posted, in step order, each
+    // with whether its sender has been told we are ready for it. A
+    // connection's receives complete in the order they were posted, so a
+    // block from a sender is that sender's earliest transfer here.
+    std::deque<std::pair<schedule::block_transfer, bool>> posted_transfers;
 
     // maps from member_indices to the queue pairs
 #ifdef USE_VERBS_API
     map<size_t, rdma::queue_pair> queue_pairs;
-    map<size_t, rdma::queue_pair> rfb_queue_pairs;
 #else
-    map<size_t, rdma::endpoint> endpoints;
-    map<size_t, rdma::endpoint> rfb_endpoints;
+    // one data endpoint per rail
+    map<size_t, vector<rdma::endpoint>> endpoints;
 #endif
+    // the connections for ready-for-block messages, which are shared with
+    // every other group that has the same neighbor
+    map<size_t, std::shared_ptr<ready_for_block_connection>> rfb_connections;
     static struct {
         rdma::message_type data_block;
         rdma::message_type ready_for_block;
@@ -99,27 +133,53 @@ private:
 
 public:
     static void initialize_message_types();
+    /** Drops the ready-for-block connection to a node that has left, so that
+     * a new one is made if it rejoins. */
+    static void remove_peer(uint32_t node_id);
 
     polling_group(uint16_t group_number, size_t block_size,
                   vector<uint32_t> members, uint32_t member_index,
                   incoming_message_callback_t upcall,
                   completion_callback_t callback,
-                  unique_ptr<schedule> transfer_schedule);
-
-    virtual void receive_block(uint32_t send_imm, size_t size);
-    virtual void receive_ready_for_block(uint32_t step, uint32_t sender);
+                  unique_ptr<schedule> transfer_schedule,
+                  size_t block_overhead = 0,
+                  uint32_t block_credits = 1,
+                  progress_callback_t progress_callback = nullptr);
+    virtual ~polling_group();
+
+    virtual void receive_block(uint32_t send_imm, size_t size, uint32_t sender);
+    virtual void receive_ready_for_block(uint32_t slices, uint32_t sender_node);
     virtual void complete_block_send();
 
     virtual void send_message(std::shared_ptr<rdma::memory_region> message_mr,
                               size_t offset, size_t length);
 
 private:
+    /** Picks the block size that should deliver a message of this length
+     * soonest under the schedule's step count, as a shift of block_size. */
+    uint32_t choose_block_size_shift(size_t length) const;
+    /** The size of the slices that the current message's blocks are split into */
+    size_t slice_size() const { return (message_block_size - 1) / num_rails + 1; }
+#ifdef USE_VERBS_API
+    rdma::queue_pair& data_connection(size_t neighbor, uint32_t rail);
+#else
+    rdma::endpoint& data_connection(size_t neighbor, uint32_t rail);
+#endif
     void post_recv(schedule::block_transfer transfer);
+    /** Posts receives for the next incoming transfers from receive_step on,
+     * one more than block_credits of them, and tells the senders of the
+     * first block_credits that we are ready for them. */
+    void post_incoming_transfers();
+    /** Calls progress_callback if the run of received blocks from the start
+     * of the message has grown */
+    void report_progress();
     void send_next_block();
     void complete_message();
     void prepare_for_next_message();
-    void send_ready_for_block(uint32_t neighbor);
+    void send_ready_for_block(uint32_t neighbor, uint32_t slices);
+    static void repost_ready_for_block_receive(uint32_t node_id);
     void connect(uint32_t neighbor);
+    void connect_ready_for_block(uint32_t neighbor);
 };
 
 #endif /* GROUP_SEND_H */
@@ -1,4 +1,5 @@
 #include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -15,10 +16,16 @@
 #include <rdma/fi_rma.h>
 #include <rdma/fi_endpoint.h>
 #include <rdma/fi_domain.h>
+#ifdef USE_CUDA
+#include <cuda_runtime_api.h>
+#endif
 
+#include "conf/affinity.hpp"
+#include "conf/completion_poller.hpp"
 #include "conf/conf.hpp"
 #include "derecho/connection_manager.h"
 #include "lf_helper.h"
+#include "tcp/emulation.h"
 #include "tcp/tcp.h"
 #include "util.h"
 
@@ -121,6 +128,7 @@ enum NextOnFailure{
 struct cm_con_data_t {
     uint32_t  pep_addr_len;               /** local endpoint address length */
     char      pep_addr[MAX_LF_ADDR_SIZE]; /** local endpoint address */
+    uint64_t  recv_tag;                   /** in RDM mode, the tag to send to the local endpoint with */
 } __attribute__((packed));
 
 /** 
@@ -128,6 +136,19 @@ struct cm_con_data_t {
  */
 tcp::tcp_connections *rdmc_connections;
 
+/**
+ * The Groups of a process share the rails, their polling threads and the
+ * registration cache, so lf_initialize() only opens them for the first one
+ * and lf_destroy() only releases them after the last one.
+ */
+static std::mutex lf_users_mutex;
+static uint32_t num_lf_users = 0;
+/**
+ * The number of Groups each remote node is a member of, which all share its
+ * TCP connection
+ */
+static std::map<uint32_t, uint32_t> node_users;
+
 /** 
  * Listener to detect new incoming connections 
  */
@@ -157,13 +178,67 @@ struct lf_ctxt {
     struct fid_eq      * peq;             /** event queue for connection management */
     // struct fid_eq      * eq;              /** event queue for transmitting events */ : moved to resources.
     struct fid_cq      * cq;              /** completion queue for all rma operations */
+    struct fid_ep      * rdm_ep;          /** in RDM mode, the endpoint for all remote nodes */
+    struct fid_av      * av;              /** in RDM mode, the address vector of rdm_ep */
     size_t             pep_addr_len;      /** length of local pep address */
-    char               pep_addr[MAX_LF_ADDR_SIZE]; /** local pep address */
+    char               pep_addr[MAX_LF_ADDR_SIZE]; /** local pep address, or the address of rdm_ep */
     struct fi_eq_attr  eq_attr;           /** event queue attributes */
     struct fi_cq_attr  cq_attr;           /** completion queue attributes */
 };
-/** The global context for libfabric */
+/** The global context for libfabric, which is also the context of rail 0 */
 struct lf_ctxt g_ctxt;
+/** The contexts of the extra rails from CONF_RDMA_EXTRA_DOMAINS, which each
+ * have their own domain, passive endpoint and completion queue */
+static vector<lf_ctxt> g_extra_rails;
+
+static lf_ctxt& rail_ctxt(uint32_t rail) {
+    return rail == 0 ? g_ctxt : g_extra_rails[rail - 1];
+}
+
+/** Whether each rail reaches all remote nodes through one reliable datagram
+ * endpoint (CONF_RDMA_RDM_ENDPOINT) instead of an endpoint per connection */
+static bool rdm_mode = false;
+/** In RDM mode, the tag the next endpoint receives its messages with. The
+ * endpoints to a node share the RDM endpoint, so the tags keep their
+ * messages apart. */
+static atomic<uint64_t> next_recv_tag{1};
+/** In RDM mode, maps (rail, node ID) to the endpoint address of the node on
+ * the rail and the entry it was inserted as in the rail's address vector */
+static map<pair<uint32_t, uint32_t>, pair<string, fi_addr_t>> rdm_peers;
+static std::mutex rdm_peers_mutex;
+/** Whether RDMA is emulated over TCP (RDMA/provider = tcp_emulation), in
+ * which case no rail is opened, and the emulation thread calls the
+ * completion handlers instead of the polling threads */
+static bool tcp_mode = false;
+/** The ID of this node, which clients send along with their connection
+ * requests so that the server knows whose request it is */
+static uint32_t my_node_id;
+/** Connection requests read from a rail's passive event queue whose server
+ * side hasn't picked them up yet, by rail and client node ID. Endpoints are
+ * connected in parallel, so the one thread reading a passive event queue at a
+ * time hands out the requests for the others. */
+static multimap<pair<uint32_t, uint32_t>, struct fi_info *> pending_connreqs;
+static std::mutex connreq_mutex;
+static std::condition_variable connreq_cv;
+static vector<bool> reading_connreqs;
+
+/** Get the address vector entry of a remote node's RDM endpoint on a rail,
+ * inserting it the first time, or again if the node came back with a new
+ * address */
+static fi_addr_t rdm_peer_addr(uint32_t rail, uint32_t node_id, const char *addr, size_t addr_len) {
+    const string name(addr, addr_len);
+    std::lock_guard<std::mutex> lock(rdm_peers_mutex);
+    auto it = rdm_peers.find({rail, node_id});
+    if (it != rdm_peers.end() && it->second.first == name) {
+        return it->second.second;
+    }
+    fi_addr_t fi_addr;
+    if (fi_av_insert(rail_ctxt(rail).av, addr, 1, &fi_addr, 0, NULL) != 1) {
+        CRASH_WITH_MESSAGE("Failed to insert the address of node %u into the address vector.\n", node_id);
+    }
+    rdm_peers[{rail, node_id}] = {name, fi_addr};
+    return fi_addr;
+}
 
 #define LF_USE_VADDR ((g_ctxt.fi->domain_attr->mr_mode) & (FI_MR_VIRT_ADDR | FI_MR_BASIC))
 #define LF_CONFIG_FILE "rdma.cfg"
@@ -177,54 +252,128 @@ enum RDMAOps {
 #define OP_BITS_MASK (0x00ff000000000000ull)
 #define EXTRACT_RDMA_OP_CODE(x) ((uint8_t)((((uint64_t)x) & OP_BITS_MASK) >> OP_BITS_SHIFT))
 
+/**
+ * Calls the handler for a completion, found from the message type and the
+ * operation encoded in its context. The caller holds completion_handlers_mutex.
+ */
+static void dispatch_completion(uint64_t op_context, uint32_t immediate, size_t length) {
+    message_type::tag_type type = op_context >> message_type::shift_bits;
+    if (type == std::numeric_limits<message_type::tag_type>::max())
+        return;
+
+    uint64_t masked_wr_id = op_context & 0x0000ffffffffffffull;
+    uint32_t opcode = (uint32_t)EXTRACT_RDMA_OP_CODE(op_context);
+    if (type >= completion_handlers.size()) {
+        // Unrecognized message type
+    } else if (opcode == RDMA_OP_SEND) {
+        completion_handlers[type].send(masked_wr_id, immediate, length);
+    } else if (opcode == RDMA_OP_RECV) {
+        completion_handlers[type].recv(masked_wr_id, immediate, length);
+    } else if (opcode == RDMA_OP_WRITE) {
+        completion_handlers[type].write(masked_wr_id, immediate, length);
+    } else {
+        puts("Sent unrecognized completion type?!");
+    }
+}
+
+/** Waits for the connection request of a remote node on a rail's passive endpoint */
+static struct fi_info *wait_for_connreq(uint32_t rail, uint32_t remote_id) {
+    std::unique_lock<std::mutex> lock(connreq_mutex);
+    if (reading_connreqs.size() <= rail) {
+        reading_connreqs.resize(rail + 1, false);
+    }
+    while (true) {
+        auto it = pending_connreqs.find({rail, remote_id});
+        if (it != pending_connreqs.end()) {
+            struct fi_info *info = it->second;
+            pending_connreqs.erase(it);
+            return info;
+        }
+        if (reading_connreqs[rail]) {
+            connreq_cv.wait(lock);
+            continue;
+        }
+        reading_connreqs[rail] = true;
+        lock.unlock();
+        alignas(struct fi_eq_cm_entry) char buf[sizeof(struct fi_eq_cm_entry) + sizeof(uint32_t)];
+        struct fi_eq_cm_entry *entry = (struct fi_eq_cm_entry *)buf;
+        uint32_t event;
+        ssize_t nRead = fi_eq_sread(rail_ctxt(rail).peq, &event, entry, sizeof(buf), -1, 0);
+        lock.lock();
+        reading_connreqs[rail] = false;
+        if (nRead < (ssize_t)sizeof(buf) || event != FI_CONNREQ) {
+            CRASH_WITH_MESSAGE("Failed to get connection from remote. nRead=%ld\n",nRead);
+        }
+        uint32_t client_id;
+        memcpy(&client_id, entry->data, sizeof(client_id));
+        pending_connreqs.emplace(make_pair(rail, ntohl(client_id)), entry->info);
+        connreq_cv.notify_all();
+    }
+}
+
 namespace impl {
 
 /** 
- * Populate some of the global context with default valus 
+ * Populate some of a rail's context with default valus 
  */
-static void default_context() {
-    memset((void*)&g_ctxt, 0, sizeof(struct lf_ctxt));
+static void default_context(lf_ctxt& ctxt, const string& domain) {
+    memset((void*)&ctxt, 0, sizeof(struct lf_ctxt));
     
     /** Create a new empty fi_info structure */
-    FAIL_IF_ZERO(g_ctxt.hints = fi_allocinfo(),"Fail to allocate fi hints",CRASH_ON_FAILURE);
+    FAIL_IF_ZERO(ctxt.hints = fi_allocinfo(),"Fail to allocate fi hints",CRASH_ON_FAILURE);
     /** Set the interface capabilities, see fi_getinfo(3) for details */
-    g_ctxt.hints->caps = FI_MSG | FI_RMA | FI_READ | FI_WRITE | 
-                         FI_REMOTE_READ | FI_REMOTE_WRITE;
+    ctxt.hints->caps = FI_MSG | FI_RMA | FI_READ | FI_WRITE | 
+                       FI_REMOTE_READ | FI_REMOTE_WRITE;
     /** Use connection-based endpoints */
-    g_ctxt.hints->ep_attr->type = FI_EP_MSG;
+    ctxt.hints->ep_attr->type = FI_EP_MSG;
     /** Enable all modes */
-    g_ctxt.hints->mode = ~0;
+    ctxt.hints->mode = ~0;
     /** Set the completion format to contain additional context */ 
-    g_ctxt.cq_attr.format = FI_CQ_FORMAT_DATA;
+    ctxt.cq_attr.format = FI_CQ_FORMAT_DATA;
     /** Use a file descriptor as the wait object (see polling_loop)*/
-    g_ctxt.cq_attr.wait_obj = FI_WAIT_UNSPEC; //FI_WAIT_FD;
+    ctxt.cq_attr.wait_obj = FI_WAIT_UNSPEC; //FI_WAIT_FD;
     /** Set the size of the local pep address */
-    g_ctxt.pep_addr_len = MAX_LF_ADDR_SIZE;
+    ctxt.pep_addr_len = MAX_LF_ADDR_SIZE;
 
     /** Set the provider, can be verbs|psm|sockets|usnic */
     FAIL_IF_ZERO(
-      g_ctxt.hints->fabric_attr->prov_name = strdup(derecho::getConfString(CONF_RDMA_PROVIDER).c_str()),
+      ctxt.hints->fabric_attr->prov_name = strdup(derecho::getConfString(CONF_RDMA_PROVIDER).c_str()),
       "strdup provider name.", CRASH_ON_FAILURE
     );
     /** Set the domain */
     FAIL_IF_ZERO(
-      g_ctxt.hints->domain_attr->name = strdup(derecho::getConfString(CONF_RDMA_DOMAIN).c_str()),
+      ctxt.hints->domain_attr->name = strdup(domain.c_str()),
       "strdup domain name.", CRASH_ON_FAILURE
     );
     /** Set the memory region mode mode bits, see fi_mr(3) for details */
-    if (strcmp(g_ctxt.hints->fabric_attr->prov_name,"sockets")==0) {
-      g_ctxt.hints->domain_attr->mr_mode = FI_MR_BASIC;
+    if (strcmp(ctxt.hints->fabric_attr->prov_name,"sockets")==0) {
+      ctxt.hints->domain_attr->mr_mode = FI_MR_BASIC;
     } else { // default
       /** Set the sizes of the tx and rx queues */
       FAIL_IF_ZERO(
-        g_ctxt.hints->tx_attr->size = derecho::Conf::get()->getInt32(CONF_RDMA_TX_DEPTH),
+        ctxt.hints->tx_attr->size = derecho::Conf::get()->getInt32(CONF_RDMA_TX_DEPTH),
         "get tx depth.", CRASH_ON_FAILURE
       );
       FAIL_IF_ZERO(
-        g_ctxt.hints->rx_attr->size = derecho::Conf::get()->getInt32(CONF_RDMA_RX_DEPTH),
+        ctxt.hints->rx_attr->size = derecho::Conf::get()->getInt32(CONF_RDMA_RX_DEPTH),
         "get rx depth.", CRASH_ON_FAILURE
       );
-      g_ctxt.hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_ALLOCATED | FI_MR_PROV_KEY | FI_MR_VIRT_ADDR;
+      ctxt.hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_ALLOCATED | FI_MR_PROV_KEY | FI_MR_VIRT_ADDR;
+#ifdef USE_CUDA
+      /** Allow memory regions over device memory (see fi_mr(3)) */
+      ctxt.hints->caps |= FI_HMEM;
+      ctxt.hints->domain_attr->mr_mode |= FI_MR_HMEM;
+#endif
+    }
+    if (rdm_mode) {
+      /** One endpoint serves every connection and thread; the connections
+       * to a node tell their messages apart by tag */
+      ctxt.hints->ep_attr->type = FI_EP_RDM;
+      ctxt.hints->caps |= FI_TAGGED;
+      ctxt.hints->domain_attr->threading = FI_THREAD_SAFE;
+      /** The op contexts encode the message type and are no fi_context the
+       * provider could use, which RDM providers such as efa may ask for */
+      ctxt.hints->mode &= ~(FI_CONTEXT | FI_CONTEXT2);
     }
 }
 }
@@ -234,30 +383,208 @@ static void default_context() {
  * Memory region constructors and member functions
  */
 
-memory_region::memory_region(size_t s) : memory_region(new char[s], s) {
-    allocated_buffer.reset(buffer);
-}
+struct mr_registration {
+    char *buffer;
+    size_t size;
+    /** Smart pointer for managing the registered memory region */
+    unique_ptr<fid_mr, std::function<void(fid_mr *)>> mr;
+    /** The registrations of the buffer in the domains of the extra rails,
+     * in rail order (see impl::lf_num_rails) */
+    vector<unique_ptr<fid_mr, std::function<void(fid_mr *)>>> rail_mrs;
+    /** The buffer, if the registration allocated it itself */
+    unique_ptr<char[]> allocated_buffer;
+    /** The key of the region if RDMA is emulated over TCP, in which case it
+     * is registered with the emulation and mr is null */
+    uint32_t emulated_key = 0;
+
+    mr_registration(char *buf, size_t s) : buffer(buf), size(s) {}
+    ~mr_registration() {
+        if (emulated_key) {
+            tcp::emulation::deregister_region(emulated_key);
+        }
+    }
+};
 
-memory_region::memory_region(char *buf, size_t s) : buffer(buf), size(s) {
-    if (!buffer || size <= 0) throw rdma::invalid_args();
+/** The registrations in use, by the start of their buffer */
+static map<char *, weak_ptr<mr_registration>> live_registrations;
+/** Registrations of buffers they allocated themselves that no region uses
+ * any more, by size. Never destroyed, as the domains outlive it. */
+static multimap<size_t, unique_ptr<mr_registration>> &idle_registrations =
+        *new multimap<size_t, unique_ptr<mr_registration>>;
+static size_t idle_bytes = 0;
+static std::mutex registrations_mutex;
+
+/** Registers reg's buffer in every rail's domain, or with the emulation */
+static void register_buffer(mr_registration &reg) {
+    if (tcp_mode) {
+        reg.emulated_key = tcp::emulation::register_region(reg.buffer, reg.size);
+        return;
+    }
 
     const int mr_access = FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE;
  
     /** Register the memory, use it to construct a smart pointer */  
     fid_mr* raw_mr;
     FAIL_IF_NONZERO(
-        fi_mr_reg(g_ctxt.domain, (void *)buffer, size, mr_access, 
+        fi_mr_reg(g_ctxt.domain, (void *)reg.buffer, reg.size, mr_access, 
                   0, 0, 0, &raw_mr, nullptr),
         "Failed to register memory", CRASH_ON_FAILURE
     );
     FAIL_IF_ZERO(raw_mr, "Pointer to memory region is null", CRASH_ON_FAILURE);
 
-    mr = unique_ptr<fid_mr, std::function<void(fid_mr *)>>(
+    reg.mr = unique_ptr<fid_mr, std::function<void(fid_mr *)>>(
         raw_mr, [](fid_mr *mr) { fi_close(&mr->fid); }
     ); 
+
+    for (const lf_ctxt &rail : g_extra_rails) {
+        FAIL_IF_NONZERO(
+            fi_mr_reg(rail.domain, (void *)reg.buffer, reg.size, mr_access,
+                      0, 0, 0, &raw_mr, nullptr),
+            "Failed to register memory on an extra rail", CRASH_ON_FAILURE
+        );
+        FAIL_IF_ZERO(raw_mr, "Pointer to memory region is null", CRASH_ON_FAILURE);
+        reg.rail_mrs.emplace_back(raw_mr, [](fid_mr *mr) { fi_close(&mr->fid); });
+    }
 }
 
-uint64_t memory_region::get_key() const { return mr->key; }
+/**
+ * Called when the last region using reg goes away. A registration of a
+ * buffer it allocated itself goes to the idle list if that stays within
+ * RDMA/mr_cache_size; anything else is deregistered.
+ */
+static void release_registration(mr_registration *reg) {
+    unique_ptr<mr_registration> released(reg);
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    auto live = live_registrations.find(reg->buffer);
+    if (live != live_registrations.end() && live->second.expired()) {
+        live_registrations.erase(live);
+    }
+    if (reg->allocated_buffer
+        && idle_bytes + reg->size <= derecho::getConfUInt64(CONF_RDMA_MR_CACHE_SIZE)) {
+        idle_bytes += reg->size;
+        idle_registrations.emplace(reg->size, std::move(released));
+    }
+}
+
+/** Makes reg the registration that later regions over its buffer share */
+static shared_ptr<mr_registration> make_live(unique_ptr<mr_registration> reg) {
+    shared_ptr<mr_registration> shared(reg.release(), release_registration);
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    live_registrations[shared->buffer] = shared;
+    return shared;
+}
+
+/** Returns a live registration that covers size bytes at buf, or null. If
+ * remote nodes address a region by its offset rather than by virtual
+ * address, the registration must also start at buf. */
+static shared_ptr<mr_registration> find_live(char *buf, size_t size) {
+    std::lock_guard<std::mutex> lock(registrations_mutex);
+    auto it = live_registrations.upper_bound(buf);
+    if (it == live_registrations.begin()) return nullptr;
+    shared_ptr<mr_registration> reg = (--it)->second.lock();
+    if (!reg || buf + size > reg->buffer + reg->size) return nullptr;
+    if (reg->buffer != buf && (tcp_mode || !LF_USE_VADDR)) return nullptr;
+    return reg;
+}
+
+/** Returns a registration of a buffer of size bytes that it allocated
+ * itself, taken from the idle list if there is one of that size */
+static shared_ptr<mr_registration> acquire_allocated(size_t size) {
+    if (size <= 0) throw rdma::invalid_args();
+
+    unique_ptr<mr_registration> reg;
+    {
+        std::lock_guard<std::mutex> lock(registrations_mutex);
+        auto it = idle_registrations.find(size);
+        if (it != idle_registrations.end()) {
+            reg = std::move(it->second);
+            idle_registrations.erase(it);
+            idle_bytes -= size;
+        }
+    }
+    if (!reg) {
+        reg = make_unique<mr_registration>(new char[size], size);
+        reg->allocated_buffer.reset(reg->buffer);
+        register_buffer(*reg);
+    }
+    return make_live(std::move(reg));
+}
+
+memory_region::memory_region(shared_ptr<mr_registration> r)
+        : reg(std::move(r)), buffer(reg->buffer), size(reg->size), cuda_device(-1) {}
+
+memory_region::memory_region(size_t s) : memory_region(acquire_allocated(s)) {}
+
+memory_region::memory_region(char *buf, size_t s) : buffer(buf), size(s), cuda_device(-1) {
+    if (!buffer || size <= 0) throw rdma::invalid_args();
+
+    reg = find_live(buffer, size);
+    if (!reg) {
+        auto new_reg = make_unique<mr_registration>(buffer, size);
+        register_buffer(*new_reg);
+        reg = make_live(std::move(new_reg));
+    }
+}
+
+#ifdef USE_CUDA
+memory_region::memory_region(char *buf, size_t s, int device) : buffer(buf), size(s), cuda_device(device) {
+    if (!buffer || size <= 0 || cuda_device < 0) throw rdma::invalid_args();
+    /** The emulation thread can't copy to and from device memory */
+    if (tcp_mode) throw rdma::unsupported_feature();
+
+    iovec iov{buffer, size};
+    fi_mr_attr mr_attr;
+    memset(&mr_attr, 0, sizeof(mr_attr));
+    mr_attr.mr_iov = &iov;
+    mr_attr.iov_count = 1;
+    mr_attr.access = FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE;
+    mr_attr.iface = FI_HMEM_CUDA;
+    mr_attr.device.cuda = cuda_device;
+
+    /** Device memory is registered for this region alone, not cached */
+    reg = make_shared<mr_registration>(buffer, size);
+    fid_mr* raw_mr;
+    FAIL_IF_NONZERO(
+        fi_mr_regattr(g_ctxt.domain, &mr_attr, 0, &raw_mr),
+        "Failed to register device memory", CRASH_ON_FAILURE
+    );
+    FAIL_IF_ZERO(raw_mr, "Pointer to memory region is null", CRASH_ON_FAILURE);
+
+    reg->mr = unique_ptr<fid_mr, std::function<void(fid_mr *)>>(
+        raw_mr, [](fid_mr *mr) { fi_close(&mr->fid); }
+    );
+
+    for (const lf_ctxt &rail : g_extra_rails) {
+        FAIL_IF_NONZERO(
+            fi_mr_regattr(rail.domain, &mr_attr, 0, &raw_mr),
+            "Failed to register device memory on an extra rail", CRASH_ON_FAILURE
+        );
+        FAIL_IF_ZERO(raw_mr, "Pointer to memory region is null", CRASH_ON_FAILURE);
+        reg->rail_mrs.emplace_back(raw_mr, [](fid_mr *mr) { fi_close(&mr->fid); });
+    }
+}
+#endif
+
+void memory_region::copy_from_host(size_t offset, const char *source, size_t length) const {
+#ifdef USE_CUDA
+    if (cuda_device >= 0) {
+        FAIL_IF_NONZERO(
+            cudaMemcpy(buffer + offset, source, length, cudaMemcpyHostToDevice),
+            "Failed to copy into device memory", CRASH_ON_FAILURE
+        );
+        return;
+    }
+#endif
+    memcpy(buffer + offset, source, length);
+}
+
+memory_region::~memory_region() {}
+
+uint64_t memory_region::get_key() const { return reg->mr ? reg->mr->key : reg->emulated_key; }
+
+fid_mr* memory_region::get_mr(uint32_t rail) const {
+    return rail == 0 ? reg->mr.get() : reg->rail_mrs.at(rail - 1).get();
+}
 
 /** 
  * Completion queue constructor
@@ -280,16 +607,18 @@ endpoint::~endpoint() {}
 endpoint::endpoint(size_t remote_index, bool is_lf_server)
     : endpoint(remote_index, is_lf_server, [](endpoint *){}) {}
 endpoint::endpoint(size_t remote_index, bool is_lf_server,
-                   std::function<void(endpoint *)> post_recvs) { 
+                   std::function<void(endpoint *)> post_recvs, uint32_t rail)
+    : rail(rail) {
     connect(remote_index, is_lf_server, post_recvs); 
 }
 
 int endpoint::init(struct fi_info *fi) {
+    lf_ctxt &ctxt = rail_ctxt(rail);
     int ret;
     /** Open an endpoint */
     fid_ep* raw_ep;
     FAIL_IF_NONZERO(
-        ret = fi_endpoint(g_ctxt.domain, fi, &raw_ep, NULL), 
+        ret = fi_endpoint(ctxt.domain, fi, &raw_ep, NULL), 
         "Failed to open endpoint", REPORT_ON_FAILURE
     );
     if(ret) return ret;
@@ -306,7 +635,7 @@ int endpoint::init(struct fi_info *fi) {
     /** Create an event queue */
     fid_eq* raw_eq;
     FAIL_IF_NONZERO(
-        ret = fi_eq_open(g_ctxt.fabric, &g_ctxt.eq_attr, &raw_eq, NULL),
+        ret = fi_eq_open(ctxt.fabric, &ctxt.eq_attr, &raw_eq, NULL),
         "Failed to open event queue", REPORT_ON_FAILURE
     );
     if(ret) return ret;
@@ -323,7 +652,7 @@ int endpoint::init(struct fi_info *fi) {
     if(ret) return ret;
     const uint64_t ep_flags = FI_RECV | FI_TRANSMIT | FI_SELECTIVE_COMPLETION;
     FAIL_IF_NONZERO(
-        ret = fi_ep_bind(raw_ep, &(g_ctxt.cq)->fid, ep_flags), 
+        ret = fi_ep_bind(raw_ep, &(ctxt.cq)->fid, ep_flags), 
         "Failed to bind endpoint and tx completion queue", REPORT_ON_FAILURE
     );
     if(ret) return ret;
@@ -342,13 +671,35 @@ bool sync(uint32_t r_id) {
 
 void endpoint::connect(size_t remote_index, bool is_lf_server, 
                        std::function<void(endpoint *)> post_recvs) {
+    lf_ctxt &ctxt = rail_ctxt(rail);
     struct cm_con_data_t local_cm_data, remote_cm_data;
     memset(&local_cm_data, 0, sizeof(local_cm_data));
     memset(&remote_cm_data, 0, sizeof(remote_cm_data));
     
     /** Populate local cm struct and exchange cm info */    
-    local_cm_data.pep_addr_len  = (uint32_t)htonl((uint32_t)g_ctxt.pep_addr_len);
-    memcpy((void*)&local_cm_data.pep_addr, &g_ctxt.pep_addr, g_ctxt.pep_addr_len);
+    if (tcp_mode) {
+        /** The address is the emulation's port and the channel */
+        emulated_channel = tcp::emulation::create_channel([](const tcp::emulation::completion& c) {
+            if (!c.success) {
+                cout << "An emulated RDMA operation failed on a broken connection" << std::endl;
+                return;
+            }
+            std::lock_guard<std::mutex> l(completion_handlers_mutex);
+            dispatch_completion(c.context, c.immediate, c.length);
+        });
+        const uint16_t port = tcp::emulation::get_port();
+        const uint32_t channel_id = emulated_channel->get_id();
+        local_cm_data.pep_addr_len = (uint32_t)htonl((uint32_t)(sizeof(port) + sizeof(channel_id)));
+        memcpy(local_cm_data.pep_addr, &port, sizeof(port));
+        memcpy(local_cm_data.pep_addr + sizeof(port), &channel_id, sizeof(channel_id));
+    } else {
+        local_cm_data.pep_addr_len  = (uint32_t)htonl((uint32_t)ctxt.pep_addr_len);
+        memcpy((void*)&local_cm_data.pep_addr, &ctxt.pep_addr, ctxt.pep_addr_len);
+    }
+    if (rdm_mode) {
+        recv_tag = next_recv_tag++;
+        local_cm_data.recv_tag = htonll(recv_tag);
+    }
 
     FAIL_IF_ZERO(
         rdmc_connections->exchange(remote_index, local_cm_data, remote_cm_data),
@@ -362,25 +713,40 @@ void endpoint::connect(size_t remote_index, bool is_lf_server,
     struct fi_eq_cm_entry entry;
     uint32_t event;
 
-    if (is_lf_server) {
-        /** Synchronously read from the passive event queue, init the server ep */ 
-        nRead = fi_eq_sread(g_ctxt.peq, &event, &entry, sizeof(entry), -1, 0);
-        if(nRead != sizeof(entry)) {
-            CRASH_WITH_MESSAGE("Failed to get connection from remote. nRead=%ld\n",nRead);
+    if (tcp_mode) {
+        uint16_t remote_port;
+        uint32_t remote_channel;
+        memcpy(&remote_port, remote_cm_data.pep_addr, sizeof(remote_port));
+        memcpy(&remote_channel, remote_cm_data.pep_addr + sizeof(remote_port), sizeof(remote_channel));
+        const string remote_ip = rdmc_connections->get_socket(remote_index).get().get_remote_ip();
+        if (!emulated_channel->connect(remote_index, remote_ip, remote_port, remote_channel)) {
+            CRASH_WITH_MESSAGE("Failed to connect to remote node %lu over TCP.\n", remote_index);
         }
+    } else if (rdm_mode) {
+        /** There is nothing to connect: the remote node is an address of the
+         *  rail's endpoint, which is closed by the rail and not by us */
+        ep = unique_ptr<fid_ep, std::function<void(fid_ep *)>>(
+            ctxt.rdm_ep, [](fid_ep *) {}
+        );
+        remote_fi_addr = rdm_peer_addr(rail, remote_index, remote_cm_data.pep_addr,
+                                       remote_cm_data.pep_addr_len);
+        send_tag = ntohll(remote_cm_data.recv_tag);
+    } else if (is_lf_server) {
+        /** Wait for the client's request on the passive event queue, init the server ep */
+        entry.info = wait_for_connreq(rail, remote_index);
         if (init(entry.info)){
-            fi_reject(g_ctxt.pep, entry.info->handle, NULL, 0);
+            fi_reject(ctxt.pep, entry.info->handle, NULL, 0);
             fi_freeinfo(entry.info);
             CRASH_WITH_MESSAGE("Failed to initialize server endpoint.\n");
         }
         if (fi_accept(ep.get(), NULL, 0)){
-            fi_reject(g_ctxt.pep, entry.info->handle, NULL, 0);
+            fi_reject(ctxt.pep, entry.info->handle, NULL, 0);
             fi_freeinfo(entry.info);
             CRASH_WITH_MESSAGE("Failed to accept connection.\n");
         }
         fi_freeinfo(entry.info);
     } else {
-        struct fi_info * client_hints = fi_dupinfo(g_ctxt.hints);
+        struct fi_info * client_hints = fi_dupinfo(ctxt.hints);
         struct fi_info * client_info = NULL;
 
         /** TODO document this */    
@@ -403,8 +769,10 @@ void endpoint::connect(size_t remote_index, bool is_lf_server,
             fi_freeinfo(client_info);
             CRASH_WITH_MESSAGE("failed to initialize client endpoint.\n");
         }
+        /** Tell the server which node this is, see wait_for_connreq() */
+        const uint32_t client_id = htonl(my_node_id);
         FAIL_IF_NONZERO(
-            fi_connect(ep.get(), remote_cm_data.pep_addr, NULL, 0),
+            fi_connect(ep.get(), remote_cm_data.pep_addr, &client_id, sizeof(client_id)),
             "fi_connect() failed", CRASH_ON_FAILURE
         );
        
@@ -438,17 +806,13 @@ bool endpoint::post_send(const memory_region& mr, size_t offset, size_t size,
     msg_iov.iov_len  = size;
 
     msg.msg_iov   = &msg_iov;
-    msg.desc      = (void**)&mr.mr->key;
+    msg.desc      = tcp_mode ? nullptr : (void**)&mr.get_mr(rail)->key;
     msg.iov_count = 1;
-    msg.addr      = 0;
+    msg.addr      = remote_fi_addr;
     msg.context   = (void*)(wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_SEND) << OP_BITS_SHIFT);
     msg.data       = immediate;
  
-    FAIL_IF_NONZERO(
-        fi_sendmsg(ep.get(), &msg, FI_COMPLETION|FI_REMOTE_CQ_DATA),
-        "fi_sendmsg() failed", REPORT_ON_FAILURE
-    );
-    return true; 
+    return send_msg(msg);
 }
 
 bool endpoint::post_recv(const memory_region& mr, size_t offset, size_t size, 
@@ -460,16 +824,12 @@ bool endpoint::post_recv(const memory_region& mr, size_t offset, size_t size,
     msg_iov.iov_len  = size;
 
     msg.msg_iov   = &msg_iov;
-    msg.desc      = (void**)&mr.mr->key;
+    msg.desc      = tcp_mode ? nullptr : (void**)&mr.get_mr(rail)->key;
     msg.iov_count = 1;
-    msg.addr      = 0;
+    msg.addr      = remote_fi_addr;
     msg.context   = (void*)(wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_RECV) << OP_BITS_SHIFT); 
  
-    FAIL_IF_NONZERO(
-        fi_recvmsg(ep.get(), &msg, FI_COMPLETION),
-        "fi_recvmsg() failed", REPORT_ON_FAILURE
-    );
-    return true; 
+    return recv_msg(msg);
 }
 
 bool endpoint::post_empty_send(uint64_t wr_id, uint32_t immediate,
@@ -477,27 +837,81 @@ bool endpoint::post_empty_send(uint64_t wr_id, uint32_t immediate,
     struct fi_msg msg;
 
     memset(&msg, 0, sizeof(msg));
+    msg.addr    = remote_fi_addr;
     msg.context = (void*)(wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_SEND) << OP_BITS_SHIFT); 
     msg.data   = immediate;
  
-    FAIL_IF_NONZERO(
-        fi_sendmsg(ep.get(), &msg, FI_COMPLETION|FI_REMOTE_CQ_DATA),
-        "fi_sendmsg() failed", REPORT_ON_FAILURE
-    );
-    return true; 
+    return send_msg(msg);
 }
 
 bool endpoint::post_empty_recv(uint64_t wr_id, const message_type& type) {
     struct fi_msg msg;
 
     memset(&msg, 0, sizeof(msg));
+    msg.addr    = remote_fi_addr;
     msg.context = (void*)(wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_RECV) << OP_BITS_SHIFT);
  
+    return recv_msg(msg);
+}
+
+bool endpoint::send_msg(const struct fi_msg& msg) {
+    if (tcp_mode) {
+        return emulated_channel->post_send(
+            msg.iov_count ? (const char*)msg.msg_iov->iov_base : nullptr,
+            msg.iov_count ? msg.msg_iov->iov_len : 0,
+            (uint32_t)msg.data, (uint64_t)msg.context, true);
+    }
+    if (!rdm_mode) {
+        FAIL_IF_NONZERO(
+            fi_sendmsg(ep.get(), &msg, FI_COMPLETION|FI_REMOTE_CQ_DATA),
+            "fi_sendmsg() failed", REPORT_ON_FAILURE
+        );
+        return true;
+    }
+    struct fi_msg_tagged tmsg;
+    tmsg.msg_iov   = msg.msg_iov;
+    tmsg.desc      = msg.desc;
+    tmsg.iov_count = msg.iov_count;
+    tmsg.addr      = msg.addr;
+    tmsg.tag       = send_tag;
+    tmsg.ignore    = 0;
+    tmsg.context   = msg.context;
+    tmsg.data      = msg.data;
+    FAIL_IF_NONZERO(
+        fi_tsendmsg(ep.get(), &tmsg, FI_COMPLETION|FI_REMOTE_CQ_DATA),
+        "fi_tsendmsg() failed", REPORT_ON_FAILURE
+    );
+    return true;
+}
+
+bool endpoint::recv_msg(const struct fi_msg& msg) {
+    if (tcp_mode) {
+        return emulated_channel->post_recv(
+            msg.iov_count ? (char*)msg.msg_iov->iov_base : nullptr,
+            msg.iov_count ? msg.msg_iov->iov_len : 0,
+            (uint64_t)msg.context);
+    }
+    if (!rdm_mode) {
+        FAIL_IF_NONZERO(
+            fi_recvmsg(ep.get(), &msg, FI_COMPLETION),
+            "fi_recvmsg() failed", REPORT_ON_FAILURE
+        );
+        return true;
+    }
+    struct fi_msg_tagged tmsg;
+    tmsg.msg_iov   = msg.msg_iov;
+    tmsg.desc      = msg.desc;
+    tmsg.iov_count = msg.iov_count;
+    tmsg.addr      = msg.addr;
+    tmsg.tag       = recv_tag;
+    tmsg.ignore    = 0;
+    tmsg.context   = msg.context;
+    tmsg.data      = 0;
     FAIL_IF_NONZERO(
-        fi_recvmsg(ep.get(), &msg, FI_COMPLETION),
-        "fi_recvmsg() failed", REPORT_ON_FAILURE
+        fi_trecvmsg(ep.get(), &tmsg, FI_COMPLETION),
+        "fi_trecvmsg() failed", REPORT_ON_FAILURE
     );
-    return true; 
+    return true;
 }
 
 bool endpoint::post_write(const memory_region& mr, size_t offset, size_t size,
@@ -511,6 +925,14 @@ bool endpoint::post_write(const memory_region& mr, size_t offset, size_t size,
              << " remote_offset = " << remote_offset;
         return false;
     }
+
+    if (tcp_mode) {
+        /** Remote regions are addressed by offset */
+        return emulated_channel->post_write(
+            mr.buffer + offset, size, (uint32_t)remote_mr.rkey, remote_offset,
+            wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_WRITE) << OP_BITS_SHIFT,
+            true);
+    }
   
     struct iovec msg_iov;
     struct fi_rma_iov rma_iov;
@@ -524,9 +946,9 @@ bool endpoint::post_write(const memory_region& mr, size_t offset, size_t size,
     rma_iov.key  = remote_mr.rkey;
 
     msg.msg_iov       = &msg_iov;
-    msg.desc          = (void**)&mr.mr->key;
+    msg.desc          = (void**)&mr.get_mr(rail)->key;
     msg.iov_count     = 1;
-    msg.addr          = 0;
+    msg.addr          = remote_fi_addr;
     msg.rma_iov       = &rma_iov;
     msg.rma_iov_count = 1;
     msg.context       = (void*)(wr_id | ((uint64_t)*type.tag << type.shift_bits) | ((uint64_t)RDMA_OP_WRITE) << OP_BITS_SHIFT); 
@@ -603,20 +1025,61 @@ namespace impl {
 bool lf_add_connection(
     uint32_t new_id,
     const std::pair<ip_addr_t, uint16_t> &new_ip_addr_and_port) {
+  std::lock_guard<std::mutex> lock(lf_users_mutex);
+  if (node_users[new_id]++ > 0) {
+      return true;
+  }
   return rdmc_connections->add_node(new_id, new_ip_addr_and_port);
 }
 
 /**
- * Removes a node's TCP connection, presumably because it has failed.
+ * Removes a node's TCP connection, presumably because it has failed, once
+ * no other Group in the process still has it as a member.
  */
 bool lf_remove_connection(uint32_t node_id) {
+     std::lock_guard<std::mutex> lock(lf_users_mutex);
+     auto users = node_users.find(node_id);
+     if (users != node_users.end() && --users->second > 0) {
+         return true;
+     }
+     node_users.erase(node_id);
      return rdmc_connections->delete_node(node_id);
 }
 
+bool lf_connection_in_use(uint32_t node_id) {
+     std::lock_guard<std::mutex> lock(lf_users_mutex);
+     return node_users.count(node_id) > 0;
+}
+
 static atomic<bool> interrupt_mode;
 static atomic<bool> polling_loop_shutdown_flag;
-static void polling_loop() {
-    pthread_setname_np(pthread_self(), "rdmc_poll");
+
+/**
+ * Reads a rail's completion queue once, without blocking, and dispatches the
+ * completions; this is what the unified CompletionPoller calls in place of
+ * polling_loop. Returns whether it found any.
+ */
+static bool poll_rail_once(fid_cq *cq, fi_cq_data_entry *cq_entries, int max_cq_entries) {
+    const int num_completions = fi_cq_read(cq, cq_entries, max_cq_entries);
+    if (num_completions == 0 || num_completions == -FI_EAGAIN) {
+        return false;
+    }
+    if (num_completions < 0) {
+        cout << "Failed to read from completion queue, fi_cq_read returned "
+             << num_completions << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> l(completion_handlers_mutex);
+    for (int i = 0; i < num_completions; i++) {
+        fi_cq_data_entry &cq_entry = cq_entries[i];
+        dispatch_completion((uint64_t)cq_entry.op_context, cq_entry.data,
+                            cq_entry.len);
+    }
+    return true;
+}
+
+static void polling_loop(fid_cq *cq, bool can_wait) {
+    derecho::name_and_pin_thread("rdmc_poll");
 
     const int max_cq_entries = 1024;
     unique_ptr<fi_cq_data_entry[]> cq_entries(new fi_cq_data_entry[max_cq_entries]);
@@ -628,17 +1091,17 @@ static void polling_loop() {
             uint64_t poll_end = get_time() + (interrupt_mode ? 0L : 50000000L);
             do {
                 if(polling_loop_shutdown_flag) return;
-                num_completions = fi_cq_read(g_ctxt.cq, cq_entries.get(), max_cq_entries);
+                num_completions = fi_cq_read(cq, cq_entries.get(), max_cq_entries);
             } while(num_completions == 0 && get_time() < poll_end);
 
-            if (num_completions == 0) {
+            if (num_completions == 0 && can_wait) {
                 /** Need ibv_req_notify_cq equivalent here? */
             
-                num_completions = fi_cq_read(g_ctxt.cq, cq_entries.get(), max_cq_entries);
+                num_completions = fi_cq_read(cq, cq_entries.get(), max_cq_entries);
                 
                 if (num_completions == 0) {
                     pollfd file_descriptor;
-                    fi_control(&g_ctxt.cq->fid, FI_GETWAIT, &file_descriptor);
+                    fi_control(&cq->fid, FI_GETWAIT, &file_descriptor);
                     int rc = 0;
                     while (rc == 0 && !polling_loop_shutdown_flag) {
                         if(polling_loop_shutdown_flag) return;
@@ -646,7 +1109,7 @@ static void polling_loop() {
                     }
 
                     if (rc > 0) {
-                        num_completions = fi_cq_read(g_ctxt.cq, cq_entries.get(), max_cq_entries);
+                        num_completions = fi_cq_read(cq, cq_entries.get(), max_cq_entries);
                     }
                 }
             }
@@ -660,84 +1123,125 @@ static void polling_loop() {
         std::lock_guard<std::mutex> l(completion_handlers_mutex);
         for (int i = 0; i < num_completions; i++) {
             fi_cq_data_entry &cq_entry = cq_entries[i];
-                
-            message_type::tag_type type = (uint64_t)cq_entry.op_context >> message_type::shift_bits;
-            if (type == std::numeric_limits<message_type::tag_type>::max())
-                continue;
-
-            uint64_t masked_wr_id = (uint64_t)cq_entry.op_context & 0x0000ffffffffffffull;
-            uint32_t opcode = (uint32_t)EXTRACT_RDMA_OP_CODE(cq_entry.op_context);
-            uint32_t immediate = cq_entry.data;
-            if (type >= completion_handlers.size()) {
-                // Unrecognized message type
-            } else if (opcode == RDMA_OP_SEND) {
-                completion_handlers[type].send(masked_wr_id, immediate,
-                                               cq_entry.len);
-            } else if (opcode == RDMA_OP_RECV) {
-                completion_handlers[type].recv(masked_wr_id, immediate,
-                                               cq_entry.len);
-            } else if (opcode == RDMA_OP_WRITE) {
-                completion_handlers[type].write(masked_wr_id, immediate,
-                                                cq_entry.len);
-            } else {
-                puts("Sent unrecognized completion type?!");
-            }
+            dispatch_completion((uint64_t)cq_entry.op_context, cq_entry.data,
+                                cq_entry.len);
         }
     }
 }
 
 /**
- * Initialize the global context 
+ * Opens the fabric, domain, completion queue and passive endpoint of a rail
  */
-bool lf_initialize(const std::map<node_id_t, std::pair<ip_addr_t, uint16_t>>
-                       &ip_addrs_and_ports,
-                   uint32_t node_rank) {
-
-  /** Initialize the connection listener on the rdmc tcp port */
-  // connection_listener =
-  // make_unique<tcp::connection_listener>(derecho::rdmc_tcp_port);
-
-  /** Initialize the tcp connections, also connects all the nodes together */
-  rdmc_connections = new tcp::tcp_connections(node_rank, ip_addrs_and_ports);
-
-  /** Set the context to defaults to start with */
-  default_context();
-  // load_configuration();
-
-  dbg_info(fi_tostr(g_ctxt.hints, FI_TYPE_INFO));
+static void open_rail(lf_ctxt &ctxt) {
+  dbg_info(fi_tostr(ctxt.hints, FI_TYPE_INFO));
   /** Initialize the fabric, domain and completion queue */
   FAIL_IF_NONZERO(
-      fi_getinfo(LF_VERSION, NULL, NULL, 0, g_ctxt.hints, &(g_ctxt.fi)),
+      fi_getinfo(LF_VERSION, NULL, NULL, 0, ctxt.hints, &(ctxt.fi)),
       "fi_getinfo() failed", CRASH_ON_FAILURE);
 
-  FAIL_IF_NONZERO(fi_fabric(g_ctxt.fi->fabric_attr, &(g_ctxt.fabric), NULL),
+  FAIL_IF_NONZERO(fi_fabric(ctxt.fi->fabric_attr, &(ctxt.fabric), NULL),
                   "fi_fabric() failed", CRASH_ON_FAILURE);
-  FAIL_IF_NONZERO(fi_domain(g_ctxt.fabric, g_ctxt.fi, &(g_ctxt.domain), NULL),
+  FAIL_IF_NONZERO(fi_domain(ctxt.fabric, ctxt.fi, &(ctxt.domain), NULL),
                   "fi_domain() failed", CRASH_ON_FAILURE);
+  /** Providers with manual progress, e.g. efa, only move data (including
+   *  the RMA they emulate over sends) while the CQ is read, so the polling
+   *  loop must not sleep on a wait object, which they may not have anyway */
+  if (ctxt.fi->domain_attr->data_progress == FI_PROGRESS_MANUAL) {
+    ctxt.cq_attr.wait_obj = FI_WAIT_NONE;
+  }
   FAIL_IF_NONZERO(
-      fi_cq_open(g_ctxt.domain, &(g_ctxt.cq_attr), &(g_ctxt.cq), NULL),
+      fi_cq_open(ctxt.domain, &(ctxt.cq_attr), &(ctxt.cq), NULL),
       "failed to initialize tx completion queue", CRASH_ON_FAILURE);
-  FAIL_IF_ZERO(g_ctxt.cq, "Pointer to completion queue is null",
+  FAIL_IF_ZERO(ctxt.cq, "Pointer to completion queue is null",
                CRASH_ON_FAILURE);
 
+  if (rdm_mode) {
+    /** Open the endpoint for all remote nodes, which it reaches through
+     *  the address vector */
+    struct fi_av_attr av_attr;
+    memset(&av_attr, 0, sizeof(av_attr));
+    av_attr.type = FI_AV_TABLE;
+    FAIL_IF_NONZERO(fi_av_open(ctxt.domain, &av_attr, &ctxt.av, NULL),
+                    "failed to open the address vector", CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO(fi_endpoint(ctxt.domain, ctxt.fi, &ctxt.rdm_ep, NULL),
+                    "failed to open the RDM endpoint", CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO(fi_ep_bind(ctxt.rdm_ep, &ctxt.av->fid, 0),
+                    "failed to bind the RDM endpoint and address vector",
+                    CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO(fi_ep_bind(ctxt.rdm_ep, &ctxt.cq->fid,
+                               FI_RECV | FI_TRANSMIT | FI_SELECTIVE_COMPLETION),
+                    "failed to bind the RDM endpoint and completion queue",
+                    CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO(fi_enable(ctxt.rdm_ep),
+                    "failed to enable the RDM endpoint", CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO(
+        fi_getname(&ctxt.rdm_ep->fid, ctxt.pep_addr, &ctxt.pep_addr_len),
+        "failed to get the local RDM endpoint address", CRASH_ON_FAILURE);
+    FAIL_IF_NONZERO((ctxt.pep_addr_len > MAX_LF_ADDR_SIZE),
+                    "local name is too big to fit in local buffer",
+                    CRASH_ON_FAILURE);
+    return;
+  }
+
   /** Initialize the event queue, initialize and configure pep  */
-  FAIL_IF_NONZERO(fi_eq_open(g_ctxt.fabric, &g_ctxt.eq_attr, &g_ctxt.peq, NULL),
+  FAIL_IF_NONZERO(fi_eq_open(ctxt.fabric, &ctxt.eq_attr, &ctxt.peq, NULL),
                   "failed to open the event queue for passive endpoint",
                   CRASH_ON_FAILURE);
-  FAIL_IF_NONZERO(fi_passive_ep(g_ctxt.fabric, g_ctxt.fi, &g_ctxt.pep, NULL),
+  FAIL_IF_NONZERO(fi_passive_ep(ctxt.fabric, ctxt.fi, &ctxt.pep, NULL),
                   "failed to open a local passive endpoint", CRASH_ON_FAILURE);
-  FAIL_IF_NONZERO(fi_pep_bind(g_ctxt.pep, &g_ctxt.peq->fid, 0),
+  FAIL_IF_NONZERO(fi_pep_bind(ctxt.pep, &ctxt.peq->fid, 0),
                   "failed to bind event queue to passive endpoint",
                   CRASH_ON_FAILURE);
-  FAIL_IF_NONZERO(fi_listen(g_ctxt.pep),
+  FAIL_IF_NONZERO(fi_listen(ctxt.pep),
                   "failed to prepare passive endpoint for incoming connections",
                   CRASH_ON_FAILURE);
   FAIL_IF_NONZERO(
-      fi_getname(&g_ctxt.pep->fid, g_ctxt.pep_addr, &g_ctxt.pep_addr_len),
+      fi_getname(&ctxt.pep->fid, ctxt.pep_addr, &ctxt.pep_addr_len),
       "failed to get the local PEP address", CRASH_ON_FAILURE);
-  FAIL_IF_NONZERO((g_ctxt.pep_addr_len > MAX_LF_ADDR_SIZE),
+  FAIL_IF_NONZERO((ctxt.pep_addr_len > MAX_LF_ADDR_SIZE),
                   "local name is too big to fit in local buffer",
                   CRASH_ON_FAILURE);
+}
+
+/**
+ * Initialize the global context 
+ */
+bool lf_initialize(const std::map<node_id_t, std::pair<ip_addr_t, uint16_t>>
+                       &ip_addrs_and_ports,
+                   uint32_t node_rank) {
+
+  /** Initialize the connection listener on the rdmc tcp port */
+  // connection_listener =
+  // make_unique<tcp::connection_listener>(derecho::rdmc_tcp_port);
+
+  std::lock_guard<std::mutex> lock(lf_users_mutex);
+  for (const auto& [id, ip_addr_and_port] : ip_addrs_and_ports) {
+      if (id != node_rank && node_users[id]++ == 0 && num_lf_users > 0) {
+          /** A later Group only connects to the nodes that no other Group
+           * has connected to yet */
+          rdmc_connections->add_node(id, ip_addr_and_port);
+      }
+  }
+  if (num_lf_users++ > 0) {
+      return true;
+  }
+
+  /** Initialize the tcp connections, also connects all the nodes together */
+  rdmc_connections = new tcp::tcp_connections(node_rank, ip_addrs_and_ports);
+  my_node_id = node_rank;
+  tcp_mode = (derecho::getConfString(CONF_RDMA_PROVIDER) == "tcp_emulation");
+  if (tcp_mode) {
+      /** There are no rails and no polling threads: the emulation thread
+       *  calls the completion handlers */
+      tcp::emulation::initialize(node_rank);
+      return true;
+  }
+  rdm_mode = derecho::getConfBoolean(CONF_RDMA_RDM_ENDPOINT);
+
+  /** Set the context to defaults to start with */
+  default_context(g_ctxt, derecho::getConfString(CONF_RDMA_DOMAIN));
+  // load_configuration();
+  open_rail(g_ctxt);
   //  event queue moved to endpoint.
   //  FAIL_IF_NONZERO(
   //      fi_eq_open(g_ctxt.fabric, &g_ctxt.eq_attr, &g_ctxt.eq, NULL),
@@ -745,14 +1249,71 @@ bool lf_initialize(const std::map<node_id_t, std::pair<ip_addr_t, uint16_t>>
   //      CRASH_ON_FAILURE
   //  );
 
-  /** Start a polling thread and run in the background */
-  std::thread polling_thread(polling_loop);
-  polling_thread.detach();
+  /** Open the extra rails; every node must list the same number of them */
+  const string extra_domains = derecho::getConfString(CONF_RDMA_EXTRA_DOMAINS);
+  size_t start = 0;
+  while (start < extra_domains.size()) {
+      size_t end = extra_domains.find(',', start);
+      if (end == string::npos) end = extra_domains.size();
+      const string entry = extra_domains.substr(start, end - start);
+      const size_t first = entry.find_first_not_of(" \t");
+      if (first != string::npos) {
+          const string domain = entry.substr(first, entry.find_last_not_of(" \t") - first + 1);
+          g_extra_rails.emplace_back();
+          default_context(g_extra_rails.back(), domain);
+          open_rail(g_extra_rails.back());
+      }
+      start = end + 1;
+  }
+
+  /** Start a polling thread for each rail and run them in the background,
+   * or have the unified poller read the rails with the SST's queue */
+  for (uint32_t rail = 0; rail < lf_num_rails(); ++rail) {
+      fid_cq *cq = rail_ctxt(rail).cq;
+      if (derecho::CompletionPoller::enabled()) {
+          int wait_fd = -1;
+          if (rail_ctxt(rail).cq_attr.wait_obj == FI_WAIT_NONE
+              || fi_control(&cq->fid, FI_GETWAIT, &wait_fd) != 0) {
+              wait_fd = -1;
+          }
+          const int max_cq_entries = 1024;
+          shared_ptr<fi_cq_data_entry[]> cq_entries(new fi_cq_data_entry[max_cq_entries]);
+          derecho::CompletionPoller::get().add_source(
+                  "RDMC rail " + std::to_string(rail),
+                  [cq, cq_entries]() { return poll_rail_once(cq, cq_entries.get(), max_cq_entries); },
+                  wait_fd);
+          continue;
+      }
+      std::thread polling_thread(polling_loop, cq,
+                                 rail_ctxt(rail).cq_attr.wait_obj != FI_WAIT_NONE);
+      polling_thread.detach();
+  }
 
   return true;
 }
 
+uint32_t lf_num_rails() {
+  return g_extra_rails.size() + 1;
+}
+
 bool lf_destroy() {
+  {
+      std::lock_guard<std::mutex> lock(lf_users_mutex);
+      if (num_lf_users > 0 && --num_lf_users > 0) {
+          return false;
+      }
+      node_users.clear();
+  }
+  {
+      std::lock_guard<std::mutex> lock(registrations_mutex);
+      idle_registrations.clear();
+      idle_bytes = 0;
+  }
+  if (tcp_mode) {
+      tcp_mode = false;
+      tcp::emulation::shutdown();
+      return true;
+  }
   return false;
 }
 
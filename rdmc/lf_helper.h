@@ -11,12 +11,14 @@
 #include <rdma/fabric.h>
 
 #include "derecho/derecho_type_definitions.h"
+#include "tcp/emulation.h"
 
 #define LF_VERSION FI_VERSION(1,5)
 
 struct fid_mr;
 struct fid_ep;
 struct fid_cq;
+struct fi_msg;
 
 /**
  * Contains functions and classes for low-level RDMA operations, such as setting
@@ -44,15 +46,26 @@ class unsupported_feature : public exception {};
 //  void operator() (fi_struct_type* fi_struct) const {fi_close(fi_struct->fid);} 
 //};
 
+/** The registration of a range of memory in each rail's domain, which the
+ * memory regions over that range share (see memory_region) */
+struct mr_registration;
+
 /**
  * A C++ wrapper for the libfabric fid_mr struct. Registers a memory region for 
  * the provided buffer on construction, and deregisters it on destruction.
+ *
+ * Registrations are cached process-wide: a region over memory that another
+ * live region already covers shares that region's registration, and the
+ * buffers that regions allocate themselves stay registered after the region
+ * is gone (up to RDMA/mr_cache_size bytes), so that the next region of the
+ * same size, e.g. of the same RDMC group in the next view, reuses both.
  */
 class memory_region {
-    /** Smart pointer for managing the registered memory region */
-    std::unique_ptr<fid_mr, std::function<void(fid_mr *)>> mr;
-    /** Smart pointer for managing the buffer the mr uses */
-    std::unique_ptr<char[]> allocated_buffer;
+    /** The registration of the buffer, shared with the other regions over it */
+    std::shared_ptr<mr_registration> reg;
+
+    /** Creates a region over the whole buffer of a registration */
+    explicit memory_region(std::shared_ptr<mr_registration> reg);
 
     friend class endpoint;
     friend class task;
@@ -60,8 +73,9 @@ class memory_region {
 public:
     /**
      * Constructor
-     * Creates a buffer of the specified size and then calls the second 
-     * constructor with the new buffer as an argument.
+     * Creates a registered buffer of the specified size, or takes over an
+     * idle one of that size from the registration cache. Its contents are
+     * undefined.
      *
      * @param size The size in bytes of the buffer to be associated with
      *     the memory region.
@@ -76,15 +90,42 @@ public:
      *      the memory region.
      */ 
     memory_region(char* buffer, size_t size);
+#ifdef USE_CUDA
+    /**
+     * Constructor
+     * Registers a memory region over CUDA device memory, so that RDMA reads
+     * and writes go straight to the GPU (GPUDirect RDMA). The provider must
+     * support FI_HMEM, e.g. verbs with the nvidia-peermem module loaded.
+     *
+     * @param buffer A device pointer to the memory that will be registered.
+     * @param size The size in bytes of the device memory.
+     * @param cuda_device The CUDA device the memory belongs to.
+     */
+    memory_region(char* buffer, size_t size, int cuda_device);
+#endif
+    ~memory_region();
+    /**
+     * copy_from_host
+     * Copies length bytes of host memory into the region at offset, with
+     * cudaMemcpy if the region is in device memory.
+     */
+    void copy_from_host(size_t offset, const char* source, size_t length) const;
     /**
      * get_key
      * Returns the key associated with the registered memory region, which
      * is used to access the region.
      */ 
     uint64_t get_key() const;
+    /**
+     * get_mr
+     * Returns the registration of the region in the domain of a rail.
+     */
+    fid_mr* get_mr(uint32_t rail) const;
 
     char* const buffer;
     const size_t size;
+    /** The CUDA device that buffer is on, or -1 if it is in host memory */
+    const int cuda_device;
 };
 
 class remote_memory_region {
@@ -157,6 +198,18 @@ protected:
     /** Smart pointer for managing the endpoint */
     std::unique_ptr<fid_eq, std::function<void(fid_eq *)>> eq;
     std::unique_ptr<fid_ep, std::function<void(fid_ep *)>> ep;
+    /** The rail (NIC or port) that the endpoint is opened on */
+    uint32_t rail = 0;
+    /** In RDM mode, the tags of the messages to and from the remote node */
+    uint64_t send_tag = 0;
+    uint64_t recv_tag = 0;
+    /** The channel that takes the place of ep if RDMA is emulated over TCP
+     * (RDMA/provider = tcp_emulation) */
+    std::unique_ptr<tcp::emulation::channel> emulated_channel;
+
+    /** Post a send or receive, as a tagged message in RDM mode */
+    bool send_msg(const struct fi_msg& msg);
+    bool recv_msg(const struct fi_msg& msg);
 
     explicit endpoint() {}
 
@@ -182,9 +235,11 @@ public:
      * @param post_recvs A lambda that is called at the end of initializing the
      *     endpoints on the client and remote sides to avoid race conditions 
      *     between post_send() and post_recv().
+     * @param rail The rail to connect over; the remote side must use the
+     *     same one.
      */    
     endpoint(size_t remote_index, bool is_lf_server,
-             std::function<void(endpoint*)> post_recvs);
+             std::function<void(endpoint*)> post_recvs, uint32_t rail = 0);
     /**
      * Constructor 
      * Default move constructor
@@ -250,7 +305,9 @@ public:
                     size_t remote_offset, const message_type& type,
                     bool signaled = false, bool send_inline = false);
 
-    fi_addr_t remote_fi_addr;
+    /** The address of the remote node in the address vector, if the
+     * endpoint is the RDM endpoint of its rail; unused otherwise */
+    fi_addr_t remote_fi_addr = 0;
 };
 
 class managed_endpoint : public endpoint {
@@ -292,6 +349,8 @@ namespace impl {
                    uint32_t node_rank);
 bool lf_add_connection(uint32_t new_id, const std::pair<ip_addr_t, uint16_t> &new_ip_addr_and_port);
 bool lf_remove_connection(uint32_t node_id);
+/** Whether a Group in this process still has the node as a member */
+bool lf_connection_in_use(uint32_t node_id);
 bool lf_destroy();
 
 std::map<uint32_t, remote_memory_region> lf_exchange_memory_regions(
@@ -299,6 +358,8 @@ std::map<uint32_t, remote_memory_region> lf_exchange_memory_regions(
          const memory_region& mr);
 
 bool set_interrupt_mode(bool enabled);
+/** The number of rails (domains) RDMC was initialized with, at least 1 */
+uint32_t lf_num_rails();
 } /* namespace impl */
 } /* namespace rdma */
 
@@ -3,6 +3,7 @@
 #define MESSAGE_H
 
 #include <cstdint>
+#include <optional>
 #include <utility>
 
 struct ParsedTag {
@@ -20,17 +21,63 @@ inline uint64_t form_tag(uint16_t group_number, uint32_t target) {
     return (((uint64_t)group_number) << 32) | (uint64_t)target;
 }
 
+/**
+ * The immediate of a data block holds the message's block size, as a right
+ * shift of the group's block size in the 4 bits below EXTENDED_IMMEDIATE_FLAG.
+ * Under it are the message's block count and the block's number, 11 and 16
+ * bits wide, if the message has fewer than MAX_COMPACT_BLOCKS blocks. Larger
+ * messages set EXTENDED_IMMEDIATE_FLAG and use the other 27 bits for the
+ * block count alone; receivers only need the block count from the first
+ * block, and know which block comes next from the schedule, so the block
+ * number is just a consistency check.
+ */
+constexpr uint32_t EXTENDED_IMMEDIATE_FLAG = 1u << 31;
+constexpr uint32_t BLOCK_SIZE_SHIFT_OFFSET = 27;
+constexpr uint32_t MAX_BLOCK_SIZE_SHIFT = 15;
+constexpr uint32_t MAX_COMPACT_BLOCKS = 1u << 11;
+/** The most blocks a message can have */
+constexpr uint32_t MAX_MESSAGE_BLOCKS = (1u << BLOCK_SIZE_SHIFT_OFFSET) - 1;
+
 struct ParsedImmediate {
-    uint16_t total_blocks;
-    uint16_t block_number;
+    uint32_t total_blocks;
+    /** Not sent for messages of MAX_COMPACT_BLOCKS blocks or more */
+    std::optional<uint32_t> block_number;
+    /** The message's blocks are the group's block size >> block_size_shift */
+    uint32_t block_size_shift;
 };
 
 inline ParsedImmediate parse_immediate(uint32_t imm) {
-    return ParsedImmediate{(uint16_t)((imm & 0xffff0000) >> 16),
-                           (uint16_t)(imm & 0x0000ffff)};
+    const uint32_t block_size_shift = (imm >> BLOCK_SIZE_SHIFT_OFFSET) & MAX_BLOCK_SIZE_SHIFT;
+    if(imm & EXTENDED_IMMEDIATE_FLAG) {
+        return ParsedImmediate{imm & MAX_MESSAGE_BLOCKS, std::nullopt, block_size_shift};
+    }
+    return ParsedImmediate{(imm & MAX_MESSAGE_BLOCKS) >> 16, imm & 0x0000ffff, block_size_shift};
+}
+inline uint32_t form_immediate(uint32_t total_blocks, uint32_t block_number,
+                               uint32_t block_size_shift) {
+    const uint32_t shift_bits = block_size_shift << BLOCK_SIZE_SHIFT_OFFSET;
+    if(total_blocks >= MAX_COMPACT_BLOCKS) {
+        return EXTENDED_IMMEDIATE_FLAG | shift_bits | total_blocks;
+    }
+    return shift_bits | total_blocks << 16 | block_number;
+}
+
+/**
+ * The connection that carries ready-for-block messages is shared by all of
+ * the groups with the same peer, so their immediate names the group in its
+ * upper 16 bits. Below that is the number of slices that the receiver wants
+ * the block in.
+ */
+struct ParsedReadyImmediate {
+    uint16_t group_number;
+    uint32_t slices;
+};
+
+inline ParsedReadyImmediate parse_ready_immediate(uint32_t imm) {
+    return ParsedReadyImmediate{(uint16_t)(imm >> 16), imm & 0x0000ffff};
 }
-inline uint32_t form_immediate(uint16_t total_blocks, uint16_t block_number) {
-    return ((uint32_t)total_blocks) << 16 | ((uint32_t)block_number);
+inline uint32_t form_ready_immediate(uint16_t group_number, uint32_t slices) {
+    return ((uint32_t)group_number) << 16 | slices;
 }
 
 #endif
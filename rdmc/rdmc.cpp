@@ -21,6 +21,7 @@
 #include <utility>
 #include <vector>
 
+#include "conf/conf.hpp"
 #include "derecho/derecho_type_definitions.h"
 
 using namespace std;
@@ -45,8 +46,17 @@ mutex groups_lock;
 #endif
         return false;
     }
+#ifdef USE_VERBS_API
+    if(derecho::getConfBoolean(CONF_RDMA_IMPLICIT_ODP)
+       && !::rdma::impl::set_implicit_odp_mode(true)) {
+        puts("Implicit ODP is not supported by this device; registering buffers explicitly");
+        fflush(stdout);
+    }
+#endif
 
-    polling_group::initialize_message_types();
+    // Every Group in the process calls this, and they share the message types
+    static once_flag message_types_initialized;
+    call_once(message_types_initialized, polling_group::initialize_message_types);
     return true;
 }
 void add_address(uint32_t index, const std::pair<ip_addr_t, uint16_t>& address) {
@@ -56,14 +66,117 @@ void add_address(uint32_t index, const std::pair<ip_addr_t, uint16_t>& address)
     ::rdma::impl::lf_add_connection(index, address);
 #endif
 }
+void remove_node(uint32_t node_id) {
+#ifndef USE_VERBS_API
+    // another Group in this process may still reach the node through it
+    if(::rdma::impl::lf_connection_in_use(node_id)) return;
+#endif
+    polling_group::remove_peer(node_id);
+}
+
+/**
+ * Parses the rack map from the configuration, which lists node_id:rack_id
+ * pairs separated by commas, once.
+ */
+static const map<uint32_t, uint32_t>& get_rack_map() {
+    static const map<uint32_t, uint32_t> rack_map = [] {
+        map<uint32_t, uint32_t> racks;
+        const string rack_map_string = derecho::getConfString(CONF_DERECHO_RDMC_RACK_MAP);
+        size_t start = 0;
+        while(start < rack_map_string.size()) {
+            size_t end = rack_map_string.find(',', start);
+            if(end == string::npos) end = rack_map_string.size();
+            const string entry = rack_map_string.substr(start, end - start);
+            unsigned int node, rack;
+            char extra;
+            if(sscanf(entry.c_str(), " %u : %u %c", &node, &rack, &extra) == 2) {
+                racks[node] = rack;
+            } else if(entry.find_first_not_of(" \t") != string::npos) {
+                printf("Ignoring malformed rdmc_rack_map entry \"%s\"\n", entry.c_str());
+                fflush(stdout);
+            }
+            start = end + 1;
+        }
+        return racks;
+    }();
+    return rack_map;
+}
+
+/** The groups and messages that an adaptive_rule applies to */
+struct adaptive_rule {
+    uint32_t max_members;
+    /** 0 matches any number of blocks */
+    size_t max_blocks;
+    send_algorithm algorithm;
+};
+
+/**
+ * Parses the thresholds for ADAPTIVE_SEND from the configuration, once. They
+ * are a comma-separated list of max_members:max_blocks:algorithm rules, which
+ * experiment's calibrate_adaptive pass prints for the cluster it runs on.
+ */
+static const vector<adaptive_rule>& get_adaptive_rules() {
+    static const vector<adaptive_rule> adaptive_rules = [] {
+        const map<string, send_algorithm> algorithm_names = {
+                {"binomial_send", BINOMIAL_SEND},
+                {"chain_send", CHAIN_SEND},
+                {"sequential_send", SEQUENTIAL_SEND},
+                {"tree_send", TREE_SEND},
+                {"striped_send", STRIPED_SEND}};
+        vector<adaptive_rule> rules;
+        const string rules_string = derecho::getConfString(CONF_DERECHO_RDMC_ADAPTIVE_THRESHOLDS);
+        size_t start = 0;
+        while(start < rules_string.size()) {
+            size_t end = rules_string.find(',', start);
+            if(end == string::npos) end = rules_string.size();
+            const string entry = rules_string.substr(start, end - start);
+            unsigned int max_members;
+            unsigned long max_blocks;
+            char name[32];
+            if(sscanf(entry.c_str(), " %u : %lu : %31s", &max_members, &max_blocks, name) == 3
+               && algorithm_names.count(name)) {
+                rules.push_back({max_members, max_blocks, algorithm_names.at(name)});
+            } else if(entry.find_first_not_of(" \t") != string::npos) {
+                printf("Ignoring malformed rdmc_adaptive_thresholds entry \"%s\"\n", entry.c_str());
+                fflush(stdout);
+            }
+            start = end + 1;
+        }
+        return rules;
+    }();
+    return adaptive_rules;
+}
+
+/**
+ * Picks the send algorithm for a group under ADAPTIVE_SEND: the one of the
+ * first rule that covers both the group and its largest message, or the
+ * binomial pipeline if there is none.
+ */
+static send_algorithm select_adaptive_algorithm(uint32_t num_members, size_t num_blocks) {
+    for(const adaptive_rule& rule : get_adaptive_rules()) {
+        if(num_members <= rule.max_members && (rule.max_blocks == 0 || num_blocks <= rule.max_blocks)) {
+            return rule.algorithm;
+        }
+    }
+    return BINOMIAL_SEND;
+}
 
 bool create_group(uint16_t group_number, std::vector<uint32_t> members,
                   size_t block_size, send_algorithm algorithm,
                   incoming_message_callback_t incoming_upcall,
                   completion_callback_t callback,
-                  failure_callback_t failure_callback) {
+                  failure_callback_t failure_callback,
+                  size_t max_message_size,
+                  progress_callback_t progress_callback) {
     if(shutdown_flag) return false;
 
+    // A schedule can't change from one message to the next, since receivers
+    // post the receive for the first block before they know a message's size
+    if(algorithm == ADAPTIVE_SEND) {
+        const size_t max_blocks = max_message_size == 0 ? 1 : (max_message_size - 1) / block_size + 1;
+        algorithm = select_adaptive_algorithm(members.size(), max_blocks);
+    }
+
     schedule* send_schedule;
     uint32_t member_index = index_of(members, node_rank);
     if(algorithm == BINOMIAL_SEND) {
@@ -74,6 +187,22 @@ bool create_group(uint16_t group_number, std::vector<uint32_t> members,
         send_schedule = new chain_schedule(members.size(), member_index);
     } else if(algorithm == TREE_SEND) {
         send_schedule = new tree_schedule(members.size(), member_index);
+    } else if(algorithm == STRIPED_SEND) {
+        send_schedule = new striped_schedule(members.size(), member_index);
+    } else if(algorithm == HIERARCHICAL_SEND) {
+        // Nodes missing from the map get racks of their own, numbered past
+        // every listed rack so they can't collide with one
+        const map<uint32_t, uint32_t>& rack_map = get_rack_map();
+        uint32_t unlisted_rack = 0;
+        for(const auto& node_rack : rack_map) {
+            unlisted_rack = max(unlisted_rack, node_rack.second + 1);
+        }
+        vector<uint32_t> member_racks;
+        for(uint32_t member : members) {
+            auto rack = rack_map.find(member);
+            member_racks.push_back(rack != rack_map.end() ? rack->second : unlisted_rack++);
+        }
+        send_schedule = new hierarchical_schedule(members.size(), member_index, member_racks);
     } else {
         puts("Unsupported group type?!");
         fflush(stdout);
@@ -83,7 +212,10 @@ bool create_group(uint16_t group_number, std::vector<uint32_t> members,
     unique_lock<mutex> lock(groups_lock);
     auto g = make_shared<polling_group>(group_number, block_size, members,
                                         member_index, incoming_upcall, callback,
-                                        unique_ptr<schedule>(send_schedule));
+                                        unique_ptr<schedule>(send_schedule),
+                                        derecho::getConfUInt64(CONF_DERECHO_RDMC_BLOCK_OVERHEAD),
+                                        derecho::getConfUInt32(CONF_DERECHO_RDMC_BLOCK_CREDITS),
+                                        progress_callback);
     auto p = groups.emplace(group_number, std::move(g));
     return p.second;
 }
@@ -95,6 +227,20 @@ void destroy_group(uint16_t group_number) {
     LOG_EVENT(group_number, -1, -1, "destroy_group");
     groups.erase(group_number);
 }
+detached_groups detach_groups(const vector<uint16_t>& group_numbers) {
+    detached_groups detached;
+    if(shutdown_flag) return detached;
+
+    unique_lock<mutex> lock(groups_lock);
+    for(uint16_t group_number : group_numbers) {
+        auto it = groups.find(group_number);
+        if(it == groups.end()) continue;
+        LOG_EVENT(group_number, -1, -1, "detach_group");
+        detached.push_back(std::move(it->second));
+        groups.erase(it);
+    }
+    return detached;
+}
 void shutdown() { shutdown_flag = true; }
 bool send(uint16_t group_number, shared_ptr<memory_region> mr, size_t offset,
           size_t length) {
@@ -29,7 +29,10 @@ enum send_algorithm {
     BINOMIAL_SEND = 1,
     CHAIN_SEND = 2,
     SEQUENTIAL_SEND = 3,
-    TREE_SEND = 4
+    TREE_SEND = 4,
+    HIERARCHICAL_SEND = 5,
+    ADAPTIVE_SEND = 6,
+    STRIPED_SEND = 7
 };
 
 struct receive_destination {
@@ -40,12 +43,23 @@ struct receive_destination {
 typedef std::function<receive_destination(size_t size)>
         incoming_message_callback_t;
 typedef std::function<void(char* buffer, size_t size)> completion_callback_t;
+/** Called with the start of an incoming message and the number of its bytes,
+ * from the start, that have arrived so far */
+typedef std::function<void(char* buffer, size_t received)> progress_callback_t;
 typedef std::function<void(std::optional<uint32_t> suspected_victim)>
         failure_callback_t;
 
 bool initialize(const std::map<uint32_t, std::pair<ip_addr_t, uint16_t>>& addresses,
                 uint32_t node_rank) __attribute__((warn_unused_result));
 void add_address(uint32_t index, const std::pair<ip_addr_t, uint16_t>& address);
+/**
+ * Drops the connection that this node's groups share with a node that has
+ * left, so that a fresh one is made if it rejoins, unless another Group in
+ * the process still has the node as a member. Call it after the node's TCP
+ * connection has been removed and before creating the groups of the next
+ * view.
+ */
+void remove_node(uint32_t node_id);
 void shutdown();
 
 /**
@@ -63,16 +77,39 @@ void shutdown();
  * message in this group
  * @param failure_callback The function to call when RDMC detects a failure in
  * this group. It will be called with the suspected failed node's ID.
+ * @param max_message_size The largest message that will be sent in this
+ * group, which ADAPTIVE_SEND uses along with the group's size to pick one of
+ * the other algorithms; 0 if unknown.
+ * @param progress_callback If set, a receiver calls it each time the run of
+ * blocks it has received from the start of a message grows, before the
+ * message is complete, so that it can start processing the message while the
+ * rest arrives. Blocks arrive out of order under most algorithms, so it may
+ * cover several blocks at once. The first block is copied into the message's
+ * destination as soon as it arrives instead of at the end. It runs on the
+ * polling thread with the group locked, so it must be quick.
  * @return True if group creation succeeds, false if it fails.
  */
 bool create_group(uint16_t group_number, std::vector<uint32_t> members,
                   size_t block_size, send_algorithm algorithm,
                   incoming_message_callback_t incoming_receive,
                   completion_callback_t send_callback,
-                  failure_callback_t failure_callback)
+                  failure_callback_t failure_callback,
+                  size_t max_message_size = 0,
+                  progress_callback_t progress_callback = nullptr)
         __attribute__((warn_unused_result));
 void destroy_group(uint16_t group_number);
 
+/** Groups removed by detach_groups(); destroying it destroys the groups. */
+using detached_groups = std::vector<std::shared_ptr<void>>;
+/**
+ * Removes several groups at once, so that no more messages can be sent or
+ * received in them, but leaves destroying them to the caller, who can do it
+ * later, e.g. once a view change has finished.
+ * @param group_numbers The groups to remove; numbers of groups that don't
+ * exist are ignored.
+ */
+detached_groups detach_groups(const std::vector<uint16_t>& group_numbers);
+
 bool send(uint16_t group_number, std::shared_ptr<rdma::memory_region> mr,
           size_t offset, size_t length) __attribute__((warn_unused_result));
 
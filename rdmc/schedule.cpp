@@ -1,6 +1,7 @@
 
 #include "schedule.h"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 
@@ -492,3 +493,186 @@ optional<schedule::block_transfer> binomial_schedule::get_first_block(size_t num
 
     return transfer;
 }
+
+hierarchical_schedule::hierarchical_schedule(uint32_t members, uint32_t index,
+                                             const vector<uint32_t>& member_racks)
+        : schedule(members, index) {
+    assert(member_racks.size() == num_members);
+    // Racks are ordered by their first member, so every node agrees on them
+    vector<uint32_t> racks;
+    for(uint32_t i = 0; i < num_members; ++i) {
+        if(std::find(racks.begin(), racks.end(), member_racks[i]) == racks.end()) {
+            racks.push_back(member_racks[i]);
+            leaders.push_back(i);
+        }
+        if(member_racks[i] == member_racks[member_index]) {
+            rack_members.push_back(i);
+        }
+    }
+    auto leader_position = std::find(leaders.begin(), leaders.end(), member_index);
+    if(leader_position != leaders.end() && leaders.size() > 1) {
+        leader_schedule.emplace(leaders.size(), leader_position - leaders.begin());
+    }
+    if(rack_members.size() > 1) {
+        auto rack_position = std::find(rack_members.begin(), rack_members.end(), member_index);
+        rack_schedule.emplace(rack_members.size(), rack_position - rack_members.begin());
+    }
+}
+
+size_t hierarchical_schedule::get_leader_steps(size_t num_blocks) const {
+    // Every leader must agree on this, so it can't depend on leader_schedule
+    if(leaders.size() < 2) {
+        return 0;
+    }
+    return binomial_schedule(leaders.size(), 0).get_total_steps(num_blocks);
+}
+
+vector<uint32_t> hierarchical_schedule::get_connections() const {
+    vector<uint32_t> ret;
+    if(leader_schedule) {
+        for(uint32_t leader : leader_schedule->get_connections()) {
+            ret.push_back(leaders[leader]);
+        }
+    }
+    if(rack_schedule) {
+        for(uint32_t rack_member : rack_schedule->get_connections()) {
+            ret.push_back(rack_members[rack_member]);
+        }
+    }
+    return ret;
+}
+size_t hierarchical_schedule::get_total_steps(size_t num_blocks) const {
+    size_t total_steps = get_leader_steps(num_blocks);
+    if(rack_schedule) {
+        total_steps += rack_schedule->get_total_steps(num_blocks);
+    }
+    return total_steps;
+}
+optional<schedule::block_transfer> hierarchical_schedule::get_outgoing_transfer(size_t num_blocks, size_t step) const {
+    const size_t leader_steps = get_leader_steps(num_blocks);
+    optional<block_transfer> transfer;
+    if(step < leader_steps) {
+        if(leader_schedule) {
+            transfer = leader_schedule->get_outgoing_transfer(num_blocks, step);
+            if(transfer) transfer->target = leaders[transfer->target];
+        }
+    } else if(rack_schedule) {
+        transfer = rack_schedule->get_outgoing_transfer(num_blocks, step - leader_steps);
+        if(transfer) transfer->target = rack_members[transfer->target];
+    }
+    return transfer;
+}
+optional<schedule::block_transfer> hierarchical_schedule::get_incoming_transfer(size_t num_blocks, size_t step) const {
+    const size_t leader_steps = get_leader_steps(num_blocks);
+    optional<block_transfer> transfer;
+    if(step < leader_steps) {
+        if(leader_schedule) {
+            transfer = leader_schedule->get_incoming_transfer(num_blocks, step);
+            if(transfer) transfer->target = leaders[transfer->target];
+        }
+    } else if(rack_schedule) {
+        transfer = rack_schedule->get_incoming_transfer(num_blocks, step - leader_steps);
+        if(transfer) transfer->target = rack_members[transfer->target];
+    }
+    return transfer;
+}
+optional<schedule::block_transfer> hierarchical_schedule::get_first_block(size_t num_blocks) const {
+    if(member_index == 0) return std::nullopt;
+
+    // A leader gets its blocks from the other leaders, and everyone else from
+    // their rack's pipeline
+    optional<block_transfer> transfer;
+    if(rack_members[0] == member_index) {
+        transfer = leader_schedule->get_first_block(num_blocks);
+        if(transfer) transfer->target = leaders[transfer->target];
+    } else {
+        transfer = rack_schedule->get_first_block(num_blocks);
+        if(transfer) transfer->target = rack_members[transfer->target];
+    }
+    return transfer;
+}
+
+optional<size_t> striped_schedule::dealt_block(size_t num_blocks, size_t slot) const {
+    const uint32_t num_receivers = num_members - 1;
+    if(slot % period >= num_receivers) return std::nullopt;
+    const size_t block = (slot / period) * num_receivers + slot % period;
+    if(block < num_blocks) return block;
+    // In the first round, receivers without a block get the last one
+    if(slot < period) return num_blocks - 1;
+    return std::nullopt;
+}
+optional<size_t> striped_schedule::owned_block(size_t num_blocks, size_t slot) const {
+    const uint32_t num_receivers = num_members - 1;
+    if(slot % period >= num_receivers) return std::nullopt;
+    const size_t block = (slot / period) * num_receivers + slot % period;
+    if(block < num_blocks) return block;
+    return std::nullopt;
+}
+bool striped_schedule::has_last_block_copy(size_t num_blocks, uint32_t receiver) const {
+    return num_blocks < num_members - 1 && receiver >= num_blocks;
+}
+
+vector<uint32_t> striped_schedule::get_connections() const {
+    // Every member exchanges blocks with every other one, except that the
+    // sender only sends
+    vector<uint32_t> ret;
+    for(uint32_t i = 0; i < num_members; ++i) {
+        if(i != member_index) {
+            ret.push_back(i);
+        }
+    }
+    return ret;
+}
+size_t striped_schedule::get_total_steps(size_t num_blocks) const {
+    if(num_members < 2) return 0;
+    const uint32_t num_receivers = num_members - 1;
+    const size_t last_slot = ((num_blocks - 1) / num_receivers) * period + (num_blocks - 1) % num_receivers;
+    // The last block is forwarded during the round after the one following its slot
+    return last_slot + 2 * period;
+}
+optional<schedule::block_transfer> striped_schedule::get_outgoing_transfer(size_t num_blocks, size_t step) const {
+    if(num_members < 2) return std::nullopt;
+    if(member_index == 0) {
+        auto block = dealt_block(num_blocks, step);
+        if(!block) return std::nullopt;
+        return block_transfer{(uint32_t)(step % period) + 1, *block};
+    }
+
+    // Receiver q forwards the block of slot step - period - j to the
+    // receiver 2j places after it, for the one j in [1, period) that makes
+    // that slot its own
+    const uint32_t receiver = member_index - 1;
+    const size_t j = (step + period - receiver) % period;
+    if(j == 0 || step < period + j) return std::nullopt;
+    auto block = owned_block(num_blocks, step - period - j);
+    if(!block) return std::nullopt;
+
+    const uint32_t target = (receiver + 2 * j) % period;
+    if(target >= num_members - 1) return std::nullopt;
+    if(*block == num_blocks - 1 && has_last_block_copy(num_blocks, target)) return std::nullopt;
+    return block_transfer{target + 1, *block};
+}
+optional<schedule::block_transfer> striped_schedule::get_incoming_transfer(size_t num_blocks, size_t step) const {
+    if(member_index == 0 || num_members < 2) return std::nullopt;
+
+    const uint32_t receiver = member_index - 1;
+    if(step % period == receiver) {
+        auto block = dealt_block(num_blocks, step);
+        if(!block) return std::nullopt;
+        return block_transfer{0, *block};
+    }
+
+    // The mirror image of get_outgoing_transfer: the forwarder j steps into
+    // its round targets receiver step + j
+    const size_t j = (receiver + period - step % period) % period;
+    if(step < period + j) return std::nullopt;
+    const size_t slot = step - period - j;
+    auto block = owned_block(num_blocks, slot);
+    if(!block) return std::nullopt;
+    if(*block == num_blocks - 1 && has_last_block_copy(num_blocks, receiver)) return std::nullopt;
+    return block_transfer{(uint32_t)(slot % period) + 1, *block};
+}
+optional<schedule::block_transfer> striped_schedule::get_first_block(size_t num_blocks) const {
+    if(member_index == 0) return std::nullopt;
+    return block_transfer{0, member_index - 1};
+}
@@ -104,4 +104,80 @@ public:
     size_t get_total_steps(size_t num_blocks) const;
 };
 
+/**
+ * A two-level schedule for fabrics where racks are joined by a spine. Each
+ * rack has a leader: the sender in its own rack, and the member with the
+ * lowest rank in every other rack. The leaders first run a binomial pipeline
+ * among themselves, so every block crosses the spine once per rack, and then
+ * each leader runs a binomial pipeline within its rack. The two phases
+ * don't overlap: the rack pipelines start once every step of the leaders'
+ * pipeline is done, since every node numbers its steps the same way, so a
+ * message takes the steps of both pipelines end to end.
+ */
+class hierarchical_schedule : public schedule {
+private:
+    /** The member index of each rack's leader, the sender's rack first */
+    vector<uint32_t> leaders;
+    /** The member indices of this node's rack, leader first */
+    vector<uint32_t> rack_members;
+    /** The schedule among leaders, if this node is one and there are several */
+    optional<binomial_schedule> leader_schedule;
+    /** The schedule within this node's rack, if it has other members */
+    optional<binomial_schedule> rack_schedule;
+
+    size_t get_leader_steps(size_t num_blocks) const;
+
+public:
+    /**
+     * @param members The number of members
+     * @param index This node's member index
+     * @param member_racks The rack of each member, by member index; only
+     * whether two members share a rack matters
+     */
+    hierarchical_schedule(uint32_t members, uint32_t index, const vector<uint32_t>& member_racks);
+
+    vector<uint32_t> get_connections() const;
+    optional<block_transfer> get_outgoing_transfer(size_t num_blocks, size_t send_step) const;
+    optional<block_transfer> get_incoming_transfer(size_t num_blocks, size_t receive_step) const;
+    optional<block_transfer> get_first_block(size_t num_blocks) const;
+    size_t get_total_steps(size_t num_blocks) const;
+};
+
+/**
+ * A scatter/allgather schedule for large messages. The sender deals the
+ * blocks out round-robin, sending each one only once, and every receiver
+ * forwards the blocks dealt to it to all of the other receivers, so all of
+ * the receivers' uplinks are busy at once. Forwarding starts one round after
+ * a block is dealt, and a receiver's j-th forward of a block goes 2j places
+ * around the ring of receivers, which makes every receiver get exactly one
+ * block per step. That needs an odd number of receivers, so with an even
+ * number a round has one idle step for a phantom receiver. When there are
+ * fewer blocks than receivers, the ones without a block of their own are
+ * dealt a copy of the last block, so that each receiver's first block always
+ * comes from the sender.
+ */
+class striped_schedule : public schedule {
+private:
+    /** The number of receivers, rounded up to an odd number */
+    const uint32_t period;
+
+    /** The block dealt in a step of the sender, if any */
+    optional<size_t> dealt_block(size_t num_blocks, size_t slot) const;
+    /** The block a receiver forwards after being dealt it in a slot, if any */
+    optional<size_t> owned_block(size_t num_blocks, size_t slot) const;
+    /** Whether a receiver was dealt a copy of the last block */
+    bool has_last_block_copy(size_t num_blocks, uint32_t receiver) const;
+
+public:
+    striped_schedule(uint32_t members, uint32_t index)
+            : schedule(members, index),
+              period(members < 2 ? 1 : (members - 1) | 1) {}
+
+    vector<uint32_t> get_connections() const;
+    optional<block_transfer> get_outgoing_transfer(size_t num_blocks, size_t send_step) const;
+    optional<block_transfer> get_incoming_transfer(size_t num_blocks, size_t receive_step) const;
+    optional<block_transfer> get_first_block(size_t num_blocks) const;
+    size_t get_total_steps(size_t num_blocks) const;
+};
+
 #endif /* SCHEDULE_H */
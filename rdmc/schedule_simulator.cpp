@@ -0,0 +1,223 @@
+#include "schedule_simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <map>
+#include <utility>
+
+using std::max;
+using std::min;
+using std::to_string;
+
+namespace {
+const double unknown = std::numeric_limits<double>::infinity();
+
+struct planned_send {
+    size_t step;
+    uint32_t target;
+    size_t block_number;
+    /** The index of the matching receive in the target's receive order */
+    size_t receive_index;
+};
+
+struct planned_receive {
+    uint32_t sender;
+    size_t block_number;
+};
+
+std::string describe(uint32_t sender, uint32_t receiver, size_t block_number) {
+    return "block " + to_string(block_number) + " from " + to_string(sender) + " to " + to_string(receiver);
+}
+
+/**
+ * The receives a member posts, in order, which follows group_send: the first
+ * block comes first, then every other incoming transfer by step, except that
+ * steps before the first real one that carry the first block are skipped.
+ */
+vector<planned_receive> get_receive_order(const schedule& s, size_t num_blocks) {
+    vector<planned_receive> receives;
+    const size_t total_steps = s.get_total_steps(num_blocks);
+    auto first = s.get_first_block(num_blocks);
+    if(!first) {
+        throw invalid_schedule("a receiver has no first block");
+    }
+    const size_t first_block_number = min(first->block_number, num_blocks - 1);
+    receives.push_back({first->target, first_block_number});
+
+    size_t step = 0;
+    for(; step < total_steps; step++) {
+        auto transfer = s.get_incoming_transfer(num_blocks, step);
+        if(transfer && transfer->block_number != first_block_number) {
+            break;
+        }
+    }
+    for(; step < total_steps; step++) {
+        auto transfer = s.get_incoming_transfer(num_blocks, step);
+        if(transfer) {
+            receives.push_back({transfer->target, transfer->block_number});
+        }
+    }
+    return receives;
+}
+}  // namespace
+
+schedule_simulation simulate_schedule(const vector<std::unique_ptr<schedule>>& members,
+                                      size_t message_size, size_t block_size,
+                                      double bandwidth, double latency) {
+    if(members.empty() || message_size == 0 || block_size == 0 || bandwidth <= 0) {
+        throw std::invalid_argument("simulate_schedule needs members, a message, a block size and a bandwidth");
+    }
+    const uint32_t num_members = members.size();
+    schedule_simulation simulation;
+    simulation.num_blocks = (message_size - 1) / block_size + 1;
+    const size_t num_blocks = simulation.num_blocks;
+    auto transfer_time = [&](size_t block_number) {
+        size_t nbytes = min(block_size, message_size - block_number * block_size);
+        return latency + nbytes / bandwidth;
+    };
+
+    vector<vector<planned_receive>> receives(num_members);
+    vector<vector<planned_send>> sends(num_members);
+    // The indices of the receives each receiver expects from each sender, in
+    // order. A receiver only ever has one ready-for-block outstanding, so a
+    // sender's transfers to it are matched with these in order.
+    std::map<std::pair<uint32_t, uint32_t>, std::deque<size_t>> expected_receives;
+    for(uint32_t m = 0; m < num_members; m++) {
+        simulation.total_steps = max(simulation.total_steps, members[m]->get_total_steps(num_blocks));
+        if(m == 0) {
+            continue;
+        }
+        receives[m] = get_receive_order(*members[m], num_blocks);
+        vector<bool> received(num_blocks, false);
+        for(size_t j = 0; j < receives[m].size(); j++) {
+            const planned_receive& r = receives[m][j];
+            if(r.sender >= num_members || r.sender == m || r.block_number >= num_blocks) {
+                throw invalid_schedule("member " + to_string(m) + " expects an impossible transfer, "
+                                       + describe(r.sender, m, r.block_number));
+            }
+            if(received[r.block_number]) {
+                throw invalid_schedule("member " + to_string(m) + " receives block "
+                                       + to_string(r.block_number) + " twice");
+            }
+            received[r.block_number] = true;
+            expected_receives[{r.sender, m}].push_back(j);
+        }
+        if(receives[m].size() != num_blocks) {
+            throw invalid_schedule("member " + to_string(m) + " receives only "
+                                   + to_string(receives[m].size()) + " of "
+                                   + to_string(num_blocks) + " blocks");
+        }
+    }
+
+    for(uint32_t m = 0; m < num_members; m++) {
+        const size_t total_steps = members[m]->get_total_steps(num_blocks);
+        for(size_t step = 0; step < total_steps; step++) {
+            auto transfer = members[m]->get_outgoing_transfer(num_blocks, step);
+            if(!transfer) {
+                continue;
+            }
+            if(transfer->target >= num_members || transfer->target == 0 || transfer->target == m) {
+                throw invalid_schedule("member " + to_string(m) + " sends to an impossible target at step "
+                                       + to_string(step));
+            }
+            auto& expected = expected_receives[{m, transfer->target}];
+            if(expected.empty()) {
+                throw invalid_schedule("member " + to_string(transfer->target) + " does not expect "
+                                       + describe(m, transfer->target, transfer->block_number)
+                                       + " at step " + to_string(step));
+            }
+            const size_t j = expected.front();
+            expected.pop_front();
+            const size_t expected_block = receives[transfer->target][j].block_number;
+            if(expected_block != transfer->block_number) {
+                throw invalid_schedule("member " + to_string(m) + " sends "
+                                       + describe(m, transfer->target, transfer->block_number)
+                                       + " at step " + to_string(step) + " but the receiver expects block "
+                                       + to_string(expected_block));
+            }
+            sends[m].push_back({step, transfer->target, transfer->block_number, j});
+        }
+    }
+    for(const auto& expected : expected_receives) {
+        if(!expected.second.empty()) {
+            const planned_receive& r = receives[expected.first.second][expected.second.front()];
+            throw invalid_schedule("member " + to_string(r.sender) + " never sends "
+                                   + describe(r.sender, expected.first.second, r.block_number));
+        }
+    }
+
+    // Each send waits for the member's previous send, for the block to have
+    // arrived and for the receiver's ready-for-block, which the receiver
+    // issues once its previous receive has finished. Repeatedly schedule
+    // every send whose dependencies are known; a valid schedule has no
+    // cycles among them, so this reaches every send.
+    vector<vector<double>> receive_end(num_members);
+    vector<vector<double>> block_arrival(num_members, vector<double>(num_blocks, unknown));
+    for(uint32_t m = 1; m < num_members; m++) {
+        receive_end[m].assign(receives[m].size(), unknown);
+    }
+    std::fill(block_arrival[0].begin(), block_arrival[0].end(), 0.0);
+    vector<size_t> next_send(num_members, 0);
+    vector<double> link_free(num_members, 0.0);
+    size_t remaining_sends = 0;
+    for(const auto& member_sends : sends) {
+        remaining_sends += member_sends.size();
+    }
+
+    bool progress = true;
+    while(remaining_sends > 0 && progress) {
+        progress = false;
+        for(uint32_t m = 0; m < num_members; m++) {
+            while(next_send[m] < sends[m].size()) {
+                const planned_send& send = sends[m][next_send[m]];
+                const double have_block = block_arrival[m][send.block_number];
+                const double receiver_ready = send.receive_index == 0
+                                                      ? latency
+                                                      : receive_end[send.target][send.receive_index - 1] + latency;
+                if(have_block == unknown || receiver_ready == unknown) {
+                    break;
+                }
+                const double start = max({link_free[m], have_block, receiver_ready});
+                const double end = start + transfer_time(send.block_number);
+                simulation.transfers.push_back({m, send.target, send.block_number, send.step, start, end});
+                link_free[m] = end;
+                receive_end[send.target][send.receive_index] = end;
+                block_arrival[send.target][send.block_number] = end;
+                next_send[m]++;
+                remaining_sends--;
+                progress = true;
+            }
+        }
+    }
+    if(remaining_sends > 0) {
+        for(uint32_t m = 0; m < num_members; m++) {
+            if(next_send[m] < sends[m].size()) {
+                const planned_send& send = sends[m][next_send[m]];
+                if(m != 0 && std::none_of(receives[m].begin(), receives[m].end(),
+                                          [&send](const planned_receive& r) {
+                                              return r.block_number == send.block_number;
+                                          })) {
+                    throw invalid_schedule("member " + to_string(m) + " forwards block "
+                                           + to_string(send.block_number) + " without receiving it");
+                }
+            }
+        }
+        throw invalid_schedule("the schedules deadlock with " + to_string(remaining_sends) + " transfers left");
+    }
+
+    simulation.member_completion_times = link_free;
+    for(uint32_t m = 1; m < num_members; m++) {
+        for(double end : receive_end[m]) {
+            simulation.member_completion_times[m] = max(simulation.member_completion_times[m], end);
+        }
+    }
+    simulation.completion_time = *std::max_element(simulation.member_completion_times.begin(),
+                                                   simulation.member_completion_times.end());
+    std::stable_sort(simulation.transfers.begin(), simulation.transfers.end(),
+                     [](const simulated_transfer& a, const simulated_transfer& b) {
+                         return a.start_time < b.start_time;
+                     });
+    return simulation;
+}
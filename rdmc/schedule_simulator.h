@@ -0,0 +1,70 @@
+#ifndef SCHEDULE_SIMULATOR_H
+#define SCHEDULE_SIMULATOR_H
+
+#include "schedule.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * One block transfer in a simulated multicast. Times are in seconds since the
+ * multicast started.
+ */
+struct simulated_transfer {
+    uint32_t sender;
+    uint32_t receiver;
+    size_t block_number;
+    /** The sender's step that issued the transfer */
+    size_t step;
+    double start_time;
+    double end_time;
+};
+
+struct schedule_simulation {
+    /** Every transfer of the multicast, ordered by start time */
+    vector<simulated_transfer> transfers;
+    /** When each member had sent and received all of its blocks */
+    vector<double> member_completion_times;
+    /** When the last member finished, in seconds */
+    double completion_time = 0;
+    size_t num_blocks = 0;
+    /** The largest number of steps any member's schedule takes */
+    size_t total_steps = 0;
+};
+
+/** Thrown when the members' schedules cannot work together. */
+struct invalid_schedule : public std::logic_error {
+    invalid_schedule(const std::string& what) : std::logic_error(what) {}
+};
+
+/**
+ * Plays a multicast out the way group_send does it, on a model network where
+ * every member has one full duplex link of the given bandwidth and latency,
+ * so that a schedule can be evaluated without a cluster. As in group_send, a
+ * member sends one block at a time in the order of its steps, a receiver asks
+ * for one block at a time with a ready-for-block message, which takes one
+ * latency to arrive, and a block can only be forwarded once it has arrived.
+ * Sending a block takes one latency plus its size over the bandwidth.
+ *
+ * Along the way this checks that the senders and receivers agree on every
+ * transfer, that no member forwards a block it has not received, and that
+ * every receiver gets every block exactly once.
+ *
+ * @param members The schedule of each member, by member index; member 0 is
+ * the sender
+ * @param message_size The size of the message in bytes
+ * @param block_size The size of a block in bytes
+ * @param bandwidth The bandwidth of a link in bytes per second
+ * @param latency The latency of a link in seconds
+ * @throws invalid_schedule if the schedules disagree, lose a block or would
+ * deadlock
+ */
+schedule_simulation simulate_schedule(const vector<std::unique_ptr<schedule>>& members,
+                                      size_t message_size, size_t block_size,
+                                      double bandwidth, double latency);
+
+#endif /* SCHEDULE_SIMULATOR_H */
@@ -1,16 +1,20 @@
 
 #include "util.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cinttypes>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <sstream>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <thread>
+#include <unistd.h>
 
 #ifdef USE_SLURM
 #include <slurm/slurm.h>
@@ -116,8 +120,82 @@ double compute_stddev(std::vector<double> v) {
     return std::sqrt(sq_sum / v.size() - mean * mean);
 }
 
-vector<event> events;
-std::mutex events_mutex;
+std::atomic<bool> event_tracing_enabled{false};
+
+void set_event_tracing(bool enabled) {
+    event_tracing_enabled = enabled;
+}
+
+namespace {
+// Every thread's ring, kept after the thread exits so its events can still
+// be flushed. Guarded by event_rings_mutex, which also serializes flushes.
+std::mutex event_rings_mutex;
+vector<unique_ptr<event_ring>> event_rings;
+
+// A pair of readings of the event clock and get_time() taken together, to
+// convert event timestamps to nanoseconds by interpolating between two of them
+struct clock_reading {
+    uint64_t event_time;
+    uint64_t time;
+};
+clock_reading read_clocks() {
+    return clock_reading{get_event_timestamp(), get_time()};
+}
+const clock_reading first_clock_reading = read_clocks();
+
+struct traced_event {
+    event e;
+    uint32_t thread_id;
+};
+
+// Takes the events logged since the last flush out of every ring, with
+// their times in get_time() nanoseconds. Requires event_rings_mutex.
+vector<traced_event> take_new_events() {
+    vector<traced_event> new_events;
+    for(auto &ring : event_rings) {
+        const uint64_t end = ring->next_event.load(std::memory_order_acquire);
+        const uint64_t oldest = end > event_ring::capacity ? end - event_ring::capacity : 0;
+        const uint64_t begin = std::max(ring->flushed_events, oldest);
+        const size_t first_new = new_events.size();
+        for(uint64_t i = begin; i < end; ++i) {
+            new_events.push_back(traced_event{ring->events[i % event_ring::capacity], ring->thread_id});
+        }
+        // Drop the events that the thread may have overwritten as they were copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t end_after_copy = ring->next_event.load(std::memory_order_relaxed);
+        if(end_after_copy > begin + event_ring::capacity) {
+            const size_t overwritten = std::min(end_after_copy - event_ring::capacity - begin, end - begin);
+            new_events.erase(new_events.begin() + first_new, new_events.begin() + first_new + overwritten);
+        }
+        ring->flushed_events = end;
+    }
+    const clock_reading now = read_clocks();
+    const double time_per_tick = now.event_time == first_clock_reading.event_time
+                                         ? 1.0
+                                         : (double)(now.time - first_clock_reading.time) / (now.event_time - first_clock_reading.event_time);
+    for(auto &traced : new_events) {
+        traced.e.time = first_clock_reading.time
+                        + (uint64_t)(time_per_tick * (int64_t)(traced.e.time - first_clock_reading.event_time));
+    }
+    std::stable_sort(new_events.begin(), new_events.end(),
+                     [](const traced_event &a, const traced_event &b) { return a.e.time < b.e.time; });
+    return new_events;
+}
+
+const char *file_basename(const char *path) {
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+}  // namespace
+
+event_ring *register_event_ring() {
+    auto ring = make_unique<event_ring>();
+    ring->thread_id = syscall(SYS_gettid);
+    std::unique_lock<std::mutex> lock(event_rings_mutex);
+    event_rings.emplace_back(std::move(ring));
+    return event_rings.back().get();
+}
+
 void start_flush_server() {
     auto flush_server = []() {
         while(true) {
@@ -129,12 +207,8 @@ void start_flush_server() {
     t.detach();
 }
 void flush_events() {
-    std::unique_lock<std::mutex> lock(events_mutex);
-
-    auto basename = [](const char *path) {
-        const char *base = strrchr(path, '/');
-        return base ? base + 1 : path;
-    };
+    std::unique_lock<std::mutex> lock(event_rings_mutex);
+    const vector<traced_event> new_events = take_new_events();
 
     static bool print_header = true;
     if(print_header) {
@@ -143,28 +217,62 @@ void flush_events() {
                 "block_number\n");
         print_header = false;
     }
-    for(const auto &e : events) {
+    for(const auto &traced : new_events) {
+        const event &e = traced.e;
         if(e.group_number == (uint32_t)(-1)) {
             printf("%5.6f, %s:%d, %s\n", 1.0e-6 * (e.time - epoch_start),
-                   basename(e.file), e.line, e.event_name);
+                   file_basename(e.file), e.line, e.event_name);
 
         } else if(e.message_number == (size_t)(-1)) {
             printf("%5.6f, %s:%d, %s, %" PRIu32 "\n",
-                   1.0e-6 * (e.time - epoch_start), basename(e.file), e.line,
+                   1.0e-6 * (e.time - epoch_start), file_basename(e.file), e.line,
                    e.event_name, e.group_number);
 
         } else if(e.block_number == (size_t)(-1)) {
             printf("%5.6f, %s:%d, %s, %" PRIu32 ", %zu\n",
-                   1.0e-6 * (e.time - epoch_start), basename(e.file), e.line,
+                   1.0e-6 * (e.time - epoch_start), file_basename(e.file), e.line,
                    e.event_name, e.group_number, e.message_number);
 
         } else {
             printf("%5.6f, %s:%d, %s, %" PRIu32 ", %zu, %zu\n",
-                   1.0e-6 * (e.time - epoch_start), basename(e.file), e.line,
+                   1.0e-6 * (e.time - epoch_start), file_basename(e.file), e.line,
                    e.event_name, e.group_number, e.message_number,
                    e.block_number);
         }
     }
     fflush(stdout);
-    events.clear();
+}
+
+void write_event_trace(const std::string &file_name) {
+    std::unique_lock<std::mutex> lock(event_rings_mutex);
+    const vector<traced_event> new_events = take_new_events();
+
+    FILE *trace_file = fopen(file_name.c_str(), "w");
+    if(!trace_file) {
+        fprintf(stderr, "WARNING: Could not open %s to write the event trace\n", file_name.c_str());
+        return;
+    }
+    const int pid = getpid();
+    // Instant events ("ph":"i") on their thread's track, in microseconds
+    fprintf(trace_file, "{\"traceEvents\":[");
+    for(size_t i = 0; i < new_events.size(); ++i) {
+        const event &e = new_events[i].e;
+        fprintf(trace_file,
+                "%s\n{\"name\":\"%s\",\"cat\":\"derecho\",\"ph\":\"i\",\"s\":\"t\","
+                "\"ts\":%.3f,\"pid\":%d,\"tid\":%" PRIu32 ",\"args\":{\"location\":\"%s:%d\"",
+                i == 0 ? "" : ",", e.event_name, 1.0e-3 * (e.time - epoch_start), pid,
+                new_events[i].thread_id, file_basename(e.file), e.line);
+        if(e.group_number != (uint32_t)(-1)) {
+            fprintf(trace_file, ",\"group_number\":%" PRIu32, e.group_number);
+        }
+        if(e.message_number != (size_t)(-1)) {
+            fprintf(trace_file, ",\"message_number\":%zu", e.message_number);
+        }
+        if(e.block_number != (size_t)(-1)) {
+            fprintf(trace_file, ",\"block_number\":%zu", e.block_number);
+        }
+        fprintf(trace_file, "}}");
+    }
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
 }
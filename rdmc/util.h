@@ -4,11 +4,16 @@
 
 #include "time/time.h"
 
+#include <array>
+#include <atomic>
 #include <cstdlib>
 #include <map>
 #include <mutex>
 #include <string>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 template <class T, class U>
 size_t index_of(T container, U elem) {
@@ -39,6 +44,7 @@ double compute_stddev(std::vector<double> v);
 struct event {
     const char *file;
     const char *event_name;
+    /** In the units of get_event_timestamp(); flush_events converts it */
     uint64_t time;
 
     int line;
@@ -46,16 +52,63 @@ struct event {
     size_t message_number;
     size_t block_number;
 };
-extern std::vector<event> events;
-extern std::mutex events_mutex;
+
+/**
+ * The events logged by one thread. Only that thread writes to it, so logging
+ * takes no lock: it fills the next slot and then publishes it by advancing
+ * next_event. Once the ring is full the oldest events are overwritten.
+ */
+struct event_ring {
+    static constexpr size_t capacity = 1 << 15;
+    std::array<event, capacity> events;
+    /** The number of events ever logged to this ring */
+    std::atomic<uint64_t> next_event{0};
+    /** The number of events already flushed; only read by the flushing thread */
+    uint64_t flushed_events = 0;
+    /** The kernel's ID for the thread that owns this ring */
+    uint32_t thread_id;
+};
+
+/** Whether log_event records anything. It is off unless set_event_tracing
+ * turns it on, and it can be turned on and off at any time. */
+extern std::atomic<bool> event_tracing_enabled;
+void set_event_tracing(bool enabled);
+
+/** Creates the calling thread's ring and registers it to be flushed. */
+event_ring *register_event_ring();
+
+/** A timestamp cheap enough to take on every logged event: the TSC where
+ * there is one, and get_time() otherwise. */
+inline uint64_t get_event_timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return get_time();
+#endif
+}
+
 inline void log_event(const char *file, int line, uint32_t group_number,
                       size_t message_number, size_t block_number,
                       const char *event_name) {
-    std::unique_lock<std::mutex> lock(events_mutex);
-    events.emplace_back(event{file, event_name, get_time(), line, group_number,
-                              message_number, block_number});
+    if(!event_tracing_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    static thread_local event_ring *ring = register_event_ring();
+    const uint64_t next_event = ring->next_event.load(std::memory_order_relaxed);
+    ring->events[next_event % event_ring::capacity]
+            = event{file, event_name, get_event_timestamp(), line, group_number,
+                    message_number, block_number};
+    ring->next_event.store(next_event + 1, std::memory_order_release);
 }
+/** Prints the events logged since the last flush, from all threads, in
+ * order of time. */
 void flush_events();
+/**
+ * Writes the events logged since the last flush, from all threads, to a
+ * file in the Chrome trace event format, which chrome://tracing and Perfetto
+ * can load. The events are then flushed, so flush_events won't print them.
+ */
+void write_event_trace(const std::string &file_name);
 void start_flush_server();
 #define DERECHO_LOG(sender, message_number, event_name)                        \
     do {                                                                       \
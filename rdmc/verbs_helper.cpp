@@ -1,4 +1,5 @@
 #include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -8,6 +9,7 @@
 #include <thread>
 #include <vector>
 
+#include "conf/affinity.hpp"
 #include "derecho/derecho_ports.h"
 #include "tcp/tcp.h"
 #include "util.h"
@@ -18,6 +20,9 @@
 extern "C" {
 #include <infiniband/verbs.h>
 }
+#ifdef USE_CUDA
+#include <cuda_runtime_api.h>
+#endif
 
 #ifdef INFINIBAND_VERBS_EXP_H
 #define MELLANOX_EXPERIMENTAL_VERBS
@@ -56,6 +61,7 @@ struct ibv_resources {
     ibv_pd *pd;                   // PD handle
     ibv_cq *cq;                   // CQ handle
     ibv_comp_channel *cc;         // Completion channel
+    ibv_mr *implicit_odp_mr;      // Covers the address space when implicit ODP is on
 } verbs_resources;
 
 struct completion_handler_set {
@@ -74,7 +80,7 @@ static feature_set supported_features;
 
 static atomic<bool> polling_loop_shutdown_flag;
 static void polling_loop() {
-    pthread_setname_np(pthread_self(), "rdmc_poll");
+    derecho::name_and_pin_thread("rdmc_poll");
     TRACE("Spawned main loop");
 
     const int max_work_completions = 1024;
@@ -235,6 +241,9 @@ static int modify_qp_to_rts(struct ibv_qp *qp) {
 
 namespace impl {
 void verbs_destroy() {
+    if(verbs_resources.implicit_odp_mr && ibv_dereg_mr(verbs_resources.implicit_odp_mr)) {
+        fprintf(stderr, "failed to deregister implicit ODP MR\n");
+    }
     if(verbs_resources.cq && ibv_destroy_cq(verbs_resources.cq)) {
         fprintf(stderr, "failed to destroy CQ\n");
     }
@@ -370,6 +379,16 @@ void verbs_destroy() {
         }
     }
 #endif
+    {
+        ibv_device_attr_ex attr_ex;
+        memset(&attr_ex, 0, sizeof(attr_ex));
+        if(ibv_query_device_ex(res->ib_ctx, NULL, &attr_ex) == 0) {
+            const uint32_t rc_caps = attr_ex.odp_caps.per_transport_caps.rc_odp_caps;
+            const uint32_t needed_rc_caps = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_RECV | IBV_ODP_SUPPORT_WRITE;
+            supported_features.implicit_odp = (attr_ex.odp_caps.general_caps & IBV_ODP_SUPPORT_IMPLICIT)
+                                              && (rc_caps & needed_rc_caps) == needed_rc_caps;
+        }
+    }
 
     {
         thread t(polling_loop);
@@ -476,12 +495,34 @@ bool set_contiguous_memory_mode(bool enabled) {
     return false;
 #endif
 }
+bool set_implicit_odp_mode(bool enabled) {
+    if(!enabled) {
+        if(verbs_resources.implicit_odp_mr) {
+            ibv_dereg_mr(verbs_resources.implicit_odp_mr);
+            verbs_resources.implicit_odp_mr = NULL;
+        }
+        return true;
+    }
+    if(!supported_features.implicit_odp) {
+        return false;
+    }
+    if(!verbs_resources.implicit_odp_mr) {
+        int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_ON_DEMAND;
+        verbs_resources.implicit_odp_mr = ibv_reg_mr(verbs_resources.pd, NULL, SIZE_MAX, mr_flags);
+    }
+    return verbs_resources.implicit_odp_mr != NULL;
+}
 }  // namespace impl
 
 using ibv_mr_unique_ptr = unique_ptr<ibv_mr, std::function<void(ibv_mr *)>>;
 static ibv_mr_unique_ptr create_mr(char *buffer, size_t size) {
     if(!buffer || size == 0) throw rdma::invalid_args();
 
+    // The implicit MR already covers the buffer, and outlives every region
+    if(verbs_resources.implicit_odp_mr) {
+        return ibv_mr_unique_ptr(verbs_resources.implicit_odp_mr, [](ibv_mr *) {});
+    }
+
     int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
 
     ibv_mr_unique_ptr mr = ibv_mr_unique_ptr(
@@ -514,7 +555,8 @@ static ibv_mr_unique_ptr create_contiguous_mr(size_t size) {
 memory_region::memory_region(size_t s, bool contiguous)
         : mr(contiguous ? create_contiguous_mr(s) : create_mr(new char[s], s)),
           buffer((char *)mr->addr),
-          size(s) {
+          size(s),
+          cuda_device(-1) {
     if(contiguous) {
         memset(buffer, 0, size);
     } else {
@@ -528,7 +570,22 @@ memory_region::memory_region(size_t s, bool contiguous) : memory_region(new char
 #endif
 
 memory_region::memory_region(size_t s) : memory_region(s, contiguous_memory_mode) {}
-memory_region::memory_region(char *buf, size_t s) : mr(create_mr(buf, s)), buffer(buf), size(s) {}
+memory_region::memory_region(char *buf, size_t s) : mr(create_mr(buf, s)), buffer(buf), size(s), cuda_device(-1) {}
+#ifdef USE_CUDA
+memory_region::memory_region(char *buf, size_t s, int device) : mr(create_mr(buf, s)), buffer(buf), size(s), cuda_device(device) {}
+#endif
+
+void memory_region::copy_from_host(size_t offset, const char *source, size_t length) const {
+#ifdef USE_CUDA
+    if(cuda_device >= 0) {
+        if(cudaMemcpy(buffer + offset, source, length, cudaMemcpyHostToDevice) != cudaSuccess) {
+            throw rdma::exception();
+        }
+        return;
+    }
+#endif
+    memcpy(buffer + offset, source, length);
+}
 
 uint32_t memory_region::get_rkey() const { return mr->rkey; }
 
@@ -34,7 +34,8 @@ class unsupported_feature : public exception {};
 
 /**
  * A C++ wrapper for the IB Verbs ibv_mr struct. Registers a memory region for
- * the provided buffer on construction, and deregisters it on destruction.
+ * the provided buffer on construction, and deregisters it on destruction,
+ * unless implicit ODP is enabled (see impl::set_implicit_odp_mode).
  * Instances of this class can only be created after global Verbs initialization
  * has been run, since it depends on the global Verbs resources.
  */
@@ -49,10 +50,19 @@ class memory_region {
 public:
     memory_region(size_t size);
     memory_region(char* buffer, size_t size);
+#ifdef USE_CUDA
+    /** Registers CUDA device memory; ibv_reg_mr accepts device pointers
+     * once the nvidia-peermem module is loaded. */
+    memory_region(char* buffer, size_t size, int cuda_device);
+#endif
+    /** Copies host memory into the region, with cudaMemcpy if it is in device memory */
+    void copy_from_host(size_t offset, const char* source, size_t length) const;
     uint32_t get_rkey() const;
 
     char* const buffer;
     const size_t size;
+    /** The CUDA device that buffer is on, or -1 if it is in host memory */
+    const int cuda_device;
 };
 
 class remote_memory_region {
@@ -168,6 +178,7 @@ public:
 struct feature_set {
     bool contiguous_memory;
     bool cross_channel;
+    bool implicit_odp;
 };
 feature_set get_supported_features();
 
@@ -191,6 +202,14 @@ std::map<uint32_t, remote_memory_region> verbs_exchange_memory_regions(
 
 bool set_interrupt_mode(bool enabled);
 bool set_contiguous_memory_mode(bool enabled);
+/**
+ * With implicit ODP enabled, memory regions for existing buffers are not
+ * registered: they all use a single on-demand-paging memory region that
+ * covers the whole address space, and the HCA faults pages in as they are
+ * accessed. Must be set before any memory regions are created. Returns false
+ * if the device doesn't support implicit ODP.
+ */
+bool set_implicit_odp_mode(bool enabled);
 
 } /* namespace impl */
 } /* namespace rdma */
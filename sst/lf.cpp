@@ -2,19 +2,34 @@
  * @file lf.cpp
  * Implementation of RDMA interface defined in lf.h.
  */
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <byteswap.h>
 #include <rdma/fabric.h>
 #include <rdma/fi_domain.h>
 #include <rdma/fi_cm.h>
 #include <rdma/fi_rma.h>
 #include <rdma/fi_errno.h>
+#include <conf/affinity.hpp>
+#include <conf/completion_poller.hpp>
 #include <conf/conf.hpp>
 
 #ifndef NDEBUG
@@ -23,6 +38,7 @@
 
 #include "derecho/connection_manager.h"
 #include "poll_utils.h"
+#include "tcp/emulation.h"
 #include "tcp/tcp.h"
 #include "lf.h"
 
@@ -72,17 +88,20 @@ namespace sst{
    * passive endpoint info to be exchanged.
    */
   struct cm_con_data_t {
-    #define MAX_LF_ADDR_SIZE    ((128)-sizeof(uint32_t)-2*sizeof(uint64_t))
+    #define MAX_LF_ADDR_SIZE    ((128)-sizeof(uint32_t)-4*sizeof(uint64_t))
     uint32_t           pep_addr_len; // local endpoint address length
     char               pep_addr[MAX_LF_ADDR_SIZE];
                                           // local endpoint address
     uint64_t           mr_key; // local memory key
     uint64_t           vaddr;  // virtual addr
+    uint64_t           endpoint_id;     // the shared endpoint to reuse, or 0
+    uint64_t           new_endpoint_id; // the ID proposed for a new shared endpoint, or 0
   } __attribute__((packed));
 
   /**
    * Global States
    */
+  static void release_resources();
   class lf_ctxt {
   public:
     // libfabric resources
@@ -94,9 +113,11 @@ namespace sst{
     struct fid_eq      * peq;             // event queue for connection management
     // struct fid_eq      * eq;           // event queue for transmitting events --> now move to resources.
     struct fid_cq      * cq;              // completion queue for all rma operations
+    struct fid_ep      * rdm_ep;          // in RDM mode, the endpoint for all remote nodes
+    struct fid_av      * av;              // in RDM mode, the address vector of rdm_ep
     size_t             pep_addr_len;      // length of local pep address
     char               pep_addr[MAX_LF_ADDR_SIZE];
-                                          // local pep address
+                                          // local pep address, or the address of rdm_ep
     // configuration resources
     struct fi_eq_attr  eq_attr;           // event queue attributes
     struct fi_cq_attr  cq_attr;           // completion queue attributes
@@ -107,16 +128,40 @@ namespace sst{
     // #define DEFAULT_SGE_BATCH_SIZE      (8)
     // uint32_t           sge_bat_size;      // maximum scatter/gather batch size
     virtual ~lf_ctxt() {
-      lf_destroy();
+      release_resources();
     }
   };
   #define LF_CONFIG_FILE "rdma.cfg"
   #define LF_USE_VADDR ((g_ctxt.fi->domain_attr->mr_mode) & (FI_MR_VIRT_ADDR|FI_MR_BASIC))
   static bool shutdown = false;
+  /** Whether all remote nodes are reached through one reliable datagram
+   * endpoint (CONF_RDMA_RDM_ENDPOINT) instead of an endpoint each */
+  static bool rdm_mode = false;
+  /** Whether RDMA is emulated over TCP (RDMA/provider = tcp_emulation), in
+   * which case there is no fabric and no polling thread */
+  static bool tcp_mode = false;
+  /** Every how many operations on an endpoint one gets a completion, or 0 */
+  static uint32_t signal_interval = 0;
+  /** In RDM mode, the operations posted on the RDM endpoint without a
+   * completion since the last one with a completion */
+  static std::atomic<uint32_t> rdm_unsignaled_ops{0};
+  /** The context of the completions only requested to drain the send queue,
+   * which the polling thread drops since its ce_idx is invalid */
+  static struct lf_sender_ctxt signal_ctxt = {0xFFFFFFFF, 0};
   std::thread polling_thread;
+  /** The SST's source in the unified CompletionPoller, if it is used instead of polling_thread */
+  static std::optional<uint64_t> poller_source_id;
   tcp::tcp_connections *sst_connections;
   // singlton: global states
   lf_ctxt g_ctxt;
+  /** Every Group in the process shares g_ctxt, the polling thread and the
+   * TCP connections, so lf_initialize() only opens them for the first one
+   * and lf_destroy() only closes them after the last one */
+  static std::mutex lf_users_mutex;
+  static uint32_t num_lf_users = 0;
+  /** The number of Groups each remote node is a member of, which all share
+   * its connections */
+  static std::map<uint32_t, uint32_t> node_users;
 
   /**
    * Internal Tools
@@ -177,6 +222,156 @@ namespace sst{
       } \
     } while (0)
 
+  /**
+   * An endpoint that the SSTs of successive views share, so that a member
+   * who stays in the group keeps its connection across a view change. Only
+   * one-sided operations go through it, so the users never compete for
+   * posted receives.
+   */
+  struct shared_endpoint {
+    /** Agreed on by both sides: the proposer's node ID and a counter */
+    const uint64_t id;
+    struct fid_ep *const ep;
+    struct fid_eq *const eq;
+    /** the operations posted on ep without a completion since the last one
+     * with a completion, counted across all of its users */
+    std::atomic<uint32_t> unsignaled_ops{0};
+
+    shared_endpoint(uint64_t id, struct fid_ep *ep, struct fid_eq *eq) : id(id), ep(ep), eq(eq) {}
+    ~shared_endpoint() {
+      if(ep)
+        FAIL_IF_NONZERO(fi_close(&ep->fid),"close shared endpoint",REPORT_ON_FAILURE);
+      if(eq)
+        FAIL_IF_NONZERO(fi_close(&eq->fid),"close shared event queue",REPORT_ON_FAILURE);
+    }
+  };
+  /** Maps node IDs to the shared endpoints connected to them */
+  static std::map<uint32_t, std::weak_ptr<shared_endpoint>> shared_endpoints;
+  static std::mutex shared_endpoints_mutex;
+  static uint32_t my_node_id;
+  /** The number of shared endpoint IDs this node has proposed */
+  static uint32_t num_endpoint_ids = 0;
+  /**
+   * Connection requests that arrived on the passive endpoint for a remote node
+   * whose server side hasn't picked them up yet, by the node ID the client
+   * sent as connection data. Endpoints are connected in parallel, so the one
+   * thread reading the passive event queue at a time hands out the requests
+   * for the others.
+   */
+  static std::multimap<uint32_t, struct fi_info *> pending_connreqs;
+  static std::mutex connreq_mutex;
+  static std::condition_variable connreq_cv;
+  static bool reading_connreqs = false;
+
+  /** Waits for the connection request of a remote node on the passive endpoint */
+  static struct fi_info *wait_for_connreq(uint32_t remote_id) {
+    std::unique_lock<std::mutex> lock(connreq_mutex);
+    while (true) {
+      auto it = pending_connreqs.find(remote_id);
+      if (it != pending_connreqs.end()) {
+        struct fi_info *info = it->second;
+        pending_connreqs.erase(it);
+        return info;
+      }
+      if (reading_connreqs) {
+        connreq_cv.wait(lock);
+        continue;
+      }
+      reading_connreqs = true;
+      lock.unlock();
+      alignas(struct fi_eq_cm_entry) char buf[sizeof(struct fi_eq_cm_entry) + sizeof(uint32_t)];
+      struct fi_eq_cm_entry *entry = (struct fi_eq_cm_entry *)buf;
+      uint32_t event;
+      ssize_t nRead = fi_eq_sread(g_ctxt.peq, &event, entry, sizeof(buf), -1, 0);
+      lock.lock();
+      reading_connreqs = false;
+      if (nRead < (ssize_t)sizeof(buf) || event != FI_CONNREQ) {
+        dbg_error("failed to get connection from remote.");
+        CRASH_WITH_MESSAGE("failed to get connection from remote. nRead=%ld\n",nRead);
+      }
+      uint32_t client_id;
+      memcpy(&client_id,entry->data,sizeof(client_id));
+      pending_connreqs.emplace(ntohl(client_id),entry->info);
+      connreq_cv.notify_all();
+    }
+  }
+  /** The ce_idx of the receives that notifications arrive in */
+  #define LF_NOTIFICATION_CE_IDX 0xFFFFFFFEu
+  /** The number of receives each resources keeps posted for notifications */
+  #define LF_NOTIFICATION_RECVS 16
+  /**
+   * The context of a receive posted for notifications. It starts with an
+   * lf_sender_ctxt, whose ce_idx tells the polling thread what it is. A
+   * receive may still complete after its resources is gone, so a context is
+   * only reused once its receive completed with no endpoint to repost it on.
+   */
+  struct notification_ctxt {
+    struct lf_sender_ctxt sctxt;
+    /** The endpoint to repost the receive on, or nullptr once it is closed */
+    struct fid_ep *ep;
+    fi_addr_t addr;
+  };
+  /** Whether SST notifications are on (CONF_DERECHO_SST_NOTIFICATIONS) */
+  static bool notifications = false;
+  /** Guards the notification contexts and num_notifications */
+  static std::mutex notification_mutex;
+  static std::condition_variable notification_cv;
+  static std::atomic<uint64_t> num_notifications{0};
+  /** All notification contexts; a deque, so they never move */
+  static std::deque<notification_ctxt> notification_ctxts;
+  static std::vector<notification_ctxt*> free_notification_ctxts;
+  /** In RDM mode, maps node IDs to their endpoint addresses and the entries
+   * they were inserted as in the address vector */
+  static std::map<uint32_t, std::pair<std::string, fi_addr_t>> rdm_peers;
+  static std::mutex rdm_peers_mutex;
+
+  /** Get the address vector entry of a remote node's RDM endpoint, inserting
+   * it the first time, or again if the node came back with a new address */
+  static fi_addr_t rdm_peer_addr(uint32_t node_id, const char *addr, size_t addr_len) {
+    const std::string name(addr, addr_len);
+    std::lock_guard<std::mutex> lock(rdm_peers_mutex);
+    auto it = rdm_peers.find(node_id);
+    if (it != rdm_peers.end() && it->second.first == name) {
+      return it->second.second;
+    }
+    fi_addr_t fi_addr;
+    if (fi_av_insert(g_ctxt.av, addr, 1, &fi_addr, 0, NULL) != 1) {
+      CRASH_WITH_MESSAGE("failed to insert the address of node %u into the address vector.\n", node_id);
+    }
+    rdm_peers[node_id] = {name, fi_addr};
+    return fi_addr;
+  }
+
+  /** Posts the receive of a notification context; the caller holds
+   * notification_mutex */
+  static void post_notification_recv(notification_ctxt *nctxt) {
+    struct fi_msg msg;
+    memset(&msg,0,sizeof(msg));
+    msg.addr = nctxt->addr;
+    msg.context = (void*)nctxt;
+    FAIL_IF_NONZERO(fi_recvmsg(nctxt->ep,&msg,FI_COMPLETION),"post a receive for notifications",REPORT_ON_FAILURE);
+  }
+
+  /** Called by the polling thread when a notification receive completes,
+   * or with nctxt == nullptr when a provider that needs no receives for
+   * remote CQ data reports a notification */
+  static void notification_received(notification_ctxt *nctxt, bool success) {
+    {
+      std::lock_guard<std::mutex> lock(notification_mutex);
+      if (nctxt && !nctxt->ep) {
+        free_notification_ctxts.push_back(nctxt);
+      } else if (nctxt && success) {
+        post_notification_recv(nctxt);
+      }
+      if (success) {
+        num_notifications++;
+      }
+    }
+    if (success) {
+      notification_cv.notify_all();
+    }
+  }
+
   /** initialize the context with default value */
   static void default_context() {
     memset((void*)&g_ctxt,0,sizeof(lf_ctxt));
@@ -185,6 +380,16 @@ namespace sst{
     g_ctxt.hints->caps = FI_MSG|FI_RMA|FI_READ|FI_WRITE|FI_REMOTE_READ|FI_REMOTE_WRITE;
     g_ctxt.hints->ep_attr->type = FI_EP_MSG; // use connection based endpoint by default.
     g_ctxt.hints->mode = ~0; // all modes
+    if (rdm_mode) {
+      // One endpoint serves every remote node and every thread, and a
+      // two-sided receive has to name the node it is from
+      g_ctxt.hints->ep_attr->type = FI_EP_RDM;
+      g_ctxt.hints->caps |= FI_DIRECTED_RECV;
+      g_ctxt.hints->domain_attr->threading = FI_THREAD_SAFE;
+      // op contexts are lf_sender_ctxt, not fi_context the provider may use
+      // (RDM providers such as efa and psm2 would otherwise ask for them)
+      g_ctxt.hints->mode &= ~(FI_CONTEXT | FI_CONTEXT2);
+    }
 
     // g_ctxt.hints->tx_attr->rma_iov_limit = DEFAULT_SGE_BATCH_SIZE; // 
     // g_ctxt.hints->tx_attr->iov_limit = DEFAULT_SGE_BATCH_SIZE;
@@ -255,24 +460,62 @@ namespace sst{
     return ret;
   }
 
-  void _resources::connect_endpoint(bool is_lf_server) {
+  void _resources::connect_endpoint(bool is_lf_server, bool share) {
+    if (tcp_mode) {
+      connect_channel();
+      return;
+    }
     dbg_trace("preparing connection to remote node(id=%d)...\n",this->remote_id);
     struct cm_con_data_t local_cm_data,remote_cm_data;
 
+    // Offer the endpoint an older SST still holds, if there is one; it is
+    // only reused if the remote side offers the same one back
+    std::shared_ptr<shared_endpoint> existing;
+    uint64_t proposed_id = 0;
+    if (share && !rdm_mode) {
+      std::lock_guard<std::mutex> lock(shared_endpoints_mutex);
+      auto it = shared_endpoints.find(this->remote_id);
+      if (it != shared_endpoints.end()) {
+        existing = it->second.lock();
+      }
+      proposed_id = ((uint64_t)my_node_id << 32) | ++num_endpoint_ids;
+    }
+    local_cm_data.endpoint_id = (uint64_t)htonll(existing ? existing->id : 0);
+    local_cm_data.new_endpoint_id = (uint64_t)htonll(proposed_id);
+
     // STEP 1 exchange CM info
     dbg_trace("Exchanging connection management info.");
     local_cm_data.pep_addr_len = (uint32_t)htonl((uint32_t)g_ctxt.pep_addr_len);
     memcpy((void*)&local_cm_data.pep_addr,&g_ctxt.pep_addr,g_ctxt.pep_addr_len);
     local_cm_data.mr_key = (uint64_t)htonll(this->mr_lwkey);
-    local_cm_data.vaddr = (uint64_t)htonll((uint64_t)this->write_buf); // for pull mode
+    local_cm_data.vaddr = (uint64_t)htonll((LF_USE_VADDR)?(uint64_t)this->write_buf:this->write_mr_offset); // for pull mode
 
     FAIL_IF_ZERO(sst_connections->exchange(this->remote_id,local_cm_data,remote_cm_data),"exchange connection management info.",CRASH_ON_FAILURE);
 
     remote_cm_data.pep_addr_len = (uint32_t)ntohl(remote_cm_data.pep_addr_len);
     this->mr_rwkey = (uint64_t)ntohll(remote_cm_data.mr_key);
     this->remote_fi_addr = (fi_addr_t)ntohll(remote_cm_data.vaddr);
+    const uint64_t remote_endpoint_id = (uint64_t)ntohll(remote_cm_data.endpoint_id);
+    const uint64_t remote_proposed_id = (uint64_t)ntohll(remote_cm_data.new_endpoint_id);
     dbg_trace("Exchanging connection management info succeeds.");
 
+    if (rdm_mode) {
+      // there is nothing to connect: the remote node is an address of the
+      // endpoint all of them share
+      this->ep = g_ctxt.rdm_ep;
+      this->eq = nullptr;
+      this->peer_addr = rdm_peer_addr(this->remote_id, remote_cm_data.pep_addr, remote_cm_data.pep_addr_len);
+      return;
+    }
+
+    if (existing && existing->id == remote_endpoint_id) {
+      dbg_trace("reusing shared endpoint {} to remote node.", existing->id);
+      this->connection = existing;
+      this->ep = existing->ep;
+      this->eq = existing->eq;
+      return;
+    }
+
     // STEP 2 connect to remote
     dbg_trace("connect to remote node.");
     ssize_t nRead;
@@ -283,11 +526,7 @@ namespace sst{
       dbg_trace("connecting as a server.");
       dbg_trace("waiting for connection.");
 
-      nRead = fi_eq_sread(g_ctxt.peq, &event, &entry, sizeof(entry), -1, 0);
-      if(nRead != sizeof(entry)) {
-        dbg_error("failed to get connection from remote.");
-        CRASH_WITH_MESSAGE("failed to get connection from remote. nRead=%ld\n",nRead);
-      }
+      entry.info = wait_for_connreq(this->remote_id);
       if(init_endpoint(entry.info)){
         fi_reject(g_ctxt.pep, entry.info->handle, NULL, 0);
         fi_freeinfo(entry.info);
@@ -317,7 +556,9 @@ namespace sst{
         CRASH_WITH_MESSAGE("failed to initialize client endpoint.\n");
       }
 
-      FAIL_IF_NONZERO(fi_connect(this->ep, remote_cm_data.pep_addr, NULL, 0),"fi_connect()",CRASH_ON_FAILURE);
+      // tell the server which node this is, see wait_for_connreq()
+      const uint32_t client_id = htonl(my_node_id);
+      FAIL_IF_NONZERO(fi_connect(this->ep, remote_cm_data.pep_addr, &client_id, sizeof(client_id)),"fi_connect()",CRASH_ON_FAILURE);
 
       nRead = fi_eq_sread(this->eq, &event, &entry, sizeof(entry), -1, 0);
       if (nRead != sizeof(entry)) {
@@ -335,6 +576,53 @@ namespace sst{
       fi_freeinfo(client_hints);
       fi_freeinfo(client_info);
     }
+
+    if (proposed_id && remote_proposed_id) {
+      // the server's proposal names the endpoint on both sides
+      this->connection = std::make_shared<shared_endpoint>(
+        is_lf_server ? proposed_id : remote_proposed_id, this->ep, this->eq);
+      std::lock_guard<std::mutex> lock(shared_endpoints_mutex);
+      shared_endpoints[this->remote_id] = this->connection;
+    }
+  }
+
+  void _resources::connect_channel() {
+    dbg_trace("preparing emulated connection to remote node(id={})...",this->remote_id);
+    struct cm_con_data_t local_cm_data,remote_cm_data;
+    memset(&local_cm_data,0,sizeof(local_cm_data));
+
+    // completions arrive on the emulation thread, and go where the polling
+    // thread would put them
+    this->emulated_channel = tcp::emulation::create_channel([](const tcp::emulation::completion &c) {
+      struct lf_sender_ctxt *sctxt = (struct lf_sender_ctxt *)c.context;
+      if (sctxt) {
+        util::polling_data.insert_completion_entry(sctxt->ce_idx, {sctxt->remote_id, c.success ? 1 : -1});
+      }
+    });
+    // the address is the emulation's port and the channel, and the remote
+    // nodes address write_buf by its offset in the registration
+    const uint16_t port = tcp::emulation::get_port();
+    const uint32_t channel_id = this->emulated_channel->get_id();
+    local_cm_data.pep_addr_len = (uint32_t)htonl((uint32_t)(sizeof(port) + sizeof(channel_id)));
+    memcpy(local_cm_data.pep_addr,&port,sizeof(port));
+    memcpy(local_cm_data.pep_addr + sizeof(port),&channel_id,sizeof(channel_id));
+    local_cm_data.mr_key = (uint64_t)htonll(this->mr_lwkey);
+    local_cm_data.vaddr = (uint64_t)htonll(this->write_mr_offset);
+
+    FAIL_IF_ZERO(sst_connections->exchange(this->remote_id,local_cm_data,remote_cm_data),"exchange connection management info.",CRASH_ON_FAILURE);
+
+    this->mr_rwkey = (uint64_t)ntohll(remote_cm_data.mr_key);
+    this->remote_fi_addr = (fi_addr_t)ntohll(remote_cm_data.vaddr);
+    uint16_t remote_port;
+    uint32_t remote_channel;
+    memcpy(&remote_port,remote_cm_data.pep_addr,sizeof(remote_port));
+    memcpy(&remote_channel,remote_cm_data.pep_addr + sizeof(remote_port),sizeof(remote_channel));
+    const std::string remote_ip = sst_connections->get_socket(this->remote_id).get().get_remote_ip();
+    if (!this->emulated_channel->connect(this->remote_id,remote_ip,remote_port,remote_channel)) {
+      CRASH_WITH_MESSAGE("failed to connect to remote node %d over TCP.\n",this->remote_id);
+    }
+    this->ep = nullptr;
+    this->eq = nullptr;
   }
 
   /**
@@ -365,6 +653,16 @@ namespace sst{
 
 #define LF_RMR_KEY(rid) (((uint64_t)0xf0000000)<<32 | (uint64_t)(rid))
 #define LF_WMR_KEY(rid) (((uint64_t)0xf8000000)<<32 | (uint64_t)(rid))
+    if (tcp_mode) {
+      // only the remote node accesses write_buf; read_buf is just the
+      // source of writes, which needs no registration
+      this->write_mr = nullptr;
+      this->read_mr = nullptr;
+      this->mr_lwkey = tcp::emulation::register_region(write_buf,size_w);
+      this->mr_lrkey = 0;
+      connect_endpoint(is_lf_server, false);
+      return;
+    }
     // register the write buffer
     FAIL_IF_NONZERO(
       fi_mr_reg(
@@ -394,31 +692,177 @@ namespace sst{
       CRASH_WITH_MESSAGE("fail to get write memory key.");
     }
     // set up the endpoint
-    connect_endpoint(is_lf_server);
+    connect_endpoint(is_lf_server, false);
   }
 
+  _resources::_resources(
+    int r_id,
+    char *write_addr,
+    char *read_addr,
+    const memory_region &region,
+    int is_lf_server) {
+
+    dbg_info("resources constructor:this={}",(void*)this);
+
+    this->remote_id = r_id;
+    this->write_buf = write_addr;
+    this->read_buf = read_addr;
+    // both buffers are covered by the region's registration
+    this->write_mr = region.mr;
+    this->read_mr = region.mr;
+    this->mr_lrkey = region.key;
+    this->mr_lwkey = region.key;
+    this->write_mr_offset = (uint64_t)(write_addr - region.buf);
+    this->owns_memory_regions = false;
+    connect_endpoint(is_lf_server, true);
+    map_remote_rows(region);
+  }
+
+  /**
+   * rows in shared memory to be exchanged.
+   */
+  struct shm_con_data_t {
+    char               host_id[64];      // the kernel's boot id, or empty
+    char               segment_name[64]; // local shared memory segment, or empty
+    uint64_t           segment_size;     // the size of the segment
+    uint64_t           offset;           // where the remote node's row is in it
+  } __attribute__((packed));
+
+  /**
+   * Identifies the running kernel, and so the host, unlike its host name,
+   * which two machines (or a machine and a container) can share. Empty if
+   * it can't be read, in which case nothing is shared.
+   */
+  static const std::string& host_identity() {
+    static const std::string boot_id = []() {
+      std::string id;
+      std::ifstream boot_id_file("/proc/sys/kernel/random/boot_id");
+      std::getline(boot_id_file, id);
+      return id;
+    }();
+    return boot_id;
+  }
+
+  void _resources::map_remote_rows(const memory_region &region) {
+    struct shm_con_data_t local_shm_data,remote_shm_data;
+    memset(&local_shm_data,0,sizeof(local_shm_data));
+    if (host_identity().size() < sizeof(local_shm_data.host_id)) {
+      strcpy(local_shm_data.host_id,host_identity().c_str());
+    }
+    if (region.shm_name.size() < sizeof(local_shm_data.segment_name)) {
+      strcpy(local_shm_data.segment_name,region.shm_name.c_str());
+    }
+    local_shm_data.segment_size = (uint64_t)htonll((uint64_t)region.size);
+    local_shm_data.offset = (uint64_t)htonll(this->write_mr_offset);
+    FAIL_IF_ZERO(sst_connections->exchange(this->remote_id,local_shm_data,remote_shm_data),"exchange shared memory info.",CRASH_ON_FAILURE);
+
+    remote_shm_data.host_id[sizeof(remote_shm_data.host_id) - 1] = '\0';
+    remote_shm_data.segment_name[sizeof(remote_shm_data.segment_name) - 1] = '\0';
+    open_remote_rows(remote_shm_data.segment_name,
+                     local_shm_data.host_id[0] != '\0' && strcmp(local_shm_data.host_id,remote_shm_data.host_id) == 0,
+                     (std::size_t)ntohll(remote_shm_data.segment_size),(uint64_t)ntohll(remote_shm_data.offset));
+    // Once both sides are past this, each has opened the other's segment
+    // (or given up on it), so the SST can unlink its own
+    bool local_done = true, remote_done;
+    FAIL_IF_ZERO(sst_connections->exchange(this->remote_id,local_done,remote_done),"exchange shared memory mapping done.",CRASH_ON_FAILURE);
+  }
+
+  void _resources::open_remote_rows(const char *segment_name, bool same_host, std::size_t segment_size, uint64_t offset) {
+    if (segment_name[0] == '\0' || !same_host || offset >= segment_size) {
+      return;
+    }
+    // Either side may fail to share: each direction falls back to the NIC on its own
+    const int fd = shm_open(segment_name, O_RDWR, 0);
+    if (fd < 0) {
+      dbg_warn("{}:{} could not open shared memory segment {} of remote node {}",__FILE__,__func__,segment_name,this->remote_id);
+      return;
+    }
+    struct stat segment_stat;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd,&segment_stat) == 0 && (std::size_t)segment_stat.st_size == segment_size) {
+      mapping = mmap(nullptr,segment_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      return;
+    }
+    dbg_trace("{}:{} writing to remote node {} through shared memory segment {}",__FILE__,__func__,this->remote_id,segment_name);
+    this->remote_rows = (char*)mapping;
+    this->remote_rows_size = segment_size;
+    this->shm_remote_buf = this->remote_rows + offset;
+  }
+
+
   _resources::~_resources(){
     dbg_trace("resources destructor:this={}",(void*)this);
     // if(this->txcq) 
     //  FAIL_IF_NONZERO(fi_close(&this->txcq->fid),"close txcq",REPORT_ON_FAILURE);
     // if(this->rxcq) 
     //  FAIL_IF_NONZERO(fi_close(&this->rxcq->fid),"close rxcq",REPORT_ON_FAILURE);
-    if(this->ep) 
-      FAIL_IF_NONZERO(fi_close(&this->ep->fid),"close endpoint",REPORT_ON_FAILURE);
-    if(this->eq)
-      FAIL_IF_NONZERO(fi_close(&this->eq->fid),"close event",REPORT_ON_FAILURE);
+    if(this->remote_rows)
+      munmap(this->remote_rows,this->remote_rows_size);
+    if(!this->notification_recvs.empty()) {
+      // their receives can complete later, but are no longer reposted
+      std::lock_guard<std::mutex> lock(notification_mutex);
+      for(auto nctxt : this->notification_recvs)
+        nctxt->ep = nullptr;
+    }
+    if(this->emulated_channel) {
+      this->emulated_channel.reset();
+      if(this->owns_memory_regions)
+        tcp::emulation::deregister_region((uint32_t)this->mr_lwkey);
+      return;
+    }
+    // a shared endpoint is closed by its last user, and the RDM endpoint by
+    // lf_destroy()
+    if(!this->connection && this->ep != g_ctxt.rdm_ep) {
+      if(this->ep) 
+        FAIL_IF_NONZERO(fi_close(&this->ep->fid),"close endpoint",REPORT_ON_FAILURE);
+      if(this->eq)
+        FAIL_IF_NONZERO(fi_close(&this->eq->fid),"close event",REPORT_ON_FAILURE);
+    }
+    if(!this->owns_memory_regions)
+      return;
     if(this->write_mr)
       FAIL_IF_NONZERO(fi_close(&this->write_mr->fid),"unregister write mr",REPORT_ON_FAILURE);
     if(this->read_mr)
       FAIL_IF_NONZERO(fi_close(&this->read_mr->fid),"unregister read mr",REPORT_ON_FAILURE);
   }
 
+  memory_region::memory_region(char *buf, std::size_t size, const std::string &shm_name)
+      : buf(buf), size(size), shm_name(shm_name) {
+    if (tcp_mode) {
+      this->mr = nullptr;
+      this->key = tcp::emulation::register_region(buf,size);
+      return;
+    }
+    FAIL_IF_NONZERO(
+      fi_mr_reg(
+        g_ctxt.domain,buf,size,FI_SEND|FI_RECV|FI_READ|FI_WRITE|FI_REMOTE_READ|FI_REMOTE_WRITE,
+        0, 0, 0, &this->mr, NULL),
+      "register memory region",
+      CRASH_ON_FAILURE);
+    this->key = fi_mr_key(this->mr);
+    if (this->key == FI_KEY_NOTAVAIL) {
+      CRASH_WITH_MESSAGE("fail to get memory region key.");
+    }
+  }
+
+  memory_region::~memory_region() {
+    if(tcp_mode && !this->mr)
+      tcp::emulation::deregister_region((uint32_t)this->key);
+    if(this->mr)
+      FAIL_IF_NONZERO(fi_close(&this->mr->fid),"unregister memory region",REPORT_ON_FAILURE);
+  }
+
   int _resources::post_remote_send(
     struct lf_sender_ctxt *ctxt,
     const long long int offset,
     const long long int size,
     const int op,
-    const bool completion) {
+    const bool completion,
+    const bool more,
+    const bool inject) {
     // dbg_trace("resources::post_remote_send(),this={}",(void*)this);
     // #ifdef !NDEBUG
     // printf(YEL "resources::post_remote_send(),this=%p\n" RESET, this);
@@ -427,6 +871,59 @@ namespace sst{
     // dbg_trace("resources::post_remote_send(ctxt=({},{}),offset={},size={},op={},completion={})",ctxt?ctxt->ce_idx:0,ctxt?ctxt->remote_id:0,offset,size,op,completion);
 
     int ret = 0;
+    const uint64_t more_flag = ((more) ? FI_MORE : 0) | ((inject) ? FI_INJECT : 0);
+
+    // A remote node on this host is written with a memcpy, in the order of
+    // the calls, as the NIC would. A write that asks for a completion still
+    // goes through the NIC: a memcpy succeeds even if the remote process has
+    // died, and those completions are how the SST notices that it has.
+    if (this->shm_remote_buf && (op == 0 || op == 1) && !completion
+        && this->shm_remote_buf + offset + size <= this->remote_rows + this->remote_rows_size) {
+      std::atomic_thread_fence(std::memory_order_release);
+      if (op == 1) {
+        memcpy(this->shm_remote_buf + offset, read_buf + offset, size);
+      } else {
+        memcpy(read_buf + offset, this->shm_remote_buf + offset, size);
+      }
+      std::atomic_thread_fence(std::memory_order_release);
+      return 0;
+    }
+
+    if (this->emulated_channel) {
+      bool posted;
+      if (op == 3) {
+        return 0;
+      } else if (op == 1) {
+        posted = this->emulated_channel->post_write(read_buf + offset, size, (uint32_t)this->mr_rwkey,
+                                                    remote_fi_addr + offset, (uint64_t)ctxt, completion);
+      } else if (op == 0) {
+        posted = this->emulated_channel->post_read(read_buf + offset, size, (uint32_t)this->mr_rwkey,
+                                                   remote_fi_addr + offset, (uint64_t)ctxt);
+      } else {
+        posted = this->emulated_channel->post_send(read_buf + offset, size, 0, (uint64_t)ctxt, completion);
+      }
+      // as with a queue pair in the error state, an operation on a broken
+      // connection is dropped, and fails only if it has a completion
+      if (!posted && (completion || op == 0) && ctxt) {
+        util::polling_data.insert_completion_entry(ctxt->ce_idx, {ctxt->remote_id, -1});
+      }
+      return 0;
+    }
+
+    // The send queue only frees the slots of unsignaled operations when a
+    // later one completes, so one in every signal_interval gets a completion
+    bool signaled = completion;
+    std::atomic<uint32_t> &unsignaled = this->connection ? this->connection->unsignaled_ops
+                                        : (rdm_mode ? rdm_unsignaled_ops : this->unsignaled_ops);
+    if (signaled) {
+      unsignaled.store(0, std::memory_order_relaxed);
+    } else if (signal_interval > 0) {
+      if (unsignaled.fetch_add(1, std::memory_order_relaxed) + 1 >= signal_interval) {
+        unsignaled.store(0, std::memory_order_relaxed);
+        signaled = true;
+        ctxt = &signal_ctxt;
+      }
+    }
 
     if (op == 2) { // two sided send
       struct fi_msg msg;
@@ -438,11 +935,11 @@ namespace sst{
       msg.msg_iov = &msg_iov;
       msg.desc = (void**)&this->mr_lrkey;
       msg.iov_count = 1;
-      msg.addr = 0;
+      msg.addr = this->peer_addr;
       msg.context = (void*)ctxt;
       msg.data = 0l; // not used
 
-      FAIL_IF_NONZERO(ret = fi_sendmsg(this->ep,&msg,(completion)?(FI_COMPLETION|FI_REMOTE_CQ_DATA):(FI_REMOTE_CQ_DATA)),
+      FAIL_IF_NONZERO(ret = fi_sendmsg(this->ep,&msg,((signaled)?(FI_COMPLETION|FI_REMOTE_CQ_DATA):(FI_REMOTE_CQ_DATA))|more_flag),
         "fi_sendmsg failed.",
         REPORT_ON_FAILURE);
     } else { // one sided send or receive
@@ -453,14 +950,14 @@ namespace sst{
       msg_iov.iov_base = read_buf + offset;
       msg_iov.iov_len = size;
   
-      rma_iov.addr = ((LF_USE_VADDR)?remote_fi_addr:0) + offset;
+      rma_iov.addr = remote_fi_addr + offset;
       rma_iov.len = size;
       rma_iov.key = this->mr_rwkey;
   
       msg.msg_iov = &msg_iov;
       msg.desc = (void**)&this->mr_lrkey;
       msg.iov_count = 1;
-      msg.addr = 0; // not used for a connection endpoint
+      msg.addr = this->peer_addr;
       msg.rma_iov = &rma_iov;
       msg.rma_iov_count = 1;
       msg.context = (void*)ctxt;
@@ -472,11 +969,17 @@ namespace sst{
       // dbg_flush();
   
       if(op == 1) { //write
-        FAIL_IF_NONZERO(ret = fi_writemsg(this->ep,&msg,(completion)?FI_COMPLETION:0),
+        FAIL_IF_NONZERO(ret = fi_writemsg(this->ep,&msg,((signaled)?FI_COMPLETION:0)|more_flag),
           "fi_writemsg failed.",
           REPORT_ON_FAILURE);
+      } else if(op == 3) { // notification: no data, only the remote CQ data
+        msg.iov_count = 0;
+        rma_iov.len = 0;
+        FAIL_IF_NONZERO(ret = fi_writemsg(this->ep,&msg,FI_REMOTE_CQ_DATA|((signaled)?FI_COMPLETION:0)|more_flag),
+          "fi_writemsg (notification) failed.",
+          REPORT_ON_FAILURE);
       } else { // read op==0
-        FAIL_IF_NONZERO(ret = fi_readmsg(this->ep,&msg,(completion)?FI_COMPLETION:0),
+        FAIL_IF_NONZERO(ret = fi_readmsg(this->ep,&msg,((signaled)?FI_COMPLETION:0)|more_flag),
           "fi_readmsg failed.",
           REPORT_ON_FAILURE);
       }
@@ -514,6 +1017,48 @@ namespace sst{
     FAIL_IF_NONZERO(post_remote_send(ctxt,offset,size,1,true),"post_remote_write(4) failed.",REPORT_ON_FAILURE);
   }
 
+  void resources::post_remote_writes(const std::vector<std::pair<long long int, long long int>> &offsets_and_sizes){
+    for (size_t i = 0; i < offsets_and_sizes.size(); i++) {
+      const bool more = (i + 1 < offsets_and_sizes.size());
+      FAIL_IF_NONZERO(post_remote_send(NULL,offsets_and_sizes[i].first,offsets_and_sizes[i].second,1,false,more),"post_remote_writes failed.",REPORT_ON_FAILURE);
+    }
+  }
+
+  void resources::post_remote_write_inline(const long long int offset, const long long int size){
+    assert(size <= get_max_inline_size());
+    FAIL_IF_NONZERO(post_remote_send(NULL,offset,size,1,false,false,true),"post_remote_write_inline failed.",REPORT_ON_FAILURE);
+  }
+
+  void resources::post_remote_notification(){
+    if (!notifications) {
+      return;
+    }
+    FAIL_IF_NONZERO(post_remote_send(NULL,0,0,3,false),"post_remote_notification failed.",REPORT_ON_FAILURE);
+  }
+
+  void _resources::post_notification_recvs() {
+    if (!notifications) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(notification_mutex);
+    for (int i = 0; i < LF_NOTIFICATION_RECVS; i++) {
+      notification_ctxt *nctxt;
+      if (free_notification_ctxts.empty()) {
+        notification_ctxts.emplace_back();
+        nctxt = &notification_ctxts.back();
+      } else {
+        nctxt = free_notification_ctxts.back();
+        free_notification_ctxts.pop_back();
+      }
+      nctxt->sctxt.ce_idx = LF_NOTIFICATION_CE_IDX;
+      nctxt->sctxt.remote_id = this->remote_id;
+      nctxt->ep = this->ep;
+      nctxt->addr = this->peer_addr;
+      this->notification_recvs.push_back(nctxt);
+      post_notification_recv(nctxt);
+    }
+  }
+
 
   /**
    * @param size The number of bytes to write from the local buffer to remote
@@ -572,13 +1117,20 @@ namespace sst{
       struct fi_msg msg;
       int ret;
   
+      if (this->emulated_channel) {
+        if (!this->emulated_channel->post_recv(write_buf + offset, size, (uint64_t)ctxt) && ctxt) {
+          util::polling_data.insert_completion_entry(ctxt->ce_idx, {ctxt->remote_id, -1});
+        }
+        return 0;
+      }
+
       msg_iov.iov_base = write_buf + offset;
       msg_iov.iov_len = size;
   
       msg.msg_iov    = &msg_iov;
       msg.desc       = (void**)&this->mr_lwkey;
       msg.iov_count  = 1;
-      msg.addr       = 0; // not used
+      msg.addr       = this->peer_addr;
       msg.context    = (void*)ctxt;
       FAIL_IF_NONZERO(ret = fi_recvmsg(this->ep, &msg, FI_COMPLETION|FI_REMOTE_CQ_DATA),
           "fi_recvmsg",
@@ -587,10 +1139,25 @@ namespace sst{
   }
 
   bool add_node(uint32_t new_id, const std::pair<ip_addr_t, uint16_t>& new_ip_addr_and_port) {
+    std::lock_guard<std::mutex> users_lock(lf_users_mutex);
+    if (node_users[new_id]++ > 0) {
+      return true;
+    }
     return sst_connections->add_node(new_id, new_ip_addr_and_port);
   }
 
   bool remove_node(uint32_t node_id) {
+      std::lock_guard<std::mutex> users_lock(lf_users_mutex);
+      auto users = node_users.find(node_id);
+      if (users != node_users.end() && --users->second > 0) {
+        // another Group still reaches the node through these connections
+        return true;
+      }
+      node_users.erase(node_id);
+      {
+        std::lock_guard<std::mutex> lock(shared_endpoints_mutex);
+        shared_endpoints.erase(node_id);
+      }
       return sst_connections->delete_node(node_id);
   }
 
@@ -600,7 +1167,7 @@ namespace sst{
   }
 
   void polling_loop() {
-    pthread_setname_np(pthread_self(), "sst_poll");
+    derecho::name_and_pin_thread("sst_poll");
     dbg_trace("Polling thread starting.");
     std::cout<<"["<<std::this_thread::get_id()<<"] polling thread starts."<<std::endl;
     while(!shutdown) {
@@ -617,31 +1184,11 @@ namespace sst{
   }
 
   /**
-   * @details
-   * This blocks until a single entry in the completion queue has
-   * completed
-   * It is exclusively used by the polling thread
-   * the thread can sleep while in this function, when it calls util::polling_data.wait_for_requests
-   * @return pair(remote_id,result) The queue pair number associated with the
-   * completed request and the result (1 for successful, -1 for unsuccessful)
+   * Turns what fi_cq_read() read off the completion queue into a completion
+   * entry for util::polling_data, handling notifications and errors itself.
+   * @return pair(remote_id,result) as for lf_poll_completion()
    */
-  std::pair<uint32_t, std::pair<int32_t, int32_t>> lf_poll_completion() {
-    struct fi_cq_entry entry;
-    int poll_result;
-
-    while(!shutdown) {
-        poll_result = 0;
-        for(int i = 0; i < 50; ++i) {
-            poll_result = fi_cq_read(g_ctxt.cq, &entry, 1);
-            if(poll_result && (poll_result!=-FI_EAGAIN)) {
-                break;
-            }
-        }
-        if(poll_result && (poll_result!=-FI_EAGAIN)) {
-            break;
-        }
-        // util::polling_data.wait_for_requests();
-    }
+  static std::pair<uint32_t, std::pair<int32_t, int32_t>> handle_cq_read(int poll_result, struct fi_cq_entry& entry) {
     // not sure what to do when we cannot read entries off the CQ
     // this means that something is wrong with the local node
     if((poll_result < 0) && (poll_result != -FI_EAGAIN)) {
@@ -689,6 +1236,10 @@ namespace sst{
 #endif//DEBUG_FOR_RELEASE
       if (eentry.op_context!=NULL){
         struct lf_sender_ctxt * sctxt = (struct lf_sender_ctxt *)eentry.op_context;
+        if (sctxt->ce_idx == LF_NOTIFICATION_CE_IDX) {
+          notification_received((notification_ctxt *)sctxt, false);
+          return {0xFFFFFFFFu,{0,-1}};
+        }
         return {sctxt->ce_idx, {sctxt->remote_id, -1}};
       } else {
           dbg_error("\tFailed polling the completion queue");
@@ -699,9 +1250,16 @@ namespace sst{
     }
     if (!shutdown) {
       struct lf_sender_ctxt * sctxt = (struct lf_sender_ctxt *)entry.op_context;
-      if (sctxt == NULL) {
+      if (sctxt == NULL && notifications) {
+        // remote CQ data reported without consuming a receive
+        notification_received(nullptr, true);
+        return {0xFFFFFFFFu,{0,0}};
+      } else if (sctxt == NULL) {
         dbg_debug("WEIRD: we get an entry with op_context = NULL.");
         return {0xFFFFFFFFu,{0,0}}; // return a bad entry: weird!!!!
+      } else if (sctxt->ce_idx == LF_NOTIFICATION_CE_IDX) {
+        notification_received((notification_ctxt *)sctxt, true);
+        return {0xFFFFFFFFu,{0,0}};
       } else {
         dbg_trace("Normal: we get an entry with op_context = {}.",(long long unsigned)sctxt);
         return {sctxt->ce_idx, {sctxt->remote_id, 1}};
@@ -711,12 +1269,72 @@ namespace sst{
     }
   }
 
+  /**
+   * @details
+   * This blocks until a single entry in the completion queue has
+   * completed
+   * It is exclusively used by the polling thread
+   * the thread can sleep while in this function, when it calls util::polling_data.wait_for_requests
+   * @return pair(remote_id,result) The queue pair number associated with the
+   * completed request and the result (1 for successful, -1 for unsuccessful)
+   */
+  std::pair<uint32_t, std::pair<int32_t, int32_t>> lf_poll_completion() {
+    struct fi_cq_entry entry;
+    int poll_result;
+
+    while(!shutdown) {
+        poll_result = 0;
+        for(int i = 0; i < 50; ++i) {
+            poll_result = fi_cq_read(g_ctxt.cq, &entry, 1);
+            if(poll_result && (poll_result!=-FI_EAGAIN)) {
+                break;
+            }
+        }
+        if(poll_result && (poll_result!=-FI_EAGAIN)) {
+            break;
+        }
+        // util::polling_data.wait_for_requests();
+    }
+    return handle_cq_read(poll_result, entry);
+  }
+
+  std::optional<std::pair<uint32_t, std::pair<int32_t, int32_t>>> lf_try_poll_completion() {
+    struct fi_cq_entry entry;
+    const int poll_result = fi_cq_read(g_ctxt.cq, &entry, 1);
+    if(poll_result == 0 || poll_result == -FI_EAGAIN) {
+      return std::nullopt;
+    }
+    return handle_cq_read(poll_result, entry);
+  }
+
   void lf_initialize(const std::map<node_id_t, std::pair<ip_addr_t, uint16_t>>
                          &ip_addrs_and_ports,
                      uint32_t node_rank) {
+    std::lock_guard<std::mutex> users_lock(lf_users_mutex);
+    for (const auto& [id, ip_addr_and_port] : ip_addrs_and_ports) {
+      if (id != node_rank && node_users[id]++ == 0 && num_lf_users > 0) {
+        // a later Group only needs connections to the nodes no other
+        // Group has connected to yet
+        sst_connections->add_node(id, ip_addr_and_port);
+      }
+    }
+    if (num_lf_users++ > 0) {
+      return;
+    }
     // initialize derecho connection manager: This is derived from Sagar's code.
     // May there be a better desgin?
     sst_connections = new tcp::tcp_connections(node_rank, ip_addrs_and_ports);
+    my_node_id = node_rank;
+    tcp_mode = (derecho::getConfString(CONF_RDMA_PROVIDER) == "tcp_emulation");
+    if (tcp_mode) {
+      // the emulation thread delivers the completions itself
+      tcp::emulation::initialize(node_rank);
+      return;
+    }
+    rdm_mode = derecho::getConfBoolean(CONF_RDMA_RDM_ENDPOINT);
+    // in RDM mode, a notification could take a receive meant for a
+    // two-sided send on the shared endpoint
+    notifications = derecho::getConfBoolean(CONF_DERECHO_SST_NOTIFICATIONS) && !rdm_mode;
 
     // initialize global resources:
     // STEP 1: initialize with configuration.
@@ -730,25 +1348,86 @@ namespace sst{
     FAIL_IF_NONZERO(fi_fabric(g_ctxt.fi->fabric_attr, &(g_ctxt.fabric), NULL),"fi_fabric()",CRASH_ON_FAILURE);
     FAIL_IF_NONZERO(fi_domain(g_ctxt.fabric, g_ctxt.fi, &(g_ctxt.domain), NULL),"fi_domain()",CRASH_ON_FAILURE);
     g_ctxt.cq_attr.size = g_ctxt.fi->tx_attr->size;
+    const int32_t configured_interval = derecho::getConfInt32(CONF_RDMA_SIGNAL_INTERVAL);
+    signal_interval = (configured_interval < 0) ? std::max<uint32_t>(g_ctxt.fi->tx_attr->size / 2, 1)
+                                                : (uint32_t)configured_interval;
+    if (g_ctxt.fi->domain_attr->data_progress == FI_PROGRESS_MANUAL) {
+      // e.g. efa, which only moves data, including the RMA it emulates over
+      // sends, while the CQ is read. The polling thread never stops reading
+      // it, so it needs no wait object, which such providers may not have.
+      g_ctxt.cq_attr.wait_obj = FI_WAIT_NONE;
+    }
     FAIL_IF_NONZERO(fi_cq_open(g_ctxt.domain, &(g_ctxt.cq_attr), &(g_ctxt.cq), NULL),"initialize tx completion queue.",REPORT_ON_FAILURE);
 
-    // STEP 3: prepare local PEP
-    FAIL_IF_NONZERO(fi_eq_open(g_ctxt.fabric,&g_ctxt.eq_attr,&g_ctxt.peq,NULL),"open the event queue for passive endpoint",CRASH_ON_FAILURE);
-    FAIL_IF_NONZERO(fi_passive_ep(g_ctxt.fabric,g_ctxt.fi,&g_ctxt.pep,NULL),"open a local passive endpoint",CRASH_ON_FAILURE);
-    FAIL_IF_NONZERO(fi_pep_bind(g_ctxt.pep,&g_ctxt.peq->fid,0),"binding event queue to passive endpoint",CRASH_ON_FAILURE);
-    FAIL_IF_NONZERO(fi_listen(g_ctxt.pep),"preparing passive endpoint for incoming connections",CRASH_ON_FAILURE);
-    FAIL_IF_NONZERO(fi_getname(&g_ctxt.pep->fid, g_ctxt.pep_addr, &g_ctxt.pep_addr_len),"get the local PEP address",CRASH_ON_FAILURE);
+    if (rdm_mode) {
+      // STEP 3: open the endpoint for all remote nodes, which it reaches
+      // through the address vector
+      struct fi_av_attr av_attr;
+      memset(&av_attr,0,sizeof(av_attr));
+      av_attr.type = FI_AV_TABLE;
+      FAIL_IF_NONZERO(fi_av_open(g_ctxt.domain,&av_attr,&g_ctxt.av,NULL),"open the address vector",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_endpoint(g_ctxt.domain,g_ctxt.fi,&g_ctxt.rdm_ep,NULL),"open the RDM endpoint",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_ep_bind(g_ctxt.rdm_ep,&g_ctxt.av->fid,0),"bind the RDM endpoint and address vector",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_ep_bind(g_ctxt.rdm_ep,&g_ctxt.cq->fid,FI_RECV | FI_TRANSMIT | FI_SELECTIVE_COMPLETION),"bind the RDM endpoint and completion queue",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_enable(g_ctxt.rdm_ep),"enable the RDM endpoint",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_getname(&g_ctxt.rdm_ep->fid, g_ctxt.pep_addr, &g_ctxt.pep_addr_len),"get the local RDM endpoint address",CRASH_ON_FAILURE);
+    } else {
+      // STEP 3: prepare local PEP
+      FAIL_IF_NONZERO(fi_eq_open(g_ctxt.fabric,&g_ctxt.eq_attr,&g_ctxt.peq,NULL),"open the event queue for passive endpoint",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_passive_ep(g_ctxt.fabric,g_ctxt.fi,&g_ctxt.pep,NULL),"open a local passive endpoint",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_pep_bind(g_ctxt.pep,&g_ctxt.peq->fid,0),"binding event queue to passive endpoint",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_listen(g_ctxt.pep),"preparing passive endpoint for incoming connections",CRASH_ON_FAILURE);
+      FAIL_IF_NONZERO(fi_getname(&g_ctxt.pep->fid, g_ctxt.pep_addr, &g_ctxt.pep_addr_len),"get the local PEP address",CRASH_ON_FAILURE);
+    }
     FAIL_IF_NONZERO((g_ctxt.pep_addr_len > MAX_LF_ADDR_SIZE),"local name is too big to fit in local buffer",CRASH_ON_FAILURE);
     // FAIL_IF_NONZERO(fi_eq_open(g_ctxt.fabric,&g_ctxt.eq_attr,&g_ctxt.eq,NULL),"open the event queue for rdma transmission.", CRASH_ON_FAILURE);
     
-    // STEP 4: start polling thread.
-    polling_thread = std::thread(polling_loop);
-    // polling_thread.detach();
+    // STEP 4: start polling thread, or have the unified poller read the
+    // completion queue along with RDMC's.
+    if (derecho::CompletionPoller::enabled()) {
+      poller_source_id = derecho::CompletionPoller::get().add_source("SST", []() {
+        auto ce = lf_try_poll_completion();
+        if (!ce) {
+          return false;
+        }
+        if (ce->first != 0xFFFFFFFF) {
+          util::polling_data.insert_completion_entry(ce->first, ce->second);
+        }
+        return true;
+      });
+    } else {
+      polling_thread = std::thread(polling_loop);
+    }
+  }
+
+  uint32_t get_max_inline_size() {
+    return g_ctxt.fi ? g_ctxt.fi->tx_attr->inject_size : 0;
+  }
+
+  uint32_t get_signal_interval() {
+    return signal_interval;
+  }
+
+  bool notifications_enabled() {
+    return notifications;
+  }
+
+  uint64_t get_notification_count() {
+    return num_notifications.load(std::memory_order_acquire);
+  }
+
+  void wait_for_notification(uint64_t seen, std::chrono::microseconds timeout) {
+    std::unique_lock<std::mutex> lock(notification_mutex);
+    notification_cv.wait_for(lock, timeout, [seen]() { return num_notifications.load() != seen; });
   }
 
   void shutdown_polling_thread(){
     shutdown = true;
     std::cout<<"["<<std::this_thread::get_id()<<"] shutdown_polling_thread() begins."<<std::endl;
+    if(poller_source_id) {
+      derecho::CompletionPoller::get().remove_source(*poller_source_id);
+      poller_source_id.reset();
+    }
     if(polling_thread.joinable()) {
       std::cout<<"["<<std::this_thread::get_id()<<"] joining polling thread."<<std::endl;
       polling_thread.join();
@@ -757,8 +1436,30 @@ namespace sst{
   }
 
   void lf_destroy(){
+    {
+      std::lock_guard<std::mutex> users_lock(lf_users_mutex);
+      if (num_lf_users > 0 && --num_lf_users > 0) {
+        return;
+      }
+      node_users.clear();
+    }
+    release_resources();
+  }
+
+  static void release_resources(){
     shutdown_polling_thread();
+    if (tcp_mode) {
+      tcp_mode = false;
+      tcp::emulation::shutdown();
+      return;
+    }
     // TODO: make sure all resources are destroyed first.
+    if (g_ctxt.rdm_ep) {
+      FAIL_IF_NONZERO(fi_close(&g_ctxt.rdm_ep->fid),"close RDM endpoint",REPORT_ON_FAILURE);
+    }
+    if (g_ctxt.av) {
+      FAIL_IF_NONZERO(fi_close(&g_ctxt.av->fid),"close address vector",REPORT_ON_FAILURE);
+    }
     if (g_ctxt.pep) {
       FAIL_IF_NONZERO(fi_close(&g_ctxt.pep->fid),"close passive endpoint",REPORT_ON_FAILURE);
     }
@@ -7,11 +7,20 @@
  * including the Resources class and global setup functions.
  */
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <map>
+#include <memory>
+#include <optional>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 #include <rdma/fabric.h>
 
 #include "derecho/derecho_type_definitions.h"
+#include "tcp/emulation.h"
 
 #define LF_VERSION FI_VERSION(1,5)
 
@@ -22,6 +31,37 @@ struct lf_sender_ctxt {
   uint32_t      remote_id; // thread id of the sender
 };
 
+/**
+ * A buffer registered with the NIC once, so that the connections to several
+ * remote nodes can share the registration instead of each pinning their
+ * parts of it again.
+ */
+class memory_region {
+public:
+    /** The start of the registered buffer */
+    char *const buf;
+    /** The size of the registered buffer */
+    const std::size_t size;
+    /** Handle for the registration */
+    struct fid_mr *mr;
+    /** key for the registration */
+    uint64_t key;
+    /** The name of the shared memory segment that buf is mapped from, or
+     * empty if it is private to this process */
+    const std::string shm_name;
+
+    /** Registers size bytes at buf for local and remote reads and writes.
+     * If shm_name is not empty, connections to nodes on the same host write
+     * to the buffer by mapping that segment instead of through the NIC. */
+    memory_region(char *buf, std::size_t size, const std::string &shm_name = "");
+    memory_region(const memory_region &) = delete;
+    memory_region &operator=(const memory_region &) = delete;
+    ~memory_region();
+};
+
+struct shared_endpoint;
+struct notification_ctxt;
+
 /**
  * Represents the set of RDMA resources needed to maintain a two-way connection
  * to a single remote node.
@@ -33,8 +73,24 @@ private:
      * @param is_lf_server This parameter decide local role in connection.
      *     If is_lf_server is true, it waits on PEP for connection from remote
      *     side. Otherwise, it initiate a connection to remote side.
+     * @param share Whether the endpoint may be shared with other resources
+     *     to the same node, reusing one that both sides still have open.
      */
-    void connect_endpoint(bool is_lf_server);
+    void connect_endpoint(bool is_lf_server, bool share);
+    /** Maps the remote node's copy of the rows, if it is on this host and
+     * its rows are in shared memory, so that writes to it are memcpys.
+     * Returns once the remote node has done the same with this node's rows,
+     * whether or not either could map them.
+     *
+     * @param region The registered region this node's buffers lie in
+     */
+    void map_remote_rows(const memory_region &region);
+    /** Maps the remote node's segment, for map_remote_rows, unless it is
+     * not on this host or has no segment */
+    void open_remote_rows(const char *segment_name, bool same_host, std::size_t segment_size, uint64_t offset);
+    /** Connects emulated_channel to the remote node instead of an endpoint,
+     * if RDMA is emulated over TCP. */
+    void connect_channel();
     /** Initialize resource endpoint using fi_info
      *
      * @param fi The fi_info object
@@ -50,11 +106,22 @@ protected:
      *     ownership of this context until completion.
      * @param offset - The offset within the remote buffer to read/write
      * @param size - The number of bytes to read/write
-     * @param op - 0 for read and 1 for write
+     * @param op - 0 for read, 1 for write, 2 for a two-sided send and 3 for a
+     *     notification (a zero-length write with remote CQ data)
+     * @param completion - whether a completion entry should be generated
+     * @param more - hint to the provider that another operation on this
+     *     endpoint follows immediately, so it can defer ringing the doorbell
+     *     until the last operation of the batch (FI_MORE).
+     * @param inject - copy the data into the work request (FI_INJECT), so
+     *     the NIC doesn't have to read it from local memory. Only allowed for
+     *     sizes up to get_max_inline_size().
      * @param return the return code for operation.
      */
     int post_remote_send(struct lf_sender_ctxt *ctxt, const long long int offset, const long long int size,
-                         const int op, const bool completion);
+                         const int op, const bool completion, const bool more = false, const bool inject = false);
+    /** Posts the receives that notifications from the remote node arrive
+     * in, if notifications are on (see notifications_enabled()) */
+    void post_notification_recvs();
 public:
     /** ID of the remote node. */
     int remote_id;
@@ -76,10 +143,37 @@ public:
     uint64_t mr_lwkey;
     /** key for remote write buffer */
     uint64_t mr_rwkey;
-    /** remote write memory address */
+    /** remote write memory address: its virtual address, or its offset in
+     * the remote registration if the provider addresses memory by offset */
     fi_addr_t remote_fi_addr;
+    /** the address of the remote node in the address vector, if the
+     * endpoint is the RDM endpoint for all nodes; unused otherwise */
+    fi_addr_t peer_addr = 0;
+    /** the offset of write_buf in the registration it lies in */
+    uint64_t write_mr_offset = 0;
+    /** whether write_mr and read_mr were registered by this object, and not
+     * borrowed from a memory_region */
+    bool owns_memory_regions = true;
     /** the event queue */
     struct fid_eq * eq;
+    /** the shared endpoint that ep and eq belong to, if they are shared */
+    std::shared_ptr<shared_endpoint> connection;
+    /** the operations posted on ep without a completion since the last one
+     * with a completion, if ep is not shared (see get_signal_interval()) */
+    std::atomic<uint32_t> unsignaled_ops{0};
+    /** the contexts of the receives posted by post_notification_recvs() */
+    std::vector<notification_ctxt *> notification_recvs;
+    /** the channel that takes the place of ep if RDMA is emulated over TCP
+     * (RDMA/provider = tcp_emulation), or nullptr */
+    std::unique_ptr<tcp::emulation::channel> emulated_channel;
+    /** the remote node's rows, mapped from its shared memory segment if it
+     * is on this host, or nullptr */
+    char *remote_rows = nullptr;
+    /** the size of the remote_rows mapping */
+    std::size_t remote_rows_size = 0;
+    /** where in remote_rows the remote node keeps its copy of this node's
+     * row, which post_remote_send copies to instead of using the NIC */
+    char *shm_remote_buf = nullptr;
 
     /**
      * Constructor
@@ -101,6 +195,16 @@ public:
      */
     _resources(int r_id, char *write_addr, char *read_addr, int size_w,
               int size_r, int is_lf_server);
+    /**
+     * Constructor for a write buffer and a read buffer that both lie in an
+     * already registered region; connects a queue pair with the specified
+     * remote node without registering anything. The queue pair is shared:
+     * if an older SST still has one to that node, it is reused. If the
+     * remote node is on this host and both sides' regions are in shared
+     * memory, writes and reads are memcpys instead.
+     */
+    _resources(int r_id, char *write_addr, char *read_addr, const memory_region &region,
+               int is_lf_server);
     /** Destroys the resources. */
     virtual ~_resources();
 };
@@ -111,6 +215,13 @@ class resources : public _resources {
     resources(int r_id, char *write_addr, char *read_addr, int size_w,
               int size_r, int is_lf_server) : 
       _resources(r_id,write_addr,read_addr,size_w,size_r,is_lf_server) {
+      post_notification_recvs();
+    }
+    /** constructor for buffers in an already registered region */
+    resources(int r_id, char *write_addr, char *read_addr, const memory_region &region,
+              int is_lf_server) :
+      _resources(r_id,write_addr,read_addr,region,is_lf_server) {
+      post_notification_recvs();
     }
 
     /*
@@ -129,6 +240,23 @@ class resources : public _resources {
     void post_remote_write_with_completion(struct lf_sender_ctxt *ctxt, const long long int size);
     /** Post an RDMA write at an offset into remote memory. */
     void post_remote_write_with_completion(struct lf_sender_ctxt *ctxt, const long long int offset, const long long int size);
+    /**
+     * Post a sequence of RDMA writes, one for each (offset, size) pair, in
+     * order. All but the last are posted with FI_MORE, so the provider can
+     * hand the whole sequence to the NIC with a single doorbell.
+     */
+    void post_remote_writes(const std::vector<std::pair<long long int, long long int>> &offsets_and_sizes);
+    /**
+     * Post an RDMA write at an offset into remote memory with its data
+     * inlined in the work request. size must not exceed get_max_inline_size().
+     */
+    void post_remote_write_inline(const long long int offset, const long long int size);
+    /**
+     * Post a notification: a zero-length write with remote CQ data, which
+     * wakes the remote node's predicate threads if they wait in
+     * wait_for_notification(). Does nothing unless notifications_enabled().
+     */
+    void post_remote_notification();
 };
 
 class resources_two_sided : public _resources {
@@ -152,11 +280,13 @@ public:
 };
 
 /**
- * add a new node to sst_connection set.
+ * add a new node to sst_connection set. The Groups of a process share a
+ * node's connections, which are only made the first time one of them adds it.
  */
 bool add_node(uint32_t new_id, const std::pair<ip_addr_t, uint16_t>& new_ip_addr_and_port);
 /**
- * Removes a node from the SST TCP connections set
+ * Removes a node from the SST TCP connections set, once every Group that
+ * added it has removed it
  */
 bool remove_node(uint32_t node_id);
 /** sync
@@ -165,18 +295,42 @@ bool remove_node(uint32_t node_id);
 bool sync(uint32_t r_id);
 /** 
  * Initializes the global libfabric resources. Must be called before creating
- * or using any SST instance. 
+ * or using any SST instance. Each Group in the process calls it, and all of
+ * them share the resources the first call opens, so later calls only connect
+ * to the nodes that are new to the process.
  * 
  * @param ip_addres A map from rank to string??
  * @param node_rank rank of this node.
  */
   void lf_initialize(const std::map<uint32_t, std::pair<ip_addr_t, uint16_t>> &ip_addrs_and_ports,
                       uint32_t node_rank);
+/**
+ * @return The largest write whose data the provider can inline in the work
+ * request (the endpoint's inject size); only valid after lf_initialize().
+ */
+uint32_t get_max_inline_size();
+/** Every how many operations on an endpoint one is posted with a
+ * completion, whether or not the caller asked for one, so that the send
+ * queue drains (CONF_RDMA_SIGNAL_INTERVAL); 0 if none are */
+uint32_t get_signal_interval();
+/** Whether SST writes may be followed by notifications, which let idle
+ * predicate threads block until a remote node has news for them
+ * (CONF_DERECHO_SST_NOTIFICATIONS); not in RDM mode or over TCP */
+bool notifications_enabled();
+/** The number of notifications received so far */
+uint64_t get_notification_count();
+/** Blocks until more than seen notifications have been received, or until
+ * timeout passes */
+void wait_for_notification(uint64_t seen, std::chrono::microseconds timeout);
 /** Polls for completion of a single posted remote write. */
 std::pair<uint32_t, std::pair<int32_t, int32_t>> lf_poll_completion(); 
+/** Reads at most one entry off the completion queue without blocking, and
+ * returns what lf_poll_completion() would, or nothing if it was empty. */
+std::optional<std::pair<uint32_t, std::pair<int32_t, int32_t>>> lf_try_poll_completion();
 /** Shutdown the polling thread. */
 void shutdown_polling_thread();
-/** Destroys the global libfabric resources. */
+/** Releases one lf_initialize() call's use of the global libfabric
+ * resources, and destroys them after the last one. */
 void lf_destroy();
 }  // namespace sst
 
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <functional>
 #include <iostream>
@@ -12,6 +14,31 @@
 #include "sst/sst.h"
 
 namespace sst {
+/**
+ * Set in a slot's size word when the message was placed against the slot's
+ * trailer, so that the message and the trailer can be sent as one inline write.
+ */
+constexpr uint64_t INLINE_MESSAGE_FLAG = 1ull << 63;
+
+/** @return The size of the message in a slot, given the slot's size word. */
+inline uint64_t slot_message_size(uint64_t size_word) {
+    return size_word & ~INLINE_MESSAGE_FLAG;
+}
+
+/**
+ * @param slot_size The size of a slot, including its two-word trailer
+ * @param size_word The slot's size word
+ * @return The offset of the message within its slot. An inline message ends
+ * at the trailer, rounded down so that it starts on a word boundary.
+ */
+inline uint64_t slot_message_offset(uint64_t slot_size, uint64_t size_word) {
+    if(!(size_word & INLINE_MESSAGE_FLAG)) {
+        return 0;
+    }
+    const uint64_t padded_size = (slot_message_size(size_word) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    return slot_size - 2 * sizeof(uint64_t) - padded_size;
+}
+
 template <typename sstType>
 class multicast_group {
     // number of messages for which get_buffer has been called
@@ -39,7 +66,8 @@ class multicast_group {
     // start indexes for sst fields it uses
     // need to know the range it can operate on
     const uint32_t num_received_offset;
-    const uint32_t slots_offset;
+    // in bytes, since groups sharing the slots field can have different slot sizes
+    const uint64_t slots_offset;
 
     // number of members
     const uint32_t num_members;
@@ -49,23 +77,69 @@ class multicast_group {
     const uint32_t window_size;
     // maximum size that the SST can send
     const uint64_t max_msg_size;
+    // if set, a slot is also not reused until every member has released it in this field
+    SSTFieldVector<int32_t> sstType::*const released_field;
+    // messages this small (plus the slot trailer) are sent as a single inline write
+    const uint64_t max_inline_msg_size;
 
     std::thread timeout_thread;
 
     void initialize() {
-        for(auto i : row_indices) {
+        for(uint32_t index = 0; index < num_members; ++index) {
+            const uint32_t i = row_indices[index];
             for(uint j = num_received_offset; j < num_received_offset + num_senders; ++j) {
                 sst->num_received_sst[i][j] = -1;
+                if(released_field) {
+                    (sst.get()->*released_field)[i][j] = -1;
+                }
+            }
+            // Only a sender's row holds this group's messages; in the other
+            // rows these bytes may be another group's window
+            if(!is_sender[index]) {
+                continue;
             }
-            for(uint j = slots_offset; j < slots_offset + window_size; ++j) {
-                sst->slots[i][max_msg_size * j] = 0;
-                (uint64_t&)sst->slots[i][max_msg_size * (j + 1) - sizeof(uint64_t)] = 0;
+            for(uint j = 0; j < window_size; ++j) {
+                sst->slots[i][slots_offset + max_msg_size * j] = 0;
+                (uint64_t&)sst->slots[i][slots_offset + max_msg_size * (j + 1) - sizeof(uint64_t)] = 0;
             }
         }
         sst->sync_with_members(row_indices);
         std::cout << "Initialization complete" << std::endl;
     }
 
+    /**
+     * Marks the next unsent slot as sent by advancing its next_seq guard, and
+     * adds the writes that send it to writes, in the order they must land:
+     * the message with the slot's size word, and then the guard, on its own,
+     * in a later write. RDMA places the writes to a row in the order they
+     * were posted, but makes no promise about the order of the bytes within
+     * one write, so a receiver that sees the new guard has the size and the
+     * message it covers. Only the occupied part of the slot is written; a
+     * receiver never reads past the size, so the stale bytes left at the end
+     * of a slot by an earlier, longer message are never interpreted.
+     */
+    void add_slot_writes(std::vector<std::pair<long long int, long long int>>& writes) {
+        const uint32_t slot = num_sent % window_size;
+        num_sent++;
+        const uint64_t slot_offset = (char*)std::addressof(sst->slots[0][slots_offset + max_msg_size * slot]) - sst->getBaseAddress();
+        const uint64_t size_offset = slot_offset + max_msg_size - 2 * sizeof(uint64_t);
+        const uint64_t guard_offset = slot_offset + max_msg_size - sizeof(uint64_t);
+        const uint64_t size_word = (uint64_t&)sst->slots[my_row][slots_offset + max_msg_size * (slot + 1) - 2 * sizeof(uint64_t)];
+        ((uint64_t&)sst->slots[my_row][slots_offset + max_msg_size * (slot + 1) - sizeof(uint64_t)])++;
+        const uint64_t msg_offset = slot_offset + slot_message_offset(max_msg_size, size_word);
+        const uint64_t msg_size = slot_message_size(size_word);
+        if(msg_size > 0 && msg_offset + msg_size < size_offset) {
+            // the message doesn't reach the size word
+            writes.emplace_back(msg_offset, msg_size);
+            writes.emplace_back(size_offset, sizeof(uint64_t));
+        } else {
+            // it does, or is padded up to it, so one write carries both
+            const uint64_t first_offset = msg_size > 0 ? msg_offset : size_offset;
+            writes.emplace_back(first_offset, guard_offset - first_offset);
+        }
+        writes.emplace_back(guard_offset, sizeof(uint64_t));
+    }
+
 public:
     multicast_group(std::shared_ptr<sstType> sst,
                     std::vector<uint32_t> row_indices,
@@ -73,7 +147,9 @@ public:
                     uint64_t max_msg_size,
                     std::vector<int> is_sender = {},
                     uint32_t num_received_offset = 0,
-                    uint32_t slots_offset = 0)
+                    uint64_t slots_offset = 0,
+                    SSTFieldVector<int32_t> sstType::*released_field = nullptr,
+                    uint64_t max_inline_msg_size = 0)
             : my_row(sst->get_local_index()),
               sst(sst),
               row_indices(row_indices),
@@ -88,7 +164,13 @@ public:
               slots_offset(slots_offset),
               num_members(row_indices.size()),
               window_size(window_size),
-              max_msg_size(max_msg_size + 2 * sizeof(uint64_t)) {
+              max_msg_size(max_msg_size + 2 * sizeof(uint64_t)),
+              released_field(released_field),
+              // a padded inline message must still fit in front of the trailer,
+              // and the write that carries both in one cache line
+              max_inline_msg_size(std::min({max_inline_msg_size,
+                                            (this->max_msg_size - 2 * sizeof(uint64_t)) & ~(sizeof(uint64_t) - 1),
+                                            static_cast<uint64_t>(cache_line_size - 2 * sizeof(uint64_t))})) {
         // find my_member_index
         for(uint i = 0; i < num_members; ++i) {
             if(row_indices[i] == my_row) {
@@ -115,20 +197,25 @@ public:
     volatile char* get_buffer(uint64_t msg_size) {
         assert(my_sender_index >= 0);
         std::lock_guard<std::mutex> lock(msg_send_mutex);
-        assert(msg_size <= max_msg_size);
+        assert(msg_size <= max_msg_size - 2 * sizeof(uint64_t));
         while(true) {
             if(queued_num - finished_multicasts_num < window_size) {
                 queued_num++;
                 uint32_t slot = queued_num % window_size;
                 // set size appropriately
-                (uint64_t&)sst->slots[my_row][max_msg_size * (slots_offset + slot + 1) - 2 * sizeof(uint64_t)] = msg_size;
-                return &sst->slots[my_row][max_msg_size * (slots_offset + slot)];
+                uint64_t& size_word = (uint64_t&)sst->slots[my_row][slots_offset + max_msg_size * (slot + 1) - 2 * sizeof(uint64_t)];
+                size_word = msg_size <= max_inline_msg_size ? (msg_size | INLINE_MESSAGE_FLAG) : msg_size;
+                return &sst->slots[my_row][slots_offset + max_msg_size * slot + slot_message_offset(max_msg_size, size_word)];
             } else {
                 long long int min_multicast_num = sst->num_received_sst[my_row][num_received_offset + my_sender_index];
                 for(auto i : row_indices) {
                     if(sst->num_received_sst[i][num_received_offset + my_sender_index] < min_multicast_num) {
                         min_multicast_num = sst->num_received_sst[i][num_received_offset + my_sender_index];
                     }
+                    if(released_field
+                       && (sst.get()->*released_field)[i][num_received_offset + my_sender_index] < min_multicast_num) {
+                        min_multicast_num = (sst.get()->*released_field)[i][num_received_offset + my_sender_index];
+                    }
                 }
                 if(finished_multicasts_num == min_multicast_num) {
                     return nullptr;
@@ -139,16 +226,94 @@ public:
         }
     }
 
-    void send() {
-        uint32_t slot = num_sent % window_size;
-        num_sent++;
-        ((uint64_t&)sst->slots[my_row][max_msg_size * (slots_offset + slot + 1) - sizeof(uint64_t)])++;
-        sst->put(
-                (char*)std::addressof(sst->slots[0][max_msg_size * (slots_offset + slot)]) - sst->getBaseAddress(),
-                max_msg_size - sizeof(uint64_t));
-        sst->put(
-                (char*)std::addressof(sst->slots[0][max_msg_size * (slots_offset + slot)]) - sst->getBaseAddress() + max_msg_size - sizeof(uint64_t),
-                sizeof(uint64_t));
+    /**
+     * Changes the size of the message in the newest slot handed out by
+     * get_buffer(), which must not have been sent yet. If the message was
+     * placed for an inline send, it may move within the slot; its first
+     * min(old size, msg_size) bytes are preserved.
+     * @return The new location of the message
+     */
+    volatile char* resize_buffer(uint64_t msg_size) {
+        assert(msg_size <= max_msg_size - 2 * sizeof(uint64_t));
+        assert(queued_num >= static_cast<long long int>(num_sent));
+        uint32_t slot = queued_num % window_size;
+        volatile char* slot_start = &sst->slots[my_row][slots_offset + max_msg_size * slot];
+        uint64_t& size_word = (uint64_t&)slot_start[max_msg_size - 2 * sizeof(uint64_t)];
+        const uint64_t old_offset = slot_message_offset(max_msg_size, size_word);
+        const uint64_t old_size = slot_message_size(size_word);
+        size_word = msg_size <= max_inline_msg_size ? (msg_size | INLINE_MESSAGE_FLAG) : msg_size;
+        const uint64_t new_offset = slot_message_offset(max_msg_size, size_word);
+        if(new_offset != old_offset) {
+            std::memmove(const_cast<char*>(slot_start) + new_offset, const_cast<char*>(slot_start) + old_offset,
+                         std::min(old_size, msg_size));
+        }
+        return slot_start + new_offset;
+    }
+
+    /**
+     * Sends the message in the oldest slot handed out by get_buffer(), with
+     * the writes of add_slot_writes(), which the RDMA layer rings the NIC for
+     * once.
+     *
+     * A message small enough for the inline tier sits right in front of the
+     * trailer instead, and the two are sent as a single write with the data
+     * inlined in the work request. That breaks the rule above: it relies on
+     * the NIC placing a write of at most one cache line in one piece, which
+     * the common InfiniBand and RoCE NICs do but RDMA does not promise, so
+     * the tier is off unless max_inline_payload_size turns it on.
+     * @return Whether the message was sent as an inline write
+     */
+    bool send() {
+        const uint32_t slot = num_sent % window_size;
+        const uint64_t size_word = (uint64_t&)sst->slots[my_row][slots_offset + max_msg_size * (slot + 1) - 2 * sizeof(uint64_t)];
+        if(size_word & INLINE_MESSAGE_FLAG) {
+            num_sent++;
+            ((uint64_t&)sst->slots[my_row][slots_offset + max_msg_size * (slot + 1) - sizeof(uint64_t)])++;
+            const uint64_t slot_offset = (char*)std::addressof(sst->slots[0][slots_offset + max_msg_size * slot]) - sst->getBaseAddress();
+            const uint64_t msg_offset = slot_offset + slot_message_offset(max_msg_size, size_word);
+            sst->put_inline(row_indices, msg_offset, slot_offset + max_msg_size - msg_offset);
+            sst->notify(row_indices);
+            return true;
+        }
+        std::vector<std::pair<long long int, long long int>> writes;
+        add_slot_writes(writes);
+        sst->put_batch(row_indices, writes);
+        sst->notify(row_indices);
+        return false;
+    }
+
+    /**
+     * Sends the next num_msgs messages that were obtained with get_buffer()
+     * but not yet sent, posting the writes of all of them to each remote row
+     * together, so that the NIC is rung once per row instead of once per
+     * message. Each message is written as add_slot_writes() says.
+     * @param num_msgs The number of queued messages to send; must not exceed
+     * the number of buffers handed out by get_buffer() and not yet sent.
+     */
+    void send_batch(uint32_t num_msgs) {
+        assert(static_cast<long long int>(num_sent + num_msgs) <= queued_num + 1);
+        if(num_msgs == 1) {
+            // a single message may go as one inline write
+            send();
+            return;
+        }
+        std::vector<std::pair<long long int, long long int>> writes;
+        writes.reserve(3 * num_msgs);
+        for(; num_msgs > 0; num_msgs--) {
+            add_slot_writes(writes);
+        }
+        sst->put_batch(row_indices, writes);
+        sst->notify(row_indices);
+    }
+
+    /** @return The largest message that get_buffer() places for an inline send. */
+    uint64_t get_max_inline_msg_size() const {
+        return max_inline_msg_size;
+    }
+
+    /** @return The number of buffers handed out by get_buffer() that have not been sent yet. */
+    uint32_t get_num_unsent() const {
+        return queued_num + 1 - num_sent;
     }
 
     void debug_print() {
@@ -156,8 +321,8 @@ public:
         using std::endl;
         for(auto i : row_indices) {
             cout << "Printing slots::next_seq" << endl;
-            for(uint j = slots_offset; j < slots_offset + window_size; ++j) {
-                cout << (uint64_t&)sst->slots[i][max_msg_size * (j + 1) - sizeof(uint64_t)] << " ";
+            for(uint j = 0; j < window_size; ++j) {
+                cout << (uint64_t&)sst->slots[i][slots_offset + max_msg_size * (j + 1) - sizeof(uint64_t)] << " ";
             }
             cout << endl;
             cout << "Printing num_received_sst" << endl;
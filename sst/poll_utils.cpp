@@ -1,67 +1,96 @@
 #include <iostream>
 #include <numeric>
 #include <functional>
+#include <stdexcept>
 
 #include "poll_utils.h"
 
 namespace sst {
 namespace util {
 
-//std::vector<std::list<std::pair<int32_t, int32_t>>> PollingData::completion_entries;
-//std::map<std::thread::id, uint32_t> PollingData::tid_to_index;
-//std::vector<bool> PollingData::if_waiting;
-//std::condition_variable PollingData::poll_cv;
-//std::mutex PollingData::poll_mutex;
-
 //Single global instance, defined here
 PollingData polling_data;
 
+PollingData::SlotOwner::SlotOwner(PollingData* polling_data)
+        : polling_data(polling_data), index(polling_data->acquire_index()) {}
+
+PollingData::SlotOwner::~SlotOwner() {
+    polling_data->release_index(index);
+}
+
+PollingData::PollingData() : slots(new CompletionSlot[max_waiting_threads]) {
+    // Hand out low indexes first
+    for(uint32_t index = max_waiting_threads; index > 0; --index) {
+        free_slots.push_back(index - 1);
+    }
+}
+
 bool PollingData::check_waiting() {
-    return std::accumulate(if_waiting.begin(), if_waiting.end(), false, [](bool a, bool b) { return a || b; });
+    for(uint32_t index = 0; index < max_waiting_threads; ++index) {
+        if(slots[index].waiting) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t PollingData::acquire_index() {
+    std::lock_guard<std::mutex> lk(free_slots_mutex);
+    if(free_slots.empty()) {
+        throw std::runtime_error("Too many threads are waiting for RDMA completions");
+    }
+    uint32_t index = free_slots.back();
+    free_slots.pop_back();
+    return index;
+}
+
+void PollingData::release_index(uint32_t index) {
+    {
+        // Drop any completions that arrived after the owner stopped waiting
+        std::lock_guard<std::mutex> lk(slots[index].entries_mutex);
+        slots[index].completion_entries.clear();
+        slots[index].waiting = false;
+    }
+    std::lock_guard<std::mutex> lk(free_slots_mutex);
+    free_slots.push_back(index);
 }
 
 void PollingData::insert_completion_entry(uint32_t index, std::pair<int32_t, int32_t> ce) {
-    std::lock_guard<std::mutex> lk(poll_mutex);
-    completion_entries[index].push_back(ce);
+    if(index >= max_waiting_threads) {
+        return;
+    }
+    std::lock_guard<std::mutex> lk(slots[index].entries_mutex);
+    slots[index].completion_entries.push_back(ce);
 }
 
-std::optional<std::pair<int32_t, int32_t>> PollingData::get_completion_entry(const std::thread::id id) {
-    std::lock_guard<std::mutex> lk(poll_mutex);
-    auto index = tid_to_index[id];
-    if(completion_entries[index].empty()) {
+std::optional<std::pair<int32_t, int32_t>> PollingData::get_completion_entry(uint32_t index) {
+    std::lock_guard<std::mutex> lk(slots[index].entries_mutex);
+    auto& completion_entries = slots[index].completion_entries;
+    if(completion_entries.empty()) {
         return {};
     }
-    auto ce = completion_entries[index].front();
-    completion_entries[index].pop_front();
+    auto ce = completion_entries.front();
+    completion_entries.pop_front();
     return ce;
 }
 
-uint32_t PollingData::get_index(const std::thread::id id) {
-    std::lock_guard<std::mutex> lk(poll_mutex);
-    if(tid_to_index.find(id) == tid_to_index.end()) {
-        completion_entries.push_back(std::list<std::pair<int32_t, int32_t>>());
-        tid_to_index[id] = completion_entries.size() - 1;
-        if_waiting.push_back(false);
-    }
-    return tid_to_index[id];
+uint32_t PollingData::get_index() {
+    thread_local SlotOwner owner(this);
+    return owner.index;
 }
 
-void PollingData::set_waiting(const std::thread::id id) {
+void PollingData::set_waiting(uint32_t index) {
+    slots[index].waiting = true;
     std::lock_guard<std::mutex> lk(poll_mutex);
-    auto index = tid_to_index[id];
-    if_waiting[index] = true;
     poll_cv.notify_all();
 }
 
-void PollingData::reset_waiting(const std::thread::id id) {
-    std::lock_guard<std::mutex> lk(poll_mutex);
-    auto index = tid_to_index[id];
-    if_waiting[index] = false;
+void PollingData::reset_waiting(uint32_t index) {
+    slots[index].waiting = false;
 }
 
 void PollingData::wait_for_requests() {
     std::unique_lock<std::mutex> lk(poll_mutex);
-    // poll_cv.wait(lk, check_waiting);
     poll_cv.wait(lk, std::bind(&PollingData::check_waiting, this));
 }
 }  // namespace util
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <optional>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -11,29 +13,53 @@
 namespace sst {
 namespace util {
 class PollingData {
-    // static std::vector<std::list<std::pair<int32_t, int32_t>>> completion_entries;
-    // static std::map<std::thread::id, uint32_t> tid_to_index;
-    // static std::vector<bool> if_waiting;
-    // static std::condition_variable poll_cv;
-    // static std::mutex poll_mutex;
-    // static bool check_waiting();
-
-    std::vector<std::list<std::pair<int32_t, int32_t>>> completion_entries;
-    std::map<std::thread::id, uint32_t> tid_to_index;
-    std::vector<bool> if_waiting;
+    /**
+     * The completion entries of one thread that waits for completions. Only
+     * that thread and the polling thread ever touch a slot, so threads that
+     * wait for completions at the same time don't contend with each other.
+     */
+    struct CompletionSlot {
+        std::mutex entries_mutex;
+        std::list<std::pair<int32_t, int32_t>> completion_entries;
+        std::atomic<bool> waiting{false};
+    };
+    /** Releases a thread's completion slot when the thread exits. */
+    struct SlotOwner {
+        PollingData* polling_data;
+        uint32_t index;
+        SlotOwner(PollingData* polling_data);
+        ~SlotOwner();
+    };
+    /** The maximum number of threads that can own a completion slot at once. */
+    static constexpr uint32_t max_waiting_threads = 1024;
+
+    /** Never resized, so the polling thread can index it without locking
+     * while other threads acquire and release slots. */
+    std::unique_ptr<CompletionSlot[]> slots;
+    /** Indexes of the slots no thread currently owns. */
+    std::vector<uint32_t> free_slots;
+    std::mutex free_slots_mutex;
     std::condition_variable poll_cv;
     std::mutex poll_mutex;
     bool check_waiting();
+    uint32_t acquire_index();
+    void release_index(uint32_t index);
+
 public:
+    PollingData();
+
     void insert_completion_entry(uint32_t index, std::pair<int32_t, int32_t> ce);
 
-    std::optional<std::pair<int32_t, int32_t>> get_completion_entry(const std::thread::id id);
+    std::optional<std::pair<int32_t, int32_t>> get_completion_entry(uint32_t index);
 
-    uint32_t get_index(const std::thread::id id);
+    /** Returns the index of the calling thread's completion slot, assigning
+     * one on the thread's first call. Completions for writes posted with
+     * this index (as the sender context's ce_idx) are delivered to it. */
+    uint32_t get_index();
 
-    void set_waiting(const std::thread::id id);
+    void set_waiting(uint32_t index);
 
-    void reset_waiting(const std::thread::id id);
+    void reset_waiting(uint32_t index);
 
     void wait_for_requests();
 };
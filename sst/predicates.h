@@ -1,10 +1,16 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <sstream>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "sst.h"
 
@@ -13,6 +19,12 @@ namespace sst {
 template <class DerivedSST>
 class SST;
 
+/** Whether the calling thread is a predicate evaluation thread, of any SST
+ * partition. Such a thread holds its own partition's trigger_mutex while it
+ * runs a trigger, so it must never wait for another partition's trigger:
+ * two triggers removing each other's predicates would wait forever. */
+inline thread_local bool on_predicate_thread = false;
+
 /** Enumeration defining the kinds of predicates an SST can handle. */
 enum class PredicateType {
     /** One-time predicates only fire once; they are deleted once they become true. */
@@ -25,6 +37,114 @@ enum class PredicateType {
     TRANSITION
 };
 
+/**
+ * A contiguous range of SST memory that a predicate reads. Predicates can be
+ * registered with the list of ranges their value depends on, in which case
+ * the detect loop only evaluates them when the contents of at least one of
+ * those ranges has changed since the last evaluation.
+ */
+struct WatchedRange {
+    const volatile char* start;
+    std::size_t length;
+
+    template <typename T>
+    WatchedRange(const volatile T* field, std::size_t num_elements = 1)
+            : start(reinterpret_cast<const volatile char*>(field)),
+              length(num_elements * sizeof(T)) {}
+};
+
+using watch_list_t = std::vector<WatchedRange>;
+
+/**
+ * Keeps a private copy of a set of watched SST ranges, so that the detect
+ * loop can cheaply tell whether any of them changed since it last looked.
+ */
+class WatchedMemorySnapshot {
+    const watch_list_t ranges;
+    std::vector<char> snapshot;
+    bool initialized = false;
+
+public:
+    WatchedMemorySnapshot(const watch_list_t& watched_ranges) : ranges(watched_ranges) {
+        std::size_t total_length = 0;
+        for(const auto& range : ranges) {
+            total_length += range.length;
+        }
+        snapshot.resize(total_length);
+    }
+
+    /**
+     * Compares the watched ranges against the snapshot and brings the
+     * snapshot up to date.
+     * @return true if any watched byte changed since the last call, or if
+     * this is the first call.
+     */
+    bool refresh() {
+        bool changed = !initialized;
+        char* snap = snapshot.data();
+        for(const auto& range : ranges) {
+            const char* current = const_cast<const char*>(range.start);
+            if(changed || memcmp(snap, current, range.length) != 0) {
+                changed = true;
+                memcpy(snap, current, range.length);
+            }
+            snap += range.length;
+        }
+        initialized = true;
+        return changed;
+    }
+};
+
+/**
+ * What the detect loop has spent on one predicate, as recorded when predicate
+ * profiling is enabled. Times are in nanoseconds. A predicate registered with
+ * watched ranges counts an evaluation on every pass, including the ones
+ * skipped because its ranges had not changed.
+ */
+struct PredicateProfile {
+    /** The label given at registration, or a generated one */
+    std::string label;
+    PredicateType type;
+    /** Whether the predicate is still registered */
+    bool active;
+    uint64_t evaluations;
+    uint64_t fires;
+    uint64_t evaluation_ns;
+    uint64_t trigger_ns;
+};
+
+/** The counters behind a PredicateProfile, written only by the detect thread. */
+struct PredicateProfileCounters {
+    const std::string label;
+    const PredicateType type;
+    std::atomic<uint64_t> evaluations{0};
+    std::atomic<uint64_t> fires{0};
+    std::atomic<uint64_t> evaluation_ns{0};
+    std::atomic<uint64_t> trigger_ns{0};
+
+    PredicateProfileCounters(const std::string& label, PredicateType type)
+            : label(label), type(type) {}
+};
+
+/**
+ * Formats predicate profiles as a table, one line per predicate, with the
+ * ones that cost the detect thread the most time first.
+ */
+inline std::string format_predicate_profiles(std::vector<PredicateProfile> profiles) {
+    std::sort(profiles.begin(), profiles.end(), [](const PredicateProfile& a, const PredicateProfile& b) {
+        return a.evaluation_ns + a.trigger_ns > b.evaluation_ns + b.trigger_ns;
+    });
+    std::ostringstream table;
+    for(const PredicateProfile& profile : profiles) {
+        table << profile.label << (profile.active ? "" : " (removed)")
+              << ": evaluations=" << profile.evaluations
+              << " fires=" << profile.fires
+              << " evaluation_us=" << profile.evaluation_ns / 1000
+              << " trigger_us=" << profile.trigger_ns / 1000 << "\n";
+    }
+    return table.str();
+}
+
 template <class DerivedSST>
 class Predicates {
     using pred = std::function<bool(const DerivedSST&)>;
@@ -38,32 +158,64 @@ class Predicates {
     pred_list transition_predicates;
     /** Contains one entry for every predicate in `transition_predicates`, in parallel. */
     std::list<bool> transition_predicate_states;
+    /** Named functions, stored as predicates whose value is ignored and
+     * whose trigger is null; see insert_named_function(). */
+    pred_list named_functions;
+    using profile_list = std::list<std::unique_ptr<PredicateProfileCounters>>;
+    /** One entry for every predicate in each list, in parallel; the entries
+     * are null unless profiling is enabled. */
+    profile_list one_time_profiles;
+    profile_list recurrent_profiles;
+    profile_list transition_profiles;
+    profile_list named_function_profiles;
+    /** Whether to profile predicates; set by SST before evaluation starts. */
+    bool profiling = false;
+    /** The number of predicates inserted, used to label unlabelled ones. */
+    uint64_t num_inserted = 0;
     // SST needs to read these predicate lists directly
     friend class SST<DerivedSST>;
 
     std::mutex predicate_mutex;
+    /** Held by the evaluating thread while it runs a trigger, so that remove()
+     * can wait for a trigger that is running on another thread to finish. */
+    std::mutex trigger_mutex;
+
+    /** Makes the profile entry for a new predicate; must hold predicate_mutex. */
+    std::unique_ptr<PredicateProfileCounters> make_profile(const std::string& label, PredicateType type);
+    /** Reads the profiles of one list; must hold predicate_mutex. */
+    void read_profiles(const pred_list& predicates, const profile_list& profiles,
+                       std::vector<PredicateProfile>& result) const;
+    /** Reads the profiles of every predicate; must hold predicate_mutex. */
+    std::vector<PredicateProfile> read_profiles() const;
+    /** Waits for a trigger running on the evaluating thread, unless the
+     * caller is a predicate thread itself; see on_predicate_thread. */
+    void wait_for_trigger();
 
 public:
     class pred_handle {
         bool valid;
         typename pred_list::iterator iter;
         PredicateType type;
+        /** The Predicates object (partition) whose list iter points into. */
+        Predicates* owner;
         friend class Predicates;
 
     public:
-        pred_handle() : valid(false), type(PredicateType::ONE_TIME) {}
-        pred_handle(typename pred_list::iterator iter, PredicateType type)
-                : valid{true}, iter{iter}, type{type} {}
+        pred_handle() : valid(false), type(PredicateType::ONE_TIME), owner(nullptr) {}
+        pred_handle(typename pred_list::iterator iter, PredicateType type, Predicates* owner)
+                : valid{true}, iter{iter}, type{type}, owner{owner} {}
         pred_handle(pred_handle&) = delete;
         pred_handle(pred_handle&& other)
-                : pred_handle(std::move(other.iter), other.type) {
+                : pred_handle(std::move(other.iter), other.type, other.owner) {
+            valid = other.valid;
             other.valid = false;
         }
         pred_handle& operator=(pred_handle&) = delete;
         pred_handle& operator=(pred_handle&& other) {
             iter = std::move(other.iter);
             type = other.type;
-            valid = true;
+            owner = other.owner;
+            valid = other.valid;
             other.valid = false;
             return *this;
         }
@@ -72,26 +224,75 @@ public:
         }
     };
 
-    /** Inserts a single (predicate, trigger) pair to the appropriate predicate list. */
+    /** Inserts a single (predicate, trigger) pair to the appropriate predicate
+     * list. The label names the predicate in profiles. */
     pred_handle insert(pred predicate, trig trigger,
-                       PredicateType type = PredicateType::ONE_TIME);
+                       PredicateType type = PredicateType::ONE_TIME,
+                       const std::string& label = "");
 
     /** Inserts a predicate with a list of triggers (which will be run in
      * sequence) to the appropriate predicate list. */
     pred_handle insert(pred predicate, const std::list<trig>& triggers,
-                       PredicateType type = PredicateType::ONE_TIME) {
+                       PredicateType type = PredicateType::ONE_TIME,
+                       const std::string& label = "") {
         return insert(predicate, [triggers](DerivedSST& t) {
             for(const auto& trigger : triggers)
                 trigger(t);
         },
-                      type);
+                      type, label);
     }
 
-    /** Removes a (predicate, trigger) pair previously registered with insert(). */
+    /**
+     * Inserts a (predicate, trigger) pair whose predicate only reads the given
+     * ranges of SST memory. The predicate is skipped, and its trigger is not
+     * run, on every pass of the detect loop in which none of those ranges
+     * changed; a skipped transition predicate keeps its previous value. This
+     * is only correct if everything the predicate and trigger depend on is
+     * covered by the watched ranges, i.e. if running the trigger again on
+     * unchanged inputs would have no effect.
+     */
+    pred_handle insert(pred predicate, trig trigger, PredicateType type,
+                       const watch_list_t& watched_ranges,
+                       const std::string& label = "");
+
+    /**
+     * Registers a named function: a function that the detect thread calls at
+     * the start of every pass, before it evaluates any predicate. It is meant
+     * for an aggregate over the SST rows (e.g. the minimum of a column) that
+     * several predicates need; the function stores the result somewhere the
+     * predicates can read, and watch, so that all of the pass's predicates
+     * see the same value and the rows are scanned once. The label names the
+     * function in profiles. It is removed with remove(), like a predicate.
+     */
+    pred_handle insert_named_function(std::function<void(const DerivedSST&)> function,
+                                      const std::string& label = "");
+
+    /** Removes a (predicate, trigger) pair previously registered with insert().
+     * The handle may come from any predicate partition of the same SST; the
+     * removal is forwarded to the partition that owns it. The trigger never
+     * runs again once this returns; unless it is called from a trigger, a
+     * run in progress on another thread has also finished. A trigger that
+     * removes another partition's predicate doesn't wait for that run. */
     void remove(pred_handle& pred);
 
+    /** Removes every (predicate, trigger) pair in handles, which may come from
+     * any partitions of the same SST, taking each partition's locks once
+     * rather than once per predicate and one partition at a time. It waits
+     * for running triggers as remove() does. */
+    void remove_all(std::list<pred_handle>& handles);
+
     /** Deletes all predicates, including evolvers and their triggers. */
     void clear();
+
+    /**
+     * Returns what the detect loop has spent on each predicate of this
+     * partition, including removed ones, or nothing if the SST was not
+     * constructed with profile_predicates.
+     */
+    std::vector<PredicateProfile> get_profiles() {
+        std::lock_guard<std::mutex> lock(predicate_mutex);
+        return read_profiles();
+    }
 };
 
 /**
@@ -105,32 +306,111 @@ public:
  * PredicateType::ONE_TIME
  */
 template <class DerivedSST>
-auto Predicates<DerivedSST>::insert(pred predicate, trig trigger, PredicateType type) -> pred_handle {
+auto Predicates<DerivedSST>::insert(pred predicate, trig trigger, PredicateType type,
+                                    const std::string& label) -> pred_handle {
     std::lock_guard<std::mutex> lock(predicate_mutex);
     if(type == PredicateType::ONE_TIME) {
         one_time_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
                 predicate, std::make_shared<trig>(trigger)));
-        return pred_handle(--one_time_predicates.end(), type);
+        one_time_profiles.push_back(make_profile(label, type));
+        return pred_handle(--one_time_predicates.end(), type, this);
     } else if(type == PredicateType::RECURRENT) {
         recurrent_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
                 predicate, std::make_shared<trig>(trigger)));
-        return pred_handle(--recurrent_predicates.end(), type);
+        recurrent_profiles.push_back(make_profile(label, type));
+        return pred_handle(--recurrent_predicates.end(), type, this);
     } else {
         transition_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
                 predicate, std::make_shared<trig>(trigger)));
         transition_predicate_states.push_back(false);
-        return pred_handle(--transition_predicates.end(), type);
+        transition_profiles.push_back(make_profile(label, type));
+        return pred_handle(--transition_predicates.end(), type, this);
     }
 }
 
 template <class DerivedSST>
-void Predicates<DerivedSST>::remove(pred_handle& handle) {
+auto Predicates<DerivedSST>::insert(pred predicate, trig trigger, PredicateType type,
+                                    const watch_list_t& watched_ranges,
+                                    const std::string& label) -> pred_handle {
+    struct watched_predicate_state {
+        WatchedMemorySnapshot watched_memory;
+        bool last_value = false;
+    };
+    auto state = std::make_shared<watched_predicate_state>(watched_predicate_state{WatchedMemorySnapshot(watched_ranges)});
+    const bool keep_last_value = (type == PredicateType::TRANSITION);
+    pred watched_predicate = [predicate, state, keep_last_value](const DerivedSST& sst) {
+        if(!state->watched_memory.refresh()) {
+            return keep_last_value && state->last_value;
+        }
+        state->last_value = predicate(sst);
+        return state->last_value;
+    };
+    return insert(watched_predicate, trigger, type, label);
+}
+
+template <class DerivedSST>
+auto Predicates<DerivedSST>::insert_named_function(std::function<void(const DerivedSST&)> function,
+                                                   const std::string& label) -> pred_handle {
     std::lock_guard<std::mutex> lock(predicate_mutex);
-    if(!handle.is_valid()) {
+    named_functions.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
+            [function](const DerivedSST& sst) {
+                function(sst);
+                return false;
+            },
+            nullptr));
+    named_function_profiles.push_back(make_profile(label, PredicateType::RECURRENT));
+    return pred_handle(--named_functions.end(), PredicateType::RECURRENT, this);
+}
+
+template <class DerivedSST>
+void Predicates<DerivedSST>::remove(pred_handle& handle) {
+    if(handle.valid && handle.owner != this) {
+        handle.owner->remove(handle);
         return;
     }
-    handle.iter->reset();
-    handle.valid = false;
+    {
+        std::lock_guard<std::mutex> lock(predicate_mutex);
+        if(!handle.is_valid()) {
+            return;
+        }
+        handle.iter->reset();
+        handle.valid = false;
+    }
+    // The evaluating thread may be running this predicate's trigger right now
+    wait_for_trigger();
+}
+
+template <class DerivedSST>
+void Predicates<DerivedSST>::remove_all(std::list<pred_handle>& handles) {
+    std::vector<Predicates*> owners;
+    for(const pred_handle& handle : handles) {
+        if(handle.valid && std::find(owners.begin(), owners.end(), handle.owner) == owners.end()) {
+            owners.push_back(handle.owner);
+        }
+    }
+    for(Predicates* owner : owners) {
+        {
+            std::lock_guard<std::mutex> lock(owner->predicate_mutex);
+            for(pred_handle& handle : handles) {
+                if(handle.valid && handle.owner == owner) {
+                    if(*handle.iter) {
+                        handle.iter->reset();
+                    }
+                    handle.valid = false;
+                }
+            }
+        }
+        owner->wait_for_trigger();
+    }
+}
+
+template <class DerivedSST>
+void Predicates<DerivedSST>::wait_for_trigger() {
+    // A predicate thread holds its own trigger_mutex, so it can't wait for
+    // another one; a thread that holds none can wait for any in any order
+    if(!on_predicate_thread) {
+        std::lock_guard<std::mutex> trigger_lock(trigger_mutex);
+    }
 }
 
 template <class DerivedSST>
@@ -143,6 +423,51 @@ void Predicates<DerivedSST>::clear() {
                   [](ptr_to_pred& ptr) { ptr.reset(); });
     std::for_each(transition_predicates.begin(), transition_predicates.end(),
                   [](ptr_to_pred& ptr) { ptr.reset(); });
+    std::for_each(named_functions.begin(), named_functions.end(),
+                  [](ptr_to_pred& ptr) { ptr.reset(); });
+}
+
+template <class DerivedSST>
+std::unique_ptr<PredicateProfileCounters> Predicates<DerivedSST>::make_profile(const std::string& label,
+                                                                                PredicateType type) {
+    ++num_inserted;
+    if(!profiling) {
+        return nullptr;
+    }
+    if(!label.empty()) {
+        return std::make_unique<PredicateProfileCounters>(label, type);
+    }
+    const char* type_name = type == PredicateType::ONE_TIME
+                                    ? "one-time"
+                                    : (type == PredicateType::RECURRENT ? "recurrent" : "transition");
+    return std::make_unique<PredicateProfileCounters>(
+            std::string("unlabelled ") + type_name + " predicate " + std::to_string(num_inserted), type);
+}
+
+template <class DerivedSST>
+void Predicates<DerivedSST>::read_profiles(const pred_list& predicates, const profile_list& profiles,
+                                           std::vector<PredicateProfile>& result) const {
+    auto pred_it = predicates.begin();
+    for(auto profile_it = profiles.begin(); profile_it != profiles.end(); ++profile_it, ++pred_it) {
+        const auto& profile = *profile_it;
+        if(profile) {
+            result.push_back({profile->label, profile->type, *pred_it != nullptr,
+                              profile->evaluations.load(std::memory_order_relaxed),
+                              profile->fires.load(std::memory_order_relaxed),
+                              profile->evaluation_ns.load(std::memory_order_relaxed),
+                              profile->trigger_ns.load(std::memory_order_relaxed)});
+        }
+    }
+}
+
+template <class DerivedSST>
+std::vector<PredicateProfile> Predicates<DerivedSST>::read_profiles() const {
+    std::vector<PredicateProfile> result;
+    read_profiles(one_time_predicates, one_time_profiles, result);
+    read_profiles(recurrent_predicates, recurrent_profiles, result);
+    read_profiles(transition_predicates, transition_profiles, result);
+    read_profiles(named_functions, named_function_profiles, result);
+    return result;
 }
 
 } /* namespace sst */
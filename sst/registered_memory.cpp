@@ -0,0 +1,141 @@
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/mempolicy.h>
+#include <new>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "conf/affinity.hpp"
+#include "conf/conf.hpp"
+#include "registered_memory.h"
+
+namespace sst {
+
+void RegisteredMemoryDeleter::operator()(volatile char* memory) const {
+    if(memory) {
+        munmap(const_cast<char*>(memory), size);
+    }
+    if(!shm_name.empty()) {
+        shm_unlink(shm_name.c_str());
+    }
+}
+
+/**
+ * Asks the kernel to put the pages of a new mapping on the NIC's NUMA node,
+ * if DERECHO/numa_node names one, moving the ones already allocated where it
+ * can. The node is preferred rather than required, so a full node falls back
+ * to the others instead of failing the allocation.
+ */
+static void prefer_nic_numa_node(void* mapping, std::size_t size) {
+    static std::atomic<bool> warned{false};
+    constexpr int bits_per_word = 8 * sizeof(unsigned long);
+    unsigned long node_mask[16] = {};
+    const int node = derecho::get_nic_numa_node();
+    if(node < 0 || node >= 16 * bits_per_word) {
+        return;
+    }
+    node_mask[node / bits_per_word] = 1UL << (node % bits_per_word);
+    if(syscall(SYS_mbind, mapping, size, MPOL_PREFERRED, node_mask, 16 * bits_per_word, MPOL_MF_MOVE) != 0
+       && !warned.exchange(true)) {
+        std::cerr << "Could not place registered memory on NUMA node " << node << std::endl;
+    }
+}
+
+/** Maps size bytes of huge pages, or returns MAP_FAILED */
+static void* map_hugepages(std::size_t size, std::size_t hugepage_size) {
+    const std::string& hugetlbfs_path = derecho::getConfString(CONF_DERECHO_HUGETLBFS_PATH);
+    if(!hugetlbfs_path.empty()) {
+        std::string file_template = hugetlbfs_path + "/derecho-XXXXXX";
+        std::vector<char> file_name(file_template.begin(), file_template.end());
+        file_name.push_back('\0');
+        const int fd = mkstemp(file_name.data());
+        if(fd < 0) {
+            return MAP_FAILED;
+        }
+        // The mapping keeps the pages after the file is gone
+        unlink(file_name.data());
+        void* mapping = MAP_FAILED;
+        if(ftruncate(fd, size) == 0) {
+            mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        return mapping;
+    }
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    flags |= __builtin_ctzll(hugepage_size) << MAP_HUGE_SHIFT;
+#endif
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+registered_memory_ptr allocate_registered_memory(std::size_t size) {
+    static std::atomic<bool> warned{false};
+    const std::size_t hugepage_size = derecho::getConfUInt64(CONF_DERECHO_HUGEPAGE_SIZE);
+    void* mapping = MAP_FAILED;
+    std::size_t mapped_size = size;
+    if(hugepage_size > 0 && size >= hugepage_size / 2) {
+        // Huge page sizes are always powers of two
+        if((hugepage_size & (hugepage_size - 1)) == 0) {
+            mapped_size = (size + hugepage_size - 1) / hugepage_size * hugepage_size;
+            mapping = map_hugepages(mapped_size, hugepage_size);
+        }
+        if(mapping == MAP_FAILED && !warned.exchange(true)) {
+            std::cerr << "Could not allocate huge pages of " << hugepage_size
+                      << " bytes, falling back to normal pages" << std::endl;
+        }
+    }
+    if(mapping == MAP_FAILED) {
+        mapped_size = size;
+        mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(mapping == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    prefer_nic_numa_node(mapping, mapped_size);
+    return registered_memory_ptr(static_cast<volatile char*>(mapping), RegisteredMemoryDeleter{mapped_size});
+}
+
+registered_memory_ptr allocate_shared_registered_memory(std::size_t size) {
+    if(!derecho::getConfBoolean(CONF_DERECHO_SHARED_MEMORY_SST)
+       || derecho::getConfUInt64(CONF_DERECHO_HUGEPAGE_SIZE) > 0) {
+        return allocate_registered_memory(size);
+    }
+    static std::atomic<uint32_t> num_segments{0};
+    // The random part keeps a process in another PID namespace, which may
+    // have the same PID, from opening a segment of the same name by mistake
+    static const uint64_t nonce = (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+    const std::string name = "/derecho-" + std::to_string(getpid()) + "-" + std::to_string(nonce) + "-"
+                             + std::to_string(num_segments++);
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) {
+        return allocate_registered_memory(size);
+    }
+    // Reserve the pages now: a full /dev/shm would otherwise only show up
+    // as a SIGBUS on first touch
+    void* mapping = MAP_FAILED;
+    if(ftruncate(fd, size) == 0 && posix_fallocate(fd, 0, size) == 0) {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return allocate_registered_memory(size);
+    }
+    prefer_nic_numa_node(mapping, size);
+    return registered_memory_ptr(static_cast<volatile char*>(mapping), RegisteredMemoryDeleter{size, name});
+}
+
+void unlink_shared_registered_memory(registered_memory_ptr& memory) {
+    std::string& shm_name = memory.get_deleter().shm_name;
+    if(!shm_name.empty()) {
+        shm_unlink(shm_name.c_str());
+        shm_name.clear();
+    }
+}
+}  // namespace sst
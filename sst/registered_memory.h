@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace sst {
+
+/** Unmaps memory obtained from allocate_registered_memory(), and removes
+ * its shared memory segment if it has one */
+struct RegisteredMemoryDeleter {
+    std::size_t size = 0;
+    /** The name of the POSIX shared memory segment behind the memory, or
+     * empty if it is private to this process */
+    std::string shm_name;
+    void operator()(volatile char* memory) const;
+};
+
+using registered_memory_ptr = std::unique_ptr<volatile char[], RegisteredMemoryDeleter>;
+
+/**
+ * Allocates size bytes of zeroed, page-aligned memory for buffers that will
+ * be registered with the NIC. If DERECHO/hugepage_size is set, memory of at
+ * least half a huge page is backed by huge pages of that size, taken from
+ * the hugetlbfs mount at DERECHO/hugetlbfs_path if there is one and from the
+ * anonymous huge page pool otherwise. Fewer, larger pages keep the NIC's
+ * translation tables small. If no huge pages can be had, normal pages are
+ * used instead.
+ */
+registered_memory_ptr allocate_registered_memory(std::size_t size);
+
+/**
+ * Like allocate_registered_memory(), but if DERECHO/shared_memory_sst is set
+ * and no huge pages are configured, backs the memory with a POSIX shared
+ * memory segment that other processes on this host can map by the name in
+ * the deleter's shm_name. If no segment can be had, the memory is private
+ * and shm_name is empty.
+ */
+registered_memory_ptr allocate_shared_registered_memory(std::size_t size);
+
+/**
+ * Removes the name of the shared memory segment behind memory from
+ * allocate_shared_registered_memory(), once every process that maps it has
+ * done so, so that the segment goes away with the last of their mappings
+ * even if they crash. Does nothing for private memory.
+ */
+void unlink_shared_registered_memory(registered_memory_ptr& memory);
+}  // namespace sst
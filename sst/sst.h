@@ -1,14 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <bitset>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <numeric>
 #include <stdexcept>
 #include <string.h>
@@ -16,7 +20,9 @@
 #include <thread>
 #include <vector>
 
+#include "conf/fault_injection.hpp"
 #include "predicates.h"
+#include "registered_memory.h"
 
 #ifdef USE_VERBS_API
   #include "verbs.h"
@@ -29,6 +35,12 @@ using sst::resources;
 namespace sst {
 
 const int alignTo = sizeof(long);
+/** The cache line size assumed by the cache-line-aligned row layout. */
+const int cache_line_size = 64;
+
+constexpr int round_up_to_cache_line(const int& len) {
+    return (len + cache_line_size - 1) / cache_line_size * cache_line_size;
+}
 
 constexpr int padded_len(const int& len) {
     return (len < alignTo) ? alignTo : (len + alignTo) | (alignTo - 1);
@@ -40,8 +52,29 @@ public:
     volatile char* base;
     int rowLen;
     int field_len;
-
-    _SSTField(const int field_len) : base(nullptr), rowLen(0), field_len(field_len) {}
+    /** Whether this field should start on a new cache line when the SST
+     * uses the cache-line-aligned row layout. */
+    bool cache_line_aligned;
+    /** Whether the whole-row put functions skip this field, see
+     * exclude_from_row_puts(). */
+    bool excluded_from_row_puts;
+    /** Offset of this field from the start of a row, in bytes. */
+    int row_offset;
+    /** The byte range [dirty_begin, dirty_end) of this field, relative to
+     * its start, that was modified in the local row since the last time
+     * SST::flush_dirty() wrote it out. Empty if dirty_begin == dirty_end. */
+    int dirty_begin;
+    int dirty_end;
+
+    _SSTField(const int field_len)
+            : base(nullptr),
+              rowLen(0),
+              field_len(field_len),
+              cache_line_aligned(false),
+              excluded_from_row_puts(false),
+              row_offset(0),
+              dirty_begin(0),
+              dirty_end(0) {}
 
     int set_base(volatile char* const base) {
         this->base = base;
@@ -53,6 +86,27 @@ public:
     }
 
     void set_rowLen(const int& _rowLen) { rowLen = _rowLen; }
+
+    /** Requests that this field start on its own cache line if the SST
+     * uses the cache-line-aligned row layout. Must be called before SSTInit. */
+    void align_to_cache_line() { cache_line_aligned = true; }
+
+    /** Requests that SST::put() and the other whole-row puts leave this field
+     * out, for large fields that are always written explicitly (with
+     * put_range() or put()) by whoever updates them. Must be called before
+     * SSTInit. */
+    void exclude_from_row_puts() { excluded_from_row_puts = true; }
+
+    /** Adds the byte range [begin, end) of this field to its dirty range. */
+    void mark_bytes_dirty(const int begin, const int end) {
+        if(dirty_begin == dirty_end) {
+            dirty_begin = begin;
+            dirty_end = end;
+        } else {
+            dirty_begin = std::min(dirty_begin, begin);
+            dirty_end = std::max(dirty_end, end);
+        }
+    }
 };
 
 /**
@@ -80,6 +134,10 @@ public:
 
     // Setter
     void operator()(const int row_idx, T const v) { *(T*)(base + row_idx * rowLen) = v; }
+
+    /** Records that the local row's value was modified, so that the next
+     * SST::flush_dirty() including this field writes it. */
+    void mark_dirty() { mark_bytes_dirty(0, sizeof(T)); }
 };
 
 /**
@@ -108,6 +166,14 @@ public:
     /** Just like std::vector::size(), returns the number of elements in this vector. */
     size_t size() const { return length; }
 
+    /** Records that elements [begin, begin + count) of the local row were
+     * modified, so that the next SST::flush_dirty() including this field
+     * writes them. */
+    void mark_dirty(size_t begin, size_t count = 1) {
+        assert(begin + count <= length);
+        mark_bytes_dirty(begin * sizeof(T), (begin + count) * sizeof(T));
+    }
+
     void __attribute__((noinline)) debug_print(int row_num) {
         volatile T* arr = (*this)[row_num];
         for(unsigned int j = 0; j < length; ++j) {
@@ -119,6 +185,46 @@ public:
 
 typedef std::function<void(uint32_t)> failure_upcall_t;
 
+/**
+ * How the predicate evaluation loop backs off when no predicate has fired
+ * for a while. After the last predicate fired the loop keeps spinning for
+ * spin_us microseconds, then yields the CPU between passes for another
+ * yield_us microseconds, and from then on sleeps for sleep_us microseconds
+ * between passes, which bounds how late an idle loop notices a change.
+ */
+struct DetectBackoffPolicy {
+    uint64_t spin_us = 1000;
+    uint64_t yield_us = 0;
+    uint64_t sleep_us = 1000;
+};
+
+/**
+ * Counters kept by each predicate evaluation thread, for tuning its
+ * DetectBackoffPolicy. Each set is only written by its own thread.
+ */
+struct DetectLoopCounters {
+    /** Passes in which at least one predicate fired. */
+    std::atomic<uint64_t> busy_passes{0};
+    /** Idle passes that spun. */
+    std::atomic<uint64_t> spin_passes{0};
+    /** Idle passes that yielded the CPU. */
+    std::atomic<uint64_t> yields{0};
+    /** Idle passes that slept. */
+    std::atomic<uint64_t> sleeps{0};
+    /** Total time requested for those sleeps, in microseconds. */
+    std::atomic<uint64_t> sleep_us{0};
+    /** Passes right after a sleep in which a predicate fired; each of these
+     * is a change that may have been noticed up to sleep_us late. */
+    std::atomic<uint64_t> wakeups_with_work{0};
+};
+
+/** Counts the remote writes posted by an SST's put functions. */
+struct PutCounters {
+    /** One per row written, so a put to every other member counts several */
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
 /** Constructor parameter pack for SST. */
 struct SSTParams {
     const std::vector<uint32_t>& members;
@@ -126,6 +232,13 @@ struct SSTParams {
     const failure_upcall_t failure_upcall;
     const std::vector<char> already_failed;
     const bool start_predicate_thread;
+    const uint32_t num_predicate_threads;
+    const std::vector<int> predicate_thread_cpus;
+    /** How the predicate threads back off when no predicate fires. */
+    const DetectBackoffPolicy backoff_policy;
+    const bool cache_line_layout;
+    const bool profile_predicates;
+    const uint64_t profile_dump_interval_ms;
 
     /**
      *
@@ -142,17 +255,44 @@ struct SSTParams {
      * should be started immediately on construction of the SST. If false,
      * predicate evaluation will not start until start_predicate_evalution()
      * is called.
+     * @param num_predicate_threads The number of predicate partitions, each of
+     * which is evaluated by its own thread. See SST::get_predicates().
+     * @param predicate_thread_cpus The CPU core to pin each predicate thread
+     * to, indexed by partition number. Threads without an entry (or with a
+     * negative one) are not pinned.
+     * @param backoff_policy How the predicate threads back off when idle.
+     * @param cache_line_layout Whether to use the cache-line-aligned row
+     * layout, in which every row starts on a cache line and fields marked
+     * with align_to_cache_line() start on a new one.
+     * @param profile_predicates Whether the predicate threads should record
+     * the evaluations, fires and time spent of each predicate; see
+     * get_predicate_profiles().
+     * @param profile_dump_interval_ms How often each predicate thread prints
+     * its profiles to standard output, in milliseconds, if profiling; 0 never
+     * prints them.
      */
     SSTParams(const std::vector<uint32_t>& _members,
               const uint32_t my_node_id,
               const failure_upcall_t failure_upcall = nullptr,
               const std::vector<char> already_failed = {},
-              const bool start_predicate_thread = true)
+              const bool start_predicate_thread = true,
+              const uint32_t num_predicate_threads = 1,
+              const std::vector<int> predicate_thread_cpus = {},
+              const DetectBackoffPolicy backoff_policy = {},
+              const bool cache_line_layout = false,
+              const bool profile_predicates = false,
+              const uint64_t profile_dump_interval_ms = 0)
             : members(_members),
               my_node_id(my_node_id),
               failure_upcall(failure_upcall),
               already_failed(already_failed),
-              start_predicate_thread(start_predicate_thread) {}
+              start_predicate_thread(start_predicate_thread),
+              num_predicate_threads(num_predicate_threads ? num_predicate_threads : 1),
+              predicate_thread_cpus(predicate_thread_cpus),
+              backoff_policy(backoff_policy),
+              cache_line_layout(cache_line_layout),
+              profile_predicates(profile_predicates),
+              profile_dump_interval_ms(profile_dump_interval_ms) {}
 };
 
 template <class DerivedSST>
@@ -162,10 +302,29 @@ private:
     void init_SSTFields(Fields&... fields) {
         rowLen = 0;
         compute_rowLen(rowLen, fields...);
-        rows = new char[rowLen * num_members];
+        if(cache_line_layout) {
+            rowLen = round_up_to_cache_line(rowLen);
+        }
+        // Page-aligned, so the rows also start on a cache line; in shared
+        // memory if possible, so members on this host can write them directly
+        row_memory = allocate_shared_registered_memory(rowLen * num_members);
+        rows = row_memory.get();
         // snapshot = new char[rowLen * num_members];
         volatile char* base = rows;
         set_bases_and_rowLens(base, rowLen, fields...);
+        row_put_ranges.clear();
+        long long int range_start = 0;
+        for(_SSTField* field : {static_cast<_SSTField*>(&fields)...}) {
+            if(field->excluded_from_row_puts) {
+                if(field->row_offset > range_start) {
+                    row_put_ranges.emplace_back(range_start, field->row_offset - range_start);
+                }
+                range_start = field->row_offset + padded_len(field->field_len);
+            }
+        }
+        if(rowLen > range_start) {
+            row_put_ranges.emplace_back(range_start, rowLen - range_start);
+        }
     }
 
     DerivedSST* derived_this;
@@ -173,18 +332,60 @@ private:
     std::vector<std::thread> background_threads;
     std::atomic<bool> thread_shutdown;
 
-    void detect();
+    void detect(Predicates<DerivedSST>& partition, uint32_t partition_num);
 
 public:
+    /** The first predicate partition, evaluated by the "sst_detect" thread.
+     * Predicates that are not inserted through get_predicates() go here. */
     Predicates<DerivedSST> predicates;
     friend class Predicates<DerivedSST>;
 
 private:
+    /** The remaining predicate partitions, if more than one predicate thread
+     * was requested; partition i + 1 is stored at index i. */
+    std::vector<std::unique_ptr<Predicates<DerivedSST>>> extra_predicate_partitions;
+    /** The CPU core each predicate thread should be pinned to, if any. */
+    const std::vector<int> predicate_thread_cpus;
+    /** How the predicate threads back off when no predicate fires. */
+    const DetectBackoffPolicy backoff_policy;
+    /** How often the predicate threads print their profiles, if profiling. */
+    const uint64_t profile_dump_interval_ms;
+    /** One set of counters per predicate thread, indexed by partition number. */
+    std::vector<std::unique_ptr<DetectLoopCounters>> detect_counters;
+    /** The writes posted by the put functions, from whichever thread calls them. */
+    PutCounters put_counters;
+
+    /** Adds writes of a given size to each of num_rows rows to put_counters */
+    void count_puts(uint32_t num_rows, long long int size) {
+        if(num_rows > 0) {
+            put_counters.writes.fetch_add(num_rows, std::memory_order_relaxed);
+            put_counters.bytes.fetch_add(num_rows * size, std::memory_order_relaxed);
+        }
+    }
+
+    /** Whether a write to a row should be posted, once any fault injected
+     * into the writes to its node has been applied; see FaultInjector. */
+    bool inject_put_fault(uint32_t index) {
+        derecho::FaultInjector& fault_injector = derecho::FaultInjector::get();
+        return !fault_injector.enabled() || fault_injector.before_put(members[index]);
+    }
+
+private:
+    /** Owns the memory where the SST rows are stored. */
+    registered_memory_ptr row_memory;
+    /** The NIC registration of row_memory, shared by the connections to
+     * all the other members, so that it is registered once per SST. */
+    std::unique_ptr<memory_region> row_region;
     /** Pointer to memory where the SST rows are stored. */
     volatile char* rows;
     // char* snapshot;
     /** Length of each row in this SST, in bytes. */
     int rowLen;
+    /** The (offset, size) chunks of the row that the whole-row puts write:
+     * the whole row, minus the fields excluded from row puts. */
+    std::vector<std::pair<long long int, long long int>> row_put_ranges;
+    /** Whether rows use the cache-line-aligned layout (see SSTParams). */
+    const bool cache_line_layout;
     /** List of nodes in the SST; indexes are row numbers, values are node IDs. */
     const std::vector<uint32_t>& members;
     /** Equal to members.size() */
@@ -224,6 +425,10 @@ public:
     SST(DerivedSST* derived_class_pointer, const SSTParams& params)
             : derived_this(derived_class_pointer),
               thread_shutdown(false),
+              predicate_thread_cpus(params.predicate_thread_cpus),
+              backoff_policy(params.backoff_policy),
+              profile_dump_interval_ms(params.profile_dump_interval_ms),
+              cache_line_layout(params.cache_line_layout),
               members(params.members),
               num_members(members.size()),
               all_indices(num_members),
@@ -232,6 +437,14 @@ public:
               failure_upcall(params.failure_upcall),
               res_vec(num_members),
               thread_start(params.start_predicate_thread) {
+        for(uint32_t partition = 0; partition < params.num_predicate_threads; ++partition) {
+            if(partition > 0) {
+                extra_predicate_partitions.emplace_back(std::make_unique<Predicates<DerivedSST>>());
+                extra_predicate_partitions.back()->profiling = params.profile_predicates;
+            }
+            detect_counters.emplace_back(std::make_unique<DetectLoopCounters>());
+        }
+        predicates.profiling = params.profile_predicates;
         //Figure out my SST index
         my_index = (uint)-1;
         for(uint32_t i = 0; i < num_members; ++i) {
@@ -262,10 +475,19 @@ public:
 
     template <typename... Fields>
     void SSTInit(Fields&... fields) {
+        using std::chrono::steady_clock;
+        const auto start_time = steady_clock::now();
         //Initialize rows and set the "base" field of each SSTField
         init_SSTFields(fields...);
 
-        //Initialize res_vec with the correct offsets for each row
+        row_region = std::make_unique<memory_region>(const_cast<char*>(rows), rowLen * num_members,
+                                                     row_memory.get_deleter().shm_name);
+        const auto rows_time = steady_clock::now();
+
+        //Initialize res_vec with the correct offsets for each row. Each
+        //connection waits on a handshake with its member, so they are all
+        //made at once instead of one member after another.
+        std::vector<std::thread> connect_threads;
         unsigned int node_rank, sst_index;
         for(auto const& rank_index : members_by_id) {
             std::tie(node_rank, sst_index) = rank_index;
@@ -276,22 +498,38 @@ public:
                 if(row_is_frozen[sst_index]) {
                     continue;
                 }
+                connect_threads.emplace_back([this, node_rank, sst_index, write_addr, read_addr]() {
 #ifdef USE_VERBS_API
-                res_vec[sst_index] = std::make_unique<resources>(
-                        node_rank, write_addr, read_addr, rowLen, rowLen);
+                    res_vec[sst_index] = std::make_unique<resources>(
+                            node_rank, write_addr, read_addr, *row_region);
 #else // use libfabric api by default
-                res_vec[sst_index] = std::make_unique<resources>(
-                        node_rank, write_addr, read_addr, rowLen, rowLen, (my_node_id<node_rank));
+                    res_vec[sst_index] = std::make_unique<resources>(
+                            node_rank, write_addr, read_addr, *row_region, (my_node_id<node_rank));
 #endif
+                });
                 // update qp_num_to_index
                 // qp_num_to_index[res_vec[sst_index].get()->qp->qp_num] = sst_index;
             }
         }
+        for(auto& thread : connect_threads) {
+            thread.join();
+        }
+        // Every member on this host has mapped the rows by now
+        unlink_shared_registered_memory(row_memory);
+        const auto connect_time = steady_clock::now();
+
+        background_threads.emplace_back(&SST::detect, this, std::ref(predicates), 0);
+        for(uint32_t partition = 1; partition <= extra_predicate_partitions.size(); ++partition) {
+            background_threads.emplace_back(&SST::detect, this,
+                                            std::ref(*extra_predicate_partitions[partition - 1]), partition);
+        }
 
-        std::thread detector(&SST::detect, this);
-        background_threads.push_back(std::move(detector));
-
-        std::cout << "Initialized SST and Started Threads" << std::endl;
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        std::cout << "Initialized SST and Started Threads (rows: "
+                  << duration_cast<microseconds>(rows_time - start_time).count() << " us, "
+                  << connect_threads.size() << " connections: "
+                  << duration_cast<microseconds>(connect_time - rows_time).count() << " us)" << std::endl;
     }
 
     ~SST();
@@ -299,6 +537,50 @@ public:
     /** Starts the predicate evaluation loop. */
     void start_predicate_evaluation();
 
+    /** Returns the number of predicate partitions, each with its own thread. */
+    uint32_t get_num_predicate_partitions() const {
+        return detect_counters.size();
+    }
+
+    /** Returns the idle-loop counters of the given predicate thread. */
+    const DetectLoopCounters& get_detect_counters(uint32_t partition_num = 0) const {
+        return *detect_counters.at(partition_num);
+    }
+
+    /**
+     * Returns what the predicate threads have spent on each predicate, over
+     * all partitions; empty unless the SST was constructed with
+     * profile_predicates.
+     */
+    std::vector<PredicateProfile> get_predicate_profiles() {
+        std::vector<PredicateProfile> profiles = predicates.get_profiles();
+        for(auto& partition : extra_predicate_partitions) {
+            std::vector<PredicateProfile> partition_profiles = partition->get_profiles();
+            profiles.insert(profiles.end(), partition_profiles.begin(), partition_profiles.end());
+        }
+        return profiles;
+    }
+
+    /** Returns the number of remote writes posted so far, and their bytes. */
+    const PutCounters& get_put_counters() const {
+        return put_counters;
+    }
+
+    /**
+     * Returns the predicate partition that predicates with the given key
+     * (e.g. a subgroup ID) should be inserted into. Each partition is
+     * evaluated by its own thread, so a slow trigger in one partition does
+     * not delay the others. The first partition is kept for unkeyed
+     * predicates, so keys are spread over the remaining ones; with a single
+     * predicate thread this always returns the predicates member.
+     */
+    Predicates<DerivedSST>& get_predicates(uint32_t partition_key) {
+        if(extra_predicate_partitions.empty()) {
+            return predicates;
+        }
+        return *extra_predicate_partitions[partition_key % extra_predicate_partitions.size()];
+    }
+
     /** Does a TCP sync with each member of the SST. */
     void sync_with_members() const;
 
@@ -319,22 +601,34 @@ public:
         return const_cast<char*>(rows);
     }
 
-    /** Writes the entire local row to all remote nodes. */
+    /** Writes the entire local row to all remote nodes, except for the
+     * fields excluded from row puts (see _SSTField::exclude_from_row_puts()). */
     void put() {
-        put(all_indices, 0, rowLen);
+        put(all_indices);
     }
 
     void put_with_completion() {
-        put_with_completion(all_indices, 0, rowLen);
+        put_with_completion(all_indices);
     }
 
-    /** Writes the entire local row to some of the remote nodes. */
+    /** Writes the entire local row to some of the remote nodes, except for
+     * the fields excluded from row puts. */
     void put(const std::vector<uint32_t> receiver_ranks) {
-        put(receiver_ranks, 0, rowLen);
+        put_batch(receiver_ranks, row_put_ranges);
     }
 
+    /** Like put(receiver_ranks), but waits for the writes to complete. The
+     * chunks before the last are posted without completions; since writes
+     * to a row complete in order, the last one's completion covers them. */
     void put_with_completion(const std::vector<uint32_t> receiver_ranks) {
-        put_with_completion(receiver_ranks, 0, rowLen);
+        if(row_put_ranges.empty()) {
+            return;
+        }
+        if(row_put_ranges.size() > 1) {
+            put_batch(receiver_ranks, std::vector<std::pair<long long int, long long int>>(
+                                              row_put_ranges.begin(), row_put_ranges.end() - 1));
+        }
+        put_with_completion(receiver_ranks, row_put_ranges.back().first, row_put_ranges.back().second);
     }
 
     /** Writes a contiguous subset of the local row to all remote nodes. */
@@ -351,6 +645,67 @@ public:
 
     void put_with_completion(const std::vector<uint32_t> receiver_ranks, long long int offset, long long int size);
 
+    /**
+     * Like put(), but the data is inlined in each work request, so the write
+     * is posted without the NIC reading the local row. size must not exceed
+     * get_max_inline_size(); on transports that can't inline, this is a put().
+     */
+    void put_inline(const std::vector<uint32_t> receiver_ranks, long long int offset, long long int size);
+
+    /** Writes several contiguous subsets of the local row, in order, to all remote nodes. */
+    void put_batch(const std::vector<std::pair<long long int, long long int>>& offsets_and_sizes) {
+        put_batch(all_indices, offsets_and_sizes);
+    }
+
+    /**
+     * Writes several contiguous subsets of the local row, in order, to some of
+     * the remote nodes. The writes to each remote row are posted together so
+     * the RDMA layer can ring the doorbell once per row rather than once per
+     * (offset, size) pair.
+     */
+    void put_batch(const std::vector<uint32_t> receiver_ranks,
+                   const std::vector<std::pair<long long int, long long int>>& offsets_and_sizes);
+
+    /**
+     * Follows the writes just posted to some of the remote nodes with a
+     * notification, which wakes their predicate threads right away if they
+     * are idle and asleep. Does nothing unless notifications_enabled().
+     */
+    void notify(const std::vector<uint32_t> receiver_ranks);
+
+    /** Writes elements [begin, begin + count) of a vector field in the local
+     * row to all remote nodes. */
+    template <typename T>
+    void put_range(const SSTFieldVector<T>& field, size_t begin, size_t count) {
+        put_range(all_indices, field, begin, count);
+    }
+
+    /** Writes elements [begin, begin + count) of a vector field in the local
+     * row to some of the remote nodes. */
+    template <typename T>
+    void put_range(const std::vector<uint32_t> receiver_ranks, const SSTFieldVector<T>& field,
+                   size_t begin, size_t count) {
+        assert(begin + count <= field.size());
+        put(receiver_ranks, field.row_offset + begin * sizeof(T), count * sizeof(T));
+    }
+
+    /** Writes the dirty parts of the given fields to all remote nodes. */
+    template <typename... Fields>
+    void flush_dirty(Fields&... fields) {
+        flush_dirty(all_indices, fields...);
+    }
+
+    /**
+     * Writes the parts of the given fields that were marked dirty since their
+     * last flush to some of the remote nodes, and clears their dirty ranges.
+     * Ranges that touch or overlap in the row are merged, and the rest are
+     * posted as one batch in row order, so the order in which the fields are
+     * listed does not matter. Marking and flushing a field must not happen
+     * concurrently on different threads.
+     */
+    template <typename... Fields>
+    void flush_dirty(const std::vector<uint32_t> receiver_ranks, Fields&... fields);
+
 private:
     using char_p = volatile char*;
 
@@ -358,6 +713,9 @@ private:
 
     template <typename Field, typename... Fields>
     void compute_rowLen(int& rowLen, Field& f, Fields&... rest) {
+        if(cache_line_layout && f.cache_line_aligned) {
+            rowLen = round_up_to_cache_line(rowLen);
+        }
         rowLen += padded_len(f.field_len);
         compute_rowLen(rowLen, rest...);
     }
@@ -366,6 +724,10 @@ private:
 
     template <typename Field, typename... Fields>
     void set_bases_and_rowLens(char_p& base, const int rlen, Field& f, Fields&... rest) {
+        if(cache_line_layout && f.cache_line_aligned) {
+            base = rows + round_up_to_cache_line(base - rows);
+        }
+        f.row_offset = base - rows;
         base += f.set_base(base);
         f.set_rowLen(rlen);
         set_bases_and_rowLens(base, rlen, rest...);
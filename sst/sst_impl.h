@@ -6,16 +6,20 @@
 
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <cstdio>
 #include <memory>
 #include <mutex>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <thread>
 #include <time.h>
 #include <vector>
 
+#include "conf/affinity.hpp"
 #include "poll_utils.h"
 #include "predicates.h"
 #include "sst.h"
@@ -32,10 +36,6 @@ SST<DerivedSST>::~SST() {
     for(auto& thread : background_threads) {
         if(thread.joinable()) thread.join();
     }
-
-    if(rows != nullptr) {
-        delete[](const_cast<char*>(rows));
-    }
 }
 
 /**
@@ -55,86 +55,177 @@ void SST<DerivedSST>::start_predicate_evaluation() {
  * events. It continuously evaluates predicates one by one, and runs the
  * trigger functions for each predicate that fires. In addition, it
  * continuously evaluates named functions one by one, and updates the local
- * row's observed values of those functions.
+ * row's observed values of those functions. There is one such thread for
+ * each predicate partition.
+ * @param partition The predicate partition this thread evaluates
+ * @param partition_num The index of that partition, used to name the thread
+ * and look up the CPU core it should be pinned to
  */
 template <typename DerivedSST>
-void SST<DerivedSST>::detect() {
-    pthread_setname_np(pthread_self(), "sst_detect");
+void SST<DerivedSST>::detect(Predicates<DerivedSST>& partition, uint32_t partition_num) {
+    derecho::name_and_pin_thread(partition_num == 0 ? "sst_detect" : "sst_detect_" + std::to_string(partition_num));
+    // sst_predicate_cpus takes precedence over DERECHO/thread_cpus
+    if(partition_num < predicate_thread_cpus.size() && predicate_thread_cpus[partition_num] >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(predicate_thread_cpus[partition_num], &cpuset);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+            std::cerr << "Failed to pin SST predicate thread " << partition_num
+                      << " to core " << predicate_thread_cpus[partition_num] << std::endl;
+        }
+    }
+    on_predicate_thread = true;
     if(!thread_start) {
         std::unique_lock<std::mutex> lock(thread_start_mutex);
         thread_start_cv.wait(lock, [this]() { return thread_start; });
     }
+    DetectLoopCounters& counters = *detect_counters[partition_num];
+    // Only this thread writes its counters, so a relaxed load and store is enough
+    auto increment = [](std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    };
+    bool slept_since_last_fire = false;
     struct timespec last_time, cur_time;
-    clock_gettime(CLOCK_REALTIME, &last_time);
+    clock_gettime(CLOCK_MONOTONIC, &last_time);
+    auto now_ns = []() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    };
+    uint64_t last_profile_dump_ns = now_ns();
+    // Evaluates a predicate, adding the time it took to its profile if it
+    // is being profiled
+    auto evaluate = [&](typename Predicates<DerivedSST>::pred& predicate, PredicateProfileCounters* profile) {
+        if(!profile) {
+            return predicate(*derived_this);
+        }
+        const uint64_t start_ns = now_ns();
+        const bool value = predicate(*derived_this);
+        increment(profile->evaluation_ns, now_ns() - start_ns);
+        increment(profile->evaluations, 1);
+        return value;
+    };
+    // Runs a trigger with the predicate lock released, likewise profiling it
+    auto fire = [&](std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger, PredicateProfileCounters* profile,
+                    std::unique_lock<std::mutex>& predicates_lock) {
+        predicates_lock.unlock();
+        {
+            std::lock_guard<std::mutex> trigger_lock(partition.trigger_mutex);
+            const uint64_t start_ns = profile ? now_ns() : 0;
+            (*trigger)(*derived_this);
+            if(profile) {
+                increment(profile->trigger_ns, now_ns() - start_ns);
+                increment(profile->fires, 1);
+            }
+        }
+        predicates_lock.lock();
+    };
 
+    const bool wait_for_notifications = notifications_enabled();
     while(!thread_shutdown) {
         try {
             bool predicate_fired = false;
+            // read before the predicates, so a notification that arrives
+            // while they are evaluated cuts the next sleep short
+            const uint64_t notifications_seen = wait_for_notifications ? get_notification_count() : 0;
             // Take the predicate lock before reading the predicate lists
-            std::unique_lock<std::mutex> predicates_lock(predicates.predicate_mutex);
+            std::unique_lock<std::mutex> predicates_lock(partition.predicate_mutex);
+
+            // The profile lists parallel the predicate lists and, like them,
+            // only grow, so their entries stay put while a trigger runs
+            auto profile_it = partition.named_function_profiles.begin();
+            // named functions come first, so every predicate of this pass sees their results
+            for(auto fun_it = partition.named_functions.begin();
+                fun_it != partition.named_functions.end(); ++fun_it, ++profile_it) {
+                if(*fun_it != nullptr) {
+                    evaluate((*fun_it)->first, profile_it->get());
+                }
+            }
 
             // one time predicates need to be evaluated only until they become true
-            for(auto& pred : predicates.one_time_predicates) {
-                if(pred != nullptr && (pred->first(*derived_this) == true)) {
+            profile_it = partition.one_time_profiles.begin();
+            for(auto pred_it = partition.one_time_predicates.begin();
+                pred_it != partition.one_time_predicates.end(); ++pred_it, ++profile_it) {
+                auto& pred = *pred_it;
+                if(pred != nullptr && evaluate(pred->first, profile_it->get()) == true) {
                     predicate_fired = true;
                     // Copy the trigger pointer locally, so it can continue running without
                     // segfaulting even if this predicate gets deleted when we unlock predicates_lock
-                    std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->second);
-                    predicates_lock.unlock();
-                    (*trigger)(*derived_this);
-                    predicates_lock.lock();
+                    fire(pred->second, profile_it->get(), predicates_lock);
                     // erase the predicate as it was just found to be true
                     pred.reset();
                 }
             }
 
             // recurrent predicates are evaluated each time they are found to be true
-            for(auto& pred : predicates.recurrent_predicates) {
-                if(pred != nullptr && (pred->first(*derived_this) == true)) {
+            profile_it = partition.recurrent_profiles.begin();
+            for(auto pred_it = partition.recurrent_predicates.begin();
+                pred_it != partition.recurrent_predicates.end(); ++pred_it, ++profile_it) {
+                auto& pred = *pred_it;
+                if(pred != nullptr && evaluate(pred->first, profile_it->get()) == true) {
                     predicate_fired = true;
-                    std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->second);
-                    predicates_lock.unlock();
-                    (*trigger)(*derived_this);
-                    predicates_lock.lock();
+                    fire(pred->second, profile_it->get(), predicates_lock);
                 }
             }
 
             // transition predicates are only evaluated when they change from false to true
             // We need to use iterators here because we need to iterate over two lists in parallel
-            auto pred_it = predicates.transition_predicates.begin();
-            auto pred_state_it = predicates.transition_predicate_states.begin();
-            while(pred_it != predicates.transition_predicates.end()) {
+            auto pred_it = partition.transition_predicates.begin();
+            auto pred_state_it = partition.transition_predicate_states.begin();
+            profile_it = partition.transition_profiles.begin();
+            while(pred_it != partition.transition_predicates.end()) {
                 if(*pred_it != nullptr) {
                     //*pred_state_it is the previous state of the predicate at *pred_it
-                    bool curr_pred_state = (*pred_it)->first(*derived_this);
+                    bool curr_pred_state = evaluate((*pred_it)->first, profile_it->get());
                     if(curr_pred_state == true && *pred_state_it == false) {
                         predicate_fired = true;
-                        std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(
-                                (*pred_it)->second);
-                        predicates_lock.unlock();
-                        (*trigger)(*derived_this);
-                        predicates_lock.lock();
+                        fire((*pred_it)->second, profile_it->get(), predicates_lock);
                     }
                     *pred_state_it = curr_pred_state;
-
-                    ++pred_it;
-                    ++pred_state_it;
                 }
+                ++pred_it;
+                ++pred_state_it;
+                ++profile_it;
+            }
+
+            if(partition.profiling && profile_dump_interval_ms > 0
+               && now_ns() - last_profile_dump_ns >= profile_dump_interval_ms * 1000000) {
+                last_profile_dump_ns = now_ns();
+                std::cout << "SST predicate profile, partition " << partition_num << ":\n"
+                          << format_predicate_profiles(partition.read_profiles()) << std::flush;
             }
 
             if(predicate_fired) {
                 // update last time
-                clock_gettime(CLOCK_REALTIME, &last_time);
+                clock_gettime(CLOCK_MONOTONIC, &last_time);
+                increment(counters.busy_passes, 1);
+                if(slept_since_last_fire) {
+                    increment(counters.wakeups_with_work, 1);
+                    slept_since_last_fire = false;
+                }
             } else {
-                clock_gettime(CLOCK_REALTIME, &cur_time);
-                // check if the system has been inactive for enough time to induce sleep
-                double time_elapsed_in_ms = (cur_time.tv_sec - last_time.tv_sec) * 1e3
-                                            + (cur_time.tv_nsec - last_time.tv_nsec) / 1e6;
-                if(time_elapsed_in_ms > 1) {
+                clock_gettime(CLOCK_MONOTONIC, &cur_time);
+                // spin, then yield, then sleep, depending on how long the system has been inactive
+                uint64_t time_elapsed_in_us = (cur_time.tv_sec - last_time.tv_sec) * 1000000
+                                              + (cur_time.tv_nsec - last_time.tv_nsec) / 1000;
+                if(time_elapsed_in_us < backoff_policy.spin_us) {
+                    increment(counters.spin_passes, 1);
+                } else if(time_elapsed_in_us < backoff_policy.spin_us + backoff_policy.yield_us) {
                     predicates_lock.unlock();
-                    using namespace std::chrono_literals;
-                    std::this_thread::sleep_for(1ms);
+                    std::this_thread::yield();
                     predicates_lock.lock();
+                    increment(counters.yields, 1);
+                } else {
+                    predicates_lock.unlock();
+                    if(wait_for_notifications) {
+                        wait_for_notification(notifications_seen, std::chrono::microseconds(backoff_policy.sleep_us));
+                    } else {
+                        std::this_thread::sleep_for(std::chrono::microseconds(backoff_policy.sleep_us));
+                    }
+                    predicates_lock.lock();
+                    increment(counters.sleeps, 1);
+                    increment(counters.sleep_us, backoff_policy.sleep_us);
+                    slept_since_last_fire = true;
                 }
             }
             //Still to do: Clean up deleted predicates
@@ -147,28 +238,124 @@ void SST<DerivedSST>::detect() {
 template <typename DerivedSST>
 void SST<DerivedSST>::put(const std::vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
     assert(offset + size <= rowLen);
+    uint32_t num_rows = 0;
     for(auto index : receiver_ranks) {
         // don't write to yourself or a frozen row
-        if(index == my_index || row_is_frozen[index]) {
+        if(index == my_index || row_is_frozen[index] || !inject_put_fault(index)) {
             continue;
         }
         // perform a remote RDMA write on the owner of the row
         res_vec[index]->post_remote_write(offset, size);
+        num_rows++;
     }
+    count_puts(num_rows, size);
     return;
 }
 
+template <typename DerivedSST>
+void SST<DerivedSST>::put_inline(const std::vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
+    assert(offset + size <= rowLen);
+    uint32_t num_rows = 0;
+    for(auto index : receiver_ranks) {
+        // don't write to yourself or a frozen row
+        if(index == my_index || row_is_frozen[index] || !inject_put_fault(index)) {
+            continue;
+        }
+#ifdef USE_VERBS_API
+        res_vec[index]->post_remote_write(offset, size);
+#else
+        res_vec[index]->post_remote_write_inline(offset, size);
+#endif
+        num_rows++;
+    }
+    count_puts(num_rows, size);
+}
+
+template <typename DerivedSST>
+void SST<DerivedSST>::notify(const std::vector<uint32_t> receiver_ranks) {
+#ifndef USE_VERBS_API
+    if(!notifications_enabled()) {
+        return;
+    }
+    for(auto index : receiver_ranks) {
+        if(index == my_index || row_is_frozen[index]) {
+            continue;
+        }
+        // on the same connection as the writes, so it arrives after them
+        res_vec[index]->post_remote_notification();
+    }
+#endif
+}
+
+template <typename DerivedSST>
+void SST<DerivedSST>::put_batch(const std::vector<uint32_t> receiver_ranks,
+                                const std::vector<std::pair<long long int, long long int>>& offsets_and_sizes) {
+    long long int batch_size = 0;
+    for(const auto& offset_and_size : offsets_and_sizes) {
+        assert(offset_and_size.first + offset_and_size.second <= rowLen);
+        batch_size += offset_and_size.second;
+    }
+    uint32_t num_rows = 0;
+    for(auto index : receiver_ranks) {
+        // don't write to yourself or a frozen row
+        if(index == my_index || row_is_frozen[index] || !inject_put_fault(index)) {
+            continue;
+        }
+#ifdef USE_VERBS_API
+        for(const auto& offset_and_size : offsets_and_sizes) {
+            res_vec[index]->post_remote_write(offset_and_size.first, offset_and_size.second);
+        }
+#else
+        res_vec[index]->post_remote_writes(offsets_and_sizes);
+#endif
+        num_rows++;
+    }
+    count_puts(num_rows, batch_size);
+}
+
+template <typename DerivedSST>
+template <typename... Fields>
+void SST<DerivedSST>::flush_dirty(const std::vector<uint32_t> receiver_ranks, Fields&... fields) {
+    // Collect the dirty ranges as (start, end) offsets within the row
+    std::vector<std::pair<long long int, long long int>> dirty_ranges;
+    for(_SSTField* field : {static_cast<_SSTField*>(&fields)...}) {
+        if(field->dirty_begin != field->dirty_end) {
+            dirty_ranges.emplace_back(field->row_offset + field->dirty_begin,
+                                      field->row_offset + field->dirty_end);
+            field->dirty_begin = field->dirty_end = 0;
+        }
+    }
+    if(dirty_ranges.empty()) {
+        return;
+    }
+    std::sort(dirty_ranges.begin(), dirty_ranges.end());
+    // Merge ranges that touch or overlap, and convert them to (offset, size)
+    std::vector<std::pair<long long int, long long int>> offsets_and_sizes;
+    long long int range_start = dirty_ranges[0].first;
+    long long int range_end = dirty_ranges[0].second;
+    for(size_t i = 1; i < dirty_ranges.size(); ++i) {
+        if(dirty_ranges[i].first <= range_end) {
+            range_end = std::max(range_end, dirty_ranges[i].second);
+        } else {
+            offsets_and_sizes.emplace_back(range_start, range_end - range_start);
+            range_start = dirty_ranges[i].first;
+            range_end = dirty_ranges[i].second;
+        }
+    }
+    offsets_and_sizes.emplace_back(range_start, range_end - range_start);
+    put_batch(receiver_ranks, offsets_and_sizes);
+}
+
 template <typename DerivedSST>
 void SST<DerivedSST>::put_with_completion(const std::vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
     assert(offset + size <= rowLen);
     unsigned int num_writes_posted = 0;
     std::vector<bool> posted_write_to(num_members, false);
 
-    const auto tid = std::this_thread::get_id();
     // get id first
-    uint32_t ce_idx = util::polling_data.get_index(tid);
+    uint32_t ce_idx = util::polling_data.get_index();
 
-    util::polling_data.set_waiting(tid);
+    util::polling_data.set_waiting(ce_idx);
 #ifdef USE_VERBS_API
     struct verbs_sender_ctxt sctxt[receiver_ranks.size()];
 #else
@@ -182,10 +369,14 @@ void SST<DerivedSST>::put_with_completion(const std::vector<uint32_t> receiver_r
         // perform a remote RDMA write on the owner of the row
         sctxt[index].remote_id = index;
         sctxt[index].ce_idx = ce_idx;
-        res_vec[index]->post_remote_write_with_completion(&sctxt[index], offset, size);
+        // A dropped write is still waited for, so it times out like a lost one
+        if(inject_put_fault(index)) {
+            res_vec[index]->post_remote_write_with_completion(&sctxt[index], offset, size);
+        }
         posted_write_to[index] = true;
         num_writes_posted++;
     }
+    count_puts(num_writes_posted, size);
 
     // track which nodes haven't failed yet
     std::vector<bool> polled_successfully_from(num_members, false);
@@ -208,7 +399,7 @@ void SST<DerivedSST>::put_with_completion(const std::vector<uint32_t> receiver_r
 
         while(true) {
             // check if polling result is available
-            ce = util::polling_data.get_completion_entry(tid);
+            ce = util::polling_data.get_completion_entry(ce_idx);
             if(ce) {
                 break;
             }
@@ -247,7 +438,7 @@ void SST<DerivedSST>::put_with_completion(const std::vector<uint32_t> receiver_r
         }
     }
 
-    util::polling_data.reset_waiting(tid);
+    util::polling_data.reset_waiting(ce_idx);
 
     for(auto index : failed_node_indexes) {
         freeze(index);
@@ -22,6 +22,7 @@
 #include <thread>
 #include <unistd.h>
 
+#include "conf/affinity.hpp"
 #include "derecho/connection_manager.h"
 #include "derecho/derecho_ports.h"
 #include "poll_utils.h"
@@ -79,6 +80,23 @@ struct global_resources *g_res;
 std::thread polling_thread;
 static bool shutdown = false;
 
+memory_region::memory_region(char *buf, std::size_t size, const std::string &) {
+    const int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    mr = ibv_reg_mr(g_res->pd, buf, size, mr_flags);
+    if(!mr) {
+        cout << "Could not register memory region, error code is: " << errno << endl;
+    }
+}
+
+memory_region::~memory_region() {
+    if(mr) {
+        int rc = ibv_dereg_mr(mr);
+        if(rc) {
+            cout << "Could not de-register memory region, error code is " << rc << endl;
+        }
+    }
+}
+
 /**
  * Initializes the resources. Registers write_addr and read_addr as the read
  * and write buffers and connects a queue pair with the specified remote node.
@@ -120,7 +138,32 @@ _resources::_resources(int r_index, char *write_addr, char *read_addr, int size_
     if(!read_mr) {
         cout << "Could not register memory region : read_mr, error code is: " << errno << endl;
     }
+    owns_memory_regions = true;
 
+    create_and_connect_qp();
+}
+
+/**
+ * Initializes the resources for a write buffer and a read buffer that lie in
+ * a region registered already, and connects a queue pair with the specified
+ * remote node.
+ *
+ * @param r_index The node rank of the remote node to connect to.
+ * @param write_addr A pointer to the memory to use as the write buffer.
+ * @param read_addr A pointer to the memory to use as the read buffer.
+ * @param region The registered region containing both buffers.
+ */
+_resources::_resources(int r_index, char *write_addr, char *read_addr, const memory_region &region)
+        : remote_index(r_index),
+          write_mr(region.mr),
+          read_mr(region.mr),
+          write_buf(write_addr),
+          read_buf(read_addr),
+          owns_memory_regions(false) {
+    create_and_connect_qp();
+}
+
+void _resources::create_and_connect_qp() {
     // set the queue pair up for creation
     struct ibv_qp_init_attr qp_init_attr;
     memset(&qp_init_attr, 0, sizeof(qp_init_attr));
@@ -143,7 +186,7 @@ _resources::_resources(int r_index, char *write_addr, char *read_addr, int size_
 
     // connect the QPs
     connect_qp();
-    cout << "Established RDMA connection with node " << r_index << endl;
+    cout << "Established RDMA connection with node " << remote_index << endl;
 }
 
 /**
@@ -158,6 +201,9 @@ _resources::~_resources() {
         }
     }
 
+    if(!owns_memory_regions) {
+        return;
+    }
     if(write_mr) {
         rc = ibv_dereg_mr(write_mr);
         if(rc) {
@@ -356,6 +402,10 @@ resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
                      int size_r) : _resources(r_index, write_addr, read_addr, size_w, size_r) {
 }
 
+resources::resources(int r_index, char *write_addr, char *read_addr, const memory_region &region)
+        : _resources(r_index, write_addr, read_addr, region) {
+}
+
 /**
  * @param size The number of bytes to read from remote memory.
  */
@@ -493,7 +543,7 @@ void resources_two_sided::post_two_sided_receive(const uint32_t id, const long l
 }
 
 void polling_loop() {
-    pthread_setname_np(pthread_self(), "sst_poll");
+    derecho::name_and_pin_thread("sst_poll");
     cout << "Polling thread starting" << endl;
     while(!shutdown) {
         auto ce = verbs_poll_completion();
@@ -654,6 +704,26 @@ bool sync(uint32_t r_index) {
     cout << "Initialized global RDMA resources" << endl;
 }
 
+uint32_t get_max_inline_size() {
+    return 0;
+}
+
+uint32_t get_signal_interval() {
+    return 0;
+}
+
+bool notifications_enabled() {
+    return false;
+}
+
+uint64_t get_notification_count() {
+    return 0;
+}
+
+void wait_for_notification(uint64_t seen, std::chrono::microseconds timeout) {
+    std::this_thread::sleep_for(timeout);
+}
+
 void shutdown_polling_thread() {
     shutdown = true;
 }
@@ -7,7 +7,10 @@
  * including the Resources class and global setup functions.
  */
 
+#include <chrono>
+#include <cstddef>
 #include <map>
+#include <string>
 
 #include <infiniband/verbs.h>
 
@@ -32,12 +35,33 @@ struct verbs_sender_ctxt {
   uint32_t      ce_idx; // index into the completion entry list
 };
 
+/**
+ * A buffer registered with the NIC once, so that the connections to several
+ * remote nodes can share the registration instead of each pinning their
+ * parts of it again.
+ */
+class memory_region {
+public:
+    /** Memory Region handle for the buffer. */
+    struct ibv_mr *mr;
+
+    /** Registers size bytes at buf for local writes and remote reads and
+     * writes. shm_name is unused, since this backend always goes through
+     * the NIC. */
+    memory_region(char *buf, std::size_t size, const std::string &shm_name = "");
+    memory_region(const memory_region &) = delete;
+    memory_region &operator=(const memory_region &) = delete;
+    ~memory_region();
+};
+
 /**
  * Represents the set of RDMA resources needed to maintain a two-way connection
  * to a single remote node.
  */
 class _resources {
 private:
+    /** Creates the queue pair and connects it to the remote node. */
+    void create_and_connect_qp();
     /** Initializes the queue pair. */
     void set_qp_initialized();
     /** Transitions the queue pair to the ready-to-receive state. */
@@ -68,10 +92,16 @@ public:
      */
     char *read_buf;
 
+    /** Whether write_mr and read_mr were registered by this object, and not
+     * borrowed from a memory_region. */
+    bool owns_memory_regions;
+
     /** Constructor; initializes Queue Pair, Memory Regions, and `remote_props`.
      */
     _resources(int r_index, char *write_addr, char *read_addr, int size_w,
                int size_r);
+    /** Constructor for buffers that both lie in an already registered region. */
+    _resources(int r_index, char *write_addr, char *read_addr, const memory_region &region);
     /** Destroys the resources. */
     virtual ~_resources();
 };
@@ -80,6 +110,7 @@ class resources : public _resources {
 public:
     resources(int r_index, char *write_addr, char *read_addr, int size_w,
               int size_r);
+    resources(int r_index, char *write_addr, char *read_addr, const memory_region &region);
     /*
       wrapper functions that make up the user interface
       all call post_remote_send with different parameters
@@ -121,6 +152,15 @@ void verbs_initialize(const std::map<uint32_t, std::string> &ip_addrs,
                       uint32_t node_rank);
 /** Polls for completion of a single posted remote write. */
 std::pair<uint32_t, std::pair<int, int>> verbs_poll_completion();
+/** The queue pairs are created without inline data, so this is always 0. */
+uint32_t get_max_inline_size();
+/** Every send is signaled by its caller, so this is always 0. */
+uint32_t get_signal_interval();
+/** Notifications are only implemented with libfabric, so this is false. */
+bool notifications_enabled();
+uint64_t get_notification_count();
+/** Sleeps for timeout, since no notification ever arrives. */
+void wait_for_notification(uint64_t seen, std::chrono::microseconds timeout);
 void shutdown_polling_thread();
 /** Destroys the global verbs resources. */
 void verbs_destroy();
@@ -0,0 +1,949 @@
+#include "emulation.h"
+#include "tcp.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/tcp.h>
+#include <map>
+#include <mutex>
+#include <netdb.h>
+#include <set>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace tcp::emulation {
+
+using namespace std;
+
+namespace {
+
+/** How long a node waits for a remote node with a higher ID to connect */
+constexpr auto connect_timeout = std::chrono::seconds(30);
+/** The size of the buffer each connection reads headers and small payloads
+ * into, so that many small writes take one read() */
+constexpr size_t input_buffer_size = 256 * 1024;
+
+enum class msg_type : uint8_t {
+    HELLO,
+    WRITE,
+    READ_REQUEST,
+    READ_RESPONSE,
+    SEND
+};
+
+/** What precedes every message on a connection */
+struct header {
+    msg_type type;
+    /** READ_RESPONSE: whether the region could be read */
+    uint8_t success;
+    /** HELLO: the sender's listening port */
+    uint16_t port;
+    /** HELLO: the sender's node ID; SEND and READ_RESPONSE: the receiving
+     * channel */
+    uint32_t id;
+    /** WRITE and READ_REQUEST: the region */
+    uint32_t key;
+    /** SEND: the immediate */
+    uint32_t immediate;
+    /** WRITE and READ_REQUEST: the offset in the region */
+    uint64_t offset;
+    /** The size of the payload that follows; READ_REQUEST: the size to read */
+    uint64_t length;
+    /** READ_REQUEST and READ_RESPONSE: the read they belong to */
+    uint64_t request;
+} __attribute__((packed));
+
+struct region {
+    char* const buf;
+    const size_t size;
+    /** The number of messages being received into the region */
+    int writers = 0;
+
+    region(char* buf, size_t size) : buf(buf), size(size) {}
+};
+
+struct peer;
+
+struct posted_recv {
+    char* buf;
+    size_t size;
+    uint64_t context;
+};
+
+struct unexpected_message {
+    vector<char> data;
+    uint32_t immediate;
+};
+
+struct channel_state {
+    const uint32_t id;
+    const completion_handler handler;
+    shared_ptr<peer> remote;
+    uint32_t remote_channel = 0;
+    deque<posted_recv> recvs;
+    /** Messages that arrived before a receive was posted for them */
+    deque<unexpected_message> unexpected;
+    /** Operations posted and not yet completed or failed, and receives
+     * whose buffers are being filled */
+    int in_flight = 0;
+    atomic<bool> closed{false};
+
+    channel_state(uint32_t id, completion_handler handler) : id(id), handler(std::move(handler)) {}
+};
+
+/** An operation waiting to be sent */
+struct outgoing {
+    header hdr;
+    const char* data = nullptr;
+    size_t size = 0;
+    /** The payload, if it is a copy (READ_RESPONSE) */
+    unique_ptr<char[]> owned;
+    /** The channel the operation counts as in flight for, or null */
+    shared_ptr<channel_state> channel;
+    bool signaled = false;
+    op_type op = op_type::WRITE;
+    uint64_t context = 0;
+    /** Superseded by a later write of the same data before it was sent */
+    bool cancelled = false;
+    /** Whether the operation is done once sent (not a READ_REQUEST) */
+    bool done_when_sent = true;
+};
+
+struct pending_read {
+    char* buf;
+    size_t size;
+    uint64_t context;
+    shared_ptr<channel_state> channel;
+};
+
+/** A completion to deliver, and the in-flight operation it ends */
+struct finished {
+    shared_ptr<channel_state> channel;
+    bool fire;
+    completion c;
+};
+
+/** A TCP connection to a remote node */
+struct peer {
+    /** Learned from its HELLO, if it connected to us */
+    uint32_t node_id = 0;
+    /** Its listening port, which tells the processes of a node apart */
+    uint16_t port = 0;
+    const int fd;
+    bool said_hello = false;
+
+    // guarded by the engine mutex
+    bool alive = true;
+    vector<outgoing> pending;
+    bool scheduled = false;
+    map<uint64_t, pending_read> reads;
+
+    // owned by the emulation thread
+    deque<outgoing> outbox;
+    size_t front_sent = 0;
+    bool want_out = false;
+    unique_ptr<char[]> inbuf{new char[input_buffer_size]};
+    size_t in_pos = 0;
+    size_t in_end = 0;
+    bool have_header = false;
+    header in_hdr;
+    char* in_dest = nullptr;
+    size_t in_left = 0;
+    shared_ptr<region> in_region;
+    shared_ptr<channel_state> in_channel;
+    bool in_matched = false;
+    posted_recv in_recv;
+    unexpected_message in_unexpected;
+    pending_read in_read;
+    bool in_read_valid = false;
+
+    explicit peer(int fd) : fd(fd) {}
+};
+
+struct engine {
+    mutex m;
+    condition_variable cv;
+    int users = 0;
+    uint32_t my_id = 0;
+    int listen_fd = -1;
+    int event_fd = -1;
+    int epoll_fd = -1;
+    uint16_t port = 0;
+    thread worker;
+    atomic<bool> stopping{false};
+    uint32_t next_key = 1;
+    uint32_t next_channel = 1;
+    uint64_t next_request = 1;
+    unordered_map<uint32_t, shared_ptr<region>> regions;
+    unordered_map<uint32_t, shared_ptr<channel_state>> channels;
+    /** The live connection to each node that has one */
+    map<uint32_t, shared_ptr<peer>> peers;
+    /** Nodes this process is connecting to */
+    set<uint32_t> connecting;
+    /** Connections made by other threads, for the emulation thread to watch */
+    vector<shared_ptr<peer>> new_peers;
+    /** Connections with pending operations */
+    vector<shared_ptr<peer>> ready;
+    /** Completions found outside the emulation thread */
+    vector<finished> deferred;
+};
+
+// never destroyed, so that SST and RDMC can shut it down from their own
+// static destructors, and an exit without shutdown() doesn't terminate on the
+// running thread
+engine& eng = *new engine;
+
+void wake() {
+    uint64_t one = 1;
+    ssize_t ret = ::write(eng.event_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void set_nodelay(int fd) {
+    int optval = 1;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval))) {
+        fprintf(stderr, "WARNING: Failed to disable Nagle's algorithm, continue without TCP_NODELAY...\n");
+    }
+}
+
+void watch(int fd, bool want_out) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.fd = fd;
+    event.events = want_out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    if(epoll_ctl(eng.epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        epoll_ctl(eng.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/** Connects to a remote node and introduces this node, blocking */
+int connect_to(const string& ip, uint16_t port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        hostent* server = gethostbyname(ip.c_str());
+        if(server == nullptr) return -1;
+        memcpy(&addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    }
+    const auto deadline = chrono::steady_clock::now() + connect_timeout;
+    int fd = -1;
+    while(true) {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) return -1;
+        if(::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) break;
+        close(fd);
+        if(chrono::steady_clock::now() > deadline) return -1;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    set_nodelay(fd);
+
+    header hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = msg_type::HELLO;
+    hello.port = eng.port;
+    hello.id = eng.my_id;
+    size_t sent = 0;
+    while(sent < sizeof(hello)) {
+        ssize_t n = ::write(fd, (char*)&hello + sent, sizeof(hello) - sent);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += n;
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+/** Gets the live connection to a node, waiting for or making it */
+shared_ptr<peer> get_peer(uint32_t remote_id, const string& remote_ip, uint16_t remote_port) {
+    unique_lock<mutex> lock(eng.m);
+    auto match = [&]() -> shared_ptr<peer> {
+        auto it = eng.peers.find(remote_id);
+        if(it != eng.peers.end() && it->second->alive && it->second->port == remote_port) {
+            return it->second;
+        }
+        return nullptr;
+    };
+    if(eng.my_id > remote_id) {
+        eng.cv.wait_for(lock, connect_timeout, [&]() { return match() || eng.stopping; });
+        return match();
+    }
+    eng.cv.wait(lock, [&]() { return eng.connecting.count(remote_id) == 0; });
+    if(auto p = match()) return p;
+    eng.connecting.insert(remote_id);
+    lock.unlock();
+    const int fd = connect_to(remote_ip, remote_port);
+    lock.lock();
+    eng.connecting.erase(remote_id);
+    eng.cv.notify_all();
+    if(fd < 0) return nullptr;
+    auto p = make_shared<peer>(fd);
+    p->node_id = remote_id;
+    p->port = remote_port;
+    p->said_hello = true;
+    eng.peers[remote_id] = p;
+    eng.new_peers.push_back(p);
+    wake();
+    return p;
+}
+
+/** Queues an operation on a channel's connection */
+bool post(uint32_t channel_id, outgoing&& op) {
+    bool need_wake = false;
+    {
+        lock_guard<mutex> lock(eng.m);
+        auto it = eng.channels.find(channel_id);
+        if(it == eng.channels.end()) return false;
+        shared_ptr<channel_state> state = it->second;
+        shared_ptr<peer> p = state->remote;
+        if(!p || !p->alive) return false;
+        if(op.hdr.type == msg_type::WRITE && !op.signaled) {
+            // the data is read when it is sent, so an unsent write of the
+            // same bytes to the same place carries nothing new
+            for(outgoing& queued : p->pending) {
+                if(!queued.cancelled && queued.hdr.type == msg_type::WRITE && !queued.signaled
+                   && queued.data == op.data && queued.size == op.size
+                   && queued.hdr.key == op.hdr.key && queued.hdr.offset == op.hdr.offset) {
+                    queued.cancelled = true;
+                    queued.channel->in_flight--;
+                    eng.cv.notify_all();
+                }
+            }
+        }
+        if(op.hdr.type == msg_type::SEND) {
+            op.hdr.id = state->remote_channel;
+        }
+        if(op.hdr.type == msg_type::READ_REQUEST) {
+            op.hdr.request = eng.next_request++;
+            p->reads[op.hdr.request] = {const_cast<char*>(op.data), op.size, op.context, state};
+            op.data = nullptr;
+            op.size = 0;
+            op.done_when_sent = false;
+        }
+        op.channel = state;
+        state->in_flight++;
+        p->pending.push_back(std::move(op));
+        if(!p->scheduled) {
+            p->scheduled = true;
+            eng.ready.push_back(p);
+            need_wake = true;
+        }
+    }
+    if(need_wake) wake();
+    return true;
+}
+
+void deliver(vector<finished>& done) {
+    for(finished& f : done) {
+        if(f.fire && !f.channel->closed) {
+            f.channel->handler(f.c);
+        }
+    }
+    if(done.empty()) return;
+    {
+        lock_guard<mutex> lock(eng.m);
+        for(finished& f : done) {
+            f.channel->in_flight--;
+        }
+    }
+    eng.cv.notify_all();
+    done.clear();
+}
+
+/** Ends an operation that was queued or sent, successfully or not */
+void end_outgoing(outgoing& op, bool success, vector<finished>& done) {
+    // a READ_REQUEST ends with its response, or with its entry in reads
+    if(!op.channel || op.cancelled || !op.done_when_sent) return;
+    done.push_back({op.channel, op.signaled || !success,
+                    {op.op, op.context, 0, 0, success}});
+}
+
+/**
+ * Writes as much of a connection's outbox as the socket takes.
+ * @return False if the connection broke
+ */
+bool flush(peer& p, vector<finished>& done) {
+    iovec iov[IOV_MAX];
+    while(!p.outbox.empty()) {
+        int count = 0;
+        size_t skip = p.front_sent;
+        for(auto it = p.outbox.begin(); it != p.outbox.end() && count + 2 <= IOV_MAX; ++it) {
+            if(skip < sizeof(header)) {
+                iov[count].iov_base = (char*)&it->hdr + skip;
+                iov[count].iov_len = sizeof(header) - skip;
+                ++count;
+                skip = 0;
+            } else {
+                skip -= sizeof(header);
+            }
+            if(it->size > skip) {
+                iov[count].iov_base = const_cast<char*>(it->data) + skip;
+                iov[count].iov_len = it->size - skip;
+                ++count;
+            }
+            skip = 0;
+        }
+        ssize_t n = ::writev(p.fd, iov, count);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                if(!p.want_out) {
+                    p.want_out = true;
+                    watch(p.fd, true);
+                }
+                return true;
+            }
+            return false;
+        }
+        size_t written = n;
+        while(written > 0) {
+            outgoing& front = p.outbox.front();
+            const size_t remaining = sizeof(header) + front.size - p.front_sent;
+            if(written < remaining) {
+                p.front_sent += written;
+                break;
+            }
+            written -= remaining;
+            p.front_sent = 0;
+            end_outgoing(front, true, done);
+            p.outbox.pop_front();
+        }
+    }
+    if(p.want_out) {
+        p.want_out = false;
+        watch(p.fd, false);
+    }
+    return true;
+}
+
+/** Decides where the payload of the message whose header was just read
+ * goes, and handles the messages that have none */
+void start_message(peer& p) {
+    header& hdr = p.in_hdr;
+    p.in_dest = nullptr;
+    p.in_left = (hdr.type == msg_type::READ_REQUEST) ? 0 : hdr.length;
+    lock_guard<mutex> lock(eng.m);
+    switch(hdr.type) {
+        case msg_type::HELLO: {
+            p.node_id = hdr.id;
+            p.port = hdr.port;
+            p.said_hello = true;
+            p.in_left = 0;
+            break;
+        }
+        case msg_type::WRITE: {
+            auto it = eng.regions.find(hdr.key);
+            if(it != eng.regions.end() && hdr.offset + hdr.length <= it->second->size) {
+                p.in_region = it->second;
+                p.in_region->writers++;
+                p.in_dest = p.in_region->buf + hdr.offset;
+            } else {
+                cerr << "WARNING: dropped an emulated write to an unknown or too small region" << endl;
+            }
+            break;
+        }
+        case msg_type::SEND: {
+            auto it = eng.channels.find(hdr.id);
+            if(it == eng.channels.end()) break;
+            p.in_channel = it->second;
+            p.in_matched = false;
+            if(!p.in_channel->recvs.empty()) {
+                p.in_recv = p.in_channel->recvs.front();
+                p.in_channel->recvs.pop_front();
+                p.in_matched = true;
+                p.in_channel->in_flight++;
+                if(hdr.length <= p.in_recv.size) {
+                    p.in_dest = p.in_recv.buf;
+                }
+            } else {
+                p.in_unexpected.data.resize(hdr.length);
+                p.in_unexpected.immediate = hdr.immediate;
+                p.in_dest = p.in_unexpected.data.data();
+            }
+            break;
+        }
+        case msg_type::READ_REQUEST: {
+            outgoing response;
+            memset(&response.hdr, 0, sizeof(header));
+            response.hdr.type = msg_type::READ_RESPONSE;
+            response.hdr.request = hdr.request;
+            auto it = eng.regions.find(hdr.key);
+            if(it != eng.regions.end() && hdr.offset + hdr.length <= it->second->size) {
+                response.owned.reset(new char[hdr.length]);
+                memcpy(response.owned.get(), it->second->buf + hdr.offset, hdr.length);
+                response.data = response.owned.get();
+                response.size = hdr.length;
+                response.hdr.success = 1;
+            }
+            response.hdr.length = response.size;
+            p.outbox.push_back(std::move(response));
+            break;
+        }
+        case msg_type::READ_RESPONSE: {
+            auto it = p.reads.find(hdr.request);
+            if(it == p.reads.end()) break;
+            p.in_read = it->second;
+            p.in_read_valid = true;
+            p.reads.erase(it);
+            if(hdr.success && hdr.length == p.in_read.size) {
+                p.in_dest = p.in_read.buf;
+            }
+            break;
+        }
+    }
+}
+
+/** Completes the message whose payload was just read */
+void finish_message(peer& p, vector<finished>& done) {
+    header& hdr = p.in_hdr;
+    lock_guard<mutex> lock(eng.m);
+    switch(hdr.type) {
+        case msg_type::WRITE:
+            if(p.in_region) {
+                p.in_region->writers--;
+                p.in_region.reset();
+                eng.cv.notify_all();
+            }
+            break;
+        case msg_type::SEND:
+            if(!p.in_channel) break;
+            if(p.in_matched) {
+                done.push_back({p.in_channel, true,
+                                {op_type::RECV, p.in_recv.context, hdr.length, hdr.immediate,
+                                 p.in_dest != nullptr}});
+            } else if(!p.in_channel->recvs.empty()) {
+                // a receive was posted while the message arrived
+                posted_recv recv = p.in_channel->recvs.front();
+                p.in_channel->recvs.pop_front();
+                const bool fits = hdr.length <= recv.size;
+                if(fits) {
+                    memcpy(recv.buf, p.in_unexpected.data.data(), hdr.length);
+                }
+                p.in_channel->in_flight++;
+                done.push_back({p.in_channel, true,
+                                {op_type::RECV, recv.context, hdr.length, hdr.immediate, fits}});
+            } else if(!p.in_channel->closed) {
+                p.in_channel->unexpected.push_back(std::move(p.in_unexpected));
+            }
+            p.in_unexpected = unexpected_message();
+            p.in_channel.reset();
+            break;
+        case msg_type::READ_RESPONSE:
+            if(p.in_read_valid) {
+                done.push_back({p.in_read.channel, true,
+                                {op_type::READ, p.in_read.context, p.in_read.size, 0,
+                                 p.in_dest != nullptr}});
+                p.in_read = pending_read();
+                p.in_read_valid = false;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Reads and handles everything that has arrived on a connection.
+ * @return False if the connection broke or was closed
+ */
+bool receive(peer& p, vector<finished>& done) {
+    while(true) {
+        if(!p.have_header) {
+            if(p.in_end - p.in_pos >= sizeof(header)) {
+                memcpy(&p.in_hdr, p.inbuf.get() + p.in_pos, sizeof(header));
+                p.in_pos += sizeof(header);
+                if(p.said_hello == (p.in_hdr.type == msg_type::HELLO)) {
+                    // a HELLO must come first, and only once
+                    return false;
+                }
+                p.have_header = true;
+                start_message(p);
+                continue;
+            }
+            if(p.in_pos > 0) {
+                memmove(p.inbuf.get(), p.inbuf.get() + p.in_pos, p.in_end - p.in_pos);
+                p.in_end -= p.in_pos;
+                p.in_pos = 0;
+            }
+            ssize_t n = ::read(p.fd, p.inbuf.get() + p.in_end, input_buffer_size - p.in_end);
+            if(n == 0) return false;
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            p.in_end += n;
+            continue;
+        }
+        if(p.in_left == 0) {
+            p.have_header = false;
+            finish_message(p, done);
+            continue;
+        }
+        const size_t available = p.in_end - p.in_pos;
+        if(available > 0) {
+            const size_t n = std::min(available, p.in_left);
+            if(p.in_dest) {
+                memcpy(p.in_dest, p.inbuf.get() + p.in_pos, n);
+                p.in_dest += n;
+            }
+            p.in_pos += n;
+            p.in_left -= n;
+            continue;
+        }
+        p.in_pos = p.in_end = 0;
+        // large payloads go straight to where they belong
+        const bool direct = p.in_dest && p.in_left >= input_buffer_size / 2;
+        ssize_t n = direct ? ::read(p.fd, p.in_dest, p.in_left)
+                           : ::read(p.fd, p.inbuf.get(), input_buffer_size);
+        if(n == 0) return false;
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if(direct) {
+            p.in_dest += n;
+            p.in_left -= n;
+        } else {
+            p.in_end = n;
+        }
+    }
+}
+
+/** Closes a broken connection and fails everything that was waiting on it */
+void drop(peer& p, vector<finished>& done) {
+    epoll_ctl(eng.epoll_fd, EPOLL_CTL_DEL, p.fd, NULL);
+    close(p.fd);
+    lock_guard<mutex> lock(eng.m);
+    p.alive = false;
+    auto it = eng.peers.find(p.node_id);
+    if(p.said_hello && it != eng.peers.end() && it->second.get() == &p) {
+        eng.peers.erase(it);
+    }
+    for(outgoing& op : p.pending) {
+        end_outgoing(op, false, done);
+    }
+    p.pending.clear();
+    for(outgoing& op : p.outbox) {
+        end_outgoing(op, false, done);
+    }
+    p.outbox.clear();
+    for(auto& read : p.reads) {
+        done.push_back({read.second.channel, true, {op_type::READ, read.second.context, 0, 0, false}});
+    }
+    p.reads.clear();
+    if(p.have_header) {
+        if(p.in_region) {
+            p.in_region->writers--;
+            p.in_region.reset();
+        }
+        if(p.in_channel && p.in_matched) {
+            done.push_back({p.in_channel, true, {op_type::RECV, p.in_recv.context, 0, 0, false}});
+        }
+        p.in_channel.reset();
+        if(p.in_read_valid) {
+            done.push_back({p.in_read.channel, true, {op_type::READ, p.in_read.context, 0, 0, false}});
+            p.in_read_valid = false;
+        }
+    }
+    eng.cv.notify_all();
+}
+
+void run() {
+    unordered_map<int, shared_ptr<peer>> by_fd;
+    vector<finished> done;
+    epoll_event events[64];
+    while(!eng.stopping) {
+        int num_events = epoll_wait(eng.epoll_fd, events, 64, -1);
+        if(num_events < 0 && errno != EINTR) {
+            cerr << "WARNING: epoll_wait failed in the TCP emulation thread: " << strerror(errno) << endl;
+        }
+        for(int i = 0; i < num_events; ++i) {
+            const int fd = events[i].data.fd;
+            if(fd == eng.listen_fd) {
+                int client;
+                while((client = accept4(eng.listen_fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    set_nodelay(client);
+                    by_fd[client] = make_shared<peer>(client);
+                    watch(client, false);
+                }
+            } else if(fd == eng.event_fd) {
+                uint64_t count;
+                ssize_t ret = ::read(eng.event_fd, &count, sizeof(count));
+                (void)ret;
+            } else {
+                auto it = by_fd.find(fd);
+                if(it == by_fd.end()) continue;
+                shared_ptr<peer> p = it->second;
+                bool ok = true;
+                if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    const bool was_hello = p->said_hello;
+                    ok = receive(*p, done);
+                    if(!was_hello && p->said_hello) {
+                        // if the node restarted, this replaces the connection
+                        // to its previous process
+                        lock_guard<mutex> lock(eng.m);
+                        eng.peers[p->node_id] = p;
+                        eng.cv.notify_all();
+                    }
+                }
+                // READ_RESPONSEs are queued by receive()
+                if(ok && (!p->outbox.empty() || (events[i].events & EPOLLOUT))) {
+                    ok = flush(*p, done);
+                }
+                if(!ok) {
+                    drop(*p, done);
+                    by_fd.erase(fd);
+                }
+            }
+        }
+
+        vector<shared_ptr<peer>> ready;
+        {
+            lock_guard<mutex> lock(eng.m);
+            for(auto& p : eng.new_peers) {
+                by_fd[p->fd] = p;
+                watch(p->fd, false);
+            }
+            eng.new_peers.clear();
+            ready.swap(eng.ready);
+            for(auto& p : ready) {
+                p->scheduled = false;
+                if(!p->alive) continue;
+                for(outgoing& op : p->pending) {
+                    if(!op.cancelled) p->outbox.push_back(std::move(op));
+                }
+                p->pending.clear();
+            }
+            for(finished& f : eng.deferred) {
+                done.push_back(std::move(f));
+            }
+            eng.deferred.clear();
+        }
+        // everything queued for a node since the last round goes out in one writev
+        for(auto& p : ready) {
+            if(p->alive && !flush(*p, done)) {
+                drop(*p, done);
+                by_fd.erase(p->fd);
+            }
+        }
+        deliver(done);
+    }
+    {
+        lock_guard<mutex> lock(eng.m);
+        for(auto& p : eng.new_peers) {
+            by_fd[p->fd] = p;
+        }
+        eng.new_peers.clear();
+    }
+    for(auto& entry : by_fd) {
+        drop(*entry.second, done);
+    }
+    deliver(done);
+}
+
+}  // namespace
+
+channel::~channel() {
+    unique_lock<mutex> lock(eng.m);
+    auto it = eng.channels.find(id);
+    if(it == eng.channels.end()) return;
+    shared_ptr<channel_state> state = it->second;
+    eng.channels.erase(it);
+    state->closed = true;
+    eng.cv.wait(lock, [&]() { return state->in_flight == 0; });
+    state->recvs.clear();
+    state->unexpected.clear();
+    state->remote.reset();
+}
+
+bool channel::connect(uint32_t remote_id, const string& remote_ip,
+                      uint16_t remote_port, uint32_t remote_channel) {
+    shared_ptr<peer> p = get_peer(remote_id, remote_ip, remote_port);
+    if(!p) return false;
+    lock_guard<mutex> lock(eng.m);
+    auto it = eng.channels.find(id);
+    if(it == eng.channels.end()) return false;
+    it->second->remote = p;
+    it->second->remote_channel = remote_channel;
+    return true;
+}
+
+bool channel::post_write(const char* buf, size_t size, uint32_t remote_key,
+                         uint64_t remote_offset, uint64_t context, bool signaled) {
+    outgoing op;
+    memset(&op.hdr, 0, sizeof(header));
+    op.hdr.type = msg_type::WRITE;
+    op.hdr.key = remote_key;
+    op.hdr.offset = remote_offset;
+    op.hdr.length = size;
+    op.data = buf;
+    op.size = size;
+    op.signaled = signaled;
+    op.op = op_type::WRITE;
+    op.context = context;
+    return post(id, std::move(op));
+}
+
+bool channel::post_read(char* buf, size_t size, uint32_t remote_key,
+                        uint64_t remote_offset, uint64_t context) {
+    outgoing op;
+    memset(&op.hdr, 0, sizeof(header));
+    op.hdr.type = msg_type::READ_REQUEST;
+    op.hdr.key = remote_key;
+    op.hdr.offset = remote_offset;
+    op.hdr.length = size;
+    // post() moves the buffer to the pending read
+    op.data = buf;
+    op.size = size;
+    op.signaled = true;
+    op.op = op_type::READ;
+    op.context = context;
+    return post(id, std::move(op));
+}
+
+bool channel::post_send(const char* buf, size_t size, uint32_t immediate,
+                        uint64_t context, bool signaled) {
+    outgoing op;
+    memset(&op.hdr, 0, sizeof(header));
+    op.hdr.type = msg_type::SEND;
+    op.hdr.immediate = immediate;
+    op.hdr.length = size;
+    op.data = buf;
+    op.size = size;
+    op.signaled = signaled;
+    op.op = op_type::SEND;
+    op.context = context;
+    return post(id, std::move(op));
+}
+
+bool channel::post_recv(char* buf, size_t size, uint64_t context) {
+    bool need_wake = false;
+    {
+        lock_guard<mutex> lock(eng.m);
+        auto it = eng.channels.find(id);
+        if(it == eng.channels.end()) return false;
+        shared_ptr<channel_state> state = it->second;
+        if(state->unexpected.empty()) {
+            state->recvs.push_back({buf, size, context});
+            return true;
+        }
+        // the completion may not be delivered here, since the caller may be
+        // a completion handler holding its own locks
+        unexpected_message& message = state->unexpected.front();
+        const size_t length = message.data.size();
+        const bool fits = length <= size;
+        if(fits) {
+            memcpy(buf, message.data.data(), length);
+        }
+        state->in_flight++;
+        eng.deferred.push_back({state, true, {op_type::RECV, context, length, message.immediate, fits}});
+        state->unexpected.pop_front();
+        need_wake = true;
+    }
+    if(need_wake) wake();
+    return true;
+}
+
+void initialize(uint32_t my_id) {
+    lock_guard<mutex> lock(eng.m);
+    if(eng.users++ > 0) return;
+    eng.my_id = my_id;
+    eng.stopping = false;
+
+    eng.listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(eng.listen_fd < 0) throw connection_failure();
+    int reuse_addr = 1;
+    setsockopt(eng.listen_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse_addr, sizeof(reuse_addr));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    // any free port: the nodes exchange them when they set up channels
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if(bind(eng.listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0
+       || listen(eng.listen_fd, 128) < 0
+       || getsockname(eng.listen_fd, (sockaddr*)&addr, &addr_len) < 0) {
+        fprintf(stderr, "ERROR on setting up the TCP emulation listener: %s\n", strerror(errno));
+        throw connection_failure();
+    }
+    eng.port = ntohs(addr.sin_port);
+    set_nonblocking(eng.listen_fd);
+
+    eng.event_fd = eventfd(0, EFD_NONBLOCK);
+    eng.epoll_fd = epoll_create1(0);
+    if(eng.event_fd < 0 || eng.epoll_fd < 0) throw connection_failure();
+    watch(eng.listen_fd, false);
+    watch(eng.event_fd, false);
+    eng.worker = thread(run);
+}
+
+void shutdown() {
+    {
+        lock_guard<mutex> lock(eng.m);
+        if(eng.users == 0 || --eng.users > 0) return;
+        eng.stopping = true;
+    }
+    wake();
+    if(eng.worker.joinable()) eng.worker.join();
+    lock_guard<mutex> lock(eng.m);
+    close(eng.listen_fd);
+    close(eng.event_fd);
+    close(eng.epoll_fd);
+    eng.listen_fd = eng.event_fd = eng.epoll_fd = -1;
+    eng.peers.clear();
+    eng.new_peers.clear();
+    eng.ready.clear();
+}
+
+uint16_t get_port() {
+    return eng.port;
+}
+
+uint32_t register_region(char* buf, size_t size) {
+    lock_guard<mutex> lock(eng.m);
+    const uint32_t key = eng.next_key++;
+    eng.regions[key] = make_shared<region>(buf, size);
+    return key;
+}
+
+void deregister_region(uint32_t key) {
+    unique_lock<mutex> lock(eng.m);
+    auto it = eng.regions.find(key);
+    if(it == eng.regions.end()) return;
+    shared_ptr<region> r = it->second;
+    eng.regions.erase(it);
+    eng.cv.wait(lock, [&]() { return r->writers == 0; });
+}
+
+unique_ptr<channel> create_channel(completion_handler handler) {
+    lock_guard<mutex> lock(eng.m);
+    const uint32_t id = eng.next_channel++;
+    eng.channels[id] = make_shared<channel_state>(id, std::move(handler));
+    return unique_ptr<channel>(new channel(id));
+}
+
+}  // namespace tcp::emulation
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/**
+ * Emulation of the RDMA operations SST and RDMC use (one-sided writes and
+ * reads, and two-sided sends with an immediate) over plain TCP, for clusters
+ * without RDMA hardware. A single thread per process serves every
+ * connection with epoll. Each remote node has one TCP connection, which all
+ * of the channels (the emulated queue pairs) to it share, and the operations
+ * queued for a node while the thread was busy go out together in one writev.
+ *
+ * Like the NIC, the thread reads the data of a write or send when it sends
+ * it, not when it is posted, so the memory must not be released before the
+ * operation completes. A write or send completes once the kernel has taken
+ * all of its data, and fails if the connection breaks first. All nodes must
+ * have the same byte order.
+ */
+namespace tcp::emulation {
+
+/** The operation an emulated completion is for */
+enum class op_type : uint8_t {
+    WRITE,
+    READ,
+    SEND,
+    RECV
+};
+
+struct completion {
+    op_type op;
+    /** The context the operation was posted with */
+    uint64_t context;
+    /** For receives, the size of the message that arrived */
+    std::size_t length;
+    /** For receives, the immediate the message was sent with */
+    uint32_t immediate;
+    /** False if the connection broke first, or a received message did not
+     * fit the posted buffer */
+    bool success;
+};
+
+using completion_handler = std::function<void(const completion&)>;
+
+/**
+ * One side of an emulated connection to a remote node. Completions of the
+ * operations posted on it, and of the receives, go to its handler, which is
+ * called by the emulation thread; the handler may post more operations.
+ */
+class channel {
+    const uint32_t id;
+
+    explicit channel(uint32_t id) : id(id) {}
+    friend std::unique_ptr<channel> create_channel(completion_handler handler);
+
+public:
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+    /** Waits until every operation posted on the channel has completed or
+     * failed, then drops the receives still posted, without completions. */
+    ~channel();
+
+    /** The ID that the remote side sends to this channel with */
+    uint32_t get_id() const { return id; }
+
+    /**
+     * Binds the channel to its remote side, connecting to the remote node
+     * first if this process has no connection to it. The node with the
+     * lower ID connects, and the other waits for it to, so both must call
+     * this at about the same time.
+     * @param remote_id The ID of the remote node
+     * @param remote_ip The IP address of the remote node
+     * @param remote_port The port the remote node emulates on, see get_port()
+     * @param remote_channel The ID of the remote side's channel
+     * @return False if the connection could not be made
+     */
+    bool connect(uint32_t remote_id, const std::string& remote_ip,
+                 uint16_t remote_port, uint32_t remote_channel);
+
+    /**
+     * Writes size bytes from buf to a remote region. There is no completion
+     * on the remote side.
+     * @param remote_key The key of the remote region, see register_region()
+     * @param remote_offset Where in the remote region to write
+     * @param signaled Whether the write has a completion
+     * @return False if the channel is not connected or the connection broke
+     */
+    bool post_write(const char* buf, std::size_t size, uint32_t remote_key,
+                    uint64_t remote_offset, uint64_t context, bool signaled);
+    /** Reads size bytes of a remote region into buf; always completes */
+    bool post_read(char* buf, std::size_t size, uint32_t remote_key,
+                   uint64_t remote_offset, uint64_t context);
+    /** Sends size bytes from buf to the oldest receive posted on the remote
+     * side, with an immediate for its completion */
+    bool post_send(const char* buf, std::size_t size, uint32_t immediate,
+                   uint64_t context, bool signaled);
+    /** Posts a buffer for a message from the remote side; receives are
+     * matched to messages in the order they are posted */
+    bool post_recv(char* buf, std::size_t size, uint64_t context);
+};
+
+/**
+ * Starts the emulation thread and its listening socket, if they are not
+ * running yet, and counts one more user (SST and RDMC each initialize it).
+ * @param my_id The ID of this node
+ */
+void initialize(uint32_t my_id);
+/** Stops the emulation thread and closes all connections when the last user
+ * calls it */
+void shutdown();
+/** The port this process accepts emulated connections on */
+uint16_t get_port();
+
+/**
+ * Lets remote nodes write to and read from size bytes at buf.
+ * @return The key that remote nodes address the region with
+ */
+uint32_t register_region(char* buf, std::size_t size);
+/** Stops remote access to a region, waiting for a write into it that is
+ * under way to finish */
+void deregister_region(uint32_t key);
+
+/** Creates a channel whose completions go to handler */
+std::unique_ptr<channel> create_channel(completion_handler handler);
+
+}  // namespace tcp::emulation
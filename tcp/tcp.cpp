@@ -10,6 +10,8 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <climits>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cassert>
@@ -169,6 +171,14 @@ bool socket::probe() {
     return count > 0;
 }
 
+size_t socket::bytes_available() {
+    int count = 0;
+    if(ioctl(sock, FIONREAD, &count) < 0) {
+        return 0;
+    }
+    return count;
+}
+
 bool socket::write(const char *buffer, size_t size) {
     if(sock < 0) {
         fprintf(stderr, "WARNING: Attempted to write to closed socket\n");
@@ -190,6 +200,124 @@ bool socket::write(const char *buffer, size_t size) {
     return true;
 }
 
+bool socket::writev(const std::vector<std::pair<const char *, size_t>> &buffers) {
+    if(sock < 0) {
+        fprintf(stderr, "WARNING: Attempted to write to closed socket\n");
+        return false;
+    }
+
+    std::vector<iovec> iovecs;
+    iovecs.reserve(buffers.size());
+    for(const auto &buffer : buffers) {
+        if(buffer.second > 0) {
+            iovecs.push_back(iovec{const_cast<char *>(buffer.first), buffer.second});
+        }
+    }
+    size_t next_iovec = 0;
+    while(next_iovec < iovecs.size()) {
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iovecs.data() + next_iovec;
+        message.msg_iovlen = std::min(iovecs.size() - next_iovec, (size_t)IOV_MAX);
+        //MSG_NOSIGNAL for the same reason as in write
+        ssize_t bytes_written = sendmsg(sock, &message, MSG_NOSIGNAL);
+        if(bytes_written == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cerr << "socket::writev: Error in the socket! Errno " << errno << std::endl;
+            return false;
+        }
+        //Skip the buffers that were sent completely, and the sent part of the next one
+        size_t remaining = bytes_written;
+        while(next_iovec < iovecs.size() && remaining >= iovecs[next_iovec].iov_len) {
+            remaining -= iovecs[next_iovec].iov_len;
+            ++next_iovec;
+        }
+        if(remaining > 0) {
+            iovecs[next_iovec].iov_base = static_cast<char *>(iovecs[next_iovec].iov_base) + remaining;
+            iovecs[next_iovec].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+buffered_writer::buffered_writer(socket &sock, size_t buffer_size) : sock(sock) {
+    buffer.reserve(buffer_size);
+}
+
+bool buffered_writer::write(const char *bytes, size_t size) {
+    if(size >= buffer.capacity()) {
+        success = sock.writev({{buffer.data(), buffer.size()}, {bytes, size}}) && success;
+        buffer.clear();
+        return success;
+    }
+    if(buffer.size() + size > buffer.capacity()) {
+        success = sock.write(buffer.data(), buffer.size()) && success;
+        buffer.clear();
+    }
+    buffer.insert(buffer.end(), bytes, bytes + size);
+    return success;
+}
+
+bool buffered_writer::flush() {
+    if(!buffer.empty()) {
+        success = sock.write(buffer.data(), buffer.size()) && success;
+        buffer.clear();
+    }
+    return success;
+}
+
+chunked_writer::chunked_writer(socket &sock, size_t chunk_size) : sock(sock) {
+    chunk.reserve(chunk_size);
+}
+
+void chunked_writer::send_chunk(const char *extra, size_t extra_size) {
+    const uint64_t size = chunk.size() + extra_size;
+    if(size == 0) {
+        return;
+    }
+    success = sock.writev({{reinterpret_cast<const char *>(&size), sizeof(size)},
+                           {chunk.data(), chunk.size()},
+                           {extra, extra_size}})
+              && success;
+    chunk.clear();
+}
+
+bool chunked_writer::write(const char *bytes, size_t size) {
+    if(size >= chunk.capacity()) {
+        send_chunk(bytes, size);
+        return success;
+    }
+    if(chunk.size() + size > chunk.capacity()) {
+        send_chunk(nullptr, 0);
+    }
+    chunk.insert(chunk.end(), bytes, bytes + size);
+    return success;
+}
+
+bool chunked_writer::finish() {
+    send_chunk(nullptr, 0);
+    const uint64_t end_marker = 0;
+    success = sock.write(end_marker) && success;
+    return success;
+}
+
+bool socket::read_chunked(std::vector<char> &buffer) {
+    uint64_t chunk_size;
+    while(read(chunk_size)) {
+        if(chunk_size == 0) {
+            return true;
+        }
+        const size_t offset = buffer.size();
+        buffer.resize(offset + chunk_size);
+        if(!read(buffer.data() + offset, chunk_size)) {
+            return false;
+        }
+    }
+    return false;
+}
+
 std::string socket::get_self_ip() {
     struct sockaddr_storage my_addr_info;
     socklen_t len = sizeof my_addr_info;
@@ -313,4 +441,47 @@ std::optional<socket> connection_listener::try_accept(int timeout_ms) {
 
 }
 
+socket_poller::socket_poller() : epoll_fd(epoll_create1(0)) {
+    if(epoll_fd < 0) throw connection_failure();
+}
+
+socket_poller::~socket_poller() {
+    close(epoll_fd);
+}
+
+static void add_to_epoll(int epoll_fd, int fd, uint64_t tag) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.u64 = tag;
+    event.events = EPOLLIN;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        throw connection_failure();
+    }
+}
+
+void socket_poller::add(const socket &s, uint64_t tag) {
+    add_to_epoll(epoll_fd, s.sock, tag);
+}
+
+void socket_poller::add(const connection_listener &listener, uint64_t tag) {
+    add_to_epoll(epoll_fd, *listener.fd, tag);
+}
+
+void socket_poller::remove(const socket &s) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s.sock, NULL);
+}
+
+std::vector<uint64_t> socket_poller::wait(int timeout_ms) {
+    epoll_event events[64];
+    int numfds;
+    do {
+        numfds = epoll_wait(epoll_fd, events, 64, timeout_ms);
+    } while(numfds < 0 && errno == EINTR);
+    std::vector<uint64_t> tags;
+    for(int i = 0; i < numfds; ++i) {
+        tags.push_back(events[i].data.u64);
+    }
+    return tags;
+}
+
 }  // namespace tcp
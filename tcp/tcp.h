@@ -4,6 +4,8 @@
 #include <memory>
 #include <string>
 #include <optional>
+#include <utility>
+#include <vector>
 
 namespace tcp {
 
@@ -18,6 +20,7 @@ class socket {
             : sock(_sock), remote_ip(remote_ip) {}
 
     friend class connection_listener;
+    friend class socket_poller;
     std::string remote_ip;
 
 public:
@@ -86,6 +89,13 @@ public:
     /** Returns true if there is any data available to be read from the socket. */
     bool probe();
 
+    /**
+     * Returns the number of bytes that can be read from the socket without
+     * blocking. After a socket_poller reports the socket readable, 0 means
+     * the remote end has closed the connection.
+     */
+    size_t bytes_available();
+
     /**
      * Writes size bytes from the given buffer to the socket.
      * @param buffer A pointer to a byte buffer whose data should be sent over
@@ -96,6 +106,24 @@ public:
      */
     bool write(const char* buffer, size_t size);
 
+    /**
+     * Writes several buffers to the socket, one after another, with as few
+     * system calls as the kernel allows (a single writev() if it takes them
+     * all at once).
+     * @param buffers The buffers to send, as (pointer, size) pairs, in order
+     * @return True if the write was successful, false if there was an error
+     * before all the bytes could be written.
+     */
+    bool writev(const std::vector<std::pair<const char*, size_t>>& buffers);
+
+    /**
+     * Reads a stream written by a chunked_writer, appending its chunks to
+     * buffer until the end marker.
+     * @return True if the whole stream was read, false if there was an error
+     * before its end marker
+     */
+    bool read_chunked(std::vector<char>& buffer);
+
     /**
      * Convenience method for sending a single POD object (e.g. an int) over
      * the socket.
@@ -130,8 +158,96 @@ public:
     }
 };
 
+/**
+ * Gathers many small writes to a socket into a few large ones, for sending
+ * an object that mutils::post_object hands over a field (or a log entry) at
+ * a time. Small pieces are copied into a buffer that is written out when it
+ * fills; a piece at least as large as the buffer is not copied, but written
+ * together with what was gathered before it in one writev(). Nothing is
+ * written for sure until flush() returns.
+ */
+class buffered_writer {
+    socket& sock;
+    std::vector<char> buffer;
+    /** False once any write to the socket has failed */
+    bool success = true;
+
+public:
+    static constexpr size_t default_buffer_size = 1024 * 1024;
+
+    explicit buffered_writer(socket& sock, size_t buffer_size = default_buffer_size);
+    buffered_writer(const buffered_writer&) = delete;
+    buffered_writer& operator=(const buffered_writer&) = delete;
+
+    /**
+     * Appends size bytes from the given buffer to the stream.
+     * @return False if a write to the socket has failed, now or before
+     */
+    bool write(const char* bytes, size_t size);
+
+    /** Appends a single POD object to the stream. */
+    template <typename T>
+    bool write(const T& obj) {
+        return write(reinterpret_cast<const char*>(&obj), sizeof(obj));
+    }
+
+    /** The write function to pass to mutils::post_object */
+    std::function<void(const char*, size_t)> post_function() {
+        return [this](const char* bytes, size_t size) { write(bytes, size); };
+    }
+
+    /**
+     * Writes whatever is still buffered to the socket.
+     * @return True if every write since the writer was constructed succeeded
+     */
+    bool flush();
+};
+
+/**
+ * Streams bytes to a socket as a sequence of chunks, each preceded by its
+ * size as a uint64_t and the last followed by a size of 0, so that an object
+ * can be sent as it is serialized, without computing its size first. Small
+ * pieces are gathered into a chunk of up to chunk_size bytes; a piece at
+ * least that large is sent without copying, as one chunk together with the
+ * bytes gathered before it. socket::read_chunked() reads the stream back.
+ */
+class chunked_writer {
+    socket& sock;
+    std::vector<char> chunk;
+    /** False once any write to the socket has failed */
+    bool success = true;
+
+    /** Sends the gathered bytes and then extra, as one chunk */
+    void send_chunk(const char* extra, size_t extra_size);
+
+public:
+    static constexpr size_t default_chunk_size = 1024 * 1024;
+
+    explicit chunked_writer(socket& sock, size_t chunk_size = default_chunk_size);
+    chunked_writer(const chunked_writer&) = delete;
+    chunked_writer& operator=(const chunked_writer&) = delete;
+
+    /**
+     * Appends size bytes from the given buffer to the stream.
+     * @return False if a write to the socket has failed, now or before
+     */
+    bool write(const char* bytes, size_t size);
+
+    /** The write function to pass to mutils::post_object */
+    std::function<void(const char*, size_t)> post_function() {
+        return [this](const char* bytes, size_t size) { write(bytes, size); };
+    }
+
+    /**
+     * Sends whatever is still gathered, and the end marker.
+     * @return True if every write since the writer was constructed succeeded
+     */
+    bool finish();
+};
+
 class connection_listener {
     std::unique_ptr<int, std::function<void(int*)>> fd;
+    friend class socket_poller;
 
 public:
     /**
@@ -158,5 +274,37 @@ public:
      */
     std::optional<socket> try_accept(int timeout_ms);
 };
+
+/**
+ * An epoll set of sockets and connection listeners, so that a single thread
+ * can wait for whichever of many connections has something to read next,
+ * instead of blocking in one socket's read while the others wait.
+ */
+class socket_poller {
+    int epoll_fd;
+
+public:
+    socket_poller();
+    socket_poller(const socket_poller&) = delete;
+    socket_poller& operator=(const socket_poller&) = delete;
+    ~socket_poller();
+
+    /** Watches a socket for incoming data; wait() reports it by tag. */
+    void add(const socket& s, uint64_t tag);
+    /** Watches a connection listener for incoming connections; wait()
+     * reports it by tag, and accept() will then not block. */
+    void add(const connection_listener& listener, uint64_t tag);
+    /** Stops watching a socket. Must be called before the socket is closed
+     * or moved into another object that will outlive its entry here. */
+    void remove(const socket& s);
+
+    /**
+     * Waits for any of the watched sockets or listeners to become readable.
+     * @param timeout_ms The longest time to wait, or -1 to wait forever
+     * @return The tags of the ones that are readable, which is empty if the
+     * timeout expired
+     */
+    std::vector<uint64_t> wait(int timeout_ms);
+};
 }  // namespace tcp
 